@@ -5,13 +5,13 @@ What this tests:
 - true_instance() returns the same pointer every time.
 - false_instance() returns the same pointer every time.
 - from(true/false) return the canonical singletons.
-- Operator lambdas (LT, EQ, AND, OR) produce canonical Boolean singletons.
+- Binary operators (LT, EQ, AND, OR) produce canonical Boolean singletons.
 */
 
 #include <cassert>
 #include <iostream>
 
-// Include interpreter implementation to access mitscript::BooleanValue and evaluate_lambdas
+// Include interpreter implementation to access mitscript::BooleanValue and evaluate
 #include "../../src/mitscript-interpreter/interpreter.cpp"
 
 using namespace mitscript;
@@ -29,25 +29,25 @@ int main() {
   assert(t1 != f1);
 
   CollectedHeap heap;
-  // Using operator lambdas
+  // Using binary operators
   // 1 < 2 => true singleton
-  Value* vlt = evaluate_lambdas.at(BinOp::LT)(
-      heap.allocate<IntegerValue>(1),
-      heap.allocate<IntegerValue>(2),
+  Value* vlt = evaluate(BinOp::LT,
+      int_immediate(1),
+      int_immediate(2),
       &heap);
   auto* blt = dynamic_cast<BooleanValue*>(vlt);
   assert(blt && blt == BooleanValue::true_instance());
 
   // 2 == 2 => true singleton
-  Value* veq = evaluate_lambdas.at(BinOp::EQ)(
-      heap.allocate<IntegerValue>(2),
-      heap.allocate<IntegerValue>(2),
+  Value* veq = evaluate(BinOp::EQ,
+      int_immediate(2),
+      int_immediate(2),
       &heap);
   auto* beq = dynamic_cast<BooleanValue*>(veq);
   assert(beq && beq == BooleanValue::true_instance());
 
   // true & false => false singleton
-  Value* vand = evaluate_lambdas.at(BinOp::AND)(
+  Value* vand = evaluate(BinOp::AND,
       BooleanValue::true_instance(),
       BooleanValue::false_instance(),
       &heap);
@@ -55,7 +55,7 @@ int main() {
   assert(band && band == BooleanValue::false_instance());
 
   // false | true => true singleton
-  Value* vor = evaluate_lambdas.at(BinOp::OR)(
+  Value* vor = evaluate(BinOp::OR,
       BooleanValue::false_instance(),
       BooleanValue::true_instance(),
       &heap);
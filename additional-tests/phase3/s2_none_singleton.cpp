@@ -28,7 +28,7 @@ int main() {
 
   // Interpreter path for NoneConstant returns singleton
   NoneConstant nc;
-  Interpreter interp;
+  Interpreter interp({"print", "input", "intcast"});
   interp.visit(&nc);
   assert(dynamic_cast<NoneValue*>(interp.rval_) && interp.rval_ == NoneValue::instance());
 
@@ -0,0 +1,490 @@
+// Microbenchmarks for the VM's primitives, in isolation from whole programs.
+//
+//   vm/<kernel>     a loop in a synthetic bytecode function, run by vm::VM.
+//                   Each iteration runs the kernel's body kBodyCopies times;
+//                   items/s counts bodies, so subtracting vm/loop's time per
+//                   item from a kernel's gives the cost of its body.
+//   heap/...        CollectedHeap used directly: allocation throughput per
+//                   Value type and minor versus full collection cost for
+//                   a few heap shapes.
+//
+// Build the mitscript-microbench target and run it with the usual Google
+// Benchmark flags, e.g. --benchmark_filter=vm/call.
+
+#include "bytecode/types.hpp"
+#include "gc/gc.hpp"
+#include "vm/interpreter.hpp"
+#include <benchmark/benchmark.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using bytecode::Operation;
+
+namespace {
+
+constexpr int kLoopIterations = 100000;
+constexpr int kBodyCopies = 8;
+
+// Builds one bytecode function by hand. Locals, constants and names are
+// added on first use; jumps are resolved to relative offsets.
+class FunctionBuilder {
+public:
+  explicit FunctionBuilder(uint32_t parameters = 0) : f_(new bytecode::Function()) {
+    f_->parameter_count_ = parameters;
+  }
+
+  bytecode::Function *function() const { return f_; }
+  int pc() const { return static_cast<int>(f_->instructions.size()); }
+
+  void emit(Operation op, std::optional<int32_t> operand = std::nullopt) {
+    f_->instructions.emplace_back(op, operand);
+  }
+  void jump_to(Operation op, int target) { emit(op, target - pc()); }
+  int jump_forward(Operation op) {
+    emit(op, 0);
+    return pc() - 1;
+  }
+  void land(int site) { f_->instructions[site].operand0 = pc() - site; }
+
+  int local(const std::string &name) { return index_of(f_->local_vars_, name); }
+  int name(const std::string &name) { return index_of(f_->names_, name); }
+  int local_ref(const std::string &name) { return index_of(f_->local_reference_vars_, name); }
+  int free_var(const std::string &name) { return index_of(f_->free_vars_, name); }
+  int function(bytecode::Function *child) {
+    f_->functions_.push_back(child);
+    return static_cast<int>(f_->functions_.size()) - 1;
+  }
+
+  int int_const(int32_t v) {
+    return constant("i" + std::to_string(v), [v] { return new bytecode::Constant::Integer(v); });
+  }
+  int string_const(const std::string &s) {
+    return constant("s" + s, [s] { return new bytecode::Constant::String(s); });
+  }
+  int none_const() {
+    return constant("n", [] { return new bytecode::Constant::None(); });
+  }
+
+  // Shorthands for the common sequences.
+  void load_local(const std::string &n) { emit(Operation::LoadLocal, local(n)); }
+  void store_local(const std::string &n) { emit(Operation::StoreLocal, local(n)); }
+  void load_int(int32_t v) { emit(Operation::LoadConst, int_const(v)); }
+  void load_string(const std::string &s) { emit(Operation::LoadConst, string_const(s)); }
+  void return_none() {
+    emit(Operation::LoadConst, none_const());
+    emit(Operation::Return);
+  }
+
+private:
+  static int index_of(std::vector<std::string> &list, const std::string &name) {
+    for (size_t i = 0; i < list.size(); ++i)
+      if (list[i] == name)
+        return static_cast<int>(i);
+    list.push_back(name);
+    return static_cast<int>(list.size()) - 1;
+  }
+
+  template <typename Make> int constant(const std::string &key, Make make) {
+    auto [it, inserted] = constants_.emplace(key, f_->constants_.size());
+    if (inserted)
+      f_->constants_.push_back(make());
+    return it->second;
+  }
+
+  bytecode::Function *f_;
+  std::unordered_map<std::string, int> constants_;
+};
+
+void free_program(bytecode::Function *f) {
+  for (bytecode::Function *child : f->functions_)
+    free_program(child);
+  for (bytecode::Constant *c : f->constants_)
+    delete c;
+  delete f;
+}
+
+struct Kernel {
+  const char *name;
+  std::function<void(FunctionBuilder &)> setup; // runs once before the loop
+  std::function<void(FunctionBuilder &)> body;  // repeated kBodyCopies times
+};
+
+// main() calls kernel(n), which runs `for (i = 0; i < n; i++) body`.
+// Functions 0-2 of main are the natives, as the compiler lays them out.
+bytecode::Function *build_program(const Kernel &kernel) {
+  FunctionBuilder k(1);
+  k.local("n");
+  k.load_int(0);
+  k.store_local("i");
+  if (kernel.setup)
+    kernel.setup(k);
+
+  int head = k.pc();
+  k.load_local("i");
+  k.load_local("n");
+  k.emit(Operation::Swap);
+  k.emit(Operation::Gt);
+  k.emit(Operation::Not);
+  int exit = k.jump_forward(Operation::If);
+  for (int copy = 0; copy < kBodyCopies; ++copy)
+    kernel.body(k);
+  k.load_local("i");
+  k.load_int(1);
+  k.emit(Operation::Add);
+  k.store_local("i");
+  k.jump_to(Operation::Goto, head);
+  k.land(exit);
+  k.return_none();
+
+  FunctionBuilder main;
+  main.function(FunctionBuilder(1).function()); // print
+  main.function(FunctionBuilder(0).function()); // input
+  main.function(FunctionBuilder(1).function()); // intcast
+  main.emit(Operation::LoadFunc, main.function(k.function()));
+  main.emit(Operation::AllocClosure, 0);
+  main.load_int(kLoopIterations);
+  main.emit(Operation::Call, 1);
+  main.emit(Operation::Pop);
+  main.return_none();
+  return main.function();
+}
+
+void run_kernel(benchmark::State &state, const Kernel &kernel) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    bytecode::Function *program = build_program(kernel);
+    {
+      vm::VM machine;
+      state.ResumeTiming();
+      machine.run(program);
+      state.PauseTiming();
+    }
+    free_program(program);
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * kLoopIterations * kBodyCopies);
+}
+
+// c = a op b, with a and b small integers.
+Kernel arithmetic(const char *name, Operation op) {
+  return {name,
+          [](FunctionBuilder &k) {
+            k.load_int(3);
+            k.store_local("a");
+            k.load_int(1);
+            k.store_local("b");
+          },
+          [op](FunctionBuilder &k) {
+            k.load_local("a");
+            k.load_local("b");
+            k.emit(op);
+            k.store_local("c");
+          }};
+}
+
+// c = (x == y) for the values setup leaves in x and y.
+Kernel equality(const char *name, std::function<void(FunctionBuilder &)> setup) {
+  return {name, std::move(setup), [](FunctionBuilder &k) {
+            k.load_local("x");
+            k.load_local("y");
+            k.emit(Operation::Eq);
+            k.store_local("c");
+          }};
+}
+
+// r = {}, then r[key(j)] = j for j in [0, 16).
+Kernel record_kernel(const char *name, bool string_keys, bool store) {
+  auto key = [string_keys](FunctionBuilder &k, int j) {
+    if (string_keys)
+      k.load_string("k" + std::to_string(j));
+    else
+      k.load_int(j);
+  };
+  return {name,
+          [key](FunctionBuilder &k) {
+            k.emit(Operation::AllocRecord);
+            k.store_local("r");
+            for (int j = 0; j < 16; ++j) {
+              k.load_local("r");
+              key(k, j);
+              k.load_int(j);
+              k.emit(Operation::IndexStore);
+            }
+          },
+          [key, store](FunctionBuilder &k) {
+            k.load_local("r");
+            key(k, 7);
+            if (store) {
+              k.load_local("i");
+              k.emit(Operation::IndexStore);
+            } else {
+              k.emit(Operation::IndexLoad);
+              k.store_local("c");
+            }
+          }};
+}
+
+// c = f(i), for f a plain function or a closure over a local of the caller.
+Kernel call_kernel(const char *name, bool closure) {
+  return {name,
+          [closure](FunctionBuilder &k) {
+            FunctionBuilder f(1);
+            f.local("x");
+            if (closure) {
+              f.emit(Operation::PushReference, f.free_var("captured"));
+              f.emit(Operation::LoadReference);
+            } else {
+              f.load_int(1);
+            }
+            f.load_local("x");
+            f.emit(Operation::Add);
+            f.emit(Operation::Return);
+
+            if (closure) {
+              // As the compiler lays it out, a captured local is both a
+              // local and a local reference.
+              k.load_int(1);
+              k.store_local("captured");
+              k.emit(Operation::LoadFunc, k.function(f.function()));
+              k.emit(Operation::PushReference, k.local_ref("captured"));
+              k.emit(Operation::AllocClosure, 1);
+            } else {
+              k.emit(Operation::LoadFunc, k.function(f.function()));
+              k.emit(Operation::AllocClosure, 0);
+            }
+            k.store_local("f");
+          },
+          [](FunctionBuilder &k) {
+            k.load_local("f");
+            k.load_local("i");
+            k.emit(Operation::Call, 1);
+            k.store_local("c");
+          }};
+}
+
+std::vector<Kernel> kernels() {
+  auto store_pair = [](auto load_x, auto load_y) {
+    return [=](FunctionBuilder &k) {
+      load_x(k);
+      k.store_local("x");
+      load_y(k);
+      k.store_local("y");
+    };
+  };
+  auto concat = [](const char *left, const char *right) {
+    return [=](FunctionBuilder &k) {
+      k.load_string(left);
+      k.load_string(right);
+      k.emit(Operation::Add);
+    };
+  };
+
+  return {
+      {"loop", nullptr, [](FunctionBuilder &) {}},
+      {"load_const", nullptr,
+       [](FunctionBuilder &k) {
+         k.load_int(7);
+         k.store_local("c");
+       }},
+      {"global",
+       [](FunctionBuilder &k) {
+         k.load_int(1);
+         k.emit(Operation::StoreGlobal, k.name("g"));
+       },
+       [](FunctionBuilder &k) {
+         k.emit(Operation::LoadGlobal, k.name("g"));
+         k.emit(Operation::StoreGlobal, k.name("g"));
+       }},
+      arithmetic("add", Operation::Add),
+      arithmetic("sub", Operation::Sub),
+      arithmetic("mul", Operation::Mul),
+      arithmetic("div", Operation::Div),
+      arithmetic("gt", Operation::Gt),
+      {"not",
+       [](FunctionBuilder &k) {
+         k.load_int(0);
+         k.load_int(1);
+         k.emit(Operation::Gt);
+         k.store_local("t");
+       },
+       [](FunctionBuilder &k) {
+         k.load_local("t");
+         k.emit(Operation::Not);
+         k.store_local("t");
+       }},
+      equality("eq/int", store_pair([](auto &k) { k.load_int(5); },
+                                    [](auto &k) { k.load_int(5); })),
+      equality("eq/string", store_pair(concat("ab", "cd"), concat("a", "bcd"))),
+      equality("eq/mixed", store_pair([](auto &k) { k.load_int(5); },
+                                      [](auto &k) { k.load_string("5"); })),
+      equality("eq/record", store_pair([](auto &k) { k.emit(Operation::AllocRecord); },
+                                       [](auto &k) { k.emit(Operation::AllocRecord); })),
+      {"field_load",
+       [](FunctionBuilder &k) {
+         k.emit(Operation::AllocRecord);
+         k.store_local("r");
+         k.load_local("r");
+         k.load_int(1);
+         k.emit(Operation::FieldStore, k.name("x"));
+       },
+       [](FunctionBuilder &k) {
+         k.load_local("r");
+         k.emit(Operation::FieldLoad, k.name("x"));
+         k.store_local("c");
+       }},
+      {"field_store",
+       [](FunctionBuilder &k) {
+         k.emit(Operation::AllocRecord);
+         k.store_local("r");
+       },
+       [](FunctionBuilder &k) {
+         k.load_local("r");
+         k.load_local("i");
+         k.emit(Operation::FieldStore, k.name("x"));
+       }},
+      record_kernel("record/dense_load", false, false),
+      record_kernel("record/dense_store", false, true),
+      record_kernel("record/map_load", true, false),
+      record_kernel("record/map_store", true, true),
+      call_kernel("call/function", false),
+      call_kernel("call/closure", true),
+  };
+}
+
+// --- CollectedHeap ----------------------------------------------------------
+
+constexpr int kAllocBatch = 4096;
+
+template <typename Make> void allocate_batch(benchmark::State &state, Make make) {
+  CollectedHeap heap;
+  std::vector<Collectable *> no_roots;
+  for (auto _ : state) {
+    for (int i = 0; i < kAllocBatch; ++i)
+      benchmark::DoNotOptimize(make(heap, i));
+    state.PauseTiming();
+    heap.minor_gc(no_roots.begin(), no_roots.end());
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * kAllocBatch);
+}
+
+void BM_AllocateInteger(benchmark::State &state) {
+  allocate_batch(state, [](CollectedHeap &h, int i) { return h.allocate<vm::Integer>(i); });
+}
+void BM_AllocateString(benchmark::State &state) {
+  allocate_batch(state, [](CollectedHeap &h, int) {
+    return h.allocate<vm::String>(std::string("a short string"));
+  });
+}
+void BM_AllocateRecord(benchmark::State &state) {
+  allocate_batch(state, [](CollectedHeap &h, int) { return h.allocate<vm::Record>(nullptr); });
+}
+void BM_AllocateReference(benchmark::State &state) {
+  allocate_batch(state, [](CollectedHeap &h, int) { return h.allocate<vm::Reference>(vm::TaggedValue::none()); });
+}
+void BM_AllocateClosure(benchmark::State &state) {
+  allocate_batch(state, [](CollectedHeap &h, int) {
+    return h.allocate_sized<vm::Closure>(vm::Closure::size_for(0), nullptr, 0u);
+  });
+}
+BENCHMARK(BM_AllocateInteger)->Name("heap/allocate/integer");
+BENCHMARK(BM_AllocateString)->Name("heap/allocate/string");
+BENCHMARK(BM_AllocateRecord)->Name("heap/allocate/record");
+BENCHMARK(BM_AllocateReference)->Name("heap/allocate/reference");
+BENCHMARK(BM_AllocateClosure)->Name("heap/allocate/closure");
+
+enum HeapShape { Array, List, Tree };
+
+vm::TaggedValue heap_ref(vm::Value *v) { return vm::TaggedValue::from_heap(v); }
+
+// Builds `live` reachable objects of the given shape, returning the root.
+vm::Value *build_heap(CollectedHeap &heap, HeapShape shape, int live) {
+  switch (shape) {
+  case Array: {
+    // One record holding every object: wide and shallow.
+    auto root = heap.allocate<vm::Record>(nullptr);
+    for (int i = 1; i < live; ++i)
+      root->dense.push_back(heap_ref(heap.allocate<vm::Integer>(i)));
+    return root;
+  }
+  case List: {
+    // A chain of records: one object deep per object.
+    vm::Record *head = nullptr;
+    for (int i = 0; i < live; ++i) {
+      auto node = heap.allocate<vm::Record>(nullptr);
+      if (head)
+        node->dense.push_back(heap_ref(head));
+      head = node;
+    }
+    return head;
+  }
+  case Tree: {
+    // A complete binary tree, built bottom up.
+    std::vector<vm::Record *> level;
+    for (int i = 0; i < (live + 1) / 2; ++i)
+      level.push_back(heap.allocate<vm::Record>(nullptr));
+    while (level.size() > 1) {
+      std::vector<vm::Record *> parents;
+      for (size_t i = 0; i < level.size(); i += 2) {
+        auto parent = heap.allocate<vm::Record>(nullptr);
+        parent->dense.push_back(heap_ref(level[i]));
+        if (i + 1 < level.size())
+          parent->dense.push_back(heap_ref(level[i + 1]));
+        parents.push_back(parent);
+      }
+      level = std::move(parents);
+    }
+    return level[0];
+  }
+  }
+  return nullptr;
+}
+
+// Times one collection over a heap of range(1) live objects of shape
+// range(0), after range(2) young objects of garbage have been allocated.
+template <bool Full> void BM_Collect(benchmark::State &state) {
+  auto shape = static_cast<HeapShape>(state.range(0));
+  int live = static_cast<int>(state.range(1));
+  int garbage = static_cast<int>(state.range(2));
+
+  CollectedHeap heap;
+  std::vector<Collectable *> roots{build_heap(heap, shape, live)};
+  heap.full_gc(roots.begin(), roots.end()); // promote the live objects
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (int i = 0; i < garbage; ++i)
+      heap.allocate<vm::Integer>(i);
+    state.ResumeTiming();
+    if (Full)
+      heap.full_gc(roots.begin(), roots.end());
+    else
+      heap.minor_gc(roots.begin(), roots.end());
+  }
+  state.counters["live"] = live;
+}
+
+void collect_args(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"shape", "live", "garbage"});
+  for (int shape : {Array, List, Tree})
+    for (int live : {1 << 10, 1 << 16})
+      b->Args({shape, live, 1 << 14});
+}
+BENCHMARK(BM_Collect<false>)->Name("heap/minor_gc")->Apply(collect_args);
+BENCHMARK(BM_Collect<true>)->Name("heap/full_gc")->Apply(collect_args);
+
+} // namespace
+
+int main(int argc, char **argv) {
+  static const std::vector<Kernel> all = kernels();
+  for (const Kernel &kernel : all)
+    benchmark::RegisterBenchmark((std::string("vm/") + kernel.name).c_str(), run_kernel, kernel)
+        ->Unit(benchmark::kMicrosecond);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
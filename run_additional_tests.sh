@@ -22,15 +22,15 @@ compile_and_run() {
   local name
   name=$(basename "$src" .cpp)
   local exe="$OUT_DIR/${name}"
-  # For singleton tests (files starting with 's'), include AST implementation to satisfy RTTI used by interpreter.cpp
+  # For singleton tests (files starting with 's'), include the AST and resolver implementations that interpreter.cpp links against
   local -a extra_src
   if [[ "$name" == s* ]]; then
-    extra_src=("$ROOT_DIR/src/mitscript-interpreter/ast.cpp")
+    extra_src=("$ROOT_DIR/src/mitscript-interpreter/ast.cpp" "$ROOT_DIR/src/mitscript-interpreter/resolver.cpp")
   else
     extra_src=()
   fi
 
-  if g++ -std=c++20 -I "$ROOT_DIR/tests/gc" -I "$ROOT_DIR/tests/phase3" "$src" ${extra_src[@]:-} -o "$exe" >/dev/null 2>&1; then
+  if g++ -std=c++20 -I "$ROOT_DIR/src/gc" -I "$ROOT_DIR/tests/phase3" "$src" ${extra_src[@]:-} -o "$exe" >/dev/null 2>&1; then
     if "$exe" >/dev/null 2>&1; then
       echo "[PASS] phase3: $(basename "$src")"
       pass=$((pass+1))
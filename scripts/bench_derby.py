@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+"""Benchmark the derby programs and compare against a stored baseline.
+
+Each program in the derby directory is run under each -O preset, several
+times, with its .in file on stdin and its .memlimit as -m. For every run
+the driver records wall time, user and system CPU time and peak RSS (from
+wait4), and the GC collection counts from --gc-stats; the output is
+checked against the .out file.
+
+Results are written as JSON. With --baseline, the medians are compared
+against an earlier results file and the driver exits with status 1 when a
+benchmark got slower (or bigger) by more than --threshold.
+"""
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from pathlib import Path
+
+REPO_ROOT = Path(__file__).resolve().parent.parent
+
+PRESETS = {
+    "O0": [],
+    "O1": ["-O1"],
+    "O2": ["-O2"],
+    "O3": ["-O3"],
+    "all": ["-O", "all"],
+}
+
+
+def run_once(binary: Path, program: Path, flags: list[str], timeout: float) -> dict:
+    """Run one derby program once and return its measurements."""
+    stdin_path = program.with_suffix(".in")
+    memlimit_path = program.with_suffix(".memlimit")
+    expected_path = program.with_suffix(".out")
+
+    cmd = [str(binary), "derby", str(program)] + flags
+    if memlimit_path.exists():
+        cmd += ["-m", memlimit_path.read_text().strip()]
+
+    with tempfile.TemporaryDirectory() as tmp:
+        stats_path = Path(tmp) / "gc.json"
+        out_path = Path(tmp) / "out.txt"
+        cmd.append(f"--gc-stats={stats_path}")
+
+        stdin = open(stdin_path) if stdin_path.exists() else subprocess.DEVNULL
+        with open(out_path, "w") as out:
+            start = time.perf_counter()
+            proc = subprocess.Popen(cmd, stdin=stdin, stdout=out, stderr=subprocess.DEVNULL)
+            timer = threading.Timer(timeout, proc.kill)
+            timer.start()
+            _, status, usage = os.wait4(proc.pid, 0)
+            wall = time.perf_counter() - start
+            timer.cancel()
+            proc.returncode = os.waitstatus_to_exitcode(status)
+        if stdin is not subprocess.DEVNULL:
+            stdin.close()
+
+        if wall >= timeout:
+            state = "timeout"
+        elif proc.returncode != 0:
+            state = f"exit {proc.returncode}"
+        elif expected_path.exists() and out_path.read_text().rstrip() != expected_path.read_text().rstrip():
+            state = "wrong output"
+        else:
+            state = "ok"
+
+        minor = full = None
+        try:
+            gc = json.loads(stats_path.read_text())
+            minor = gc["minor"]["collections"]
+            full = gc["full"]["collections"]
+        except (OSError, ValueError, KeyError):
+            pass
+
+    return {
+        "status": state,
+        "wall_s": wall,
+        "user_s": usage.ru_utime,
+        "sys_s": usage.ru_stime,
+        "peak_rss_kb": usage.ru_maxrss,  # kilobytes on Linux
+        "gc_minor": minor,
+        "gc_full": full,
+    }
+
+
+def summarize(program: Path, preset: str, runs: list[dict]) -> dict:
+    """Collapse the runs of one benchmark into medians."""
+    memlimit_path = program.with_suffix(".memlimit")
+    memlimit_mb = float(memlimit_path.read_text()) if memlimit_path.exists() else None
+    peak_rss_kb = max(r["peak_rss_kb"] for r in runs)
+    failures = [r["status"] for r in runs if r["status"] != "ok"]
+    return {
+        "benchmark": program.stem,
+        "preset": preset,
+        "status": failures[0] if failures else "ok",
+        "runs": len(runs),
+        "wall_s": statistics.median(r["wall_s"] for r in runs),
+        "wall_min_s": min(r["wall_s"] for r in runs),
+        "user_s": statistics.median(r["user_s"] for r in runs),
+        "sys_s": statistics.median(r["sys_s"] for r in runs),
+        "peak_rss_kb": peak_rss_kb,
+        "memlimit_mb": memlimit_mb,
+        "rss_over_limit": peak_rss_kb / (memlimit_mb * 1024) if memlimit_mb else None,
+        "gc_minor": runs[-1]["gc_minor"],
+        "gc_full": runs[-1]["gc_full"],
+    }
+
+
+def compare(results: list[dict], baseline: list[dict], threshold: float) -> list[str]:
+    """Return a line for every benchmark that regressed against baseline."""
+    old = {(r["benchmark"], r["preset"]): r for r in baseline}
+    regressions = []
+    for r in results:
+        b = old.get((r["benchmark"], r["preset"]))
+        if b is None:
+            continue
+        name = f"{r['benchmark']} [{r['preset']}]"
+        if b["status"] == "ok" and r["status"] != "ok":
+            regressions.append(f"{name}: {r['status']}")
+            continue
+        for key, label, scale, unit in (("wall_s", "wall time", 1, "s"),
+                                        ("peak_rss_kb", "peak RSS", 1 / 1024, " MB")):
+            if b[key] and r[key] > b[key] * (1 + threshold):
+                regressions.append(f"{name}: {label} {b[key] * scale:.3f}{unit} -> "
+                                   f"{r[key] * scale:.3f}{unit} ({(r[key] / b[key] - 1) * 100:+.1f}%)")
+    return regressions
+
+
+def print_table(results: list[dict], baseline: list[dict]) -> None:
+    old = {(r["benchmark"], r["preset"]): r for r in baseline}
+    print(f"{'benchmark':<12} {'preset':<6} {'wall s':>8} {'user s':>8} {'sys s':>7} "
+          f"{'RSS MB':>7} {'/limit':>6} {'minor':>6} {'full':>5} {'vs base':>8}  status")
+    for r in results:
+        b = old.get((r["benchmark"], r["preset"]))
+        delta = f"{(r['wall_s'] / b['wall_s'] - 1) * 100:+.1f}%" if b and b["wall_s"] else ""
+        ratio = f"{r['rss_over_limit']:.2f}" if r["rss_over_limit"] is not None else "-"
+        gc = lambda n: "-" if n is None else str(n)
+        print(f"{r['benchmark']:<12} {r['preset']:<6} {r['wall_s']:>8.3f} {r['user_s']:>8.3f} "
+              f"{r['sys_s']:>7.3f} {r['peak_rss_kb'] / 1024:>7.1f} {ratio:>6} "
+              f"{gc(r['gc_minor']):>6} {gc(r['gc_full']):>5} {delta:>8}  {r['status']}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the MITScript derby programs")
+    parser.add_argument("--binary", type=Path, default=REPO_ROOT / "build/cmake/release/mitscript",
+                        help="mitscript executable to measure")
+    parser.add_argument("--derby-dir", type=Path, default=REPO_ROOT / "tests/derby/public",
+                        help="directory of derby programs (.mit with .in, .memlimit, .out)")
+    parser.add_argument("--runs", type=int, default=5, help="runs per benchmark and preset")
+    parser.add_argument("--presets", default="O0,all",
+                        help=f"comma-separated presets, from {', '.join(PRESETS)}")
+    parser.add_argument("--only", help="comma-separated benchmark names to run")
+    parser.add_argument("--timeout", type=float, default=120, help="seconds before a run is killed")
+    parser.add_argument("--output", type=Path, help="write results JSON here")
+    parser.add_argument("--baseline", type=Path, help="results JSON to compare against")
+    parser.add_argument("--save-baseline", action="store_true",
+                        help="write the results to --baseline instead of comparing")
+    parser.add_argument("--threshold", type=float, default=0.05,
+                        help="fractional slowdown counted as a regression (default 0.05)")
+    args = parser.parse_args()
+
+    presets = args.presets.split(",")
+    for preset in presets:
+        if preset not in PRESETS:
+            parser.error(f"unknown preset '{preset}'")
+    if not args.binary.exists():
+        parser.error(f"{args.binary} not found; build it first")
+    if args.save_baseline and not args.baseline:
+        parser.error("--save-baseline needs --baseline")
+
+    programs = sorted(args.derby_dir.glob("*.mit"))
+    if args.only:
+        wanted = set(args.only.split(","))
+        programs = [p for p in programs if p.stem in wanted]
+
+    results = []
+    for program in programs:
+        for preset in presets:
+            runs = [run_once(args.binary, program, PRESETS[preset], args.timeout)
+                    for _ in range(args.runs)]
+            results.append(summarize(program, preset, runs))
+            print(f"  {program.stem} [{preset}] {results[-1]['wall_s']:.3f}s", file=sys.stderr)
+
+    report = {"binary": str(args.binary), "runs": args.runs, "results": results}
+    if args.output:
+        args.output.parent.mkdir(parents=True, exist_ok=True)
+        args.output.write_text(json.dumps(report, indent=2) + "\n")
+
+    baseline = []
+    if args.baseline and not args.save_baseline and args.baseline.exists():
+        baseline = json.loads(args.baseline.read_text())["results"]
+
+    print_table(results, baseline)
+
+    if args.save_baseline:
+        args.baseline.parent.mkdir(parents=True, exist_ok=True)
+        args.baseline.write_text(json.dumps(report, indent=2) + "\n")
+        print(f"\nBaseline saved to {args.baseline}")
+        return 0
+
+    if args.baseline and not baseline:
+        print(f"\nNo baseline at {args.baseline}; run with --save-baseline to create one")
+
+    failed = [r for r in results if r["status"] != "ok"]
+    regressions = compare(results, baseline, args.threshold)
+    for line in regressions:
+        print(f"REGRESSION {line}")
+    return 1 if failed or regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
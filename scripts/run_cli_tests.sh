@@ -0,0 +1,123 @@
+#!/usr/bin/env bash
+#
+# End-to-end tests of command-line paths that the .mit/.out suites do not
+# reach. Each test prints PASS or FAIL with its name; the exit status is
+# the number of failures. Runs the binary behind ./run.sh.
+
+set -uo pipefail
+
+REPO_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+cd "$REPO_ROOT"
+
+pass=0
+fail=0
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+
+check() {
+  local name="$1"
+  shift
+  if "$@"; then
+    printf "PASS %s\n" "$name"
+    pass=$((pass + 1))
+  else
+    printf "FAIL %s\n" "$name"
+    fail=$((fail + 1))
+  fi
+}
+
+# Runs the rest of the command line with stdin from $1 (or /dev/null),
+# writing stdout, stderr and the exit status to $2.
+run_to() {
+  local in="$1" out="$2"
+  shift 2
+  [ -f "$in" ] || in=/dev/null
+  "$@" <"$in" >"$out" 2>&1
+  echo "exit $?" >>"$out"
+}
+
+# compile --emit-binary writes an image the vm subcommand runs exactly as
+# it runs the text bytecode of the same program, with and without -O.
+binary_image_matches_text() {
+  local mit="$1" opt="$2"
+  local base="${mit%.mit}" name
+  name="$(basename "$base")"
+  ./run.sh compile "$mit" $opt -o "$WORK/$name.mitbc" || return 1
+  ./run.sh compile "$mit" $opt --emit-binary -o "$WORK/$name.bin" || return 1
+  run_to "$base.in" "$WORK/$name.text.out" ./run.sh vm "$WORK/$name.mitbc"
+  run_to "$base.in" "$WORK/$name.bin.out" ./run.sh vm "$WORK/$name.bin"
+  cmp -s "$WORK/$name.text.out" "$WORK/$name.bin.out"
+}
+
+for mit in tests/phase4/public/good*.mit tests/phase4/public/sparsearrays.mit \
+           tests/regression/*.mit tests/phase5/public/*.mit; do
+  for opt in "" "-O all"; do
+    check "binary image: $mit ${opt:-(no -O)}" binary_image_matches_text "$mit" "$opt"
+  done
+done
+
+# A damaged --compile-cache entry is a miss: the run recompiles, prints
+# what an uncached run prints, and leaves a good entry for the next run.
+# `damage` is a python expression turning the entry's bytes `b` into new
+# bytes.
+cache_survives_corruption() {
+  local mit="$1" damage="$2"
+  local base="${mit%.mit}" cache="$WORK/cache" entry
+  rm -rf "$cache"
+  run_to "$base.in" "$WORK/uncached.out" ./run.sh derby "$mit"
+  run_to "$base.in" "$WORK/first.out" ./run.sh derby "$mit" --compile-cache="$cache"
+  entry="$(ls "$cache"/*.mitbin 2>/dev/null | head -n 1)"
+  [ -n "$entry" ] || return 1
+  cp "$entry" "$WORK/entry.good"
+  python3 -c "import sys; b = open(sys.argv[1], 'rb').read(); open(sys.argv[1], 'wb').write($damage)" "$entry" || return 1
+  run_to "$base.in" "$WORK/second.out" ./run.sh derby "$mit" --compile-cache="$cache"
+  run_to "$base.in" "$WORK/third.out" ./run.sh derby "$mit" --compile-cache="$cache"
+  cmp -s "$WORK/uncached.out" "$WORK/first.out" &&
+    cmp -s "$WORK/uncached.out" "$WORK/second.out" &&
+    cmp -s "$WORK/uncached.out" "$WORK/third.out" &&
+    cmp -s "$entry" "$WORK/entry.good"
+}
+
+# The same with one byte flipped, at each of 64 places across the entry.
+cache_survives_flips() {
+  local mit="$1" k
+  for k in $(seq 0 63); do
+    cache_survives_corruption "$mit" \
+      "(lambda i: b[:i] + bytes([b[i] ^ 0x21]) + b[i + 1:])(len(b) * $k // 64)" || return 1
+  done
+}
+
+for mit in tests/phase4/public/good05.mit tests/regression/smallstrings.mit; do
+  check "compile cache: truncated entry, $mit" cache_survives_corruption "$mit" 'b[:len(b) // 2]'
+  check "compile cache: empty entry, $mit" cache_survives_corruption "$mit" 'b""'
+  check "compile cache: garbage entry, $mit" cache_survives_corruption "$mit" 'bytes(len(b))'
+  check "compile cache: one byte flipped, $mit" cache_survives_flips "$mit"
+done
+
+# A --snapshot run saves the program's state at its first input(); later
+# runs resume from it. Resumed with different stdin, a run must print
+# exactly what a fresh run with that stdin prints, including the output
+# from before the snapshot.
+snapshot_resumes_with_new_input() {
+  local mit="$1" opt="$2"
+  local base="${mit%.mit}" cache="$WORK/snapshots"
+  rm -rf "$cache"
+  run_to "$base.in" "$WORK/fresh.out" ./run.sh derby "$mit" -m 2 $opt
+  run_to "$base.alt.in" "$WORK/fresh.alt.out" ./run.sh derby "$mit" -m 2 $opt
+  run_to "$base.in" "$WORK/saved.out" ./run.sh derby "$mit" -m 2 $opt --snapshot="$cache"
+  ls "$cache"/*.mitsnap >/dev/null 2>&1 || return 1
+  run_to "$base.alt.in" "$WORK/resumed.alt.out" ./run.sh derby "$mit" -m 2 $opt --snapshot="$cache"
+  run_to "$base.in" "$WORK/resumed.out" ./run.sh derby "$mit" -m 2 $opt --snapshot="$cache"
+  ! cmp -s "$WORK/fresh.out" "$WORK/fresh.alt.out" &&
+    cmp -s "$WORK/fresh.out" "$WORK/saved.out" &&
+    cmp -s "$WORK/fresh.alt.out" "$WORK/resumed.alt.out" &&
+    cmp -s "$WORK/fresh.out" "$WORK/resumed.out"
+}
+
+for opt in "" "-O all"; do
+  check "snapshot: tests/regression/snapshot.mit ${opt:-(no -O)}" \
+    snapshot_resumes_with_new_input tests/regression/snapshot.mit "$opt"
+done
+
+printf "\nSummary: %d passed, %d failed\n" "$pass" "$fail"
+exit $fail
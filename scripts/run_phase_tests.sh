@@ -3,6 +3,8 @@
 # Run all tests in a directory (argument), skipping any whose filename contains
 # "bad". For each .mit test, compile to bytecode then run the VM; for bare
 # .mitbc, run the VM directly. Compare stdout against the matching .out file.
+# A "bad" test must exit non-zero; if it has a .out file, its output
+# (including the error message) must match too.
 
 set -euo pipefail
 
@@ -81,7 +83,10 @@ for test_file in "${tests[@]}"; do
   fi
 
   if [ "$is_bad" = true ]; then
-    if [ $run_status -ne 0 ]; then
+    if [ $run_status -ne 0 ] && [ -f "$out_file" ] && ! diff -u "$out_file" "$tmp_out" >/dev/null; then
+      printf "FAIL %-24s (output mismatch)\n" "$rel_name"
+      fail=$((fail + 1))
+    elif [ $run_status -ne 0 ]; then
       printf "PASS %-24s (bad test expected non-zero)\n" "$rel_name"
       pass=$((pass + 1))
     else
@@ -0,0 +1,162 @@
+#include "batch.hpp"
+
+#include "bytecode/binary.hpp"
+#include "vm/interpreter.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+struct Run {
+  std::string output; // captured when writing to stdout
+  std::string error;
+  bool done = false;
+};
+
+// Owns an open descriptor.
+struct Descriptor {
+  int fd = -1;
+  Descriptor(int fd) : fd(fd) {}
+  Descriptor(const Descriptor &) = delete;
+  Descriptor &operator=(const Descriptor &) = delete;
+  ~Descriptor() {
+    if (fd >= 0)
+      ::close(fd);
+  }
+};
+
+// Gathers a tree decoded by read_binary, which nothing else owns. The
+// VM's inliner lets callers share their callees' constants and functions,
+// so each is collected once.
+void collect_program(bytecode::Function *func,
+                     std::unordered_set<bytecode::Function *> &functions,
+                     std::unordered_set<bytecode::Constant *> &constants) {
+  if (!functions.insert(func).second)
+    return;
+  constants.insert(func->constants_.begin(), func->constants_.end());
+  for (bytecode::Function *child : func->functions_)
+    collect_program(child, functions, constants);
+}
+
+void delete_program(bytecode::Function *program) {
+  std::unordered_set<bytecode::Function *> functions;
+  std::unordered_set<bytecode::Constant *> constants;
+  collect_program(program, functions, constants);
+  for (bytecode::Constant *constant : constants)
+    delete constant;
+  for (bytecode::Function *func : functions)
+    delete func;
+}
+
+void run_one(std::string_view image, const std::string &input,
+             const BatchOptions &options, Run &run) {
+  Descriptor in(::open(input.c_str(), O_RDONLY | O_CLOEXEC));
+  if (in.fd < 0) {
+    run.error = std::string("cannot open input: ") + std::strerror(errno);
+    return;
+  }
+  Descriptor out(-1);
+  if (!options.output_dir.empty()) {
+    std::filesystem::path path = std::filesystem::path(options.output_dir) /
+                                 std::filesystem::path(input).filename();
+    path += ".out";
+    out.fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (out.fd < 0) {
+      run.error = "cannot write " + path.string() + ": " + std::strerror(errno);
+      return;
+    }
+  }
+
+  run.error = run_image(image, options.mem_mb, options.configure, in.fd,
+                        out.fd, out.fd < 0 ? &run.output : nullptr);
+}
+
+} // namespace
+
+std::string run_image(std::string_view image, size_t mem_mb,
+                      const std::function<void(vm::VM &)> &configure,
+                      int input_fd, int output_fd, std::string *capture) {
+  std::string error;
+  bytecode::Function *program = bytecode::read_binary(image);
+  {
+    vm::VM machine(mem_mb);
+    if (configure)
+      configure(machine);
+    machine.set_stdio(input_fd, output_fd, capture);
+    try {
+      machine.run(program);
+    } catch (const std::exception &e) {
+      error = e.what();
+    }
+    machine.release_heap();
+  }
+  delete_program(program);
+  return error;
+}
+
+bool run_batch(const bytecode::Function *program,
+               const std::vector<std::string> &inputs,
+               const BatchOptions &options) {
+  std::ostringstream encoded;
+  bytecode::write_binary(program, encoded);
+  const std::string image = encoded.str();
+
+  std::vector<Run> runs(inputs.size());
+  std::mutex mutex;
+  std::condition_variable finished;
+  std::atomic<size_t> next{0};
+  auto work = [&] {
+    for (size_t i; (i = next.fetch_add(1)) < inputs.size();) {
+      try {
+        run_one(image, inputs[i], options, runs[i]);
+      } catch (const std::exception &e) {
+        runs[i].error = e.what();
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      runs[i].done = true;
+      finished.notify_all();
+    }
+  };
+
+  size_t jobs = options.jobs;
+  if (jobs == 0)
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  jobs = std::min(jobs, inputs.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < jobs; ++i)
+    workers.emplace_back(work);
+
+  // Report the runs in input order as they finish.
+  bool ok = true;
+  for (size_t i = 0; i < runs.size(); ++i) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      finished.wait(lock, [&] { return runs[i].done; });
+    }
+    std::cout.write(runs[i].output.data(),
+                    static_cast<std::streamsize>(runs[i].output.size()));
+    std::string().swap(runs[i].output);
+    if (!runs[i].error.empty()) {
+      ok = false;
+      std::cout.flush();
+      std::cerr << inputs[i] << ": " << runs[i].error << "\n";
+    }
+  }
+  for (std::thread &worker : workers)
+    worker.join();
+  std::cout.flush();
+  return ok;
+}
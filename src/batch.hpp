@@ -0,0 +1,47 @@
+#pragma once
+
+#include "bytecode/types.hpp"
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace vm {
+class VM;
+}
+
+// Runs one compiled program against many inputs at once for the batch
+// subcommand. Each run gets its own VM (heap, globals, stdin and stdout)
+// on a pool of `jobs` threads, 0 meaning one per core.
+//
+// The bytecode tree is not shared between the VMs: the VM quickens its
+// register code in place and keys inline caches, constant pools and JIT
+// code on its own state. The program is encoded once as a binary image
+// and every run decodes its own copy, which costs far less than compiling.
+struct BatchOptions {
+  size_t jobs = 0;
+  size_t mem_mb = 4;
+  // Where each run's output goes as <input file name>.out; when empty the
+  // outputs are written to stdout, one after another in input order.
+  std::string output_dir;
+  // Applies the command line's VM settings to each new VM.
+  std::function<void(vm::VM &)> configure;
+};
+
+// Runs `program` once per input file, with that file as stdin. Errors are
+// reported on stderr, prefixed by the input they happened on; returns
+// false when any run failed.
+bool run_batch(const bytecode::Function *program,
+               const std::vector<std::string> &inputs,
+               const BatchOptions &options);
+
+// Decodes `image`, a program encoded by bytecode::write_binary, and runs
+// it in a fresh VM of `mem_mb` set up by `configure`, reading stdin from
+// `input_fd`. Output goes to `output_fd`, or is appended to `capture`
+// when that is set. Returns the error the run stopped on, or an empty
+// string when it finished. The batch and serve subcommands run every
+// program this way.
+std::string run_image(std::string_view image, size_t mem_mb,
+                      const std::function<void(vm::VM &)> &configure,
+                      int input_fd, int output_fd, std::string *capture);
@@ -0,0 +1,280 @@
+#include "./binary.hpp"
+#include "./instructions.hpp"
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace bytecode {
+
+namespace {
+
+constexpr std::string_view kMagic("\x7fMITBC\x01\n", 8);
+constexpr uint32_t kVersion = 1;
+
+enum ConstantTag : uint32_t { TagNone, TagInteger, TagBoolean, TagString };
+
+constexpr uint32_t kHasOperand0 = 1u << 8;
+constexpr uint32_t kHasOperand1 = 1u << 9;
+
+void put(std::string &out, uint32_t w) {
+  char bytes[4] = {static_cast<char>(w), static_cast<char>(w >> 8),
+                   static_cast<char>(w >> 16), static_cast<char>(w >> 24)};
+  out.append(bytes, 4);
+}
+
+class Writer {
+public:
+  void add_function(const Function *f) {
+    index_.emplace(f, order_.size());
+    order_.push_back(f);
+    for (const Function *child : f->functions_)
+      add_function(child);
+  }
+
+  void write(std::ostream &os) {
+    // Records first, since they decide the string table.
+    std::string records;
+    std::vector<uint32_t> record_offsets;
+    for (const Function *f : order_) {
+      record_offsets.push_back(records.size());
+      write_function(f, records);
+    }
+
+    std::string strings;
+    size_t table_size = 8 * strings_.size();
+    std::string bytes;
+    for (const std::string &s : strings_) bytes += s;
+    while (bytes.size() % 4) bytes.push_back('\0');
+
+    const size_t header_size = kMagic.size() + 4 * 4 + 4 * order_.size();
+    const size_t strings_offset = header_size;
+    const size_t records_offset = strings_offset + table_size + bytes.size();
+
+    std::string header(kMagic);
+    put(header, kVersion);
+    put(header, strings_.size());
+    put(header, order_.size());
+    put(header, strings_offset);
+    for (uint32_t off : record_offsets) put(header, records_offset + off);
+
+    size_t byte_offset = strings_offset + table_size;
+    for (const std::string &s : strings_) {
+      put(strings, byte_offset);
+      put(strings, s.size());
+      byte_offset += s.size();
+    }
+
+    os.write(header.data(), header.size());
+    os.write(strings.data(), strings.size());
+    os.write(bytes.data(), bytes.size());
+    os.write(records.data(), records.size());
+  }
+
+private:
+  uint32_t intern(const std::string &s) {
+    auto [it, inserted] = string_index_.emplace(s, strings_.size());
+    if (inserted) strings_.push_back(s);
+    return it->second;
+  }
+
+  void write_names(const std::vector<std::string> &names, std::string &out) {
+    put(out, names.size());
+    for (const std::string &name : names) put(out, intern(name));
+  }
+
+  void write_function(const Function *f, std::string &out) {
+    put(out, f->parameter_count_);
+
+    put(out, f->functions_.size());
+    for (const Function *child : f->functions_) put(out, index_.at(child));
+
+    put(out, f->constants_.size());
+    for (const Constant *c : f->constants_) {
+      if (auto i = dynamic_cast<const Constant::Integer *>(c)) {
+        put(out, TagInteger);
+        put(out, static_cast<uint32_t>(i->value));
+      } else if (auto b = dynamic_cast<const Constant::Boolean *>(c)) {
+        put(out, TagBoolean);
+        put(out, b->value);
+      } else if (auto s = dynamic_cast<const Constant::String *>(c)) {
+        put(out, TagString);
+        put(out, intern(s->value));
+      } else {
+        put(out, TagNone);
+        put(out, 0);
+      }
+    }
+
+    write_names(f->local_vars_, out);
+    write_names(f->local_reference_vars_, out);
+    write_names(f->free_vars_, out);
+    write_names(f->names_, out);
+
+    put(out, f->instructions.size());
+    for (const Instruction &inst : f->instructions) {
+      uint32_t head = static_cast<uint32_t>(inst.operation);
+      if (inst.operand0) head |= kHasOperand0;
+      if (inst.operand1) head |= kHasOperand1;
+      put(out, head);
+      put(out, static_cast<uint32_t>(inst.operand0.value_or(0)));
+      put(out, static_cast<uint32_t>(inst.operand1.value_or(0)));
+    }
+  }
+
+  std::vector<const Function *> order_;
+  std::unordered_map<const Function *, uint32_t> index_;
+  std::vector<std::string> strings_;
+  std::unordered_map<std::string, uint32_t> string_index_;
+};
+
+[[noreturn]] void corrupt(const std::string &what) {
+  throw std::runtime_error("Invalid bytecode image: " + what);
+}
+
+class Reader {
+public:
+  explicit Reader(std::string_view image) : image_(image) {}
+
+  Function *read() {
+    if (!is_binary(image_)) corrupt("bad magic");
+    size_t pos = kMagic.size();
+    if (word(pos) != kVersion) corrupt("unsupported version");
+    uint32_t string_count = word(pos + 4);
+    uint32_t function_count = word(pos + 8);
+    size_t strings_offset = word(pos + 12);
+    size_t records = pos + 16;
+    if (function_count == 0) corrupt("no functions");
+
+    strings_.reserve(string_count);
+    for (uint32_t i = 0; i < string_count; ++i) {
+      size_t off = word(strings_offset + 8 * size_t{i});
+      size_t len = word(strings_offset + 8 * size_t{i} + 4);
+      if (off > image_.size() || len > image_.size() - off)
+        corrupt("string out of range");
+      strings_.push_back(image_.substr(off, len));
+    }
+
+    record_offsets_.reserve(function_count);
+    for (uint32_t i = 0; i < function_count; ++i)
+      record_offsets_.push_back(word(records + 4 * size_t{i}));
+    built_.assign(function_count, nullptr);
+    return read_function(0);
+  }
+
+private:
+  uint32_t word(size_t pos) const {
+    if (pos > image_.size() || image_.size() - pos < 4) corrupt("truncated");
+    auto p = reinterpret_cast<const unsigned char *>(image_.data() + pos);
+    return uint32_t{p[0]} | uint32_t{p[1]} << 8 | uint32_t{p[2]} << 16 |
+           uint32_t{p[3]} << 24;
+  }
+
+  uint32_t next() {
+    uint32_t w = word(cursor_);
+    cursor_ += 4;
+    return w;
+  }
+
+  // A count of items of `width` words each that must fit in the image.
+  uint32_t count(size_t width) {
+    uint32_t n = next();
+    if (n > (image_.size() - cursor_) / (4 * width)) corrupt("count out of range");
+    return n;
+  }
+
+  std::string string(uint32_t index) const {
+    if (index >= strings_.size()) corrupt("string index out of range");
+    return std::string(strings_[index]);
+  }
+
+  std::vector<std::string> names() {
+    std::vector<std::string> out;
+    uint32_t n = count(1);
+    out.reserve(n);
+    for (uint32_t i = 0; i < n; ++i) out.push_back(string(next()));
+    return out;
+  }
+
+  Function *read_function(uint32_t index) {
+    if (built_[index]) corrupt("function listed twice");
+    auto f = new Function();
+    built_[index] = f;
+    cursor_ = record_offsets_[index];
+
+    f->parameter_count_ = next();
+
+    // Children come after their parent in the image, so following them
+    // always terminates.
+    std::vector<uint32_t> children(count(1));
+    for (uint32_t &child : children) {
+      child = next();
+      if (child <= index || child >= built_.size())
+        corrupt("function index out of range");
+    }
+
+    uint32_t constants = count(2);
+    f->constants_.reserve(constants);
+    for (uint32_t i = 0; i < constants; ++i) {
+      uint32_t tag = next();
+      uint32_t value = next();
+      switch (tag) {
+      case TagNone: f->constants_.push_back(new Constant::None()); break;
+      case TagInteger:
+        f->constants_.push_back(new Constant::Integer(static_cast<int32_t>(value)));
+        break;
+      case TagBoolean: f->constants_.push_back(new Constant::Boolean(value != 0)); break;
+      case TagString: f->constants_.push_back(new Constant::String(string(value))); break;
+      default: corrupt("unknown constant tag");
+      }
+    }
+
+    f->local_vars_ = names();
+    f->local_reference_vars_ = names();
+    f->free_vars_ = names();
+    f->names_ = names();
+
+    uint32_t instructions = count(3);
+    f->instructions.reserve(instructions);
+    for (uint32_t i = 0; i < instructions; ++i) {
+      uint32_t head = next();
+      int32_t op0 = static_cast<int32_t>(next());
+      int32_t op1 = static_cast<int32_t>(next());
+      uint32_t op = head & 0xff;
+      if (op > static_cast<uint32_t>(Operation::End)) corrupt("unknown operation");
+      f->instructions.emplace_back(
+          static_cast<Operation>(op),
+          head & kHasOperand0 ? std::optional<int32_t>(op0) : std::nullopt,
+          head & kHasOperand1 ? std::optional<int32_t>(op1) : std::nullopt);
+    }
+
+    f->functions_.reserve(children.size());
+    for (uint32_t child : children) f->functions_.push_back(read_function(child));
+    return f;
+  }
+
+  std::string_view image_;
+  std::vector<std::string_view> strings_;
+  std::vector<uint32_t> record_offsets_;
+  std::vector<Function *> built_;
+  size_t cursor_ = 0;
+};
+
+} // namespace
+
+bool is_binary(std::string_view contents) {
+  return contents.substr(0, kMagic.size()) == kMagic;
+}
+
+void write_binary(const Function *function, std::ostream &os) {
+  Writer writer;
+  writer.add_function(function);
+  writer.write(os);
+}
+
+Function *read_binary(std::string_view image) {
+  return Reader(image).read();
+}
+
+} // namespace bytecode
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "./types.hpp"
+#include <iostream>
+#include <string_view>
+
+namespace bytecode {
+
+// A compact binary image of a Function tree, the binary counterpart of the
+// textual .mitbc format. It holds the same things the text does: for every
+// function its nested functions, constants, parameter count, name lists
+// and stack instructions. Loading it involves no lexing or parsing.
+//
+// Layout, all fields 32-bit little-endian words:
+//   header      magic "\x7fMITBC\x01\n", version, string count, function
+//               count, then the byte offsets of the string table and of
+//               each function record
+//   strings     per string its byte offset and length, then the bytes
+//   functions   one record per function, the root first:
+//                 parameter count
+//                 child count, child function indices
+//                 constant count, constants as (tag, value) pairs where
+//                   value is the integer, the boolean or a string index
+//                 local_vars, local_reference_vars, free_vars and names,
+//                   each a count and string indices
+//                 instruction count, instructions as (operation and operand
+//                   flags, operand 0, operand 1)
+//
+// Identifiers and string constants are stored once in the string table.
+
+// Whether contents starts like a binary image.
+bool is_binary(std::string_view contents);
+
+void write_binary(const Function *function, std::ostream &os);
+
+// Builds the Function tree an image describes. Throws std::runtime_error
+// when the image is truncated or refers outside itself.
+Function *read_binary(std::string_view image);
+
+} // namespace bytecode
@@ -6,7 +6,7 @@
 
 namespace bytecode
 {
-  enum class Operation
+  enum class Operation : uint8_t
   {
     // Description: push a constant onto the operand stack
     // Mnemonic:    load_const i
@@ -74,8 +74,9 @@ namespace bytecode
     StoreReference,
 
     // Description: allocates a record and pushes it on the operand stack
-    // Mnemonic:    alloc_record
-    // Operand 0:   N/A
+    // Mnemonic:    alloc_record [n]
+    // Operand 0:   optional; the number of named fields the record is about
+    // to receive, which are allocated up front
     // Stack:       S => S :: record
     AllocRecord,
 
@@ -244,25 +245,162 @@ namespace bytecode
     // Operand 0:   N/A
     // Operand 1:   a value
     // Stack:       S :: operand 1 => S
-    Pop
+    Pop,
+
+    // Description: field_load/field_store for a record the compiler has
+    // proved to be built by a record literal in which field f.names[i] is
+    // slot s. Fields are only ever appended, so the field stays at slot s
+    // unless the record has since switched to dictionary mode, in which case
+    // these behave exactly like field_load/field_store.
+    // Mnemonic:    field_load_slot i s / field_store_slot i s
+    // Operand 0:   index of the field's name within the enclosing function's
+    // names list
+    // Operand 1:   the field's slot
+    // Stack:       as for FieldLoad/FieldStore
+    // Registers:   as for FieldLoad/FieldStore, with the slot in place of the
+    //              field cache index
+    FieldLoadSlot,
+    FieldStoreSlot,
+
+    // Description: add/sub/mul and the comparisons gt/geq/eq for two operands
+    // the compiler has proved to be integers. The VM does not check the
+    // operands' kinds; the result on anything but two integers is unspecified.
+    // Mnemonic:    add_i/sub_i/mul_i/gt_i/geq_i/eq_i
+    // Operand 0:   N/A
+    // Operand 1:   right value
+    // Operand 2:   left value
+    // Stack:       S :: operand 2 :: operand 1 => S :: op(operand 2, operand 1)
+    AddI,
+    SubI,
+    MulI,
+    GtI,
+    GeqI,
+    EqI,
+
+    // The remaining operations exist only in register code. They are
+    // superinstructions formed by the VM after translation (see
+    // vm/superinstructions.hpp) and never appear in stack bytecode.
+
+    // Description: compares two values and branches on the result
+    // Mnemonic:    gt_jump/geq_jump/eq_jump i
+    // Operand 0:   offset relative to the current instruction offset to jump to
+    // Registers:   src1 = left value, src2 = right value; a nonzero dst
+    //              inverts the test (jump when the comparison is false)
+    GtJump,
+    GeqJump,
+    EqJump,
+
+    // Description: adds/subtracts an integer immediate (semantics of Add/Sub
+    // with a constant right operand)
+    // Mnemonic:    add_imm/sub_imm k
+    // Operand 0:   the integer k
+    // Registers:   dst = src1 op k
+    AddImm,
+    SubImm,
+    // Description: the update and test of a counted loop, `c = c + step;
+    // if (c < bound) jump` (semantics of Add followed by GtJump)
+    // Mnemonic:    inc_jump_lt/add_jump_lt i
+    // Operand 0:   offset relative to the current instruction offset to jump to
+    // Registers:   dst = the counter, src1 = the bound; src2 = the step, as a
+    //              signed 16-bit immediate (IncJumpLt) or a register
+    //              (AddJumpLt)
+    IncJumpLt,
+    AddJumpLt,
+
+    // Description: guards a call the VM has inlined (see vm/inliner.hpp):
+    // falls through when the callee is a closure of the inlined function
+    // holding all of its free variable references, or that function itself
+    // if it has no free variables, and jumps to the original call otherwise
+    // Mnemonic:    call_guard i
+    // Operand 0:   offset relative to the current instruction offset to jump to
+    // Registers:   src1 = the callee; dst = index of the inlined function in
+    //              the enclosing function's inline_targets
+    CallGuard,
+
+    // Description: push_ref for a free variable of an inlined function,
+    // read from the closure being called
+    // Mnemonic:    load_free_ref j
+    // Operand 0:   index of the free variable in the closure's references
+    // Registers:   dst = the reference, src1 = the closure
+    LoadFreeRef,
+
+    // Description: allocates the Reference cell of a local reference
+    // variable of an inlined function, as a call does on entry
+    // Mnemonic:    new_ref
+    // Registers:   dst = the new reference, src1 = the local's initial value
+    NewReference,
+
+    // Description: quickened forms of Add/Sub/Mul/Gt/Geq/Eq and the
+    // compare-and-jumps, installed in place by the VM once an instruction has
+    // seen two integer operands. Each checks that both operands are still
+    // tagged integers and otherwise reverts to the generic operation.
+    AddInt,
+    SubInt,
+    MulInt,
+    GtInt,
+    GeqInt,
+    EqInt,
+    GtJumpInt,
+    GeqJumpInt,
+    EqJumpInt,
+
+    // Description: sentinel the VM appends to every register function;
+    // reaching it means control fell off the end of the function
+    // Mnemonic:    end
+    End
   };
 
   struct Instruction
   {
-    Instruction(const Operation operation, std::optional<int32_t> operand0)
-        : operation(operation), operand0(operand0) {}
+    Instruction(const Operation operation, std::optional<int32_t> operand0,
+                std::optional<int32_t> operand1 = std::nullopt)
+        : operation(operation), operand0(operand0), operand1(operand1) {}
 
     Operation operation;
     std::optional<int32_t> operand0;
+    std::optional<int32_t> operand1; // only FieldLoadSlot/FieldStoreSlot
   };
 
-  // Register-based instruction format (coexists with legacy stack format)
+  // Register-based instruction format (coexists with legacy stack format).
+  // The operation takes a byte, so the three registers pack behind it and
+  // an instruction is 12 bytes. Calls, branches and field accesses use all
+  // three registers and the immediate, so no smaller form holds them.
+  //
+  // Built with MITSCRIPT_THREADED_DISPATCH, an instruction also carries its
+  // handler in the register loop, as an offset from the loop's first
+  // handler (see VM::thread_code), and is 16 bytes. Off by default: on the
+  // derby programs it was no faster than the table lookup on op, and life
+  // ran 6% slower with the larger instructions.
   struct RegisterInstruction {
     Operation op;
     uint16_t dst = 0;
     uint16_t src1 = 0;
     uint16_t src2 = 0;
     int32_t imm = 0;
+#ifdef MITSCRIPT_THREADED_DISPATCH
+    int32_t handler = 0;
+#endif
+  };
+#ifdef MITSCRIPT_THREADED_DISPATCH
+  static_assert(sizeof(RegisterInstruction) == 16);
+#else
+  static_assert(sizeof(RegisterInstruction) == 12);
+#endif
+
+  // Inline cache for one register-form FieldLoad/FieldStore site. Entries are
+  // keyed on the receiving record's shape id; for a store that adds a new
+  // field, next_shape_id is the shape the record transitions to (otherwise it
+  // equals shape_id). The site index lives in the instruction's unused
+  // register operand.
+  struct FieldCache {
+    static constexpr uint8_t kMaxEntries = 4;
+    struct Entry {
+      uint32_t shape_id;
+      uint32_t slot;
+      uint32_t next_shape_id;
+    };
+    Entry entries[kMaxEntries];
+    uint8_t size = 0;
   };
 
   typedef std::vector<Instruction> InstructionList;
@@ -1,13 +1,14 @@
 #include "./lexer.hpp"
 #include "./token.hpp"
 
+#include <algorithm>
 #include <cctype>
+#include <cstdlib>
 #include <iostream>
-#include <optional>
-#include <sstream>
+#include <unordered_map>
 #include <vector>
 
-static std::vector<std::tuple<std::string, bytecode::TokenKind>>
+static const std::unordered_map<std::string_view, bytecode::TokenKind>
     keyword_to_token{{"None", bytecode::TokenKind::NONE},
                      {"true", bytecode::TokenKind::TRUE},
                      {"false", bytecode::TokenKind::FALSE},
@@ -52,56 +53,68 @@ static std::vector<std::tuple<std::string, bytecode::TokenKind>>
                      {"if", bytecode::TokenKind::IF},
                      {"dup", bytecode::TokenKind::DUP},
                      {"swap", bytecode::TokenKind::SWAP},
-                     {"pop", bytecode::TokenKind::POP}};
+                     {"pop", bytecode::TokenKind::POP},
+                     {"field_load_slot", bytecode::TokenKind::FIELD_LOAD_SLOT},
+                     {"field_store_slot", bytecode::TokenKind::FIELD_STORE_SLOT},
+                     {"add_i", bytecode::TokenKind::ADD_I},
+                     {"sub_i", bytecode::TokenKind::SUB_I},
+                     {"mul_i", bytecode::TokenKind::MUL_I},
+                     {"gt_i", bytecode::TokenKind::GT_I},
+                     {"geq_i", bytecode::TokenKind::GEQ_I},
+                     {"eq_i", bytecode::TokenKind::EQ_I}};
 
-static std::vector<std::tuple<std::string, bytecode::TokenKind>>
-    symbol_to_token{
-        {"[", bytecode::TokenKind::LBRACKET},
-        {"]", bytecode::TokenKind::RBRACKET},
-        {"(", bytecode::TokenKind::LPAREN},
-        {")", bytecode::TokenKind::RPAREN},
-        {"{", bytecode::TokenKind::LBRACE},
-        {"}", bytecode::TokenKind::RBRACE},
-        {"=", bytecode::TokenKind::ASSIGN},
-        {",", bytecode::TokenKind::COMMA},
-    };
+static bool symbol_kind(char c, bytecode::TokenKind &kind)
+{
+  switch (c)
+  {
+  case '[': kind = bytecode::TokenKind::LBRACKET; return true;
+  case ']': kind = bytecode::TokenKind::RBRACKET; return true;
+  case '(': kind = bytecode::TokenKind::LPAREN; return true;
+  case ')': kind = bytecode::TokenKind::RPAREN; return true;
+  case '{': kind = bytecode::TokenKind::LBRACE; return true;
+  case '}': kind = bytecode::TokenKind::RBRACE; return true;
+  case '=': kind = bytecode::TokenKind::ASSIGN; return true;
+  case ',': kind = bytecode::TokenKind::COMMA; return true;
+  default: return false;
+  }
+}
 
-static int is_comment(int c) { return c != '\r' && c != '\n'; }
+static bool is_comment(char c) { return c != '\r' && c != '\n'; }
 
-static int is_identifier_start(int c) { return std::isalpha(c) || c == '_'; }
+// The optimizer names the locals it adds with a leading '$' ($gvn0,
+// $inl2_x, ...), which source identifiers cannot contain, so they never
+// clash with the program's own; they must read back in.
+static bool is_identifier_start(char c)
+{
+  return std::isalpha(static_cast<unsigned char>(c)) || c == '_' || c == '$';
+}
 
-static int is_identifier_continue(int c) { return std::isalnum(c) || c == '_'; }
+static bool is_identifier_continue(char c)
+{
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$';
+}
 
-bytecode::Lexer::Lexer(const std::string &file_contents)
-    : rest(file_contents), current_line(1), current_col(1) {}
+static bool is_digit(char c) { return std::isdigit(static_cast<unsigned char>(c)); }
+
+bytecode::Lexer::Lexer(std::string_view file_contents)
+    : input(file_contents), pos(0), current_line(1), current_col(1) {}
 
 std::vector<bytecode::Token> bytecode::Lexer::lex()
 {
   std::vector<bytecode::Token> result;
+  result.reserve(input.size() / 4 + 1);
   while (!is_eof())
   {
     if (lex_comment())
       continue;
-    if (auto token = lex_symbol())
-    {
-      result.push_back(*token);
+    if (lex_symbol(result))
       continue;
-    }
-    if (auto token = lex_intliteral())
-    {
-      result.push_back(*token);
+    if (lex_intliteral(result))
       continue;
-    }
-    if (auto token = lex_identifier_or_keyword())
-    {
-      result.push_back(*token);
+    if (lex_identifier_or_keyword(result))
       continue;
-    }
-    if (auto token = lex_stringliteral())
-    {
-      result.push_back(*token);
+    if (lex_stringliteral(result))
       continue;
-    }
 
     if (lex_whitespace())
       continue;
@@ -110,13 +123,14 @@ std::vector<bytecode::Token> bytecode::Lexer::lex()
               << current_line << ", column " << current_col << std::endl;
     std::exit(1);
   }
-  result.emplace_back(bytecode::TokenKind::EOF_TOKEN, "", current_line, current_col, current_line, current_col);
+  result.emplace_back(bytecode::TokenKind::EOF_TOKEN, std::string_view(), current_line, current_col,
+                      current_line, current_col);
   return result;
 }
 
 bool bytecode::Lexer::lex_whitespace()
 {
-  if (!is_eof() && std::isspace(peek()))
+  if (!is_eof() && std::isspace(static_cast<unsigned char>(peek())))
   {
     consume(1);
     return true;
@@ -126,148 +140,110 @@ bool bytecode::Lexer::lex_whitespace()
 
 bool bytecode::Lexer::lex_comment()
 {
-  if (this->rest.substr(0, 2) == "//")
+  if (peek() == '/' && peek(1) == '/')
   {
-    std::string text = take_while<is_comment>();
-    consume(text.length());
+    consume(span_while(pos, is_comment) - pos);
     return true;
   }
   return false;
 }
 
-std::optional<bytecode::Token> bytecode::Lexer::lex_symbol()
+bool bytecode::Lexer::lex_symbol(std::vector<Token> &out)
 {
-  for (const auto &[symbol, token] : symbol_to_token)
-  {
-    if (this->rest.substr(0, symbol.length()) == symbol)
-    {
-      auto start_line = this->current_line;
-      auto start_col = this->current_col;
-      std::string text = consume(symbol.length());
-      return bytecode::Token(token, text, start_line, start_col, this->current_line, this->current_col);
-    }
-  }
-  return std::nullopt;
+  bytecode::TokenKind kind;
+  if (is_eof() || !symbol_kind(peek(), kind))
+    return false;
+  auto start_line = this->current_line;
+  auto start_col = this->current_col;
+  std::string_view text = consume(1);
+  out.emplace_back(kind, text, start_line, start_col, this->current_line, this->current_col);
+  return true;
 }
 
-std::optional<bytecode::Token> bytecode::Lexer::lex_intliteral()
+bool bytecode::Lexer::lex_intliteral(std::vector<Token> &out)
 {
-  if (!is_eof() && (std::isdigit(peek()) || peek() == '-'))
-  {
-    auto start_line = this->current_line;
-    auto start_col = this->current_col;
-    std::string text;
-    if (peek() == '-')
-    {
-      text = consume(1);
-    }
-    if (!is_eof() && std::isdigit(peek()))
-    {
-      std::string to_add = take_while<std::isdigit>();
-      consume(to_add.length());
-      text += to_add;
-      return bytecode::Token(bytecode::TokenKind::INT, text, start_line, start_col, this->current_line, this->current_col);
-    }
-    else if (text == "-")
-    {
-      this->rest = "-" + this->rest;
-      this->current_col--;
-    }
-  }
-  return std::nullopt;
+  size_t digits = peek() == '-' ? pos + 1 : pos;
+  if (digits >= input.size() || !is_digit(input[digits]))
+    return false;
+  auto start_line = this->current_line;
+  auto start_col = this->current_col;
+  std::string_view text = consume(span_while(digits, is_digit) - pos);
+  out.emplace_back(bytecode::TokenKind::INT, text, start_line, start_col, this->current_line,
+                   this->current_col);
+  return true;
 }
 
-std::optional<bytecode::Token> bytecode::Lexer::lex_identifier_or_keyword()
+bool bytecode::Lexer::lex_identifier_or_keyword(std::vector<Token> &out)
 {
-  if (!is_eof() && is_identifier_start(peek()))
-  {
-    auto start_line = this->current_line;
-    auto start_col = this->current_col;
-    std::string text = take_while<is_identifier_continue>();
-    consume(text.length());
-    bytecode::TokenKind token_kind = bytecode::TokenKind::IDENTIFIER;
-    for (const auto &[keyword, keyword_token] : keyword_to_token)
-    {
-      if (text == keyword)
-      {
-        token_kind = keyword_token;
-        break;
-      }
-    }
-    return bytecode::Token(token_kind, text, start_line, start_col, this->current_line, this->current_col);
-  }
-  return std::nullopt;
+  if (is_eof() || !is_identifier_start(peek()))
+    return false;
+  auto start_line = this->current_line;
+  auto start_col = this->current_col;
+  std::string_view text = consume(span_while(pos, is_identifier_continue) - pos);
+  auto keyword = keyword_to_token.find(text);
+  bytecode::TokenKind token_kind =
+      keyword == keyword_to_token.end() ? bytecode::TokenKind::IDENTIFIER : keyword->second;
+  out.emplace_back(token_kind, text, start_line, start_col, this->current_line, this->current_col);
+  return true;
 }
 
-std::optional<bytecode::Token> bytecode::Lexer::lex_stringliteral()
+bool bytecode::Lexer::lex_stringliteral(std::vector<Token> &out)
 {
-  if (!is_eof() && peek() == '"')
+  if (is_eof() || peek() != '"')
+    return false;
+  auto start_line = this->current_line;
+  auto start_col = this->current_col;
+  consume(1);
+
+  size_t end = pos;
+  while (end < input.size() && input[end] != '"')
   {
-    auto start_line = this->current_line;
-    auto start_col = this->current_col;
-    std::ostringstream oss;
-    oss << consume(1);
-    while (!is_eof() && peek() != '"')
+    if (input[end] == '\\' && end + 1 < input.size())
     {
-      if (peek() == '\\')
+      char escaped = input[end + 1];
+      if (escaped != '\\' && escaped != 'n' && escaped != 't' && escaped != '"')
       {
-        oss << consume(1);
-        if (!is_eof())
-        {
-          char escaped = peek();
-          if (escaped == '\\' || escaped == 'n' || escaped == 't' ||
-              escaped == '"')
-          {
-            oss << consume(1);
-          }
-          else
-          {
-            std::cerr << "Error: Invalid escape sequence '\\" << escaped
-                      << "' at line " << current_line << ", column "
-                      << current_col << std::endl;
-            std::exit(1);
-          }
-        }
+        consume(end + 1 - pos);
+        std::cerr << "Error: Invalid escape sequence '\\" << escaped
+                  << "' at line " << current_line << ", column "
+                  << current_col << std::endl;
+        std::exit(1);
       }
-      else
-      {
-        oss << consume(1);
-      }
-    }
-
-    if (is_eof())
-    {
-      std::cerr << "Error: Unterminated string literal at line " << current_line
-                << ", column " << current_col << std::endl;
-      std::exit(1);
-    }
-    else if (peek() == '"')
-    {
-      oss << consume(1);
+      end += 2;
+      continue;
     }
+    end++;
+  }
 
-    std::string text = oss.str();
-
-    std::string processed_text =
-        escape_string(text.substr(1, text.length() - 2));
-
-    return bytecode::Token(bytecode::TokenKind::STRING, processed_text, start_line, start_col, this->current_line, this->current_col);
+  if (end >= input.size())
+  {
+    consume(input.size() - pos);
+    std::cerr << "Error: Unterminated string literal at line " << current_line
+              << ", column " << current_col << std::endl;
+    std::exit(1);
   }
-  return std::nullopt;
+
+  std::string_view body = consume(end - pos);
+  consume(1);
+  out.emplace_back(bytecode::TokenKind::STRING, body, start_line, start_col, this->current_line,
+                   this->current_col);
+  return true;
 }
 
-bool bytecode::Lexer::is_eof() const { return this->rest.empty(); }
+bool bytecode::Lexer::is_eof() const { return pos >= input.size(); }
 
-char bytecode::Lexer::peek() const { return this->rest[0]; }
+char bytecode::Lexer::peek(size_t ahead) const
+{
+  return pos + ahead < input.size() ? input[pos + ahead] : '\0';
+}
 
-std::string bytecode::Lexer::consume(int n)
+std::string_view bytecode::Lexer::consume(size_t n)
 {
-  for (size_t i = 0; i < (size_t)n; i++)
+  n = std::min(n, input.size() - pos);
+  std::string_view result = input.substr(pos, n);
+  for (char c : result)
   {
-    if (i >= this->rest.length())
-      break;
-
-    if (this->rest[i] == '\n')
+    if (c == '\n')
     {
       this->current_col = 1;
       this->current_line += 1;
@@ -277,31 +253,31 @@ std::string bytecode::Lexer::consume(int n)
       this->current_col += 1;
     }
   }
-
-  std::string result = this->rest.substr(0, n);
-  this->rest = this->rest.substr(n);
+  pos += n;
   return result;
 }
 
-template <int (*predicate)(int)>
-std::string bytecode::Lexer::take_while() const
+template <typename Predicate>
+size_t bytecode::Lexer::span_while(size_t from, Predicate predicate) const
 {
-  size_t i = 0;
-  while (i < this->rest.length() && predicate(this->rest[i]))
-  {
+  size_t i = from;
+  while (i < input.size() && predicate(input[i]))
     i++;
-  }
-  return this->rest.substr(0, i);
+  return i;
 }
 
-std::string bytecode::Lexer::escape_string(const std::string &str)
+std::string bytecode::unescape_string(std::string_view body)
 {
+  if (body.find('\\') == std::string_view::npos)
+    return std::string(body);
+
   std::string result;
-  for (size_t i = 0; i < str.length(); i++)
+  result.reserve(body.size());
+  for (size_t i = 0; i < body.length(); i++)
   {
-    if (str[i] == '\\' && i + 1 < str.length())
+    if (body[i] == '\\' && i + 1 < body.length())
     {
-      switch (str[i + 1])
+      switch (body[i + 1])
       {
       case '\\':
         result += '\\';
@@ -316,20 +292,20 @@ std::string bytecode::Lexer::escape_string(const std::string &str)
         result += '\t';
         break;
       default:
-        result += str[i + 1];
+        result += body[i + 1];
         break;
       }
       i++; // Skip the next character
     }
     else
     {
-      result += str[i];
+      result += body[i];
     }
   }
   return result;
 }
 
-std::vector<bytecode::Token> bytecode::lex(const std::string &contents)
+std::vector<bytecode::Token> bytecode::lex(std::string_view contents)
 {
   return bytecode::Lexer(contents).lex();
 }
@@ -1,37 +1,42 @@
 #pragma once
 
 #include "./token.hpp"
-#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace bytecode {
 
+// Scans bytecode text in place: tokens are views into file_contents, which
+// must outlive them.
 class Lexer {
 public:
-  Lexer(const std::string &file_contents);
+  Lexer(std::string_view file_contents);
 
   std::vector<Token> lex();
 
 private:
-  std::string rest;
+  std::string_view input;
+  size_t pos;
   int current_line;
   int current_col;
 
   bool is_eof() const;
-  char peek() const;
-  std::string consume(int n);
-  template <int (*predicate)(int)> std::string take_while() const;
+  char peek(size_t ahead = 0) const;
+  std::string_view consume(size_t n);
+  template <typename Predicate> size_t span_while(size_t from, Predicate predicate) const;
 
   bool lex_whitespace();
   bool lex_comment();
-  std::optional<Token> lex_symbol();
-  std::optional<Token> lex_intliteral();
-  std::optional<Token> lex_identifier_or_keyword();
-  std::optional<Token> lex_stringliteral();
-  std::string escape_string(const std::string &str);
+  bool lex_symbol(std::vector<Token> &out);
+  bool lex_intliteral(std::vector<Token> &out);
+  bool lex_identifier_or_keyword(std::vector<Token> &out);
+  bool lex_stringliteral(std::vector<Token> &out);
 };
 
-std::vector<Token> lex(const std::string &contents);
+std::vector<Token> lex(std::string_view contents);
+
+// The value of a string literal's body, with its escape sequences decoded.
+std::string unescape_string(std::string_view body);
 
 } // namespace bytecode
@@ -3,12 +3,24 @@
 #include "./lexer.hpp"
 #include "./types.hpp"
 #include <cassert>
+#include <charconv>
 #include <iostream>
 #include <optional>
 #include <stdexcept>
 
-bytecode::Parser::Parser(const std::vector<Token> &tokens)
-    : tokens(tokens), pos(0) {}
+// std::stoi for token text, which is not NUL-terminated.
+static int parse_int(std::string_view text) {
+  int value = 0;
+  auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+  if (ec == std::errc::result_out_of_range)
+    throw std::out_of_range("stoi");
+  if (ec != std::errc() || end == text.data())
+    throw std::invalid_argument("stoi");
+  return value;
+}
+
+bytecode::Parser::Parser(std::vector<Token> tokens)
+    : tokens(std::move(tokens)), pos(0) {}
 
 bytecode::Function *bytecode::Parser::parse() {
   if (is_eof()) {
@@ -77,7 +89,7 @@ bytecode::Token bytecode::Parser::consume(TokenKind kind,
   throw std::runtime_error(message + " at line " +
                            std::to_string(current.start_line) + ", column " +
                            std::to_string(current.start_col) + " (token: '" +
-                           current.text + "')");
+                           std::string(current.text) + "')");
 }
 
 bytecode::Function *bytecode::Parser::parse_function() {
@@ -102,7 +114,7 @@ bytecode::Function *bytecode::Parser::parse_function() {
   consume(TokenKind::ASSIGN, "Expected '=' after 'parameter_count'");
   auto param_count_token =
       consume(TokenKind::INT, "Expected integer for parameter count");
-  uint32_t param_count = safe_unsigned_cast(std::stoi(param_count_token.text));
+  uint32_t param_count = safe_unsigned_cast(parse_int(param_count_token.text));
   consume(TokenKind::COMMA, "Expected ',' after parameter count");
 
   consume(TokenKind::LOCAL_VARS, "Expected 'local_vars' keyword");
@@ -226,9 +238,9 @@ std::vector<std::string> *bytecode::Parser::parse_ident_list_plus() {
       throw std::runtime_error(
           message + " at line " + std::to_string(current.start_line) +
           ", column " + std::to_string(current.start_col) + " (token: '" +
-          current.text + "')");
+          std::string(current.text) + "')");
     }
-    return advance().text;
+    return std::string(advance().text);
   };
 
   list->push_back(consume_ident_like("Expected identifier"));
@@ -251,11 +263,11 @@ bytecode::Constant *bytecode::Parser::parse_constant() {
     return new bytecode::Constant::Boolean(false);
   } else if (check(TokenKind::STRING)) {
     auto str_token = consume(TokenKind::STRING, "Expected string constant");
-    return new bytecode::Constant::String(str_token.text);
+    return new bytecode::Constant::String(bytecode::unescape_string(str_token.text));
   } else if (check(TokenKind::INT)) {
     auto int_token = consume(TokenKind::INT, "Expected integer constant");
     return new bytecode::Constant::Integer(
-        safe_cast(std::stoi(int_token.text)));
+        safe_cast(parse_int(int_token.text)));
   } else {
     const auto &current = peek();
     throw std::runtime_error("Expected constant at line " +
@@ -294,37 +306,37 @@ bytecode::Instruction bytecode::Parser::parse_instruction() {
     auto operand =
         consume(TokenKind::INT, "Expected integer operand for load_const");
     return bytecode::Instruction(bytecode::Operation::LoadConst,
-                                 safe_cast(std::stoi(operand.text)));
+                                 safe_cast(parse_int(operand.text)));
   } else if (match({TokenKind::LOAD_FUNC})) {
     auto operand =
         consume(TokenKind::INT, "Expected integer operand for load_func");
     return bytecode::Instruction(bytecode::Operation::LoadFunc,
-                                 safe_cast(std::stoi(operand.text)));
+                                 safe_cast(parse_int(operand.text)));
   } else if (match({TokenKind::LOAD_LOCAL})) {
     auto operand =
         consume(TokenKind::INT, "Expected integer operand for load_local");
     return bytecode::Instruction(bytecode::Operation::LoadLocal,
-                                 safe_cast(std::stoi(operand.text)));
+                                 safe_cast(parse_int(operand.text)));
   } else if (match({TokenKind::STORE_LOCAL})) {
     auto operand =
         consume(TokenKind::INT, "Expected integer operand for store_local");
     return bytecode::Instruction(bytecode::Operation::StoreLocal,
-                                 safe_cast(std::stoi(operand.text)));
+                                 safe_cast(parse_int(operand.text)));
   } else if (match({TokenKind::LOAD_GLOBAL})) {
     auto operand =
         consume(TokenKind::INT, "Expected integer operand for load_global");
     return bytecode::Instruction(bytecode::Operation::LoadGlobal,
-                                 safe_cast(std::stoi(operand.text)));
+                                 safe_cast(parse_int(operand.text)));
   } else if (match({TokenKind::STORE_GLOBAL})) {
     auto operand =
         consume(TokenKind::INT, "Expected integer operand for store_global");
     return bytecode::Instruction(bytecode::Operation::StoreGlobal,
-                                 safe_cast(std::stoi(operand.text)));
+                                 safe_cast(parse_int(operand.text)));
   } else if (match({TokenKind::PUSH_REF})) {
     auto operand =
         consume(TokenKind::INT, "Expected integer operand for push_ref");
     return bytecode::Instruction(bytecode::Operation::PushReference,
-                                 safe_cast(std::stoi(operand.text)));
+                                 safe_cast(parse_int(operand.text)));
   } else if (match({TokenKind::LOAD_REF})) {
     return bytecode::Instruction(bytecode::Operation::LoadReference,
                                  std::nullopt);
@@ -332,18 +344,20 @@ bytecode::Instruction bytecode::Parser::parse_instruction() {
     return bytecode::Instruction(bytecode::Operation::StoreReference,
                                  std::nullopt);
   } else if (match({TokenKind::ALLOC_RECORD})) {
-    return bytecode::Instruction(bytecode::Operation::AllocRecord,
-                                 std::nullopt);
+    std::optional<int32_t> size;
+    if (check(TokenKind::INT))
+      size = safe_cast(parse_int(advance().text));
+    return bytecode::Instruction(bytecode::Operation::AllocRecord, size);
   } else if (match({TokenKind::FIELD_LOAD})) {
     auto operand =
         consume(TokenKind::INT, "Expected integer operand for field_load");
     return bytecode::Instruction(bytecode::Operation::FieldLoad,
-                                 safe_cast(std::stoi(operand.text)));
+                                 safe_cast(parse_int(operand.text)));
   } else if (match({TokenKind::FIELD_STORE})) {
     auto operand =
         consume(TokenKind::INT, "Expected integer operand for field_store");
     return bytecode::Instruction(bytecode::Operation::FieldStore,
-                                 safe_cast(std::stoi(operand.text)));
+                                 safe_cast(parse_int(operand.text)));
   } else if (match({TokenKind::INDEX_LOAD})) {
     return bytecode::Instruction(bytecode::Operation::IndexLoad, std::nullopt);
   } else if (match({TokenKind::INDEX_STORE})) {
@@ -352,11 +366,11 @@ bytecode::Instruction bytecode::Parser::parse_instruction() {
     auto operand =
         consume(TokenKind::INT, "Expected integer operand for alloc_closure");
     return bytecode::Instruction(bytecode::Operation::AllocClosure,
-                                 safe_cast(std::stoi(operand.text)));
+                                 safe_cast(parse_int(operand.text)));
   } else if (match({TokenKind::CALL})) {
     auto operand = consume(TokenKind::INT, "Expected integer operand for call");
     return bytecode::Instruction(bytecode::Operation::Call,
-                                 safe_cast(std::stoi(operand.text)));
+                                 safe_cast(parse_int(operand.text)));
   } else if (match({TokenKind::RETURN})) {
     return bytecode::Instruction(bytecode::Operation::Return, std::nullopt);
   } else if (match({TokenKind::ADD})) {
@@ -384,17 +398,37 @@ bytecode::Instruction bytecode::Parser::parse_instruction() {
   } else if (match({TokenKind::GOTO})) {
     auto operand = consume(TokenKind::INT, "Expected integer operand for goto");
     return bytecode::Instruction(bytecode::Operation::Goto,
-                                 safe_cast(std::stoi(operand.text)));
+                                 safe_cast(parse_int(operand.text)));
   } else if (match({TokenKind::IF})) {
     auto operand = consume(TokenKind::INT, "Expected integer operand for if");
     return bytecode::Instruction(bytecode::Operation::If,
-                                 safe_cast(std::stoi(operand.text)));
+                                 safe_cast(parse_int(operand.text)));
   } else if (match({TokenKind::DUP})) {
     return bytecode::Instruction(bytecode::Operation::Dup, std::nullopt);
   } else if (match({TokenKind::SWAP})) {
     return bytecode::Instruction(bytecode::Operation::Swap, std::nullopt);
   } else if (match({TokenKind::POP})) {
     return bytecode::Instruction(bytecode::Operation::Pop, std::nullopt);
+  } else if (match({TokenKind::ADD_I})) {
+    return bytecode::Instruction(bytecode::Operation::AddI, std::nullopt);
+  } else if (match({TokenKind::SUB_I})) {
+    return bytecode::Instruction(bytecode::Operation::SubI, std::nullopt);
+  } else if (match({TokenKind::MUL_I})) {
+    return bytecode::Instruction(bytecode::Operation::MulI, std::nullopt);
+  } else if (match({TokenKind::GT_I})) {
+    return bytecode::Instruction(bytecode::Operation::GtI, std::nullopt);
+  } else if (match({TokenKind::GEQ_I})) {
+    return bytecode::Instruction(bytecode::Operation::GeqI, std::nullopt);
+  } else if (match({TokenKind::EQ_I})) {
+    return bytecode::Instruction(bytecode::Operation::EqI, std::nullopt);
+  } else if (match({TokenKind::FIELD_LOAD_SLOT, TokenKind::FIELD_STORE_SLOT})) {
+    bool load = previous().kind == TokenKind::FIELD_LOAD_SLOT;
+    auto name = consume(TokenKind::INT, "Expected name operand for field slot access");
+    auto slot = consume(TokenKind::INT, "Expected slot operand for field slot access");
+    return bytecode::Instruction(load ? bytecode::Operation::FieldLoadSlot
+                                      : bytecode::Operation::FieldStoreSlot,
+                                 safe_cast(parse_int(name.text)),
+                                 safe_cast(parse_int(slot.text)));
   } else {
     const auto &current = peek();
     throw std::runtime_error("Expected instruction at line " +
@@ -426,8 +460,7 @@ uint32_t bytecode::Parser::safe_unsigned_cast(int64_t value) {
   return new_value;
 }
 
-bytecode::Function *bytecode::parse(const std::string &contents) {
-  auto tokens = bytecode::lex(contents);
-  auto parser = bytecode::Parser(tokens);
+bytecode::Function *bytecode::parse(std::string_view contents) {
+  auto parser = bytecode::Parser(bytecode::lex(contents));
   return parser.parse();
 }
@@ -2,13 +2,14 @@
 
 #include "./token.hpp"
 #include "./types.hpp"
+#include <string_view>
 #include <vector>
 
 namespace bytecode {
 
 class Parser {
 public:
-  Parser(const std::vector<Token> &tokens);
+  Parser(std::vector<Token> tokens);
 
   Function *parse();
 
@@ -39,6 +40,7 @@ private:
   uint32_t safe_unsigned_cast(int64_t value);
 };
 
-Function *parse(const std::string &contents);
+// The returned function copies every string it keeps out of contents.
+Function *parse(std::string_view contents);
 
 } // namespace bytecode
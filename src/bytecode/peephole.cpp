@@ -0,0 +1,202 @@
+#include "peephole.hpp"
+#include "instructions.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace bytecode::peephole {
+
+static bool is_branch(const Instruction& inst) {
+    return inst.operation == Operation::Goto || inst.operation == Operation::If;
+}
+
+static int64_t target_of(const std::vector<Instruction>& code, size_t i) {
+    return static_cast<int64_t>(i) + code[i].operand0.value();
+}
+
+// The boolean a load_const pushes, if it pushes one.
+static const Constant::Boolean* bool_constant(Function* f, const Instruction& inst) {
+    if (inst.operation != Operation::LoadConst) return nullptr;
+    int32_t idx = inst.operand0.value();
+    if (idx < 0 || static_cast<size_t>(idx) >= f->constants_.size()) return nullptr;
+    return dynamic_cast<const Constant::Boolean*>(f->constants_[idx]);
+}
+
+// Redirects every goto and if whose target is a goto to the end of the
+// chain. A chain that loops is left alone.
+static bool thread_jumps(std::vector<Instruction>& code) {
+    const int64_t n = static_cast<int64_t>(code.size());
+    bool changed = false;
+
+    for (size_t i = 0; i < code.size(); i++) {
+        if (!is_branch(code[i])) continue;
+
+        int64_t t = target_of(code, i);
+        for (size_t hops = 0; hops < code.size(); hops++) {
+            if (t < 0 || t >= n || code[t].operation != Operation::Goto) break;
+            int64_t next = target_of(code, t);
+            if (next == t) break;
+            t = next;
+        }
+        if (t < 0 || t > n) continue;
+
+        int32_t offset = static_cast<int32_t>(t - static_cast<int64_t>(i));
+        if (offset != code[i].operand0.value()) {
+            code[i].operand0 = offset;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Marks the instructions no path from the entry reaches.
+static void mark_unreachable(const std::vector<Instruction>& code, std::vector<char>& dead) {
+    const int64_t n = static_cast<int64_t>(code.size());
+    std::vector<char> seen(code.size(), 0);
+    std::vector<int64_t> work;
+    if (n > 0) work.push_back(0);
+
+    while (!work.empty()) {
+        int64_t i = work.back();
+        work.pop_back();
+        if (i < 0 || i >= n || seen[i]) continue;
+        seen[i] = 1;
+
+        const Instruction& inst = code[i];
+        if (is_branch(inst)) work.push_back(target_of(code, i));
+        if (inst.operation != Operation::Goto && inst.operation != Operation::Return)
+            work.push_back(i + 1);
+    }
+
+    for (size_t i = 0; i < code.size(); i++)
+        if (!seen[i]) dead[i] = 1;
+}
+
+// Applies the local rewrites, deleting instructions by marking them in
+// `dead`. Returns whether anything changed.
+static bool rewrite(Function* f, std::vector<char>& dead) {
+    auto& code = f->instructions;
+    const int64_t n = static_cast<int64_t>(code.size());
+
+    // is_target[i]: some branch lands on instruction i.
+    std::vector<char> is_target(code.size() + 1, 0);
+    for (size_t i = 0; i < code.size(); i++) {
+        if (!is_branch(code[i])) continue;
+        int64_t t = target_of(code, i);
+        if (t >= 0 && t <= n) is_target[t] = 1;
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i + 1 < code.size(); i++) {
+        if (dead[i] || dead[i + 1] || is_target[i + 1]) continue;
+        Instruction& a = code[i];
+        Instruction& b = code[i + 1];
+
+        // dup; pop  and  load_const; pop  and  load_func; pop
+        if (b.operation == Operation::Pop &&
+            (a.operation == Operation::Dup || a.operation == Operation::LoadConst ||
+             a.operation == Operation::LoadFunc)) {
+            dead[i] = dead[i + 1] = 1;
+            changed = true;
+            i++;
+            continue;
+        }
+
+        // store_local x; load_local x  =>  dup; store_local x
+        if (a.operation == Operation::StoreLocal && b.operation == Operation::LoadLocal &&
+            a.operand0 == b.operand0) {
+            b = a;
+            a = Instruction(Operation::Dup, std::nullopt);
+            changed = true;
+            i++;
+            continue;
+        }
+
+        // load_const <bool>; if i
+        if (b.operation == Operation::If) {
+            if (const Constant::Boolean* c = bool_constant(f, a)) {
+                dead[i] = 1;
+                if (c->value)
+                    b.operation = Operation::Goto;
+                else
+                    dead[i + 1] = 1;
+                changed = true;
+                i++;
+                continue;
+            }
+        }
+    }
+
+    // goto 1
+    for (size_t i = 0; i < code.size(); i++) {
+        if (!dead[i] && code[i].operation == Operation::Goto && code[i].operand0.value() == 1) {
+            dead[i] = 1;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+// Removes the instructions marked in `dead` and relocates branch offsets.
+// A branch to a removed instruction lands on the next one that is kept;
+// every rewrite above leaves that equivalent.
+static void compact(std::vector<Instruction>& code, const std::vector<char>& dead) {
+    std::vector<int64_t> new_index(code.size() + 1, 0);
+    int64_t kept = 0;
+    for (size_t i = 0; i < code.size(); i++) {
+        new_index[i] = kept;
+        if (!dead[i]) kept++;
+    }
+    new_index[code.size()] = kept;
+
+    const int64_t n = static_cast<int64_t>(code.size());
+    std::vector<Instruction> out;
+    out.reserve(kept);
+    for (size_t i = 0; i < code.size(); i++) {
+        if (dead[i]) continue;
+        Instruction inst = code[i];
+        if (is_branch(inst)) {
+            int64_t t = target_of(code, i);
+            // Out-of-range targets are left for the VM to report.
+            if (t >= 0 && t <= n)
+                inst.operand0 = static_cast<int32_t>(new_index[t] - new_index[i]);
+        }
+        out.push_back(inst);
+    }
+    code = std::move(out);
+}
+
+static void optimize_one(Function* f) {
+    auto& code = f->instructions;
+
+    // Each round shrinks the code or threads a jump, so this terminates;
+    // the bound only guards against pathological inputs.
+    for (int round = 0; round < 16; round++) {
+        bool changed = thread_jumps(code);
+
+        std::vector<char> dead(code.size(), 0);
+        changed |= rewrite(f, dead);
+        mark_unreachable(code, dead);
+
+        bool any_dead = false;
+        for (char d : dead) any_dead |= d != 0;
+        if (any_dead) {
+            compact(code, dead);
+            changed = true;
+        }
+
+        if (!changed) break;
+    }
+}
+
+// Public entry point
+
+void optimize(Function* func)
+{
+    for (Function* child : func->functions_)
+        optimize(child);
+
+    optimize_one(func);
+}
+
+} // namespace bytecode::peephole
@@ -0,0 +1,26 @@
+// bytecode/peephole.hpp
+#pragma once
+
+#include "types.hpp"    // for bytecode::Function
+
+namespace bytecode::peephole {
+
+// Peephole optimization and jump threading of stack bytecode, for .mitbc
+// files that reach the VM without going through the compiler's passes.
+//
+// Rewrites, repeated until none applies:
+//   dup; pop                        => (nothing)
+//   load_const k; pop               => (nothing)   likewise load_func
+//   store_local x; load_local x     => dup; store_local x
+//   load_const true; if i           => goto i
+//   load_const false; if i          => (nothing)
+//   goto/if to a goto               => goto/if to that goto's target
+//   goto to the next instruction    => (nothing)
+// and deletes instructions no path from the entry reaches.
+//
+// A pair is only rewritten when no branch lands on its second
+// instruction. Offsets of the remaining gotos and ifs are relocated.
+// Nested functions are processed too.
+void optimize(Function* func);
+
+} // namespace bytecode::peephole
@@ -141,6 +141,8 @@ void PrettyPrinter::print(const Instruction &inst, std::ostream &os) {
   }
   case Operation::AllocRecord: {
     os << "alloc_record";
+    if (inst.operand0)
+      os << "\t" << inst.operand0.value();
     break;
   }
   case Operation::FieldLoad: {
@@ -235,6 +237,40 @@ void PrettyPrinter::print(const Instruction &inst, std::ostream &os) {
     os << "pop";
     break;
   }
+  case Operation::FieldLoadSlot: {
+    os << "field_load_slot\t" << inst.operand0.value() << "\t"
+       << inst.operand1.value();
+    break;
+  }
+  case Operation::FieldStoreSlot: {
+    os << "field_store_slot\t" << inst.operand0.value() << "\t"
+       << inst.operand1.value();
+    break;
+  }
+  case Operation::AddI: {
+    os << "add_i";
+    break;
+  }
+  case Operation::SubI: {
+    os << "sub_i";
+    break;
+  }
+  case Operation::MulI: {
+    os << "mul_i";
+    break;
+  }
+  case Operation::GtI: {
+    os << "gt_i";
+    break;
+  }
+  case Operation::GeqI: {
+    os << "geq_i";
+    break;
+  }
+  case Operation::EqI: {
+    os << "eq_i";
+    break;
+  }
   default:
     assert(false && "Unhandled Operation");
   }
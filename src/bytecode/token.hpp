@@ -1,6 +1,6 @@
 #pragma once
 
-#include <string>
+#include <string_view>
 
 namespace bytecode {
 
@@ -58,6 +58,14 @@ enum class TokenKind {
   DUP,
   SWAP,
   POP,
+  FIELD_LOAD_SLOT,
+  FIELD_STORE_SLOT,
+  ADD_I,
+  SUB_I,
+  MUL_I,
+  GT_I,
+  GEQ_I,
+  EQ_I,
 
   LBRACE,
   RBRACE,
@@ -71,16 +79,19 @@ enum class TokenKind {
   EOF_TOKEN
 };
 
+// A token's text is a view into the lexed source, which must outlive it.
+// For a string literal it is the body between the quotes, escape sequences
+// and all (see unescape_string in lexer.hpp).
 struct Token {
   TokenKind kind;
-  std::string text;
+  std::string_view text;
   int start_line;
   int start_col;
   int end_line;
   int end_col;
 
-  Token(TokenKind k, std::string t, int sl, int sc, int el, int ec)
-    : kind(k), text(std::move(t)), start_line(sl), start_col(sc), end_line(el), end_col(ec) {}
+  Token(TokenKind k, std::string_view t, int sl, int sc, int el, int ec)
+    : kind(k), text(t), start_line(sl), start_col(sc), end_line(el), end_col(ec) {}
 };
 
-} // namespace bytecode
\ No newline at end of file
+} // namespace bytecode
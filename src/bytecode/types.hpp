@@ -73,5 +73,19 @@ struct Function {
   InstructionList instructions;
   RegisterInstructionList reg_instructions; // Register-based variant
   uint16_t register_count = 0;              // Total registers for reg VM
+  std::vector<FieldCache> field_caches;     // Per-site field inline caches
+  std::vector<int32_t> ref_registers;       // Ref slot -> local register (-1 if none)
+  std::vector<Function *> inline_targets;   // Functions inlined here, by CallGuard
+  uint32_t call_count = 0;                  // Calls seen, for JIT tiering
+  uint32_t back_edge_count = 0;             // Loop back edges seen, for OSR
+  void *jit_code = nullptr;                 // Native entry point once compiled
+  int32_t constant_pool = -1;               // VM constant pool, once translated
+  // Registers live across each Call, for the collector: call_live_maps
+  // holds live_map_words() words per Call, and call_live_map[pc] is the
+  // offset of that Call's map (kNoLiveMap for other instructions).
+  static constexpr uint32_t kNoLiveMap = UINT32_MAX;
+  std::vector<uint32_t> call_live_map;
+  std::vector<uint64_t> call_live_maps;
+  size_t live_map_words() const { return (register_count + 63) / 64; }
 };
 }; // namespace bytecode
@@ -10,12 +10,29 @@ void print_help(char *argv0) {
     std::cout << "\n";
     std::cout << "POSITIONALS:\n";
     std::cout << "  input_file TEXT             Path to input file, use '-' for stdin\n";
+    std::cout << "  batch_inputs TEXT ...       batch: stdin files to run the program on, or @FILE listing them\n";
     std::cout << "\n";
     std::cout << "OPTIONS:\n";
     std::cout << "  -h,     --help              Print this help message and exit\n";
     std::cout << "  -o,     --output TEXT       Path to output file, use '-' for stdout\n";
     std::cout << "  -m,     --mem UINT          Memory limit in MB -- Enabled for VM/derby subcommands\n";
     std::cout << "  -O,     --opt TEXT          Comma-separated list of operators\n";
+    std::cout << "  -O1, -O2, -O3               Optimization presets (added to any -O list)\n";
+    std::cout << "          --time-passes       Report the time spent in each optimization pass on stderr\n";
+    std::cout << "          --compile-threads UINT  Threads for per-function optimization passes (0 = one per core)\n";
+    std::cout << "          --emit-binary       Write a binary bytecode image from compile instead of text\n";
+    std::cout << "          --compile-cache[=DIR]  Reuse derby compilations cached in DIR (default: ~/.cache/mitscript)\n";
+    std::cout << "          --snapshot[=DIR]    Resume derby runs from the heap saved at their first input(), kept in DIR (default: as --compile-cache)\n";
+    std::cout << "          --gc-pause-us UINT  Incremental GC step budget in microseconds (0 = stop-the-world)\n";
+    std::cout << "          --gc-threads UINT   Threads used for GC marking\n";
+    std::cout << "          --gc-background-sweep  Free dead objects on a background thread\n";
+    std::cout << "          --gc-stats[=PATH]   Write GC telemetry as JSON at exit (default: stderr)\n";
+    std::cout << "          --perf-counters[=PATH]  Write hardware counters per phase (compile, translate, execute, mark, sweep) as JSON at exit (default: stderr)\n";
+    std::cout << "          --heap-profile PATH Write sampled allocation sites as collapsed stacks at exit\n";
+    std::cout << "          --profile[=PATH]    Write hot operations, functions, loops and call sites at exit (default: stderr; also -O profile)\n";
+    std::cout << "  -j,     --jobs UINT         batch, serve: programs run at once (0 = one per core)\n";
+    std::cout << "          --output-dir DIR    batch: write each run's output to DIR/<input name>.out instead of stdout\n";
+    std::cout << "          --socket PATH       serve: Unix socket to accept jobs on (see src/serve.hpp for the protocol)\n";
     std::cout << "\n";
     std::cout << "SUBCOMMANDS:\n";
     std::cout << "  scan\n";
@@ -24,13 +41,34 @@ void print_help(char *argv0) {
     std::cout << "  interpret\n";
     std::cout << "  vm\n";
     std::cout << "  derby\n";
+    std::cout << "  batch\n";
+    std::cout << "  serve\n";
 }
 
 void cli_parse_internal(Command &c, int argc, char **argv) {
   std::string input_file = "-";
   std::string output_file = "-";
   size_t mem = 4;
+  size_t gc_pause_us = 0;
+  size_t gc_threads = 1;
+  bool gc_background_sweep = false;
+  std::string gc_stats;
+  std::string perf_counters;
+  std::string heap_profile;
+  std::string profile;
   std::vector<std::string> opt;
+  int opt_level = 0;
+  bool time_passes = false;
+  size_t compile_threads = 0;
+  bool emit_binary = false;
+  bool compile_cache = false;
+  std::string compile_cache_dir;
+  bool snapshot = false;
+  std::string snapshot_dir;
+  std::vector<std::string> batch_inputs;
+  size_t jobs = 0;
+  std::string output_dir;
+  std::string socket_path;
   CommandKind kind;
 
   if (argc < 2) {
@@ -52,6 +90,10 @@ void cli_parse_internal(Command &c, int argc, char **argv) {
     kind = CommandKind::VM;
   } else if (subcommand == "derby") {
     kind = CommandKind::DERBY;
+  } else if (subcommand == "batch") {
+    kind = CommandKind::BATCH;
+  } else if (subcommand == "serve") {
+    kind = CommandKind::SERVE;
   } else if (subcommand == "-h" || subcommand == "--help") {
     print_help(argv[0]);
     exit(0);
@@ -83,6 +125,101 @@ void cli_parse_internal(Command &c, int argc, char **argv) {
       }
     } else if (arg.rfind("--mem=", 0) == 0) {
       mem = std::stoul(arg.substr(6));
+    } else if (arg == "--gc-pause-us") {
+      if (i + 1 < argc) {
+        gc_pause_us = std::stoul(argv[++i]);
+      } else {
+        std::cerr << "Error: --gc-pause-us requires a value\n";
+        exit(1);
+      }
+    } else if (arg.rfind("--gc-pause-us=", 0) == 0) {
+      gc_pause_us = std::stoul(arg.substr(14));
+    } else if (arg == "--gc-threads") {
+      if (i + 1 < argc) {
+        gc_threads = std::stoul(argv[++i]);
+      } else {
+        std::cerr << "Error: --gc-threads requires a value\n";
+        exit(1);
+      }
+    } else if (arg.rfind("--gc-threads=", 0) == 0) {
+      gc_threads = std::stoul(arg.substr(13));
+    } else if (arg == "--gc-background-sweep") {
+      gc_background_sweep = true;
+    } else if (arg == "--gc-stats") {
+      gc_stats = "-";
+    } else if (arg.rfind("--gc-stats=", 0) == 0) {
+      gc_stats = arg.substr(11);
+    } else if (arg == "--perf-counters") {
+      perf_counters = "-";
+    } else if (arg.rfind("--perf-counters=", 0) == 0) {
+      perf_counters = arg.substr(16);
+    } else if (arg == "--heap-profile") {
+      if (i + 1 < argc) {
+        heap_profile = argv[++i];
+      } else {
+        std::cerr << "Error: --heap-profile requires a value\n";
+        exit(1);
+      }
+    } else if (arg.rfind("--heap-profile=", 0) == 0) {
+      heap_profile = arg.substr(15);
+    } else if (arg == "--profile") {
+      profile = "-";
+    } else if (arg.rfind("--profile=", 0) == 0) {
+      profile = arg.substr(10);
+    } else if (arg == "-j" || arg == "--jobs") {
+      if (i + 1 < argc) {
+        jobs = std::stoul(argv[++i]);
+      } else {
+        std::cerr << "Error: -j/--jobs requires a value\n";
+        exit(1);
+      }
+    } else if (arg.rfind("--jobs=", 0) == 0) {
+      jobs = std::stoul(arg.substr(7));
+    } else if (arg == "--output-dir") {
+      if (i + 1 < argc) {
+        output_dir = argv[++i];
+      } else {
+        std::cerr << "Error: --output-dir requires a value\n";
+        exit(1);
+      }
+    } else if (arg.rfind("--output-dir=", 0) == 0) {
+      output_dir = arg.substr(13);
+    } else if (arg == "--socket") {
+      if (i + 1 < argc) {
+        socket_path = argv[++i];
+      } else {
+        std::cerr << "Error: --socket requires a value\n";
+        exit(1);
+      }
+    } else if (arg.rfind("--socket=", 0) == 0) {
+      socket_path = arg.substr(9);
+    } else if (arg == "-O1" || arg == "-O2" || arg == "-O3") {
+      opt_level = arg[2] - '0';
+    } else if (arg == "-O0") {
+      opt_level = 0;
+    } else if (arg == "--time-passes") {
+      time_passes = true;
+    } else if (arg == "--emit-binary") {
+      emit_binary = true;
+    } else if (arg == "--compile-cache") {
+      compile_cache = true;
+    } else if (arg.rfind("--compile-cache=", 0) == 0) {
+      compile_cache = true;
+      compile_cache_dir = arg.substr(16);
+    } else if (arg == "--snapshot") {
+      snapshot = true;
+    } else if (arg.rfind("--snapshot=", 0) == 0) {
+      snapshot = true;
+      snapshot_dir = arg.substr(11);
+    } else if (arg == "--compile-threads") {
+      if (i + 1 < argc) {
+        compile_threads = std::stoul(argv[++i]);
+      } else {
+        std::cerr << "Error: --compile-threads requires a value\n";
+        exit(1);
+      }
+    } else if (arg.rfind("--compile-threads=", 0) == 0) {
+      compile_threads = std::stoul(arg.substr(18));
     } else if (arg == "-O" || arg == "--opt") {
       if (i + 1 < argc) {
         std::string opt_str = argv[++i];
@@ -115,6 +252,20 @@ void cli_parse_internal(Command &c, int argc, char **argv) {
     } else if (arg.rfind("-", 0) == 0) {
       // Ignore unknown flags to stay lenient with wrapper scripts.
       continue;
+    } else if (kind == CommandKind::BATCH) {
+      if (arg.rfind("@", 0) == 0) {
+        std::ifstream list(arg.substr(1));
+        if (!list) {
+          std::cerr << "Error: cannot read input list '" << arg.substr(1) << "'\n";
+          exit(1);
+        }
+        std::string line;
+        while (std::getline(list, line))
+          if (!line.empty())
+            batch_inputs.push_back(line);
+      } else {
+        batch_inputs.push_back(arg);
+      }
     } else {
       // Ignore extra positionals.
       continue;
@@ -130,11 +281,30 @@ void cli_parse_internal(Command &c, int argc, char **argv) {
   c.input_stream =
       (input_file == "-") ? &std::cin : new std::ifstream(input_file);
   c.output_stream =
-      (output_file == "-") ? &std::cout : new std::ofstream(output_file);
+      (output_file == "-") ? &std::cout : new std::ofstream(output_file, std::ios::binary);
   c.input_filename = input_file;
   c.kind = kind;
   c.mem = mem;
+  c.gc_pause_us = gc_pause_us;
+  c.gc_threads = gc_threads;
+  c.gc_background_sweep = gc_background_sweep;
+  c.gc_stats = gc_stats;
+  c.perf_counters = perf_counters;
+  c.heap_profile = heap_profile;
+  c.profile = profile;
   c.opt = opt;
+  c.opt_level = opt_level;
+  c.time_passes = time_passes;
+  c.compile_threads = compile_threads;
+  c.emit_binary = emit_binary;
+  c.compile_cache = compile_cache;
+  c.compile_cache_dir = compile_cache_dir;
+  c.snapshot = snapshot;
+  c.snapshot_dir = snapshot_dir;
+  c.batch_inputs = batch_inputs;
+  c.jobs = jobs;
+  c.output_dir = output_dir;
+  c.socket_path = socket_path;
 }
 
 Command cli_parse(int argc, char **argv) {
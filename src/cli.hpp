@@ -4,7 +4,7 @@
 #include <vector>
 #include <string>
 
-enum class CommandKind { SCAN, PARSE, COMPILE, INTERPRET, VM, DERBY };
+enum class CommandKind { SCAN, PARSE, COMPILE, INTERPRET, VM, DERBY, BATCH, SERVE };
 
 struct Command {
   CommandKind kind;
@@ -13,10 +13,29 @@ struct Command {
   std::string input_filename;
   std::string output_filename;
   size_t mem;
+  size_t gc_pause_us;
+  size_t gc_threads;
+  bool gc_background_sweep;
+  std::string gc_stats;
+  std::string perf_counters;
+  std::string heap_profile;
+  std::string profile;
   std::vector<std::string> opt;
+  int opt_level;
+  bool time_passes;
+  size_t compile_threads;
+  bool emit_binary;
+  bool compile_cache;
+  std::string compile_cache_dir;
+  bool snapshot;
+  std::string snapshot_dir;
+  std::vector<std::string> batch_inputs;
+  size_t jobs;
+  std::string output_dir;
+  std::string socket_path;
 
   Command()
-      : input_stream(nullptr), output_stream(nullptr), input_filename(""), output_filename(""), mem(4), opt() {}
+      : input_stream(nullptr), output_stream(nullptr), input_filename(""), output_filename(""), mem(4), gc_pause_us(0), gc_threads(1), gc_background_sweep(false), gc_stats(), perf_counters(), heap_profile(), profile(), opt(), opt_level(0), time_passes(false), compile_threads(0), emit_binary(false), compile_cache(false), compile_cache_dir(), snapshot(false), snapshot_dir(), batch_inputs(), jobs(0), output_dir(), socket_path() {}
 
   ~Command() {
     if (input_stream && input_stream != &std::cin) {
@@ -0,0 +1,164 @@
+#include "compile_cache.hpp"
+
+#include "bytecode/binary.hpp"
+#include "source_file.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Identifies the running compiler by its executable's size and mtime.
+std::string compiler_stamp() {
+  std::error_code ec;
+  fs::path exe = fs::read_symlink("/proc/self/exe", ec);
+  if (ec)
+    return __DATE__ " " __TIME__;
+  auto size = fs::file_size(exe, ec);
+  auto mtime = fs::last_write_time(exe, ec).time_since_epoch().count();
+  if (ec)
+    return __DATE__ " " __TIME__;
+  return exe.string() + " " + std::to_string(size) + " " + std::to_string(mtime);
+}
+
+uint64_t fnv1a(std::string_view s) {
+  uint64_t h = 1469598103934665603ull;
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+void put_length(std::string &out, uint64_t n) {
+  for (int i = 0; i < 8; ++i)
+    out.push_back(static_cast<char>(n >> (8 * i)));
+}
+
+uint64_t get_length(std::string_view in) {
+  uint64_t n = 0;
+  for (int i = 0; i < 8; ++i)
+    n |= uint64_t{static_cast<unsigned char>(in[i])} << (8 * i);
+  return n;
+}
+
+} // namespace
+
+CompileCache::CompileCache(std::string dir, std::string_view options, std::string_view source)
+    : dir_(dir.empty() ? default_dir() : std::move(dir)) {
+  key_ = "mitscript compile cache\n";
+  key_ += compiler_stamp();
+  key_ += '\n';
+  key_ += options;
+  key_ += '\n';
+  key_ += source;
+
+  char name[32];
+  std::snprintf(name, sizeof name, "%016llx", static_cast<unsigned long long>(fnv1a(key_)));
+  path_ = (fs::path(dir_) / name).string() + ".mitbin";
+  snapshot_path_ = (fs::path(dir_) / name).string() + ".mitsnap";
+}
+
+std::optional<SourceFile> CompileCache::open_entry(const std::string &path) const {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return std::nullopt;
+  SourceFile entry = SourceFile::open(path, in);
+  std::string_view text = entry.text();
+
+  if (text.size() < 8 || get_length(text) != key_.size() ||
+      text.size() - 8 < key_.size() + 8 || text.substr(8, key_.size()) != key_)
+    return std::nullopt;
+  // A torn or damaged payload could still decode, as a different program.
+  if (get_length(text.substr(8 + key_.size())) != fnv1a(text.substr(payload_offset())))
+    return std::nullopt;
+  return entry;
+}
+
+void CompileCache::write_entry(const std::string &path, std::string_view payload) const {
+  std::error_code ec;
+  fs::create_directories(dir_, ec);
+  if (ec)
+    return;
+
+  std::string header;
+  put_length(header, key_.size());
+  std::string checksum;
+  put_length(checksum, fnv1a(payload));
+
+  std::string tmp = path + ".tmp." + std::to_string(getpid());
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out << header << key_ << checksum << payload;
+    if (!out.flush()) {
+      out.close();
+      fs::remove(tmp, ec);
+      return;
+    }
+  }
+  fs::rename(tmp, path, ec);
+  if (ec)
+    fs::remove(tmp, ec);
+}
+
+bytecode::Function *CompileCache::load() const {
+  std::optional<SourceFile> entry = open_entry(path_);
+  if (!entry)
+    return nullptr;
+  try {
+    return bytecode::read_binary(entry->text().substr(payload_offset()));
+  } catch (const std::exception &) {
+    return nullptr;
+  }
+}
+
+void CompileCache::store(const bytecode::Function *program) const {
+  std::ostringstream image;
+  bytecode::write_binary(program, image);
+  write_entry(path_, image.str());
+}
+
+// A snapshot entry's payload is the image's length, the image and then
+// the VM state.
+std::optional<CompileCache::Snapshot> CompileCache::load_snapshot() const {
+  std::optional<SourceFile> entry = open_entry(snapshot_path_);
+  if (!entry)
+    return std::nullopt;
+  Snapshot snapshot{std::move(*entry), nullptr, {}};
+  std::string_view payload = snapshot.file.text().substr(payload_offset());
+  if (payload.size() < 8 || get_length(payload) > payload.size() - 8)
+    return std::nullopt;
+  uint64_t image_size = get_length(payload);
+  try {
+    snapshot.program = bytecode::read_binary(payload.substr(8, image_size));
+  } catch (const std::exception &) {
+    return std::nullopt;
+  }
+  snapshot.state = payload.substr(8 + image_size);
+  return snapshot;
+}
+
+void CompileCache::store_snapshot(std::string_view image, std::string_view state) const {
+  std::string payload;
+  put_length(payload, image.size());
+  payload += image;
+  payload += state;
+  write_entry(snapshot_path_, payload);
+}
+
+std::string CompileCache::default_dir() {
+  if (const char *dir = std::getenv("MITSCRIPT_CACHE_DIR"); dir && *dir)
+    return dir;
+  if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+    return (fs::path(xdg) / "mitscript").string();
+  if (const char *home = std::getenv("HOME"); home && *home)
+    return (fs::path(home) / ".cache" / "mitscript").string();
+  return (fs::temp_directory_path() / "mitscript-cache").string();
+}
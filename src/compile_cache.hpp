@@ -0,0 +1,64 @@
+#pragma once
+
+#include "bytecode/types.hpp"
+#include "source_file.hpp"
+#include <optional>
+#include <string>
+#include <string_view>
+
+// On-disk cache of compiled programs for the derby subcommand. An entry is
+// a binary bytecode image (bytecode/binary.hpp) keyed by everything the
+// compiler's output depends on: the source text, the optimization options
+// and the compiler executable itself, so rebuilding the compiler or
+// changing -O invalidates old entries.
+//
+// Entries are named by a hash of the key but store the whole key, and a
+// load compares it byte for byte, so a hash collision is a miss rather
+// than the wrong program. A checksum of the payload follows the key, so a
+// damaged entry is a miss too. Entries are written to a temporary file
+// and renamed into place, so concurrent runs never see a partial entry.
+//
+// Next to a program's entry the cache can keep a snapshot of it for
+// --snapshot: the image together with the VM state saved when the program
+// first called input() (VM::save_snapshot).
+class CompileCache {
+public:
+  // A loaded snapshot entry. `state` points into the mapped entry file.
+  struct Snapshot {
+    SourceFile file;
+    bytecode::Function *program;
+    std::string_view state;
+  };
+
+  // `dir` may be empty for default_dir().
+  CompileCache(std::string dir, std::string_view options, std::string_view source);
+
+  // The cached program, or nullptr when there is no valid entry.
+  bytecode::Function *load() const;
+
+  // Saves program as the entry for this key. Failures (an unwritable
+  // directory, a full disk) only lose the entry.
+  void store(const bytecode::Function *program) const;
+
+  // The snapshot entry for this key, if there is a valid one.
+  std::optional<Snapshot> load_snapshot() const;
+
+  // Saves a snapshot of the program whose binary image is `image`.
+  void store_snapshot(std::string_view image, std::string_view state) const;
+
+  // $MITSCRIPT_CACHE_DIR, else $XDG_CACHE_HOME/mitscript, else
+  // ~/.cache/mitscript, else mitscript-cache in the temp directory.
+  static std::string default_dir();
+
+private:
+  // The entry at `path` with its key and checksum checked, or nothing;
+  // the entry's payload starts at payload_offset().
+  std::optional<SourceFile> open_entry(const std::string &path) const;
+  size_t payload_offset() const { return 8 + key_.size() + 8; }
+  void write_entry(const std::string &path, std::string_view payload) const;
+
+  std::string dir_;
+  std::string path_;
+  std::string snapshot_path_;
+  std::string key_;
+};
@@ -0,0 +1,509 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+/*
+  Page-based backing store for CollectedHeap.
+
+  Small objects are segregated by size class (multiples of kGranule up to
+  kMaxSmallSize). Each class owns 64 KiB pages of equal-sized cells; a
+  page's header, at the start of its aligned block, keeps one bit per cell
+  in each of four side bitmaps: allocated, marked, old (survived a
+  collection) and remembered (the card table: old objects that may point
+  to young ones). Objects themselves carry no GC state beyond their
+  vtable pointer. Allocation is a cursor over the allocated bitmap:
+  fresh pages and pages emptied by a sweep hand out consecutive cells, so
+  new objects are laid out contiguously in allocation order, and the
+  collector sweeps by walking pages instead of chasing a list.
+
+  Objects larger than kMaxSmallSize get a block of their own with the same
+  header, so every object's page is found by masking its address.
+
+  Objects never move (the VM holds raw pointers to them), so the young
+  generation is not a separate space: it is whatever was allocated since
+  the last collection. The pages it was allocated in are the nursery;
+  only they can hold young objects, so a minor collection prepares just
+  those pages and its sweep cost follows the allocation since the last
+  collection rather than the size of the heap.
+
+  Sweeping is lazy. After marking, prepare_sweep() makes one pass over the
+  bitmaps only: it promotes survivors, clears the mark bits, counts the
+  dead and queues the pages that hold any. From then on a queued page's
+  allocated-but-not-old cells are exactly its dead objects, so their
+  destructors can run later: when the allocator next takes the page, on
+  the optional background sweeper thread, or at the start of the next
+  collection's pass, so a dead object's own allocations (vector and string
+  buffers) are held for at most one cycle.
+*/
+class HeapArena {
+ public:
+  static constexpr std::size_t kPageSize = 64 * 1024;
+  static constexpr std::size_t kGranule = 16;
+  static constexpr std::size_t kMaxSmallSize = 512;
+  static constexpr std::size_t kNumClasses = kMaxSmallSize / kGranule;
+  static constexpr std::size_t kMaxCells = kPageSize / kGranule;
+  static constexpr std::size_t kBitmapWords = kMaxCells / 64;
+
+  enum : uint8_t { kSwept, kPending, kSweeping };
+
+  // Destroys the object in a dead cell; set by the owning heap.
+  using Finalizer = void (*)(void* ctx, void* object);
+
+  struct Page {
+    uint32_t cell_size;
+    uint32_t cells;      // number of cells in the page
+    uint32_t live = 0;   // allocated cells
+    uint32_t recip;      // ceil(2^32 / cell_size), for cell_index()
+    uint32_t size_class; // kNumClasses for a large object
+    uint32_t cursor = 0; // allocation resumes at this bitmap word
+    uint32_t pending_dead = 0; // dead cells queued for sweeping
+    uint8_t state = kSwept;    // kSwept, kPending or kSweeping (atomic_ref)
+    bool has_dirty_cards = false; // listed in the heap's dirty pages
+    bool in_nursery = false;      // allocated into since the last sweep
+    uint64_t alloc_bits[kBitmapWords];
+    uint64_t mark_bits[kBitmapWords];
+    uint64_t old_bits[kBitmapWords];
+    uint64_t remembered_bits[kBitmapWords];
+
+    char* cells_begin() {
+      return reinterpret_cast<char*>(this) + kHeaderSize;
+    }
+    void* cell(std::size_t i) { return cells_begin() + i * cell_size; }
+
+    std::size_t cell_index(const void* p) {
+      uint64_t offset = static_cast<uint64_t>(
+          static_cast<const char*>(p) - cells_begin());
+      return static_cast<std::size_t>((offset * recip) >> 32);
+    }
+
+    bool allocated(std::size_t i) const { return test(alloc_bits, i); }
+
+    static bool test(const uint64_t* bits, std::size_t i) {
+      return (bits[i / 64] >> (i % 64)) & 1;
+    }
+    static void set(uint64_t* bits, std::size_t i) {
+      bits[i / 64] |= uint64_t{1} << (i % 64);
+    }
+
+    // Cells that exist in bitmap word w (the last word may be partial).
+    uint64_t valid_mask(std::size_t w) const {
+      if ((w + 1) * 64 <= cells) return ~uint64_t{0};
+      if (w * 64 >= cells) return 0;
+      return (uint64_t{1} << (cells - w * 64)) - 1;
+    }
+    std::size_t words() const { return (cells + 63) / 64; }
+  };
+
+  static constexpr std::size_t kHeaderSize =
+      (sizeof(Page) + kGranule - 1) / kGranule * kGranule;
+
+  HeapArena() = default;
+  HeapArena(const HeapArena&) = delete;
+  HeapArena& operator=(const HeapArena&) = delete;
+
+  // Frees the pages. Objects still in them are not destroyed unless
+  // destroy_objects() ran first.
+  ~HeapArena() {
+    set_background_sweep(false);
+    for (auto& cls : classes_) {
+      for (Page* page : cls.pages) std::free(page);
+    }
+    for (Page* page : large_) std::free(page);
+  }
+
+  void set_finalizer(Finalizer finalize, void* ctx) {
+    finalize_ = finalize;
+    finalize_ctx_ = ctx;
+  }
+
+  // Starts or stops the thread that sweeps queued pages in the background.
+  // The finalizer then runs on that thread too.
+  void set_background_sweep(bool on) {
+    if (on == sweeper_.joinable()) return;
+    if (on) {
+      sweeper_shutdown_ = false;
+      sweeper_ = std::thread([this] { run_sweeper(); });
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(sweeper_mutex_);
+      sweeper_shutdown_ = true;
+      sweeper_pause_.store(true, std::memory_order_relaxed);
+    }
+    sweeper_cv_.notify_all();
+    sweeper_.join();
+    sweeper_pause_.store(false, std::memory_order_relaxed);
+  }
+
+  static Page* page_of(const void* p) {
+    return reinterpret_cast<Page*>(reinterpret_cast<uintptr_t>(p) &
+                                   ~(kPageSize - 1));
+  }
+
+  // Storage for an object of `size` bytes. `cell_size` receives the number
+  // of bytes actually reserved.
+  void* allocate(std::size_t size, std::size_t& cell_size) {
+    if (size > kMaxSmallSize) return allocate_large(size, cell_size);
+    std::size_t c = size == 0 ? 0 : (size - 1) / kGranule;
+    SizeClass& cls = classes_[c];
+    cell_size = (c + 1) * kGranule;
+    while (true) {
+      if (cls.current) {
+        if (void* p = take_cell(cls.current)) return p;
+        cls.current = nullptr;
+      }
+      if (cls.next_available < cls.available.size()) {
+        Page* page = cls.available[cls.next_available++];
+        // A page the background sweeper holds is skipped for this cycle.
+        if (claim(page)) {
+          sweep_page(page);
+          cls.current = enter_nursery(page);
+        } else if (state_of(page).load(std::memory_order_acquire) == kSwept) {
+          cls.current = enter_nursery(page);
+        }
+        continue;
+      }
+      cls.current = enter_nursery(new_page(c));
+      cls.pages.push_back(cls.current);
+    }
+  }
+
+  // Undoes an allocation whose constructor threw.
+  static void release(void* p) {
+    Page* page = page_of(p);
+    std::size_t i = page->cell_index(p);
+    page->alloc_bits[i / 64] &= ~(uint64_t{1} << (i % 64));
+    page->live -= 1;
+  }
+
+  /*
+    Called after marking. A minor collection promotes marked young cells to
+    old, visiting only the nursery pages; a full one leaves exactly the
+    marked cells old and clears the remembered bits. Either way the mark bits are cleared, pages whose dead
+    objects still need destroying are queued, empty pages are returned to
+    the system, and the number of newly dead cells and their bytes are
+    returned. Works a bitmap word (64 cells) at a time and never touches
+    the objects.
+  */
+  struct SweepStats {
+    std::size_t objects = 0;
+    std::size_t bytes = 0;
+  };
+
+  SweepStats prepare_sweep(bool minor) {
+    pause_sweeper();
+    sweep_queued_pages();
+    SweepStats stats;
+    auto prepare_page = [&](Page* page) {
+      uint32_t dead_cells = 0;
+      for (std::size_t w = 0, n = page->words(); w < n; ++w) {
+        uint64_t alloc = page->alloc_bits[w] & page->valid_mask(w);
+        uint64_t marked = page->mark_bits[w];
+        if (minor) {
+          page->old_bits[w] |= alloc & marked;
+        } else {
+          page->old_bits[w] = alloc & marked;
+          page->remembered_bits[w] = 0;
+        }
+        page->mark_bits[w] = 0;
+        dead_cells += static_cast<uint32_t>(
+            __builtin_popcountll(alloc & ~page->old_bits[w]));
+      }
+      stats.objects += dead_cells;
+      stats.bytes += std::size_t{dead_cells} * page->cell_size;
+      page->pending_dead = dead_cells;
+      page->state = dead_cells ? kPending : kSwept;
+    };
+    if (minor) {
+      for (Page* page : nursery_) prepare_page(page);
+    } else {
+      for (auto& cls : classes_) {
+        for (Page* page : cls.pages) prepare_page(page);
+      }
+      for (Page* page : large_) prepare_page(page);
+    }
+    for (Page* page : nursery_) page->in_nursery = false;
+    nursery_.clear();
+    reclaim();
+    resume_sweeper();
+    return stats;
+  }
+
+  // Destroys the dead objects of every queued page now.
+  void finish_sweep() {
+    pause_sweeper();
+    sweep_queued_pages();
+    resume_sweeper();
+  }
+
+  // Destroys every object still in the arena, live or dead, for a heap
+  // that goes away before the program does. Stops the background sweeper.
+  void destroy_objects() {
+    set_background_sweep(false);
+    auto destroy = [&](Page* page) {
+      for (std::size_t w = 0, n = page->words(); w < n; ++w) {
+        uint64_t alloc = page->alloc_bits[w] & page->valid_mask(w);
+        for (uint64_t bits = alloc; bits; bits &= bits - 1) {
+          std::size_t i = w * 64 + static_cast<unsigned>(__builtin_ctzll(bits));
+          finalize_(finalize_ctx_, page->cell(i));
+        }
+        page->alloc_bits[w] = 0;
+      }
+      page->live = 0;
+      page->pending_dead = 0;
+    };
+    for (auto& cls : classes_) {
+      for (Page* page : cls.pages) destroy(page);
+    }
+    for (Page* page : large_) destroy(page);
+  }
+
+ private:
+  void sweep_queued_pages() {
+    for (auto& cls : classes_) {
+      for (Page* page : cls.pages) {
+        if (claim(page)) sweep_page(page);
+      }
+    }
+    for (Page* page : large_) {
+      if (claim(page)) sweep_page(page);
+    }
+  }
+
+  static std::atomic_ref<uint8_t> state_of(Page* page) {
+    return std::atomic_ref<uint8_t>(page->state);
+  }
+
+  // Takes a queued page for sweeping; false if it is not queued.
+  static bool claim(Page* page) {
+    uint8_t expected = kPending;
+    return state_of(page).compare_exchange_strong(
+        expected, kSweeping, std::memory_order_acquire);
+  }
+
+  // Destroys a claimed page's dead objects and frees their cells.
+  void sweep_page(Page* page) {
+    for (std::size_t w = 0, n = page->words(); w < n; ++w) {
+      uint64_t dead =
+          page->alloc_bits[w] & page->valid_mask(w) & ~page->old_bits[w];
+      if (!dead) continue;
+      for (uint64_t bits = dead; bits; bits &= bits - 1) {
+        std::size_t i = w * 64 + static_cast<unsigned>(__builtin_ctzll(bits));
+        finalize_(finalize_ctx_, page->cell(i));
+      }
+      page->alloc_bits[w] &= ~dead;
+    }
+    page->live -= page->pending_dead;
+    page->pending_dead = 0;
+    page->cursor = 0;
+    state_of(page).store(kSwept, std::memory_order_release);
+  }
+
+  // Returns empty pages to the system and queues every page that has, or
+  // will have once swept, free cells for allocation.
+  void reclaim() {
+    for (std::size_t c = 0; c < kNumClasses; ++c) {
+      SizeClass& cls = classes_[c];
+      std::vector<Page*> kept;
+      kept.reserve(cls.pages.size());
+      cls.available.clear();
+      cls.next_available = 0;
+      cls.current = nullptr;
+      std::size_t empty_kept = 0;
+      for (Page* page : cls.pages) {
+        if (page->live == 0) {
+          if (empty_kept >= kRetainedEmptyPages) {
+            std::free(page);
+            continue;
+          }
+          ++empty_kept;
+        }
+        page->cursor = 0;
+        if (page->live - page->pending_dead < page->cells)
+          cls.available.push_back(page);
+        kept.push_back(page);
+      }
+      cls.pages = std::move(kept);
+    }
+    std::vector<Page*> large;
+    large.reserve(large_.size());
+    for (Page* page : large_) {
+      if (page->live == 0)
+        std::free(page);
+      else
+        large.push_back(page);
+    }
+    large_ = std::move(large);
+    // Without a background sweeper nothing else would destroy dead large
+    // objects, and their blocks are worth returning promptly.
+    if (!sweeper_.joinable()) {
+      for (Page* page : large_) {
+        if (claim(page)) sweep_page(page);
+      }
+    }
+  }
+
+  // Background sweeping. The sweeper walks the pages queued by the last
+  // prepare_sweep(), racing the allocator for each through claim(). The
+  // collector pauses it before rewriting bitmaps or the page lists.
+  void run_sweeper() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(sweeper_mutex_);
+    while (true) {
+      sweeper_cv_.wait(lock, [&] {
+        return sweeper_shutdown_ ||
+               (sweeper_epoch_ != seen &&
+                !sweeper_pause_.load(std::memory_order_relaxed));
+      });
+      if (sweeper_shutdown_) return;
+      seen = sweeper_epoch_;
+      sweeper_busy_ = true;
+      lock.unlock();
+      for (Page* page : sweeper_queue_) {
+        if (sweeper_pause_.load(std::memory_order_acquire)) break;
+        if (claim(page)) sweep_page(page);
+      }
+      lock.lock();
+      sweeper_busy_ = false;
+      sweeper_idle_cv_.notify_all();
+    }
+  }
+
+  void pause_sweeper() {
+    if (!sweeper_.joinable()) return;
+    std::unique_lock<std::mutex> lock(sweeper_mutex_);
+    sweeper_pause_.store(true, std::memory_order_release);
+    sweeper_idle_cv_.wait(lock, [this] { return !sweeper_busy_; });
+  }
+
+  void resume_sweeper() {
+    if (!sweeper_.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(sweeper_mutex_);
+      sweeper_queue_.clear();
+      for (auto& cls : classes_) {
+        for (Page* page : cls.pages) {
+          if (page->state == kPending) sweeper_queue_.push_back(page);
+        }
+      }
+      for (Page* page : large_) {
+        if (page->state == kPending) sweeper_queue_.push_back(page);
+      }
+      sweeper_pause_.store(false, std::memory_order_relaxed);
+      ++sweeper_epoch_;
+    }
+    sweeper_cv_.notify_all();
+  }
+
+  // Pages per class that survive a sweep even when empty, so a workload
+  // hovering at a page boundary does not return and refetch memory.
+  static constexpr std::size_t kRetainedEmptyPages = 1;
+
+  struct SizeClass {
+    std::vector<Page*> pages;
+    std::vector<Page*> available; // pages with free cells, from reclaim()
+    std::size_t next_available = 0;
+    Page* current = nullptr;
+  };
+
+  SizeClass classes_[kNumClasses];
+  std::vector<Page*> large_;
+  std::vector<Page*> nursery_; // pages allocated into since the last sweep
+
+  Page* enter_nursery(Page* page) {
+    if (!page->in_nursery) {
+      page->in_nursery = true;
+      nursery_.push_back(page);
+    }
+    return page;
+  }
+
+  Finalizer finalize_ = nullptr;
+  void* finalize_ctx_ = nullptr;
+
+  std::thread sweeper_;
+  std::mutex sweeper_mutex_;
+  std::condition_variable sweeper_cv_;
+  std::condition_variable sweeper_idle_cv_;
+  std::vector<Page*> sweeper_queue_;
+  std::atomic<bool> sweeper_pause_{false};
+  uint64_t sweeper_epoch_ = 0;
+  bool sweeper_busy_ = false;
+  bool sweeper_shutdown_ = false;
+
+  static void* take_cell(Page* page) {
+    for (uint32_t w = page->cursor; w < kBitmapWords; ++w) {
+      uint64_t free_bits = ~page->alloc_bits[w];
+      if (!free_bits) continue;
+      unsigned bit = static_cast<unsigned>(__builtin_ctzll(free_bits));
+      page->alloc_bits[w] |= uint64_t{1} << bit;
+      page->live += 1;
+      page->cursor = w;
+      return page->cell(w * 64 + bit);
+    }
+    page->cursor = kBitmapWords;
+    return nullptr;
+  }
+
+  static Page* init_page(void* block, uint32_t cell_size, uint32_t cells,
+                         uint32_t size_class) {
+    Page* page = static_cast<Page*>(block);
+    page->cell_size = cell_size;
+    page->cells = cells;
+    page->live = 0;
+    page->recip = static_cast<uint32_t>(((uint64_t{1} << 32) + cell_size - 1) /
+                                        cell_size);
+    page->size_class = size_class;
+    page->cursor = 0;
+    page->pending_dead = 0;
+    page->state = kSwept;
+    page->has_dirty_cards = false;
+    page->in_nursery = false;
+    std::memset(page->mark_bits, 0, sizeof(page->mark_bits));
+    std::memset(page->old_bits, 0, sizeof(page->old_bits));
+    std::memset(page->remembered_bits, 0, sizeof(page->remembered_bits));
+    // Bits past the last cell read as allocated so take_cell skips them.
+    for (std::size_t w = 0; w < kBitmapWords; ++w) {
+      std::size_t first = w * 64;
+      if (first + 64 <= cells)
+        page->alloc_bits[w] = 0;
+      else if (first >= cells)
+        page->alloc_bits[w] = ~uint64_t{0};
+      else
+        page->alloc_bits[w] = ~uint64_t{0} << (cells - first);
+    }
+    return page;
+  }
+
+  static void* aligned_block(std::size_t bytes) {
+    void* block = std::aligned_alloc(kPageSize, bytes);
+    if (!block) throw std::bad_alloc();
+    return block;
+  }
+
+  static Page* new_page(std::size_t c) {
+    uint32_t cell_size = static_cast<uint32_t>((c + 1) * kGranule);
+    uint32_t cells =
+        static_cast<uint32_t>((kPageSize - kHeaderSize) / cell_size);
+    return init_page(aligned_block(kPageSize), cell_size, cells,
+                     static_cast<uint32_t>(c));
+  }
+
+  void* allocate_large(std::size_t size, std::size_t& cell_size) {
+    std::size_t bytes =
+        (kHeaderSize + size + kPageSize - 1) / kPageSize * kPageSize;
+    Page* page = init_page(aligned_block(bytes), static_cast<uint32_t>(size), 1,
+                           static_cast<uint32_t>(kNumClasses));
+    large_.push_back(enter_nursery(page));
+    cell_size = size;
+    return take_cell(page);
+  }
+};
@@ -1,30 +1,39 @@
 #pragma once
+#include <algorithm>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 #include <cstddef>
 #include <tuple>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include "arena.hpp"
+#include "large_space.hpp"
 #include "lrucache.hpp"
+#include "perf_counters.hpp"
+#include "stats.hpp"
+#include "work_stealing_deque.hpp"
 
 class CollectedHeap;
 
 // Any object that inherits from collectable can be created and tracked by the
-// garbage collector.
+// garbage collector. Its GC state (mark, generation, remembered) lives in the
+// side bitmaps of its arena page, so the only per-object overhead is the
+// vtable pointer.
 class Collectable {
  public:
   virtual ~Collectable() = default;
 
- private:
-  // Header fields used by the GC
-  bool marked_ = false;
-  Collectable* next_ = nullptr;
-  Collectable* prev_ = nullptr;
-  std::size_t size_ = 0;
-
-  // Simple generational metadata
-  uint8_t generation_ = 0;      // 0 = young, 1 = old (expandable)
-  bool in_remembered_ = false;  // tracked in remembered set when old → young
+  // Bytes the object owns outside its heap cell (container storage). The
+  // heap sums this over the objects it traces to size the live heap.
+  virtual std::size_t payload_bytes() const { return 0; }
 
  protected:
   /*
@@ -36,6 +45,16 @@ class Collectable {
   */
   virtual void follow(CollectedHeap& heap) = 0;
 
+  /*
+    Like follow(...), but only for the references held in slots
+    [begin, end) of the object's indexed storage, for objects that pass a
+    slot to CollectedHeap::write_barrier. The default follows everything.
+  */
+  virtual void follow_slots(CollectedHeap& heap, std::size_t /*begin*/,
+                            std::size_t /*end*/) {
+    follow(heap);
+  }
+
   friend class CollectedHeap;
 };
 
@@ -50,60 +69,185 @@ class Collectable {
 */
 class CollectedHeap {
  public:
-  CollectedHeap() = default;
+  CollectedHeap() { arena_.set_finalizer(&CollectedHeap::finalize, this); }
+  CollectedHeap(const CollectedHeap&) = delete;
+  CollectedHeap& operator=(const CollectedHeap&) = delete;
+
+  ~CollectedHeap() {
+    stop_mark_pool();
+    arena_.set_background_sweep(false);
+    delete allocation_cache;
+  }
+
+  // Runs the destructors of all remaining objects, which the heap's own
+  // destructor skips (see HeapArena).
+  void destroy_objects() { arena_.destroy_objects(); }
+
+  /*
+    By default every collection destroys the dead objects it finds before
+    returning. With `on`, they are destroyed lazily instead, by the
+    allocator as it reuses their pages (or by finish_sweep()), so a
+    collection's pause covers marking and queueing pages only.
+  */
+  void set_lazy_sweep(bool on) { lazy_sweep_ = on; }
+
+  /*
+    With `on`, a background thread also sweeps queued pages while the
+    mutator runs, so a collection's pause covers marking only. Implies
+    lazy sweeping (see set_lazy_sweep).
+  */
+  void set_background_sweep(bool on) {
+    arena_.set_background_sweep(on);
+    background_sweep_ = on;
+  }
+
+  /*
+    Number of threads that trace during stop-the-world marking (the calling
+    thread plus n - 1 helpers). With n > 1, workers drain their own
+    work-stealing deques and steal from each other when they run dry.
+    Incremental mark steps stay on the mutator thread.
+  */
+  void set_mark_threads(std::size_t n) {
+    n = n ? n : 1;
+    if (n == mark_threads_) return;
+    stop_mark_pool();
+    mark_threads_ = n;
+  }
+
+  // Records every collection into `stats` (nullptr stops recording).
+  void set_stats(GcStats* stats) { stats_ = stats; }
+
+  // Charges marking and sweeping to their phases in `counters` (nullptr
+  // stops counting).
+  void set_perf_counters(PerfCounters* counters) { perf_ = counters; }
+
+  // Calls `hook` with each dead object just before it is destroyed, on
+  // whichever thread sweeps it (see set_background_sweep).
+  using FreeHook = void (*)(void* ctx, Collectable* obj);
+  void set_free_hook(FreeHook hook, void* ctx) {
+    free_hook_ = hook;
+    free_hook_ctx_ = ctx;
+  }
+
+  // Destroys every object the last collection found dead now rather than
+  // as the allocator reaches them.
+  void finish_sweep() { arena_.finish_sweep(); }
   mitscript::LRUCache<int>* allocation_cache =
       new mitscript::LRUCache<int>(1000);
 
-  // Remembered set for old objects that may point to young ones
-  std::vector<Collectable*> remembered_;
+  /*
+    Card table for old-to-young pointers. An old object that may point to a
+    young one has its remembered bit set, and its page is listed in
+    dirty_pages_, so a minor GC finds it without walking the old
+    generation. Objects with large indexed storage are carded more finely
+    through write_barrier(owner, child, slot): slot_cards_ holds a bit per
+    kCardSlots slots written, and a minor GC traces only those ranges. A
+    minor GC cleans every card it scans, since it promotes all young
+    survivors.
+  */
+  static constexpr std::size_t kCardSlots = 128;
 
+  // 0 = young, 1 = old (survived a collection)
   bool is_young(Collectable* obj) const {
-    return obj && obj->generation_ == 0;
+    return obj && !old_bit(obj);
   }
   bool is_old(Collectable* obj) const {
-    return obj && obj->generation_ > 0;
+    return obj && old_bit(obj);
   }
 
+  // Dirties an old object's card so the next minor GC traces all of it.
   void remember(Collectable* obj) {
-    if (!obj || obj->in_remembered_ || !is_old(obj)) return;
-    remembered_.push_back(obj);
-    obj->in_remembered_ = true;
+    if (!obj) return;
+    HeapArena::Page* page = HeapArena::page_of(obj);
+    std::size_t i = page->cell_index(obj);
+    if (!HeapArena::Page::test(page->old_bits, i)) return;
+    if (HeapArena::Page::test(page->remembered_bits, i)) {
+      // Already dirty; if only some of its slots were, trace it whole.
+      if (!slot_cards_.empty()) slot_cards_.erase(obj);
+      return;
+    }
+    dirty_card(page, i);
   }
 
-  // Write barrier: call this whenever an old object gets a reference
-  // to a (potentially) young object.
+  // Dirties the card covering `slot` of an old object's indexed storage.
+  void remember_slot(Collectable* obj, std::size_t slot) {
+    if (!obj) return;
+    HeapArena::Page* page = HeapArena::page_of(obj);
+    std::size_t i = page->cell_index(obj);
+    if (!HeapArena::Page::test(page->old_bits, i)) return;
+    std::vector<uint64_t>* cards;
+    if (HeapArena::Page::test(page->remembered_bits, i)) {
+      auto it = slot_cards_.find(obj);
+      if (it == slot_cards_.end()) return;  // the whole object is dirty
+      cards = &it->second;
+    } else {
+      dirty_card(page, i);
+      cards = &slot_cards_[obj];
+    }
+    std::size_t card = slot / kCardSlots;
+    if (card / 64 >= cards->size()) cards->resize(card / 64 + 1, 0);
+    (*cards)[card / 64] |= uint64_t{1} << (card % 64);
+  }
+
+  // Write barrier: call this whenever an object gets a reference to another
+  // (in particular an old object to a potentially young one).
   void write_barrier(Collectable* owner, Collectable* child) {
     if (!owner || !child) return;
+    // Dijkstra insertion barrier: while an incremental mark is in progress,
+    // `owner` may already be traced (black), so shade `child` grey to keep
+    // the new edge from hiding it.
+    if (marking_) markSuccessors(child);
     if (is_old(owner) && is_young(child)) {
       remember(owner);
     }
   }
 
+  // Write barrier for a store into slot `slot` of the owner's indexed
+  // storage; dirties only that slot's card (see kCardSlots).
+  void write_barrier(Collectable* owner, Collectable* child, std::size_t slot) {
+    if (!owner || !child) return;
+    if (marking_) markSuccessors(child);
+    if (is_old(owner) && is_young(child)) {
+      remember_slot(owner, slot);
+    }
+  }
+
   /*
     T must be a subclass of Collectable. Before returning the
     object, it should be registered so that it can be deallocated later.
   */
   template <typename T, typename... Args>
   T* allocate(Args&&... args) {
+    return allocate_sized<T>(sizeof(T), std::forward<Args>(args)...);
+  }
+
+  /*
+    As allocate, but gives the object a cell of at least `size` bytes; T
+    keeps the bytes past sizeof(T) as inline trailing storage.
+  */
+  template <typename T, typename... Args>
+  T* allocate_sized(std::size_t size, Args&&... args) {
     static_assert(std::is_base_of_v<Collectable, T>,
                   "T must derive from Collectable");
     static_assert(std::is_constructible_v<T, Args...>,
                   "T must be constructible with Args...");
 
-    T* obj = new T(std::forward<Args>(args)...);
-
-    // Insert at head of global list
-    obj->next_ = head_;
-    obj->prev_ = nullptr;
-    if (head_) head_->prev_ = obj;
-    head_ = obj;
-
-    obj->size_ = sizeof(T);
-    obj->generation_ = 0;       // newly allocated → young
-    obj->in_remembered_ = false;
-    obj->marked_ = false;
+    static_assert(alignof(T) <= HeapArena::kGranule,
+                  "T is over-aligned for the arena");
+
+    std::size_t cell_size = 0;
+    void* mem = arena_.allocate(size, cell_size);
+    T* obj;
+    try {
+      // The cell's side bits are clear: unmarked, young, not remembered.
+      obj = new (mem) T(std::forward<Args>(args)...);
+    } catch (...) {
+      HeapArena::release(mem);
+      throw;
+    }
 
-    allocated_bytes_ += obj->size_;
+    allocated_bytes_ += cell_size;
+    young_bytes_ += cell_size;
     objects_allocated_ += 1;
     return obj;
   }
@@ -120,11 +264,46 @@ class CollectedHeap {
   */
   void markSuccessors(Collectable* next) {
     if (!next) return;
-    if (next->marked_) return;
-    next->marked_ = true;
+    HeapArena::Page* page = HeapArena::page_of(next);
+    std::size_t i = page->cell_index(next);
+    // A minor GC traces the young generation only; old objects are taken
+    // to be live, and their young successors are found through the cards.
+    if (minor_marking_ && HeapArena::Page::test(page->old_bits, i)) return;
+    if (parallel_marking_) {
+      // Several workers may reach the same object; whoever sets its mark
+      // bit traces it.
+      uint64_t bit = uint64_t{1} << (i % 64);
+      std::atomic_ref<uint64_t> word(page->mark_bits[i / 64]);
+      if (word.fetch_or(bit, std::memory_order_relaxed) & bit) return;
+      current_worker_->deque.push(next);
+      return;
+    }
+    if (HeapArena::Page::test(page->mark_bits, i)) return;
+    HeapArena::Page::set(page->mark_bits, i);
     mark_stack_.push_back(next);
   }
 
+  /*
+    Objects with long indexed storage call this from follow(...) instead of
+    marking every slot at once: the heap calls follow_slots(...) on `obj`
+    for [begin, end) later, kScanChunk slots at a time from the end, each
+    chunk once what the previous one reached has been traced. That keeps
+    the mark stack to about a chunk per array being traced, however big
+    the arrays. Taking chunks from the end visits the slots' targets in the
+    order marking the whole array at once would (the stack pops the last
+    slot's first), which is usually descending address order.
+    Returns false when the caller must mark the slots itself (parallel
+    marking).
+  */
+  static constexpr std::size_t kScanChunk = 4096;
+
+  bool defer_slots(Collectable* obj, std::size_t begin, std::size_t end) {
+    if (parallel_marking_) return false;
+    if (begin < end)
+      slot_ranges_.push_back({obj, begin, end, mark_stack_.size()});
+    return true;
+  }
+
   /*
     Returns the current allocated bytes on the heap.
   */
@@ -132,6 +311,14 @@ class CollectedHeap {
     return allocated_bytes_;
   }
 
+  /*
+    Cells plus payloads of the objects the last collection found live (plus
+    the cells of any unreachable old objects a minor GC left alone).
+  */
+  std::size_t live_bytes() const {
+    return allocated_bytes_ + live_payload_;
+  }
+
   /*
     The gc method should be periodically invoked by your VM (or by other methods
     in CollectedHeap) whenever the VM decides it is time to reclaim memory.
@@ -142,54 +329,67 @@ class CollectedHeap {
     full_gc(begin, end);
   }
 
+  /*
+    Every collection entry point takes its roots either as an iterator range
+    or as a root enumerator: a callable that, given a visitor, calls it with
+    each root, so the VM can walk its frames in place rather than copying
+    the roots into a vector first.
+  */
+  template <typename Iterator>
+  static auto root_range(Iterator begin, Iterator end) {
+    return [begin, end](auto&& visit) {
+      for (auto it = begin; it != end; ++it) visit(*it);
+    };
+  }
+
   /*
     Minor GC: only collects unreachable YOUNG objects.
-    Old unreachable objects are left for full GC.
-    Semantics match your original code, but using an explicit mark stack.
+    Old unreachable objects are left for full GC. Marking stops at old
+    objects and starts from the roots and the dirty cards, so its cost
+    follows the young generation and the old objects written since the
+    last collection rather than the whole heap.
   */
   template <typename Iterator>
   void minor_gc(Iterator begin, Iterator end) {
-    // 1) Mark: roots and remembered old objects
-    clear_mark_stack();
+    minor_gc(root_range(begin, end));
+  }
 
-    for (auto it = begin; it != end; ++it) {
-      markSuccessors(*it);
-    }
-    for (Collectable* obj : remembered_) {
-      markSuccessors(obj);
+  template <typename RootEnumerator>
+  void minor_gc(RootEnumerator&& for_each_root) {
+    // A minor GC shares the mark bits with an incremental cycle, so finish
+    // the cycle instead.
+    if (marking_) {
+      finish_incremental_mark(for_each_root);
+      return;
     }
 
+    // 1) Mark: roots and dirty cards. live_payload_ keeps the old
+    // generation's payload as of when each object was last traced, and
+    // gains that of the young survivors.
+    GcStats::Stopwatch watch;
+    PerfCounters::Scope phase(perf_, PerfCounters::Phase::Mark);
+    clear_mark_stack();
+    minor_marking_ = true;
+    shade_roots(for_each_root);
+    std::size_t cards = scan_dirty_cards();
     process_mark_stack();
-
-    // 2) Sweep: walk entire list, but only delete unreachable young objects.
-    Collectable* cur = head_;
-    while (cur) {
-      Collectable* next = cur->next_;
-      if (!cur->marked_) {
-        if (is_young(cur)) {
-          // unlink from list
-          if (cur->prev_) cur->prev_->next_ = next;
-          else head_ = next;
-          if (next) next->prev_ = cur->prev_;
-
-          purge_from_cache(cur);
-
-          allocated_bytes_ -= cur->size_;
-          objects_allocated_ -= 1;
-          delete cur;
-        }
-        // unreachable old objects collected only in full GC
-      } else {
-        // live object: clear mark bit for next GC
-        cur->marked_ = false;
-        if (is_young(cur)) {
-          // promoted to old after surviving a minor GC
-          cur->generation_ = 1;
-        }
-      }
-      cur = next;
+    minor_marking_ = false;
+    uint64_t mark_ns = watch.lap_ns();
+
+    // 2) Sweep: unreachable young objects (see set_lazy_sweep).
+    // Unreachable old objects are collected only in full GC; marked young
+    // objects are promoted to old after surviving a minor GC, so no
+    // old-to-young pointers remain and the cards stay clean.
+    phase.switch_to(PerfCounters::Phase::Sweep);
+    std::size_t young = young_bytes_;
+    HeapArena::SweepStats dead = arena_.prepare_sweep(/*minor=*/true);
+    account_sweep(dead);
+    end_sweep();
+    if (stats_) {
+      stats_->collections.push_back({GcStats::Kind::Minor, mark_ns,
+                                     watch.lap_ns(), young,
+                                     young - dead.bytes, cards});
     }
-    // We do NOT clear remembered_ here; still needed for future minor GCs.
   }
 
   /*
@@ -198,74 +398,437 @@ class CollectedHeap {
   */
   template <typename Iterator>
   void full_gc(Iterator begin, Iterator end) {
-    // 1) Mark from roots
+    full_gc(root_range(begin, end));
+  }
+
+  template <typename RootEnumerator>
+  void full_gc(RootEnumerator&& for_each_root) {
+    if (!marking_) start_incremental_mark(for_each_root);
+    finish_incremental_mark(for_each_root);
+  }
+
+  /*
+    Incremental full GC, as tri-color marking: unmarked objects are white,
+    marked objects still on the mark stack are grey, and marked objects
+    whose successors have been pushed are black.
+
+    start_incremental_mark() shades the roots; the mutator then runs, calling
+    mark_for() to trace for a bounded time, while write_barrier() shades the
+    targets of new edges. Registers and other roots are not barriered, so
+    finish_incremental_mark() rescans them in a final pause before sweeping.
+    Objects allocated during the cycle start white and survive only if that
+    rescan or a barrier reaches them.
+  */
+  template <typename Iterator>
+  void start_incremental_mark(Iterator begin, Iterator end) {
+    start_incremental_mark(root_range(begin, end));
+  }
+
+  template <typename RootEnumerator>
+  void start_incremental_mark(RootEnumerator&& for_each_root) {
+    GcStats::Stopwatch watch;
+    PerfCounters::Scope phase(perf_, PerfCounters::Phase::Mark);
     clear_mark_stack();
+    live_payload_ = 0;
+    shade_roots(for_each_root);
+    marking_ = true;
+    cycle_mark_ns_ = watch.lap_ns();
+  }
 
-    for (auto it = begin; it != end; ++it) {
-      markSuccessors(*it);
-    }
+  bool marking() const { return marking_; }
+
+  // Traces grey objects for roughly `budget`. Returns true once none are
+  // left, i.e. the cycle is ready to finish.
+  bool mark_for(std::chrono::microseconds budget) {
+    using clock = std::chrono::steady_clock;
+    // Check the clock only every few objects; follow() is cheap.
+    constexpr std::size_t kObjectsPerClockCheck = 64;
+    GcStats::Stopwatch watch;
+    PerfCounters::Scope phase(perf_, PerfCounters::Phase::Mark);
+    const auto deadline = clock::now() + budget;
+    std::size_t traced = 0;
+    drain_mark_stack([&] {
+      return ++traced % kObjectsPerClockCheck == 0 &&
+             clock::now() >= deadline;
+    });
+    cycle_mark_ns_ += watch.lap_ns();
+    return mark_stack_.empty() && slot_ranges_.empty();
+  }
+
+  template <typename Iterator>
+  void finish_incremental_mark(Iterator begin, Iterator end) {
+    finish_incremental_mark(root_range(begin, end));
+  }
 
+  template <typename RootEnumerator>
+  void finish_incremental_mark(RootEnumerator&& for_each_root) {
+    // 1) Rescan the roots and trace whatever is still grey
+    GcStats::Stopwatch watch;
+    PerfCounters::Scope phase(perf_, PerfCounters::Phase::Mark);
+    shade_roots(for_each_root);
     process_mark_stack();
+    marking_ = false;
+    uint64_t mark_ns = cycle_mark_ns_ + watch.lap_ns();
+
+    // 2) Sweep: all unreachable objects, young or old (see set_lazy_sweep);
+    // survivors are treated as old, and the sweep cleans every card.
+    phase.switch_to(PerfCounters::Phase::Sweep);
+    clear_dirty_pages();
+    std::size_t before = allocated_bytes_;
+    account_sweep(arena_.prepare_sweep(/*minor=*/false));
+    end_sweep();
+    if (stats_) {
+      stats_->collections.push_back({GcStats::Kind::Full, mark_ns,
+                                     watch.lap_ns(), before, allocated_bytes_,
+                                     0});
+    }
+  }
+
+ private:
+  template <typename RootEnumerator>
+  void shade_roots(RootEnumerator& for_each_root) {
+    for_each_root([this](Collectable* root) { markSuccessors(root); });
+  }
 
-    // 2) Sweep entire list: delete all unreachable objects, reset metadata
-    Collectable* cur = head_;
-    while (cur) {
-      Collectable* next = cur->next_;
-      if (!cur->marked_) {
-        // unreachable (young or old) → delete
-        if (cur->prev_) cur->prev_->next_ = next;
-        else head_ = next;
-        if (next) next->prev_ = cur->prev_;
-
-        purge_from_cache(cur);
-
-        allocated_bytes_ -= cur->size_;
-        objects_allocated_ -= 1;
-        delete cur;
-      } else {
-        // live object: clear mark and treat as old
-        cur->marked_ = false;
-        cur->generation_ = 1;
-        cur->in_remembered_ = false;
+  void dirty_card(HeapArena::Page* page, std::size_t i) {
+    HeapArena::Page::set(page->remembered_bits, i);
+    if (page->has_dirty_cards) return;
+    page->has_dirty_cards = true;
+    dirty_pages_.push_back(page);
+  }
+
+  // Traces the young successors of every dirty old object (just its dirty
+  // slot ranges, if it is carded by slot), then cleans the cards. Returns
+  // the number of cards traced.
+  std::size_t scan_dirty_cards() {
+    std::size_t traced = 0;
+    for (HeapArena::Page* page : dirty_pages_) {
+      for (std::size_t w = 0, n = page->words(); w < n; ++w) {
+        for (uint64_t bits = page->remembered_bits[w]; bits; bits &= bits - 1) {
+          std::size_t i = w * 64 + static_cast<unsigned>(__builtin_ctzll(bits));
+          auto* obj = static_cast<Collectable*>(page->cell(i));
+          auto it = slot_cards_.empty() ? slot_cards_.end()
+                                        : slot_cards_.find(obj);
+          if (it == slot_cards_.end()) {
+            obj->follow(*this);
+            ++traced;
+            continue;
+          }
+          const std::vector<uint64_t>& cards = it->second;
+          for (std::size_t cw = 0; cw < cards.size(); ++cw) {
+            for (uint64_t c = cards[cw]; c; c &= c - 1) {
+              std::size_t card =
+                  cw * 64 + static_cast<unsigned>(__builtin_ctzll(c));
+              obj->follow_slots(*this, card * kCardSlots,
+                                (card + 1) * kCardSlots);
+              ++traced;
+            }
+          }
+        }
+        page->remembered_bits[w] = 0;
       }
-      cur = next;
+      page->has_dirty_cards = false;
     }
-    remembered_.clear();
+    dirty_pages_.clear();
+    slot_cards_.clear();
+    return traced;
   }
 
- private:
-  // Explicit mark stack to avoid recursive marking
+  // Forgets the dirty pages before a full sweep, which clears the
+  // remembered bits itself and may free the pages.
+  void clear_dirty_pages() {
+    for (HeapArena::Page* page : dirty_pages_) page->has_dirty_cards = false;
+    dirty_pages_.clear();
+    slot_cards_.clear();
+  }
+
+  // Explicit mark stack to avoid recursive marking. It keeps its capacity
+  // from one collection to the next; defer_slots() keeps it small.
   void clear_mark_stack() {
     mark_stack_.clear();
-    mark_stack_.shrink_to_fit();  // optional; remove if you want to avoid reallocation
+    slot_ranges_.clear();
   }
 
   void process_mark_stack() {
-    // Non-recursive DFS over object graph
-    while (!mark_stack_.empty()) {
-      Collectable* obj = mark_stack_.back();
-      mark_stack_.pop_back();
-      // follow() will call markSuccessors() for children
+    if (mark_threads_ > 1 && (!mark_stack_.empty() || !slot_ranges_.empty())) {
+      flush_slot_ranges();
+      process_mark_stack_parallel();
+      return;
+    }
+    drain_mark_stack([] { return false; });
+  }
+
+  /*
+    Traces grey objects, and the slot ranges their follow(...) deferred,
+    until none are left or pause() returns true after an object or chunk.
+    Objects go from the mark stack to trace() through a FIFO of
+    kPrefetchDepth, and each is prefetched as it enters (see prefetch_cell),
+    so its cell has usually arrived by the time follow(...) reads it. A
+    deferred range's next chunk is due when the stack is back down to its
+    height when the range was deferred.
+  */
+  static constexpr std::size_t kPrefetchDepth = 8;
+
+  template <typename Pause>
+  void drain_mark_stack(Pause&& pause) {
+    Collectable* fifo[kPrefetchDepth];
+    std::size_t head = 0, queued = 0;
+    while (true) {
+      std::size_t floor = slot_ranges_.empty() ? 0 : slot_ranges_.back().floor;
+      while (queued < kPrefetchDepth && mark_stack_.size() > floor) {
+        Collectable* obj = mark_stack_.back();
+        mark_stack_.pop_back();
+        prefetch_cell(obj);
+        fifo[(head + queued++) % kPrefetchDepth] = obj;
+      }
+      if (queued == 0) {
+        if (slot_ranges_.empty()) break;
+        trace_next_chunk();
+        if (pause()) break;
+        continue;
+      }
+      Collectable* obj = fifo[head];
+      head = (head + 1) % kPrefetchDepth;
+      --queued;
+      trace(obj);
+      if (pause()) break;
+    }
+    // Objects still queued stay grey.
+    while (queued > 0) {
+      --queued;
+      mark_stack_.push_back(fifo[(head + queued) % kPrefetchDepth]);
+    }
+  }
+
+  // Starts loading the cache lines where follow(...) will find an
+  // object's fields. Three lines cover a record, the largest of them;
+  // the cell's size is not looked up, since reading its page header costs
+  // more than prefetching past the end of a small cell.
+  static void prefetch_cell(Collectable* obj) {
+    constexpr std::size_t kLine = 64, kLines = 3;
+    const char* p = reinterpret_cast<const char*>(obj);
+    for (std::size_t line = 0; line < kLines; ++line)
+      __builtin_prefetch(p + line * kLine);
+  }
+
+  // Follows the last chunk of the most recently deferred range.
+  void trace_next_chunk() {
+    SlotRange& range = slot_ranges_.back();
+    Collectable* obj = range.obj;
+    std::size_t end = range.end;
+    std::size_t begin = end - std::min(end - range.begin, kScanChunk);
+    if (begin == range.begin)
+      slot_ranges_.pop_back();
+    else
+      range.end = begin;
+    obj->follow_slots(*this, begin, end);
+  }
+
+  // Follows every deferred range now, leaving what they reach grey.
+  void flush_slot_ranges() {
+    while (!slot_ranges_.empty()) {
+      SlotRange range = slot_ranges_.back();
+      slot_ranges_.pop_back();
+      range.obj->follow_slots(*this, range.begin, range.end);
+    }
+  }
+
+  void trace(Collectable* obj) {
+    live_payload_ += obj->payload_bytes();
+    obj->follow(*this);
+  }
+
+  struct MarkWorker {
+    WorkStealingDeque<Collectable*> deque;
+    std::size_t payload = 0;
+  };
+
+  // Deals the grey objects out to the workers and traces until every
+  // deque is empty and every worker idle.
+  void process_mark_stack_parallel() {
+    start_mark_pool();
+    const std::size_t n = mark_threads_;
+    for (std::size_t k = 0; k < mark_stack_.size(); ++k) {
+      workers_[k % n]->deque.push(mark_stack_[k]);
+    }
+    mark_stack_.clear();
+    idle_workers_.store(0, std::memory_order_relaxed);
+    parallel_marking_ = true;
+    {
+      std::lock_guard<std::mutex> lock(pool_mutex_);
+      pool_busy_ = n - 1;
+      ++pool_epoch_;
+    }
+    pool_cv_.notify_all();
+    run_mark_worker(0);
+    {
+      std::unique_lock<std::mutex> lock(pool_mutex_);
+      pool_done_cv_.wait(lock, [this] { return pool_busy_ == 0; });
+    }
+    parallel_marking_ = false;
+    for (auto& w : workers_) {
+      w->deque.clear();
+      live_payload_ += w->payload;
+      w->payload = 0;
+    }
+  }
+
+  void run_mark_worker(std::size_t id) {
+    const std::size_t n = mark_threads_;
+    current_worker_ = workers_[id].get();
+    MarkWorker& self = *current_worker_;
+    WorkStealingDeque<Collectable*>& own = self.deque;
+    auto trace_here = [&](Collectable* obj) {
+      self.payload += obj->payload_bytes();
       obj->follow(*this);
+    };
+    while (true) {
+      while (Collectable* obj = own.pop()) trace_here(obj);
+
+      Collectable* stolen = nullptr;
+      for (std::size_t k = 1; k < n && !stolen; ++k) {
+        stolen = workers_[(id + k) % n]->deque.steal();
+      }
+      if (stolen) {
+        trace_here(stolen);
+        continue;
+      }
+
+      // Out of work. Only workers that are tracing can create more, so
+      // once all are idle marking is complete.
+      idle_workers_.fetch_add(1, std::memory_order_acq_rel);
+      bool more = false;
+      while (idle_workers_.load(std::memory_order_acquire) < n) {
+        for (std::size_t k = 1; k < n && !more; ++k) {
+          more = !workers_[(id + k) % n]->deque.looks_empty();
+        }
+        if (more) break;
+        std::this_thread::yield();
+      }
+      if (!more) break;
+      idle_workers_.fetch_sub(1, std::memory_order_acq_rel);
+    }
+    current_worker_ = nullptr;
+  }
+
+  void start_mark_pool() {
+    if (!mark_pool_.empty()) return;
+    workers_.clear();
+    for (std::size_t i = 0; i < mark_threads_; ++i) {
+      workers_.push_back(std::make_unique<MarkWorker>());
     }
+    pool_shutdown_ = false;
+    for (std::size_t i = 1; i < mark_threads_; ++i) {
+      mark_pool_.emplace_back([this, i] {
+        uint64_t seen = 0;
+        while (true) {
+          {
+            std::unique_lock<std::mutex> lock(pool_mutex_);
+            pool_cv_.wait(lock,
+                          [&] { return pool_shutdown_ || pool_epoch_ != seen; });
+            if (pool_shutdown_) return;
+            seen = pool_epoch_;
+          }
+          run_mark_worker(i);
+          std::lock_guard<std::mutex> lock(pool_mutex_);
+          if (--pool_busy_ == 0) pool_done_cv_.notify_one();
+        }
+      });
+    }
+  }
+
+  void stop_mark_pool() {
+    {
+      std::lock_guard<std::mutex> lock(pool_mutex_);
+      pool_shutdown_ = true;
+    }
+    pool_cv_.notify_all();
+    for (auto& t : mark_pool_) t.join();
+    mark_pool_.clear();
+  }
+
+  static bool old_bit(const Collectable* obj) {
+    HeapArena::Page* page = HeapArena::page_of(obj);
+    return HeapArena::Page::test(page->old_bits, page->cell_index(obj));
+  }
+
+  // Dead objects leave the byte count when a collection finds them, not
+  // when their destructors run.
+  void account_sweep(HeapArena::SweepStats stats) {
+    allocated_bytes_ -= stats.bytes;
+    objects_allocated_ -= stats.objects;
+    young_bytes_ = 0;
+  }
+
+  // Destroys the objects the collection just queued, unless they are left
+  // to the allocator or the background sweeper.
+  void end_sweep() {
+    if (!lazy_sweep_ && !background_sweep_) arena_.finish_sweep();
+  }
+
+  // Runs from the allocator or the background sweeper; the arena marks the
+  // cell free once this returns.
+  static void finalize(void* ctx, void* object) {
+    auto* heap = static_cast<CollectedHeap*>(ctx);
+    Collectable* cur = static_cast<Collectable*>(object);
+    heap->purge_from_cache(cur);
+    if (heap->free_hook_) heap->free_hook_(heap->free_hook_ctx_, cur);
+    cur->~Collectable();
   }
 
   // Remove any cache entries that point to this object (address-based)
   void purge_from_cache(Collectable* cur) {
     if (!cur || !allocation_cache) return;
-    for (const auto& k : allocation_cache->keys()) {
-      auto* cached = allocation_cache->get(k);
-      if (reinterpret_cast<void*>(cached) ==
-          reinterpret_cast<void*>(cur)) {
-        allocation_cache->remove(k);
-      }
-    }
+    // The background sweeper may be finalizing at the same time.
+    std::unique_lock<std::mutex> lock(cache_mutex_, std::defer_lock);
+    if (background_sweep_) lock.lock();
+    if (allocation_cache->empty()) return;
+    allocation_cache->remove_value(cur);
   }
 
-  Collectable* head_ = nullptr;
+  HeapArena arena_;
+  std::mutex cache_mutex_;
+  bool background_sweep_ = false;
+  bool lazy_sweep_ = false;
+  bool marking_ = false;  // an incremental mark is in progress
+  bool minor_marking_ = false;  // a minor GC is marking: skip old objects
   std::size_t allocated_bytes_ = 0;
+  std::size_t live_payload_ = 0;  // payload_bytes() of objects last traced
   std::size_t objects_allocated_ = 0;
-
-  // Mark stack used during marking phase
+  std::size_t young_bytes_ = 0;  // cells allocated since the last sweep
+
+  // Telemetry (see set_stats, set_perf_counters and set_free_hook)
+  GcStats* stats_ = nullptr;
+  PerfCounters* perf_ = nullptr;
+  FreeHook free_hook_ = nullptr;
+  void* free_hook_ctx_ = nullptr;
+  uint64_t cycle_mark_ns_ = 0;  // marking so far in the current full cycle
+
+  // Mark stack used during marking phase, and the slot ranges deferred
+  // from it (see defer_slots)
+  struct SlotRange {
+    Collectable* obj;
+    std::size_t begin, end;
+    std::size_t floor;  // mark stack height when deferred
+  };
   std::vector<Collectable*> mark_stack_;
+  std::vector<SlotRange> slot_ranges_;
+
+  // Card table (see kCardSlots)
+  std::vector<HeapArena::Page*> dirty_pages_;
+  std::unordered_map<Collectable*, std::vector<uint64_t>> slot_cards_;
+
+  // Parallel marking (see set_mark_threads)
+  std::size_t mark_threads_ = 1;
+  bool parallel_marking_ = false;
+  std::vector<std::unique_ptr<MarkWorker>> workers_;
+  std::atomic<std::size_t> idle_workers_{0};
+  static inline thread_local MarkWorker* current_worker_ = nullptr;
+  std::vector<std::thread> mark_pool_;
+  std::mutex pool_mutex_;
+  std::condition_variable pool_cv_;
+  std::condition_variable pool_done_cv_;
+  uint64_t pool_epoch_ = 0;
+  std::size_t pool_busy_ = 0;
+  bool pool_shutdown_ = false;
 };
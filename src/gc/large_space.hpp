@@ -0,0 +1,122 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+  Large-object space for the biggest buffers heap objects own outside their
+  cells: the element storage of array-like records and the text of long
+  strings. Small payloads stay on the malloc heap; from kThreshold bytes up
+  a buffer gets page-aligned memory of its own straight from mmap, so it
+  never shares pages with small allocations and never sits in a malloc
+  arena that cannot shrink.
+
+  Heap objects never move, so neither do these buffers; the collector only
+  reads them, and a record's elements are traced a card at a time once the
+  record is old (CollectedHeap::kCardSlots). When a buffer is freed its
+  pages go back to the OS at once with madvise(MADV_DONTNEED) while the
+  address range is kept for the next buffer of the same size, which is the
+  usual case for rows of a matrix or a vector that grows and is copied.
+  Ranges beyond kRetainedBytes are unmapped instead.
+
+  The space is shared by every heap in the process (batch runs VMs on
+  several threads), so it takes a lock; buffers this big are rare enough
+  that it is never contended.
+*/
+class LargeObjectSpace {
+ public:
+  static constexpr std::size_t kThreshold = 32 * 1024;
+  // Address space kept mapped (but not resident) for reuse.
+  static constexpr std::size_t kRetainedBytes = 64 * 1024 * 1024;
+
+  static LargeObjectSpace& instance() {
+    // Never destroyed: buffers may be freed by objects that outlive main.
+    static LargeObjectSpace* space = new LargeObjectSpace;
+    return *space;
+  }
+
+  void* allocate(std::size_t bytes) {
+    std::size_t size = round_up(bytes);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (std::size_t i = free_.size(); i-- > 0;) {
+        if (free_[i].size != size) continue;
+        void* block = free_[i].base;
+        free_[i] = free_.back();
+        free_.pop_back();
+        retained_ -= size;
+        return block;
+      }
+    }
+    void* block = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED) throw std::bad_alloc();
+    return block;
+  }
+
+  void release(void* block, std::size_t bytes) {
+    std::size_t size = round_up(bytes);
+    madvise(block, size, MADV_DONTNEED);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (retained_ + size > kRetainedBytes) {
+      munmap(block, size);
+      return;
+    }
+    free_.push_back({block, size});
+    retained_ += size;
+  }
+
+ private:
+  struct Block {
+    void* base;
+    std::size_t size;
+  };
+
+  LargeObjectSpace() : page_size_(static_cast<std::size_t>(sysconf(_SC_PAGESIZE))) {}
+
+  std::size_t round_up(std::size_t bytes) const {
+    return (bytes + page_size_ - 1) / page_size_ * page_size_;
+  }
+
+  const std::size_t page_size_;
+  std::mutex mutex_;
+  std::vector<Block> free_;  // released blocks, their pages given back
+  std::size_t retained_ = 0;
+};
+
+// Standard allocator that places buffers of LargeObjectSpace::kThreshold
+// bytes or more in the large-object space and the rest on the malloc heap.
+template <typename T>
+struct LargeObjectAllocator {
+  using value_type = T;
+
+  LargeObjectAllocator() = default;
+  template <typename U>
+  LargeObjectAllocator(const LargeObjectAllocator<U>&) {}
+
+  T* allocate(std::size_t n) {
+    if (n > SIZE_MAX / sizeof(T)) throw std::bad_array_new_length();
+    std::size_t bytes = n * sizeof(T);
+    if (bytes >= LargeObjectSpace::kThreshold)
+      return static_cast<T*>(LargeObjectSpace::instance().allocate(bytes));
+    return static_cast<T*>(::operator new(bytes));
+  }
+
+  void deallocate(T* p, std::size_t n) {
+    std::size_t bytes = n * sizeof(T);
+    if (bytes >= LargeObjectSpace::kThreshold)
+      LargeObjectSpace::instance().release(p, bytes);
+    else
+      ::operator delete(p);
+  }
+
+  template <typename U>
+  bool operator==(const LargeObjectAllocator<U>&) const { return true; }
+  template <typename U>
+  bool operator!=(const LargeObjectAllocator<U>&) const { return false; }
+};
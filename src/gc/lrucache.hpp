@@ -42,7 +42,9 @@ class LRUCache {
 	void insert(const T& key, Value* value) {
 		auto it = map_.find(key);
 		if (it != map_.end()) {
+			unindex(it->second);
 			it->second->value = value;
+			by_value_.emplace(value, it->second);
 			moveToHead(it->second);
 			return;
 		}
@@ -54,6 +56,7 @@ class LRUCache {
 		head_ = node;
 		if (!tail_) tail_ = node;
 		map_[key] = node;
+		by_value_.emplace(value, node);
 
 		if (map_.size() > capacity_) evictLRU();
 	}
@@ -67,6 +70,8 @@ class LRUCache {
 		}
 	}
 
+	bool empty() const { return map_.empty(); }
+
 	std::vector<T> keys() const {
 		std::vector<T> ks;
 		ks.reserve(map_.size());
@@ -77,22 +82,49 @@ class LRUCache {
 	void remove(const T& key) {
         auto it = map_.find(key);
         if (it == map_.end()) return;
-        auto* node = it->second;
-        // unlink node
-        if (node->prev) node->prev->next = node->next;
-        else            head_ = node->next;
-        if (node->next) node->next->prev = node->prev;
-        else            tail_ = node->prev;
-        map_.erase(it);
-        delete node;
+        erase_node(it->second);
     }
 
+	// Drops every entry whose value is `value`, without disturbing the
+	// recency order of the others. Costs one hash lookup when there are none.
+	void remove_value(const void* value) {
+		auto range = by_value_.equal_range(value);
+		if (range.first == range.second) return;
+		std::vector<ListNode<T>*> nodes;
+		for (auto it = range.first; it != range.second; ++it)
+			nodes.push_back(it->second);
+		for (auto* node : nodes) erase_node(node);
+	}
+
 
  private:
 	std::size_t capacity_;
 	std::unordered_map<T, ListNode<T>*> map_;
 	ListNode<T>* head_ = nullptr;
 	ListNode<T>* tail_ = nullptr;
+	// Reverse index so entries can be dropped by value in O(1)
+	std::unordered_multimap<const void*, ListNode<T>*> by_value_;
+
+	void unindex(ListNode<T>* node) {
+		auto range = by_value_.equal_range(node->value);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (it->second == node) {
+				by_value_.erase(it);
+				return;
+			}
+		}
+	}
+
+	void erase_node(ListNode<T>* node) {
+		// unlink node
+		if (node->prev) node->prev->next = node->next;
+		else            head_ = node->next;
+		if (node->next) node->next->prev = node->prev;
+		else            tail_ = node->prev;
+		unindex(node);
+		map_.erase(node->key);
+		delete node;
+	}
 
 	void moveToHead(ListNode<T>* node) {
 		if (node == head_) return;
@@ -114,6 +146,7 @@ class LRUCache {
 		// unlink tail
 		tail_ = victim->prev;
 		if (tail_) tail_->next = nullptr; else head_ = nullptr;
+		unindex(victim);
 		map_.erase(victim->key);
 		delete victim;
 	}
@@ -0,0 +1,234 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include "stats.hpp"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+  Hardware counters per phase for --perf-counters. The driver, the VM and
+  CollectedHeap bracket their work in Scopes: compile (source to bytecode),
+  translate (bytecode to register code), execute (the interpreter and JIT
+  code, including lazy sweeping by the allocator), and mark and sweep
+  inside a collection. Phases nest; time and events go to the innermost
+  open one, so execute does not include the collections it triggers.
+
+  The counters are one perf_event_open group (cycles, instructions, cache
+  misses, branch misses) on the calling thread, read at every phase
+  change and scaled when the kernel multiplexed them. GC helper threads
+  and the background sweeper are not counted. Where perf events cannot be
+  opened (no PMU, perf_event_paranoid, not Linux) only wall time is kept.
+  write_json() reports in the same layout and units as --gc-stats.
+*/
+class PerfCounters {
+ public:
+  enum class Phase : uint8_t { Compile, Translate, Execute, Mark, Sweep };
+  static constexpr std::size_t kPhases = 5;
+
+  // Opens phase `phase` until it goes out of scope; does nothing when the
+  // counters are off.
+  class Scope {
+   public:
+    Scope(PerfCounters* counters, Phase phase) : counters_(counters) {
+      if (counters_) counters_->enter(phase);
+    }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+    ~Scope() {
+      if (counters_) counters_->leave();
+    }
+
+    // Ends the current phase and starts `phase` in its place.
+    void switch_to(Phase phase) {
+      if (counters_) counters_->switch_to(phase);
+    }
+
+   private:
+    PerfCounters* counters_;
+  };
+
+  PerfCounters() {
+    open_group();
+    last_ = sample();
+  }
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+  ~PerfCounters() {
+#if defined(__linux__)
+    for (int fd : fds_)
+      if (fd >= 0) close(fd);
+#endif
+  }
+
+  // Whether hardware events are being counted, or wall time only.
+  bool hardware() const { return events_ > 0; }
+
+  void enter(Phase phase) {
+    charge();
+    if (depth_ < kMaxDepth) stack_[depth_] = phase;
+    ++depth_;
+    totals_[index(phase)].entries += 1;
+  }
+
+  void leave() {
+    charge();
+    if (depth_ > 0) --depth_;
+  }
+
+  void switch_to(Phase phase) {
+    charge();
+    if (depth_ > 0 && depth_ <= kMaxDepth) stack_[depth_ - 1] = phase;
+    totals_[index(phase)].entries += 1;
+  }
+
+  void write_json(std::ostream& out) {
+    charge();
+    out << "{\n";
+    out << "  \"counters\": \"" << (hardware() ? "hardware" : "timer")
+        << "\",\n";
+    out << "  \"phases\": {";
+    for (std::size_t p = 0; p < kPhases; ++p) {
+      const Totals& t = totals_[p];
+      out << (p ? ",\n" : "\n") << "    \"" << kPhaseNames[p]
+          << "\": {\"entries\": " << t.entries << ", \"wall_us\": ";
+      GcStats::write_us(out, t.wall_ns);
+      if (hardware()) {
+        for (std::size_t e = 0; e < kEvents; ++e) {
+          if (fds_[e] < 0) continue;
+          out << ", \"" << kEventNames[e] << "\": " << t.events[e];
+        }
+        uint64_t instructions = t.events[kInstructions];
+        if (fds_[kInstructions] >= 0 && fds_[kCycles] >= 0)
+          out << ", \"ipc\": "
+              << (t.events[kCycles]
+                      ? static_cast<double>(instructions) / t.events[kCycles]
+                      : 0.0);
+        if (fds_[kInstructions] >= 0) {
+          for (std::size_t e : {kCacheMisses, kBranchMisses}) {
+            if (fds_[e] < 0) continue;
+            out << ", \"" << kEventNames[e] << "_per_kinstr\": "
+                << (instructions ? 1000.0 * static_cast<double>(t.events[e]) /
+                                       static_cast<double>(instructions)
+                                 : 0.0);
+          }
+        }
+      }
+      out << "}";
+    }
+    out << "\n  }\n}\n";
+  }
+
+ private:
+  enum : std::size_t {
+    kCycles,
+    kInstructions,
+    kCacheMisses,
+    kBranchMisses,
+    kEvents
+  };
+  static constexpr const char* kEventNames[kEvents] = {
+      "cycles", "instructions", "cache_misses", "branch_misses"};
+  static constexpr const char* kPhaseNames[kPhases] = {
+      "compile", "translate", "execute", "mark", "sweep"};
+  static constexpr std::size_t kMaxDepth = 8;
+
+  struct Sample {
+    std::chrono::steady_clock::time_point time;
+    std::array<uint64_t, kEvents> events{};
+  };
+  struct Totals {
+    uint64_t entries = 0;
+    uint64_t wall_ns = 0;
+    std::array<uint64_t, kEvents> events{};
+  };
+
+  static std::size_t index(Phase phase) {
+    return static_cast<std::size_t>(phase);
+  }
+
+  // Gives the time and events since the last sample to the open phase.
+  void charge() {
+    Sample now = sample();
+    if (depth_ > 0 && depth_ <= kMaxDepth) {
+      Totals& t = totals_[index(stack_[depth_ - 1])];
+      t.wall_ns += static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(now.time -
+                                                               last_.time)
+              .count());
+      // Scaled counts can step back when multiplexing changes the scale.
+      for (std::size_t e = 0; e < kEvents; ++e)
+        if (now.events[e] > last_.events[e])
+          t.events[e] += now.events[e] - last_.events[e];
+    }
+    last_ = now;
+  }
+
+  void open_group() {
+#if defined(__linux__)
+    static constexpr uint64_t kConfigs[kEvents] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    int leader = -1;
+    for (std::size_t e = 0; e < kEvents; ++e) {
+      perf_event_attr attr{};
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = kConfigs[e];
+      attr.disabled = leader < 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+      int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1,
+                                        leader, PERF_FLAG_FD_CLOEXEC));
+      // Without cycles there is no group to join; fall back to timing.
+      if (fd < 0 && leader < 0) return;
+      fds_[e] = fd;
+      if (fd < 0) continue;
+      if (leader < 0) leader = fd;
+      order_[events_++] = e;
+    }
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+  }
+
+  Sample sample() const {
+    Sample s;
+    s.time = std::chrono::steady_clock::now();
+#if defined(__linux__)
+    if (!hardware()) return s;
+    // nr, time_enabled, time_running, then one value per event.
+    uint64_t buf[3 + kEvents];
+    if (read(fds_[kCycles], buf, sizeof(buf)) <
+        static_cast<ssize_t>((3 + events_) * sizeof(uint64_t))) {
+      s.events = last_.events;
+      return s;
+    }
+    double scale = buf[2] && buf[2] < buf[1]
+                       ? static_cast<double>(buf[1]) / buf[2]
+                       : 1.0;
+    for (std::size_t i = 0; i < events_; ++i)
+      s.events[order_[i]] =
+          static_cast<uint64_t>(static_cast<double>(buf[3 + i]) * scale);
+#endif
+    return s;
+  }
+
+  std::array<int, kEvents> fds_{-1, -1, -1, -1};
+  std::array<std::size_t, kEvents> order_{};  // group position -> event
+  std::size_t events_ = 0;                    // events opened
+  std::array<Phase, kMaxDepth> stack_{};
+  std::size_t depth_ = 0;
+  std::array<Totals, kPhases> totals_{};
+  Sample last_;
+};
@@ -0,0 +1,169 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#if defined(__unix__)
+#include <sys/resource.h>
+#endif
+
+/*
+  Collector telemetry for --gc-stats. CollectedHeap appends one record per
+  collection (minor, or a full cycle including its incremental steps) and
+  the VM one pause per call into the collector, so an incremental cycle
+  contributes several pauses but a single collection. write_json() dumps
+  the lot, with totals, a pause histogram and the peak heap next to the
+  memory limit, when the run ends.
+*/
+struct GcStats {
+  using clock = std::chrono::steady_clock;
+
+  enum class Kind : uint8_t { Minor, Full };
+
+  struct Collection {
+    Kind kind;
+    uint64_t mark_ns;
+    uint64_t sweep_ns;
+    std::size_t before_bytes;    // cells in the generation(s) collected
+    std::size_t survived_bytes;  // of which still live afterwards
+    std::size_t dirty_cards;     // cards traced for old-to-young pointers
+  };
+
+  // Times a stretch of collector work; lap_ns() restarts the clock.
+  class Stopwatch {
+   public:
+    uint64_t lap_ns() {
+      clock::time_point now = clock::now();
+      uint64_t ns = static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(now - start_)
+              .count());
+      start_ = now;
+      return ns;
+    }
+
+   private:
+    clock::time_point start_ = clock::now();
+  };
+
+  // Records the time until it goes out of scope as one pause; does nothing
+  // when stats are off.
+  class Pause {
+   public:
+    explicit Pause(GcStats* stats) : stats_(stats) {}
+    Pause(const Pause&) = delete;
+    Pause& operator=(const Pause&) = delete;
+    ~Pause() {
+      if (stats_) stats_->pauses_ns.push_back(watch_.lap_ns());
+    }
+
+   private:
+    GcStats* stats_;
+    Stopwatch watch_;
+  };
+
+  std::vector<Collection> collections;
+  std::vector<uint64_t> pauses_ns;
+  std::size_t peak_heap_bytes = 0;
+
+  void note_heap(std::size_t bytes) {
+    peak_heap_bytes = std::max(peak_heap_bytes, bytes);
+  }
+
+  void write_json(std::ostream& out, std::size_t mem_limit_bytes,
+                  std::size_t heap_budget_bytes) const {
+    out << "{\n";
+    out << "  \"mem_limit_bytes\": " << mem_limit_bytes << ",\n";
+    out << "  \"heap_budget_bytes\": " << heap_budget_bytes << ",\n";
+    out << "  \"peak_heap_bytes\": " << peak_heap_bytes << ",\n";
+    out << "  \"peak_rss_bytes\": " << peak_rss_bytes() << ",\n";
+    write_generation(out, Kind::Minor, "minor");
+    write_generation(out, Kind::Full, "full");
+    write_pauses(out);
+    out << "  \"collections\": [";
+    for (std::size_t i = 0; i < collections.size(); ++i) {
+      const Collection& c = collections[i];
+      out << (i ? ",\n" : "\n") << "    {\"kind\": \""
+          << (c.kind == Kind::Minor ? "minor" : "full") << "\", \"mark_us\": ";
+      write_us(out, c.mark_ns);
+      out << ", \"sweep_us\": ";
+      write_us(out, c.sweep_ns);
+      out << ", \"before_bytes\": " << c.before_bytes
+          << ", \"survived_bytes\": " << c.survived_bytes
+          << ", \"dirty_cards\": " << c.dirty_cards << "}";
+    }
+    out << (collections.empty() ? "]\n" : "\n  ]\n") << "}\n";
+  }
+
+  // Microseconds to one decimal, as every duration in the report.
+  static void write_us(std::ostream& out, uint64_t ns) {
+    out << ns / 1000 << '.' << (ns / 100) % 10;
+  }
+
+ private:
+  static std::size_t peak_rss_bytes() {
+#if defined(__unix__)
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+      return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+    return 0;
+  }
+
+  void write_generation(std::ostream& out, Kind kind, const char* name) const {
+    std::size_t count = 0, before = 0, survived = 0, cards = 0;
+    uint64_t mark_ns = 0, sweep_ns = 0;
+    for (const Collection& c : collections) {
+      if (c.kind != kind) continue;
+      ++count;
+      mark_ns += c.mark_ns;
+      sweep_ns += c.sweep_ns;
+      before += c.before_bytes;
+      survived += c.survived_bytes;
+      cards += c.dirty_cards;
+    }
+    out << "  \"" << name << "\": {\"collections\": " << count
+        << ", \"mark_us\": ";
+    write_us(out, mark_ns);
+    out << ", \"sweep_us\": ";
+    write_us(out, sweep_ns);
+    out << ", \"before_bytes\": " << before
+        << ", \"survived_bytes\": " << survived << ", \"survivor_ratio\": "
+        << (before ? static_cast<double>(survived) / before : 0.0)
+        << ", \"dirty_cards\": " << cards << "},\n";
+  }
+
+  // Pause histogram buckets double from 1us; each counts the pauses up to
+  // its bound. Only non-empty buckets are written.
+  void write_pauses(std::ostream& out) const {
+    std::vector<uint64_t> sorted(pauses_ns);
+    std::sort(sorted.begin(), sorted.end());
+    uint64_t total = 0;
+    for (uint64_t ns : sorted) total += ns;
+    auto percentile = [&](std::size_t p) -> uint64_t {
+      return sorted.empty() ? 0 : sorted[(sorted.size() - 1) * p / 100];
+    };
+    out << "  \"pauses\": {\"count\": " << sorted.size() << ", \"total_us\": ";
+    write_us(out, total);
+    out << ", \"p50_us\": ";
+    write_us(out, percentile(50));
+    out << ", \"p99_us\": ";
+    write_us(out, percentile(99));
+    out << ", \"max_us\": ";
+    write_us(out, sorted.empty() ? 0 : sorted.back());
+    out << ", \"histogram_us\": [";
+    bool first = true;
+    std::size_t k = 0;
+    for (uint64_t bound_us = 1; k < sorted.size(); bound_us *= 2) {
+      std::size_t count = 0;
+      for (; k < sorted.size() && sorted[k] <= bound_us * 1000; ++k) ++count;
+      if (!count) continue;
+      out << (first ? "" : ", ") << "{\"le\": " << bound_us
+          << ", \"count\": " << count << "}";
+      first = false;
+    }
+    out << "]},\n";
+  }
+};
@@ -0,0 +1,131 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+/*
+  Chase-Lev work-stealing deque (with the memory orderings of Le et al.,
+  "Correct and Efficient Work-Stealing for Weak Memory Models", PPoPP'13).
+
+  One owner thread pushes and pops at the bottom; any other thread may
+  steal from the top. The ring buffer grows on demand. Arrays outgrown
+  while thieves may still be reading them are kept until clear(), which
+  is only called while no thread is using the deque.
+*/
+template <typename T>
+class WorkStealingDeque {
+  static_assert(std::is_pointer_v<T>, "deque elements are pointers");
+
+ public:
+  explicit WorkStealingDeque(std::size_t capacity = 1024) {
+    std::size_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+    arrays_.push_back(std::make_unique<Array>(cap));
+    array_.store(arrays_.back().get(), std::memory_order_relaxed);
+  }
+
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+  // Owner only.
+  void push(T item) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    Array* a = array_.load(std::memory_order_relaxed);
+    if (b - t > static_cast<int64_t>(a->mask)) a = grow(a, t, b);
+    a->put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only. Returns nullptr when empty.
+  T pop() {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T item = a->get(b);
+    if (t == b) {
+      // Last element: race thieves for it.
+      if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed))
+        item = nullptr;
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  // Any thread. Returns nullptr when empty or when it lost a race.
+  T steal() {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+    Array* a = array_.load(std::memory_order_acquire);
+    T item = a->get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed))
+      return nullptr;
+    return item;
+  }
+
+  bool looks_empty() const {
+    return bottom_.load(std::memory_order_relaxed) <=
+           top_.load(std::memory_order_relaxed);
+  }
+
+  // Drops retired arrays. No other thread may be using the deque.
+  void clear() {
+    top_.store(0, std::memory_order_relaxed);
+    bottom_.store(0, std::memory_order_relaxed);
+    Array* current = array_.load(std::memory_order_relaxed);
+    for (auto& a : arrays_) {
+      if (a.get() == current) {
+        std::unique_ptr<Array> keep = std::move(a);
+        arrays_.clear();
+        arrays_.push_back(std::move(keep));
+        break;
+      }
+    }
+  }
+
+ private:
+  struct Array {
+    std::size_t mask;
+    std::unique_ptr<std::atomic<T>[]> slots;
+
+    explicit Array(std::size_t cap)
+        : mask(cap - 1), slots(new std::atomic<T>[cap]) {}
+
+    T get(int64_t i) const {
+      return slots[static_cast<std::size_t>(i) & mask].load(
+          std::memory_order_relaxed);
+    }
+    void put(int64_t i, T item) {
+      slots[static_cast<std::size_t>(i) & mask].store(
+          item, std::memory_order_relaxed);
+    }
+  };
+
+  Array* grow(Array* a, int64_t t, int64_t b) {
+    auto bigger = std::make_unique<Array>((a->mask + 1) * 2);
+    for (int64_t i = t; i < b; ++i) bigger->put(i, a->get(i));
+    Array* next = bigger.get();
+    arrays_.push_back(std::move(bigger));
+    array_.store(next, std::memory_order_release);
+    return next;
+  }
+
+  alignas(64) std::atomic<int64_t> top_{0};
+  alignas(64) std::atomic<int64_t> bottom_{0};
+  std::atomic<Array*> array_{nullptr};
+  std::vector<std::unique_ptr<Array>> arrays_;  // owner only
+};
@@ -1,5 +1,6 @@
 #include "cli.hpp"
 
+#include "bytecode/binary.hpp"
 #include "bytecode/parser.hpp"
 #include "bytecode/prettyprinter.hpp"
 #include "mitscript-interpreter/interpreter.hpp"
@@ -7,22 +8,21 @@
 #include "mitscript-compiler/bytecode-converter.hpp"
 #include "mitscript-compiler/converter.hpp"
 #include "mitscript-compiler/cfg-prettyprinter.hpp"
-#include "mitscript-compiler/constant-propagation.hpp"
-#include "mitscript-compiler/inliner.hpp"
-#include "mitscript-compiler/shape_analysis.hpp"
+#include "mitscript-compiler/pass_manager.hpp"
 #include "mitscript-interpreter/lexer.hpp"
 #include "mitscript-interpreter/parser.hpp"
 #include "vm/interpreter.hpp"
-#include "bytecode/opt_inline.hpp"
-#include "mitscript-compiler/dce.hpp"
+#include "bytecode/peephole.hpp"
+#include "batch.hpp"
+#include "compile_cache.hpp"
+#include "serve.hpp"
+#include "source_file.hpp"
+#include <fstream>
 #include <iostream>
 #include <algorithm>
-
-static std::string read_istream(std::istream &is)
-{
-  return std::string(std::istreambuf_iterator<char>(is),
-                     std::istreambuf_iterator<char>());
-}
+#include <memory>
+#include <optional>
+#include <sstream>
 
 static bool has_opt(const Command &cmd, const std::string &name)
 {
@@ -34,15 +34,136 @@ static bool has_opt(const Command &cmd, const std::string &name)
   return present(name) || present("all");
 }
 
-static void run_shape_analysis_recursive(mitscript::CFG::FunctionCFG &fn)
+// Where the VM writes its execution profile: --profile, or stderr for
+// -O profile (which "all" does not include); empty when off.
+static std::string profile_path(const Command &cmd)
+{
+  if (!cmd.profile.empty())
+    return cmd.profile;
+  bool listed = std::find(cmd.opt.begin(), cmd.opt.end(), "profile") != cmd.opt.end();
+  return listed ? "-" : "";
+}
+
+// The options a compiled program depends on, for the compile cache.
+static std::string cache_options(const Command &cmd)
+{
+  std::vector<std::string> opt = cmd.opt;
+  std::sort(opt.begin(), opt.end());
+  std::string key = "O" + std::to_string(cmd.opt_level);
+  for (const auto &o : opt)
+    key += "," + o;
+  return key;
+}
+
+// The -O preset, plus any passes the -O list names on top of it.
+static mitscript::analysis::PassOptions pass_options(const Command &cmd)
+{
+  auto o = mitscript::analysis::PassOptions::preset(has_opt(cmd, "all") ? 3 : cmd.opt_level);
+  o.constprop |= has_opt(cmd, "constprop");
+  o.dce |= has_opt(cmd, "dce");
+  o.gvn |= has_opt(cmd, "gvn");
+  o.licm |= has_opt(cmd, "licm");
+  o.iv |= has_opt(cmd, "iv") || has_opt(cmd, "strength");
+  o.rotate |= has_opt(cmd, "rotate");
+  o.inline_calls |= has_opt(cmd, "inline") || has_opt(cmd, "inlining");
+  o.sra |= has_opt(cmd, "sra") || has_opt(cmd, "escape");
+  o.shape |= has_opt(cmd, "shape") || has_opt(cmd, "shapeanalysis");
+  o.types |= has_opt(cmd, "types") || has_opt(cmd, "typeinfer");
+  o.threads = cmd.compile_threads;
+  o.time_passes = cmd.time_passes;
+  return o;
+}
+
+// The VM settings batch and serve give each run; the reports written at
+// exit (--gc-stats, --profile and so on) are per process and stay off.
+static void configure_job(const Command &command, vm::VM &vm)
+{
+  vm.set_jit_enabled(has_opt(command, "jit") || command.opt_level >= 3);
+  vm.set_inlining(has_opt(command, "vminline"));
+  vm.set_gc_pause_us(command.gc_pause_us);
+  vm.set_gc_threads(command.gc_threads);
+  vm.set_gc_background_sweep(command.gc_background_sweep);
+}
+
+// The VM settings of a single run: a job's, plus the reports it writes at
+// exit, with the perf counters going to `perf`.
+static void configure_process(const Command &command, vm::VM &vm, PerfCounters *perf)
 {
-  // Run intraprocedural shape analysis per function; results are available for later passes.
-  (void)mitscript::analysis::run_shape_analysis(fn);
-  for (auto &child : fn.children)
+  configure_job(command, vm);
+  vm.set_gc_stats(command.gc_stats);
+  vm.set_heap_profile(command.heap_profile);
+  vm.set_profile(profile_path(command));
+  vm.set_perf_counters(perf);
+}
+
+// Writes the --perf-counters report to `path` ("-" for stderr).
+static void write_perf_counters(PerfCounters &counters, const std::string &path)
+{
+  if (path == "-")
   {
-    if (child)
-      run_shape_analysis_recursive(*child);
+    counters.write_json(std::cerr);
+    return;
   }
+  std::ofstream out(path);
+  if (!out)
+    std::cerr << "cannot write perf counters to " << path << "\n";
+  else
+    counters.write_json(out);
+}
+
+// Compiles source for derby and batch, through the compile cache when
+// --compile-cache is on. `bc` owns the program it converts; the work is
+// charged to the compile phase of `perf` when that is set.
+static bytecode::Function *compile_source(const Command &command, std::string_view contents,
+                                          BytecodeConverter &bc, PerfCounters *perf = nullptr)
+{
+  PerfCounters::Scope phase(perf, PerfCounters::Phase::Compile);
+  auto has_printcfg = [&]()
+  {
+    return std::find(command.opt.begin(), command.opt.end(), "printcfg") != command.opt.end();
+  };
+
+  // A cache hit skips the compiler, so runs that want to see it work
+  // (printcfg, --time-passes) bypass the cache.
+  std::optional<CompileCache> cache;
+  bytecode::Function *bytecode = nullptr;
+  if (command.compile_cache && !has_printcfg() && !command.time_passes)
+  {
+    cache.emplace(command.compile_cache_dir, cache_options(command), contents);
+    bytecode = cache->load();
+  }
+
+  if (!bytecode)
+  {
+    mitscript::Lexer lexer(contents);
+    std::vector<mitscript::Token> tokens = lexer.lex();
+
+    mitscript::Parser parser(tokens);
+    auto ast = parser.parse();
+
+    mitscript::CFG::FunctionCFG cfg;
+    cfg.name = "module";
+    CFGBuilder cfg_builder(cfg, /*moduleScope=*/true);
+    ast->accept(&cfg_builder);
+
+    mitscript::analysis::PassManager passes(pass_options(command));
+    passes.run(cfg);
+    if (command.time_passes)
+      passes.report(std::cerr);
+
+    // Optional: print CFG before lowering to bytecode
+    if (has_printcfg())
+    {
+      mitscript::CFG::prettyprint(cfg, *command.output_stream);
+    }
+
+    bc.shapes = &passes.shapes();
+    bc.types = &passes.types();
+    bytecode = bc.convert(cfg, /*is_toplevel=*/true);
+    if (cache)
+      cache->store(bytecode);
+  }
+  return bytecode;
 }
 
 static std::string token_kind_name(const mitscript::Token &t)
@@ -68,12 +189,27 @@ static std::string token_kind_name(const mitscript::Token &t)
 
 int main(int argc, char **argv)
 {
+  // Nothing here uses C stdio for the program's I/O, and the VM reads and
+  // writes the raw descriptors, so iostreams need not stay in step with it.
+  std::ios::sync_with_stdio(false);
+
   Command command = cli_parse(argc, argv);
 
-  std::string contents = read_istream(*command.input_stream);
+  // Tokens view into the source, so it stays mapped until exit. serve
+  // takes its programs from its clients instead.
+  SourceFile source = command.kind == CommandKind::SERVE
+                          ? SourceFile()
+                          : SourceFile::open(command.input_filename, *command.input_stream);
+  std::string_view contents = source.text();
   std::string input_filename = command.input_filename;
   std::string output_filename = command.output_filename;
 
+  // --perf-counters: one set of phase counters for this process. Batch
+  // runs VMs on threads of their own, which it does not count.
+  std::unique_ptr<PerfCounters> perf;
+  if (!command.perf_counters.empty())
+    perf = std::make_unique<PerfCounters>();
+
   bool had_error = false;
   switch (command.kind)
   {
@@ -167,6 +303,7 @@ int main(int argc, char **argv)
 
     try
     {
+      PerfCounters::Scope phase(perf.get(), PerfCounters::Phase::Compile);
       mitscript::Parser parser(tokens);
       auto ast = parser.parse();
 
@@ -175,27 +312,10 @@ int main(int argc, char **argv)
       CFGBuilder cfg_builder(cfg, /*moduleScope=*/true);
       ast->accept(&cfg_builder);
 
-      // Optional optimization: constant propagation / folding.
-      if (has_opt(command, "constprop") || has_opt(command, "all"))
-      {
-        mitscript::analysis::run_constant_folding(cfg);
-      }
-
-      if (has_opt(command, "dce") || has_opt(command, "all"))
-      {
-        mitscript::analysis::run_dce_on_function(cfg);
-      }
-
-      if (has_opt(command, "inline") || has_opt(command, "inlining") || has_opt(command, "all"))
-      {
-        mitscript::analysis::InlineConfig icfg;
-        mitscript::analysis::run_inlining_pass(cfg, icfg);
-      }
-
-      if (has_opt(command, "shape") || has_opt(command, "shapeanalysis") || has_opt(command, "all"))
-      {
-        run_shape_analysis_recursive(cfg);
-      }
+      mitscript::analysis::PassManager passes(pass_options(command));
+      passes.run(cfg);
+      if (command.time_passes)
+        passes.report(std::cerr);
 
       auto has_printcfg = [&]()
       {
@@ -207,8 +327,13 @@ int main(int argc, char **argv)
       }
 
       BytecodeConverter bc;
+      bc.shapes = &passes.shapes();
+      bc.types = &passes.types();
       bytecode::Function *bytecode = bc.convert(cfg, /*is_toplevel=*/true);
-      bytecode::prettyprint(bytecode, *command.output_stream);
+      if (command.emit_binary)
+        bytecode::write_binary(bytecode, *command.output_stream);
+      else
+        bytecode::prettyprint(bytecode, *command.output_stream);
     }
     catch (const std::exception &e)
     {
@@ -223,54 +348,43 @@ int main(int argc, char **argv)
   {
     try
     {
-      // Compile source to bytecode and immediately execute on the VM.
-      mitscript::Lexer lexer(contents);
-      std::vector<mitscript::Token> tokens = lexer.lex();
-
-      mitscript::Parser parser(tokens);
-      auto ast = parser.parse();
-
-      mitscript::CFG::FunctionCFG cfg;
-      cfg.name = "module";
-      CFGBuilder cfg_builder(cfg, /*moduleScope=*/true);
-      ast->accept(&cfg_builder);
-
-      // Optional optimization: constant propagation / folding.
-      if (has_opt(command, "constprop") || has_opt(command, "all"))
+      // With --snapshot, a run resumes from the state an earlier run of
+      // the same program saved at its first input(). A snapshot that does
+      // not fit is ignored, and the program runs from the start.
+      std::optional<CompileCache> snapshots;
+      if (command.snapshot)
       {
-        mitscript::analysis::run_constant_folding(cfg);
+        snapshots.emplace(command.snapshot_dir, cache_options(command), contents);
+        if (std::optional<CompileCache::Snapshot> snapshot = snapshots->load_snapshot())
+        {
+          vm::VM vm(command.mem);
+          configure_process(command, vm, perf.get());
+          try
+          {
+            vm.run(snapshot->program, snapshot->state);
+            break;
+          }
+          catch (const vm::SnapshotError &)
+          {
+            // Thrown before the program started; run it afresh below.
+          }
+        }
       }
 
-      if (has_opt(command, "dce") || has_opt(command, "all"))
-      {
-        mitscript::analysis::run_dce_on_function(cfg);
-      }
-
-      if (has_opt(command, "inline") || has_opt(command, "inlining") || has_opt(command, "all"))
-      {
-        mitscript::analysis::InlineConfig icfg;
-        mitscript::analysis::run_inlining_pass(cfg, icfg);
-      }
-
-      if (has_opt(command, "shape") || has_opt(command, "shapeanalysis") || has_opt(command, "all"))
-      {
-        run_shape_analysis_recursive(cfg);
-      }
+      // Compile source to bytecode and immediately execute on the VM.
+      BytecodeConverter bc; // owns the program it converts
+      bytecode::Function *bytecode = compile_source(command, contents, bc, perf.get());
 
-      // Optional: print CFG before lowering to bytecode
-      auto has_printcfg = [&]()
-      {
-        return std::find(command.opt.begin(), command.opt.end(), "printcfg") != command.opt.end();
-      };
-      if (has_printcfg())
+      vm::VM vm(command.mem);
+      configure_process(command, vm, perf.get());
+      if (snapshots)
       {
-        mitscript::CFG::prettyprint(cfg, *command.output_stream);
+        // The image is encoded now; running the program changes the tree.
+        std::ostringstream image;
+        bytecode::write_binary(bytecode, image);
+        vm.set_snapshot_hook([&snapshots, image = image.str()](vm::VM &machine)
+                             { snapshots->store_snapshot(image, machine.save_snapshot()); });
       }
-
-      BytecodeConverter bc;
-      bytecode::Function *bytecode = bc.convert(cfg, /*is_toplevel=*/true);
-      // bytecode::opt_inline::inline_functions(bytecode);
-      vm::VM vm(command.mem);
       vm.run(bytecode);
     }
     catch (const std::exception &e)
@@ -280,6 +394,52 @@ int main(int argc, char **argv)
     }
     break;
   }
+  case CommandKind::BATCH:
+  {
+    if (command.batch_inputs.empty())
+    {
+      had_error = true;
+      std::cerr << "Error: batch needs at least one input file\n";
+      break;
+    }
+    try
+    {
+      BytecodeConverter bc; // owns the program it converts
+      bytecode::Function *bytecode = compile_source(command, contents, bc);
+
+      BatchOptions options;
+      options.jobs = command.jobs;
+      options.mem_mb = command.mem;
+      options.output_dir = command.output_dir;
+      options.configure = [&command](vm::VM &vm)
+      { configure_job(command, vm); };
+      had_error = !run_batch(bytecode, command.batch_inputs, options);
+    }
+    catch (const std::exception &e)
+    {
+      had_error = true;
+      std::cerr << e.what() << "\n";
+    }
+    break;
+  }
+  case CommandKind::SERVE:
+  {
+    ServeOptions options;
+    options.socket_path = command.socket_path;
+    options.jobs = command.jobs;
+    options.mem_mb = command.mem;
+    options.compile = [&command](std::string_view source)
+    {
+      BytecodeConverter bc; // owns the program it converts
+      std::ostringstream image;
+      bytecode::write_binary(compile_source(command, source, bc), image);
+      return image.str();
+    };
+    options.configure = [&command](vm::VM &vm)
+    { configure_job(command, vm); };
+    had_error = !run_server(options);
+    break;
+  }
   case CommandKind::INTERPRET:
   {
     mitscript::Lexer lexer(contents);
@@ -308,6 +468,8 @@ int main(int argc, char **argv)
     catch (const std::exception &e)
     {
       had_error = true;
+      // print() no longer flushes; keep program output ahead of the error.
+      std::cout.flush();
       std::cerr << e.what() << "\n";
     }
     break;
@@ -317,16 +479,25 @@ int main(int argc, char **argv)
   {
     try
     {
-      // Parse bytecode
-      bytecode::Function *bytecode_func = bytecode::parse(contents);
+      // Load a binary image as is; parse anything else as text.
+      std::optional<PerfCounters::Scope> phase;
+      phase.emplace(perf.get(), PerfCounters::Phase::Compile);
+      bytecode::Function *bytecode_func = bytecode::is_binary(contents)
+                                              ? bytecode::read_binary(contents)
+                                              : bytecode::parse(contents);
 
       size_t max_mem_mb = command.mem;
 
-      // Optimization: inlining (disabled for now; current pass is not semantics-safe)
-      bytecode::opt_inline::inline_functions(bytecode_func);
+      if (has_opt(command, "peephole"))
+        bytecode::peephole::optimize(bytecode_func);
+      phase.reset();
 
       // Create VM and execute
       vm::VM vm(max_mem_mb);
+      configure_process(command, vm, perf.get());
+      // Bytecode is past the compiler's passes, so -O inline means the VM's.
+      if (has_opt(command, "inline"))
+        vm.set_inlining(true);
       vm.run(bytecode_func);
 
       // Cleanup
@@ -366,5 +537,7 @@ int main(int argc, char **argv)
   }
   }
 
+  if (perf)
+    write_perf_counters(*perf, command.perf_counters);
   return had_error ? 1 : 0;
 }
@@ -5,6 +5,8 @@
 #include <optional>
 
 #include "./cfg.hpp"
+#include "./shape_analysis.hpp"
+#include "./type_inference.hpp"
 #include "../bytecode/instructions.hpp"
 #include "../bytecode/types.hpp"
 
@@ -19,6 +21,15 @@ struct BytecodeConverter {
         BlockId target_block;
     };
 
+    // Shape analysis results, if it ran. Field accesses on records of a
+    // known shape address their slot directly, and record literals allocate
+    // their fields up front.
+    const mitscript::analysis::ShapeResults* shapes = nullptr;
+
+    // Type inference results, if it ran. Arithmetic and comparisons on two
+    // proven integers use the typed opcodes, which skip the kind checks.
+    const mitscript::analysis::TypeResults* types = nullptr;
+
     std::unordered_set<std::string> global_names_;
     std::vector<std::unique_ptr<bytecode::Function>> function_arena;
     std::vector<std::unique_ptr<bytecode::Constant>> constant_arena;
@@ -94,7 +105,7 @@ struct BytecodeConverter {
                 break;
             case IROperand::CONSTS:
                 key.kind = K::STR;
-                key.s = decodeStringLiteral(operand.s);
+                key.s = decodeStringLiteral(operand.s.str());
                 break;
             case IROperand::CONSTB:
                 key.kind = K::BOOL;
@@ -295,8 +306,9 @@ struct BytecodeConverter {
         std::vector<int> block_first_instrs(cfg.blocks.size(), -1);
         std::vector<Fixup> fixups;
 
-        auto emit = [&](bytecode::Operation op, std::optional<int32_t> o = std::nullopt) {
-            fn->instructions.emplace_back(op, o);
+        auto emit = [&](bytecode::Operation op, std::optional<int32_t> o = std::nullopt,
+                        std::optional<int32_t> o1 = std::nullopt) {
+            fn->instructions.emplace_back(op, o, o1);
             return (int)fn->instructions.size() - 1;
         };
 
@@ -315,13 +327,47 @@ struct BytecodeConverter {
         }
 
 
-        for (BlockId b : blockIds) {
+        const mitscript::analysis::ShapeAnalysisResult* shape_res = nullptr;
+        if (shapes) {
+            auto it = shapes->find(&cfg);
+            if (it != shapes->end()) shape_res = &it->second;
+        }
+        const mitscript::analysis::TypeInferenceResult* type_res = nullptr;
+        if (types) {
+            auto it = types->find(&cfg);
+            if (it != types->end()) type_res = &it->second;
+        }
+        // Whether both operands of a binary op are tagged integers.
+        auto int_operands = [&](const IRInstr& ir) {
+            if (!type_res || ir.inputs.size() != 2) return false;
+            for (const auto& x : ir.inputs)
+                if (x.kind != IROperand::VREG ||
+                    mitscript::analysis::get_vreg_type(*type_res, x.i) !=
+                        mitscript::analysis::TypeKind::Int)
+                    return false;
+            return true;
+        };
+        // The shape of `x`, a record operand in block b, or -1.
+        auto known_shape = [&](BlockId b, const IROperand& x) {
+            if (!shape_res || x.kind != IROperand::VREG ||
+                !mitscript::analysis::is_field_access_monomorphic(*shape_res, b, x.i))
+                return -1;
+            return mitscript::analysis::get_shape_at_block_out(*shape_res, b, x.i).shape_id;
+        };
+
+        for (size_t pos = 0; pos < blockIds.size(); ++pos) {
+            const BlockId b = blockIds[pos];
+            // The block laid out next, which needs no jump to reach.
+            const BlockId next = pos + 1 < blockIds.size() ? blockIds[pos + 1] : -1;
             auto& block = *cfg.blocks[b];
             block_first_instrs[b] = (int)fn->instructions.size();
+            // Records whose literal is still being filled in.
+            std::unordered_set<int> literals;
 
             for (const auto& ir : block.code) {
                 bytecode::Operation op = mapToBytecodeOp(ir.op);
                 std::optional<int32_t> operand;
+                std::optional<int32_t> operand1;
 
                 switch (ir.op) {
                     case IROp::LoadLocal:
@@ -345,11 +391,11 @@ struct BytecodeConverter {
                         }
 
                         if (x.kind == IROperand::NAME) {
-                            if (auto it = local_index.find(x.s); it != local_index.end()) {
+                            if (auto it = local_index.find(x.s.str()); it != local_index.end()) {
                                 operand = it->second;
                             } else {
                                 // Free variable captured via closure
-                                auto fvIt = std::find(fn->free_vars_.begin(), fn->free_vars_.end(), x.s);
+                                auto fvIt = std::find(fn->free_vars_.begin(), fn->free_vars_.end(), x.s.str());
                                 if (fvIt != fn->free_vars_.end()) {
                                     int idx = (int)(fn->local_reference_vars_.size() +
                                                     std::distance(fn->free_vars_.begin(), fvIt));
@@ -366,7 +412,7 @@ struct BytecodeConverter {
                                 }
                                 op = (ir.op == IROp::LoadLocal) ? bytecode::Operation::LoadGlobal
                                                                 : bytecode::Operation::StoreGlobal;
-                                operand = internName(x.s);
+                                operand = internName(x.s.str());
                                 break;
                             }
                         }
@@ -374,13 +420,13 @@ struct BytecodeConverter {
                         // Fallback: treat as global name
                         op = (ir.op == IROp::LoadLocal) ? bytecode::Operation::LoadGlobal
                                                         : bytecode::Operation::StoreGlobal;
-                        operand = internName(x.s);
+                        operand = internName(x.s.str());
                         break;
                     }
 
                     case IROp::LoadGlobal:
                     case IROp::StoreGlobal:
-                        operand = internName(ir.inputs[0].s);
+                        operand = internName(ir.inputs[0].s.str());
                         break;
 
                     case IROp::LoadConst: {
@@ -389,38 +435,75 @@ struct BytecodeConverter {
                     }
 
                     case IROp::LoadField:
-
-                    case IROp::StoreField:
+                    case IROp::StoreField: {
+                        const IROperand* field = nullptr;
                         for (auto &x : ir.inputs)
-                            if (x.kind == IROperand::NAME)
-                                operand = internName(x.s);
+                            if (x.kind == IROperand::NAME) {
+                                operand = internName(x.s.str());
+                                field = &x;
+                            }
+                        if (!field || ir.inputs.empty() ||
+                            (ir.inputs[0].kind == IROperand::VREG && literals.count(ir.inputs[0].i)))
+                            break;
+                        int shape = known_shape(b, ir.inputs[0]);
+                        int slot = shape < 0 ? -1
+                                             : mitscript::analysis::get_slot_index(*shape_res, shape,
+                                                                                   field->s.str());
+                        if (slot >= 0) {
+                            op = ir.op == IROp::LoadField ? bytecode::Operation::FieldLoadSlot
+                                                          : bytecode::Operation::FieldStoreSlot;
+                            operand1 = slot;
+                        }
+                        break;
+                    }
+
+                    case IROp::MakeRecord: {
+                        if (!ir.output) break;
+                        literals.insert(ir.output->i);
+                        int shape = known_shape(b, *ir.output);
+                        if (shape < 0) break;
+                        const auto& fields = shape_res->registry.lookup(shape)->fields;
+                        std::unordered_set<std::string> distinct(fields.begin(), fields.end());
+                        if (!distinct.empty()) operand = static_cast<int32_t>(distinct.size());
+                        break;
+                    }
+
+                    case IROp::Add:
+                    case IROp::Sub:
+                    case IROp::Mul:
+                    case IROp::CmpEq:
+                        if (int_operands(ir))
+                            op = ir.op == IROp::Add   ? bytecode::Operation::AddI
+                                 : ir.op == IROp::Sub ? bytecode::Operation::SubI
+                                 : ir.op == IROp::Mul ? bytecode::Operation::MulI
+                                                      : bytecode::Operation::EqI;
                         break;
 
                     case IROp::CmpLt:
                         // a < b  →  swap then Gt (computes b > a)
                         emit(bytecode::Operation::Swap);
-                        op = bytecode::Operation::Gt;
+                        op = int_operands(ir) ? bytecode::Operation::GtI : bytecode::Operation::Gt;
                         break;
 
                     case IROp::CmpLe:
                         // a <= b → swap then Geq (computes b >= a)
                         emit(bytecode::Operation::Swap);
-                        op = bytecode::Operation::Geq;
+                        op = int_operands(ir) ? bytecode::Operation::GeqI : bytecode::Operation::Geq;
                         break;
 
                     case IROp::CmpGt:
-                        op = bytecode::Operation::Gt;
+                        op = int_operands(ir) ? bytecode::Operation::GtI : bytecode::Operation::Gt;
                         break;
 
                     case IROp::CmpGe:
-                        op = bytecode::Operation::Geq;
+                        op = int_operands(ir) ? bytecode::Operation::GeqI : bytecode::Operation::Geq;
                         break;
 
                     case IROp::Call: {
                     if (!ir.inputs.empty()) {
                         const auto& cal = ir.inputs[0];
                         if (cal.kind == IROperand::NAME) {
-                            emit(bytecode::Operation::LoadGlobal, internName(cal.s));
+                            emit(bytecode::Operation::LoadGlobal, internName(cal.s.str()));
                         } else if (cal.kind == IROperand::LOCAL) {
                             emit(bytecode::Operation::LoadLocal, cal.i);
                         }
@@ -475,7 +558,7 @@ struct BytecodeConverter {
                         break;
                 }
 
-                emit(op, operand);
+                emit(op, operand, operand1);
             }
 
             switch (block.term.kind) {
@@ -504,9 +587,24 @@ struct BytecodeConverter {
                         block.term.falseTarget >= static_cast<BlockId>(cfg.blocks.size())) {
                         throw std::runtime_error("CondJump false target out of range");
                     }
-                    emit(bytecode::Operation::Not);
+                    if (block.term.trueTarget < 0 ||
+                        block.term.trueTarget >= static_cast<BlockId>(cfg.blocks.size())) {
+                        throw std::runtime_error("CondJump true target out of range");
+                    }
+                    if (next == block.term.trueTarget) {
+                        emit(bytecode::Operation::Not);
+                        int at = emit(bytecode::Operation::If, 0);
+                        fixups.push_back({at, block.term.falseTarget});
+                        break;
+                    }
+                    // A rotated loop's latch branches back to a block laid
+                    // out earlier (see induction.hpp).
                     int at = emit(bytecode::Operation::If, 0);
-                    fixups.push_back({at, block.term.falseTarget});
+                    fixups.push_back({at, block.term.trueTarget});
+                    if (next != block.term.falseTarget) {
+                        at = emit(bytecode::Operation::Goto, 0);
+                        fixups.push_back({at, block.term.falseTarget});
+                    }
                     break;
                 }
             }
@@ -61,10 +61,12 @@ std::string opName(IROp op) {
 std::string operandToString(const IROperand& operand) {
     switch (operand.kind) {
     case IROperand::VREG: return "v" + std::to_string(operand.i);
-    case IROperand::LOCAL: return "local#" + std::to_string(operand.i);
-    case IROperand::NAME: return "name(" + operand.s + ')';
+    case IROperand::LOCAL:
+        return "local#" + std::to_string(operand.i) +
+               (operand.version >= 0 ? '_' + std::to_string(operand.version) : "");
+    case IROperand::NAME: return "name(" + operand.s.str() + ')';
     case IROperand::CONSTI: return "const(" + std::to_string(operand.i) + ')';
-    case IROperand::CONSTS: return "const(\"" + operand.s + "\")";
+    case IROperand::CONSTS: return "const(\"" + operand.s.str() + "\")";
     case IROperand::CONSTB: return std::string("const(") + (operand.i ? "true" : "false") + ')';
     case IROperand::NONE: return "None";
     }
@@ -106,6 +108,15 @@ void printBlock(const BasicBlock& block, std::ostream& os, int baseIndent) {
     if (!block.successors.empty()) {
         os << ind << "  succs: " << joinList(block.successors) << '\n';
     }
+    for (const auto& phi : block.phis) {
+        os << ind << "  local#" << phi.local << '_' << phi.version << " = phi(";
+        for (size_t i = 0; i < phi.args.size(); ++i) {
+            if (i) os << ", ";
+            if (phi.args[i] < 0) os << '-';
+            else os << phi.args[i];
+        }
+        os << ")\n";
+    }
     if (block.code.empty()) {
         os << ind << "  <no instructions>\n";
     } else {
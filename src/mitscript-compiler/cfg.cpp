@@ -0,0 +1,42 @@
+#include "cfg.hpp"
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+namespace mitscript::CFG {
+
+namespace {
+
+// The interned strings. A deque never moves its elements, so the pointers
+// handed out stay valid for the life of the process; the index keys view
+// the stored strings.
+struct SymbolTable {
+    std::mutex mutex;
+    std::deque<std::string> strings;
+    std::unordered_map<std::string_view, const std::string*> index;
+};
+
+SymbolTable& symbol_table() {
+    static SymbolTable* table = new SymbolTable;
+    return *table;
+}
+
+} // namespace
+
+const std::string& Symbol::empty() {
+    static const std::string* text = intern({});
+    return *text;
+}
+
+const std::string* Symbol::intern(std::string_view text) {
+    SymbolTable& table = symbol_table();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    auto it = table.index.find(text);
+    if (it != table.index.end()) return it->second;
+    const std::string* stored = &table.strings.emplace_back(text);
+    table.index.emplace(*stored, stored);
+    return stored;
+}
+
+} // namespace mitscript::CFG
@@ -1,6 +1,12 @@
 #pragma once
 #include "../mitscript-interpreter/ast.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
 #include <optional>
+#include <string>
+#include <string_view>
 
 namespace mitscript::CFG
 {
@@ -51,19 +57,136 @@ namespace mitscript::CFG
     };
 ;
 
+    // Interned operand text (names and string constants). Every distinct
+    // string is stored once for the whole process, so an operand carries a
+    // pointer instead of its own copy, and two symbols are equal exactly
+    // when the pointers are. Interning is thread-safe; reading never locks.
+    class Symbol {
+    public:
+        Symbol() : text_(&empty()) {}
+        explicit Symbol(std::string_view text) : text_(intern(text)) {}
+
+        const std::string& str() const { return *text_; }
+        bool empty_text() const { return text_->empty(); }
+
+        bool operator==(Symbol o) const { return text_ == o.text_; }
+        bool operator!=(Symbol o) const { return text_ != o.text_; }
+
+        std::size_t hash() const { return std::hash<const void*>{}(text_); }
+
+    private:
+        static const std::string& empty();
+        static const std::string* intern(std::string_view text);
+
+        const std::string* text_;
+    };
+
     struct IROperand {
-        enum Kind { VREG, LOCAL, NAME, CONSTI, CONSTS, CONSTB, NONE } kind;
+        enum Kind : uint8_t { VREG, LOCAL, NAME, CONSTI, CONSTS, CONSTB, NONE } kind;
         int i = 0;
-        std::string s;
+        // SSA version of a LOCAL operand while the function is in SSA form
+        // (see ssa.hpp); -1 otherwise.
+        int version = -1;
+        Symbol s;
+
+        IROperand() : kind(NONE), i(0) {}
+        IROperand(Kind k, int i_val = 0) : kind(k), i(i_val) {}
+        IROperand(Kind k, int i_val, Symbol sym) : kind(k), i(i_val), s(sym) {}
+        IROperand(Kind k, int i_val, std::string_view text)
+            : kind(k), i(i_val), s(text) {}
+    };
 
-        IROperand() : kind(NONE), i(0), s() {}
-        IROperand(Kind k, int i_val = 0, std::string s_val = {})
-            : kind(k), i(i_val), s(std::move(s_val)) {}
+    // An instruction's operands. Almost every instruction has at most three,
+    // which are stored inline; only calls and closures with more spill to the
+    // heap.
+    class OperandList {
+    public:
+        static constexpr uint32_t kInline = 3;
+
+        OperandList() = default;
+        OperandList(std::initializer_list<IROperand> ops) { append(ops.begin(), ops.size()); }
+        OperandList(const OperandList& o) { append(o.data(), o.size_); }
+        OperandList(OperandList&& o) noexcept { take(o); }
+        ~OperandList() { delete[] heap_; }
+
+        OperandList& operator=(const OperandList& o) {
+            if (this != &o) {
+                clear();
+                append(o.data(), o.size_);
+            }
+            return *this;
+        }
+        OperandList& operator=(OperandList&& o) noexcept {
+            if (this != &o) {
+                delete[] heap_;
+                heap_ = nullptr;
+                take(o);
+            }
+            return *this;
+        }
+
+        std::size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+        IROperand* data() { return heap_ ? heap_ : inline_; }
+        const IROperand* data() const { return heap_ ? heap_ : inline_; }
+        IROperand& operator[](std::size_t k) { return data()[k]; }
+        const IROperand& operator[](std::size_t k) const { return data()[k]; }
+        IROperand* begin() { return data(); }
+        IROperand* end() { return data() + size_; }
+        const IROperand* begin() const { return data(); }
+        const IROperand* end() const { return data() + size_; }
+        IROperand& back() { return data()[size_ - 1]; }
+        const IROperand& back() const { return data()[size_ - 1]; }
+
+        void push_back(const IROperand& op) {
+            if (size_ == capacity()) grow(size_ * 2);
+            data()[size_++] = op;
+        }
+        void clear() { size_ = 0; }
+        void assign(std::size_t n, const IROperand& op) {
+            clear();
+            if (n > capacity()) grow(n);
+            for (std::size_t k = 0; k < n; ++k) data()[k] = op;
+            size_ = static_cast<uint32_t>(n);
+        }
+
+    private:
+        uint32_t capacity() const { return heap_ ? heap_capacity_ : kInline; }
+
+        void grow(std::size_t n) {
+            IROperand* bigger = new IROperand[n];
+            std::copy(data(), data() + size_, bigger);
+            delete[] heap_;
+            heap_ = bigger;
+            heap_capacity_ = static_cast<uint32_t>(n);
+        }
+        void append(const IROperand* ops, std::size_t n) {
+            if (size_ + n > capacity()) grow(size_ + n);
+            std::copy(ops, ops + n, data() + size_);
+            size_ += static_cast<uint32_t>(n);
+        }
+        void take(OperandList& o) {
+            size_ = o.size_;
+            if (o.heap_) {
+                heap_ = o.heap_;
+                heap_capacity_ = o.heap_capacity_;
+                o.heap_ = nullptr;
+            } else {
+                std::copy(o.inline_, o.inline_ + o.size_, inline_);
+            }
+            o.size_ = 0;
+        }
+
+        uint32_t size_ = 0;
+        uint32_t heap_capacity_ = 0;
+        IROperand* heap_ = nullptr;
+        IROperand inline_[kInline];
     };
 
     struct IRInstr {
         IROp op;
-        std::vector<IROperand> inputs;
+        OperandList inputs;
         std::optional<IROperand> output;
 
     };
@@ -77,8 +200,18 @@ namespace mitscript::CFG
 
     };
 
+    // phi(local) at the head of a block while in SSA form: defines
+    // `version` of `local` from args[i], the version live out of
+    // predecessors[i] (-1 for a predecessor that never runs).
+    struct Phi {
+        int local;
+        int version;
+        std::vector<int> args;
+    };
+
     struct BasicBlock {
         BlockId id;
+        std::vector<Phi> phis;
         std::vector<IRInstr> code;
         Terminator term{Terminator::Kind::Jump, -1};
         std::vector<BlockId> successors;
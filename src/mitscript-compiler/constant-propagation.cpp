@@ -0,0 +1,431 @@
+#include "constant-propagation.hpp"
+
+#include "dataflow.hpp"
+#include "gvn.hpp"
+#include "ssa.hpp"
+
+#include <algorithm>
+
+using namespace mitscript::CFG;
+
+namespace mitscript::analysis {
+
+namespace {
+
+bool contains(const std::vector<std::string>& v, const std::string& s) {
+    return std::find(v.begin(), v.end(), s) != v.end();
+}
+
+const std::string& slot_name(const FunctionCFG& fn, int slot) {
+    return slot < static_cast<int>(fn.params.size()) ? fn.params[slot]
+                                                     : fn.locals[slot - fn.params.size()];
+}
+
+// The global a load or store names, or "" when it names a local or a free
+// variable. Names that are neither a local nor a free variable of fn are
+// globals, wherever they appear.
+std::string global_name(const FunctionCFG& fn, bool is_module, const IRInstr& ir) {
+    if (ir.inputs.empty() || ir.inputs[0].kind != IROperand::NAME) return {};
+    const std::string& name = ir.inputs[0].s.str();
+    switch (ir.op) {
+        case IROp::LoadGlobal:
+        case IROp::StoreGlobal:
+            return name;
+        case IROp::LoadLocal:
+        case IROp::StoreLocal:
+            return is_module || !contains(fn.freeVars, name) ? name : std::string{};
+        default:
+            return {};
+    }
+}
+
+void count_global_stores(const FunctionCFG& fn, bool is_module,
+                         std::unordered_map<std::string, int>& stores) {
+    for (const auto& blk : fn.blocks) {
+        if (!blk) continue;
+        for (const auto& ir : blk->code) {
+            if (ir.op != IROp::StoreGlobal && ir.op != IROp::StoreLocal) continue;
+            std::string name = global_name(fn, is_module, ir);
+            if (name.empty() && is_module && !ir.inputs.empty() &&
+                ir.inputs[0].kind == IROperand::LOCAL)
+                name = slot_name(fn, ir.inputs[0].i);
+            if (!name.empty()) ++stores[name];
+        }
+    }
+    for (const auto& child : fn.children) {
+        if (child) count_global_stores(*child, false, stores);
+    }
+}
+
+size_t count_vregs(const FunctionCFG& fn) {
+    int max_v = -1;
+    for (const auto& blk_ptr : fn.blocks) {
+        if (!blk_ptr) continue;
+        for (const auto& ir : blk_ptr->code) {
+            if (ir.output && ir.output->kind == IROperand::VREG)
+                max_v = std::max(max_v, ir.output->i);
+            for (const auto& inp : ir.inputs) {
+                if (inp.kind == IROperand::VREG) max_v = std::max(max_v, inp.i);
+            }
+        }
+        if (blk_ptr->term.kind != Terminator::Kind::Jump)
+            max_v = std::max(max_v, blk_ptr->term.condition);
+    }
+    return (max_v < 0) ? 0u : static_cast<size_t>(max_v + 1);
+}
+
+bool is_bottom(const CPValue& v) { return v.kind == CPValue::Kind::Bottom; }
+
+// Instructions that compute their value from their operands alone, and so
+// can be replaced by the constant.
+bool foldable(IROp op) {
+    switch (op) {
+        case IROp::Add: case IROp::Sub: case IROp::Mul: case IROp::Div:
+        case IROp::CmpEq: case IROp::CmpLt: case IROp::CmpGt:
+        case IROp::CmpLe: case IROp::CmpGe: case IROp::And: case IROp::Or:
+        case IROp::Neg: case IROp::Not:
+        case IROp::LoadLocal: case IROp::LoadGlobal:
+            return true;
+        default:
+            return false;
+    }
+}
+
+class SparseConstantPropagation {
+public:
+    SparseConstantPropagation(FunctionCFG& fn, bool is_toplevel, const GlobalConstants* globals)
+        : fn_(fn), is_toplevel_(is_toplevel), globals_(globals) {}
+
+    void run() {
+        dom_ = compute_dominators(fn_);
+        if (dom_.rpo.empty()) return;
+        ssa_ = construct_ssa(fn_, dom_, is_toplevel_);
+
+        const size_t n = fn_.blocks.size();
+        vregs_.assign(count_vregs(fn_), CPValue::bottom());
+        versions_.resize(ssa_.version_count.size());
+        users_.resize(ssa_.version_count.size());
+        for (size_t slot = 0; slot < versions_.size(); ++slot) {
+            versions_[slot].assign(static_cast<size_t>(ssa_.version_count[slot]), CPValue::bottom());
+            users_[slot].resize(versions_[slot].size());
+            // Version 0 is whatever the local holds on entry.
+            if (!versions_[slot].empty()) versions_[slot][0] = CPValue::top();
+        }
+        executable_.assign(n, 0);
+        edge_taken_.resize(n);
+        worklist_.emplace(dom_.rpo, n);
+
+        for (BlockId b : dom_.rpo) {
+            const auto& blk = *fn_.blocks[b];
+            edge_taken_[b].assign(blk.predecessors.size(), 0);
+            for (const auto& phi : blk.phis) {
+                for (int arg : phi.args)
+                    if (arg >= 0) add_user(phi.local, arg, b);
+            }
+            for (const auto& ir : blk.code) {
+                if (ir.op == IROp::LoadLocal && !ir.inputs.empty() && ir.inputs[0].version >= 0)
+                    add_user(ir.inputs[0].i, ir.inputs[0].version, b);
+            }
+        }
+        if (is_toplevel_ && globals_) find_module_stores();
+
+        executable_[fn_.entry] = 1;
+        enqueue(fn_.entry);
+        while (!worklist_->empty()) visit(worklist_->pop());
+    }
+
+    void rewrite() {
+        if (dom_.rpo.empty()) return;
+        for (BlockId b : dom_.rpo) {
+            if (!executable_[b]) continue;
+            auto& blk = *fn_.blocks[b];
+
+            // A constant replaces the whole operand tree that computes it,
+            // which keeps the block's stack balanced. Walking backwards, a
+            // tree's root comes before its subtrees.
+            auto starts = pure_tree_starts(blk);
+            std::vector<IRInstr> code;
+            code.reserve(blk.code.size());
+            for (int k = static_cast<int>(blk.code.size()) - 1; k >= 0; --k) {
+                IRInstr& ir = blk.code[k];
+                if (ir.output && ir.output->kind == IROperand::VREG && foldable(ir.op) &&
+                    is_constant(vreg(ir.output->i))) {
+                    bool has_operands = std::any_of(ir.inputs.begin(), ir.inputs.end(),
+                        [](const IROperand& x) { return x.kind == IROperand::VREG; });
+                    if (!has_operands || starts[k] >= 0) {
+                        ir.op = IROp::LoadConst;
+                        ir.inputs.assign(1, cpvalue_to_operand(vreg(ir.output->i)));
+                        if (has_operands) k = starts[k];
+                    }
+                }
+                code.push_back(std::move(ir));
+            }
+            std::reverse(code.begin(), code.end());
+            blk.code = std::move(code);
+
+            // A constant condition goes away with the branch, if it is the
+            // value the block computes last.
+            if (blk.term.kind != Terminator::Kind::CondJump) continue;
+            const CPValue& c = vreg(blk.term.condition);
+            if (c.kind != CPValue::Kind::ConstBool || blk.code.empty() ||
+                blk.code.back().op != IROp::LoadConst || !blk.code.back().output ||
+                blk.code.back().output->i != blk.term.condition)
+                continue;
+            blk.code.pop_back();
+            BlockId taken = *c.bool_val ? blk.term.trueTarget : blk.term.falseTarget;
+            BlockId dropped = *c.bool_val ? blk.term.falseTarget : blk.term.trueTarget;
+            blk.term.kind = Terminator::Kind::Jump;
+            blk.term.target = taken;
+            blk.term.trueTarget = -1;
+            blk.term.falseTarget = -1;
+            blk.successors.clear();
+            if (taken >= 0) blk.successors.push_back(taken);
+            if (dropped != taken && dropped >= 0 && dropped < static_cast<BlockId>(fn_.blocks.size()) &&
+                fn_.blocks[dropped]) {
+                auto& preds = fn_.blocks[dropped]->predecessors;
+                preds.erase(std::remove(preds.begin(), preds.end(), b), preds.end());
+            }
+        }
+        destruct_ssa(fn_);
+    }
+
+private:
+    void add_user(int slot, int version, BlockId b) {
+        auto& list = users_[slot][version];
+        if (list.empty() || list.back() != b) list.push_back(b);
+    }
+
+    void enqueue(BlockId b) { worklist_->push(b); }
+
+    const CPValue& vreg(int v) const {
+        static const CPValue top = CPValue::top();
+        return v >= 0 && v < static_cast<int>(vregs_.size()) ? vregs_[v] : top;
+    }
+
+    void set_vreg(int v, const CPValue& value) {
+        if (v >= 0 && v < static_cast<int>(vregs_.size())) vregs_[v] = meet(vregs_[v], value);
+    }
+
+    void set_version(int slot, int version, const CPValue& value) {
+        CPValue& cur = versions_[slot][version];
+        CPValue merged = meet(cur, value);
+        if (merged == cur) return;
+        cur = std::move(merged);
+        for (BlockId user : users_[slot][version])
+            if (executable_[user]) enqueue(user);
+    }
+
+    void take_edge(BlockId from, BlockId to) {
+        if (to < 0 || to >= static_cast<BlockId>(fn_.blocks.size()) || !dom_.reachable[to]) return;
+        bool added = false;
+        const auto& preds = fn_.blocks[to]->predecessors;
+        for (size_t i = 0; i < preds.size(); ++i) {
+            if (preds[i] == from && !edge_taken_[to][i]) {
+                edge_taken_[to][i] = 1;
+                added = true;
+            }
+        }
+        if (!executable_[to]) {
+            executable_[to] = 1;
+            enqueue(to);
+        } else if (added && !fn_.blocks[to]->phis.empty()) {
+            enqueue(to);
+        }
+    }
+
+    // Where the module body stores each constant global, if in its entry
+    // block (find_constant_globals only accepts those).
+    void find_module_stores() {
+        const auto& code = fn_.blocks[fn_.entry]->code;
+        for (size_t k = 0; k < code.size(); ++k) {
+            if (code[k].op != IROp::StoreGlobal && code[k].op != IROp::StoreLocal) continue;
+            std::string name = global_name(fn_, true, code[k]);
+            if (!name.empty() && globals_->count(name)) module_stores_.emplace(name, k);
+        }
+    }
+
+    // The value of a global read at code[k] of block b.
+    CPValue global_value(const IRInstr& ir, BlockId b, size_t k) const {
+        if (!globals_) return CPValue::top();
+        std::string name = global_name(fn_, is_toplevel_, ir);
+        auto it = globals_->find(name);
+        if (name.empty() || it == globals_->end()) return CPValue::top();
+        if (is_toplevel_) {
+            // Module code may read the global before it is assigned.
+            auto st = module_stores_.find(name);
+            if (st == module_stores_.end() || (b == fn_.entry && k <= st->second))
+                return CPValue::top();
+        }
+        return it->second;
+    }
+
+    CPValue operand(const IROperand& op) const {
+        switch (op.kind) {
+            case IROperand::VREG:   return vreg(op.i);
+            case IROperand::CONSTI: return CPValue::cint(op.i);
+            case IROperand::CONSTB: return CPValue::cbool(op.i != 0);
+            case IROperand::CONSTS: return CPValue::cstr(op.s.str());
+            case IROperand::NONE:   return CPValue::none();
+            default:                return CPValue::top();
+        }
+    }
+
+    void visit(BlockId b) {
+        const auto& blk = *fn_.blocks[b];
+        for (const auto& phi : blk.phis) {
+            CPValue v = CPValue::bottom();
+            for (size_t i = 0; i < phi.args.size(); ++i) {
+                if (!edge_taken_[b][i]) continue;
+                v = meet(v, phi.args[i] >= 0 ? versions_[phi.local][phi.args[i]] : CPValue::top());
+            }
+            set_version(phi.local, phi.version, v);
+        }
+
+        for (size_t k = 0; k < blk.code.size(); ++k) {
+            const auto& ir = blk.code[k];
+            CPValue out = CPValue::top();
+            switch (ir.op) {
+                case IROp::LoadConst:
+                    if (ir.inputs.size() == 1) out = operand(ir.inputs[0]);
+                    break;
+                case IROp::LoadLocal:
+                    if (!ir.inputs.empty() && ir.inputs[0].version >= 0)
+                        out = versions_[ir.inputs[0].i][ir.inputs[0].version];
+                    else
+                        out = global_value(ir, b, k);
+                    break;
+                case IROp::LoadGlobal:
+                    out = global_value(ir, b, k);
+                    break;
+                case IROp::StoreLocal:
+                    if (ir.inputs.size() >= 2 && ir.inputs[0].version >= 0)
+                        set_version(ir.inputs[0].i, ir.inputs[0].version, operand(ir.inputs[1]));
+                    break;
+                case IROp::Add: case IROp::Sub: case IROp::Mul: case IROp::Div:
+                case IROp::CmpEq: case IROp::CmpLt: case IROp::CmpGt:
+                case IROp::CmpLe: case IROp::CmpGe: case IROp::And: case IROp::Or:
+                    if (ir.inputs.size() == 2) {
+                        CPValue a = operand(ir.inputs[0]);
+                        CPValue c = operand(ir.inputs[1]);
+                        out = is_bottom(a) || is_bottom(c) ? CPValue::bottom()
+                                                           : eval_binary(ir.op, a, c);
+                    }
+                    break;
+                case IROp::Neg:
+                case IROp::Not:
+                    if (ir.inputs.size() == 1) {
+                        CPValue a = operand(ir.inputs[0]);
+                        out = is_bottom(a) ? CPValue::bottom() : eval_unary(ir.op, a);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            if (ir.output && ir.output->kind == IROperand::VREG) set_vreg(ir.output->i, out);
+        }
+
+        switch (blk.term.kind) {
+            case Terminator::Kind::Jump:
+                take_edge(b, blk.term.target);
+                break;
+            case Terminator::Kind::CondJump: {
+                const CPValue& c = vreg(blk.term.condition);
+                if (is_bottom(c)) break;
+                if (c.kind != CPValue::Kind::ConstBool || *c.bool_val) take_edge(b, blk.term.trueTarget);
+                if (c.kind != CPValue::Kind::ConstBool || !*c.bool_val) take_edge(b, blk.term.falseTarget);
+                break;
+            }
+            case Terminator::Kind::Return:
+                break;
+        }
+    }
+
+    FunctionCFG& fn_;
+    bool is_toplevel_;
+    const GlobalConstants* globals_;
+    DominatorTree dom_;
+    SSAInfo ssa_;
+
+    std::vector<CPValue> vregs_;
+    std::vector<std::vector<CPValue>> versions_;             // per slot, per version
+    std::vector<std::vector<std::vector<BlockId>>> users_;   // blocks reading each version
+    std::vector<char> executable_;
+    std::vector<std::vector<char>> edge_taken_;              // per block, per predecessor
+    std::unordered_map<std::string, size_t> module_stores_;
+    // Blocks to (re)visit, earliest in reverse postorder first, so a block
+    // usually sees its predecessors' values settled.
+    std::optional<BlockWorklist> worklist_;
+};
+
+} // namespace
+
+GlobalConstants find_constant_globals(const FunctionCFG& module) {
+    GlobalConstants found;
+    if (module.entry < 0 || module.entry >= static_cast<BlockId>(module.blocks.size()) ||
+        !module.blocks[module.entry])
+        return found;
+
+    std::unordered_map<std::string, int> stores;
+    count_global_stores(module, true, stores);
+
+    // The entry block runs first and straight through, so up to its first
+    // call it is all the code that has run.
+    std::unordered_map<VReg, CPValue> values;
+    auto value_of = [&](const IROperand& x) {
+        if (x.kind != IROperand::VREG) return CPValue::top();
+        auto it = values.find(x.i);
+        return it == values.end() ? CPValue::top() : it->second;
+    };
+    for (const auto& ir : module.blocks[module.entry]->code) {
+        if (ir.op == IROp::Call) break;
+        CPValue out = CPValue::top();
+        switch (ir.op) {
+            case IROp::LoadConst:
+                if (ir.inputs.size() == 1) {
+                    const IROperand& c = ir.inputs[0];
+                    if (c.kind == IROperand::CONSTI) out = CPValue::cint(c.i);
+                    else if (c.kind == IROperand::CONSTB) out = CPValue::cbool(c.i != 0);
+                    else if (c.kind == IROperand::CONSTS) out = CPValue::cstr(c.s.str());
+                    else if (c.kind == IROperand::NONE) out = CPValue::none();
+                }
+                break;
+            case IROp::LoadGlobal:
+            case IROp::LoadLocal: {
+                auto it = found.find(global_name(module, true, ir));
+                if (it != found.end()) out = it->second;
+                break;
+            }
+            case IROp::StoreGlobal:
+            case IROp::StoreLocal: {
+                std::string name = global_name(module, true, ir);
+                if (!name.empty() && ir.inputs.size() >= 2 && stores[name] == 1) {
+                    CPValue v = value_of(ir.inputs[1]);
+                    if (is_constant(v)) found[name] = v;
+                }
+                break;
+            }
+            case IROp::Add: case IROp::Sub: case IROp::Mul: case IROp::Div:
+            case IROp::CmpEq: case IROp::CmpLt: case IROp::CmpGt:
+            case IROp::CmpLe: case IROp::CmpGe: case IROp::And: case IROp::Or:
+                if (ir.inputs.size() == 2)
+                    out = eval_binary(ir.op, value_of(ir.inputs[0]), value_of(ir.inputs[1]));
+                break;
+            case IROp::Neg:
+            case IROp::Not:
+                if (ir.inputs.size() == 1) out = eval_unary(ir.op, value_of(ir.inputs[0]));
+                break;
+            default:
+                break;
+        }
+        if (ir.output && ir.output->kind == IROperand::VREG) values[ir.output->i] = out;
+    }
+    return found;
+}
+
+void run_constant_folding(FunctionCFG& fn, bool is_toplevel, const GlobalConstants* globals) {
+    SparseConstantPropagation sccp(fn, is_toplevel, globals);
+    sccp.run();
+    sccp.rewrite();
+}
+
+} // namespace mitscript::analysis
@@ -13,8 +13,7 @@ struct CFGBuilder : public Visitor {
 
      std::unordered_set<std::string> get_vars(Block* b) {
         std::unordered_set<std::string> vars;
-        for (const auto& statement_ptr : b->statements) {
-            Statement* statement = statement_ptr.get();
+        for (Statement* statement : b->statements) {
             if (auto if_stmt = dynamic_cast<IfStatement*>(statement)) {
                 auto if_vars = get_vars(if_stmt);
                 vars.insert(if_vars.begin(), if_vars.end());
@@ -37,23 +36,23 @@ struct CFGBuilder : public Visitor {
     std::unordered_set<std::string> get_vars(IfStatement* if_stmt) {
         std::unordered_set<std::string> vars;
         if (if_stmt->then_block) {
-            auto then_vars = get_vars(if_stmt->then_block.get());
+            auto then_vars = get_vars(if_stmt->then_block);
             vars.insert(then_vars.begin(), then_vars.end());
         }
         if (if_stmt->else_block) {
-            auto else_vars = get_vars(if_stmt->else_block.get());
+            auto else_vars = get_vars(if_stmt->else_block);
             vars.insert(else_vars.begin(), else_vars.end());
         }
         return vars;
     }
 
     std::unordered_set<std::string> get_vars(WhileLoop* while_stmt) {
-        return get_vars(while_stmt->body.get());
+        return get_vars(while_stmt->body);
     }
 
     std::unordered_set<std::string> get_vars(Assignment* assign_stmt) {
         std::unordered_set<std::string> vars;
-        if (auto var_target = dynamic_cast<Variable*>(assign_stmt->target.get())) {
+        if (auto var_target = dynamic_cast<Variable*>(assign_stmt->target)) {
             vars.insert(var_target->name);
         }
         return vars;
@@ -148,9 +147,9 @@ struct CFGBuilder : public Visitor {
         return raw;
     };
 
-    void startFunction(const std::vector<std::string>& params) {
+    void startFunction(const AstList<std::string>& params) {
         CFG.entry = 0;
-        CFG.params = params;
+        CFG.params.assign(params.begin(), params.end());
         localSlots.clear();
         notedNames.clear();
         byRefSet.clear();
@@ -167,16 +166,16 @@ struct CFGBuilder : public Visitor {
             return;
         }
         if (auto blk = dynamic_cast<Block*>(s)) {
-            for (auto& st : blk->statements) collectGlobals(st.get());
+            for (auto& st : blk->statements) collectGlobals(st);
             return;
         }
         if (auto iff = dynamic_cast<IfStatement*>(s)) {
-            collectGlobals(iff->then_block.get());
-            if (iff->else_block) collectGlobals(iff->else_block.get());
+            collectGlobals(iff->then_block);
+            if (iff->else_block) collectGlobals(iff->else_block);
             return;
         }
         if (auto wh = dynamic_cast<WhileLoop*>(s)) {
-            collectGlobals(wh->body.get());
+            collectGlobals(wh->body);
             return;
         }
     }
@@ -207,13 +206,13 @@ struct CFGBuilder : public Visitor {
 
     };
 
-    VReg emitValuedInstr(IROp op, std::vector<IROperand> input) {
+    VReg emitValuedInstr(IROp op, OperandList input) {
         VReg outputReg = newVreg();
         curr -> code.push_back(IRInstr{op, std::move(input), IROperand{IROperand::VREG, outputReg}});
         return outputReg;
     }
 
-    void emitUnvaluedInstr(IROp op, std::vector<IROperand> input) {
+    void emitUnvaluedInstr(IROp op, OperandList input) {
         curr -> code.push_back(IRInstr{op, std::move(input),  std::nullopt});
     };
 
@@ -247,7 +246,7 @@ struct CFGBuilder : public Visitor {
         is_module_scope = true;
 
         for (auto& stmt : node->statements) {
-            execStatement(stmt.get());
+            execStatement(stmt);
         }
 
         if (hasOpenTerminator()) {
@@ -295,7 +294,7 @@ struct CFGBuilder : public Visitor {
     };
 
     void visit(UnaryExpression* node) override {
-        VReg val = evalExpression(node -> operand.get());
+        VReg val = evalExpression(node -> operand);
         lastVreg = emitValuedInstr(
             node -> op == UnOp::NEG ? IROp::Neg : IROp::Not,
             {IROperand{IROperand::VREG, val}}
@@ -306,7 +305,7 @@ struct CFGBuilder : public Visitor {
         VReg record = emitValuedInstr(IROp::MakeRecord, {});
         for (auto& [key, expr] : node->fields) {
             emitUnvaluedInstr(IROp::Dup, {});
-            VReg value = evalExpression(expr.get());
+            VReg value = evalExpression(expr);
             noteName(key);
             emitUnvaluedInstr(IROp::StoreField, {
                 {IROperand::VREG, record},
@@ -320,13 +319,13 @@ struct CFGBuilder : public Visitor {
 
     void visit(Block* node) override {
         for (auto& stmt : node -> statements) {
-            execStatement(stmt.get());
+            execStatement(stmt);
         };
     };
     void visit(Assignment* node) override {
-        if (auto fieldDeref = dynamic_cast<FieldDereference*>(node -> target.get())) {
-            VReg obj = evalExpression(fieldDeref -> object.get());
-            VReg rhs = evalExpression(node -> value.get());
+        if (auto fieldDeref = dynamic_cast<FieldDereference*>(node -> target)) {
+            VReg obj = evalExpression(fieldDeref -> object);
+            VReg rhs = evalExpression(node -> value);
             noteName(fieldDeref->field_name);
             emitUnvaluedInstr(IROp::StoreField,
                 {
@@ -338,10 +337,10 @@ struct CFGBuilder : public Visitor {
             return;
         }
 
-        if (auto idxExpr = dynamic_cast<IndexExpression*>(node -> target.get())) {
-            VReg baseExpr = evalExpression(idxExpr -> baseExpression.get());
-            VReg idx = evalExpression(idxExpr -> indexExpression.get());
-            VReg rhs = evalExpression(node -> value.get());
+        if (auto idxExpr = dynamic_cast<IndexExpression*>(node -> target)) {
+            VReg baseExpr = evalExpression(idxExpr -> baseExpression);
+            VReg idx = evalExpression(idxExpr -> indexExpression);
+            VReg rhs = evalExpression(node -> value);
             emitUnvaluedInstr(IROp::StoreIndex, {
                 {IROperand::VREG, baseExpr},
                 {IROperand::VREG, idx},
@@ -351,7 +350,7 @@ struct CFGBuilder : public Visitor {
         }
 
         bool targetIsGlobalVar = false;
-        if (auto var = dynamic_cast<Variable*>(node->target.get())) {
+        if (auto var = dynamic_cast<Variable*>(node->target)) {
             if (is_module_scope || funcGlobals.count(var->name)) {
                 targetIsGlobalVar = true;
                 noteName(var->name);
@@ -359,22 +358,23 @@ struct CFGBuilder : public Visitor {
         }
 
         VReg rhs;
-        // if (auto var = dynamic_cast<Variable*>(node->target.get())) {
+        // if (auto var = dynamic_cast<Variable*>(node->target)) {
         //     if (!isGlobalReference(var->name) &&
         //         !(parentLocals && parentLocals->count(var->name))) {
         //         ensureLocal(var->name);
         //     }
         // }
 
-        rhs = evalExpression(node->value.get());
-        if (auto var = dynamic_cast<Variable*>(node->target.get())) {
+        rhs = evalExpression(node->value);
+        if (auto var = dynamic_cast<Variable*>(node->target)) {
             if (targetIsGlobalVar) {
                 emitUnvaluedInstr(IROp::StoreGlobal, {
                     {IROperand::NAME, 0, var->name}, {IROperand::VREG, rhs}
                 });
             } else if (localSlots.find(var->name) != localSlots.end()) {
+                // Only locals a nested function captures live in a
+                // Reference (see visit(FunctionDeclaration*)).
                 int slot = slotOfLocal(var->name);
-                ensureByRef(var->name);
                 emitUnvaluedInstr(IROp::StoreLocal, {
                     {IROperand::LOCAL, slot}, {IROperand::VREG, rhs}
                 });
@@ -388,7 +388,6 @@ struct CFGBuilder : public Visitor {
             } else {
                 // Default to local if nothing else matched
                 int slot = ensureLocal(var->name);
-                ensureByRef(var->name);
                 emitUnvaluedInstr(IROp::StoreLocal, {
                     {IROperand::LOCAL, slot}, {IROperand::VREG, rhs}
                 });
@@ -397,7 +396,7 @@ struct CFGBuilder : public Visitor {
 
     };
     void visit(IfStatement* node) override {
-        VReg cond = evalExpression(node -> condition.get());
+        VReg cond = evalExpression(node -> condition);
 
         BasicBlock* thenBlock = newBlock();
         BasicBlock* elseBlock = node -> else_block ? newBlock() : nullptr;
@@ -408,7 +407,7 @@ struct CFGBuilder : public Visitor {
         curr = thenBlock;
 
         for (auto& stmt : node -> then_block -> statements) {
-            execStatement(stmt.get());
+            execStatement(stmt);
         }
 
         if (curr -> term.kind == Terminator::Jump && curr -> term.target == -1) {
@@ -418,7 +417,7 @@ struct CFGBuilder : public Visitor {
         if (elseBlock) {
             curr = elseBlock;
             for (auto& stmt : node -> else_block -> statements) {
-                execStatement(stmt.get());
+                execStatement(stmt);
             }
             bool elseReturns = (elseBlock->term.kind == Terminator::Kind::Return);
             if (!elseReturns &&
@@ -434,11 +433,11 @@ struct CFGBuilder : public Visitor {
 
     };
     void visit(::mitscript::Return* node) override {
-        // VReg rval = evalExpression(node -> value.get());
+        // VReg rval = evalExpression(node -> value);
         // emitUnvaluedInstr(IROp::Return, {{IROperand::VREG, rval}});
         std::optional<VReg> rval;
         if (node -> value) {
-            rval = evalExpression(node -> value.get());
+            rval = evalExpression(node -> value);
         }
 
         BasicBlock* returnBlock = curr;
@@ -450,15 +449,15 @@ struct CFGBuilder : public Visitor {
     };
     void visit(BinaryExpression* node) override {
         IROp op = mapBin(node -> op);
-        VReg lhs = evalExpression(node -> left.get());
-        VReg rhs = evalExpression(node -> right.get());
+        VReg lhs = evalExpression(node -> left);
+        VReg rhs = evalExpression(node -> right);
 
         lastVreg = emitValuedInstr(op, {{IROperand::VREG, lhs}, {IROperand::VREG, rhs}});
 
 
     };
     void visit(FieldDereference* node) override {
-        VReg obj = evalExpression(node -> object.get());
+        VReg obj = evalExpression(node -> object);
         noteName(node->field_name);
         lastVreg = emitValuedInstr(IROp::LoadField,
             {IROperand{IROperand::VREG, obj}, {IROperand::NAME, 0, node -> field_name}
@@ -466,24 +465,24 @@ struct CFGBuilder : public Visitor {
 
     };
     void visit(::mitscript::Call* node) override {
-        VReg callee = evalExpression(node -> callee.get());
-        std::vector<IROperand> input;
+        VReg callee = evalExpression(node -> callee);
+        OperandList input;
         input.push_back({IROperand::VREG, callee});
 
         for (auto& arg : node -> arguments) {
             input.push_back(
-                {IROperand::VREG, evalExpression(arg.get())}
+                {IROperand::VREG, evalExpression(arg)}
             );
         }
 
-        lastVreg = emitValuedInstr(IROp::Call, input);
+        lastVreg = emitValuedInstr(IROp::Call, std::move(input));
     };
     void visit(Global* node) override {
         funcGlobals.insert(node->name);
         noteName(node->name);
     };
     void visit(CallStatement* node) override {
-        evalExpression(node -> call.get());
+        evalExpression(node -> call);
         emitUnvaluedInstr(IROp::Pop, {});
     };
     void visit(WhileLoop* node) override {
@@ -496,11 +495,11 @@ struct CFGBuilder : public Visitor {
 
         curr = B_head;
 
-        VReg cond = evalExpression(node -> condition.get());
+        VReg cond = evalExpression(node -> condition);
         endWithCond(cond, B_body, B_exit);
         curr = B_body;
         for (auto& stmt : node -> body -> statements) {
-            execStatement(stmt.get());
+            execStatement(stmt);
         }
 
         if (curr -> term.kind == Terminator::Kind::Jump && curr -> term.target == -1) {
@@ -534,13 +533,13 @@ struct CFGBuilder : public Visitor {
 
 
         // 1) find function-level globals
-        subBuilder.collectGlobals(node->body.get());
+        subBuilder.collectGlobals(node->body);
 
         // 2) initialize params & entry block
         subBuilder.startFunction(node->args);
 
         // 3) precompute locals: all LHS names minus globals and params
-        auto locals = subBuilder.get_vars(node->body.get());
+        auto locals = subBuilder.get_vars(node->body);
         for (const auto& g : subBuilder.funcGlobals) {
             locals.erase(g);
         }
@@ -560,7 +559,7 @@ struct CFGBuilder : public Visitor {
 
         // 4) generate code for body
         for (auto& stmt : node->body->statements) {
-            subBuilder.execStatement(stmt.get());
+            subBuilder.execStatement(stmt);
         }
 
         // 5) ensure an implicit "return None" if needed
@@ -596,7 +595,7 @@ struct CFGBuilder : public Visitor {
         const FunctionCFG& child = *CFG.children.back();
 
         // 7) build closure: free vars (by name) + function index
-        std::vector<IROperand> closureInputs;
+        OperandList closureInputs;
         for (const auto& fv : child.freeVars) {
             closureInputs.push_back({IROperand::NAME, 0, fv});
         }
@@ -604,8 +603,8 @@ struct CFGBuilder : public Visitor {
         lastVreg = emitValuedInstr(IROp::AllocClosure, std::move(closureInputs));
     }
     void visit(IndexExpression* node) override{
-        VReg base = evalExpression(node -> baseExpression.get());
-        VReg index = evalExpression(node -> indexExpression.get());
+        VReg base = evalExpression(node -> baseExpression);
+        VReg index = evalExpression(node -> indexExpression);
 
         lastVreg = emitValuedInstr(IROp::LoadIndex, {
             IROperand{IROperand::VREG, base}, IROperand{IROperand::VREG, index}
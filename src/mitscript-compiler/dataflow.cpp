@@ -0,0 +1,101 @@
+#include "dataflow.hpp"
+
+using namespace mitscript::CFG;
+
+namespace mitscript::analysis {
+
+void BitSet::clear() {
+    std::fill(words_.begin(), words_.end(), 0);
+}
+
+bool BitSet::any() const {
+    uint64_t acc = 0;
+    for (uint64_t w : words_) acc |= w;
+    return acc != 0;
+}
+
+size_t BitSet::count() const {
+    size_t c = 0;
+    for (uint64_t w : words_) c += static_cast<size_t>(__builtin_popcountll(w));
+    return c;
+}
+
+bool BitSet::union_with(const BitSet& o) {
+    uint64_t changed = 0;
+    for (size_t i = 0; i < words_.size(); ++i) {
+        uint64_t w = words_[i] | o.words_[i];
+        changed |= w ^ words_[i];
+        words_[i] = w;
+    }
+    return changed != 0;
+}
+
+bool BitSet::intersect_with(const BitSet& o) {
+    uint64_t changed = 0;
+    for (size_t i = 0; i < words_.size(); ++i) {
+        uint64_t w = words_[i] & o.words_[i];
+        changed |= w ^ words_[i];
+        words_[i] = w;
+    }
+    return changed != 0;
+}
+
+void BitSet::subtract(const BitSet& o) {
+    for (size_t i = 0; i < words_.size(); ++i) words_[i] &= ~o.words_[i];
+}
+
+std::vector<BlockId> block_order(const FunctionCFG& fn) {
+    const BlockId n = static_cast<BlockId>(fn.blocks.size());
+    auto valid = [&](BlockId b) { return b >= 0 && b < n && fn.blocks[b]; };
+
+    std::vector<BlockId> order;
+    order.reserve(fn.blocks.size());
+    std::vector<char> seen(fn.blocks.size(), 0);
+
+    // Iterative DFS; a block is emitted once all its successors are done.
+    if (valid(fn.entry)) {
+        std::vector<std::pair<BlockId, size_t>> stack{{fn.entry, 0}};
+        seen[fn.entry] = 1;
+        while (!stack.empty()) {
+            auto& [b, next] = stack.back();
+            const auto& succs = fn.blocks[b]->successors;
+            if (next < succs.size()) {
+                BlockId s = succs[next++];
+                if (valid(s) && !seen[s]) {
+                    seen[s] = 1;
+                    stack.push_back({s, 0});
+                }
+                continue;
+            }
+            order.push_back(b);
+            stack.pop_back();
+        }
+        std::reverse(order.begin(), order.end());
+    }
+
+    for (BlockId b = 0; b < n; ++b)
+        if (valid(b) && !seen[b]) order.push_back(b);
+    return order;
+}
+
+BlockWorklist::BlockWorklist(const std::vector<BlockId>& order, size_t block_count)
+    : order_(order), position_(block_count, -1), queued_(block_count) {
+    for (size_t i = 0; i < order.size(); ++i) position_[order[i]] = static_cast<int>(i);
+}
+
+void BlockWorklist::push(BlockId b) {
+    if (b < 0 || static_cast<size_t>(b) >= position_.size() || position_[b] < 0 ||
+        queued_.test(b))
+        return;
+    queued_.set(b);
+    heap_.push(position_[b]);
+}
+
+BlockId BlockWorklist::pop() {
+    BlockId b = order_[heap_.top()];
+    heap_.pop();
+    queued_.reset(b);
+    return b;
+}
+
+} // namespace mitscript::analysis
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "cfg.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+namespace mitscript::analysis {
+
+// Fixed-size set of small integers, one bit each, packed into 64-bit words.
+// The set operations are plain loops over the words, which the compiler
+// vectorizes.
+class BitSet {
+public:
+    BitSet() = default;
+    explicit BitSet(size_t bits) : bits_(bits), words_((bits + 63) / 64, 0) {}
+
+    size_t size() const { return bits_; }
+
+    bool test(size_t i) const { return i < bits_ && (words_[i >> 6] >> (i & 63)) & 1; }
+    bool operator[](size_t i) const { return test(i); }
+    void set(size_t i) {
+        if (i < bits_) words_[i >> 6] |= uint64_t{1} << (i & 63);
+    }
+    void reset(size_t i) {
+        if (i < bits_) words_[i >> 6] &= ~(uint64_t{1} << (i & 63));
+    }
+    void clear();
+
+    bool any() const;
+    size_t count() const;
+
+    // The set operations require both sets to have the same size. The
+    // first two return whether this set changed.
+    bool union_with(const BitSet& o);
+    bool intersect_with(const BitSet& o);
+    void subtract(const BitSet& o);
+
+    bool operator==(const BitSet& o) const { return bits_ == o.bits_ && words_ == o.words_; }
+    bool operator!=(const BitSet& o) const { return !(*this == o); }
+
+    // Calls f(i) for every member, in increasing order.
+    template <class F>
+    void for_each(F f) const {
+        for (size_t w = 0; w < words_.size(); ++w) {
+            for (uint64_t bits = words_[w]; bits; bits &= bits - 1)
+                f(w * 64 + static_cast<size_t>(__builtin_ctzll(bits)));
+        }
+    }
+
+private:
+    size_t bits_ = 0;
+    std::vector<uint64_t> words_;
+};
+
+// The blocks reachable from the entry in reverse postorder, followed by the
+// remaining blocks in index order.
+std::vector<mitscript::CFG::BlockId> block_order(const mitscript::CFG::FunctionCFG& fn);
+
+// Blocks waiting to be visited. pop() returns the waiting block that comes
+// first in `order`, and a block waits at most once.
+class BlockWorklist {
+public:
+    BlockWorklist(const std::vector<mitscript::CFG::BlockId>& order, size_t block_count);
+
+    void push(mitscript::CFG::BlockId b);
+    bool empty() const { return heap_.empty(); }
+    mitscript::CFG::BlockId pop();
+
+private:
+    const std::vector<mitscript::CFG::BlockId>& order_;
+    std::vector<int> position_;
+    BitSet queued_;
+    std::priority_queue<int, std::vector<int>, std::greater<int>> heap_;
+};
+
+enum class Direction { Forward, Backward };
+
+// The facts at the start and end of every block.
+template <class Value>
+struct DataflowResult {
+    std::vector<Value> before;
+    std::vector<Value> after;
+};
+
+// Solves a dataflow problem over fn's blocks with a worklist, visiting
+// blocks in reverse postorder for forward problems and in postorder for
+// backward ones, so that most blocks see their inputs settled first.
+//
+// A Problem provides:
+//   using Value = ...;
+//   Value initial();                          // the facts before anything flows
+//   Value boundary();                         // at the entry (forward) or at
+//                                             // the blocks without successors
+//                                             // (backward)
+//   bool join(Value& into, const Value& v);   // merges v in; true if into changed
+//   Value transfer(BlockId b, const Value& v);// across b, in the problem's direction
+//
+// A forward problem only visits blocks reachable from the entry; the rest
+// keep initial(). A backward problem visits every block.
+template <class Problem>
+DataflowResult<typename Problem::Value> solve_dataflow(const mitscript::CFG::FunctionCFG& fn,
+                                                      Problem& problem, Direction dir) {
+    using mitscript::CFG::BlockId;
+    using Value = typename Problem::Value;
+
+    const size_t n = fn.blocks.size();
+    DataflowResult<Value> res;
+    res.before.assign(n, problem.initial());
+    res.after.assign(n, problem.initial());
+    if (n == 0) return res;
+
+    const bool forward = dir == Direction::Forward;
+    std::vector<BlockId> order = block_order(fn);
+    if (!forward) std::reverse(order.begin(), order.end());
+    BlockWorklist work(order, n);
+
+    auto valid = [&](BlockId b) { return b >= 0 && b < static_cast<BlockId>(n) && fn.blocks[b]; };
+
+    // in: the side facts flow into; out: the side transfer() produces.
+    auto& in = forward ? res.before : res.after;
+    auto& out = forward ? res.after : res.before;
+
+    // Edges in the direction facts flow, from the successor lists alone.
+    std::vector<std::vector<BlockId>> next(n);
+    for (BlockId b : order) {
+        if (!valid(b)) continue;
+        for (BlockId s : fn.blocks[b]->successors) {
+            if (!valid(s)) continue;
+            if (forward)
+                next[b].push_back(s);
+            else
+                next[s].push_back(b);
+        }
+    }
+
+    if (forward) {
+        if (!valid(fn.entry)) return res;
+        in[fn.entry] = problem.boundary();
+        work.push(fn.entry);
+    } else {
+        for (BlockId b : order) {
+            if (!valid(b)) continue;
+            bool has_succ = std::any_of(fn.blocks[b]->successors.begin(),
+                                        fn.blocks[b]->successors.end(), valid);
+            if (!has_succ) in[b] = problem.boundary();
+            work.push(b);
+        }
+    }
+
+    std::vector<char> visited(n, 0);
+    while (!work.empty()) {
+        BlockId b = work.pop();
+        out[b] = problem.transfer(b, in[b]);
+        visited[b] = 1;
+        for (BlockId s : next[b]) {
+            if (problem.join(in[s], out[b]) || !visited[s]) work.push(s);
+        }
+    }
+    return res;
+}
+
+} // namespace mitscript::analysis
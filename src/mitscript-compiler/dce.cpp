@@ -1,14 +1,16 @@
 #include "dce.hpp"
+#include "type_inference.hpp"
 
 #include <algorithm>
 #include <queue>
+#include <unordered_map>
 
 using namespace mitscript::CFG;
 
 namespace mitscript::analysis {
 
 LiveSet::LiveSet(size_t vreg_count, size_t local_count)
-    : vregs(vreg_count, 0), locals(local_count, 0) {}
+    : vregs(vreg_count), locals(local_count) {}
 
 bool LiveSet::operator==(const LiveSet& other) const {
     return vregs == other.vregs && locals == other.locals;
@@ -53,32 +55,13 @@ size_t count_locals(const FunctionCFG& fn) {
     return fn.params.size() + fn.locals.size();
 }
 
-LiveSet unite(const LiveSet& a, const LiveSet& b) {
-    LiveSet out(a.vregs.size(), a.locals.size());
-    for (size_t i = 0; i < a.vregs.size(); ++i) {
-        out.vregs[i] = static_cast<char>(a.vregs[i] || b.vregs[i]);
-    }
-    for (size_t i = 0; i < a.locals.size(); ++i) {
-        out.locals[i] = static_cast<char>(a.locals[i] || b.locals[i]);
-    }
-    return out;
-}
-
-void add_use_vreg(LiveSet& live, size_t idx) {
-    if (idx < live.vregs.size()) live.vregs[idx] = 1;
-}
+void add_use_vreg(LiveSet& live, size_t idx) { live.vregs.set(idx); }
 
-void add_use_local(LiveSet& live, size_t idx) {
-    if (idx < live.locals.size()) live.locals[idx] = 1;
-}
+void add_use_local(LiveSet& live, size_t idx) { live.locals.set(idx); }
 
-void kill_def_vreg(LiveSet& live, size_t idx) {
-    if (idx < live.vregs.size()) live.vregs[idx] = 0;
-}
+void kill_def_vreg(LiveSet& live, size_t idx) { live.vregs.reset(idx); }
 
-void kill_def_local(LiveSet& live, size_t idx) {
-    if (idx < live.locals.size()) live.locals[idx] = 0;
-}
+void kill_def_local(LiveSet& live, size_t idx) { live.locals.reset(idx); }
 
 DefUse analyze_instr(const IRInstr& ir) {
     DefUse du;
@@ -114,25 +97,69 @@ DefUse analyze_instr(const IRInstr& ir) {
     return du;
 }
 
-bool instr_has_side_effects(const IRInstr& ins) {
+// Ints bound to vregs by LoadConst, for spotting constant divisors.
+std::unordered_map<int, int> constant_ints(const FunctionCFG& fn) {
+    std::unordered_map<int, int> out;
+    for (const auto& blk_ptr : fn.blocks) {
+        if (!blk_ptr) continue;
+        for (const auto& ir : blk_ptr->code) {
+            if (ir.op == IROp::LoadConst && ir.output && ir.output->kind == IROperand::VREG &&
+                !ir.inputs.empty() && ir.inputs[0].kind == IROperand::CONSTI) {
+                out[ir.output->i] = ir.inputs[0].i;
+            }
+        }
+    }
+    return out;
+}
+
+// True unless every VREG input of `ins` is known to be of kind `a` or `b`.
+bool operands_unproven(const IRInstr& ins, const TypeInferenceResult& types,
+                       TypeKind a, TypeKind b = TypeKind::Bottom) {
+    for (const auto& in : ins.inputs) {
+        if (in.kind != IROperand::VREG) continue;
+        TypeKind t = get_vreg_type(types, in.i);
+        if (t != a && t != b) return true;
+    }
+    return false;
+}
+
+// Whether `ins` must stay even when what it defines is dead. Operators that
+// check their operand types (or divide) can throw, so they only go when
+// type inference proves they cannot; field and index loads throw on
+// non-records and are always kept.
+bool instr_has_side_effects(const IRInstr& ins, const TypeInferenceResult& types,
+                            const std::unordered_map<int, int>& const_ints) {
     switch (ins.op) {
         case IROp::Add:
         case IROp::Sub:
         case IROp::Mul:
-        case IROp::Div:
-        case IROp::CmpEq:
         case IROp::CmpLt:
         case IROp::CmpGt:
         case IROp::CmpLe:
         case IROp::CmpGe:
         case IROp::Neg:
+            return operands_unproven(ins, types, TypeKind::Int);
+
+        case IROp::CmpEq:
+            return operands_unproven(ins, types, TypeKind::Int, TypeKind::Bool);
+
         case IROp::Not:
         case IROp::And:
         case IROp::Or:
+            return operands_unproven(ins, types, TypeKind::Bool);
+
+        case IROp::Div: {
+            if (operands_unproven(ins, types, TypeKind::Int)) return true;
+            if (ins.inputs.size() < 2) return true;
+            const auto& divisor = ins.inputs[1];
+            if (divisor.kind == IROperand::CONSTI) return divisor.i == 0;
+            if (divisor.kind != IROperand::VREG) return true;
+            auto it = const_ints.find(divisor.i);
+            return it == const_ints.end() || it->second == 0;
+        }
+
         case IROp::LoadConst:
         case IROp::LoadLocal:
-        case IROp::LoadField:
-        case IROp::LoadIndex:
             return false;
 
         case IROp::StoreLocal:
@@ -221,75 +248,115 @@ void eliminate_unreachable_blocks(FunctionCFG& fn) {
     }
 }
 
+namespace {
+
+// Backward liveness: a block's transfer runs its terminator and then its
+// instructions in reverse over the set live at its end.
+struct LivenessProblem {
+    using Value = LiveSet;
+
+    const FunctionCFG& fn;
+    size_t num_vregs;
+    size_t num_locals;
+    // Locals captured by closures; stores to these must be kept live.
+    std::vector<char> captured;
+
+    LiveSet initial() const { return LiveSet(num_vregs, num_locals); }
+    LiveSet boundary() const { return initial(); }
+
+    bool join(LiveSet& into, const LiveSet& v) const {
+        bool changed = into.vregs.union_with(v.vregs);
+        changed |= into.locals.union_with(v.locals);
+        return changed;
+    }
+
+    LiveSet transfer(BlockId b, const LiveSet& out) const {
+        const auto& blk = *fn.blocks[b];
+        LiveSet live = out;
+        add_terminator_uses(blk, live);
+
+        for (auto it = blk.code.rbegin(); it != blk.code.rend(); ++it) {
+            const auto du = analyze_instr(*it);
+            bool rhs_needed = true;
+
+            if (du.def_vreg >= 0) kill_def_vreg(live, static_cast<size_t>(du.def_vreg));
+            if (du.def_local >= 0) {
+                kill_def_local(live, static_cast<size_t>(du.def_local));
+                // If the local isn't live and isn't captured, the store's RHS
+                // does not need to stay live.
+                if (du.def_local < static_cast<int>(live.locals.size()) &&
+                    !live.locals[du.def_local] &&
+                    (du.def_local >= static_cast<int>(captured.size()) || !captured[du.def_local])) {
+                    rhs_needed = false;
+                }
+            }
+            if (rhs_needed) {
+                for (auto v : du.use_vregs) add_use_vreg(live, static_cast<size_t>(v));
+                for (auto l : du.use_locals) add_use_local(live, static_cast<size_t>(l));
+            }
+        }
+        return live;
+    }
+};
+
+} // namespace
+
 LivenessResult compute_liveness(FunctionCFG& fn) {
     LivenessResult result;
     result.num_vregs = count_vregs(fn);
     result.num_locals = count_locals(fn);
 
-    // Track locals captured by closures; stores to these must be kept live.
-    std::vector<char> captured(result.num_locals, 0);
+    LivenessProblem problem{fn, result.num_vregs, result.num_locals,
+                            std::vector<char>(result.num_locals, 0)};
     for (const auto& name : fn.byRefLocals) {
         for (size_t i = 0; i < fn.params.size(); ++i) {
-            if (fn.params[i] == name) captured[i] = 1;
+            if (fn.params[i] == name) problem.captured[i] = 1;
         }
         for (size_t i = 0; i < fn.locals.size(); ++i) {
-            if (fn.locals[i] == name) captured[fn.params.size() + i] = 1;
+            if (fn.locals[i] == name) problem.captured[fn.params.size() + i] = 1;
         }
     }
 
-    result.live_in.assign(fn.blocks.size(), LiveSet(result.num_vregs, result.num_locals));
-    result.live_out.assign(fn.blocks.size(), LiveSet(result.num_vregs, result.num_locals));
-
-    bool changed = true;
-    while (changed) {
-        changed = false;
-        for (int b = static_cast<int>(fn.blocks.size()) - 1; b >= 0; --b) {
-            if (b < 0 || !fn.blocks[b]) continue;
-            const auto& blk = *fn.blocks[b];
-
-            LiveSet new_out(result.num_vregs, result.num_locals);
-            for (auto succ : blk.successors) {
-                if (succ < 0 || succ >= (BlockId)fn.blocks.size()) continue;
-                if (!fn.blocks[succ]) continue;
-                new_out = unite(new_out, result.live_in[succ]);
-            }
+    auto solved = solve_dataflow(fn, problem, Direction::Backward);
+    result.live_in = std::move(solved.before);
+    result.live_out = std::move(solved.after);
+    return result;
+}
 
-            LiveSet live = new_out;
-            add_terminator_uses(blk, live);
-
-            for (auto it = blk.code.rbegin(); it != blk.code.rend(); ++it) {
-                const auto du = analyze_instr(*it);
-                bool rhs_needed = true;
-
-                if (du.def_vreg >= 0) kill_def_vreg(live, static_cast<size_t>(du.def_vreg));
-                if (du.def_local >= 0) {
-                    kill_def_local(live, static_cast<size_t>(du.def_local));
-                    // If the local isn't live and isn't captured, the store's RHS
-                    // does not need to stay live.
-                    if (du.def_local < static_cast<int>(live.locals.size()) &&
-                        !live.locals[du.def_local] &&
-                        (du.def_local >= static_cast<int>(captured.size()) || !captured[du.def_local])) {
-                        rhs_needed = false;
-                    }
-                }
-                if (rhs_needed) {
-                    for (auto v : du.use_vregs) add_use_vreg(live, static_cast<size_t>(v));
-                    for (auto l : du.use_locals) add_use_local(live, static_cast<size_t>(l));
-                }
-            }
+void eliminate_dead_instructions(FunctionCFG& fn, const LivenessResult& liveness,
+                                 bool is_toplevel) {
+    const TypeInferenceResult types = run_type_inference(fn, is_toplevel);
+    const auto const_ints = constant_ints(fn);
 
-            if (live != result.live_in[b] || new_out != result.live_out[b]) {
-                result.live_in[b] = std::move(live);
-                result.live_out[b] = std::move(new_out);
-                changed = true;
+    // Whether each vreg's value can be computed without throwing (its
+    // definition and everything feeding it), and how many readers it has,
+    // so a dead store can tell whether its value disappears with it.
+    std::unordered_map<int, int> readers;
+    std::vector<const IRInstr*> defs;
+    for (const auto& blk_ptr : fn.blocks) {
+        if (!blk_ptr) continue;
+        for (const auto& ir : blk_ptr->code) {
+            if (ir.output && ir.output->kind == IROperand::VREG) defs.push_back(&ir);
+            for (const auto& in : ir.inputs) {
+                if (in.kind == IROperand::VREG) ++readers[in.i];
             }
         }
     }
+    std::unordered_map<int, bool> pure_def;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (const IRInstr* ir : defs) {
+            bool& pure = pure_def[ir->output->i];
+            if (pure || instr_has_side_effects(*ir, types, const_ints)) continue;
+            pure = std::all_of(ir->inputs.begin(), ir->inputs.end(), [&](const IROperand& in) {
+                if (in.kind != IROperand::VREG) return true;
+                auto it = pure_def.find(in.i);
+                return it != pure_def.end() && it->second;
+            });
+            changed |= pure;
+        }
+    }
 
-    return result;
-}
-
-void eliminate_dead_instructions(FunctionCFG& fn, const LivenessResult& liveness) {
     const size_t total_slots = fn.params.size() + fn.locals.size();
     std::vector<char> captured(total_slots, 0);
     for (const auto& name : fn.byRefLocals) {
@@ -343,7 +410,18 @@ void eliminate_dead_instructions(FunctionCFG& fn, const LivenessResult& liveness
                 }
             }
 
-            if (has_dead_def && !instr_has_side_effects(ir)) {
+            if (has_dead_def && !instr_has_side_effects(ir, types, const_ints)) {
+                // A dead store whose value has to be computed anyway (it may
+                // throw) becomes a Pop, which keeps the operand stack
+                // balanced and the value's computation live.
+                if (ir.op == IROp::StoreLocal && !du.use_vregs.empty()) {
+                    const int v = du.use_vregs[0];
+                    auto p = pure_def.find(v);
+                    if (readers[v] != 1 || p == pure_def.end() || !p->second) {
+                        add_use_vreg(live, static_cast<size_t>(v));
+                        kept.push_back(IRInstr{IROp::Pop, {}, std::nullopt});
+                    }
+                }
                 continue; // Remove this dead instruction.
             }
 
@@ -361,14 +439,15 @@ void eliminate_dead_instructions(FunctionCFG& fn, const LivenessResult& liveness
     }
 }
 
-void run_dce_on_function(FunctionCFG& fn) {
+void run_dce_on_function(FunctionCFG& fn, bool is_toplevel, bool recursive) {
     eliminate_unreachable_blocks(fn);
     auto liveness = compute_liveness(fn);
-    eliminate_dead_instructions(fn, liveness);
+    eliminate_dead_instructions(fn, liveness, is_toplevel);
+    if (!recursive) return;
 
     // Apply recursively to nested functions.
     for (auto& child : fn.children) {
-        if (child) run_dce_on_function(*child);
+        if (child) run_dce_on_function(*child, /*is_toplevel=*/false);
     }
 }
 
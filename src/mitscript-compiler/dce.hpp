@@ -1,14 +1,15 @@
 #pragma once
 
 #include "cfg.hpp"
+#include "dataflow.hpp"
 #include <vector>
 
 namespace mitscript::analysis {
 
 // Simple liveness set that tracks virtual registers and locals separately.
 struct LiveSet {
-    std::vector<char> vregs;
-    std::vector<char> locals;
+    BitSet vregs;
+    BitSet locals;
 
     LiveSet() = default;
     LiveSet(size_t vreg_count, size_t local_count);
@@ -27,14 +28,19 @@ struct LivenessResult {
 // Removes CFG blocks unreachable from the entry.
 void eliminate_unreachable_blocks(mitscript::CFG::FunctionCFG& fn);
 
-// Fixed-point liveness computation across the CFG.
+// Liveness of vregs and locals at every block boundary, solved backward
+// with the dataflow framework (see dataflow.hpp).
 LivenessResult compute_liveness(mitscript::CFG::FunctionCFG& fn);
 
-// Deletes dead, side-effect-free instructions using the provided liveness info.
+// Deletes dead instructions using the provided liveness info. Operators
+// that may throw are kept unless type inference (see type_inference.hpp)
+// proves their operands safe; `is_toplevel` is passed through to it.
 void eliminate_dead_instructions(mitscript::CFG::FunctionCFG& fn,
-                                 const LivenessResult& liveness);
+                                 const LivenessResult& liveness, bool is_toplevel);
 
-// Runs the full DCE pipeline (reachability + liveness + per-instruction DCE).
-void run_dce_on_function(mitscript::CFG::FunctionCFG& fn);
+// Runs the full DCE pipeline (reachability + liveness + per-instruction DCE),
+// and unless `recursive` is false, on nested functions too.
+void run_dce_on_function(mitscript::CFG::FunctionCFG& fn, bool is_toplevel,
+                         bool recursive = true);
 
 } // namespace mitscript::analysis
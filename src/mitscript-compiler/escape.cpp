@@ -0,0 +1,395 @@
+#include "escape.hpp"
+
+#include "ssa.hpp"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace mitscript::CFG;
+
+namespace mitscript::analysis {
+
+namespace {
+
+// Where a vreg is consumed: input `pos` of code[index], or the value a Dup
+// copies or a Pop drops (pos -1), or the block's terminator (pos -2).
+struct Use {
+    BlockId block;
+    size_t index;
+    int pos;
+};
+
+struct Site {
+    BlockId block;
+    size_t index;
+};
+
+using Fields = std::map<std::string, int>;
+
+class ScalarReplacer {
+public:
+    ScalarReplacer(FunctionCFG& fn, bool is_toplevel)
+        : fn_(fn), private_(private_locals(fn, is_toplevel)), dom_(compute_dominators(fn)) {}
+
+    void run() {
+        if (!simulate_stacks()) return;
+        find_candidates();
+        if (makes_.empty()) return;
+        rewrite();
+    }
+
+private:
+    // Follows each block's operand stack to find what its Dups and Pops
+    // operate on. False if some block's stack use does not add up.
+    bool simulate_stacks() {
+        top_.assign(fn_.blocks.size(), {});
+        for (size_t b = 0; b < fn_.blocks.size(); ++b) {
+            if (!fn_.blocks[b]) continue;
+            const BasicBlock& blk = *fn_.blocks[b];
+            const BlockId id = static_cast<BlockId>(b);
+            std::vector<VReg> stack;
+            top_[b].assign(blk.code.size(), -1);
+            for (size_t k = 0; k < blk.code.size(); ++k) {
+                const IRInstr& ir = blk.code[k];
+                if (ir.op == IROp::Dup || ir.op == IROp::Pop) {
+                    if (stack.empty()) return false;
+                    top_[b][k] = stack.back();
+                    uses_[stack.back()].push_back({id, k, -1});
+                    if (ir.op == IROp::Dup) stack.push_back(stack.back());
+                    else stack.pop_back();
+                    continue;
+                }
+                std::vector<VReg> operands;
+                for (size_t i = 0; i < ir.inputs.size(); ++i) {
+                    if (ir.inputs[i].kind != IROperand::VREG) continue;
+                    operands.push_back(ir.inputs[i].i);
+                    uses_[ir.inputs[i].i].push_back({id, k, static_cast<int>(i)});
+                }
+                if (stack.size() < operands.size() ||
+                    !std::equal(operands.begin(), operands.end(), stack.end() - operands.size()))
+                    return false;
+                stack.resize(stack.size() - operands.size());
+                if (ir.output) {
+                    if (ir.output->kind != IROperand::VREG) return false;
+                    VReg v = ir.output->i;
+                    stack.push_back(v);
+                    next_vreg_ = std::max(next_vreg_, v + 1);
+                    if (ir.op == IROp::MakeRecord) {
+                        makes_[v] = {id, k};
+                        stack_at_make_[v] = stack;
+                    } else if (ir.op == IROp::LoadLocal && !ir.inputs.empty() &&
+                               ir.inputs[0].kind == IROperand::LOCAL) {
+                        loads_[v] = ir.inputs[0].i;
+                    }
+                }
+            }
+            if (blk.term.kind != Terminator::Kind::Jump && blk.term.condition >= 0) {
+                uses_[blk.term.condition].push_back({id, blk.code.size(), -2});
+                next_vreg_ = std::max(next_vreg_, blk.term.condition + 1);
+            }
+        }
+        return true;
+    }
+
+    const IRInstr& instr(const Use& u) const { return fn_.blocks[u.block]->code[u.index]; }
+
+    bool is_field_access(const Use& u) const {
+        if (u.pos != 0) return false;
+        const IRInstr& ir = instr(u);
+        if (ir.op == IROp::LoadField) return ir.inputs.size() == 2 && ir.inputs[1].kind == IROperand::NAME;
+        if (ir.op == IROp::StoreField) return ir.inputs.size() == 3 && ir.inputs[1].kind == IROperand::NAME;
+        return false;
+    }
+
+    // The slot a record literal is assigned to, -1 if none, -2 if it is
+    // assigned more than once.
+    int assigned_slot(VReg v) const {
+        int slot = -1;
+        for (const Use& u : uses_.at(v)) {
+            if (u.pos != 1 || instr(u).op != IROp::StoreLocal || instr(u).inputs[0].kind != IROperand::LOCAL)
+                continue;
+            if (slot != -1) return -2;
+            slot = instr(u).inputs[0].i;
+        }
+        return slot;
+    }
+
+    // Whether record value v only has uses that scalar replacement removes.
+    bool contained(VReg v) const {
+        auto it = uses_.find(v);
+        if (it == uses_.end()) return true;
+        bool is_make = makes_.count(v) > 0;
+        for (const Use& u : it->second) {
+            if (u.pos == -1 || is_field_access(u)) continue;
+            if (is_make && u.pos == 1 && instr(u).op == IROp::StoreLocal &&
+                instr(u).inputs[0].kind == IROperand::LOCAL && candidate_[instr(u).inputs[0].i] &&
+                u.block == makes_.at(v).block)
+                continue;
+            return false;
+        }
+        return true;
+    }
+
+    // Whether every read of each candidate slot follows a store to it on
+    // every path. Clears the slots where it does not.
+    bool check_assigned_before_read() {
+        const size_t n = candidate_.size();
+        std::vector<std::vector<char>> out(fn_.blocks.size(), std::vector<char>(n, 1));
+        auto in_of = [&](BlockId b) {
+            std::vector<char> in(n, b == fn_.entry ? 0 : 1);
+            if (b == fn_.entry) return in;
+            for (BlockId p : fn_.blocks[b]->predecessors) {
+                if (p < 0 || p >= static_cast<BlockId>(dom_.reachable.size()) || !dom_.reachable[p]) continue;
+                for (size_t s = 0; s < n; ++s) in[s] = in[s] && out[p][s];
+            }
+            return in;
+        };
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (BlockId b : dom_.rpo) {
+                auto cur = in_of(b);
+                for (const auto& ir : fn_.blocks[b]->code) {
+                    if (ir.op == IROp::StoreLocal && ir.inputs[0].kind == IROperand::LOCAL &&
+                        ir.inputs[0].i < static_cast<int>(n))
+                        cur[ir.inputs[0].i] = 1;
+                }
+                if (cur != out[b]) {
+                    out[b] = std::move(cur);
+                    changed = true;
+                }
+            }
+        }
+        bool cleared = false;
+        for (BlockId b : dom_.rpo) {
+            auto cur = in_of(b);
+            for (const auto& ir : fn_.blocks[b]->code) {
+                if (ir.inputs.empty() || ir.inputs[0].kind != IROperand::LOCAL) continue;
+                int s = ir.inputs[0].i;
+                if (s < 0 || s >= static_cast<int>(n)) continue;
+                if (ir.op == IROp::StoreLocal) cur[s] = 1;
+                else if (ir.op == IROp::LoadLocal && candidate_[s] && !cur[s]) {
+                    candidate_[s] = 0;
+                    cleared = true;
+                }
+            }
+        }
+        return !cleared;
+    }
+
+    void find_candidates() {
+        const size_t n = private_.size();
+        candidate_.assign(n, 0);
+        for (size_t s = fn_.params.size(); s < n; ++s) candidate_[s] = private_[s];
+        // A candidate slot only ever holds record literals.
+        std::vector<char> stored(n, 0);
+        for (const auto& blk : fn_.blocks) {
+            if (!blk) continue;
+            for (const auto& ir : blk->code) {
+                if (ir.op != IROp::StoreLocal || ir.inputs.size() < 2 ||
+                    ir.inputs[0].kind != IROperand::LOCAL)
+                    continue;
+                int s = ir.inputs[0].i;
+                if (s < 0 || s >= static_cast<int>(n)) continue;
+                stored[s] = 1;
+                if (ir.inputs[1].kind != IROperand::VREG || !makes_.count(ir.inputs[1].i) ||
+                    assigned_slot(ir.inputs[1].i) != s)
+                    candidate_[s] = 0;
+            }
+        }
+        for (size_t s = 0; s < n; ++s) candidate_[s] = candidate_[s] && stored[s];
+
+        do {
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (const auto& [u, s] : loads_) {
+                    if (s >= 0 && s < static_cast<int>(n) && candidate_[s] && !contained(u)) {
+                        candidate_[s] = 0;
+                        changed = true;
+                    }
+                }
+                for (const auto& [v, site] : makes_) {
+                    int s = assigned_slot(v);
+                    if (s >= 0 && candidate_[s] && !contained(v)) {
+                        candidate_[s] = 0;
+                        changed = true;
+                    }
+                }
+            }
+        } while (!check_assigned_before_read());
+
+        for (auto it = makes_.begin(); it != makes_.end();) {
+            int s = assigned_slot(it->first);
+            bool keep = s >= 0 ? candidate_[s] != 0 : s == -1 && contained(it->first);
+            it = keep ? std::next(it) : makes_.erase(it);
+        }
+    }
+
+    int new_local(const std::string& name) {
+        fn_.locals.push_back(name);
+        return static_cast<int>(fn_.params.size() + fn_.locals.size()) - 1;
+    }
+
+    void add_fields(Fields& fields, VReg v, const std::string& prefix) {
+        auto it = uses_.find(v);
+        if (it == uses_.end()) return;
+        for (const Use& u : it->second) {
+            if (!is_field_access(u)) continue;
+            const std::string& f = instr(u).inputs[1].s.str();
+            if (!fields.count(f)) fields[f] = new_local(prefix + f);
+        }
+    }
+
+    // Whether a literal assigned to slot s can be built in the slot's own
+    // field locals: the slot's current record is not read while the
+    // literal is being filled in.
+    bool builds_in_place(VReg v, int s) const {
+        const Site& make = makes_.at(v);
+        for (VReg x : stack_at_make_.at(v)) {
+            auto it = loads_.find(x);
+            if (it != loads_.end() && it->second == s) return false;
+        }
+        const auto& code = fn_.blocks[make.block]->code;
+        for (size_t k = make.index + 1; k < code.size(); ++k) {
+            const IRInstr& ir = code[k];
+            if (ir.op == IROp::StoreLocal && ir.inputs[1].kind == IROperand::VREG && ir.inputs[1].i == v)
+                return true;
+            if (ir.op == IROp::LoadLocal && ir.inputs[0].kind == IROperand::LOCAL && ir.inputs[0].i == s)
+                return false;
+        }
+        return false;
+    }
+
+    // The fields a literal stores before anything reads one of its fields,
+    // which need no None first.
+    std::set<std::string> literal_fields(VReg v) const {
+        std::set<std::string> filled;
+        for (const Use& u : uses_.at(v)) {
+            if (!is_field_access(u)) continue;
+            if (instr(u).op == IROp::LoadField) break;
+            filled.insert(instr(u).inputs[1].s.str());
+        }
+        return filled;
+    }
+
+    void rewrite() {
+        int group = 0;
+        std::unordered_map<int, Fields> slot_fields;
+        for (const auto& [u, s] : loads_) {
+            if (!candidate_[s]) continue;
+            auto& fields = slot_fields[s];
+            add_fields(fields, u, "$sra" + std::to_string(s) + "_");
+        }
+        for (const auto& [v, site] : makes_) {
+            int s = assigned_slot(v);
+            if (s >= 0) add_fields(slot_fields[s], v, "$sra" + std::to_string(s) + "_");
+        }
+
+        // The field locals each record value reads and writes.
+        std::unordered_map<VReg, const Fields*> fields_of;
+        std::unordered_map<VReg, Fields> own;
+        std::unordered_map<VReg, int> copied_to; // literals built apart from their slot
+        for (const auto& [v, site] : makes_) {
+            int s = assigned_slot(v);
+            if (s >= 0 && builds_in_place(v, s)) {
+                fields_of[v] = &slot_fields[s];
+                continue;
+            }
+            std::string prefix = "$sra_r" + std::to_string(group++) + "_";
+            Fields& fields = own[v];
+            if (s >= 0) {
+                for (const auto& [f, slot] : slot_fields[s]) fields[f] = new_local(prefix + f);
+                copied_to[v] = s;
+            } else {
+                add_fields(fields, v, prefix);
+            }
+            fields_of[v] = &fields;
+        }
+        for (const auto& [u, s] : loads_) {
+            if (candidate_[s]) fields_of[u] = &slot_fields[s];
+        }
+
+        auto vreg = [&]() { return IROperand{IROperand::VREG, next_vreg_++}; };
+        for (size_t b = 0; b < fn_.blocks.size(); ++b) {
+            if (!fn_.blocks[b]) continue;
+            auto& code = fn_.blocks[b]->code;
+            std::vector<IRInstr> out;
+            out.reserve(code.size());
+            for (size_t k = 0; k < code.size(); ++k) {
+                IRInstr& ir = code[k];
+                if (ir.op == IROp::Dup || ir.op == IROp::Pop) {
+                    if (!fields_of.count(top_[b][k])) out.push_back(std::move(ir));
+                    continue;
+                }
+                const Fields* rec = nullptr;
+                if (ir.output && fields_of.count(ir.output->i)) rec = fields_of.at(ir.output->i);
+                if (ir.op == IROp::MakeRecord && rec) {
+                    auto filled = literal_fields(ir.output->i);
+                    for (const auto& [f, slot] : *rec) {
+                        if (filled.count(f)) continue;
+                        IROperand none = vreg();
+                        out.push_back(IRInstr{IROp::LoadConst, {IROperand{}}, none});
+                        out.push_back(IRInstr{IROp::StoreLocal, {IROperand{IROperand::LOCAL, slot}, none},
+                                              std::nullopt});
+                    }
+                    continue;
+                }
+                if (ir.op == IROp::LoadLocal && rec) continue;
+                if (ir.op == IROp::StoreLocal && ir.inputs.size() == 2 && ir.inputs[1].kind == IROperand::VREG &&
+                    fields_of.count(ir.inputs[1].i)) {
+                    VReg v = ir.inputs[1].i;
+                    auto it = copied_to.find(v);
+                    if (it == copied_to.end()) continue; // built in place
+                    for (const auto& [f, slot] : slot_fields[it->second]) {
+                        IROperand t = vreg();
+                        out.push_back(IRInstr{IROp::LoadLocal, {IROperand{IROperand::LOCAL, own[v][f]}}, t});
+                        out.push_back(IRInstr{IROp::StoreLocal, {IROperand{IROperand::LOCAL, slot}, t},
+                                              std::nullopt});
+                    }
+                    continue;
+                }
+                if ((ir.op == IROp::LoadField || ir.op == IROp::StoreField) && !ir.inputs.empty() &&
+                    ir.inputs[0].kind == IROperand::VREG && fields_of.count(ir.inputs[0].i)) {
+                    int slot = fields_of.at(ir.inputs[0].i)->at(ir.inputs[1].s.str());
+                    IROperand local{IROperand::LOCAL, slot};
+                    if (ir.op == IROp::LoadField) {
+                        out.push_back(IRInstr{IROp::LoadLocal, {local}, ir.output});
+                    } else {
+                        out.push_back(IRInstr{IROp::StoreLocal, {local, ir.inputs[2]}, std::nullopt});
+                    }
+                    continue;
+                }
+                out.push_back(std::move(ir));
+            }
+            code = std::move(out);
+        }
+    }
+
+    FunctionCFG& fn_;
+    std::vector<char> private_;
+    DominatorTree dom_;
+    VReg next_vreg_ = 0;
+    std::vector<std::vector<VReg>> top_;   // per instruction: the vreg a Dup or Pop sees
+    std::unordered_map<VReg, std::vector<Use>> uses_;
+    std::map<VReg, Site> makes_;           // record literals that do not escape
+    std::unordered_map<VReg, std::vector<VReg>> stack_at_make_;
+    std::map<VReg, int> loads_;            // LoadLocal outputs and their slots
+    std::vector<char> candidate_;          // slots replaced by field locals
+};
+
+} // namespace
+
+void run_scalar_replacement(FunctionCFG& fn, bool is_toplevel, bool recursive) {
+    for (auto& child : fn.children) {
+        if (child && recursive) run_scalar_replacement(*child, false);
+    }
+    if (fn.blocks.empty()) return;
+    ScalarReplacer(fn, is_toplevel).run();
+}
+
+} // namespace mitscript::analysis
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "cfg.hpp"
+
+namespace mitscript::analysis {
+
+// Escape analysis and scalar replacement of records.
+//
+// A record escapes when its reference can be seen by anything but field
+// loads and stores in its own function: passed to a call, returned, stored
+// into another record or a global, indexed, captured, or used as a plain
+// value. A record that does not escape is only ever reached through the
+// vreg of its MakeRecord, or through a local that holds nothing else (a
+// private local whose every store is a record literal, and which is
+// assigned on every path before it is read).
+//
+// Each such record, or each such local, gets one local per field it is
+// accessed with. MakeRecord sets the fields to None, StoreField and
+// LoadField become StoreLocal and LoadLocal of the field's local, and the
+// record itself is never allocated. A literal assigned to a local it reads
+// while being built is filled in separate locals and copied on assignment.
+//
+// Nested functions are processed too unless `recursive` is false.
+void run_scalar_replacement(mitscript::CFG::FunctionCFG& fn, bool is_toplevel = true,
+                            bool recursive = true);
+
+} // namespace mitscript::analysis
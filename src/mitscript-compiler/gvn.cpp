@@ -0,0 +1,404 @@
+#include "gvn.hpp"
+
+#include "ssa.hpp"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace mitscript::CFG;
+
+namespace mitscript::analysis {
+
+namespace {
+
+// Smallest operand tree worth replacing with a temporary.
+constexpr int kMinTreeInstrs = 2;
+
+struct ExprKey {
+    int op;
+    int a = -1;
+    int b = -1;
+    int epoch = -1;  // memory state, for loads
+    int kind = -1;   // operand kind of a constant or named load
+    int i = 0;
+    Symbol s;
+
+    bool operator==(const ExprKey& o) const {
+        return op == o.op && a == o.a && b == o.b && epoch == o.epoch &&
+               kind == o.kind && i == o.i && s == o.s;
+    }
+};
+
+struct ExprKeyHasher {
+    std::size_t operator()(const ExprKey& k) const noexcept {
+        std::size_t h = k.s.hash();
+        for (int v : {k.op, k.a, k.b, k.epoch, k.kind, k.i}) {
+            h ^= std::hash<int>{}(v) + 0x9e3779b9u + (h << 6) + (h >> 2);
+        }
+        return h;
+    }
+};
+
+struct Site {
+    BlockId block = -1;
+    int index = -1;
+};
+
+bool is_binary(IROp op) {
+    switch (op) {
+        case IROp::Add: case IROp::Sub: case IROp::Mul: case IROp::Div:
+        case IROp::CmpEq: case IROp::CmpLt: case IROp::CmpGt:
+        case IROp::CmpLe: case IROp::CmpGe: case IROp::And: case IROp::Or:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Instructions that may be dropped when the value they compute is already
+// available: they only read.
+bool is_pure(const IRInstr& ir) {
+    switch (ir.op) {
+        case IROp::LoadConst: case IROp::LoadLocal: case IROp::LoadGlobal:
+        case IROp::Neg: case IROp::Not: case IROp::LoadField: case IROp::LoadIndex:
+            return true;
+        default:
+            return is_binary(ir.op);
+    }
+}
+
+// Stack slots an instruction pops and pushes once lowered to bytecode.
+std::pair<int, int> stack_effect(const IRInstr& ir) {
+    switch (ir.op) {
+        case IROp::LoadConst: case IROp::LoadLocal: case IROp::LoadGlobal:
+        case IROp::MakeRecord: case IROp::AllocClosure:
+            return {0, 1};
+        case IROp::StoreLocal: case IROp::StoreGlobal: case IROp::Pop:
+            return {1, 0};
+        case IROp::Neg: case IROp::Not: case IROp::LoadField:
+            return {1, 1};
+        case IROp::LoadIndex:
+            return {2, 1};
+        case IROp::StoreField:
+            return {2, 0};
+        case IROp::StoreIndex:
+            return {3, 0};
+        case IROp::Call: {
+            // A named callee is loaded by the converter, not popped.
+            int pops = 0;
+            for (const auto& in : ir.inputs) pops += in.kind == IROperand::VREG;
+            return {pops, 1};
+        }
+        default:
+            return is_binary(ir.op) ? std::make_pair(2, 1) : std::make_pair(0, 0);
+    }
+}
+
+class ValueNumbering {
+public:
+    ValueNumbering(FunctionCFG& fn, const DominatorTree& dom, const SSAInfo& ssa)
+        : fn_(fn), dom_(dom), ssa_(ssa) {
+        int max_v = -1;
+        for (const auto& blk : fn.blocks) {
+            if (!blk) continue;
+            for (const auto& ir : blk->code) {
+                if (ir.output && ir.output->kind == IROperand::VREG)
+                    max_v = std::max(max_v, ir.output->i);
+                for (const auto& in : ir.inputs) {
+                    if (in.kind == IROperand::VREG) max_v = std::max(max_v, in.i);
+                }
+            }
+        }
+        vreg_vn_.assign(static_cast<size_t>(max_v + 1), -1);
+        version_vn_.resize(ssa.version_count.size());
+        for (size_t slot = 0; slot < version_vn_.size(); ++slot) {
+            version_vn_[slot].assign(static_cast<size_t>(ssa.version_count[slot]), -1);
+            if (!version_vn_[slot].empty()) version_vn_[slot][0] = next_vn_++;
+        }
+        redundant_.resize(fn.blocks.size());
+    }
+
+    // Numbers every reachable block; afterwards leader(b, k) names the
+    // dominating instruction whose value instruction k recomputes.
+    void run() {
+        if (!dom_.rpo.empty()) visit(fn_.entry, next_epoch_++);
+    }
+
+    Site leader(BlockId b, int k) const {
+        const auto& r = redundant_[b];
+        return k < static_cast<int>(r.size()) ? r[k] : Site{};
+    }
+
+private:
+    int fresh() { return next_vn_++; }
+
+    int vn_of(const IROperand& op) {
+        if (op.kind != IROperand::VREG || op.i < 0) return fresh();
+        int& vn = vreg_vn_[op.i];
+        if (vn < 0) vn = fresh();
+        return vn;
+    }
+
+    int& version_vn(const IROperand& local) {
+        int& vn = version_vn_[local.i][local.version];
+        if (vn < 0) vn = fresh();
+        return vn;
+    }
+
+    bool promoted(const IROperand& op) const {
+        return op.kind == IROperand::LOCAL && op.version >= 0 &&
+               op.i < static_cast<int>(ssa_.promoted.size()) && ssa_.promoted[op.i];
+    }
+
+    void visit(BlockId b, int epoch) {
+        auto& blk = *fn_.blocks[b];
+        std::vector<ExprKey> scope;
+        redundant_[b].assign(blk.code.size(), Site{});
+
+        // A phi whose incoming values all have one number is a copy.
+        for (const auto& phi : blk.phis) {
+            int vn = -1;
+            bool same = true;
+            for (size_t i = 0; i < phi.args.size() && same; ++i) {
+                BlockId p = blk.predecessors[i];
+                if (p < 0 || p >= static_cast<BlockId>(dom_.reachable.size()) ||
+                    !dom_.reachable[p])
+                    continue;
+                int arg = phi.args[i];
+                int arg_vn = arg >= 0 ? version_vn_[phi.local][arg] : -1;
+                if (arg_vn < 0 || (vn >= 0 && arg_vn != vn)) same = false;
+                vn = arg_vn;
+            }
+            version_vn_[phi.local][phi.version] = (same && vn >= 0) ? vn : fresh();
+        }
+
+        for (int k = 0; k < static_cast<int>(blk.code.size()); ++k) {
+            const IRInstr& ir = blk.code[k];
+            std::optional<ExprKey> key;
+            int vn = -1;
+
+            switch (ir.op) {
+                case IROp::LoadConst:
+                    if (!ir.inputs.empty())
+                        key = ExprKey{ir.op, -1, -1, -1, ir.inputs[0].kind, ir.inputs[0].i,
+                                      ir.inputs[0].s};
+                    break;
+                case IROp::LoadLocal:
+                    if (ir.inputs.empty()) break;
+                    if (promoted(ir.inputs[0])) {
+                        vn = version_vn(ir.inputs[0]);
+                    } else {
+                        key = ExprKey{ir.op, -1, -1, epoch, ir.inputs[0].kind,
+                                      ir.inputs[0].i, ir.inputs[0].s};
+                    }
+                    break;
+                case IROp::LoadGlobal:
+                    if (!ir.inputs.empty())
+                        key = ExprKey{ir.op, -1, -1, epoch, -1, 0, ir.inputs[0].s};
+                    break;
+                case IROp::Neg:
+                case IROp::Not:
+                    if (ir.inputs.size() == 1)
+                        key = ExprKey{ir.op, vn_of(ir.inputs[0]), -1, -1, -1, 0, {}};
+                    break;
+                case IROp::LoadField:
+                    if (ir.inputs.size() == 2)
+                        key = ExprKey{ir.op, vn_of(ir.inputs[0]), -1, epoch, -1, 0,
+                                      ir.inputs[1].s};
+                    break;
+                case IROp::LoadIndex:
+                    if (ir.inputs.size() == 2)
+                        key = ExprKey{ir.op, vn_of(ir.inputs[0]), vn_of(ir.inputs[1]), epoch, -1, 0, {}};
+                    break;
+                case IROp::StoreLocal:
+                    if (ir.inputs.size() == 2 && promoted(ir.inputs[0])) {
+                        version_vn(ir.inputs[0]) = vn_of(ir.inputs[1]);
+                        break;
+                    }
+                    epoch = next_epoch_++;
+                    break;
+                case IROp::StoreGlobal:
+                case IROp::StoreField:
+                case IROp::StoreIndex:
+                case IROp::Call:
+                    epoch = next_epoch_++;
+                    break;
+                default:
+                    if (is_binary(ir.op) && ir.inputs.size() == 2)
+                        key = ExprKey{ir.op, vn_of(ir.inputs[0]), vn_of(ir.inputs[1]), -1, -1, 0, {}};
+                    break;
+            }
+
+            if (key) {
+                auto it = table_.find(*key);
+                if (it != table_.end()) {
+                    vn = it->second.first;
+                    redundant_[b][k] = it->second.second;
+                } else {
+                    vn = fresh();
+                    table_.emplace(*key, std::make_pair(vn, Site{b, k}));
+                    scope.push_back(std::move(*key));
+                }
+            }
+            if (ir.output && ir.output->kind == IROperand::VREG && ir.output->i >= 0)
+                vreg_vn_[ir.output->i] = vn >= 0 ? vn : fresh();
+        }
+
+        // Memory is unchanged on entry to a child only if this block is its
+        // sole predecessor.
+        for (BlockId child : dom_.children[b]) {
+            int reachable_preds = 0;
+            bool only_b = true;
+            for (auto p : fn_.blocks[child]->predecessors) {
+                if (p < 0 || p >= static_cast<BlockId>(dom_.reachable.size()) ||
+                    !dom_.reachable[p])
+                    continue;
+                ++reachable_preds;
+                only_b = only_b && p == b;
+            }
+            visit(child, (reachable_preds == 1 && only_b) ? epoch : next_epoch_++);
+        }
+
+        for (const auto& k : scope) table_.erase(k);
+    }
+
+    FunctionCFG& fn_;
+    const DominatorTree& dom_;
+    const SSAInfo& ssa_;
+    int next_vn_ = 0;
+    int next_epoch_ = 0;
+    std::vector<int> vreg_vn_;
+    std::vector<std::vector<int>> version_vn_;
+    std::unordered_map<ExprKey, std::pair<int, Site>, ExprKeyHasher> table_;
+    std::vector<std::vector<Site>> redundant_;
+};
+
+struct Replacement {
+    BlockId block;
+    int start;
+    int root;
+    Site leader;
+};
+
+} // namespace
+
+std::vector<int> pure_tree_starts(const BasicBlock& blk) {
+    struct Entry {
+        int start;
+        int size;
+        bool pure;
+    };
+    std::vector<Entry> stack;
+    std::vector<int> starts(blk.code.size(), -1);
+    for (int k = 0; k < static_cast<int>(blk.code.size()); ++k) {
+        const IRInstr& ir = blk.code[k];
+        if (ir.op == IROp::Dup) {
+            stack.push_back({-1, 0, false});
+            continue;
+        }
+        auto [pops, pushes] = stack_effect(ir);
+        Entry tree{k, 1, is_pure(ir)};
+        for (int i = 0; i < pops; ++i) {
+            if (stack.empty()) {
+                tree.pure = false;
+                continue;
+            }
+            Entry operand = stack.back();
+            stack.pop_back();
+            tree.start = std::min(tree.start, operand.start);
+            tree.size += operand.size;
+            tree.pure = tree.pure && operand.pure && operand.start >= 0;
+        }
+        for (int i = 0; i < pushes; ++i) stack.push_back(tree);
+        // Operands left on the stack by earlier statements would make the
+        // range [start, k] include instructions outside the tree.
+        if (tree.pure && tree.start >= 0 && k - tree.start + 1 == tree.size)
+            starts[k] = tree.start;
+    }
+    return starts;
+}
+
+void run_gvn_on_function(FunctionCFG& fn, bool is_toplevel, bool recursive) {
+    for (auto& child : fn.children) {
+        if (child && recursive) run_gvn_on_function(*child, false);
+    }
+    if (fn.blocks.empty()) return;
+
+    DominatorTree dom = compute_dominators(fn);
+    SSAInfo ssa = construct_ssa(fn, dom, is_toplevel);
+    ValueNumbering vn(fn, dom, ssa);
+    vn.run();
+
+    // Pick the largest redundant trees: walking backwards, a tree's root
+    // comes before its subtrees.
+    std::vector<Replacement> replacements;
+    std::vector<std::vector<char>> removed(fn.blocks.size());
+    for (BlockId b : dom.rpo) {
+        const auto& blk = *fn.blocks[b];
+        auto starts = pure_tree_starts(blk);
+        removed[b].assign(blk.code.size(), 0);
+        for (int k = static_cast<int>(blk.code.size()) - 1; k >= 0; --k) {
+            Site leader = vn.leader(b, k);
+            if (leader.block < 0 || starts[k] < 0 || k - starts[k] + 1 < kMinTreeInstrs)
+                continue;
+            replacements.push_back({b, starts[k], k, leader});
+            std::fill(removed[b].begin() + starts[k], removed[b].begin() + k + 1, 1);
+            k = starts[k];
+        }
+    }
+
+    // One temporary per leader, stored right after it computes the value.
+    std::unordered_map<long long, int> temp_of;
+    auto site_key = [](Site s) { return (static_cast<long long>(s.block) << 32) | s.index; };
+    std::vector<std::vector<Replacement>> by_block(fn.blocks.size());
+    for (const auto& r : replacements) {
+        if (removed[r.leader.block][r.leader.index]) {
+            std::fill(removed[r.block].begin() + r.start, removed[r.block].begin() + r.root + 1, 0);
+            continue;
+        }
+        auto [it, added] = temp_of.try_emplace(site_key(r.leader), 0);
+        if (added) {
+            it->second = static_cast<int>(fn.params.size() + fn.locals.size());
+            fn.locals.push_back("$gvn" + std::to_string(temp_of.size() - 1));
+        }
+        by_block[r.block].push_back(r);
+    }
+
+    if (!temp_of.empty()) {
+        for (BlockId b : dom.rpo) {
+            auto& blk = *fn.blocks[b];
+            std::vector<int> temp_at_root(blk.code.size(), -1);
+            for (const auto& r : by_block[b]) temp_at_root[r.root] = temp_of[site_key(r.leader)];
+
+            std::vector<IRInstr> code;
+            code.reserve(blk.code.size());
+            for (int k = 0; k < static_cast<int>(blk.code.size()); ++k) {
+                IRInstr& ir = blk.code[k];
+                if (removed[b][k]) {
+                    if (temp_at_root[k] >= 0) {
+                        code.push_back(IRInstr{IROp::LoadLocal,
+                                               {IROperand{IROperand::LOCAL, temp_at_root[k]}},
+                                               ir.output});
+                    }
+                    continue;
+                }
+                code.push_back(std::move(ir));
+                auto it = temp_of.find(site_key(Site{b, k}));
+                if (it != temp_of.end()) {
+                    code.push_back(IRInstr{IROp::Dup, {}, std::nullopt});
+                    code.push_back(IRInstr{IROp::StoreLocal,
+                                           {IROperand{IROperand::LOCAL, it->second},
+                                            *code[code.size() - 2].output},
+                                           std::nullopt});
+                }
+            }
+            blk.code = std::move(code);
+        }
+    }
+
+    destruct_ssa(fn);
+}
+
+} // namespace mitscript::analysis
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "cfg.hpp"
+#include <vector>
+
+namespace mitscript::analysis {
+
+// Global value numbering over SSA form (see ssa.hpp), followed by
+// redundancy elimination. Values are numbered in dominator-tree preorder
+// with a scoped hash table, so an expression is redundant when an
+// equivalent one dominates it: the same constant, arithmetic on the same
+// value numbers, or the same LoadGlobal/LoadField/LoadIndex/free-variable
+// load with no call or store to memory in between. Loads of promoted
+// locals take the value number of the version they read, which makes
+// copies through locals transparent.
+//
+// The IR lowers to a stack machine, so a redundant expression is replaced
+// as a whole: the instructions that compute it (its operand tree, when
+// that tree is side-effect free) become one LoadLocal of a temporary that
+// the dominating occurrence fills with Dup; StoreLocal. Single loads are
+// left alone, since reading the temporary would cost as much.
+//
+// Nested functions are processed too unless `recursive` is false.
+void run_gvn_on_function(mitscript::CFG::FunctionCFG& fn, bool is_toplevel = true,
+                         bool recursive = true);
+
+// For each instruction of blk, the first instruction of the operand tree it
+// roots, as lowered to the stack machine: the tree occupies the contiguous
+// range [start, k]. -1 when that tree has side effects or reaches outside
+// the block.
+std::vector<int> pure_tree_starts(const mitscript::CFG::BasicBlock& blk);
+
+} // namespace mitscript::analysis
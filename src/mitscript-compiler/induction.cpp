@@ -0,0 +1,334 @@
+#include "induction.hpp"
+
+#include "ssa.hpp"
+#include "type_inference.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+using namespace mitscript::CFG;
+
+namespace mitscript::analysis {
+
+namespace {
+
+// Headers longer than this are not copied into latches.
+constexpr size_t kMaxRotatedHeader = 8;
+
+int max_vreg(const FunctionCFG& fn) {
+    int max_v = -1;
+    for (const auto& blk : fn.blocks) {
+        if (!blk) continue;
+        max_v = std::max(max_v, blk->term.condition);
+        for (const auto& ir : blk->code) {
+            if (ir.output && ir.output->kind == IROperand::VREG) max_v = std::max(max_v, ir.output->i);
+            for (const auto& in : ir.inputs) {
+                if (in.kind == IROperand::VREG) max_v = std::max(max_v, in.i);
+            }
+        }
+    }
+    return max_v;
+}
+
+bool produces(const IRInstr& ir, const IROperand& x) {
+    return x.kind == IROperand::VREG && ir.output && ir.output->kind == IROperand::VREG &&
+           ir.output->i == x.i;
+}
+
+bool loads_local(const IRInstr& ir, int slot) {
+    return ir.op == IROp::LoadLocal && !ir.inputs.empty() &&
+           ir.inputs[0].kind == IROperand::LOCAL && ir.inputs[0].i == slot;
+}
+
+std::optional<int> int_constant(const IRInstr& ir) {
+    if (ir.op != IROp::LoadConst || ir.inputs.empty() || ir.inputs[0].kind != IROperand::CONSTI)
+        return std::nullopt;
+    return ir.inputs[0].i;
+}
+
+int32_t wrapping_mul(int32_t a, int32_t b) {
+    return static_cast<int32_t>(static_cast<uint32_t>(a) * static_cast<uint32_t>(b));
+}
+
+struct Update {
+    IROperand step;
+    bool decrement;
+};
+
+// Whether code[s], a StoreLocal of slot, stores `slot + step` or
+// `slot - step`. The value's operand tree is the three instructions before
+// the store.
+std::optional<Update> match_update(const std::vector<IRInstr>& code, size_t s, int slot) {
+    const IRInstr& store = code[s];
+    if (s < 3 || store.inputs.size() < 2) return std::nullopt;
+    const IRInstr& op = code[s - 1];
+    if ((op.op != IROp::Add && op.op != IROp::Sub) || op.inputs.size() != 2 ||
+        !produces(op, store.inputs[1]))
+        return std::nullopt;
+    const IRInstr& a = code[s - 3];
+    const IRInstr& b = code[s - 2];
+    if (!produces(a, op.inputs[0]) || !produces(b, op.inputs[1])) return std::nullopt;
+
+    auto step_of = [&](const IRInstr& x) -> std::optional<IROperand> {
+        if (x.inputs.empty()) return std::nullopt;
+        if (int_constant(x)) return x.inputs[0];
+        if (x.op == IROp::LoadLocal && x.inputs[0].kind == IROperand::LOCAL &&
+            x.inputs[0].i != slot)
+            return IROperand{IROperand::LOCAL, x.inputs[0].i};
+        return std::nullopt;
+    };
+    if (loads_local(a, slot)) {
+        if (auto step = step_of(b)) return Update{*step, op.op == IROp::Sub};
+    }
+    if (op.op == IROp::Add && loads_local(b, slot)) {
+        if (auto step = step_of(a)) return Update{*step, false};
+    }
+    return std::nullopt;
+}
+
+bool same_step(const InductionVariable& iv, const Update& u) {
+    return iv.decrement == u.decrement && iv.step.kind == u.step.kind && iv.step.i == u.step.i;
+}
+
+// Per block: the innermost loop containing it, or -1. find_loops lists
+// outer loops before the loops they contain.
+std::vector<int> innermost_loops(const FunctionCFG& fn, const std::vector<Loop>& loops) {
+    std::vector<int> innermost(fn.blocks.size(), -1);
+    for (size_t l = 0; l < loops.size(); ++l) {
+        for (BlockId b : loops[l].blocks) innermost[b] = static_cast<int>(l);
+    }
+    return innermost;
+}
+
+struct Product {
+    BlockId block;
+    int root;      // the Mul; its operands are the two instructions before it
+    int local;
+    int factor;
+};
+
+void reduce_loop(FunctionCFG& fn, const DominatorTree& dom, const std::vector<Loop>& loops,
+                 size_t index, const std::vector<int>& innermost,
+                 const std::vector<char>& private_slots, const TypeInferenceResult& types,
+                 VReg& next_vreg, int& temp_count) {
+    const Loop& loop = loops[index];
+    BlockId preheader = find_preheader(fn, dom, loop);
+    if (preheader < 0) return;
+
+    const auto& on_entry = types.locals_in[loop.header];
+    std::map<int, InductionVariable> ivs;
+    for (auto& iv : find_induction_variables(fn, loop, private_slots)) {
+        bool usable =
+            iv.step.kind == IROperand::CONSTI && iv.local < static_cast<int>(on_entry.size()) &&
+            on_entry[iv.local] == TypeKind::Int &&
+            std::all_of(iv.updates.begin(), iv.updates.end(),
+                        [&](BlockId b) { return innermost[b] == static_cast<int>(index); });
+        if (usable) ivs.emplace(iv.local, std::move(iv));
+    }
+    if (ivs.empty()) return;
+
+    auto iv_load = [&](const IRInstr& ir) {
+        return ir.op == IROp::LoadLocal && !ir.inputs.empty() &&
+                       ir.inputs[0].kind == IROperand::LOCAL && ivs.count(ir.inputs[0].i)
+                   ? ir.inputs[0].i
+                   : -1;
+    };
+    std::vector<Product> products;
+    for (BlockId b : loop.blocks) {
+        bool every_iteration = std::all_of(loop.latches.begin(), loop.latches.end(),
+                                           [&](BlockId l) { return dom.dominates(b, l); });
+        if (!every_iteration && innermost[b] == static_cast<int>(index)) continue;
+        const auto& code = fn.blocks[b]->code;
+        for (size_t k = 2; k < code.size(); ++k) {
+            const IRInstr& mul = code[k];
+            if (mul.op != IROp::Mul || mul.inputs.size() != 2 || !mul.output ||
+                !produces(code[k - 2], mul.inputs[0]) || !produces(code[k - 1], mul.inputs[1]))
+                continue;
+            int local = iv_load(code[k - 2]);
+            auto factor = int_constant(code[k - 1]);
+            if (local < 0 || !factor) {
+                local = iv_load(code[k - 1]);
+                factor = int_constant(code[k - 2]);
+            }
+            if (local >= 0 && factor) products.push_back({b, static_cast<int>(k), local, *factor});
+        }
+    }
+    if (products.empty()) return;
+
+    // One temporary per (variable, factor), shared by its products.
+    std::map<std::pair<int, int>, int> temp_of;
+    for (const auto& p : products) {
+        auto [it, inserted] = temp_of.emplace(std::make_pair(p.local, p.factor), 0);
+        if (!inserted) continue;
+        it->second = static_cast<int>(fn.params.size() + fn.locals.size());
+        fn.locals.push_back("$iv" + std::to_string(temp_count++));
+    }
+
+    // Products are in ascending order within each block; replace them last
+    // to first so the earlier indices stay valid.
+    for (auto it = products.rbegin(); it != products.rend(); ++it) {
+        auto& code = fn.blocks[it->block]->code;
+        int temp = temp_of.at({it->local, it->factor});
+        IRInstr load{IROp::LoadLocal, {IROperand{IROperand::LOCAL, temp}}, code[it->root].output};
+        code.erase(code.begin() + it->root - 2, code.begin() + it->root + 1);
+        code.insert(code.begin() + it->root - 2, std::move(load));
+    }
+
+    auto vreg = [&]() { return IROperand{IROperand::VREG, next_vreg++}; };
+    for (const auto& [key, temp] : temp_of) {
+        const auto& [local, factor] = key;
+        const InductionVariable& iv = ivs.at(local);
+
+        // temp = local * factor on entry; the variable is an integer there.
+        auto& pre = fn.blocks[preheader]->code;
+        IROperand v = vreg(), k = vreg(), product = vreg();
+        pre.push_back({IROp::LoadLocal, {IROperand{IROperand::LOCAL, local}}, v});
+        pre.push_back({IROp::LoadConst, {IROperand{IROperand::CONSTI, factor}}, k});
+        pre.push_back({IROp::Mul, {v, k}, product});
+        pre.push_back({IROp::StoreLocal, {IROperand{IROperand::LOCAL, temp}, product}, std::nullopt});
+
+        // temp += step * factor after every update.
+        int32_t delta = wrapping_mul(iv.step.i, factor);
+        if (iv.decrement) delta = wrapping_mul(delta, -1);
+        std::set<BlockId> blocks(iv.updates.begin(), iv.updates.end());
+        for (BlockId b : blocks) {
+            auto& code = fn.blocks[b]->code;
+            for (size_t s = 0; s < code.size(); ++s) {
+                const IRInstr& ir = code[s];
+                if (ir.op != IROp::StoreLocal || ir.inputs.empty() ||
+                    ir.inputs[0].kind != IROperand::LOCAL || ir.inputs[0].i != local)
+                    continue;
+                IROperand t = vreg(), d = vreg(), sum = vreg();
+                code.insert(code.begin() + s + 1,
+                            {IRInstr{IROp::LoadLocal, {IROperand{IROperand::LOCAL, temp}}, t},
+                             IRInstr{IROp::LoadConst, {IROperand{IROperand::CONSTI, delta}}, d},
+                             IRInstr{IROp::Add, {t, d}, sum},
+                             IRInstr{IROp::StoreLocal, {IROperand{IROperand::LOCAL, temp}, sum},
+                                     std::nullopt}});
+                s += 4;
+            }
+        }
+    }
+}
+
+void rotate_loop(FunctionCFG& fn, const Loop& loop, VReg& next_vreg) {
+    BasicBlock& header = *fn.blocks[loop.header];
+    const Terminator& test = header.term;
+    if (test.kind != Terminator::Kind::CondJump || header.code.size() > kMaxRotatedHeader ||
+        loop.contains(test.trueTarget) == loop.contains(test.falseTarget))
+        return;
+
+    for (BlockId l : loop.latches) {
+        BasicBlock& latch = *fn.blocks[l];
+        if (l == loop.header || latch.term.kind != Terminator::Kind::Jump ||
+            latch.term.target != loop.header)
+            continue;
+
+        std::unordered_map<VReg, VReg> vreg_of;
+        auto rename = [&](VReg v) {
+            auto it = vreg_of.find(v);
+            return it == vreg_of.end() ? v : it->second;
+        };
+        for (const auto& ir : header.code) {
+            IRInstr copy = ir;
+            for (auto& in : copy.inputs) {
+                if (in.kind == IROperand::VREG) in.i = rename(in.i);
+            }
+            if (copy.output && copy.output->kind == IROperand::VREG) {
+                vreg_of[copy.output->i] = next_vreg;
+                copy.output->i = next_vreg++;
+            }
+            latch.code.push_back(std::move(copy));
+        }
+        latch.term = test;
+        latch.term.condition = rename(test.condition);
+        latch.successors = header.successors;
+
+        auto& preds = header.predecessors;
+        preds.erase(std::remove(preds.begin(), preds.end(), l), preds.end());
+        for (BlockId s : header.successors) fn.blocks[s]->predecessors.push_back(l);
+    }
+}
+
+} // namespace
+
+std::vector<InductionVariable> find_induction_variables(const FunctionCFG& fn, const Loop& loop,
+                                                        const std::vector<char>& private_slots) {
+    auto is_private = [&](int slot) {
+        return slot >= 0 && slot < static_cast<int>(private_slots.size()) && private_slots[slot];
+    };
+
+    std::map<int, InductionVariable> found;
+    std::set<int> stored;
+    std::set<int> rejected;
+    for (BlockId b : loop.blocks) {
+        const auto& code = fn.blocks[b]->code;
+        for (size_t s = 0; s < code.size(); ++s) {
+            const IRInstr& ir = code[s];
+            if (ir.op != IROp::StoreLocal || ir.inputs.empty() ||
+                ir.inputs[0].kind != IROperand::LOCAL)
+                continue;
+            int slot = ir.inputs[0].i;
+            stored.insert(slot);
+            auto update = match_update(code, s, slot);
+            if (!is_private(slot) || !update) {
+                rejected.insert(slot);
+                continue;
+            }
+            auto [it, inserted] =
+                found.emplace(slot, InductionVariable{slot, update->step, update->decrement, {}});
+            if (!inserted && !same_step(it->second, *update)) rejected.insert(slot);
+            it->second.updates.push_back(b);
+        }
+    }
+
+    std::vector<InductionVariable> ivs;
+    for (auto& [slot, iv] : found) {
+        if (rejected.count(slot)) continue;
+        if (iv.step.kind == IROperand::LOCAL && (!is_private(iv.step.i) || stored.count(iv.step.i)))
+            continue;
+        ivs.push_back(std::move(iv));
+    }
+    return ivs;
+}
+
+void run_strength_reduction(FunctionCFG& fn, bool is_toplevel, bool recursive) {
+    for (auto& child : fn.children) {
+        if (child && recursive) run_strength_reduction(*child, false);
+    }
+    if (fn.blocks.empty()) return;
+
+    DominatorTree dom = compute_dominators(fn);
+    auto loops = find_loops(fn, dom);
+    if (loops.empty()) return;
+    auto innermost = innermost_loops(fn, loops);
+    auto private_slots = private_locals(fn, is_toplevel);
+    TypeInferenceResult types = run_type_inference(fn, is_toplevel);
+    VReg next_vreg = max_vreg(fn) + 1;
+    int temp_count = 0;
+    // Only instructions move, so the loops and dominators stay valid.
+    for (size_t l = 0; l < loops.size(); ++l) {
+        reduce_loop(fn, dom, loops, l, innermost, private_slots, types, next_vreg, temp_count);
+    }
+}
+
+void run_loop_rotation(FunctionCFG& fn, bool recursive) {
+    for (auto& child : fn.children) {
+        if (child && recursive) run_loop_rotation(*child);
+    }
+    if (fn.blocks.empty()) return;
+
+    DominatorTree dom = compute_dominators(fn);
+    VReg next_vreg = max_vreg(fn) + 1;
+    // Rotation only rewrites latches, which no other loop has as its header
+    // or latch, so each loop found up front can be rotated in turn.
+    for (const auto& loop : find_loops(fn, dom)) rotate_loop(fn, loop, next_vreg);
+}
+
+} // namespace mitscript::analysis
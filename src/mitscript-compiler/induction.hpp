@@ -0,0 +1,53 @@
+#pragma once
+
+#include "cfg.hpp"
+#include "loops.hpp"
+#include <vector>
+
+namespace mitscript::analysis {
+
+// A basic induction variable of a loop: a local only this function can
+// access (see private_locals) whose every store in the loop is
+// `i = i + step` or `i = i - step`, where step is an integer constant or a
+// private local the loop never stores.
+struct InductionVariable {
+    int local;
+    mitscript::CFG::IROperand step;                 // CONSTI or LOCAL
+    bool decrement = false;                         // i = i - step
+    std::vector<mitscript::CFG::BlockId> updates;   // blocks that store it
+};
+
+std::vector<InductionVariable> find_induction_variables(const mitscript::CFG::FunctionCFG& fn,
+                                                        const Loop& loop,
+                                                        const std::vector<char>& private_slots);
+
+// Strength reduction of `i * k`, for a constant k and an induction variable
+// i with a constant step that is an integer whenever the loop is entered
+// (see type_inference.hpp). A temporary t is set to i * k in the preheader
+// and advanced by step * k after every update of i, so that the product
+// becomes a load of t. Since MITScript integers wrap, the two agree even on
+// overflow.
+//
+// Each update costs an addition, so only products evaluated at least once
+// per update are reduced: those in blocks that run on every iteration, or
+// in a nested loop, of a loop whose updates of i are not in a nested loop.
+//
+// Nested functions are processed too unless `recursive` is false.
+void run_strength_reduction(mitscript::CFG::FunctionCFG& fn, bool is_toplevel = true,
+                            bool recursive = true);
+
+// Loop rotation. MITScript only has while loops, which the converter lays
+// out as a header that tests the condition and exits, a body, and a latch
+// that jumps back to the header: two branches per iteration. Rotation
+// copies a small header's code into each latch that jumps back to it, so
+// that the latch tests the condition itself and branches straight back
+// into the body; the header is then only run on entry to the loop.
+//
+// With the counter's update at the end of the body, a rotated latch ends
+// in `c = c + step; if (c < bound)`, which the VM fuses into a single
+// IncJumpLt or AddJumpLt (see vm/superinstructions.hpp).
+//
+// Nested functions are processed too unless `recursive` is false.
+void run_loop_rotation(mitscript::CFG::FunctionCFG& fn, bool recursive = true);
+
+} // namespace mitscript::analysis
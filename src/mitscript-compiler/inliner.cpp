@@ -1,7 +1,13 @@
 #include "inliner.hpp"
 
+#include "dce.hpp"
+#include "loops.hpp"
+#include "ssa.hpp"
+
 #include <algorithm>
 #include <functional>
+#include <optional>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -32,27 +38,101 @@ int max_vreg_in_function(const FunctionCFG& fn) {
     return max_v;
 }
 
+bool contains(const std::vector<std::string>& names, const std::string& s) {
+    return std::find(names.begin(), names.end(), s) != names.end();
+}
+
+int local_slot(const FunctionCFG& fn, const std::string& name) {
+    auto p = std::find(fn.params.begin(), fn.params.end(), name);
+    if (p != fn.params.end()) return static_cast<int>(p - fn.params.begin());
+    auto l = std::find(fn.locals.begin(), fn.locals.end(), name);
+    if (l != fn.locals.end()) return static_cast<int>(fn.params.size() + (l - fn.locals.begin()));
+    return -1;
+}
+
+const std::string& slot_name(const FunctionCFG& fn, int slot) {
+    size_t i = static_cast<size_t>(slot);
+    return i < fn.params.size() ? fn.params[i] : fn.locals[i - fn.params.size()];
+}
+
+// The blocks the bytecode converter emits: those reachable from the entry
+// without entering a post-return block. The entry comes first.
+std::vector<BlockId> emitted_blocks(const FunctionCFG& fn) {
+    std::vector<BlockId> out;
+    std::vector<char> seen(fn.blocks.size(), 0);
+    std::vector<BlockId> work{fn.entry};
+    while (!work.empty()) {
+        BlockId b = work.back();
+        work.pop_back();
+        if (b < 0 || b >= static_cast<BlockId>(fn.blocks.size()) || !fn.blocks[b] || seen[b])
+            continue;
+        seen[b] = 1;
+        if (fn.blocks[b]->post_return) continue;
+        out.push_back(b);
+        for (BlockId s : fn.blocks[b]->successors) work.push_back(s);
+    }
+    return out;
+}
+
 int instruction_count(const FunctionCFG& fn) {
     int count = 0;
-    for (const auto& blk_ptr : fn.blocks) {
-        if (!blk_ptr) continue;
-        count += static_cast<int>(blk_ptr->code.size());
-    }
+    for (BlockId b : emitted_blocks(fn)) count += static_cast<int>(fn.blocks[b]->code.size());
     return count;
 }
 
-struct CallSite {
-    FunctionCFG* caller = nullptr;
-    BlockId block = -1;
-    size_t instr_index = 0;
-    FunctionCFG* callee = nullptr;
-};
+// The operand stack just before code[k], as the vregs on it from the
+// bottom up, or nullopt if the block's stack use does not add up.
+std::optional<std::vector<VReg>> stack_before(const BasicBlock& blk, size_t k) {
+    std::vector<VReg> stack;
+    for (size_t i = 0; i < k; ++i) {
+        const auto& ir = blk.code[i];
+        if (ir.op == IROp::Dup || ir.op == IROp::Pop) {
+            if (stack.empty()) return std::nullopt;
+            if (ir.op == IROp::Dup) stack.push_back(stack.back());
+            else stack.pop_back();
+            continue;
+        }
+        std::vector<VReg> operands;
+        for (const auto& in : ir.inputs) {
+            if (in.kind == IROperand::VREG) operands.push_back(in.i);
+        }
+        if (stack.size() < operands.size() ||
+            !std::equal(operands.begin(), operands.end(), stack.end() - operands.size()))
+            return std::nullopt;
+        stack.resize(stack.size() - operands.size());
+        if (ir.output) {
+            if (ir.output->kind != IROperand::VREG) return std::nullopt;
+            stack.push_back(ir.output->i);
+        }
+    }
+    return stack;
+}
 
-struct CallGraph {
-    std::vector<FunctionCFG*> funcs;
-    std::unordered_map<FunctionCFG*, std::vector<FunctionCFG*>> edges;
-    std::unordered_map<FunctionCFG*, bool> recursive;
-};
+// Whether fn's body can be copied into another function: it defines no
+// functions, never assigns a free variable, and branches only between the
+// blocks the converter emits.
+bool inlinable_body(const FunctionCFG& fn) {
+    if (!fn.children.empty()) return false;
+    auto blocks = emitted_blocks(fn);
+    if (blocks.empty() || blocks.front() != fn.entry) return false;
+    std::unordered_set<BlockId> emitted(blocks.begin(), blocks.end());
+    for (BlockId b : blocks) {
+        const BasicBlock& blk = *fn.blocks[b];
+        if (!blk.phis.empty()) return false;
+        for (const auto& ir : blk.code) {
+            if (ir.op == IROp::AllocClosure) return false;
+            if (ir.op == IROp::StoreLocal && !ir.inputs.empty() &&
+                ir.inputs[0].kind == IROperand::NAME && contains(fn.freeVars, ir.inputs[0].s.str()))
+                return false;
+        }
+        const Terminator& t = blk.term;
+        if (t.kind == Terminator::Kind::Jump && !emitted.count(t.target)) return false;
+        if (t.kind == Terminator::Kind::CondJump &&
+            (!emitted.count(t.trueTarget) || !emitted.count(t.falseTarget)))
+            return false;
+    }
+    return true;
+}
 
 void collect_functions(FunctionCFG& root, std::vector<FunctionCFG*>& out) {
     out.push_back(&root);
@@ -66,121 +146,221 @@ FunctionCFG* lookup_child(FunctionCFG& caller, int idx) {
     return caller.children[idx].get();
 }
 
-// Resolve a callee index either as a nested child or as a module-level function
-// in the flattened function list (as produced by collect_functions).
-FunctionCFG* lookup_callee_global(const std::vector<FunctionCFG*>& all_funcs,
-                                  FunctionCFG& caller,
-                                  int idx) {
-    if (idx < 0) return nullptr;
-    // Prefer the existing child lookup semantics.
-    if (auto* child = lookup_child(caller, idx)) return child;
-    // Fallback: treat idx as a module-level function ordinal.
-    if (idx < static_cast<int>(all_funcs.size())) {
-        return all_funcs[idx];
-    }
-    return nullptr;
+FunctionCFG* closure_of(FunctionCFG& fn, const IRInstr& ir) {
+    if (ir.op != IROp::AllocClosure || ir.inputs.empty() ||
+        ir.inputs.back().kind != IROperand::CONSTI)
+        return nullptr;
+    return lookup_child(fn, ir.inputs.back().i);
 }
 
-// Build a mapping from global function name -> FunctionCFG* by scanning the
-// module (root) function for "StoreGlobal <name>, <vreg>" where the value comes
-// from an AllocClosure of a child function.
-std::unordered_map<std::string, FunctionCFG*> build_global_func_map(FunctionCFG& module,
-                                                                    const std::vector<FunctionCFG*>& /*funcs*/) {
-    std::unordered_map<std::string, FunctionCFG*> name_map;
-
-    // Directly map named children.
-    for (const auto& child_ptr : module.children) {
-        if (child_ptr && !child_ptr->name.empty()) {
-            name_map.emplace(child_ptr->name, child_ptr.get());
+using GlobalFunctions = std::unordered_map<std::string, FunctionCFG*>;
+
+// Globals the program assigns exactly once, from a function literal, before
+// the module's first call. No function can run before that call, so every
+// read of the global in a function sees the function.
+GlobalFunctions single_assignment_globals(FunctionCFG& module,
+                                          const std::vector<FunctionCFG*>& funcs) {
+    std::unordered_map<std::string, int> stores;
+    for (auto* f : funcs) {
+        bool is_module = f == &module;
+        for (const auto& blk : f->blocks) {
+            if (!blk) continue;
+            for (const auto& ir : blk->code) {
+                if (ir.inputs.empty()) continue;
+                const IROperand& x = ir.inputs[0];
+                if (ir.op == IROp::StoreGlobal && x.kind == IROperand::NAME) {
+                    ++stores[x.s.str()];
+                } else if (ir.op == IROp::StoreLocal && x.kind == IROperand::NAME) {
+                    if (is_module ||
+                        (local_slot(*f, x.s.str()) < 0 && !contains(f->freeVars, x.s.str())))
+                        ++stores[x.s.str()];
+                } else if (ir.op == IROp::StoreLocal && is_module && x.kind == IROperand::LOCAL) {
+                    ++stores[slot_name(module, x.i)];
+                }
+            }
+        }
+    }
+
+    GlobalFunctions bound;
+    if (module.entry < 0 || module.entry >= static_cast<BlockId>(module.blocks.size())) return bound;
+    std::unordered_map<VReg, FunctionCFG*> closures;
+    for (const auto& ir : module.blocks[module.entry]->code) {
+        if (ir.op == IROp::Call) break;
+        if (FunctionCFG* c = closure_of(module, ir)) {
+            if (ir.output && ir.output->kind == IROperand::VREG) closures[ir.output->i] = c;
+            continue;
         }
+        if ((ir.op != IROp::StoreGlobal && ir.op != IROp::StoreLocal) || ir.inputs.size() < 2 ||
+            ir.inputs[1].kind != IROperand::VREG)
+            continue;
+        const IROperand& x = ir.inputs[0];
+        std::string name;
+        if (x.kind == IROperand::NAME) name = x.s.str();
+        else if (x.kind == IROperand::LOCAL && contains(module.names, slot_name(module, x.i)))
+            name = slot_name(module, x.i);
+        auto it = closures.find(ir.inputs[1].i);
+        if (!name.empty() && it != closures.end()) bound[name] = it->second;
     }
+    for (auto it = bound.begin(); it != bound.end();) {
+        it = stores[it->first] == 1 ? std::next(it) : bound.erase(it);
+    }
+    return bound;
+}
 
-    // Track vreg -> FunctionCFG* inside the module body.
-    std::unordered_map<int, FunctionCFG*> vreg_func;
-    for (const auto& blk_ptr : module.blocks) {
-        if (!blk_ptr) continue;
-        for (const auto& ir : blk_ptr->code) {
-            if (ir.op == IROp::AllocClosure &&
-                ir.output && ir.output->kind == IROperand::VREG &&
-                !ir.inputs.empty() &&
-                ir.inputs.back().kind == IROperand::CONSTI) {
-                FunctionCFG* callee = lookup_child(module, ir.inputs.back().i);
-                if (callee) vreg_func[ir.output->i] = callee;
-            } else if (ir.op == IROp::StoreGlobal &&
-                       ir.inputs.size() >= 2 &&
-                       ir.inputs[0].kind == IROperand::NAME &&
-                       ir.inputs[1].kind == IROperand::VREG) {
-                int v = ir.inputs[1].i;
-                auto it = vreg_func.find(v);
-                if (it != vreg_func.end()) {
-                    name_map.emplace(ir.inputs[0].s, it->second);
-                }
+bool stored_by_name(const FunctionCFG& fn, const std::string& name) {
+    for (const auto& child : fn.children) {
+        if (!child) continue;
+        for (const auto& blk : child->blocks) {
+            if (!blk) continue;
+            for (const auto& ir : blk->code) {
+                if (ir.op == IROp::StoreLocal && !ir.inputs.empty() &&
+                    ir.inputs[0].kind == IROperand::NAME && ir.inputs[0].s.str() == name)
+                    return true;
             }
         }
+        if (stored_by_name(*child, name)) return true;
     }
-    return name_map;
+    return false;
 }
 
-CallGraph build_call_graph(const std::vector<FunctionCFG*>& funcs) {
-    CallGraph cg;
-    cg.funcs = funcs;
-    if (funcs.empty()) return cg;
-    auto global_name_map = build_global_func_map(*funcs.front(), funcs);
+struct ClosureBinding {
+    FunctionCFG* fn;
+    BlockId block;
+    size_t index;
+};
 
-    for (auto* f : funcs) {
-        for (const auto& blk_ptr : f->blocks) {
-            if (!blk_ptr) continue;
-            std::unordered_map<int, FunctionCFG*> vreg_callee;
-            for (const auto& ir : blk_ptr->code) {
-                // Track simple defs to resolve subsequent calls in the same block.
-                // This is minimal: only LoadGlobal of a known function and AllocClosure.
-                if (ir.op == IROp::AllocClosure &&
-                    ir.output && ir.output->kind == IROperand::VREG &&
-                    !ir.inputs.empty() &&
-                    ir.inputs.back().kind == IROperand::CONSTI) {
-                    FunctionCFG* c = lookup_child(*f, ir.inputs.back().i);
-                    if (c) vreg_callee[ir.output->i] = c;
-                } else if (ir.op == IROp::LoadGlobal &&
-                           ir.output && ir.output->kind == IROperand::VREG &&
-                           !ir.inputs.empty() &&
-                           ir.inputs[0].kind == IROperand::NAME) {
-                    auto itn = global_name_map.find(ir.inputs[0].s);
-                    if (itn != global_name_map.end()) vreg_callee[ir.output->i] = itn->second;
-                } else if (ir.op == IROp::LoadLocal &&
-                           ir.output && ir.output->kind == IROperand::VREG &&
-                           !ir.inputs.empty() &&
-                           ir.inputs[0].kind == IROperand::NAME) {
-                    auto itn = global_name_map.find(ir.inputs[0].s);
-                    if (itn != global_name_map.end()) vreg_callee[ir.output->i] = itn->second;
+// What a function needs to resolve the callees of its calls.
+struct CallerInfo {
+    FunctionCFG* fn = nullptr;
+    bool is_root = false;
+    DominatorTree dom;
+    // Locals assigned exactly once, from a closure over one of fn's children.
+    std::unordered_map<int, ClosureBinding> closures;
+
+    CallerInfo(FunctionCFG& f, bool root) : fn(&f), is_root(root), dom(compute_dominators(f)) {
+        if (root) return;
+        std::unordered_map<int, int> stores;
+        for (size_t b = 0; b < f.blocks.size(); ++b) {
+            if (!f.blocks[b]) continue;
+            std::unordered_map<VReg, FunctionCFG*> made;
+            const auto& code = f.blocks[b]->code;
+            for (size_t i = 0; i < code.size(); ++i) {
+                const auto& ir = code[i];
+                if (FunctionCFG* c = closure_of(f, ir)) {
+                    if (ir.output && ir.output->kind == IROperand::VREG) made[ir.output->i] = c;
+                }
+                if (ir.op != IROp::StoreLocal || ir.inputs.size() < 2 ||
+                    ir.inputs[0].kind != IROperand::LOCAL)
+                    continue;
+                int slot = ir.inputs[0].i;
+                ++stores[slot];
+                auto it = ir.inputs[1].kind == IROperand::VREG ? made.find(ir.inputs[1].i) : made.end();
+                if (it != made.end()) {
+                    closures[slot] = {it->second, static_cast<BlockId>(b), i};
                 }
+            }
+        }
+        for (auto it = closures.begin(); it != closures.end();) {
+            int slot = it->first;
+            bool keep = stores[slot] == 1 && slot >= static_cast<int>(f.params.size()) &&
+                        !stored_by_name(f, slot_name(f, slot));
+            it = keep ? std::next(it) : closures.erase(it);
+        }
+    }
+};
 
-                if (ir.op != IROp::Call) continue;
-                if (ir.inputs.empty()) continue;
+struct Callee {
+    FunctionCFG* fn = nullptr;
+    int load = -1; // the instruction that pushed the callee, if it is a plain load
+};
 
-                FunctionCFG* callee = nullptr;
-                const auto& callee_op = ir.inputs[0];
-                if (callee_op.kind == IROperand::CONSTI) {
-                    callee = lookup_callee_global(funcs, *f, callee_op.i);
-                } else if (callee_op.kind == IROperand::VREG) {
-                    auto it = vreg_callee.find(callee_op.i);
-                    if (it != vreg_callee.end()) callee = it->second;
-                }
-                if (callee) cg.edges[f].push_back(callee);
+// The function a Call at code[k] of block b certainly invokes, if known.
+Callee resolve_callee(const CallerInfo& caller, const GlobalFunctions& globals, BlockId b,
+                      size_t k) {
+    const FunctionCFG& fn = *caller.fn;
+    const auto& code = fn.blocks[b]->code;
+    const IROperand& target = code[k].inputs[0];
+    auto global = [&](const std::string& name) -> FunctionCFG* {
+        auto it = globals.find(name);
+        return it == globals.end() ? nullptr : it->second;
+    };
+    if (target.kind == IROperand::NAME) return {global(target.s.str()), -1};
+    if (target.kind != IROperand::VREG) return {};
+
+    int def = static_cast<int>(k) - 1;
+    while (def >= 0 && !(code[def].output && code[def].output->kind == IROperand::VREG &&
+                         code[def].output->i == target.i))
+        --def;
+    if (def < 0) return {};
+    const IRInstr& ir = code[def];
+    if (ir.inputs.empty()) return {};
+    const IROperand& x = ir.inputs[0];
+    switch (ir.op) {
+        case IROp::LoadGlobal:
+            return {x.kind == IROperand::NAME ? global(x.s.str()) : nullptr, def};
+        case IROp::LoadLocal:
+            if (x.kind == IROperand::NAME) {
+                // A name that is not the caller's own variable is a global.
+                if (local_slot(fn, x.s.str()) >= 0 || contains(fn.freeVars, x.s.str())) return {};
+                return {global(x.s.str()), def};
+            }
+            if (x.kind != IROperand::LOCAL) return {};
+            if (caller.is_root) {
+                const std::string& name = slot_name(fn, x.i);
+                return {contains(fn.names, name) ? global(name) : nullptr, def};
+            } else {
+                auto it = caller.closures.find(x.i);
+                if (it == caller.closures.end()) return {};
+                const ClosureBinding& s = it->second;
+                bool assigned = s.block == b ? s.index < static_cast<size_t>(def)
+                                             : caller.dom.dominates(s.block, b);
+                return {assigned ? s.fn : nullptr, def};
+            }
+        case IROp::AllocClosure:
+            return {closure_of(*caller.fn, ir), -1};
+        default:
+            return {};
+    }
+}
+
+struct CallGraph {
+    // Functions in bottom-up order: each after every function it calls,
+    // except within a cycle.
+    std::vector<FunctionCFG*> order;
+    std::unordered_map<FunctionCFG*, int> scc;
+    std::unordered_map<FunctionCFG*, bool> recursive;
+};
+
+CallGraph build_call_graph(const std::vector<FunctionCFG*>& funcs, const GlobalFunctions& globals) {
+    CallGraph cg;
+    std::unordered_map<FunctionCFG*, std::vector<FunctionCFG*>> edges;
+    for (auto* f : funcs) {
+        CallerInfo caller(*f, f == funcs.front());
+        for (size_t b = 0; b < f->blocks.size(); ++b) {
+            if (!f->blocks[b]) continue;
+            const auto& code = f->blocks[b]->code;
+            for (size_t k = 0; k < code.size(); ++k) {
+                if (code[k].op != IROp::Call || code[k].inputs.empty()) continue;
+                Callee callee = resolve_callee(caller, globals, static_cast<BlockId>(b), k);
+                if (callee.fn) edges[f].push_back(callee.fn);
             }
         }
     }
-    // Detect recursion via DFS for SCC.
+
+    // Tarjan's algorithm finishes each strongly connected component after
+    // every component it reaches, which is the bottom-up order.
     std::unordered_map<FunctionCFG*, int> index, lowlink;
     std::unordered_map<FunctionCFG*, bool> on_stack;
     std::vector<FunctionCFG*> stack;
     int idx = 0;
+    int scc_count = 0;
 
     std::function<void(FunctionCFG*)> strongconnect = [&](FunctionCFG* v) {
         index[v] = lowlink[v] = idx++;
         stack.push_back(v);
         on_stack[v] = true;
 
-        for (auto* w : cg.edges[v]) {
+        for (auto* w : edges[v]) {
             if (!index.count(w)) {
                 strongconnect(w);
                 lowlink[v] = std::min(lowlink[v], lowlink[w]);
@@ -190,354 +370,360 @@ CallGraph build_call_graph(const std::vector<FunctionCFG*>& funcs) {
         }
 
         if (lowlink[v] == index[v]) {
-            std::vector<FunctionCFG*> scc;
+            std::vector<FunctionCFG*> members;
             while (true) {
                 auto* w = stack.back();
                 stack.pop_back();
                 on_stack[w] = false;
-                scc.push_back(w);
+                members.push_back(w);
                 if (w == v) break;
             }
-            if (scc.size() > 1) {
-                for (auto* fn : scc) cg.recursive[fn] = true;
-            } else {
-                // Self-loop?
-                for (auto* tgt : cg.edges[v]) {
-                    if (tgt == v) cg.recursive[v] = true;
-                }
+            bool self_call = std::find(edges[v].begin(), edges[v].end(), v) != edges[v].end();
+            for (auto* fn : members) {
+                cg.scc[fn] = scc_count;
+                cg.recursive[fn] = members.size() > 1 || self_call;
+                cg.order.push_back(fn);
             }
+            ++scc_count;
         }
     };
 
     for (auto* f : funcs) {
         if (!index.count(f)) strongconnect(f);
     }
-
-    for (auto* f : funcs) {
-        if (!cg.recursive.count(f)) cg.recursive[f] = false;
-    }
     return cg;
 }
 
-bool should_inline(const FunctionCFG* callee,
-                   const CallGraph& cg,
-                   int max_inline_instructions) {
-    if (!callee) return false;
-    // Do not inline closures that capture free variables; we do not rewrite
-    // environments here.
-    if (!callee->freeVars.empty()) return false;
-    // Also skip functions that define nested functions/closures; inlining them
-    // would require remapping their children and environments.
-    if (!callee->children.empty()) return false;
-    if (cg.recursive.at(const_cast<FunctionCFG*>(callee))) return false;
-    // Only inline our vetted tiny helper used in hot loops.
-    return false;
-}
+struct CallSite {
+    BlockId block = -1;
+    size_t instr_index = 0;
+    FunctionCFG* callee = nullptr;
+    int depth = 0; // loops around the call
+    int size = 0;  // instructions in the callee
+};
 
-std::vector<CallSite> find_call_sites(const std::vector<FunctionCFG*>& funcs,
-                                      const CallGraph& cg,
-                                      int max_inline_instructions,
-                                      const std::unordered_map<std::string, FunctionCFG*>& global_name_map,
-                                      FunctionCFG* root) {
-    std::vector<CallSite> sites;
-    for (auto* caller : funcs) {
-        // Avoid inlining into the module/root function to keep top-level
-        // sequencing simple.
-        if (caller == root) continue;
-        // Function-wide best-effort mapping from vreg to callee function.
-        std::unordered_map<int, FunctionCFG*> func_vreg_callee;
-        for (const auto& blk_ptr : caller->blocks) {
-            if (!blk_ptr) continue;
-            for (const auto& ir : blk_ptr->code) {
-                if (!ir.output || ir.output->kind != IROperand::VREG) continue;
-                if (ir.op == IROp::AllocClosure &&
-                    !ir.inputs.empty() &&
-                    ir.inputs.back().kind == IROperand::CONSTI) {
-                    if (auto* c = lookup_child(*caller, ir.inputs.back().i)) {
-                        func_vreg_callee[ir.output->i] = c;
-                    }
-                } else if (ir.op == IROp::LoadGlobal &&
-                           !ir.inputs.empty() &&
-                           ir.inputs[0].kind == IROperand::NAME) {
-                    if (auto it = global_name_map.find(ir.inputs[0].s); it != global_name_map.end()) {
-                        func_vreg_callee[ir.output->i] = it->second;
-                    }
-                } else if (ir.op == IROp::LoadLocal &&
-                           !ir.inputs.empty() &&
-                           ir.inputs[0].kind == IROperand::NAME) {
-                    if (auto it = global_name_map.find(ir.inputs[0].s); it != global_name_map.end()) {
-                        func_vreg_callee[ir.output->i] = it->second;
-                    }
-                }
-            }
+class Inliner {
+public:
+    Inliner(FunctionCFG& caller, int& counter)
+        : caller_(caller), counter_(counter), next_vreg_(max_vreg_in_function(caller) + 1) {}
+
+    // Replaces the call at the site with the callee's body. `load` is the
+    // instruction that pushed the callee, which goes away with the call.
+    // Returns false, leaving the caller untouched, if the block's operand
+    // stack cannot be followed.
+    bool inline_call(const CallSite& site, int load) {
+        BasicBlock& blk = *caller_.blocks[site.block];
+        const size_t k = site.instr_index;
+        const IRInstr call = blk.code[k];
+        FunctionCFG& callee = *site.callee;
+        if (!call.output || call.output->kind != IROperand::VREG) return false;
+        const VReg result = call.output->i;
+
+        auto stack = stack_before(blk, k);
+        std::vector<VReg> operands;
+        for (const auto& in : call.inputs) {
+            if (in.kind == IROperand::VREG) operands.push_back(in.i);
+        }
+        if (!stack || stack->size() < operands.size() ||
+            !std::equal(operands.begin(), operands.end(), stack->end() - operands.size()))
+            return false;
+        std::vector<VReg> below(stack->begin(), stack->end() - operands.size());
+        const bool callee_on_stack = call.inputs[0].kind == IROperand::VREG;
+        if (callee_on_stack &&
+            std::count(stack->begin(), stack->end(), call.inputs[0].i) != 1)
+            load = -1;
+
+        auto blocks = emitted_blocks(callee);
+        const bool straight_line = blocks.size() == 1 &&
+                                   callee.blocks[callee.entry]->term.kind == Terminator::Kind::Return;
+        if (!straight_line) {
+            // The values under the call are renamed after it.
+            std::unordered_set<VReg> distinct(below.begin(), below.end());
+            if (distinct.size() != below.size()) return false;
         }
 
-        for (size_t bid = 0; bid < caller->blocks.size(); ++bid) {
-            auto& blk_ptr = caller->blocks[bid];
-            if (!blk_ptr) continue;
-            auto& blk = *blk_ptr;
-            std::unordered_map<int, FunctionCFG*> vreg_callee;
-            for (size_t i = 0; i < blk.code.size(); ++i) {
-                const auto& ir = blk.code[i];
-                // Track defs to resolve callee vregs.
-                if (ir.op == IROp::AllocClosure &&
-                    ir.output && ir.output->kind == IROperand::VREG &&
-                    !ir.inputs.empty() &&
-                    ir.inputs.back().kind == IROperand::CONSTI) {
-                    if (auto* callee = lookup_child(*caller, ir.inputs.back().i)) {
-                        vreg_callee[ir.output->i] = callee;
-                    }
-                } else if (ir.op == IROp::LoadGlobal &&
-                           ir.output && ir.output->kind == IROperand::VREG &&
-                           !ir.inputs.empty() &&
-                           ir.inputs[0].kind == IROperand::NAME) {
-                    if (auto it = global_name_map.find(ir.inputs[0].s); it != global_name_map.end()) {
-                        vreg_callee[ir.output->i] = it->second;
-                    }
-                }
+        prefix_ = "$inl" + std::to_string(counter_++) + "_";
+        offset_ = static_cast<int>(caller_.params.size() + caller_.locals.size());
+        for (const auto& p : callee.params) caller_.locals.push_back(prefix_ + p);
+        for (const auto& l : callee.locals) caller_.locals.push_back(prefix_ + l);
+        vmap_.clear();
+        callee_ = &callee;
+
+        // Parameters take the arguments from the top of the stack down.
+        std::vector<IRInstr> prologue;
+        for (size_t i = call.inputs.size() - 1; i >= 1; --i) {
+            prologue.push_back(IRInstr{
+                IROp::StoreLocal, {IROperand{IROperand::LOCAL, offset_ + static_cast<int>(i) - 1},
+                                   call.inputs[i]},
+                std::nullopt});
+        }
+        if (callee_on_stack && load < 0) prologue.push_back(IRInstr{IROp::Pop, {}, std::nullopt});
+        // Locals the body may read before assigning start out as None, as
+        // they would in a fresh frame.
+        auto liveness = compute_liveness(callee);
+        const auto& live = liveness.live_in[callee.entry].locals;
+        for (size_t l = callee.params.size(); l < live.size(); ++l) {
+            if (!live[l]) continue;
+            IROperand none{IROperand::VREG, next_vreg_++};
+            prologue.push_back(IRInstr{IROp::LoadConst, {IROperand{}}, none});
+            prologue.push_back(IRInstr{
+                IROp::StoreLocal, {IROperand{IROperand::LOCAL, offset_ + static_cast<int>(l)}, none},
+                std::nullopt});
+        }
 
-                if (ir.op != IROp::Call) continue;
-                if (ir.inputs.empty()) continue;
-                const auto& callee_op = ir.inputs[0];
-                FunctionCFG* callee = nullptr;
-                if (callee_op.kind == IROperand::CONSTI) {
-                    callee = lookup_callee_global(funcs, *caller, callee_op.i);
-                } else if (callee_op.kind == IROperand::NAME) {
-                    if (auto itn = global_name_map.find(callee_op.s); itn != global_name_map.end()) {
-                        callee = itn->second;
-                    }
-                } else if (callee_op.kind == IROperand::VREG) {
-                    if (auto it = vreg_callee.find(callee_op.i); it != vreg_callee.end()) {
-                        callee = it->second;
-                    } else if (auto it2 = func_vreg_callee.find(callee_op.i); it2 != func_vreg_callee.end()) {
-                        callee = it2->second;
-                    }
-                }
-                if (!callee) continue;
-                if (!should_inline(callee, cg, max_inline_instructions)) continue;
-                sites.push_back({caller, static_cast<BlockId>(bid), i, callee});
-            }
+        if (straight_line) {
+            const BasicBlock& body = *callee.blocks[callee.entry];
+            std::vector<IRInstr> code = std::move(prologue);
+            if (body.term.condition >= 0) vmap_[body.term.condition] = result;
+            for (const auto& ir : body.code) code.push_back(copy(ir));
+            if (body.term.condition < 0)
+                code.push_back(IRInstr{IROp::LoadConst, {IROperand{}}, call.output});
+            blk.code.erase(blk.code.begin() + k);
+            blk.code.insert(blk.code.begin() + k, code.begin(), code.end());
+        } else {
+            inline_blocks(site, blocks, std::move(prologue), below, result);
         }
+        if (load >= 0) blk.code.erase(blk.code.begin() + load);
+        return true;
     }
-    return sites;
-}
 
-int total_locals(const FunctionCFG& fn) {
-    return static_cast<int>(fn.params.size() + fn.locals.size());
-}
+private:
+    VReg map_vreg(VReg v) {
+        if (v < 0) return v;
+        auto [it, inserted] = vmap_.emplace(v, 0);
+        if (inserted) it->second = next_vreg_++;
+        return it->second;
+    }
 
-int append_locals(FunctionCFG& caller, const FunctionCFG& callee) {
-    int offset = total_locals(caller);
-    // Append params and locals as new locals in caller to reserve slots.
-    for (const auto& p : callee.params) caller.locals.push_back("inl_param_" + p);
-    for (const auto& l : callee.locals) caller.locals.push_back("inl_local_" + l);
-    // Propagate by-ref markers.
-    for (const auto& name : callee.byRefLocals) {
-        caller.byRefLocals.push_back("inl_" + name);
+    int new_local(const std::string& name) {
+        caller_.locals.push_back(prefix_ + name);
+        return static_cast<int>(caller_.params.size() + caller_.locals.size()) - 1;
     }
-    return offset;
-}
 
-void remap_operands(IRInstr& ir,
-                    const std::vector<int>& vmap,
-                    int local_offset) {
-    auto remap_op = [&](IROperand& op) {
-        if (op.kind == IROperand::VREG && op.i >= 0 && op.i < static_cast<int>(vmap.size())) {
-            op.i = vmap[op.i];
-        } else if (op.kind == IROperand::LOCAL) {
-            op.i += local_offset;
+    // A callee instruction as it reads in the caller. Free variables denote
+    // the same variables in the function that defines the callee: its own
+    // locals, or free variables it captured in turn. Other names are
+    // globals.
+    IRInstr copy(IRInstr ir) {
+        for (auto& x : ir.inputs) {
+            if (x.kind == IROperand::VREG) x.i = map_vreg(x.i);
+            else if (x.kind == IROperand::LOCAL) x.i += offset_;
         }
-    };
-    for (auto& in : ir.inputs) remap_op(in);
-    if (ir.output) remap_op(*ir.output);
-}
-
-} // namespace
-
-// Core inlining of a single call site inside caller.
-static void inline_call(FunctionCFG& caller, const CallSite& site) {
-    BasicBlock* call_blk = caller.blocks[site.block].get();
-    if (!call_blk) return;
-    if (site.instr_index >= call_blk->code.size()) return;
-    FunctionCFG& callee = *site.callee;
-
-    const IRInstr& call_ir = call_blk->code[site.instr_index];
-    int call_dst = (call_ir.output && call_ir.output->kind == IROperand::VREG)
-                       ? call_ir.output->i
-                       : -1;
-
-    // Gather return value vregs to map to call destination when possible.
-    std::unordered_set<int> returned;
-    for (const auto& blk_ptr : callee.blocks) {
-        if (!blk_ptr) continue;
-        const auto& term = blk_ptr->term;
-        if (term.kind == Terminator::Kind::Return && term.condition >= 0) {
-            returned.insert(term.condition);
+        if ((ir.op == IROp::LoadLocal || ir.op == IROp::StoreLocal) && !ir.inputs.empty() &&
+            ir.inputs[0].kind == IROperand::NAME) {
+            const std::string& name = ir.inputs[0].s.str();
+            if (contains(callee_->freeVars, name)) {
+                int slot = local_slot(caller_, name);
+                if (slot >= 0) ir.inputs[0] = IROperand{IROperand::LOCAL, slot};
+            } else {
+                ir.op = ir.op == IROp::LoadLocal ? IROp::LoadGlobal : IROp::StoreGlobal;
+            }
         }
+        if (ir.output && ir.output->kind == IROperand::VREG)
+            ir.output->i = map_vreg(ir.output->i);
+        return ir;
     }
 
-    int callee_vregs = max_vreg_in_function(callee) + 1;
-    int next_vreg = max_vreg_in_function(caller) + 1;
-
-    std::vector<int> vmap(callee_vregs, -1);
-    for (int i = 0; i < callee_vregs; ++i) {
-        if (call_dst >= 0 && returned.count(i)) {
-            vmap[i] = call_dst;
-        } else {
-            vmap[i] = next_vreg++;
+    // Splits the call's block after the call, which becomes a jump into a
+    // copy of the callee's blocks. The operand stack must be empty between
+    // blocks, so the values under the call are saved in locals around the
+    // body, and its returns store the result in a local and jump to the
+    // rest of the block.
+    void inline_blocks(const CallSite& site, const std::vector<BlockId>& blocks,
+                       std::vector<IRInstr> prologue, const std::vector<VReg>& below, VReg result) {
+        const FunctionCFG& callee = *callee_;
+        std::vector<int> saved;
+        for (size_t j = 0; j < below.size(); ++j) {
+            std::string name = "s";
+            name += std::to_string(j);
+            saved.push_back(new_local(name));
+        }
+        for (size_t j = below.size(); j-- > 0;) {
+            prologue.push_back(IRInstr{
+                IROp::StoreLocal, {IROperand{IROperand::LOCAL, saved[j]}, IROperand{IROperand::VREG, below[j]}},
+                std::nullopt});
+        }
+        const int ret = new_local("ret");
+
+        BasicBlock& blk = *caller_.blocks[site.block];
+        auto cont = std::make_unique<BasicBlock>();
+        cont->id = static_cast<BlockId>(caller_.blocks.size());
+        std::unordered_map<VReg, VReg> renamed;
+        for (size_t j = 0; j < below.size(); ++j) {
+            VReg v = next_vreg_++;
+            renamed[below[j]] = v;
+            cont->code.push_back(IRInstr{IROp::LoadLocal, {IROperand{IROperand::LOCAL, saved[j]}},
+                                         IROperand{IROperand::VREG, v}});
+        }
+        cont->code.push_back(IRInstr{IROp::LoadLocal, {IROperand{IROperand::LOCAL, ret}},
+                                     IROperand{IROperand::VREG, result}});
+        auto rename = [&](VReg v) {
+            auto it = renamed.find(v);
+            return it == renamed.end() ? v : it->second;
+        };
+        for (size_t i = site.instr_index + 1; i < blk.code.size(); ++i) {
+            IRInstr ir = blk.code[i];
+            for (auto& x : ir.inputs) {
+                if (x.kind == IROperand::VREG) x.i = rename(x.i);
+            }
+            cont->code.push_back(std::move(ir));
+        }
+        cont->term = blk.term;
+        cont->term.condition = rename(cont->term.condition);
+        cont->successors = blk.successors;
+        for (BlockId s : cont->successors) {
+            if (s < 0 || s >= static_cast<BlockId>(caller_.blocks.size()) || !caller_.blocks[s]) continue;
+            auto& preds = caller_.blocks[s]->predecessors;
+            std::replace(preds.begin(), preds.end(), site.block, cont->id);
+        }
+        const BlockId cont_id = cont->id;
+        caller_.blocks.push_back(std::move(cont));
+
+        std::unordered_map<BlockId, BlockId> copy_of;
+        for (BlockId b : blocks) {
+            auto clone = std::make_unique<BasicBlock>();
+            clone->id = static_cast<BlockId>(caller_.blocks.size());
+            copy_of[b] = clone->id;
+            caller_.blocks.push_back(std::move(clone));
+        }
+        for (BlockId b : blocks) {
+            const BasicBlock& orig = *callee.blocks[b];
+            BasicBlock& clone = *caller_.blocks[copy_of[b]];
+            for (const auto& ir : orig.code) clone.code.push_back(copy(ir));
+            Terminator term = orig.term;
+            switch (term.kind) {
+                case Terminator::Kind::Jump:
+                    term.target = copy_of[term.target];
+                    clone.successors = {term.target};
+                    break;
+                case Terminator::Kind::CondJump:
+                    term.condition = map_vreg(term.condition);
+                    term.trueTarget = copy_of[term.trueTarget];
+                    term.falseTarget = copy_of[term.falseTarget];
+                    clone.successors = {term.trueTarget, term.falseTarget};
+                    break;
+                case Terminator::Kind::Return: {
+                    IROperand value{IROperand::VREG, map_vreg(term.condition)};
+                    if (term.condition < 0) {
+                        value.i = next_vreg_++;
+                        clone.code.push_back(IRInstr{IROp::LoadConst, {IROperand{}}, value});
+                    }
+                    clone.code.push_back(IRInstr{
+                        IROp::StoreLocal, {IROperand{IROperand::LOCAL, ret}, value}, std::nullopt});
+                    term = Terminator{Terminator::Kind::Jump, cont_id};
+                    clone.successors = {cont_id};
+                    break;
+                }
+            }
+            clone.term = term;
+        }
+        for (BlockId b : blocks) {
+            BlockId c = copy_of[b];
+            for (BlockId s : caller_.blocks[c]->successors) caller_.blocks[s]->predecessors.push_back(c);
         }
-    }
 
-    // Create new local slots for callee locals/params.
-    int local_offset = append_locals(caller, callee);
-
-    // Split caller block at call site.
-    auto cont_blk = std::make_unique<BasicBlock>();
-    cont_blk->id = static_cast<int>(caller.blocks.size());
-    // Copy instructions after call into continuation block.
-    cont_blk->code.assign(call_blk->code.begin() + site.instr_index + 1, call_blk->code.end());
-    cont_blk->term = call_blk->term;
-    cont_blk->successors = call_blk->successors;
-    cont_blk->predecessors.clear(); // Will rebuild.
-    cont_blk->post_return = call_blk->post_return;
-
-    // New terminator for call block: jump to inlined entry.
-    call_blk->code.erase(call_blk->code.begin() + site.instr_index, call_blk->code.end());
-    call_blk->term.kind = Terminator::Kind::Jump;
-    call_blk->term.target = -1; // fill later
-    call_blk->term.condition = -1;
-    call_blk->term.trueTarget = call_blk->term.falseTarget = -1;
-    call_blk->successors.clear();
-
-    // Fix predecessors of original successors to point to cont block.
-    for (auto succ : cont_blk->successors) {
-        if (succ < 0 || succ >= static_cast<BlockId>(caller.blocks.size())) continue;
-        auto* succ_blk = caller.blocks[succ].get();
-        if (!succ_blk) continue;
-        std::replace(succ_blk->predecessors.begin(), succ_blk->predecessors.end(),
-                     site.block, cont_blk->id);
+        BasicBlock& call_blk = *caller_.blocks[site.block];
+        call_blk.code.resize(site.instr_index);
+        call_blk.code.insert(call_blk.code.end(), prologue.begin(), prologue.end());
+        BlockId entry = copy_of[callee.entry];
+        call_blk.term = Terminator{Terminator::Kind::Jump, entry};
+        call_blk.successors = {entry};
+        caller_.blocks[entry]->predecessors.push_back(site.block);
     }
 
-    // Insert continuation block into caller.
-    caller.blocks.push_back(std::move(cont_blk));
-    BasicBlock* cont_ptr = caller.blocks.back().get();
+    FunctionCFG& caller_;
+    int& counter_;
+    VReg next_vreg_;
+    const FunctionCFG* callee_ = nullptr;
+    std::string prefix_;
+    int offset_ = 0;
+    std::unordered_map<VReg, VReg> vmap_;
+};
 
-    // Clone callee blocks.
-    std::unordered_map<BlockId, BasicBlock*> block_map;
-    for (const auto& blk_ptr : callee.blocks) {
-        if (!blk_ptr) continue;
-        auto clone = std::make_unique<BasicBlock>();
-        clone->id = static_cast<int>(caller.blocks.size());
-        clone->post_return = false;
-        block_map[blk_ptr->id] = clone.get();
-        caller.blocks.push_back(std::move(clone));
+void inline_into(FunctionCFG& fn, bool is_root, const CallGraph& cg, const GlobalFunctions& globals,
+                 const InlineConfig& cfg, int& counter) {
+    CallerInfo caller(fn, is_root);
+    std::vector<int> depth(fn.blocks.size(), 0);
+    for (const auto& loop : find_loops(fn, caller.dom)) {
+        for (BlockId b : loop.blocks) ++depth[b];
     }
 
-    // Synthetic exit block inside caller for the inlined callee.
-    auto exit_clone = std::make_unique<BasicBlock>();
-    int exit_id = static_cast<int>(caller.blocks.size());
-    exit_clone->id = exit_id;
-    caller.blocks.push_back(std::move(exit_clone));
-
-    // Populate cloned blocks.
-    for (const auto& blk_ptr : callee.blocks) {
-        if (!blk_ptr) continue;
-        BasicBlock* clone = block_map[blk_ptr->id];
-        // Clone instructions with operand remapping.
-        for (auto ir : blk_ptr->code) {
-            remap_operands(ir, vmap, local_offset);
-            clone->code.push_back(std::move(ir));
-        }
-
-        // Clone terminator.
-        Terminator term = blk_ptr->term;
-        auto map_target = [&](BlockId t) -> BlockId {
-            auto it = block_map.find(t);
-            if (it != block_map.end() && it->second) return it->second->id;
-            return exit_id;
-        };
-        switch (term.kind) {
-            case Terminator::Kind::Jump:
-                term.target = map_target(term.target);
-                clone->successors = {term.target};
-                break;
-            case Terminator::Kind::CondJump:
-                if (term.condition >= 0 && term.condition < static_cast<int>(vmap.size()))
-                    term.condition = vmap[term.condition];
-                term.trueTarget = map_target(term.trueTarget);
-                term.falseTarget = map_target(term.falseTarget);
-                clone->successors = {term.trueTarget, term.falseTarget};
-                break;
-            case Terminator::Kind::Return:
-                if (term.condition >= 0 && term.condition < static_cast<int>(vmap.size()))
-                    term.condition = vmap[term.condition];
-                term.kind = Terminator::Kind::Jump;
-                term.target = exit_id;
-                term.condition = -1;
-                term.trueTarget = term.falseTarget = -1;
-                clone->successors = {exit_id};
-                break;
+    struct Candidate {
+        CallSite site;
+        int load;
+    };
+    std::vector<Candidate> candidates;
+    std::unordered_map<FunctionCFG*, bool> inlinable;
+    for (BlockId b : caller.dom.rpo) {
+        if (fn.blocks[b]->post_return) continue;
+        const auto& code = fn.blocks[b]->code;
+        for (size_t k = 0; k < code.size(); ++k) {
+            if (code[k].op != IROp::Call || code[k].inputs.empty()) continue;
+            Callee callee = resolve_callee(caller, globals, b, k);
+            FunctionCFG* f = callee.fn;
+            if (!f || cg.recursive.at(f) || cg.scc.at(f) == cg.scc.at(&fn)) continue;
+            if (code[k].inputs.size() - 1 != f->params.size()) continue; // stays an error
+            bool args_on_stack = std::all_of(code[k].inputs.begin() + 1, code[k].inputs.end(),
+                                             [](const IROperand& x) { return x.kind == IROperand::VREG; });
+            if (!args_on_stack) continue;
+            // Free variables are only meaningful in the defining function.
+            if (!f->freeVars.empty() &&
+                std::none_of(fn.children.begin(), fn.children.end(),
+                             [&](const auto& c) { return c.get() == f; }))
+                continue;
+            auto it = inlinable.find(f);
+            if (it == inlinable.end()) it = inlinable.emplace(f, inlinable_body(*f)).first;
+            if (!it->second) continue;
+            int size = instruction_count(*f);
+            int limit = std::min(cfg.max_inline_instructions,
+                                 cfg.base_inline_instructions + cfg.loop_depth_bonus * depth[b]);
+            if (size > limit) continue;
+            candidates.push_back({CallSite{b, k, f, depth[b], size}, callee.load});
         }
-        clone->term = term;
     }
-
-    // Wire predecessors for cloned blocks.
-    for (const auto& blk_ptr : callee.blocks) {
-        if (!blk_ptr) continue;
-        BasicBlock* clone = block_map[blk_ptr->id];
-        for (auto succ : clone->successors) {
-            if (succ == exit_id) {
-                caller.blocks[exit_id]->predecessors.push_back(clone->id);
-            } else {
-                auto* succ_blk = caller.blocks[succ].get();
-                succ_blk->predecessors.push_back(clone->id);
-            }
-        }
+    if (candidates.empty()) return;
+
+    // Hottest and cheapest first, within the growth budget.
+    std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        if (a.site.depth != b.site.depth) return a.site.depth > b.site.depth;
+        return a.site.size < b.site.size;
+    });
+    int budget = instruction_count(fn) * cfg.growth_percent / 100 + cfg.growth_slack;
+    std::vector<Candidate> chosen;
+    for (const auto& c : candidates) {
+        if (c.site.size > budget) continue;
+        budget -= c.site.size;
+        chosen.push_back(c);
     }
 
-    // Fill exit block: jump to continuation, assign predecessors.
-    auto* exit_blk = caller.blocks[exit_id].get();
-    exit_blk->term.kind = Terminator::Kind::Jump;
-    exit_blk->term.target = cont_ptr->id;
-    exit_blk->successors = {cont_ptr->id};
-    cont_ptr->predecessors.push_back(exit_id);
-
-    // Set entry jump target and predecessor.
-    BasicBlock* entry_clone = block_map[callee.entry];
-    call_blk->term.target = entry_clone->id;
-    call_blk->successors = {entry_clone->id};
-    entry_clone->predecessors.push_back(call_blk->id);
-
-    // Initialize parameters: insert stores from caller args into mapped local slots.
-    int arg_offset = 1; // first input is callee id
-    int param_count = static_cast<int>(callee.params.size());
-    std::vector<IRInstr> prologue;
-    for (int i = 0; i < param_count && arg_offset + i < static_cast<int>(call_ir.inputs.size()); ++i) {
-        const auto& arg = call_ir.inputs[arg_offset + i];
-        IROperand dst{IROperand::LOCAL, local_offset + i};
-        IROperand src = arg;
-        if (src.kind == IROperand::VREG && src.i >= 0 && src.i < static_cast<int>(vmap.size())) {
-            // Argument lives in caller; leave as-is.
+    // Later calls in a block first: inlining a call only changes the code
+    // from the call on, and from the instruction that loaded its callee.
+    std::sort(chosen.begin(), chosen.end(), [](const Candidate& a, const Candidate& b) {
+        if (a.site.block != b.site.block) return a.site.block < b.site.block;
+        return a.site.instr_index > b.site.instr_index;
+    });
+    Inliner inliner(fn, counter);
+    for (size_t i = 0; i < chosen.size(); ++i) {
+        const Candidate& c = chosen[i];
+        if (!inliner.inline_call(c.site, c.load) || c.load < 0) continue;
+        for (size_t j = i + 1; j < chosen.size() && chosen[j].site.block == c.site.block; ++j) {
+            auto& later = chosen[j];
+            if (later.site.instr_index > static_cast<size_t>(c.load)) --later.site.instr_index;
+            if (later.load > c.load) --later.load;
         }
-        prologue.push_back(IRInstr{IROp::StoreLocal, {dst, src}, std::nullopt});
     }
-    // Prepend prologue to entry clone.
-    entry_clone->code.insert(entry_clone->code.begin(), prologue.begin(), prologue.end());
 }
 
+} // namespace
+
 void run_inlining_pass(FunctionCFG& root, const InlineConfig& cfg) {
     std::vector<FunctionCFG*> funcs;
     collect_functions(root, funcs);
-    auto cg = build_call_graph(funcs);
-    // Build global name -> func map from module/root for resolving LoadGlobal callees.
-    auto global_name_map = funcs.empty() ? std::unordered_map<std::string, FunctionCFG*>{}
-                                         : build_global_func_map(*funcs.front(), funcs);
-
-    FunctionCFG* module = funcs.empty() ? nullptr : funcs.front();
-    auto sites = find_call_sites(funcs, cg, cfg.max_inline_instructions, global_name_map, module);
-    // Inline in a stable order.
-    for (const auto& site : sites) {
-        inline_call(*site.caller, site);
+    auto globals = single_assignment_globals(root, funcs);
+    auto cg = build_call_graph(funcs, globals);
+    int counter = 0;
+    for (FunctionCFG* fn : cg.order) {
+        inline_into(*fn, fn == &root, cg, globals, cfg, counter);
     }
 }
 
@@ -5,11 +5,31 @@
 
 namespace mitscript::analysis {
 
+// Cost model for the inliner. A call site outside loops inlines callees of
+// up to base_inline_instructions; each enclosing loop allows
+// loop_depth_bonus more, up to max_inline_instructions. Each function may
+// grow by growth_percent of its own size plus growth_slack instructions.
 struct InlineConfig {
     int max_inline_instructions = 40;
+    int base_inline_instructions = 12;
+    int loop_depth_bonus = 14;
+    int growth_percent = 100;
+    int growth_slack = 64;
 };
 
-// Run module-level inlining starting from the toplevel function.
+// Bottom-up inlining over the module's call graph.
+//
+// A call's callee is known when it is read from a global the program
+// assigns exactly once, from a function literal, before the module makes
+// its first call; or from a local of the caller assigned exactly once, from
+// a closure the caller defines, at a point dominating the call. Callees
+// that define functions themselves or are part of a recursive cycle are
+// never inlined. Functions are processed callees first, so a callee's own
+// calls are already inlined when it is copied into its callers.
+//
+// A closure inlined into the function that defines it reads its free
+// variables as the caller's own locals. Each inlined call gets fresh locals
+// for the callee's parameters and locals.
 void run_inlining_pass(mitscript::CFG::FunctionCFG& root, const InlineConfig& cfg = {});
 
 } // namespace mitscript::analysis
@@ -0,0 +1,279 @@
+#include "licm.hpp"
+
+#include "gvn.hpp"
+#include "loops.hpp"
+#include "ssa.hpp"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace mitscript::CFG;
+
+namespace mitscript::analysis {
+
+namespace {
+
+// Peeling copies the loop body, so large loops are left alone.
+constexpr size_t kMaxPeelInstrs = 256;
+// Smallest operand tree worth a temporary.
+constexpr int kMinTreeInstrs = 2;
+
+struct Hoist {
+    BlockId block;
+    int start;
+    int root;
+};
+
+// What the instructions of a loop may write.
+class LoopEffects {
+public:
+    LoopEffects(const FunctionCFG& fn, const Loop& loop, const std::vector<char>& private_slots)
+        : fn_(fn), private_(private_slots) {
+        for (BlockId b : loop.blocks) {
+            for (const auto& ir : fn.blocks[b]->code) {
+                switch (ir.op) {
+                    case IROp::Call:
+                        has_call_ = true;
+                        break;
+                    case IROp::StoreLocal:
+                        if (ir.inputs.empty()) break;
+                        if (is_private(ir.inputs[0])) {
+                            stored_slots_.insert(ir.inputs[0].i);
+                        } else {
+                            stored_names_.insert(name_of(ir.inputs[0]));
+                        }
+                        break;
+                    case IROp::StoreGlobal:
+                        if (!ir.inputs.empty()) stored_names_.insert(ir.inputs[0].s.str());
+                        break;
+                    case IROp::StoreField:
+                        for (const auto& in : ir.inputs) {
+                            if (in.kind == IROperand::NAME) stored_fields_.insert(in.s.str());
+                        }
+                        break;
+                    case IROp::StoreIndex:
+                        has_store_index_ = true;
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+    }
+
+    // Whether ir reads only what the loop leaves unchanged (its stack
+    // operands aside).
+    bool invariant(const IRInstr& ir) const {
+        switch (ir.op) {
+            case IROp::LoadConst:
+            case IROp::Neg:
+            case IROp::Not:
+                return true;
+            case IROp::LoadLocal:
+                if (ir.inputs.empty()) return false;
+                if (is_private(ir.inputs[0])) return !stored_slots_.count(ir.inputs[0].i);
+                return !has_call_ && !stored_names_.count(name_of(ir.inputs[0]));
+            case IROp::LoadGlobal:
+                return !ir.inputs.empty() && !has_call_ && !stored_names_.count(ir.inputs[0].s.str());
+            case IROp::LoadField:
+                return ir.inputs.size() == 2 && !has_call_ && !has_store_index_ &&
+                       !stored_fields_.count(ir.inputs[1].s.str());
+            case IROp::LoadIndex:
+                return !has_call_ && !has_store_index_ && stored_fields_.empty();
+            case IROp::Add: case IROp::Sub: case IROp::Mul: case IROp::Div:
+            case IROp::CmpEq: case IROp::CmpLt: case IROp::CmpGt:
+            case IROp::CmpLe: case IROp::CmpGe: case IROp::And: case IROp::Or:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+private:
+    bool is_private(const IROperand& x) const {
+        return x.kind == IROperand::LOCAL && x.i >= 0 &&
+               x.i < static_cast<int>(private_.size()) && private_[x.i];
+    }
+
+    // Shared variables are tracked by name: at module scope a LOCAL slot
+    // and a NAME can denote the same global.
+    const std::string& name_of(const IROperand& x) const {
+        if (x.kind != IROperand::LOCAL || x.i < 0) return x.s.str();
+        size_t i = static_cast<size_t>(x.i);
+        return i < fn_.params.size() ? fn_.params[i] : fn_.locals[i - fn_.params.size()];
+    }
+
+    const FunctionCFG& fn_;
+    const std::vector<char>& private_;
+    bool has_call_ = false;
+    bool has_store_index_ = false;
+    std::unordered_set<int> stored_slots_;
+    std::unordered_set<std::string> stored_names_;
+    std::unordered_set<std::string> stored_fields_;
+};
+
+int max_vreg(const FunctionCFG& fn) {
+    int max_v = -1;
+    for (const auto& blk : fn.blocks) {
+        if (!blk) continue;
+        max_v = std::max(max_v, blk->term.condition);
+        for (const auto& ir : blk->code) {
+            if (ir.output && ir.output->kind == IROperand::VREG) max_v = std::max(max_v, ir.output->i);
+            for (const auto& in : ir.inputs) {
+                if (in.kind == IROperand::VREG) max_v = std::max(max_v, in.i);
+            }
+        }
+    }
+    return max_v;
+}
+
+// Copies the loop's blocks and routes the preheader into the copy, whose
+// back edges lead to the original header. Returns the copy of each block.
+std::unordered_map<BlockId, BlockId> peel_first_iteration(FunctionCFG& fn, const Loop& loop,
+                                                          BlockId preheader, VReg& next_vreg) {
+    std::unordered_map<BlockId, BlockId> copy_of;
+    for (BlockId b : loop.blocks) {
+        auto blk = std::make_unique<BasicBlock>();
+        blk->id = static_cast<BlockId>(fn.blocks.size());
+        copy_of[b] = blk->id;
+        fn.blocks.push_back(std::move(blk));
+    }
+    auto target = [&](BlockId b) {
+        auto it = copy_of.find(b);
+        return (it == copy_of.end() || b == loop.header) ? b : it->second;
+    };
+
+    std::unordered_map<VReg, VReg> vreg_of;
+    auto rename = [&](VReg v) {
+        if (v < 0) return v;
+        auto it = vreg_of.find(v);
+        return it == vreg_of.end() ? v : it->second;
+    };
+
+    for (BlockId b : loop.blocks) {
+        const BasicBlock& orig = *fn.blocks[b];
+        BasicBlock& copy = *fn.blocks[copy_of[b]];
+        copy.code = orig.code;
+        for (auto& ir : copy.code) {
+            for (auto& in : ir.inputs) {
+                if (in.kind == IROperand::VREG) in.i = rename(in.i);
+            }
+            if (ir.output && ir.output->kind == IROperand::VREG) {
+                VReg fresh = next_vreg++;
+                vreg_of[ir.output->i] = fresh;
+                ir.output->i = fresh;
+            }
+        }
+        copy.term = orig.term;
+        copy.term.condition = rename(copy.term.condition);
+        copy.term.target = copy.term.target >= 0 ? target(copy.term.target) : -1;
+        copy.term.trueTarget = copy.term.trueTarget >= 0 ? target(copy.term.trueTarget) : -1;
+        copy.term.falseTarget = copy.term.falseTarget >= 0 ? target(copy.term.falseTarget) : -1;
+        copy.post_return = orig.post_return;
+        for (BlockId s : orig.successors) copy.successors.push_back(target(s));
+        if (b == loop.header) {
+            copy.predecessors.push_back(preheader);
+        } else {
+            for (BlockId p : orig.predecessors) {
+                if (loop.contains(p)) copy.predecessors.push_back(copy_of[p]);
+            }
+        }
+    }
+
+    // Edges leaving the copy: to the original header and out of the loop.
+    for (BlockId b : loop.blocks) {
+        BlockId c = copy_of[b];
+        for (BlockId s : fn.blocks[c]->successors) {
+            if (s >= 0 && s < static_cast<BlockId>(fn.blocks.size()) &&
+                (s == loop.header || !loop.contains(s)))
+                fn.blocks[s]->predecessors.push_back(c);
+        }
+    }
+
+    BasicBlock& pre = *fn.blocks[preheader];
+    BlockId header_copy = copy_of[loop.header];
+    pre.term.target = header_copy;
+    std::replace(pre.successors.begin(), pre.successors.end(), loop.header, header_copy);
+    auto& header_preds = fn.blocks[loop.header]->predecessors;
+    header_preds.erase(std::remove(header_preds.begin(), header_preds.end(), preheader),
+                       header_preds.end());
+    return copy_of;
+}
+
+void hoist_loop(FunctionCFG& fn, const DominatorTree& dom, const Loop& loop,
+                const std::vector<char>& private_slots, VReg& next_vreg, int& temp_count) {
+    BlockId preheader = find_preheader(fn, dom, loop);
+    if (preheader < 0) return;
+    size_t size = 0;
+    for (BlockId b : loop.blocks) size += fn.blocks[b]->code.size();
+    if (size > kMaxPeelInstrs) return;
+
+    LoopEffects effects(fn, loop, private_slots);
+    std::vector<Hoist> hoists;
+    for (BlockId b : loop.blocks) {
+        // Only blocks that run on every iteration are sure to have set the
+        // temporary in the peeled one.
+        bool every_iteration = std::all_of(loop.latches.begin(), loop.latches.end(),
+                                           [&](BlockId l) { return dom.dominates(b, l); });
+        if (!every_iteration) continue;
+
+        const auto& code = fn.blocks[b]->code;
+        auto starts = pure_tree_starts(*fn.blocks[b]);
+        for (int k = static_cast<int>(code.size()) - 1; k >= 0; --k) {
+            int start = starts[k];
+            if (start < 0 || k - start + 1 < kMinTreeInstrs || !code[k].output) continue;
+            bool invariant = std::all_of(code.begin() + start, code.begin() + k + 1,
+                                         [&](const IRInstr& ir) { return effects.invariant(ir); });
+            if (!invariant) continue;
+            hoists.push_back({b, start, k});
+            k = start;
+        }
+    }
+    if (hoists.empty()) return;
+
+    auto copy_of = peel_first_iteration(fn, loop, preheader, next_vreg);
+
+    // Hoists are in descending order within each block, so earlier edits
+    // leave the later indices valid.
+    for (const auto& h : hoists) {
+        int temp = static_cast<int>(fn.params.size() + fn.locals.size());
+        fn.locals.push_back("$licm" + std::to_string(temp_count++));
+
+        auto& peeled = fn.blocks[copy_of[h.block]]->code;
+        IROperand value = *peeled[h.root].output;
+        peeled.insert(peeled.begin() + h.root + 1,
+                      {IRInstr{IROp::Dup, {}, std::nullopt},
+                       IRInstr{IROp::StoreLocal, {IROperand{IROperand::LOCAL, temp}, value},
+                               std::nullopt}});
+
+        auto& code = fn.blocks[h.block]->code;
+        IRInstr load{IROp::LoadLocal, {IROperand{IROperand::LOCAL, temp}}, code[h.root].output};
+        code.erase(code.begin() + h.start, code.begin() + h.root + 1);
+        code.insert(code.begin() + h.start, std::move(load));
+    }
+}
+
+} // namespace
+
+void run_licm_on_function(FunctionCFG& fn, bool is_toplevel, bool recursive) {
+    for (auto& child : fn.children) {
+        if (child && recursive) run_licm_on_function(*child, false);
+    }
+    if (fn.blocks.empty()) return;
+
+    DominatorTree dom = compute_dominators(fn);
+    auto loops = find_loops(fn, dom);
+    auto private_slots = private_locals(fn, is_toplevel);
+    VReg next_vreg = max_vreg(fn) + 1;
+    int temp_count = 0;
+    // Innermost loops share no blocks, so each can be peeled using the
+    // dominator tree of the original function.
+    for (const auto& loop : loops) {
+        if (loop.innermost) hoist_loop(fn, dom, loop, private_slots, next_vreg, temp_count);
+    }
+}
+
+} // namespace mitscript::analysis
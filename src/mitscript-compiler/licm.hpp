@@ -0,0 +1,28 @@
+#pragma once
+
+#include "cfg.hpp"
+
+namespace mitscript::analysis {
+
+// Loop-invariant code motion over innermost loops (see loops.hpp).
+//
+// An operand tree is invariant when nothing in the loop can change its
+// inputs: constants, locals the loop never stores, and -- in loops without
+// calls -- globals and free variables it never stores, and field and index
+// loads no store in the loop can alias (a StoreField only aliases loads of
+// the same field; a StoreIndex aliases every field and index load).
+//
+// Hoisting such a tree into the preheader would evaluate it even when the
+// loop runs zero times, and MITScript loads and arithmetic raise errors on
+// bad operands, so the tree cannot simply be moved. Instead the loop's
+// first iteration is peeled into the preheader's path: the copy computes
+// each invariant tree as before and saves it in a temporary, and the loop
+// proper, which only runs after a complete first iteration, reads the
+// temporary. Only trees in blocks that run on every iteration qualify, so
+// the temporary is always set.
+//
+// Nested functions are processed too unless `recursive` is false.
+void run_licm_on_function(mitscript::CFG::FunctionCFG& fn, bool is_toplevel = true,
+                          bool recursive = true);
+
+} // namespace mitscript::analysis
@@ -0,0 +1,88 @@
+#include "loops.hpp"
+
+#include <algorithm>
+
+using namespace mitscript::CFG;
+
+namespace mitscript::analysis {
+
+bool Loop::contains(BlockId b) const {
+    return std::find(blocks.begin(), blocks.end(), b) != blocks.end();
+}
+
+std::vector<Loop> find_loops(const FunctionCFG& fn, const DominatorTree& dom) {
+    std::vector<Loop> loops;
+    std::vector<int> loop_of_header(fn.blocks.size(), -1);
+
+    for (BlockId b : dom.rpo) {
+        for (BlockId h : fn.blocks[b]->successors) {
+            if (h < 0 || h >= static_cast<BlockId>(fn.blocks.size()) || !dom.reachable[h] ||
+                !dom.dominates(h, b))
+                continue;
+            if (loop_of_header[h] < 0) {
+                loop_of_header[h] = static_cast<int>(loops.size());
+                loops.push_back(Loop{h, {h}, {}});
+            }
+            loops[loop_of_header[h]].latches.push_back(b);
+        }
+    }
+
+    // Walk back from each latch to the header.
+    std::vector<char> in_loop(fn.blocks.size());
+    for (auto& loop : loops) {
+        std::fill(in_loop.begin(), in_loop.end(), 0);
+        in_loop[loop.header] = 1;
+        std::vector<BlockId> work;
+        for (BlockId l : loop.latches) {
+            if (!in_loop[l]) {
+                in_loop[l] = 1;
+                loop.blocks.push_back(l);
+                work.push_back(l);
+            }
+        }
+        while (!work.empty()) {
+            BlockId b = work.back();
+            work.pop_back();
+            for (BlockId p : fn.blocks[b]->predecessors) {
+                if (p < 0 || p >= static_cast<BlockId>(fn.blocks.size()) || !dom.reachable[p] ||
+                    in_loop[p])
+                    continue;
+                in_loop[p] = 1;
+                loop.blocks.push_back(p);
+                work.push_back(p);
+            }
+        }
+    }
+
+    // A loop strictly contains every loop whose header it contains.
+    std::stable_sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) {
+        return a.blocks.size() > b.blocks.size();
+    });
+    for (size_t i = 0; i < loops.size(); ++i) {
+        for (size_t j = i; j-- > 0;) {
+            if (loops[j].contains(loops[i].header)) {
+                loops[i].parent = static_cast<int>(j);
+                loops[j].innermost = false;
+                break;
+            }
+        }
+    }
+    return loops;
+}
+
+BlockId find_preheader(const FunctionCFG& fn, const DominatorTree& dom, const Loop& loop) {
+    BlockId preheader = -1;
+    for (BlockId p : fn.blocks[loop.header]->predecessors) {
+        // Blocks added since dom was computed are entries too.
+        if (p >= static_cast<BlockId>(dom.reachable.size())) return -1;
+        if (p < 0 || !dom.reachable[p] || loop.contains(p)) continue;
+        if (preheader >= 0 && preheader != p) return -1;
+        preheader = p;
+    }
+    if (preheader < 0) return -1;
+    const BasicBlock& blk = *fn.blocks[preheader];
+    if (blk.term.kind != Terminator::Kind::Jump || blk.term.target != loop.header) return -1;
+    return preheader;
+}
+
+} // namespace mitscript::analysis
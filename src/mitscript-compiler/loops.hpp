@@ -0,0 +1,33 @@
+#pragma once
+
+#include "cfg.hpp"
+#include "ssa.hpp"
+#include <vector>
+
+namespace mitscript::analysis {
+
+// A natural loop: the header and every block that reaches one of its back
+// edges (an edge into the header from a block the header dominates)
+// without passing through the header. Back edges sharing a header form one
+// loop.
+struct Loop {
+    mitscript::CFG::BlockId header;
+    std::vector<mitscript::CFG::BlockId> blocks;   // header first
+    std::vector<mitscript::CFG::BlockId> latches;  // sources of the back edges
+    int parent = -1;                               // innermost enclosing loop
+    bool innermost = true;
+
+    bool contains(mitscript::CFG::BlockId b) const;
+};
+
+// Loops over the blocks dom covers, outer loops before the loops they
+// contain.
+std::vector<Loop> find_loops(const mitscript::CFG::FunctionCFG& fn, const DominatorTree& dom);
+
+// The block a loop is entered from: the header's only predecessor outside
+// the loop, provided it jumps nowhere else. -1 if there is none, in which
+// case the loop has no preheader to hoist into.
+mitscript::CFG::BlockId find_preheader(const mitscript::CFG::FunctionCFG& fn,
+                                       const DominatorTree& dom, const Loop& loop);
+
+} // namespace mitscript::analysis
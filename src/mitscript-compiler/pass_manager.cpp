@@ -0,0 +1,317 @@
+#include "pass_manager.hpp"
+
+#include "constant-propagation.hpp"
+#include "dce.hpp"
+#include "escape.hpp"
+#include "gvn.hpp"
+#include "induction.hpp"
+#include "licm.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+using namespace mitscript::CFG;
+
+namespace mitscript::analysis {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum PassId {
+    ConstPropPass, DCEPass, GVNPass, LICMPass, IVPass,
+    InlinePass, SRAPass, RotatePass, ShapePass, TypesPass, PassCount
+};
+
+const char* const kPassNames[PassCount] = {"constprop", "dce", "gvn",    "licm",  "iv",
+                                           "inline",    "sra", "rotate", "shape", "types"};
+
+// Worker threads that run parallel loops; the calling thread takes part too.
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t threads) {
+        for (size_t i = 1; i < threads; ++i) workers_.emplace_back([this] { work(); });
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : workers_) t.join();
+    }
+
+    // Calls task(i) for every i in [0, n) and returns once all calls have.
+    // Rethrows the first exception a call threw.
+    void parallel_for(size_t n, const std::function<void(size_t)>& task) {
+        if (workers_.empty() || n < 2) {
+            for (size_t i = 0; i < n; ++i) task(i);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = &task;
+            count_ = n;
+            next_.store(0, std::memory_order_relaxed);
+            pending_ = workers_.size();
+            error_ = nullptr;
+            ++generation_;
+        }
+        cv_.notify_all();
+        drain();
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [&] { return pending_ == 0; });
+        task_ = nullptr;
+        if (error_) std::rethrow_exception(error_);
+    }
+
+private:
+    void drain() {
+        for (size_t i; (i = next_.fetch_add(1, std::memory_order_relaxed)) < count_;) {
+            try {
+                (*task_)(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!error_) error_ = std::current_exception();
+            }
+        }
+    }
+
+    void work() {
+        size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [&] { return stop_ || generation_ != seen; });
+                if (stop_) return;
+                seen = generation_;
+            }
+            drain();
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--pending_ == 0) done_cv_.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable done_cv_;
+    const std::function<void(size_t)>* task_ = nullptr;
+    size_t count_ = 0;
+    std::atomic<size_t> next_{0};
+    size_t pending_ = 0;
+    size_t generation_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_;
+};
+
+struct Unit {
+    FunctionCFG* fn;
+    bool is_toplevel;
+    size_t size;
+};
+
+size_t instruction_count(const FunctionCFG& fn) {
+    size_t n = 0;
+    for (const auto& blk : fn.blocks)
+        if (blk) n += blk->code.size() + 1;
+    return n;
+}
+
+void collect_units(FunctionCFG& fn, bool is_toplevel, std::vector<Unit>& out) {
+    out.push_back({&fn, is_toplevel, 0});
+    for (auto& child : fn.children)
+        if (child) collect_units(*child, false, out);
+}
+
+// Counts that constant folding and DCE only ever move one way: folding
+// turns instructions into constants and branches into jumps, and DCE
+// deletes instructions and blocks. A round changed the function exactly
+// when one of them moved.
+struct Footprint {
+    size_t blocks = 0;
+    size_t instrs = 0;
+    size_t consts = 0;
+    size_t branches = 0;
+
+    bool operator==(const Footprint& o) const {
+        return blocks == o.blocks && instrs == o.instrs && consts == o.consts &&
+               branches == o.branches;
+    }
+};
+
+Footprint footprint(const FunctionCFG& fn) {
+    Footprint f;
+    for (const auto& blk : fn.blocks) {
+        if (!blk) continue;
+        ++f.blocks;
+        f.instrs += blk->code.size();
+        for (const auto& ir : blk->code)
+            if (ir.op == IROp::LoadConst) ++f.consts;
+        if (blk->term.kind == Terminator::Kind::CondJump) ++f.branches;
+    }
+    return f;
+}
+
+} // namespace
+
+PassOptions PassOptions::preset(int level) {
+    PassOptions o;
+    if (level >= 1) o.constprop = o.dce = o.shape = true;
+    if (level >= 2) o.gvn = o.licm = o.iv = o.rotate = o.types = true;
+    if (level >= 3) o.inline_calls = o.sra = true;
+    return o;
+}
+
+void PassManager::run(FunctionCFG& module) {
+    const auto start = Clock::now();
+    shapes_.clear();
+    types_.clear();
+    timings_.assign(PassCount, {});
+    for (int p = 0; p < PassCount; ++p) timings_[p].name = kPassNames[p];
+    std::mutex timing_mutex;
+
+    // Runs body() as pass p, on behalf of one function.
+    auto timed = [&](PassId p, std::vector<double>& local, const auto& body) {
+        if (!options_.time_passes) {
+            body();
+            return;
+        }
+        const auto t0 = Clock::now();
+        body();
+        local[p] += std::chrono::duration<double>(Clock::now() - t0).count();
+    };
+    auto merge = [&](const std::vector<double>& local, const std::vector<char>& ran) {
+        if (!options_.time_passes) return;
+        std::lock_guard<std::mutex> lock(timing_mutex);
+        for (int p = 0; p < PassCount; ++p) {
+            timings_[p].seconds += local[p];
+            timings_[p].runs += ran[p];
+        }
+    };
+
+    std::vector<Unit> units;
+    collect_units(module, true, units);
+    function_count_ = units.size();
+    // Largest functions first, so that no thread picks up a big one last.
+    for (auto& u : units) u.size = instruction_count(*u.fn);
+    std::stable_sort(units.begin(), units.end(),
+                     [](const Unit& a, const Unit& b) { return a.size > b.size; });
+
+    size_t threads = options_.threads;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, units.size());
+    threads_used_ = threads;
+    WorkerPool pool(threads);
+
+    GlobalConstants globals;
+    if (options_.constprop) {
+        std::vector<double> local(PassCount, 0);
+        timed(ConstPropPass, local, [&] { globals = find_constant_globals(module); });
+        merge(local, std::vector<char>(PassCount, 0));
+    }
+
+    // Per-function passes before inlining.
+    pool.parallel_for(units.size(), [&](size_t i) {
+        FunctionCFG& fn = *units[i].fn;
+        const bool top = units[i].is_toplevel;
+        std::vector<double> local(PassCount, 0);
+        std::vector<char> ran(PassCount, 0);
+
+        const int rounds = options_.constprop && options_.dce ? options_.max_cleanup_rounds : 1;
+        Footprint before = footprint(fn);
+        for (int round = 0; round < rounds; ++round) {
+            if (options_.constprop) {
+                timed(ConstPropPass, local, [&] { run_constant_folding(fn, top, &globals); });
+                ran[ConstPropPass] = 1;
+            }
+            if (options_.dce) {
+                timed(DCEPass, local, [&] { run_dce_on_function(fn, top, /*recursive=*/false); });
+                ran[DCEPass] = 1;
+            }
+            Footprint after = footprint(fn);
+            if (after == before) break;
+            before = after;
+        }
+        if (options_.gvn) {
+            timed(GVNPass, local, [&] { run_gvn_on_function(fn, top, /*recursive=*/false); });
+            ran[GVNPass] = 1;
+        }
+        if (options_.licm) {
+            timed(LICMPass, local, [&] { run_licm_on_function(fn, top, /*recursive=*/false); });
+            ran[LICMPass] = 1;
+        }
+        if (options_.iv) {
+            timed(IVPass, local, [&] { run_strength_reduction(fn, top, /*recursive=*/false); });
+            ran[IVPass] = 1;
+        }
+        merge(local, ran);
+    });
+
+    if (options_.inline_calls) {
+        std::vector<double> local(PassCount, 0);
+        std::vector<char> ran(PassCount, 0);
+        timed(InlinePass, local, [&] { run_inlining_pass(module, options_.inline_config); });
+        ran[InlinePass] = 1;
+        merge(local, ran);
+    }
+
+    // Inlining only rewrites existing functions, so the units still cover
+    // the module. The result maps get their entries up front, so that the
+    // workers only ever write to their own.
+    for (const auto& u : units) {
+        if (options_.shape) shapes_[u.fn];
+        if (options_.types) types_[u.fn];
+    }
+    pool.parallel_for(units.size(), [&](size_t i) {
+        FunctionCFG& fn = *units[i].fn;
+        const bool top = units[i].is_toplevel;
+        std::vector<double> local(PassCount, 0);
+        std::vector<char> ran(PassCount, 0);
+        if (options_.sra) {
+            timed(SRAPass, local, [&] { run_scalar_replacement(fn, top, /*recursive=*/false); });
+            ran[SRAPass] = 1;
+        }
+        if (options_.rotate) {
+            timed(RotatePass, local, [&] { run_loop_rotation(fn, /*recursive=*/false); });
+            ran[RotatePass] = 1;
+        }
+        if (options_.shape) {
+            timed(ShapePass, local, [&] { shapes_.at(&fn) = run_shape_analysis(fn, top); });
+            ran[ShapePass] = 1;
+        }
+        if (options_.types) {
+            timed(TypesPass, local, [&] { types_.at(&fn) = run_type_inference(fn, top); });
+            ran[TypesPass] = 1;
+        }
+        merge(local, ran);
+    });
+
+    wall_seconds_ = std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void PassManager::report(std::ostream& os) const {
+    os << "===-------------------------------------------------------===\n"
+       << "                   Optimization pass timing\n"
+       << "===-------------------------------------------------------===\n";
+    os << std::fixed << std::setprecision(3);
+    os << "  Total: " << wall_seconds_ * 1e3 << " ms wall, " << function_count_
+       << " functions, " << threads_used_ << (threads_used_ == 1 ? " thread\n" : " threads\n");
+    os << "\n   Time (ms)   Functions  Pass\n";
+    for (const auto& t : timings_) {
+        if (t.runs == 0) continue;
+        os << std::setw(12) << t.seconds * 1e3 << std::setw(12) << t.runs << "  " << t.name
+           << "\n";
+    }
+    os.unsetf(std::ios::floatfield);
+}
+
+} // namespace mitscript::analysis
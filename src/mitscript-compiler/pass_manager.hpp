@@ -0,0 +1,84 @@
+#pragma once
+
+#include "cfg.hpp"
+#include "inliner.hpp"
+#include "shape_analysis.hpp"
+#include "type_inference.hpp"
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace mitscript::analysis {
+
+// Which passes run. Every pass is off by default.
+struct PassOptions {
+    bool constprop = false;
+    bool dce = false;
+    bool gvn = false;
+    bool licm = false;
+    bool iv = false;
+    bool inline_calls = false;
+    bool sra = false;
+    bool rotate = false;
+    bool shape = false;
+    bool types = false;
+
+    InlineConfig inline_config;
+    // Rounds of constant folding and DCE, run until neither changes the
+    // function any more.
+    int max_cleanup_rounds = 4;
+    // Threads for the per-function passes; 0 picks one per core.
+    size_t threads = 0;
+    // Collect per-pass timings (see PassManager::report).
+    bool time_passes = false;
+
+    // -O1: constant folding and DCE, and the shape analysis that lets the
+    // converter address record slots directly.
+    // -O2: also GVN, LICM, strength reduction, loop rotation, and type
+    // inference.
+    // -O3: also inlining and scalar replacement.
+    static PassOptions preset(int level);
+};
+
+// Runs the optimization pipeline over a module.
+//
+// Passes that look at one function at a time (everything but the inliner)
+// run on every function of the module independently, spread over a thread
+// pool; each function's passes run in pipeline order. The pipeline is:
+//
+//   constprop + dce (to a fixed point), gvn, licm, iv    per function
+//   inline                                               whole module
+//   sra, rotate, shape, types                            per function
+//
+// The analyses' results are kept for the bytecode converter.
+class PassManager {
+public:
+    explicit PassManager(PassOptions options) : options_(std::move(options)) {}
+
+    void run(mitscript::CFG::FunctionCFG& module);
+
+    const ShapeResults& shapes() const { return shapes_; }
+    const TypeResults& types() const { return types_; }
+
+    // Writes the time spent in each pass, summed over functions, and the
+    // wall-clock time of the whole pipeline.
+    void report(std::ostream& os) const;
+
+private:
+    struct PassTiming {
+        std::string name;
+        double seconds = 0;
+        size_t runs = 0;
+    };
+
+    PassOptions options_;
+    ShapeResults shapes_;
+    TypeResults types_;
+    std::vector<PassTiming> timings_;
+    double wall_seconds_ = 0;
+    size_t function_count_ = 0;
+    size_t threads_used_ = 1;
+};
+
+} // namespace mitscript::analysis
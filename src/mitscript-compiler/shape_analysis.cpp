@@ -1,7 +1,9 @@
 #include "shape_analysis.hpp"
 
+#include "dataflow.hpp"
+#include "ssa.hpp"
+
 #include <algorithm>
-#include <queue>
 #include <sstream>
 #include <unordered_set>
 
@@ -46,13 +48,18 @@ ShapeInfo meet(const ShapeInfo& a, const ShapeInfo& b) {
     return ShapeInfo::top();
 }
 
-void meet_state(ShapeState& dst, const ShapeState& src) {
-    for (size_t i = 0; i < dst.vregs.size(); ++i) {
-        dst.vregs[i] = meet(dst.vregs[i], src.vregs[i]);
-    }
-    for (size_t i = 0; i < dst.locals.size(); ++i) {
-        dst.locals[i] = meet(dst.locals[i], src.locals[i]);
-    }
+// Meets src into dst; returns whether dst changed.
+bool meet_into(ShapeInfo& dst, const ShapeInfo& src) {
+    ShapeInfo m = meet(dst, src);
+    if (m == dst) return false;
+    dst = m;
+    return true;
+}
+
+bool meet_state(ShapeState& dst, const ShapeState& src) {
+    bool changed = false;
+    for (size_t i = 0; i < dst.locals.size(); ++i) changed |= meet_into(dst.locals[i], src.locals[i]);
+    return changed;
 }
 
 struct AllocationShape {
@@ -85,7 +92,7 @@ std::vector<AllocationShape> discover_record_shapes(FunctionCFG& fn) {
                 const auto& field = follower.inputs[1];
                 if (obj.kind != IROperand::VREG || obj.i != target) continue;
                 if (field.kind == IROperand::NAME) {
-                    a.fields.push_back(field.s);
+                    a.fields.push_back(field.s.str());
                 }
             }
             shapes.push_back(std::move(a));
@@ -94,67 +101,35 @@ std::vector<AllocationShape> discover_record_shapes(FunctionCFG& fn) {
     return shapes;
 }
 
-} // namespace
-
-int ShapeRegistry::intern_shape(const std::vector<std::string>& fields) {
-    std::ostringstream oss;
-    for (size_t i = 0; i < fields.size(); ++i) {
-        if (i) oss << '\0';
-        oss << fields[i];
+// Forward shape propagation of the locals. Unknown is the bottom of the
+// lattice; on entry, every local may hold anything. Vreg shapes go to one
+// table for the whole function as they are defined; `reread` is set when a
+// vreg changes after some block has read it, which calls for another pass.
+struct ShapeProblem {
+    using Value = ShapeState;
+
+    const FunctionCFG& fn;
+    size_t num_locals;
+    const std::vector<char>& private_slots;
+    const std::unordered_map<BlockId, std::unordered_map<size_t, int>>& make_record_shape;
+    std::vector<ShapeInfo>& vregs;
+    BitSet& read;
+    bool& reread;
+
+    ShapeState initial() const {
+        ShapeState s;
+        s.locals.assign(num_locals, ShapeInfo::unknown());
+        return s;
     }
-    std::string key = oss.str();
-    auto it = key_to_id_.find(key);
-    if (it != key_to_id_.end()) return it->second;
-
-    int id = static_cast<int>(shapes_.size());
-    Shape sh;
-    sh.id = id;
-    sh.fields = fields;
-    shapes_.push_back(std::move(sh));
-    key_to_id_[key] = id;
-    return id;
-}
-
-const Shape* ShapeRegistry::lookup(int id) const {
-    if (id < 0 || id >= static_cast<int>(shapes_.size())) return nullptr;
-    return &shapes_[id];
-}
-
-int ShapeRegistry::slot_index(int shape_id, const std::string& field) const {
-    const Shape* sh = lookup(shape_id);
-    if (!sh) return -1;
-    for (size_t i = 0; i < sh->fields.size(); ++i) {
-        if (sh->fields[i] == field) return static_cast<int>(i);
-    }
-    return -1;
-}
-
-ShapeAnalysisResult run_shape_analysis(FunctionCFG& fn) {
-    ShapeAnalysisResult res;
-    res.num_vregs = count_vregs(fn);
-    res.num_locals = count_locals(fn);
-
-    // Pre-discover record literal shapes.
-    std::unordered_map<BlockId, std::unordered_map<size_t, int>> make_record_shape;
-    for (const auto& a : discover_record_shapes(fn)) {
-        int sid = res.registry.intern_shape(a.fields);
-        make_record_shape[a.block][a.instr_index] = sid;
-    }
-
-    ShapeState bottom;
-    bottom.vregs.assign(res.num_vregs, ShapeInfo::unknown());
-    bottom.locals.assign(res.num_locals, ShapeInfo::unknown());
-
-    res.in_states.assign(fn.blocks.size(), bottom);
-    res.out_states.assign(fn.blocks.size(), bottom);
-
-    std::queue<BlockId> worklist;
-    if (fn.entry >= 0 && fn.entry < static_cast<BlockId>(fn.blocks.size()) && fn.blocks[fn.entry]) {
-        worklist.push(fn.entry);
+    ShapeState boundary() const {
+        ShapeState s = initial();
+        s.locals.assign(num_locals, ShapeInfo::top());
+        return s;
     }
+    bool join(ShapeState& into, const ShapeState& v) const { return meet_state(into, v); }
 
-    auto transfer = [&](BlockId bid) {
-        ShapeState state = res.in_states[bid];
+    ShapeState transfer(BlockId bid, const ShapeState& in) const {
+        ShapeState state = in;
         const auto& blk = *fn.blocks[bid];
 
         for (size_t i = 0; i < blk.code.size(); ++i) {
@@ -163,32 +138,37 @@ ShapeAnalysisResult run_shape_analysis(FunctionCFG& fn) {
 
             switch (ir.op) {
                 case IROp::MakeRecord: {
-                    auto it = make_record_shape[bid].find(i);
-                    if (it != make_record_shape[bid].end()) {
-                        output_shape = ShapeInfo::shape(it->second);
-                    } else {
-                        output_shape = ShapeInfo::top();
+                    output_shape = ShapeInfo::top();
+                    auto blk_it = make_record_shape.find(bid);
+                    if (blk_it != make_record_shape.end()) {
+                        auto it = blk_it->second.find(i);
+                        if (it != blk_it->second.end()) output_shape = ShapeInfo::shape(it->second);
                     }
                     break;
                 }
                 case IROp::LoadLocal: {
+                    output_shape = ShapeInfo::top();
                     if (ir.output && !ir.inputs.empty() && ir.inputs[0].kind == IROperand::LOCAL) {
                         int slot = ir.inputs[0].i;
-                        if (slot >= 0 && slot < static_cast<int>(state.locals.size())) {
+                        if (slot >= 0 && slot < static_cast<int>(state.locals.size()) &&
+                            private_slots[slot]) {
                             output_shape = state.locals[slot];
                         }
                     }
                     break;
                 }
                 case IROp::StoreLocal: {
-                    if (ir.inputs.size() >= 2 &&
-                        ir.inputs[0].kind == IROperand::LOCAL &&
-                        ir.inputs[1].kind == IROperand::VREG) {
+                    if (ir.inputs.size() >= 2 && ir.inputs[0].kind == IROperand::LOCAL) {
                         int slot = ir.inputs[0].i;
-                        int reg = ir.inputs[1].i;
+                        int reg = ir.inputs[1].kind == IROperand::VREG ? ir.inputs[1].i : -1;
                         if (slot >= 0 && slot < static_cast<int>(state.locals.size()) &&
-                            reg >= 0 && reg < static_cast<int>(state.vregs.size())) {
-                            state.locals[slot] = state.vregs[reg];
+                            private_slots[slot]) {
+                            if (reg >= 0 && reg < static_cast<int>(vregs.size())) {
+                                state.locals[slot] = vregs[reg];
+                                read.set(static_cast<size_t>(reg));
+                            } else {
+                                state.locals[slot] = ShapeInfo::top();
+                            }
                         }
                     }
                     // StoreLocal does not define a vreg.
@@ -222,60 +202,103 @@ ShapeAnalysisResult run_shape_analysis(FunctionCFG& fn) {
                 case IROp::StoreGlobal:
                 case IROp::Call:
                 default:
-                    // Unknown shape result.
-                    output_shape = (ir.op == IROp::Call) ? ShapeInfo::top() : ShapeInfo::unknown();
+                    // Unknown is reserved for values not reached yet; anything
+                    // else produced here may or may not be a record.
+                    output_shape = ShapeInfo::top();
                     break;
             }
 
             if (ir.output && ir.output->kind == IROperand::VREG) {
                 int out = ir.output->i;
-                if (out >= 0 && out < static_cast<int>(state.vregs.size())) {
-                    state.vregs[out] = output_shape;
+                if (out >= 0 && out < static_cast<int>(vregs.size()) &&
+                    meet_into(vregs[out], output_shape) && read.test(static_cast<size_t>(out))) {
+                    reread = true;
                 }
             }
         }
 
-        res.out_states[bid] = state;
-    };
+        return state;
+    }
+};
 
-    std::vector<char> in_queue(fn.blocks.size(), 0);
-    if (!worklist.empty()) in_queue[fn.entry] = 1;
+} // namespace
 
-    while (!worklist.empty()) {
-        BlockId bid = worklist.front();
-        worklist.pop();
-        in_queue[bid] = 0;
-        if (bid < 0 || bid >= static_cast<BlockId>(fn.blocks.size())) continue;
-        if (!fn.blocks[bid]) continue;
+int ShapeRegistry::intern_shape(const std::vector<std::string>& fields) {
+    std::ostringstream oss;
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (i) oss << '\0';
+        oss << fields[i];
+    }
+    std::string key = oss.str();
+    auto it = key_to_id_.find(key);
+    if (it != key_to_id_.end()) return it->second;
 
-        transfer(bid);
-        const auto& out_state = res.out_states[bid];
-
-        for (auto succ : fn.blocks[bid]->successors) {
-            if (succ < 0 || succ >= static_cast<BlockId>(fn.blocks.size())) continue;
-            if (!fn.blocks[succ]) continue;
-
-            ShapeState joined = res.in_states[succ];
-            meet_state(joined, out_state);
-            if (joined.vregs != res.in_states[succ].vregs ||
-                joined.locals != res.in_states[succ].locals) {
-                res.in_states[succ] = std::move(joined);
-                if (!in_queue[succ]) {
-                    worklist.push(succ);
-                    in_queue[succ] = 1;
-                }
-            }
-        }
+    int id = static_cast<int>(shapes_.size());
+    Shape sh;
+    sh.id = id;
+    sh.fields = fields;
+    shapes_.push_back(std::move(sh));
+    key_to_id_[key] = id;
+    return id;
+}
+
+const Shape* ShapeRegistry::lookup(int id) const {
+    if (id < 0 || id >= static_cast<int>(shapes_.size())) return nullptr;
+    return &shapes_[id];
+}
+
+int ShapeRegistry::slot_index(int shape_id, const std::string& field) const {
+    const Shape* sh = lookup(shape_id);
+    if (!sh) return -1;
+    for (size_t i = 0; i < sh->fields.size(); ++i) {
+        if (sh->fields[i] == field) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+ShapeAnalysisResult run_shape_analysis(FunctionCFG& fn, bool is_toplevel) {
+    ShapeAnalysisResult res;
+    res.num_vregs = count_vregs(fn);
+    res.num_locals = count_locals(fn);
+
+    // Pre-discover record literal shapes.
+    std::unordered_map<BlockId, std::unordered_map<size_t, int>> make_record_shape;
+    for (const auto& a : discover_record_shapes(fn)) {
+        int sid = res.registry.intern_shape(a.fields);
+        make_record_shape[a.block][a.instr_index] = sid;
+    }
+
+    // Parameters and not-yet-assigned locals may hold anything on entry.
+    // Locals a nested function or (at module scope) another function can
+    // assign are never tracked.
+    auto private_slots = private_locals(fn, is_toplevel);
+
+    res.vregs.assign(res.num_vregs, ShapeInfo::unknown());
+    BitSet read(res.num_vregs);
+    bool reread = true;
+    while (reread) {
+        reread = false;
+        ShapeProblem problem{fn, res.num_locals, private_slots, make_record_shape,
+                             res.vregs, read, reread};
+        auto solved = solve_dataflow(fn, problem, Direction::Forward);
+        res.in_states = std::move(solved.before);
+        res.out_states = std::move(solved.after);
     }
 
     return res;
 }
 
+void run_shape_analysis_recursive(FunctionCFG& fn, ShapeResults& out, bool is_toplevel) {
+    out[&fn] = run_shape_analysis(fn, is_toplevel);
+    for (auto& child : fn.children) {
+        if (child) run_shape_analysis_recursive(*child, out, false);
+    }
+}
+
 ShapeInfo get_shape_at_block_out(const ShapeAnalysisResult& res, BlockId bid, int vreg) {
     if (bid < 0 || bid >= static_cast<BlockId>(res.out_states.size())) return ShapeInfo::unknown();
-    const auto& st = res.out_states[bid];
-    if (vreg < 0 || vreg >= static_cast<int>(st.vregs.size())) return ShapeInfo::unknown();
-    return st.vregs[vreg];
+    if (vreg < 0 || vreg >= static_cast<int>(res.vregs.size())) return ShapeInfo::unknown();
+    return res.vregs[vreg];
 }
 
 bool is_field_access_monomorphic(const ShapeAnalysisResult& res, BlockId bid, int vreg) {
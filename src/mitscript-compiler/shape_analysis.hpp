@@ -38,21 +38,37 @@ private:
     std::unordered_map<std::string, int> key_to_id_;
 };
 
+// The shapes of the locals at a block boundary.
 struct ShapeState {
-    std::vector<ShapeInfo> vregs;
     std::vector<ShapeInfo> locals;
 };
 
 struct ShapeAnalysisResult {
     std::vector<ShapeState> in_states;
     std::vector<ShapeState> out_states;
+    // Per vreg, over all of its definitions. A vreg only carries a value
+    // from its definition to its uses, so this is all the flow-sensitive
+    // state would say where the vreg is read, without a copy per block.
+    std::vector<ShapeInfo> vregs;
     ShapeRegistry registry;
     size_t num_vregs = 0;
     size_t num_locals = 0;
 };
 
 // Runs intraprocedural shape analysis on a single function.
-ShapeAnalysisResult run_shape_analysis(mitscript::CFG::FunctionCFG& fn);
+//
+// A value has a known shape only when it is certainly a record built by a
+// record literal with those fields (in that order), possibly extended since:
+// fields are only ever appended, so each listed field keeps its slot for as
+// long as the record has a shape at all. Parameters, captured locals and (at
+// module scope) globals are never tracked.
+ShapeAnalysisResult run_shape_analysis(mitscript::CFG::FunctionCFG& fn, bool is_toplevel = true);
+
+// Results for a function and all of its nested functions.
+using ShapeResults =
+    std::unordered_map<const mitscript::CFG::FunctionCFG*, ShapeAnalysisResult>;
+void run_shape_analysis_recursive(mitscript::CFG::FunctionCFG& fn, ShapeResults& out,
+                                  bool is_toplevel = true);
 
 // Query helpers
 ShapeInfo get_shape_at_block_out(const ShapeAnalysisResult& res, mitscript::CFG::BlockId bid, int vreg);
@@ -0,0 +1,245 @@
+#include "ssa.hpp"
+
+#include "dce.hpp"
+
+#include <algorithm>
+#include <unordered_set>
+
+using namespace mitscript::CFG;
+
+namespace mitscript::analysis {
+
+namespace {
+
+bool is_block(const FunctionCFG& fn, BlockId b) {
+    return b >= 0 && b < static_cast<BlockId>(fn.blocks.size()) && fn.blocks[b];
+}
+
+void postorder(const FunctionCFG& fn, BlockId b, std::vector<char>& seen,
+               std::vector<BlockId>& out) {
+    if (!is_block(fn, b) || seen[b] || fn.blocks[b]->post_return) return;
+    seen[b] = 1;
+    for (auto succ : fn.blocks[b]->successors) postorder(fn, succ, seen, out);
+    out.push_back(b);
+}
+
+// The local slot a LoadLocal/StoreLocal names, or -1 (free variables and
+// globals are named by string).
+int local_slot(const IRInstr& ir) {
+    if ((ir.op != IROp::LoadLocal && ir.op != IROp::StoreLocal) || ir.inputs.empty())
+        return -1;
+    const IROperand& x = ir.inputs[0];
+    return x.kind == IROperand::LOCAL ? x.i : -1;
+}
+
+void rename(FunctionCFG& fn, const DominatorTree& dom, BlockId b,
+            const SSAInfo& info, std::vector<std::vector<int>>& current,
+            std::vector<int>& next_version) {
+    auto& blk = *fn.blocks[b];
+    std::vector<int> defined;
+
+    auto define = [&](int slot) {
+        int v = next_version[slot]++;
+        current[slot].push_back(v);
+        defined.push_back(slot);
+        return v;
+    };
+
+    for (auto& phi : blk.phis) phi.version = define(phi.local);
+
+    for (auto& ir : blk.code) {
+        int slot = local_slot(ir);
+        if (slot < 0 || slot >= static_cast<int>(info.promoted.size()) ||
+            !info.promoted[slot])
+            continue;
+        if (ir.op == IROp::LoadLocal) {
+            ir.inputs[0].version = current[slot].back();
+        } else {
+            ir.inputs[0].version = define(slot);
+        }
+    }
+
+    for (auto succ : blk.successors) {
+        if (!is_block(fn, succ) || !dom.reachable[succ]) continue;
+        auto& sblk = *fn.blocks[succ];
+        for (size_t i = 0; i < sblk.predecessors.size(); ++i) {
+            if (sblk.predecessors[i] != b) continue;
+            for (auto& phi : sblk.phis) phi.args[i] = current[phi.local].back();
+        }
+    }
+
+    for (auto child : dom.children[b]) rename(fn, dom, child, info, current, next_version);
+
+    for (int slot : defined) current[slot].pop_back();
+}
+
+} // namespace
+
+bool DominatorTree::dominates(BlockId a, BlockId b) const {
+    while (b >= 0) {
+        if (a == b) return true;
+        b = idom[b];
+    }
+    return false;
+}
+
+DominatorTree compute_dominators(const FunctionCFG& fn) {
+    DominatorTree dom;
+    const size_t n = fn.blocks.size();
+    dom.reachable.assign(n, 0);
+    dom.idom.assign(n, -1);
+    dom.children.assign(n, {});
+    if (!is_block(fn, fn.entry)) return dom;
+
+    std::vector<BlockId> post;
+    postorder(fn, fn.entry, dom.reachable, post);
+    dom.rpo.assign(post.rbegin(), post.rend());
+
+    std::vector<int> order(n, -1);  // postorder number
+    for (size_t i = 0; i < post.size(); ++i) order[post[i]] = static_cast<int>(i);
+
+    auto intersect = [&](BlockId a, BlockId b) {
+        while (a != b) {
+            while (order[a] < order[b]) a = dom.idom[a];
+            while (order[b] < order[a]) b = dom.idom[b];
+        }
+        return a;
+    };
+
+    dom.idom[fn.entry] = fn.entry;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (BlockId b : dom.rpo) {
+            if (b == fn.entry) continue;
+            BlockId new_idom = -1;
+            for (auto p : fn.blocks[b]->predecessors) {
+                if (!is_block(fn, p) || !dom.reachable[p] || dom.idom[p] < 0) continue;
+                new_idom = (new_idom < 0) ? p : intersect(p, new_idom);
+            }
+            if (new_idom != dom.idom[b]) {
+                dom.idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    dom.idom[fn.entry] = -1;
+    for (BlockId b : dom.rpo) {
+        if (dom.idom[b] >= 0) dom.children[dom.idom[b]].push_back(b);
+    }
+    return dom;
+}
+
+std::vector<std::vector<BlockId>> compute_dominance_frontiers(const FunctionCFG& fn,
+                                                              const DominatorTree& dom) {
+    std::vector<std::vector<BlockId>> df(fn.blocks.size());
+    for (BlockId b : dom.rpo) {
+        std::vector<BlockId> preds;
+        for (auto p : fn.blocks[b]->predecessors) {
+            if (is_block(fn, p) && dom.reachable[p]) preds.push_back(p);
+        }
+        if (preds.size() < 2) continue;
+        for (BlockId runner : preds) {
+            while (runner >= 0 && runner != dom.idom[b]) {
+                auto& frontier = df[runner];
+                if (std::find(frontier.begin(), frontier.end(), b) == frontier.end())
+                    frontier.push_back(b);
+                runner = dom.idom[runner];
+            }
+        }
+    }
+    return df;
+}
+
+std::vector<char> private_locals(const FunctionCFG& fn, bool is_toplevel) {
+    const size_t slots = fn.params.size() + fn.locals.size();
+    std::vector<char> result(slots, 1);
+
+    // Nested functions reach captured locals through references, and the
+    // converter turns module-level locals named in `names` into globals.
+    std::unordered_set<std::string> shared;
+    for (const auto& child : fn.children) {
+        if (child) shared.insert(child->freeVars.begin(), child->freeVars.end());
+    }
+    if (is_toplevel) shared.insert(fn.names.begin(), fn.names.end());
+    for (size_t i = 0; i < slots; ++i) {
+        const std::string& name =
+            i < fn.params.size() ? fn.params[i] : fn.locals[i - fn.params.size()];
+        if (shared.count(name)) result[i] = 0;
+    }
+    return result;
+}
+
+SSAInfo construct_ssa(FunctionCFG& fn, const DominatorTree& dom, bool is_toplevel) {
+    SSAInfo info;
+    const size_t slots = fn.params.size() + fn.locals.size();
+    info.promoted = private_locals(fn, is_toplevel);
+    info.version_count.assign(slots, 0);
+
+    for (auto& blk : fn.blocks) {
+        if (blk) blk->phis.clear();
+    }
+    if (dom.rpo.empty()) return info;
+
+    // Phi placement: iterated dominance frontier of each local's stores,
+    // pruned to the blocks where the local is live on entry.
+    auto df = compute_dominance_frontiers(fn, dom);
+    auto liveness = compute_liveness(fn);
+    std::vector<std::vector<BlockId>> def_blocks(slots);
+    for (BlockId b : dom.rpo) {
+        for (const auto& ir : fn.blocks[b]->code) {
+            int slot = local_slot(ir);
+            if (ir.op == IROp::StoreLocal && slot >= 0 && slot < static_cast<int>(slots) &&
+                info.promoted[slot]) {
+                auto& defs = def_blocks[slot];
+                if (defs.empty() || defs.back() != b) defs.push_back(b);
+            }
+        }
+    }
+
+    std::vector<int> has_phi(fn.blocks.size(), -1);
+    std::vector<int> queued(fn.blocks.size(), -1);
+    for (size_t slot = 0; slot < slots; ++slot) {
+        if (!info.promoted[slot] || def_blocks[slot].empty()) continue;
+        std::vector<BlockId> work = def_blocks[slot];
+        for (BlockId b : work) queued[b] = static_cast<int>(slot);
+        while (!work.empty()) {
+            BlockId b = work.back();
+            work.pop_back();
+            for (BlockId d : df[b]) {
+                if (has_phi[d] == static_cast<int>(slot)) continue;
+                has_phi[d] = static_cast<int>(slot);
+                const auto& live = liveness.live_in[d].locals;
+                if (slot < live.size() && live[slot]) {
+                    auto& blk = *fn.blocks[d];
+                    blk.phis.push_back(Phi{static_cast<int>(slot), -1,
+                                           std::vector<int>(blk.predecessors.size(), -1)});
+                }
+                if (queued[d] != static_cast<int>(slot)) {
+                    queued[d] = static_cast<int>(slot);
+                    work.push_back(d);
+                }
+            }
+        }
+    }
+
+    // Renaming, in dominator-tree preorder. Version 0 is the entry value.
+    std::vector<std::vector<int>> current(slots, std::vector<int>{0});
+    std::vector<int> next_version(slots, 1);
+    rename(fn, dom, fn.entry, info, current, next_version);
+    info.version_count = std::move(next_version);
+    return info;
+}
+
+void destruct_ssa(FunctionCFG& fn) {
+    for (auto& blk : fn.blocks) {
+        if (!blk) continue;
+        blk->phis.clear();
+        for (auto& ir : blk->code) {
+            for (auto& in : ir.inputs) in.version = -1;
+        }
+    }
+}
+
+} // namespace mitscript::analysis
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "cfg.hpp"
+#include <vector>
+
+namespace mitscript::analysis {
+
+// Dominator tree over the blocks that can run: those reachable from the
+// entry without entering a post-return block (the bytecode converter never
+// emits those).
+struct DominatorTree {
+    std::vector<char> reachable;
+    std::vector<mitscript::CFG::BlockId> idom;  // -1 for the entry and unreachable blocks
+    std::vector<std::vector<mitscript::CFG::BlockId>> children;
+    std::vector<mitscript::CFG::BlockId> rpo;   // reachable blocks, reverse postorder
+
+    bool dominates(mitscript::CFG::BlockId a, mitscript::CFG::BlockId b) const;
+};
+
+// Cooper, Harvey and Kennedy's iterative algorithm over reverse postorder.
+DominatorTree compute_dominators(const mitscript::CFG::FunctionCFG& fn);
+
+// DF(b): the blocks where b's dominance ends.
+std::vector<std::vector<mitscript::CFG::BlockId>> compute_dominance_frontiers(
+    const mitscript::CFG::FunctionCFG& fn, const DominatorTree& dom);
+
+// Per local slot: whether only this function's own instructions can read
+// or write it, i.e. it is neither captured by a nested function nor, at
+// module scope, a global.
+std::vector<char> private_locals(const mitscript::CFG::FunctionCFG& fn, bool is_toplevel);
+
+struct SSAInfo {
+    std::vector<char> promoted;       // per local slot: renamed into versions
+    std::vector<int> version_count;   // per local slot
+};
+
+// Puts fn into SSA form. Locals that only this function can write (not
+// captured by a nested function, and not module globals) are renamed:
+// every StoreLocal defines a new version, every LoadLocal names the version
+// that reaches it, and pruned phis are placed at the iterated dominance
+// frontiers of the stores where the local is live. Version 0 is the value
+// a local holds on entry. Instructions keep their order and stack effects,
+// so the form lowers as-is; only IROperand::version and BasicBlock::phis
+// are added.
+SSAInfo construct_ssa(mitscript::CFG::FunctionCFG& fn, const DominatorTree& dom,
+                      bool is_toplevel);
+
+// Leaves SSA form by dropping the phis and versions. Every version of a
+// local maps back to its slot, which is exact as long as no two versions
+// of a local are live at once; passes running on SSA form must keep it that
+// way (GVN only adds reads of fresh temporaries).
+void destruct_ssa(mitscript::CFG::FunctionCFG& fn);
+
+} // namespace mitscript::analysis
@@ -0,0 +1,189 @@
+#include "type_inference.hpp"
+
+#include "ssa.hpp"
+
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+
+using namespace mitscript::CFG;
+
+namespace mitscript::analysis {
+
+namespace {
+
+size_t count_vregs(const FunctionCFG& fn) {
+    int max_v = -1;
+    for (const auto& blk_ptr : fn.blocks) {
+        if (!blk_ptr) continue;
+        for (const auto& ir : blk_ptr->code) {
+            if (ir.output && ir.output->kind == IROperand::VREG)
+                max_v = std::max(max_v, ir.output->i);
+            for (const auto& inp : ir.inputs) {
+                if (inp.kind == IROperand::VREG)
+                    max_v = std::max(max_v, inp.i);
+            }
+        }
+    }
+    return (max_v < 0) ? 0u : static_cast<size_t>(max_v + 1);
+}
+
+TypeKind constant_type(const IROperand& c) {
+    switch (c.kind) {
+        case IROperand::CONSTI: return TypeKind::Int;
+        case IROperand::CONSTB: return TypeKind::Bool;
+        case IROperand::CONSTS: return TypeKind::String;
+        case IROperand::NONE:   return TypeKind::None;
+        default:                return TypeKind::Top;
+    }
+}
+
+} // namespace
+
+TypeKind join(TypeKind a, TypeKind b) {
+    if (a == TypeKind::Bottom) return b;
+    if (b == TypeKind::Bottom) return a;
+    return a == b ? a : TypeKind::Top;
+}
+
+TypeInferenceResult run_type_inference(const FunctionCFG& fn, bool is_toplevel) {
+    TypeInferenceResult res;
+    const size_t num_locals = fn.params.size() + fn.locals.size();
+    res.vregs.assign(count_vregs(fn), TypeKind::Bottom);
+    res.locals_in.assign(fn.blocks.size(), std::vector<TypeKind>(num_locals, TypeKind::Bottom));
+
+    const bool has_entry = fn.entry >= 0 && fn.entry < static_cast<BlockId>(fn.blocks.size()) &&
+                           fn.blocks[fn.entry];
+    if (!has_entry) return res;
+
+    // Parameters and not-yet-assigned locals may hold anything on entry.
+    auto private_slots = private_locals(fn, is_toplevel);
+    res.locals_in[fn.entry].assign(num_locals, TypeKind::Top);
+
+    auto local_slot = [&](const IROperand& x) {
+        if (x.kind != IROperand::LOCAL || x.i < 0 || x.i >= static_cast<int>(num_locals) ||
+            !private_slots[x.i])
+            return -1;
+        return x.i;
+    };
+
+    // The operand stack is empty at block boundaries, so every vreg a block
+    // reads is one it defines itself.
+    auto transfer = [&](BlockId bid) {
+        std::vector<TypeKind> locals = res.locals_in[bid];
+        std::unordered_map<int, TypeKind> defined;
+        auto type_of = [&](const IROperand& x) {
+            if (x.kind != IROperand::VREG) return TypeKind::Top;
+            auto it = defined.find(x.i);
+            return it == defined.end() ? TypeKind::Top : it->second;
+        };
+
+        for (const auto& ir : fn.blocks[bid]->code) {
+            TypeKind out = TypeKind::Top;
+            switch (ir.op) {
+                case IROp::LoadConst:
+                    if (!ir.inputs.empty()) out = constant_type(ir.inputs[0]);
+                    break;
+                case IROp::LoadLocal: {
+                    int slot = ir.inputs.empty() ? -1 : local_slot(ir.inputs[0]);
+                    if (slot >= 0) out = locals[slot];
+                    break;
+                }
+                case IROp::StoreLocal: {
+                    int slot = ir.inputs.size() < 2 ? -1 : local_slot(ir.inputs[0]);
+                    if (slot >= 0) locals[slot] = type_of(ir.inputs[1]);
+                    continue;
+                }
+                case IROp::Add: {
+                    if (ir.inputs.size() < 2) break;
+                    TypeKind a = type_of(ir.inputs[0]);
+                    TypeKind b = type_of(ir.inputs[1]);
+                    if (a == TypeKind::Int && b == TypeKind::Int) out = TypeKind::Int;
+                    else if (a == TypeKind::String || b == TypeKind::String) out = TypeKind::String;
+                    break;
+                }
+                case IROp::Sub:
+                case IROp::Mul:
+                case IROp::Div:
+                case IROp::Neg:
+                    out = TypeKind::Int;
+                    break;
+                case IROp::CmpEq:
+                case IROp::CmpLt:
+                case IROp::CmpGt:
+                case IROp::CmpLe:
+                case IROp::CmpGe:
+                case IROp::Not:
+                case IROp::And:
+                case IROp::Or:
+                    out = TypeKind::Bool;
+                    break;
+                case IROp::MakeRecord:
+                    out = TypeKind::Record;
+                    break;
+                case IROp::AllocClosure:
+                    out = TypeKind::Function;
+                    break;
+                default:
+                    // Fields, indexes, globals and calls may hold anything.
+                    break;
+            }
+            if (ir.output && ir.output->kind == IROperand::VREG) {
+                int v = ir.output->i;
+                defined[v] = out;
+                if (v >= 0 && v < static_cast<int>(res.vregs.size()))
+                    res.vregs[v] = join(res.vregs[v], out);
+            }
+        }
+        return locals;
+    };
+
+    std::queue<BlockId> worklist;
+    std::vector<char> in_queue(fn.blocks.size(), 0);
+    std::vector<char> visited(fn.blocks.size(), 0);
+    worklist.push(fn.entry);
+    in_queue[fn.entry] = 1;
+
+    while (!worklist.empty()) {
+        BlockId bid = worklist.front();
+        worklist.pop();
+        in_queue[bid] = 0;
+        visited[bid] = 1;
+
+        std::vector<TypeKind> out = transfer(bid);
+        for (auto succ : fn.blocks[bid]->successors) {
+            if (succ < 0 || succ >= static_cast<BlockId>(fn.blocks.size())) continue;
+            if (!fn.blocks[succ]) continue;
+
+            auto& in = res.locals_in[succ];
+            bool changed = false;
+            for (size_t i = 0; i < num_locals; ++i) {
+                TypeKind joined = join(in[i], out[i]);
+                if (joined != in[i]) {
+                    in[i] = joined;
+                    changed = true;
+                }
+            }
+            if ((changed || !visited[succ]) && !in_queue[succ]) {
+                worklist.push(succ);
+                in_queue[succ] = 1;
+            }
+        }
+    }
+
+    return res;
+}
+
+void run_type_inference_recursive(const FunctionCFG& fn, TypeResults& out, bool is_toplevel) {
+    out[&fn] = run_type_inference(fn, is_toplevel);
+    for (const auto& child : fn.children) {
+        if (child) run_type_inference_recursive(*child, out, false);
+    }
+}
+
+TypeKind get_vreg_type(const TypeInferenceResult& res, int vreg) {
+    if (vreg < 0 || vreg >= static_cast<int>(res.vregs.size())) return TypeKind::Top;
+    return res.vregs[vreg];
+}
+
+} // namespace mitscript::analysis
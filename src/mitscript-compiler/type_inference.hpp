@@ -0,0 +1,45 @@
+#pragma once
+
+#include "cfg.hpp"
+#include <unordered_map>
+#include <vector>
+
+namespace mitscript::analysis {
+
+// The kind of value a vreg or local may hold. Bottom is reserved for values
+// not reached yet; Top for values that may be of more than one kind.
+//
+// Int means a tagged integer. Integers the VM boxes (as record fields, or
+// via intcast) come back through loads the pass treats as Top, so only
+// constants and the results of arithmetic are ever Int.
+enum class TypeKind { Bottom, Int, Bool, String, Record, Function, None, Top };
+
+TypeKind join(TypeKind a, TypeKind b);
+
+struct TypeInferenceResult {
+    // Per vreg: the join of every value it is assigned.
+    std::vector<TypeKind> vregs;
+    // Per block: the kinds of the locals on entry.
+    std::vector<std::vector<TypeKind>> locals_in;
+};
+
+// Flow-sensitive type inference over a single function.
+//
+// Only locals this function alone can access (see private_locals) carry a
+// kind across instructions and blocks; parameters, captured locals,
+// globals, fields, indexes and call results are Top. Sub, Mul, Div and Neg
+// are Int whatever their operands: they either produce an integer or
+// throw.
+TypeInferenceResult run_type_inference(const mitscript::CFG::FunctionCFG& fn,
+                                       bool is_toplevel = true);
+
+// Results for a function and all of its nested functions.
+using TypeResults =
+    std::unordered_map<const mitscript::CFG::FunctionCFG*, TypeInferenceResult>;
+void run_type_inference_recursive(const mitscript::CFG::FunctionCFG& fn, TypeResults& out,
+                                  bool is_toplevel = true);
+
+// Query helper: the kind of `vreg`, or Top if the pass did not see it.
+TypeKind get_vreg_type(const TypeInferenceResult& res, int vreg);
+
+} // namespace mitscript::analysis
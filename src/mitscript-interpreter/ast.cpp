@@ -1,6 +1,33 @@
 #include "./ast.hpp"
 
+#include <algorithm>
+#include <cstdint>
+
 namespace mitscript {
+    AstArena::~AstArena() {
+        for (auto it = cleanups_.rbegin(); it != cleanups_.rend(); ++it)
+            it->destroy(it->objects, it->count);
+    }
+
+    void* AstArena::allocate(size_t size, size_t align) {
+        auto aligned = [&](char* p) {
+            auto addr = reinterpret_cast<uintptr_t>(p);
+            return reinterpret_cast<char*>((addr + align - 1) & ~(uintptr_t)(align - 1));
+        };
+        char* p = cursor_ ? aligned(cursor_) : nullptr;
+        if (!p || size > static_cast<size_t>(limit_ - p)) {
+            // Chunks double up to 1 MiB so that small programs stay small.
+            size_t chunk = std::max(next_chunk_, size + align);
+            next_chunk_ = std::min<size_t>(next_chunk_ * 2, 1 << 20);
+            chunks_.emplace_back(new char[chunk]);
+            cursor_ = chunks_.back().get();
+            limit_ = cursor_ + chunk;
+            p = aligned(cursor_);
+        }
+        cursor_ = p + size;
+        return p;
+    }
+
     void AST::accept(Visitor* v) { v->visit(this); }
     void Block::accept(Visitor* v) { v->visit(this); }
     void Assignment::accept(Visitor* v) { v->visit(this); }
@@ -1,8 +1,12 @@
 #pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
 #include <string>
-#include <vector>
+#include <type_traits>
+#include <utility>
 #include <variant>
-#include <memory>
+#include <vector>
 
 namespace mitscript {
     class AST;
@@ -34,10 +38,87 @@ namespace mitscript {
         int end_col;
     };
 
+    // A fixed-length array of children, stored in the AST's arena.
+    template <class T>
+    class AstList {
+        public:
+            AstList() = default;
+            AstList(T* data, size_t size) : data_(data), size_(size) {}
+
+            size_t size() const { return size_; }
+            bool empty() const { return size_ == 0; }
+            T& operator[](size_t i) const { return data_[i]; }
+            T* begin() const { return data_; }
+            T* end() const { return data_ + size_; }
+
+        private:
+            T* data_ = nullptr;
+            size_t size_ = 0;
+    };
+
+    // Bump allocator for the nodes of one AST. Nodes are never freed one at
+    // a time: the arena releases all of them at once when it is destroyed,
+    // running destructors only for the objects that have one (the nodes
+    // holding strings).
+    class AstArena {
+        public:
+            AstArena() = default;
+            AstArena(const AstArena&) = delete;
+            AstArena& operator=(const AstArena&) = delete;
+            ~AstArena();
+
+            template <class T, class... Args>
+            T* make(Args&&... args) {
+                T* obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+                if constexpr (!std::is_trivially_destructible_v<T>) register_cleanup<T>(obj, 1);
+                return obj;
+            }
+
+            // Moves items[from, end) into a contiguous arena array and drops
+            // them from items. Parsers collect children on one reusable
+            // vector and copy each node's run out when the node is complete.
+            template <class T>
+            AstList<T> list(std::vector<T>& items, size_t from = 0) {
+                size_t n = items.size() - from;
+                if (n == 0) return {};
+                T* data = static_cast<T*>(allocate(sizeof(T) * n, alignof(T)));
+                for (size_t i = 0; i < n; ++i) new (data + i) T(std::move(items[from + i]));
+                items.resize(from);
+                if constexpr (!std::is_trivially_destructible_v<T>) register_cleanup<T>(data, n);
+                return {data, n};
+            }
+
+        private:
+            struct Cleanup {
+                void (*destroy)(void*, size_t);
+                void* objects;
+                size_t count;
+            };
+
+            void* allocate(size_t size, size_t align);
+
+            template <class T>
+            void register_cleanup(T* objects, size_t count) {
+                cleanups_.push_back({[](void* p, size_t n) {
+                    for (size_t i = 0; i < n; ++i) static_cast<T*>(p)[i].~T();
+                }, objects, count});
+            }
+
+            std::vector<std::unique_ptr<char[]>> chunks_;
+            char* cursor_ = nullptr;
+            char* limit_ = nullptr;
+            size_t next_chunk_ = 16 * 1024;
+            std::vector<Cleanup> cleanups_;
+    };
+
+    // Nodes live in an AstArena and are destroyed with it, never through a
+    // Node pointer, so the destructor is neither virtual nor public. That
+    // keeps the nodes without strings trivially destructible.
     struct Node {
         SourceSpan span;
         virtual void accept(Visitor* visitor) = 0;
-        virtual ~Node() {}
+        protected:
+            ~Node() = default;
     };
 
     struct Statement: Node {
@@ -48,8 +129,17 @@ namespace mitscript {
         virtual void accept(Visitor* visitor) = 0;
     };
 
+    // Where the resolver (resolver.hpp) found a variable: `depth` frames up
+    // the lexical chain at `slot`, or in global slot `slot`.
+    struct VarSlot {
+        static constexpr int kGlobal = -1;
+        int depth = kGlobal;
+        int slot = -1;
+    };
+
     struct Variable: public Expression {
         std::string name;
+        VarSlot where;
 
         void accept(Visitor* visitor) override;
     };
@@ -84,39 +174,42 @@ namespace mitscript {
     enum class UnOp {NEG, NOT};
 
 
+    // The root of a parsed program. It owns the arena every other node of
+    // the tree is allocated from.
     class AST : public Node{
         public:
-            std::vector<std::unique_ptr<Statement>> statements;
+            AstArena arena;
+            AstList<Statement*> statements;
             void accept(Visitor* visitor) override;
     };
 
     class Block : public Statement{
         public:
-            std::vector<std::unique_ptr<Statement>> statements;
+            AstList<Statement*> statements;
 
             void accept(Visitor* visitor) override;
     };
 
     class Assignment : public Statement{
         public:
-            std::unique_ptr<Expression> target;
-            std::unique_ptr<Expression> value;
+            Expression* target = nullptr;
+            Expression* value = nullptr;
 
             void accept(Visitor* visitor) override;
     };
 
     class IfStatement : public Statement{
         public:
-            std::unique_ptr<Expression> condition;
-            std::unique_ptr<Block> then_block;
-            std::unique_ptr<Block> else_block; // can be nullptr
+            Expression* condition = nullptr;
+            Block* then_block = nullptr;
+            Block* else_block = nullptr; // can be nullptr
 
             void accept(Visitor* visitor) override;
     };
 
     class Return : public Statement{
         public:
-            std::unique_ptr<Expression> value;
+            Expression* value = nullptr;
 
             void accept(Visitor* visitor) override;
     };
@@ -124,15 +217,15 @@ namespace mitscript {
     class BinaryExpression : public Expression {
         public:
             BinOp op;
-            std::unique_ptr<Expression> left;
-            std::unique_ptr<Expression> right;
+            Expression* left = nullptr;
+            Expression* right = nullptr;
 
             void accept(Visitor* visitor) override;
     };
 
     class FieldDereference : public Expression{
         public:
-            std::unique_ptr<Expression> object;
+            Expression* object = nullptr;
             std::string field_name;
 
             void accept(Visitor* visitor) override;
@@ -140,8 +233,8 @@ namespace mitscript {
 
     class Call : public Expression {
         public:
-            std::unique_ptr<Expression> callee;
-            std::vector<std::unique_ptr<Expression>> arguments;
+            Expression* callee = nullptr;
+            AstList<Expression*> arguments;
 
             void accept(Visitor* visitor) override;
     };
@@ -162,21 +255,22 @@ namespace mitscript {
     class Global : public Statement {
         public:
             std::string name;
+            int slot = -1; // global slot, set by the resolver
 
             void accept(Visitor* visitor) override;
     };
 
     class CallStatement : public Statement {
         public:
-            std::unique_ptr<Call> call;
+            Call* call = nullptr;
 
             void accept(Visitor* visitor) override;
     };
 
     class WhileLoop : public Statement{
         public:
-            std::unique_ptr<Expression> condition;
-            std::unique_ptr<Block> body;
+            Expression* condition = nullptr;
+            Block* body = nullptr;
 
             void accept(Visitor* visitor) override;
     };
@@ -184,8 +278,15 @@ namespace mitscript {
     class FunctionDeclaration : public Expression{
         public:
             std::string name;
-            std::vector<std::string> args;
-            std::unique_ptr<Block> body;
+            AstList<std::string> args;
+            Block* body = nullptr;
+
+            // Set by the resolver: the frame's slot count, the slot each
+            // argument is bound to (-1 when the parameter is declared
+            // global) and the global slots the body declares.
+            int frame_size = 0;
+            AstList<int> param_slots;
+            AstList<int> global_slots;
 
             void accept(Visitor* visitor) override;
     };
@@ -193,22 +294,22 @@ namespace mitscript {
     class UnaryExpression : public Expression {
         public:
             UnOp op;
-            std::unique_ptr<Expression> operand;
+            Expression* operand = nullptr;
 
         void accept(Visitor* visitor) override;
     };
 
     class IndexExpression : public Expression {
         public:
-            std::unique_ptr<Expression> baseExpression;
-            std::unique_ptr<Expression> indexExpression;
+            Expression* baseExpression = nullptr;
+            Expression* indexExpression = nullptr;
 
         void accept(Visitor* visitor) override;
     };
 
     class Record : public Expression {
         public:
-            std::vector<std::pair<std::string, std::unique_ptr<Expression>>> fields;
+            AstList<std::pair<std::string, Expression*>> fields;
 
         void accept(Visitor* visitor) override;
     };
@@ -1,7 +1,7 @@
 #include "./ast.hpp"
 #include "./interpreter.hpp"
+#include "./resolver.hpp"
 #include "../gc/gc.hpp"
-#include <unordered_set>
 #include <iostream>
 #include <functional>
 #include <unordered_map>
@@ -9,11 +9,7 @@
 #include <stdexcept>
 #include <vector>
 #include <algorithm>
-
-struct EnumHash {
-  template <class T>
-  size_t operator()(T v) const noexcept { return static_cast<size_t>(v); }
-};
+#include <cstdint>
 
 // Helper to raise cast errors consistently
 static inline void cast_error(const char* msg) {
@@ -30,7 +26,6 @@ namespace mitscript {
     class StackFrame;
     class Value;
     class BooleanValue;
-    class IntegerValue;
     class StringValue;
     class RecordValue;
     class FunctionValue;
@@ -44,109 +39,32 @@ namespace mitscript {
             virtual std::string toString() const = 0;
     };
 
-    struct ReturnSignal {Value* value;};
-    std::string str(Value*);
-    // Forward declarations
-    std::unordered_set<std::string> get_globals(Block* b);
-    std::unordered_set<std::string> get_globals(IfStatement* if_stmt);
-    std::unordered_set<std::string> get_globals(WhileLoop* while_stmt);
-    // Forward declarations for variable collection helpers
-    std::unordered_set<std::string> get_vars(Block* b);
-    std::unordered_set<std::string> get_vars(IfStatement* if_stmt);
-    std::unordered_set<std::string> get_vars(WhileLoop* while_stmt);
-    std::unordered_set<std::string> get_vars(Assignment* assign_stmt);
-
-    std::unordered_set<std::string> get_globals(Block* b) {
-        std::unordered_set<std::string> globals;
-        for (const auto& statement_ptr : b->statements) {
-            Statement* statement = statement_ptr.get();
-            if (auto if_stmt = dynamic_cast<IfStatement*>(statement)) {
-                auto if_globals = get_globals(if_stmt);
-                globals.insert(if_globals.begin(), if_globals.end());
-
-            } else if (auto while_stmt = dynamic_cast<WhileLoop*>(statement)) {
-                auto loop_globals = get_globals(while_stmt);
-                globals.insert(loop_globals.begin(), loop_globals.end());
-            } else if (auto global_stmt = dynamic_cast<Global*>(statement)) {
-                globals.insert(global_stmt->name);
-            } else if (auto block_stmt = dynamic_cast<Block*>(statement)) {
-                auto block_globals = get_globals(block_stmt);
-                globals.insert(block_globals.begin(), block_globals.end());
-            }
-        }
-        return globals;
-    }
-
+    // Integers are immediates, not heap objects: the int sits in the upper
+    // half of the Value* and the low bit is set, which no real (aligned)
+    // Value* has. Check is_int before dereferencing a Value*.
+    static_assert(sizeof(uintptr_t) == 8, "integer immediates need 64-bit pointers");
 
-    std::unordered_set<std::string> get_globals(IfStatement* if_stmt) {
-        std::unordered_set<std::string> globals;
-        if (if_stmt->then_block) {
-            auto then_globals = get_globals(if_stmt->then_block.get());
-            globals.insert(then_globals.begin(), then_globals.end());
-        }
-        if (if_stmt->else_block) {
-            auto else_globals = get_globals(if_stmt->else_block.get());
-            globals.insert(else_globals.begin(), else_globals.end());
-        }
-        return globals;
+    inline bool is_int(const Value* v) {
+        return reinterpret_cast<uintptr_t>(v) & 1;
     }
 
-    std::unordered_set<std::string> get_globals(WhileLoop* while_stmt) {
-        return get_globals(while_stmt->body.get());
-    }
-
-    std::unordered_set<std::string> get_vars(Block* b) {
-        std::unordered_set<std::string> vars;
-        for (const auto& statement_ptr : b->statements) {
-            Statement* statement = statement_ptr.get();
-            if (auto if_stmt = dynamic_cast<IfStatement*>(statement)) {
-                auto if_vars = get_vars(if_stmt);
-                vars.insert(if_vars.begin(), if_vars.end());
-
-            } else if (auto while_stmt = dynamic_cast<WhileLoop*>(statement)) {
-                auto loop_vars = get_vars(while_stmt);
-                vars.insert(loop_vars.begin(), loop_vars.end());
-            } else if (auto assign_stmt = dynamic_cast<Assignment*>(statement)){
-                auto assignment_vars = get_vars(assign_stmt);
-                vars.insert(assignment_vars.begin(), assignment_vars.end());
-            } else if (auto block_stmt = dynamic_cast<Block*>(statement)) {
-                auto block_vars = get_vars(block_stmt);
-                vars.insert(block_vars.begin(), block_vars.end());
-            }
-        }
-        return vars;
-    }
-
-
-    std::unordered_set<std::string> get_vars(IfStatement* if_stmt) {
-        std::unordered_set<std::string> vars;
-        if (if_stmt->then_block) {
-            auto then_vars = get_vars(if_stmt->then_block.get());
-            vars.insert(then_vars.begin(), then_vars.end());
-        }
-        if (if_stmt->else_block) {
-            auto else_vars = get_vars(if_stmt->else_block.get());
-            vars.insert(else_vars.begin(), else_vars.end());
-        }
-        return vars;
+    inline int32_t int_value(const Value* v) {
+        return static_cast<int32_t>(reinterpret_cast<uintptr_t>(v) >> 32);
     }
 
-    std::unordered_set<std::string> get_vars(WhileLoop* while_stmt) {
-        return get_vars(while_stmt->body.get());
+    inline Value* int_immediate(int32_t i) {
+        return reinterpret_cast<Value*>((static_cast<uintptr_t>(static_cast<uint32_t>(i)) << 32) | 1);
     }
 
-    std::unordered_set<std::string> get_vars(Assignment* assign_stmt) {
-        std::unordered_set<std::string> vars;
-        if (auto var_target = dynamic_cast<Variable*>(assign_stmt->target.get())) {
-            vars.insert(var_target->name);
-        }
-        return vars;
+    // dynamic_cast for a Value* that may be an integer immediate.
+    template <class T>
+    T* value_cast(Value* v) {
+        return is_int(v) ? nullptr : dynamic_cast<T*>(v);
     }
 
-
-
-    // Forward declaration of operator evaluation table (defined later)
-    extern std::unordered_map<BinOp, std::function<Value*(Value*, Value*, CollectedHeap*)>, EnumHash> evaluate_lambdas;
+    struct ReturnSignal {Value* value;};
+    std::string str(Value*);
+    Value* evaluate(BinOp op, Value* l, Value* r, CollectedHeap* heap);
 
     class BooleanValue : public Value {
         public:
@@ -183,16 +101,6 @@ namespace mitscript {
 
 
 
-    class IntegerValue : public Value {
-        public:
-            int value;
-            IntegerValue(int v) : value(v) {};
-            std::string toString() const override {
-                return std::to_string(value);
-            }
-            void follow(CollectedHeap&) override {}
-    };
-
     class StringValue : public Value {
         public:
             std::string value;
@@ -245,7 +153,7 @@ namespace mitscript {
                 std::sort(var_value_list.begin(), var_value_list.end());
 
                 for (const auto& pair : var_value_list) {
-                    result += pair.first + ":" + pair.second->toString() + " ";
+                    result += pair.first + ":" + str(pair.second) + " ";
                 }
                 // if (!record_map.empty()) {
                 //     result.pop_back();
@@ -255,7 +163,7 @@ namespace mitscript {
             }
             void follow(CollectedHeap& heap) override {
                 for (const auto& pair : record_map) {
-                    heap.markSuccessors(pair.second);
+                    if (!is_int(pair.second)) heap.markSuccessors(pair.second);
                 }
             }
     };
@@ -263,11 +171,10 @@ namespace mitscript {
     class FunctionValue : public Value {
         public:
             StackFrame* defining_env;
-            std::vector<std::string> args;
-            Block* body;
+            FunctionDeclaration* decl; // in the AST's arena, which outlives the heap
 
-            FunctionValue(StackFrame* defining_env, std::vector<std::string> x, Block* s)
-                : defining_env(defining_env), args(x), body(s) {};
+            FunctionValue(StackFrame* defining_env, FunctionDeclaration* decl)
+                : defining_env(defining_env), decl(decl) {};
 
             std::string toString() const override {
                 return "FUNCTION";
@@ -290,47 +197,22 @@ namespace mitscript {
             void follow(CollectedHeap&) override {}
     };
 
+    // One activation's variables, in the slots the resolver gave them.
+    // Function frames start with every slot None; the global frame starts
+    // with them unset (nullptr) and reading one of those is an error.
     class StackFrame: public Collectable {
         public:
             StackFrame* global_frame;
-            std::unordered_map<std::string, Value*> frame;
             StackFrame* parent_frame;
-            std::unordered_set<std::string> global_vars;
-            CollectedHeap* heap;
+            std::vector<Value*> slots;
 
-            StackFrame(StackFrame* parent, CollectedHeap* heap)
+            StackFrame(StackFrame* parent, size_t size, Value* initial)
                 : global_frame(parent ? parent->global_frame : this),
-                  parent_frame(parent), heap(heap) {
-                        if (!parent) {
-                            // Print Built-In Function
-                        global_frame->frame["print"] = heap->allocate<NativeFunctionValue>("print", 1, [](const std::vector<Value*>& args, Interpreter& interp) -> Value* {
-                            (void)interp;
-                            std::string out = str(args[0]);
-                            while (!out.empty() && out.back() == ' ') out.pop_back();
-                            std::cout << out << std::endl;
-                            return NoneValue::instance();
-                        });
-
-                            global_frame->frame["input"] = heap->allocate<NativeFunctionValue>("input", 0, [heap](const std::vector<Value*>& args, Interpreter& interp) -> Value* {
-                            (void)args;
-                            (void)interp;
-                            std::string line;
-                            std::getline(std::cin, line);
-                            return heap->allocate<StringValue>(line);
-                        });
-
-                        // global_frame -> frame["intcast"] = new NativeFunctionValue("intcast", 1, [](const std::vector<Value*>& args, Interpreter& interp) -> Value* {
-                        global_frame -> frame["intcast"] = heap->allocate<NativeFunctionValue>("intcast", 1, [heap](const std::vector<Value*>& args, Interpreter& interp) -> Value* {
-                            (void)interp;
-                            return heap->allocate<IntegerValue>(atoi(str(args[0]).c_str()));
-                        });
-
-                    }
-                    };
+                  parent_frame(parent), slots(size, initial) {}
 
             void follow(CollectedHeap& heap) override {
-                for (const auto& pair : frame) {
-                    heap.markSuccessors(pair.second);
+                for (Value* value : slots) {
+                    if (!is_int(value)) heap.markSuccessors(value);
                 }
                 if (parent_frame) {
                     heap.markSuccessors(parent_frame);
@@ -340,46 +222,16 @@ namespace mitscript {
                 }
             }
 
-            void set_global(const std::string& name) {
-                global_vars.insert(name);
-
-                auto it = frame.find(name);
-                if (it != frame.end()) {
-                    global_frame->frame[name] = it->second;
-                    frame.erase(it);
+            Value*& slot(VarSlot where) {
+                if (where.depth == VarSlot::kGlobal) {
+                    return global_frame->slots[where.slot];
                 }
-                if (global_frame->frame.find(name) == global_frame->frame.end()) {
-                    global_frame->frame[name] = NoneValue::instance();
+                StackFrame* frame = this;
+                for (int i = 0; i < where.depth; i++) {
+                    frame = frame->parent_frame;
                 }
+                return frame->slots[where.slot];
             }
-
-
-            void set_variable(const std::string& name, Value* value) {
-                StackFrame& frame_to_write = lookup_write(name);
-                frame_to_write.frame[name] = value;
-            }
-
-        Value* lookup_read(std::string name) {
-            if (global_vars.count(name) && global_frame != this){
-                return global_frame -> lookup_read(name);
-            }
-
-            if (frame.find(name) != frame.end()) {
-                return frame[name];
-            }
-
-            if (parent_frame != nullptr) {
-                return parent_frame -> lookup_read(name);
-            }
-
-            throw std::runtime_error("UninitializedVariableException - Variable not found: " + name);
-        };
-
-        StackFrame& lookup_write(std::string name) {
-            return global_vars.count(name) ? *global_frame : *this;
-        }
-
-
     };
 
     class Interpreter : public Visitor {
@@ -390,8 +242,37 @@ namespace mitscript {
 
             Value* rval_;
             std::vector<StackFrame*> stack;
-            Interpreter() : heap(new CollectedHeap()), rval_(nullptr), stack() {
-                stack.push_back(heap->allocate<StackFrame>(nullptr, heap));
+            std::vector<std::string> global_names; // by global slot
+
+            Interpreter(std::vector<std::string> globals)
+                : heap(new CollectedHeap()), rval_(nullptr), stack(), global_names(std::move(globals)) {
+                stack.push_back(heap->allocate<StackFrame>(nullptr, global_names.size(), nullptr));
+
+                define_native("print", 1, [](const std::vector<Value*>& args, Interpreter& interp) -> Value* {
+                    (void)interp;
+                    std::string out = str(args[0]);
+                    while (!out.empty() && out.back() == ' ') out.pop_back();
+                    std::cout << out << '\n';
+                    return NoneValue::instance();
+                });
+
+                define_native("input", 0, [](const std::vector<Value*>& args, Interpreter& interp) -> Value* {
+                    (void)args;
+                    std::string line;
+                    std::getline(std::cin, line);
+                    return interp.heap->allocate<StringValue>(line);
+                });
+
+                define_native("intcast", 1, [](const std::vector<Value*>& args, Interpreter& interp) -> Value* {
+                    (void)interp;
+                    return int_immediate(atoi(str(args[0]).c_str()));
+                });
+            }
+
+            // Binds a built-in, which the resolver must have been given.
+            void define_native(const std::string& name, size_t arg_count, NativeFunctionValue::Impl impl) {
+                size_t slot = std::find(global_names.begin(), global_names.end(), name) - global_names.begin();
+                stack.front()->slots.at(slot) = heap->allocate<NativeFunctionValue>(name, arg_count, std::move(impl));
             }
 
             void visit(AST* node) {
@@ -410,18 +291,15 @@ namespace mitscript {
             void visit(Assignment* node) {
 
 
-                if (auto var_assignment = dynamic_cast<Variable*>(node -> target.get())) {
-                    std::string var_name = var_assignment -> name;
-
+                if (auto var_assignment = dynamic_cast<Variable*>(node -> target)) {
                     node -> value -> accept(this);
-                    Value* value = rval_;
-                    stack.back() -> set_variable(var_name, value);
+                    stack.back() -> slot(var_assignment -> where) = rval_;
 
-                } else if (auto field_deref = dynamic_cast<FieldDereference*>(node -> target.get())) {
-                    auto* object = field_deref -> object.get();
+                } else if (auto field_deref = dynamic_cast<FieldDereference*>(node -> target)) {
+                    auto* object = field_deref -> object;
                     object -> accept(this);
                     Value* target = rval_;
-                    if (auto rec = dynamic_cast<RecordValue*>(target)) {
+                    if (auto rec = value_cast<RecordValue>(target)) {
 
                         node -> value -> accept(this);
                         Value* value = rval_;
@@ -431,12 +309,12 @@ namespace mitscript {
                         throw std::runtime_error("IllegalCastException -- Expected Record Type for Field Dereference");
                     }
 
-                } else if (auto idx_expr = dynamic_cast<IndexExpression*>(node -> target.get())) {
+                } else if (auto idx_expr = dynamic_cast<IndexExpression*>(node -> target)) {
                     idx_expr -> baseExpression -> accept(this);
                     Value* target = rval_;
                     idx_expr -> indexExpression -> accept(this);
                     Value* index = rval_;
-                    if (auto rec = dynamic_cast<RecordValue*>(target)) {
+                    if (auto rec = value_cast<RecordValue>(target)) {
                         node -> value -> accept(this);
                         Value* value = rval_;
                         rec -> add_entry(str(index), value);
@@ -452,7 +330,7 @@ namespace mitscript {
             void visit(IfStatement* node) {
                 node -> condition -> accept(this);
                 Value* result = rval_;
-                if (auto condition_result = dynamic_cast<BooleanValue*>(result)) {
+                if (auto condition_result = value_cast<BooleanValue>(result)) {
                     if (condition_result->value()) {
                         node ->then_block -> accept(this);
 
@@ -486,14 +364,14 @@ namespace mitscript {
                 Value* right_val = rval_;
                 auto op = node -> op;
 
-                rval_ = evaluate_lambdas.at(op)(left_val, right_val, heap);
+                rval_ = evaluate(op, left_val, right_val, heap);
 
             }
 
             void visit(FieldDereference* node) {
                 node -> object -> accept(this);
                 Value* record = rval_;
-                if (auto record_val = dynamic_cast<RecordValue*>(record)) {
+                if (auto record_val = value_cast<RecordValue>(record)) {
                     rval_ = record_val -> get_entry(node ->field_name, heap);
                 } else {
                     throw std::runtime_error("IllegalCastException -- Expected Record Type for Field Dereference");
@@ -503,7 +381,7 @@ namespace mitscript {
             void visit(Call* node) {
                 node -> callee -> accept(this);
                 Value* func = rval_;
-                if (auto native_func_expr = dynamic_cast<NativeFunctionValue*>(func)) {
+                if (auto native_func_expr = value_cast<NativeFunctionValue>(func)) {
 
                     std::vector<Value*> evaluated_arguments;
                     for (const auto& arg : node->arguments) { arg->accept(this); evaluated_arguments.push_back(rval_); }
@@ -516,53 +394,38 @@ namespace mitscript {
                     rval_ = native_func_expr->impl(evaluated_arguments, *this);   // no new frame for natives
                     return;
 
-                } else if (auto func_expr = dynamic_cast<FunctionValue*>(func)) {
+                } else if (auto func_expr = value_cast<FunctionValue>(func)) {
                     std::vector<Value*> evaluated_arguments;
                     for (const auto& arg : node -> arguments) {
                         arg -> accept(this);
                         evaluated_arguments.push_back(rval_);
                     }
 
-                    if (evaluated_arguments.size() != func_expr -> args.size()) {
+                    FunctionDeclaration* decl = func_expr -> decl;
+                    if (evaluated_arguments.size() != decl -> args.size()) {
                         throw std::runtime_error("RuntimeException -- argument count mismatch");
                     }
 
-                    StackFrame *new_frame = heap->allocate<StackFrame>(func_expr -> defining_env, heap);
-                    // StackFrame *new_frame = new StackFrame(func_expr -> defining_env);
+                    StackFrame *new_frame = heap->allocate<StackFrame>(
+                        func_expr -> defining_env, decl -> frame_size, NoneValue::instance());
 
-                    // for (const auto& stmt : func_expr->body->statements) {
-                    //     if (auto glob_stmt = dynamic_cast<Global*>(stmt.get())) {
-                    //         new_frame->set_global(glob_stmt->name);
-                    //     }
-                    // }
-                    auto global_vars = get_globals(func_expr -> body);
-                    auto vars = get_vars(func_expr -> body);
-
-                    for (const auto& var : global_vars) {
-                        new_frame -> set_global(var);
+                    // Declaring a global defines it.
+                    for (int slot : decl -> global_slots) {
+                        Value*& global = new_frame -> global_frame -> slots[slot];
+                        if (!global) global = NoneValue::instance();
                     }
 
-                    for (const auto& var : vars) {
-                        if (new_frame -> global_vars.count(var)) {
-                            continue;
+                    for (size_t i = 0; i < evaluated_arguments.size(); i++) {
+                        if (decl -> param_slots[i] >= 0) {
+                            new_frame -> slots[decl -> param_slots[i]] = evaluated_arguments[i];
                         }
-                        new_frame -> frame[var] = NoneValue::instance();
-
                     }
 
-                    for (size_t i = 0; i < func_expr -> args.size(); i++) {
-                        std::string param_name = func_expr ->args[i];
-                        if (new_frame -> global_vars.count(param_name)) {
-                            continue;
-                        }
-                        new_frame -> frame[param_name] = evaluated_arguments[i];
-                    };
-
                     this -> stack.push_back(new_frame);
 
                     try {
                         rval_ = NoneValue::instance();
-                        func_expr -> body -> accept(this);
+                        decl -> body -> accept(this);
                         rval_ = NoneValue::instance();
                     } catch (ReturnSignal rs) {
                         rval_ = rs.value;
@@ -578,7 +441,7 @@ namespace mitscript {
             }
 
             void visit(IntegerConstant* node) {
-                rval_ = heap->allocate<IntegerValue>(node -> value);
+                rval_ = int_immediate(node -> value);
             }
 
             void visit(NoneConstant* /*node*/) {
@@ -586,7 +449,8 @@ namespace mitscript {
             }
 
             void visit(Global* node) {
-                stack.back() -> set_global(node -> name);
+                Value*& global = stack.back() -> global_frame -> slots[node -> slot];
+                if (!global) global = NoneValue::instance();
             }
 
             void visit(CallStatement* node) {
@@ -596,7 +460,7 @@ namespace mitscript {
             void visit(WhileLoop* node) {
                 while (true) {
                     node -> condition -> accept(this);
-                    if (auto condition_res = dynamic_cast<BooleanValue*>(rval_)) {
+                    if (auto condition_res = value_cast<BooleanValue>(rval_)) {
                         if (condition_res->value()) {
                             node -> body -> accept(this);
                         } else {
@@ -609,23 +473,20 @@ namespace mitscript {
             }
 
             void visit(FunctionDeclaration* node) {
-                FunctionValue* new_function = heap->allocate<FunctionValue>(
-                    stack.back(), node->args, node->body.get()
-                );
+                FunctionValue* new_function = heap->allocate<FunctionValue>(stack.back(), node);
                 rval_ = new_function;
 
             }
 
             void visit(UnaryExpression* node) {
                 node -> operand -> accept(this);
-                if (auto operand_int = dynamic_cast<IntegerValue*>(rval_)) {
+                if (is_int(rval_)) {
                     if (node -> op == UnOp::NEG) {
-                        IntegerValue* adj_int = heap->allocate<IntegerValue>(-1 * operand_int -> value);
-                        rval_ = adj_int;
+                        rval_ = int_immediate(-static_cast<uint32_t>(int_value(rval_)));
                     } else {
                         throw std::runtime_error("IllegalCastException -- Only Negative operator works for integer types");
                     }
-                } else if (auto operand_bool = dynamic_cast<BooleanValue*>(rval_)) {
+                } else if (auto operand_bool = value_cast<BooleanValue>(rval_)) {
                     if (node -> op == UnOp::NOT) {
                         rval_ = BooleanValue::from(!operand_bool->value());
                     } else {
@@ -639,7 +500,7 @@ namespace mitscript {
 
             void visit(IndexExpression* node) {
                 node -> baseExpression -> accept(this);
-                if (auto record_obj = dynamic_cast<RecordValue*>(rval_)) {
+                if (auto record_obj = value_cast<RecordValue>(rval_)) {
                     node -> indexExpression -> accept(this);
                     rval_ = record_obj -> get_entry(str(rval_), heap);
                 } else {
@@ -653,7 +514,7 @@ namespace mitscript {
                 for (size_t i = 0; i < node -> fields.size(); i++) {
                     const auto& pair = node->fields[i];
                     std::string name = pair.first;
-                    Expression* expr = pair.second.get();
+                    Expression* expr = pair.second;
                     expr -> accept(this);
                     map[name] = rval_;
                 }
@@ -678,7 +539,11 @@ namespace mitscript {
             }
 
             void visit(Variable* node) {
-                rval_ = stack.back() -> lookup_read(node -> name);
+                Value* value = stack.back() -> slot(node -> where);
+                if (!value) {
+                    throw std::runtime_error("UninitializedVariableException - Variable not found: " + node -> name);
+                }
+                rval_ = value;
             }
 
 
@@ -693,7 +558,9 @@ namespace mitscript {
     }
 
     void interpret(AST &node) {
-        Interpreter interpreter;
+        std::vector<std::string> globals = {"print", "input", "intcast"};
+        resolve(node, globals);
+        Interpreter interpreter(std::move(globals));
         try {
             node.accept(&interpreter);
         } catch (const ReturnSignal &rs) {
@@ -703,166 +570,102 @@ namespace mitscript {
     }
 
     std::string str(Value* val) {
-        if (dynamic_cast<StringValue*>(val))  return val->toString();
-        if (dynamic_cast<BooleanValue*>(val)) return val->toString();
-        if (dynamic_cast<IntegerValue*>(val)) return val->toString();
-        if (dynamic_cast<FunctionValue*>(val)) return "FUNCTION";
-        if (dynamic_cast<RecordValue*>(val)) return val->toString();
-        if (dynamic_cast<NoneValue*>(val))    return "None";
+        if (is_int(val)) return std::to_string(int_value(val));
+        if (value_cast<StringValue>(val))  return val->toString();
+        if (value_cast<BooleanValue>(val)) return val->toString();
+        if (value_cast<FunctionValue>(val)) return "FUNCTION";
+        if (value_cast<RecordValue>(val)) return val->toString();
+        if (value_cast<NoneValue>(val))    return "None";
         return "<unknown>";
     }
 
 
-    StringValue* bin_add(StringValue* l, StringValue* r, CollectedHeap* heap) {
-        return heap->allocate<StringValue>(l->value + r->value);
-    };
-
-    StringValue* bin_add(StringValue* l, IntegerValue* r, CollectedHeap* heap) {
-        return heap->allocate<StringValue>(str(l) + str(r));
-    };
-
-    StringValue* bin_add(IntegerValue* l, StringValue* r, CollectedHeap* heap) {
-        return heap->allocate<StringValue>(str(l) + str(r));
-    };
+    static inline int32_t int_operand(Value* v, const char* msg) {
+        if (!is_int(v)) cast_error(msg);
+        return int_value(v);
+    }
 
-    IntegerValue* bin_add(IntegerValue* l, IntegerValue* r, CollectedHeap* heap) {
-        return heap->allocate<IntegerValue>(l->value + r->value);
-    };
+    static inline bool bool_operand(Value* v, const char* msg) {
+        auto b = value_cast<BooleanValue>(v);
+        if (!b) cast_error(msg);
+        return b->value();
+    }
 
+    // Arithmetic wraps, as 32-bit two's complement.
+    static inline Value* wrap(uint32_t v) {
+        return int_immediate(static_cast<int32_t>(v));
+    }
 
-    std::unordered_map<BinOp, std::function<Value*(Value*, Value*, CollectedHeap*)>, EnumHash> evaluate_lambdas = {
-  // +
-  {BinOp::ADD, [](Value* l, Value* r, CollectedHeap* heap) -> Value* {
-      if (auto li = dynamic_cast<IntegerValue*>(l)) {
-        if (auto ri = dynamic_cast<IntegerValue*>(r))
-          return heap->allocate<IntegerValue>(li->value + ri->value);
-      }
-
-      // If either is string, concatenate str(lhs) + str(rhs)
-      if (dynamic_cast<StringValue*>(l) || dynamic_cast<StringValue*>(r)) {
-        return heap->allocate<StringValue>(str(l) + str(r));
-      }
-      cast_error("operator '+' expects integers or strings");
-      return nullptr;
-  }},
-
-  // -
-  {BinOp::SUB, [](Value* l, Value* r, CollectedHeap* heap) -> Value* {
-      auto li = dynamic_cast<IntegerValue*>(l);
-      auto ri = dynamic_cast<IntegerValue*>(r);
-      if (!li || !ri) cast_error("operator '-' expects integers");
-      return heap->allocate<IntegerValue>(li->value - ri->value);
-  }},
-
-  // *
-  {BinOp::MUL, [](Value* l, Value* r, CollectedHeap* heap) -> Value* {
-      auto li = dynamic_cast<IntegerValue*>(l);
-      auto ri = dynamic_cast<IntegerValue*>(r);
-      if (!li || !ri) cast_error("operator '*' expects integers");
-      return heap->allocate<IntegerValue>(li->value * ri->value);
-  }},
-
-  // /
-  {BinOp::DIV, [](Value* l, Value* r, CollectedHeap* heap) -> Value* {
-      auto li = dynamic_cast<IntegerValue*>(l);
-      auto ri = dynamic_cast<IntegerValue*>(r);
-      if (!li || !ri) cast_error("operator '/' expects integers");
-      if (ri->value == 0) arith_error("divide by zero");
-      return heap->allocate<IntegerValue>(li->value / ri->value);
-  }},
-
-  // <
-  {BinOp::LT, [](Value* l, Value* r, CollectedHeap* heap) -> Value* {
-      (void)heap;
-      auto li = dynamic_cast<IntegerValue*>(l);
-      auto ri = dynamic_cast<IntegerValue*>(r);
-      if (!li || !ri) cast_error("operator '<' expects integers");
-      return BooleanValue::from(li->value < ri->value);
-  }},
-
-  // <=
-  {BinOp::LTE, [](Value* l, Value* r, CollectedHeap* heap) -> Value* {
-      (void)heap;
-      auto li = dynamic_cast<IntegerValue*>(l);
-      auto ri = dynamic_cast<IntegerValue*>(r);
-      if (!li || !ri) cast_error("operator '<=' expects integers");
-      return BooleanValue::from(li->value <= ri->value);
-  }},
-
-  // >
-  {BinOp::GT, [](Value* l, Value* r, CollectedHeap* heap) -> Value* {
-      (void)heap;
-      auto li = dynamic_cast<IntegerValue*>(l);
-      auto ri = dynamic_cast<IntegerValue*>(r);
-      if (!li || !ri) cast_error("operator '>' expects integers");
-      return BooleanValue::from(li->value > ri->value);
-  }},
-
-  // >=
-  {BinOp::GTE, [](Value* l, Value* r, CollectedHeap* heap) -> Value* {
-      (void)heap;
-      auto li = dynamic_cast<IntegerValue*>(l);
-      auto ri = dynamic_cast<IntegerValue*>(r);
-      if (!li || !ri) cast_error("operator '>=' expects integers");
-      return BooleanValue::from(li->value >= ri->value);
-  }},
-
-  // &
-  {BinOp::AND, [](Value* l, Value* r, CollectedHeap* heap) -> Value* {
-      (void)heap;
-      auto lb = dynamic_cast<BooleanValue*>(l);
-      auto rb = dynamic_cast<BooleanValue*>(r);
-      if (!lb || !rb) cast_error("operator '&' expects booleans");
-      return BooleanValue::from(lb->value() && rb->value());
-  }},
-
-  // |
-  {BinOp::OR, [](Value* l, Value* r, CollectedHeap* heap) -> Value* {
-      (void)heap;
-      auto lb = dynamic_cast<BooleanValue*>(l);
-      auto rb = dynamic_cast<BooleanValue*>(r);
-      if (!lb || !rb) cast_error("operator '|' expects booleans");
-      return BooleanValue::from(lb->value() || rb->value());
-  }},
-
-  // ==
-  {BinOp::EQ, [](Value* l, Value* r, CollectedHeap* heap) -> Value* {
-      (void)heap;
-      // Cross-type equality is FALSE
-      auto li = dynamic_cast<IntegerValue*>(l);
-      auto ri = dynamic_cast<IntegerValue*>(r);
-    if (li && ri) return BooleanValue::from(li->value == ri->value);
-
-      auto ls = dynamic_cast<StringValue*>(l);
-      auto rs = dynamic_cast<StringValue*>(r);
-    if (ls && rs) return BooleanValue::from(ls->value == rs->value);
-
-      auto lb = dynamic_cast<BooleanValue*>(l);
-      auto rb = dynamic_cast<BooleanValue*>(r);
-    if (lb && rb) return BooleanValue::from(lb->value() == rb->value());
-
-      auto lrec = dynamic_cast<RecordValue*>(l);
-      auto rrec = dynamic_cast<RecordValue*>(r);
-    if (lrec && rrec) return BooleanValue::from(lrec == rrec); // address identity
-
-      auto lf = dynamic_cast<FunctionValue*>(l);
-      auto rf = dynamic_cast<FunctionValue*>(r);
-      if (lf && rf) {
-        // Minimal: pointer identity. (If you later implement closure/body equality, adjust here.)
-    return BooleanValue::from(lf == rf);
-      }
-
-    if (auto lnf = dynamic_cast<NativeFunctionValue*>(l)) {
-        if (auto rnf = dynamic_cast<NativeFunctionValue*>(r))
-            return BooleanValue::from(lnf == rnf);
+    Value* evaluate(BinOp op, Value* l, Value* r, CollectedHeap* heap) {
+        switch (op) {
+            case BinOp::ADD:
+                if (is_int(l) && is_int(r)) {
+                    return wrap(static_cast<uint32_t>(int_value(l)) + static_cast<uint32_t>(int_value(r)));
+                }
+                // If either is string, concatenate str(lhs) + str(rhs)
+                if (value_cast<StringValue>(l) || value_cast<StringValue>(r)) {
+                    return heap->allocate<StringValue>(str(l) + str(r));
+                }
+                cast_error("operator '+' expects integers or strings");
+                return nullptr;
+
+            case BinOp::SUB: {
+                int32_t a = int_operand(l, "operator '-' expects integers");
+                int32_t b = int_operand(r, "operator '-' expects integers");
+                return wrap(static_cast<uint32_t>(a) - static_cast<uint32_t>(b));
+            }
+
+            case BinOp::MUL: {
+                int32_t a = int_operand(l, "operator '*' expects integers");
+                int32_t b = int_operand(r, "operator '*' expects integers");
+                return wrap(static_cast<uint32_t>(a) * static_cast<uint32_t>(b));
+            }
+
+            case BinOp::DIV: {
+                int32_t a = int_operand(l, "operator '/' expects integers");
+                int32_t b = int_operand(r, "operator '/' expects integers");
+                if (b == 0) arith_error("divide by zero");
+                if (b == -1) return wrap(-static_cast<uint32_t>(a));
+                return int_immediate(a / b);
+            }
+
+            case BinOp::LT:
+                return BooleanValue::from(int_operand(l, "operator '<' expects integers") <
+                                          int_operand(r, "operator '<' expects integers"));
+            case BinOp::LTE:
+                return BooleanValue::from(int_operand(l, "operator '<=' expects integers") <=
+                                          int_operand(r, "operator '<=' expects integers"));
+            case BinOp::GT:
+                return BooleanValue::from(int_operand(l, "operator '>' expects integers") >
+                                          int_operand(r, "operator '>' expects integers"));
+            case BinOp::GTE:
+                return BooleanValue::from(int_operand(l, "operator '>=' expects integers") >=
+                                          int_operand(r, "operator '>=' expects integers"));
+
+            case BinOp::AND: {
+                bool a = bool_operand(l, "operator '&' expects booleans");
+                bool b = bool_operand(r, "operator '&' expects booleans");
+                return BooleanValue::from(a && b);
+            }
+
+            case BinOp::OR: {
+                bool a = bool_operand(l, "operator '|' expects booleans");
+                bool b = bool_operand(r, "operator '|' expects booleans");
+                return BooleanValue::from(a || b);
+            }
+
+            case BinOp::EQ: {
+                // Cross-type equality is false. Integers compare by value
+                // (equal immediates are equal pointers), strings by
+                // contents, and everything else by identity: booleans and
+                // None are singletons, records and functions are objects.
+                if (l == r) return BooleanValue::from(true);
+                if (is_int(l) || is_int(r)) return BooleanValue::from(false);
+                auto ls = value_cast<StringValue>(l);
+                auto rs = value_cast<StringValue>(r);
+                return BooleanValue::from(ls && rs && ls->value == rs->value);
+            }
         }
-
-      // None equals itself only
-            if (dynamic_cast<NoneValue*>(l) && dynamic_cast<NoneValue*>(r))
-                return BooleanValue::from(true);
-
-      // Different types → false
-      return BooleanValue::from(false);
-  }},
-};
+        return nullptr;
+    }
 };
@@ -81,31 +81,6 @@ inline mitscript::TokenKind keyword_kind(const char* start, size_t len) {
     return TK::IDENTIFIER;
 }
 
-// Static strings for single-character tokens to avoid repeated allocations
-static const std::string STR_LBRACE = "{";
-static const std::string STR_RBRACE = "}";
-static const std::string STR_LBRACKET = "[";
-static const std::string STR_RBRACKET = "]";
-static const std::string STR_LPAREN = "(";
-static const std::string STR_RPAREN = ")";
-static const std::string STR_COMMA = ",";
-static const std::string STR_COLON = ":";
-static const std::string STR_SEMICOLON = ";";
-static const std::string STR_DOT = ".";
-static const std::string STR_MULT = "*";
-static const std::string STR_DIV = "/";
-static const std::string STR_ADD = "+";
-static const std::string STR_SUB = "-";
-static const std::string STR_BANG = "!";
-static const std::string STR_AMP = "&";
-static const std::string STR_BAR = "|";
-static const std::string STR_LT = "<";
-static const std::string STR_LE = "<=";
-static const std::string STR_GT = ">";
-static const std::string STR_GE = ">=";
-static const std::string STR_ASSIGN = "=";
-static const std::string STR_EQEQ = "==";
-
 } // anonymous namespace
 
 void mitscript::Lexer::skip_ws_and_comments(const char *&p, const char *end, int &line, int &col)
@@ -156,19 +131,17 @@ mitscript::Token mitscript::Lexer::make_error(const std::string &error_msg, int
     throw std::runtime_error("Lexer error at line " + std::to_string(start_line) + ", col " + std::to_string(start_col) + ": " + error_msg);
 }
 
-mitscript::Lexer::Lexer(const std::string &file_contents)
-    : input(file_contents), data(input.c_str()), size(input.size()), pos(0), current_line(1), current_col(1) {}
+mitscript::Lexer::Lexer(std::string_view file_contents)
+    : input(file_contents), data(input.data()), size(input.size()), pos(0), current_line(1), current_col(1) {}
 
 mitscript::Token
 mitscript::Lexer::lex_string(const char *&p, const char *end, int &line, int &col, int start_line, int start_col)
 {
+    // The token is the literal as written; the parser decodes it.
+    const char *start = p;
     ++p;
     ++col;
 
-    std::string string_literal;
-    string_literal.reserve(32);  // Reserve reasonable initial size
-    string_literal.push_back('"');
-
     while (p < end) {
         char c = *p;
 
@@ -181,10 +154,9 @@ mitscript::Lexer::lex_string(const char *&p, const char *end, int &line, int &co
         if (c == '"') {
             ++p;
             ++col;
-            string_literal.push_back('"');
             return mitscript::Token(mitscript::TokenKind::STRING,
-                                    std::move(string_literal), start_line, start_col,
-                                    line, col);
+                                    std::string_view(start, static_cast<size_t>(p - start)),
+                                    start_line, start_col, line, col);
         }
 
         if (c == '\\') {
@@ -201,8 +173,6 @@ mitscript::Lexer::lex_string(const char *&p, const char *end, int &line, int &co
             case '\\':
             case 'n':
             case 't':
-                string_literal.push_back('\\');
-                string_literal.push_back(e);
                 ++p;
                 ++col;
                 break;
@@ -215,7 +185,6 @@ mitscript::Lexer::lex_string(const char *&p, const char *end, int &line, int &co
             continue;
         }
 
-        string_literal.push_back(c);
         ++p;
         ++col;
     }
@@ -232,7 +201,7 @@ mitscript::Token mitscript::Lexer::lex_number(const char *&p, const char *end, i
         ++p;
         ++col;
     }
-    return mitscript::Token(mitscript::TokenKind::INT, std::string(start, static_cast<size_t>(p - start)), start_line, start_col, line, col);
+    return mitscript::Token(mitscript::TokenKind::INT, std::string_view(start, static_cast<size_t>(p - start)), start_line, start_col, line, col);
 }
 
 mitscript::Token mitscript::Lexer::lex_identifier_or_keyword(const char *&p, const char *end, int &line, int &col, int start_line, int start_col)
@@ -245,7 +214,7 @@ mitscript::Token mitscript::Lexer::lex_identifier_or_keyword(const char *&p, con
 
     size_t len = static_cast<size_t>(p - start);
     TokenKind kind = keyword_kind(start, len);
-    return mitscript::Token(kind, std::string(start, len), start_line, start_col, line, col);
+    return mitscript::Token(kind, std::string_view(start, len), start_line, start_col, line, col);
 }
 
 std::vector<mitscript::Token> mitscript::Lexer::lex()
@@ -287,100 +256,104 @@ std::vector<mitscript::Token> mitscript::Lexer::lex()
         }
 
         // Single and double-character operators
+        const char *tok = p;
+        auto emit = [&](TokenKind kind) {
+            tokens.emplace_back(kind, std::string_view(tok, static_cast<size_t>(p - tok)), sl, sc, line, col);
+        };
         switch (c) {
         case '{':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::LBRACE, STR_LBRACE, sl, sc, line, col);
+            emit(TokenKind::LBRACE);
             break;
         case '}':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::RBRACE, STR_RBRACE, sl, sc, line, col);
+            emit(TokenKind::RBRACE);
             break;
         case '[':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::LBRACKET, STR_LBRACKET, sl, sc, line, col);
+            emit(TokenKind::LBRACKET);
             break;
         case ']':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::RBRACKET, STR_RBRACKET, sl, sc, line, col);
+            emit(TokenKind::RBRACKET);
             break;
         case '(':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::LPAREN, STR_LPAREN, sl, sc, line, col);
+            emit(TokenKind::LPAREN);
             break;
         case ')':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::RPAREN, STR_RPAREN, sl, sc, line, col);
+            emit(TokenKind::RPAREN);
             break;
         case ',':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::COMMA, STR_COMMA, sl, sc, line, col);
+            emit(TokenKind::COMMA);
             break;
         case ':':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::COLON, STR_COLON, sl, sc, line, col);
+            emit(TokenKind::COLON);
             break;
         case ';':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::SEMICOLON, STR_SEMICOLON, sl, sc, line, col);
+            emit(TokenKind::SEMICOLON);
             break;
         case '.':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::DOT, STR_DOT, sl, sc, line, col);
+            emit(TokenKind::DOT);
             break;
         case '*':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::MULT, STR_MULT, sl, sc, line, col);
+            emit(TokenKind::MULT);
             break;
         case '/':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::DIV, STR_DIV, sl, sc, line, col);
+            emit(TokenKind::DIV);
             break;
         case '+':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::ADD, STR_ADD, sl, sc, line, col);
+            emit(TokenKind::ADD);
             break;
         case '-':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::SUB, STR_SUB, sl, sc, line, col);
+            emit(TokenKind::SUB);
             break;
         case '!':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::BANG, STR_BANG, sl, sc, line, col);
+            emit(TokenKind::BANG);
             break;
         case '&':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::AMP, STR_AMP, sl, sc, line, col);
+            emit(TokenKind::AMP);
             break;
         case '|':
             ++p; ++col;
-            tokens.emplace_back(TokenKind::BAR, STR_BAR, sl, sc, line, col);
+            emit(TokenKind::BAR);
             break;
         case '<':
             if (p + 1 < end && p[1] == '=') {
                 p += 2; col += 2;
-                tokens.emplace_back(TokenKind::LE, STR_LE, sl, sc, line, col);
+                emit(TokenKind::LE);
             } else {
                 ++p; ++col;
-                tokens.emplace_back(TokenKind::LT, STR_LT, sl, sc, line, col);
+                emit(TokenKind::LT);
             }
             break;
         case '>':
             if (p + 1 < end && p[1] == '=') {
                 p += 2; col += 2;
-                tokens.emplace_back(TokenKind::GE, STR_GE, sl, sc, line, col);
+                emit(TokenKind::GE);
             } else {
                 ++p; ++col;
-                tokens.emplace_back(TokenKind::GT, STR_GT, sl, sc, line, col);
+                emit(TokenKind::GT);
             }
             break;
         case '=':
             if (p + 1 < end && p[1] == '=') {
                 p += 2; col += 2;
-                tokens.emplace_back(TokenKind::EQEQ, STR_EQEQ, sl, sc, line, col);
+                emit(TokenKind::EQEQ);
             } else {
                 ++p; ++col;
-                tokens.emplace_back(TokenKind::ASSIGN, STR_ASSIGN, sl, sc, line, col);
+                emit(TokenKind::ASSIGN);
             }
             break;
         default: {
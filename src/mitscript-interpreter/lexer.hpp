@@ -2,6 +2,7 @@
 #include "./token.hpp"
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace mitscript
@@ -9,12 +10,13 @@ namespace mitscript
     class Lexer
     {
     public:
-        Lexer(const std::string &file_contents);
+        // Tokens view into file_contents, which must outlive them.
+        Lexer(std::string_view file_contents);
 
         std::vector<Token> lex();
 
     private:
-        std::string input;
+        std::string_view input;
         const char *data;
         size_t size;
         size_t pos;
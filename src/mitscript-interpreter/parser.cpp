@@ -1,5 +1,6 @@
 #include <stdexcept>
 #include <cstdlib>
+#include <string_view>
 
 #include "./token.hpp"
 #include "./ast.hpp"
@@ -14,19 +15,21 @@ namespace {
 const mitscript::Token eof_token(TokenKind::EOF_TOKEN, "", 0, 0, 0, 0);
 
 // Optimized integer parsing - faster than std::stoi for simple cases
-inline int fast_stoi(const std::string& s) {
-    const char* p = s.c_str();
+inline int fast_stoi(std::string_view s) {
     int result = 0;
-    while (*p >= '0' && *p <= '9') {
-        result = result * 10 + (*p - '0');
-        ++p;
+    for (char c : s) {
+        if (c < '0' || c > '9') break;
+        result = result * 10 + (c - '0');
     }
     return result;
 }
 
 // Decode string literal with escape sequences
-inline std::string decode_string_literal(const std::string &literal) {
-    if (literal.size() < 2) return literal;
+inline std::string decode_string_literal(std::string_view literal) {
+    if (literal.size() < 2) return std::string(literal);
+    // Most literals have nothing to unescape.
+    std::string_view body = literal.substr(1, literal.size() - 2);
+    if (body.find('\\') == std::string_view::npos) return std::string(body);
 
     std::string result;
     result.reserve(literal.size() - 2);
@@ -154,6 +157,8 @@ bool mitscript::Parser::match(TokenKind kind) {
 
 std::unique_ptr<mitscript::AST> mitscript::Parser::parse() {
     auto root = std::make_unique<mitscript::AST>();
+    arena_ = &root->arena;
+    size_t base = pending_statements_.size();
     while (!is_eof()) {
         auto statement = parse_statement();
         if (!statement) {
@@ -162,12 +167,13 @@ std::unique_ptr<mitscript::AST> mitscript::Parser::parse() {
             }
             break;
         }
-        root->statements.push_back(std::move(statement));
+        pending_statements_.push_back(statement);
     }
+    root->statements = arena_->list(pending_statements_, base);
     return root;
 }
 
-std::unique_ptr<mitscript::Statement> mitscript::Parser::parse_statement() {
+mitscript::Statement* mitscript::Parser::parse_statement() {
     TokenKind kind = (current < tokens.size()) ? tokens[current].kind : TokenKind::EOF_TOKEN;
 
     switch (kind) {
@@ -188,47 +194,49 @@ std::unique_ptr<mitscript::Statement> mitscript::Parser::parse_statement() {
     if (match(TokenKind::ASSIGN)) {
         auto rhs = parse_expression();
         expect(TokenKind::SEMICOLON, "Expected ';' after assignment");
-        auto asn = std::make_unique<mitscript::Assignment>();
-        asn->target = std::move(loc);
-        asn->value = std::move(rhs);
+        auto asn = arena_->make<mitscript::Assignment>();
+        asn->target = loc;
+        asn->value = rhs;
         return asn;
     }
 
     if (current < tokens.size() && tokens[current].kind == TokenKind::LPAREN) {
         // Support chained calls like b()()
-        std::unique_ptr<mitscript::Expression> expr = std::move(loc);
+        mitscript::Expression* expr = loc;
         while (current < tokens.size() && tokens[current].kind == TokenKind::LPAREN) {
-            expr = parse_call_from_location(std::move(expr));
+            expr = parse_call_from_location(expr);
         }
         expect(TokenKind::SEMICOLON, "Expected ';' after function call");
-        auto cs = std::make_unique<mitscript::CallStatement>();
-        auto *callPtr = dynamic_cast<mitscript::Call*>(expr.release());
+        auto cs = arena_->make<mitscript::CallStatement>();
+        auto *callPtr = dynamic_cast<mitscript::Call*>(expr);
         if (!callPtr) {
             error_here("Expected function call");
         }
-        cs->call.reset(callPtr);
+        cs->call = callPtr;
         return cs;
     }
 
     error_here("Expected assignment or function call statement");
 }
 
-std::unique_ptr<mitscript::Block> mitscript::Parser::parse_block() {
+mitscript::Block* mitscript::Parser::parse_block() {
     expect(TokenKind::LBRACE, "Expected '{' to start block");
-    auto block = std::make_unique<mitscript::Block>();
+    auto block = arena_->make<mitscript::Block>();
+    size_t base = pending_statements_.size();
 
     while (current < tokens.size() && tokens[current].kind != TokenKind::RBRACE) {
         auto statement = parse_statement();
         if (statement) {
-            block->statements.push_back(std::move(statement));
+            pending_statements_.push_back(statement);
         }
     }
+    block->statements = arena_->list(pending_statements_, base);
 
     expect(TokenKind::RBRACE, "Expected '}' to end block");
     return block;
 }
 
-std::unique_ptr<mitscript::IfStatement> mitscript::Parser::parse_if_statement() {
+mitscript::IfStatement* mitscript::Parser::parse_if_statement() {
     expect(TokenKind::IF, "Expected 'IF' to start an If statement");
     expect(TokenKind::LPAREN, "Expected opening paren, '(' after If");
     auto condition = parse_expression();
@@ -236,20 +244,20 @@ std::unique_ptr<mitscript::IfStatement> mitscript::Parser::parse_if_statement()
 
     auto then_block = parse_block();
 
-    std::unique_ptr<mitscript::Block> else_block;
+    mitscript::Block* else_block = nullptr;
     if (match(TokenKind::ELSE)) {
         else_block = parse_block();
     }
 
-    auto astNode = std::make_unique<mitscript::IfStatement>();
-    astNode->condition = std::move(condition);
-    astNode->then_block = std::move(then_block);
-    astNode->else_block = std::move(else_block);
+    auto astNode = arena_->make<mitscript::IfStatement>();
+    astNode->condition = condition;
+    astNode->then_block = then_block;
+    astNode->else_block = else_block;
 
     return astNode;
 }
 
-std::unique_ptr<mitscript::WhileLoop> mitscript::Parser::parse_while_loop() {
+mitscript::WhileLoop* mitscript::Parser::parse_while_loop() {
     expect(TokenKind::WHILE, "Expected 'While' to start a WHILE loop");
     expect(TokenKind::LPAREN, "Expected opening paren '(' after While");
 
@@ -258,71 +266,73 @@ std::unique_ptr<mitscript::WhileLoop> mitscript::Parser::parse_while_loop() {
 
     auto body = parse_block();
 
-    auto astNode = std::make_unique<mitscript::WhileLoop>();
-    astNode->condition = std::move(condition);
-    astNode->body = std::move(body);
+    auto astNode = arena_->make<mitscript::WhileLoop>();
+    astNode->condition = condition;
+    astNode->body = body;
 
     return astNode;
 }
 
-std::unique_ptr<mitscript::Return> mitscript::Parser::parse_return_statement() {
+mitscript::Return* mitscript::Parser::parse_return_statement() {
     expect(TokenKind::RETURN, "Expected Return for a return statement");
 
     auto return_value = parse_expression();
 
     expect(TokenKind::SEMICOLON, "Expected ';' after return");
 
-    auto astNode = std::make_unique<mitscript::Return>();
-    astNode->value = std::move(return_value);
+    auto astNode = arena_->make<mitscript::Return>();
+    astNode->value = return_value;
 
     return astNode;
 }
 
-std::unique_ptr<mitscript::Global> mitscript::Parser::parse_global_statement() {
+mitscript::Global* mitscript::Parser::parse_global_statement() {
     expect(TokenKind::GLOBAL, "Expected Global for a global statement");
 
     const auto& token = expect(TokenKind::IDENTIFIER, "Expected identifier after 'Global'");
 
     expect(TokenKind::SEMICOLON, "Expected ';' after global");
 
-    auto globalNode = std::make_unique<mitscript::Global>();
+    auto globalNode = arena_->make<mitscript::Global>();
     globalNode->name = token.text;
 
     return globalNode;
 }
 
-std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_expression() {
+mitscript::Expression* mitscript::Parser::parse_expression() {
     if (match(TokenKind::FUN)) {
         expect(TokenKind::LPAREN, "Expected '(' after 'fun'");
         std::vector<std::string> params;
         if (current < tokens.size() && tokens[current].kind != TokenKind::RPAREN) {
             const auto &id0 = expect(TokenKind::IDENTIFIER, "Expected parameter name");
-            params.push_back(id0.text);
+            params.emplace_back(id0.text);
             while (match(TokenKind::COMMA)) {
                 if (current < tokens.size() && tokens[current].kind == TokenKind::RPAREN) break;
                 const auto &id = expect(TokenKind::IDENTIFIER, "Expected parameter name");
-                params.push_back(id.text);
+                params.emplace_back(id.text);
             }
         }
         expect(TokenKind::RPAREN, "Expected ')' after parameters");
         auto body = parse_block();
-        auto fn = std::make_unique<mitscript::FunctionDeclaration>();
+        auto fn = arena_->make<mitscript::FunctionDeclaration>();
         fn->name = "";
-        fn->args = std::move(params);
-        fn->body = std::move(body);
+        fn->args = arena_->list(params);
+        fn->body = body;
         return fn;
     }
 
     if (match(TokenKind::LBRACE)) {
-        auto rec = std::make_unique<mitscript::Record>();
+        auto rec = arena_->make<mitscript::Record>();
+        std::vector<std::pair<std::string, mitscript::Expression*>> fields;
         while (current < tokens.size() && tokens[current].kind != TokenKind::RBRACE) {
             const auto &key = expect(TokenKind::IDENTIFIER, "Expected field name");
             expect(TokenKind::COLON, "Expected ':' after field name");
             auto val = parse_expression();
             expect(TokenKind::SEMICOLON, "Expected ';' after record field");
-            rec->fields.emplace_back(key.text, std::move(val));
+            fields.emplace_back(key.text, val);
         }
         expect(TokenKind::RBRACE, "Expected '}' to close record");
+        rec->fields = arena_->list(fields);
         return rec;
     }
 
@@ -330,23 +340,23 @@ std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_expression() {
     return parse_binary_expression(1);
 }
 
-std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_simple_expression() {
+mitscript::Expression* mitscript::Parser::parse_simple_expression() {
     auto lhs = parse_simple_atom();
     while (current < tokens.size() && is_binary_op(tokens[current].kind)) {
         auto opk = tokens[current].kind;
         int prec = precedence_of(opk);
         ++current;
         auto rhs = parse_binary_rhs(prec + 1);
-        auto b = std::make_unique<mitscript::BinaryExpression>();
+        auto b = arena_->make<mitscript::BinaryExpression>();
         b->op = token_to_binop(opk);
-        b->left = std::move(lhs);
-        b->right = std::move(rhs);
-        lhs = std::move(b);
+        b->left = lhs;
+        b->right = rhs;
+        lhs = b;
     }
     return lhs;
 }
 
-std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_binary_rhs(int min_prec) {
+mitscript::Expression* mitscript::Parser::parse_binary_rhs(int min_prec) {
     auto lhs = parse_simple_atom();
     while (current < tokens.size() && is_binary_op(tokens[current].kind) &&
            precedence_of(tokens[current].kind) >= min_prec) {
@@ -354,25 +364,25 @@ std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_binary_rhs(int m
         int prec = precedence_of(opk);
         ++current;
         auto rhs = parse_binary_rhs(prec + 1);
-        auto b = std::make_unique<mitscript::BinaryExpression>();
+        auto b = arena_->make<mitscript::BinaryExpression>();
         b->op = token_to_binop(opk);
-        b->left = std::move(lhs);
-        b->right = std::move(rhs);
-        lhs = std::move(b);
+        b->left = lhs;
+        b->right = rhs;
+        lhs = b;
     }
     return lhs;
 }
 
-std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_simple_atom() {
+mitscript::Expression* mitscript::Parser::parse_simple_atom() {
     // unary
     if (match(TokenKind::SUB)) {
-        auto u = std::make_unique<mitscript::UnaryExpression>();
+        auto u = arena_->make<mitscript::UnaryExpression>();
         u->op = mitscript::UnOp::NEG;
         u->operand = parse_simple_expression();
         return u;
     }
     if (match(TokenKind::BANG)) {
-        auto u = std::make_unique<mitscript::UnaryExpression>();
+        auto u = arena_->make<mitscript::UnaryExpression>();
         u->op = mitscript::UnOp::NOT;
         u->operand = parse_simple_expression();
         return u;
@@ -387,43 +397,43 @@ std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_simple_atom() {
 
     // literals
     if (match(TokenKind::INT)) {
-        auto c = std::make_unique<mitscript::IntegerConstant>();
+        auto c = arena_->make<mitscript::IntegerConstant>();
         c->value = fast_stoi(previous().text);
         return c;
     }
     if (match(TokenKind::STRING)) {
-        auto c = std::make_unique<mitscript::StringConstant>();
+        auto c = arena_->make<mitscript::StringConstant>();
         c->value = decode_string_literal(previous().text);
         return c;
     }
     if (match(TokenKind::TRUE)) {
-        auto c = std::make_unique<mitscript::BooleanConstant>();
+        auto c = arena_->make<mitscript::BooleanConstant>();
         c->value = true;
         return c;
     }
     if (match(TokenKind::FALSE)) {
-        auto c = std::make_unique<mitscript::BooleanConstant>();
+        auto c = arena_->make<mitscript::BooleanConstant>();
         c->value = false;
         return c;
     }
     if (match(TokenKind::NONE)) {
-        return std::make_unique<mitscript::NoneConstant>();
+        return arena_->make<mitscript::NoneConstant>();
     }
 
     // location, optionally followed by a call
     if (current < tokens.size() && tokens[current].kind == TokenKind::IDENTIFIER) {
         auto loc = parse_location();
         if (current < tokens.size() && tokens[current].kind == TokenKind::LPAREN) {
-            return parse_call_from_location(std::move(loc));
+            return parse_call_from_location(loc);
         }
         return loc;
     }
 
     error_here("Expected simple expression");
-    return std::make_unique<mitscript::NoneConstant>(); // unreachable
+    return arena_->make<mitscript::NoneConstant>(); // unreachable
 }
 
-std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_postfix_expression() {
+mitscript::Expression* mitscript::Parser::parse_postfix_expression() {
     auto expression = parse_primary_expression();
 
     while (true) {
@@ -434,39 +444,41 @@ std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_postfix_expressi
                        dynamic_cast<const mitscript::FieldDereference*>(e) != nullptr ||
                        dynamic_cast<const mitscript::IndexExpression*>(e) != nullptr;
             };
-            if (!isLocation(expression.get())) {
+            if (!isLocation(expression)) {
                 error_here("Callee must be a location (identifier, field, or index)");
             }
 
-            auto call = std::make_unique<mitscript::Call>();
-            call->callee = std::move(expression);
+            auto call = arena_->make<mitscript::Call>();
+            call->callee = expression;
+            size_t base = pending_arguments_.size();
 
             if (current < tokens.size() && tokens[current].kind != TokenKind::RPAREN) {
-                call->arguments.push_back(parse_expression());
+                pending_arguments_.push_back(parse_expression());
 
                 while (match(TokenKind::COMMA)) {
                     if (current < tokens.size() && tokens[current].kind == TokenKind::RPAREN) {
                         break;
                     }
-                    call->arguments.push_back(parse_expression());
+                    pending_arguments_.push_back(parse_expression());
                 }
             }
 
             expect(TokenKind::RPAREN, "Expected ')' after arguments");
-            expression = std::move(call);
+            call->arguments = arena_->list(pending_arguments_, base);
+            expression = call;
             continue;
         } else if (match(TokenKind::DOT)) {
             const auto &tok = expect(TokenKind::IDENTIFIER, "Expected field name after '.'");
-            auto fld = std::make_unique<mitscript::FieldDereference>();
-            fld->object = std::move(expression);
+            auto fld = arena_->make<mitscript::FieldDereference>();
+            fld->object = expression;
             fld->field_name = tok.text;
-            expression = std::move(fld);
+            expression = fld;
         } else if (match(TokenKind::LBRACKET)) {
-            auto idx = std::make_unique<mitscript::IndexExpression>();
-            idx->baseExpression = std::move(expression);
+            auto idx = arena_->make<mitscript::IndexExpression>();
+            idx->baseExpression = expression;
             idx->indexExpression = parse_expression();
             expect(TokenKind::RBRACKET, "Expected ']' after index expression");
-            expression = std::move(idx);
+            expression = idx;
         } else {
             break;
         }
@@ -475,7 +487,7 @@ std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_postfix_expressi
     return expression;
 }
 
-std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_binary_expression(int min_prec) {
+mitscript::Expression* mitscript::Parser::parse_binary_expression(int min_prec) {
     auto lhs = parse_unary_expression();
     while (current < tokens.size() && is_binary_op(tokens[current].kind)) {
         auto op_kind = tokens[current].kind;
@@ -484,24 +496,24 @@ std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_binary_expressio
 
         ++current;
         auto rhs = parse_binary_expression(precedence + 1);
-        auto ex = std::make_unique<mitscript::BinaryExpression>();
+        auto ex = arena_->make<mitscript::BinaryExpression>();
         ex->op = token_to_binop(op_kind);
-        ex->left = std::move(lhs);
-        ex->right = std::move(rhs);
+        ex->left = lhs;
+        ex->right = rhs;
 
-        lhs = std::move(ex);
+        lhs = ex;
     }
     return lhs;
 }
 
-std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_unary_expression() {
+mitscript::Expression* mitscript::Parser::parse_unary_expression() {
     if (match(TokenKind::SUB)) {
-        auto unex = std::make_unique<mitscript::UnaryExpression>();
+        auto unex = arena_->make<mitscript::UnaryExpression>();
         unex->op = mitscript::UnOp::NEG;
         unex->operand = parse_unary_expression();
         return unex;
     } else if (match(TokenKind::BANG)) {
-        auto unex = std::make_unique<mitscript::UnaryExpression>();
+        auto unex = arena_->make<mitscript::UnaryExpression>();
         unex->op = mitscript::UnOp::NOT;
         // '!' binds looser than comparisons/equality but tighter than '&'/'|'.
         unex->operand = parse_binary_expression(precedence_of(TokenKind::BANG));
@@ -510,7 +522,7 @@ std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_unary_expression
     return parse_postfix_expression();
 }
 
-std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_primary_expression() {
+mitscript::Expression* mitscript::Parser::parse_primary_expression() {
     if (current >= tokens.size()) {
         error_here("Expected expression");
     }
@@ -520,35 +532,35 @@ std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_primary_expressi
     switch (kind) {
         case TokenKind::INT: {
             ++current;
-            auto ex = std::make_unique<mitscript::IntegerConstant>();
+            auto ex = arena_->make<mitscript::IntegerConstant>();
             ex->value = fast_stoi(previous().text);
             return ex;
         }
         case TokenKind::STRING: {
             ++current;
-            auto ex = std::make_unique<mitscript::StringConstant>();
+            auto ex = arena_->make<mitscript::StringConstant>();
             ex->value = decode_string_literal(previous().text);
             return ex;
         }
         case TokenKind::TRUE: {
             ++current;
-            auto ex = std::make_unique<mitscript::BooleanConstant>();
+            auto ex = arena_->make<mitscript::BooleanConstant>();
             ex->value = true;
             return ex;
         }
         case TokenKind::FALSE: {
             ++current;
-            auto ex = std::make_unique<mitscript::BooleanConstant>();
+            auto ex = arena_->make<mitscript::BooleanConstant>();
             ex->value = false;
             return ex;
         }
         case TokenKind::NONE: {
             ++current;
-            return std::make_unique<mitscript::NoneConstant>();
+            return arena_->make<mitscript::NoneConstant>();
         }
         case TokenKind::IDENTIFIER: {
             ++current;
-            auto ex = std::make_unique<mitscript::Variable>();
+            auto ex = arena_->make<mitscript::Variable>();
             ex->name = previous().text;
             return ex;
         }
@@ -560,15 +572,17 @@ std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_primary_expressi
         }
         case TokenKind::LBRACE: {
             ++current;
-            auto ex = std::make_unique<mitscript::Record>();
+            auto ex = arena_->make<mitscript::Record>();
+            std::vector<std::pair<std::string, mitscript::Expression*>> fields;
             while (current < tokens.size() && tokens[current].kind != TokenKind::RBRACE) {
                 const auto &key = expect(TokenKind::IDENTIFIER, "Expected field name");
                 expect(TokenKind::COLON, "Expected ':' after field name");
                 auto val = parse_expression();
                 expect(TokenKind::SEMICOLON, "Expected ';' after record field");
-                ex->fields.emplace_back(key.text, std::move(val));
+                fields.emplace_back(key.text, val);
             }
             expect(TokenKind::RBRACE, "Expected '}' to close record");
+            ex->fields = arena_->list(fields);
             return ex;
         }
         case TokenKind::FUN: {
@@ -577,19 +591,19 @@ std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_primary_expressi
             std::vector<std::string> params;
             if (current < tokens.size() && tokens[current].kind != TokenKind::RPAREN) {
                 const auto &id = expect(TokenKind::IDENTIFIER, "Expected parameter name");
-                params.push_back(id.text);
+                params.emplace_back(id.text);
                 while (match(TokenKind::COMMA)) {
                     if (current < tokens.size() && tokens[current].kind == TokenKind::RPAREN) break;
                     const auto &id2 = expect(TokenKind::IDENTIFIER, "Expected parameter name");
-                    params.push_back(id2.text);
+                    params.emplace_back(id2.text);
                 }
             }
             expect(TokenKind::RPAREN, "Expected ')' after parameters");
             auto body = parse_block();
-            auto function = std::make_unique<mitscript::FunctionDeclaration>();
+            auto function = arena_->make<mitscript::FunctionDeclaration>();
             function->name = "";
-            function->args = std::move(params);
-            function->body = std::move(body);
+            function->args = arena_->list(params);
+            function->body = body;
             return function;
         }
         default:
@@ -597,29 +611,29 @@ std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_primary_expressi
     }
 
     error_here("Expected expression");
-    return std::make_unique<mitscript::NoneConstant>();
+    return arena_->make<mitscript::NoneConstant>();
 }
 
-std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_location() {
+mitscript::Expression* mitscript::Parser::parse_location() {
     const auto &id = expect(TokenKind::IDENTIFIER, "Expected identifier for location");
-    auto var = std::make_unique<mitscript::Variable>();
+    auto var = arena_->make<mitscript::Variable>();
     var->name = id.text;
-    std::unique_ptr<mitscript::Expression> result = std::move(var);
+    mitscript::Expression* result = var;
 
     for (;;) {
         if (match(TokenKind::DOT)) {
             const auto &field = expect(TokenKind::IDENTIFIER, "Expected field name after '.'");
-            auto fld = std::make_unique<mitscript::FieldDereference>();
-            fld->object = std::move(result);
+            auto fld = arena_->make<mitscript::FieldDereference>();
+            fld->object = result;
             fld->field_name = field.text;
-            result = std::move(fld);
+            result = fld;
         } else if (match(TokenKind::LBRACKET)) {
             auto idx_expr = parse_expression();
             expect(TokenKind::RBRACKET, "Expected ']' after index expression");
-            auto idx = std::make_unique<mitscript::IndexExpression>();
-            idx->baseExpression = std::move(result);
-            idx->indexExpression = std::move(idx_expr);
-            result = std::move(idx);
+            auto idx = arena_->make<mitscript::IndexExpression>();
+            idx->baseExpression = result;
+            idx->indexExpression = idx_expr;
+            result = idx;
         } else {
             break;
         }
@@ -627,23 +641,25 @@ std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_location() {
     return result;
 }
 
-std::unique_ptr<mitscript::Expression> mitscript::Parser::parse_call_from_location(std::unique_ptr<mitscript::Expression> loc) {
+mitscript::Expression* mitscript::Parser::parse_call_from_location(mitscript::Expression* loc) {
     expect(TokenKind::LPAREN, "Expected '(' after function name");
 
-    auto call = std::make_unique<mitscript::Call>();
-    call->callee = std::move(loc);
+    auto call = arena_->make<mitscript::Call>();
+    call->callee = loc;
+    size_t base = pending_arguments_.size();
 
     if (current < tokens.size() && tokens[current].kind != TokenKind::RPAREN) {
-        call->arguments.push_back(parse_expression());
+        pending_arguments_.push_back(parse_expression());
 
         while (match(TokenKind::COMMA)) {
             if (current < tokens.size() && tokens[current].kind == TokenKind::RPAREN) {
                 break;
             }
-            call->arguments.push_back(parse_expression());
+            pending_arguments_.push_back(parse_expression());
         }
     }
 
     expect(TokenKind::RPAREN, "Expected ')' after arguments");
+    call->arguments = arena_->list(pending_arguments_, base);
     return call;
 }
@@ -11,6 +11,14 @@ namespace mitscript {
             const std::vector<Token>& tokens;
             size_t current{0};
 
+            // The arena of the AST being built, and the children of the
+            // blocks and calls still being parsed. A node's children are
+            // pushed here and copied into the arena as one array when the
+            // node is complete.
+            AstArena* arena_ = nullptr;
+            std::vector<Statement*> pending_statements_;
+            std::vector<Expression*> pending_arguments_;
+
             // ------------------------
             // Token utilities
             // ------------------------
@@ -27,32 +35,32 @@ namespace mitscript {
             // ------------------------
             // Top-level / statements
             // ------------------------
-            std::unique_ptr<Statement>     parse_statement();
-            std::unique_ptr<Block>         parse_block();               // { statement* }
-            std::unique_ptr<Assignment>    parse_assignment();          // location '=' expr ';'
-            std::unique_ptr<IfStatement>   parse_if_statement();        // if (...) block [else block]
-            std::unique_ptr<WhileLoop>     parse_while_loop();          // while (...) block
-            std::unique_ptr<Return>        parse_return_statement();    // return expr ';'
-            std::unique_ptr<Global>        parse_global_statement();    // global name ';'
-            std::unique_ptr<CallStatement> parse_call_statement();      // call ';'
+            Statement*     parse_statement();
+            Block*         parse_block();               // { statement* }
+            Assignment*    parse_assignment();          // location '=' expr ';'
+            IfStatement*   parse_if_statement();        // if (...) block [else block]
+            WhileLoop*     parse_while_loop();          // while (...) block
+            Return*        parse_return_statement();    // return expr ';'
+            Global*        parse_global_statement();    // global name ';'
+            CallStatement* parse_call_statement();      // call ';'
 
             // ------------------------
             // Expressions (precedence)
             // ------------------------
-            std::unique_ptr<Expression> parse_expression();                 // entry
-            std::unique_ptr<FunctionDeclaration> parse_function_declaration(); // if you keep fun as a node
-            std::unique_ptr<Expression> parse_binary_expression(int min_precedence = 0);
-            std::unique_ptr<Expression> parse_unary_expression();           // '!' | '-' | postfix
-            std::unique_ptr<Expression> parse_postfix_expression();         // call/field/index chaining
-            std::unique_ptr<Expression> parse_primary_expression();         // literals, identifiers, parens, fun-literal, record
-            std::unique_ptr<Expression> parse_location();
-            std::unique_ptr<Expression> parse_call_from_location(std::unique_ptr<Expression> loc);
+            Expression* parse_expression();                 // entry
+            FunctionDeclaration* parse_function_declaration(); // if you keep fun as a node
+            Expression* parse_binary_expression(int min_precedence = 0);
+            Expression* parse_unary_expression();           // '!' | '-' | postfix
+            Expression* parse_postfix_expression();         // call/field/index chaining
+            Expression* parse_primary_expression();         // literals, identifiers, parens, fun-literal, record
+            Expression* parse_location();
+            Expression* parse_call_from_location(Expression* loc);
             // Additional helpers used by an alternate precedence-climbing path
-            std::unique_ptr<Expression> parse_simple_atom();
-            std::unique_ptr<Expression> parse_simple_expression();
-            std::unique_ptr<Expression> parse_binary_rhs(int min_prec);
+            Expression* parse_simple_atom();
+            Expression* parse_simple_expression();
+            Expression* parse_binary_rhs(int min_prec);
             // (Optional) helpers for argument/field/record parsing
-            std::vector<std::unique_ptr<Expression>> parse_argument_list(); // ( ... )
+            AstList<Expression*> parse_argument_list(); // ( ... )
 
             // ------------------------
             // Operator helpers
@@ -0,0 +1,174 @@
+#include "./resolver.hpp"
+#include <unordered_map>
+#include <unordered_set>
+
+namespace mitscript {
+    namespace {
+        struct Scope {
+            Scope* parent;
+            std::unordered_map<std::string, int> locals;
+            std::unordered_set<std::string> globals;
+        };
+
+        // The names a function body declares global and the names it
+        // assigns, looking into nested blocks but not nested functions.
+        void declarations(Block* b, std::unordered_set<std::string>& globals,
+                          std::vector<std::string>& assigned) {
+            for (Statement* statement : b->statements) {
+                if (auto if_stmt = dynamic_cast<IfStatement*>(statement)) {
+                    if (if_stmt->then_block) declarations(if_stmt->then_block, globals, assigned);
+                    if (if_stmt->else_block) declarations(if_stmt->else_block, globals, assigned);
+                } else if (auto while_stmt = dynamic_cast<WhileLoop*>(statement)) {
+                    declarations(while_stmt->body, globals, assigned);
+                } else if (auto block_stmt = dynamic_cast<Block*>(statement)) {
+                    declarations(block_stmt, globals, assigned);
+                } else if (auto global_stmt = dynamic_cast<Global*>(statement)) {
+                    globals.insert(global_stmt->name);
+                } else if (auto assign_stmt = dynamic_cast<Assignment*>(statement)) {
+                    if (auto var_target = dynamic_cast<Variable*>(assign_stmt->target)) {
+                        assigned.push_back(var_target->name);
+                    }
+                }
+            }
+        }
+
+        class Resolver : public Visitor {
+            public:
+                Resolver(AstArena& arena, std::vector<std::string>& globals)
+                    : arena_(arena), globals_(globals) {
+                    for (size_t i = 0; i < globals.size(); i++) {
+                        global_index_.emplace(globals[i], i);
+                    }
+                }
+
+                void visit(AST* node) {
+                    for (Statement* statement : node->statements) statement->accept(this);
+                }
+
+                void visit(Block* node) {
+                    for (Statement* statement : node->statements) statement->accept(this);
+                }
+
+                void visit(Assignment* node) {
+                    node->target->accept(this);
+                    node->value->accept(this);
+                }
+
+                void visit(IfStatement* node) {
+                    node->condition->accept(this);
+                    node->then_block->accept(this);
+                    if (node->else_block) node->else_block->accept(this);
+                }
+
+                void visit(Return* node) {
+                    node->value->accept(this);
+                }
+
+                void visit(BinaryExpression* node) {
+                    node->left->accept(this);
+                    node->right->accept(this);
+                }
+
+                void visit(FieldDereference* node) {
+                    node->object->accept(this);
+                }
+
+                void visit(Call* node) {
+                    node->callee->accept(this);
+                    for (Expression* arg : node->arguments) arg->accept(this);
+                }
+
+                void visit(IntegerConstant*) {}
+                void visit(NoneConstant*) {}
+                void visit(StringConstant*) {}
+                void visit(BooleanConstant*) {}
+
+                void visit(Global* node) {
+                    node->slot = global_slot(node->name);
+                }
+
+                void visit(CallStatement* node) {
+                    node->call->accept(this);
+                }
+
+                void visit(WhileLoop* node) {
+                    node->condition->accept(this);
+                    node->body->accept(this);
+                }
+
+                void visit(FunctionDeclaration* node) {
+                    Scope scope{current_, {}, {}};
+                    std::vector<std::string> assigned;
+                    declarations(node->body, scope.globals, assigned);
+
+                    // Parameters come first; a repeated one binds its last
+                    // argument, and a global one binds nothing.
+                    std::vector<int> params;
+                    for (const std::string& arg : node->args) {
+                        params.push_back(scope.globals.count(arg) ? -1 : local(scope, arg));
+                    }
+                    for (const std::string& name : assigned) {
+                        if (!scope.globals.count(name)) local(scope, name);
+                    }
+                    std::vector<int> globals;
+                    for (const std::string& name : scope.globals) globals.push_back(global_slot(name));
+
+                    node->frame_size = static_cast<int>(scope.locals.size());
+                    node->param_slots = arena_.list(params);
+                    node->global_slots = arena_.list(globals);
+
+                    Scope* outer = current_;
+                    current_ = &scope;
+                    node->body->accept(this);
+                    current_ = outer;
+                }
+
+                void visit(UnaryExpression* node) {
+                    node->operand->accept(this);
+                }
+
+                void visit(IndexExpression* node) {
+                    node->baseExpression->accept(this);
+                    node->indexExpression->accept(this);
+                }
+
+                void visit(Record* node) {
+                    for (const auto& field : node->fields) field.second->accept(this);
+                }
+
+                void visit(Variable* node) {
+                    int depth = 0;
+                    for (Scope* scope = current_; scope; scope = scope->parent, depth++) {
+                        if (scope->globals.count(node->name)) break;
+                        auto it = scope->locals.find(node->name);
+                        if (it != scope->locals.end()) {
+                            node->where = {depth, it->second};
+                            return;
+                        }
+                    }
+                    node->where = {VarSlot::kGlobal, global_slot(node->name)};
+                }
+
+            private:
+                static int local(Scope& scope, const std::string& name) {
+                    return scope.locals.emplace(name, static_cast<int>(scope.locals.size())).first->second;
+                }
+
+                int global_slot(const std::string& name) {
+                    auto [it, inserted] = global_index_.emplace(name, static_cast<int>(globals_.size()));
+                    if (inserted) globals_.push_back(name);
+                    return it->second;
+                }
+
+                AstArena& arena_;
+                std::vector<std::string>& globals_;
+                std::unordered_map<std::string, int> global_index_;
+                Scope* current_ = nullptr; // nullptr at top level
+        };
+    }
+
+    void resolve(AST& program, std::vector<std::string>& globals) {
+        Resolver resolver(program.arena, globals);
+        program.accept(&resolver);
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "./ast.hpp"
+#include <string>
+#include <vector>
+
+namespace mitscript {
+    // Binds every variable of a program to a frame slot before it runs, so
+    // the interpreter indexes flat frames instead of hashing names.
+    //
+    // A function's frame holds its parameters and the variables it assigns,
+    // less those it declares global. A name is looked for in the frames of
+    // the enclosing functions from the inside out, stopping at a global
+    // declaration, and otherwise lives in the global frame. `globals` names
+    // the global frame's slots: pass it seeded with the built-ins and the
+    // resolver appends every other global the program mentions.
+    void resolve(AST& program, std::vector<std::string>& globals);
+}
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <string>
+#include <string_view>
 
 namespace mitscript {
 
@@ -52,15 +52,17 @@ enum class TokenKind {
 
 };
 
+// A token's text is a view into the lexed source, which must outlive it.
+// String literals keep their quotes and escape sequences.
 struct Token {
     TokenKind kind;
-    std::string text;
+    std::string_view text;
     int start_line;
     int start_col;
     int end_line;
     int end_col;
 
-    Token(TokenKind k, std::string text, int sl, int sc, int el, int ec)
-        : kind(k), text(std::move(text)), start_line(sl), start_col(sc), end_line(el), end_col(ec) {}
+    Token(TokenKind k, std::string_view text, int sl, int sc, int el, int ec)
+        : kind(k), text(text), start_line(sl), start_col(sc), end_line(el), end_col(ec) {}
 };
 };
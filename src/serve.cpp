@@ -0,0 +1,317 @@
+#include "serve.hpp"
+
+#include "batch.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// Largest script or stdin a job may send.
+constexpr size_t kMaxJobBytes = size_t{256} << 20;
+
+// Largest heap a job may ask for, so mem_mb in bytes cannot overflow.
+constexpr size_t kMaxMemMb = size_t{1} << 20;
+
+// Owns an open descriptor.
+struct Descriptor {
+  int fd = -1;
+  Descriptor(int fd) : fd(fd) {}
+  Descriptor(const Descriptor &) = delete;
+  Descriptor &operator=(const Descriptor &) = delete;
+  ~Descriptor() {
+    if (fd >= 0)
+      ::close(fd);
+  }
+};
+
+bool read_exact(int fd, char *out, size_t n) {
+  while (n > 0) {
+    ssize_t got = ::read(fd, out, n);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      return false;
+    out += got;
+    n -= static_cast<size_t>(got);
+  }
+  return true;
+}
+
+// Sends on a socket without raising SIGPIPE when the client has gone.
+bool send_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t put = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (put < 0 && errno == EINTR)
+      continue;
+    if (put <= 0)
+      return false;
+    data.remove_prefix(static_cast<size_t>(put));
+  }
+  return true;
+}
+
+bool write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t put = ::write(fd, data.data(), data.size());
+    if (put < 0 && errno == EINTR)
+      continue;
+    if (put <= 0)
+      return false;
+    data.remove_prefix(static_cast<size_t>(put));
+  }
+  return true;
+}
+
+// Reads a header line of `count` whitespace-separated numbers. On a
+// malformed line, returns false with the reason in `*error`.
+bool read_header(int fd, size_t *fields, size_t count, std::string *error) {
+  std::string line;
+  char c;
+  while (true) {
+    if (!read_exact(fd, &c, 1)) {
+      *error = "connection closed before the end of the header line";
+      return false;
+    }
+    if (c == '\n')
+      break;
+    if (line.size() == 128) {
+      *error = "header line longer than 128 bytes";
+      return false;
+    }
+    line += c;
+  }
+  const char *p = line.c_str();
+  for (size_t i = 0; i < count; ++i) {
+    while (*p == ' ' || *p == '\t')
+      ++p;
+    // strtoull would accept a sign, and negate what follows it.
+    char *end;
+    errno = 0;
+    unsigned long long v = std::strtoull(p, &end, 10);
+    if (end == p || *p == '-' || *p == '+') {
+      *error = "malformed header line: expected "
+               "<mem_mb> <script bytes> <stdin bytes>";
+      return false;
+    }
+    if (errno == ERANGE || v > SIZE_MAX) {
+      *error = "header field out of range: " + std::string(p, static_cast<const char *>(end));
+      return false;
+    }
+    fields[i] = static_cast<size_t>(v);
+    p = end;
+  }
+  while (*p == ' ' || *p == '\t' || *p == '\r')
+    ++p;
+  if (*p) {
+    *error = "malformed header line: unexpected " + std::string(p);
+    return false;
+  }
+  return true;
+}
+
+// Sends a reply in the format serve.hpp documents.
+void send_reply(int fd, std::string_view output, std::string_view error) {
+  std::string header = std::to_string(error.empty() ? 0 : 1) + " " +
+                       std::to_string(output.size()) + " " +
+                       std::to_string(error.size()) + "\n";
+  if (send_all(fd, header) && send_all(fd, output))
+    send_all(fd, error);
+}
+
+// Answers a request the server could not read. The client may still be
+// sending it, and closing a socket with unread data resets the connection
+// and loses the reply, so after replying this reads and drops input until
+// the client closes, goes quiet for a second, or has sent as much as a
+// job could.
+void reject(int fd, std::string_view error) {
+  send_reply(fd, "", error);
+  ::shutdown(fd, SHUT_WR);
+  timeval timeout{1, 0};
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  char buffer[4096];
+  for (size_t dropped = 0; dropped < 2 * kMaxJobBytes;) {
+    ssize_t got = ::read(fd, buffer, sizeof(buffer));
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      return;
+    dropped += static_cast<size_t>(got);
+  }
+}
+
+// Compiled images by source text, least recently used first out.
+class ImageCache {
+public:
+  explicit ImageCache(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {}
+
+  std::shared_ptr<const std::string> find(const std::string &source) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(source);
+    if (it == index_.end())
+      return nullptr;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->image;
+  }
+
+  void insert(const std::string &source,
+              std::shared_ptr<const std::string> image) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index_.count(source))
+      return;
+    entries_.push_front({source, std::move(image)});
+    index_.emplace(source, entries_.begin());
+    if (entries_.size() > capacity_) {
+      index_.erase(entries_.back().source);
+      entries_.pop_back();
+    }
+  }
+
+private:
+  struct Entry {
+    std::string source;
+    std::shared_ptr<const std::string> image;
+  };
+
+  size_t capacity_;
+  std::mutex mutex_;
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+class Server {
+public:
+  explicit Server(const ServeOptions &options)
+      : options_(options), cache_(options.cache_entries) {}
+
+  void serve(int listener) {
+    size_t jobs = options_.jobs;
+    if (jobs == 0)
+      jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < jobs; ++i)
+      workers.emplace_back([this, listener] {
+        while (true) {
+          int fd = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+          if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+              continue;
+            std::perror("serve: accept");
+            return;
+          }
+          Descriptor conn(fd);
+          handle(conn.fd);
+        }
+      });
+    for (std::thread &worker : workers)
+      worker.join();
+  }
+
+private:
+  void handle(int fd) {
+    size_t header[3];
+    std::string error;
+    if (!read_header(fd, header, 3, &error)) {
+      reject(fd, error);
+      return;
+    }
+    if (header[1] > kMaxJobBytes || header[2] > kMaxJobBytes) {
+      reject(fd, "script and stdin may be at most " +
+                     std::to_string(kMaxJobBytes) + " bytes each");
+      return;
+    }
+    if (header[0] > kMaxMemMb) {
+      reject(fd, "mem_mb may be at most " + std::to_string(kMaxMemMb));
+      return;
+    }
+    const size_t mem_mb = header[0] ? header[0] : options_.mem_mb;
+    std::string source(header[1], '\0');
+    std::string input(header[2], '\0');
+    if (!read_exact(fd, source.data(), source.size()) ||
+        !read_exact(fd, input.data(), input.size())) {
+      reject(fd, "connection closed before the script and stdin were sent");
+      return;
+    }
+
+    std::string output;
+    try {
+      std::shared_ptr<const std::string> image = compiled(source);
+      // The program reads its stdin from a descriptor.
+      Descriptor in(::memfd_create("mitscript-stdin", MFD_CLOEXEC));
+      if (in.fd < 0 || !write_all(in.fd, input) ||
+          ::lseek(in.fd, 0, SEEK_SET) != 0)
+        throw std::runtime_error(std::string("cannot buffer stdin: ") +
+                                 std::strerror(errno));
+      error = run_image(*image, mem_mb, options_.configure, in.fd, -1,
+                        &output);
+    } catch (const std::exception &e) {
+      error = e.what();
+    }
+
+    send_reply(fd, output, error);
+  }
+
+  // The image for `source`, compiled now unless the cache has it. Compiles
+  // run one at a time.
+  std::shared_ptr<const std::string> compiled(const std::string &source) {
+    if (auto image = cache_.find(source))
+      return image;
+    std::lock_guard<std::mutex> lock(compile_mutex_);
+    if (auto image = cache_.find(source))
+      return image;
+    auto image = std::make_shared<const std::string>(options_.compile(source));
+    cache_.insert(source, image);
+    return image;
+  }
+
+  const ServeOptions &options_;
+  ImageCache cache_;
+  std::mutex compile_mutex_;
+};
+
+} // namespace
+
+bool run_server(const ServeOptions &options) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (options.socket_path.empty() ||
+      options.socket_path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "serve: socket path must be 1 to "
+              << sizeof(addr.sun_path) - 1 << " bytes\n";
+    return false;
+  }
+  std::memcpy(addr.sun_path, options.socket_path.c_str(),
+              options.socket_path.size() + 1);
+
+  Descriptor listener(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  ::unlink(options.socket_path.c_str());
+  if (listener.fd < 0 ||
+      ::bind(listener.fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+          0 ||
+      ::listen(listener.fd, SOMAXCONN) < 0) {
+    std::cerr << "serve: cannot listen on " << options.socket_path << ": "
+              << std::strerror(errno) << "\n";
+    return false;
+  }
+
+  Server server(options);
+  server.serve(listener.fd);
+  return true;
+}
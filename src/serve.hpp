@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace vm {
+class VM;
+}
+
+// The serve subcommand: a resident process that runs MITScript jobs sent
+// over a Unix socket, so short scripts skip process startup and, after
+// the first time a script is seen, the compiler.
+//
+// A connection carries one job. The client sends the header line
+//
+//   <mem_mb> <script bytes> <stdin bytes>\n
+//
+// followed by the script's source and its stdin text; a mem_mb of 0 takes
+// the server's --mem. The server answers with
+//
+//   <status> <output bytes> <error bytes>\n
+//
+// followed by what the program printed and the error it stopped on, and
+// closes the connection. status is 0 when the program ran to completion
+// and 1 when it did not compile or stopped on an error. A request the
+// server cannot read (a malformed header, a script or stdin over 256 MiB,
+// a mem_mb over 1048576, or a connection that closes early) gets status
+// 1, no output and the reason as the error.
+//
+// There is no per-job time limit: a program that never finishes keeps
+// its worker busy until the server is killed. Clients that need a bound
+// must time out on their own side.
+//
+// Compiled programs are kept as binary images, by source text, in an LRU
+// of `cache_entries`. As in batch (see batch.hpp) every job decodes its
+// own copy of the bytecode tree and runs it in a fresh VM, since the VM
+// specializes the tree it runs; decoding is far cheaper than compiling,
+// and the heap pages and buffers a finished job frees are reused by the
+// next one through the allocator.
+struct ServeOptions {
+  std::string socket_path;
+  size_t jobs = 0; // jobs run at once, 0 meaning one per core
+  size_t mem_mb = 4;
+  size_t cache_entries = 64;
+  // Compiles source to a binary image; throws on a compile error.
+  std::function<std::string(std::string_view)> compile;
+  // Applies the command line's VM settings to each new VM.
+  std::function<void(vm::VM &)> configure;
+};
+
+// Listens on options.socket_path (replacing any socket file there) and
+// serves jobs until the process is killed. Returns false, with the reason
+// on stderr, when the socket cannot be set up.
+bool run_server(const ServeOptions &options);
@@ -0,0 +1,64 @@
+#include "source_file.hpp"
+
+#include <fcntl.h>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SourceFile SourceFile::open(const std::string &path, std::istream &fallback) {
+  SourceFile f;
+  if (path != "-") {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      struct stat st;
+      if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size_t size = static_cast<size_t>(st.st_size);
+        if (size == 0) {
+          ::close(fd);
+          return f;
+        }
+        void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+          ::close(fd);
+          madvise(p, size, MADV_SEQUENTIAL);
+          f.mapping_ = p;
+          f.mapped_size_ = size;
+          f.text_ = std::string_view(static_cast<const char *>(p), size);
+          return f;
+        }
+      }
+      ::close(fd);
+    }
+  }
+
+  f.buffer_.assign(std::istreambuf_iterator<char>(fallback), std::istreambuf_iterator<char>());
+  f.text_ = f.buffer_;
+  return f;
+}
+
+SourceFile::SourceFile(SourceFile &&other) noexcept { *this = std::move(other); }
+
+SourceFile &SourceFile::operator=(SourceFile &&other) noexcept {
+  if (this == &other)
+    return *this;
+  release();
+  mapping_ = other.mapping_;
+  mapped_size_ = other.mapped_size_;
+  buffer_ = std::move(other.buffer_);
+  text_ = mapping_ ? other.text_ : std::string_view(buffer_);
+  other.mapping_ = nullptr;
+  other.mapped_size_ = 0;
+  other.text_ = {};
+  return *this;
+}
+
+SourceFile::~SourceFile() { release(); }
+
+void SourceFile::release() {
+  if (mapping_)
+    munmap(mapping_, mapped_size_);
+  mapping_ = nullptr;
+  mapped_size_ = 0;
+  text_ = {};
+}
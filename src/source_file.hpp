@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <istream>
+#include <string>
+#include <string_view>
+
+// The text of an input program. A regular file is memory-mapped and read
+// in place; anything else (stdin, pipes) is read into memory. Tokens and
+// parsers take string_views into text(), so it must outlive them.
+class SourceFile {
+public:
+  // Maps `path`, or reads `fallback` when path is "-" or cannot be mapped.
+  static SourceFile open(const std::string &path, std::istream &fallback);
+
+  SourceFile() = default;
+  SourceFile(SourceFile &&other) noexcept;
+  SourceFile &operator=(SourceFile &&other) noexcept;
+  SourceFile(const SourceFile &) = delete;
+  SourceFile &operator=(const SourceFile &) = delete;
+  ~SourceFile();
+
+  std::string_view text() const { return text_; }
+
+private:
+  void release();
+
+  void *mapping_ = nullptr;
+  size_t mapped_size_ = 0;
+  std::string buffer_;
+  std::string_view text_;
+};
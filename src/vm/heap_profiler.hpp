@@ -0,0 +1,180 @@
+#pragma once
+
+// Sampling allocation profiler for --heap-profile.
+//
+// The VM offers every allocation to sample(); on average one is taken per
+// kMeanSampleBytes allocated, at exponentially distributed intervals so
+// that periodic allocation patterns cannot alias with the sampling. A
+// sampled object of s bytes stands for 1 / (1 - e^(-s / mean)) objects
+// like it, the inverse of its chance of being sampled, which makes the
+// per-site totals unbiased estimates.
+//
+// Each sample is tagged with the interpreter stack at the allocation
+// (function and pc of every frame) and the value type allocated. The heap
+// reports dead objects through its free hook, so what is still tracked at
+// exit is what survived the last collection. write() dumps the totals as
+// collapsed stacks, the text format of flamegraph.pl and speedscope: one
+// line per site, frames from the outermost in, separated by ';', then the
+// byte count. Lines under the root frame "allocated" count every byte the
+// site allocated; lines under "live" count its sampled objects still
+// alive, payload included.
+
+#include "bytecode/types.hpp"
+#include "gc/gc.hpp"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vm {
+
+// Labels every function in the tree under `func` by its position in it:
+// `name` for func itself, then name + ".3(a,b)" for its fourth nested
+// function, taking parameters a and b, and so on.
+inline void
+label_functions(const bytecode::Function *func, const std::string &name,
+                std::unordered_map<const bytecode::Function *, std::string>
+                    &labels) {
+  std::string label = name;
+  if (func->parameter_count_ > 0) {
+    label += '(';
+    for (uint32_t i = 0;
+         i < func->parameter_count_ && i < func->local_vars_.size(); ++i) {
+      if (i)
+        label += ',';
+      label += func->local_vars_[i];
+    }
+    label += ')';
+  }
+  labels.emplace(func, label);
+  for (size_t i = 0; i < func->functions_.size(); ++i)
+    label_functions(func->functions_[i], name + "." + std::to_string(i),
+                    labels);
+}
+
+class HeapProfiler {
+public:
+  static constexpr size_t kMeanSampleBytes = 64 * 1024;
+  // Frames kept per sample, innermost first; deep recursion is cut off.
+  static constexpr size_t kMaxStackDepth = 64;
+
+  struct StackFrame {
+    const bytecode::Function *func;
+    size_t pc;
+  };
+
+  HeapProfiler() { countdown_ = next_interval(); }
+
+  // Names every function in the tree under `main`; see label_functions.
+  void name_functions(const bytecode::Function *main) {
+    names_.clear();
+    label_functions(main, "main", names_);
+  }
+
+  // Counts `bytes` allocated; true when the allocation should be sampled.
+  bool sample(size_t bytes) {
+    if (bytes < countdown_) {
+      countdown_ -= bytes;
+      return false;
+    }
+    bytes -= countdown_;
+    countdown_ = next_interval();
+    while (bytes >= countdown_) {
+      bytes -= countdown_;
+      countdown_ = next_interval();
+    }
+    countdown_ -= bytes;
+    return true;
+  }
+
+  // Records a sampled object of `cell_bytes` plus its payload. `stack`
+  // lists the frames outermost first.
+  void record(Collectable *obj, size_t cell_bytes, const char *type,
+              const std::vector<StackFrame> &stack) {
+    size_t bytes = cell_bytes + obj->payload_bytes();
+    std::string key;
+    size_t first = 0;
+    if (stack.size() > kMaxStackDepth) {
+      first = stack.size() - kMaxStackDepth;
+      key = "...;";
+    }
+    for (size_t i = first; i < stack.size(); ++i) {
+      auto it = names_.find(stack[i].func);
+      key += it != names_.end() ? it->second : std::string("?");
+      key += '@';
+      key += std::to_string(stack[i].pc);
+      key += ';';
+    }
+    key += type;
+
+    auto [site, added] = site_ids_.try_emplace(key, sites_.size());
+    if (added)
+      sites_.push_back({std::move(key), 0});
+    double scale =
+        1.0 / -std::expm1(-static_cast<double>(bytes) / kMeanSampleBytes);
+    sites_[site->second].allocated += scale * static_cast<double>(bytes);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    samples_[obj] = {static_cast<uint32_t>(site->second), scale,
+                     static_cast<uint32_t>(cell_bytes)};
+  }
+
+  // Called with each object the collector frees, possibly from the
+  // background sweeper.
+  void forget(Collectable *obj) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    samples_.erase(obj);
+  }
+
+  void write(std::ostream &out) const {
+    for (const Site &site : sites_) {
+      auto bytes = static_cast<uint64_t>(std::llround(site.allocated));
+      if (bytes)
+        out << "allocated;" << site.stack << ' ' << bytes << '\n';
+    }
+    std::vector<double> live(sites_.size(), 0.0);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto &[obj, s] : samples_)
+        live[s.site] += s.scale * static_cast<double>(s.cell_bytes +
+                                                      obj->payload_bytes());
+    }
+    for (size_t i = 0; i < sites_.size(); ++i) {
+      auto bytes = static_cast<uint64_t>(std::llround(live[i]));
+      if (bytes)
+        out << "live;" << sites_[i].stack << ' ' << bytes << '\n';
+    }
+  }
+
+private:
+  struct Site {
+    std::string stack; // collapsed frames, ending in the value type
+    double allocated;  // estimated bytes allocated
+  };
+  struct Sample {
+    uint32_t site;
+    double scale;        // objects this sample stands for
+    uint32_t cell_bytes; // size without the payload
+  };
+
+  size_t next_interval() {
+    std::exponential_distribution<double> interval(1.0 / kMeanSampleBytes);
+    return static_cast<size_t>(interval(rng_)) + 1;
+  }
+
+  // Fixed seed: the same run samples the same allocations.
+  std::mt19937_64 rng_{0x5eed};
+  size_t countdown_ = 0;
+  std::unordered_map<const bytecode::Function *, std::string> names_;
+  std::unordered_map<std::string, size_t> site_ids_;
+  std::vector<Site> sites_;
+  mutable std::mutex mutex_;
+  std::unordered_map<Collectable *, Sample> samples_;
+};
+
+} // namespace vm
@@ -0,0 +1,563 @@
+#pragma once
+
+// Inlining of calls in register code (-O inline), run by VM::run once the
+// whole program has been translated.
+//
+// A Call enters whatever function value its callee register holds, so the
+// function is only known at run time. This pass predicts it from where the
+// register was loaded: a closure made on the spot, or a global or local
+// every store to which is a closure of the same function. A predicted call
+// to a small function becomes
+//
+//       CallGuard callee -> slow     (see bytecode/instructions.hpp)
+//       <what a call does on entry: parameters, cleared locals, References>
+//       <the callee's code, in registers above the caller's>
+//       Goto done
+//   slow:
+//       Call ...                     (the original call)
+//   done:
+//
+// so a wrong prediction costs the guard and nothing else. In the copied
+// code a Return moves its value into the Call's destination and jumps to
+// done; PushReference of a local reference variable moves from the
+// register holding its cell, and of a free variable loads it from the
+// closure (LoadFreeRef); a StoreLocal into a captured local stores through
+// the cell explicitly. The callee's constants, names, nested functions and
+// field caches are appended to the caller's, so copied indices stay valid.
+//
+// Bodies are copied from the code every function had before the pass, so
+// inlining is one level deep; calls of a function from itself are left
+// alone. Inlined bodies share one register window per caller, as none is
+// live once its call site is done.
+//
+// A global that is stored more than one function, or a closure the pass
+// cannot trace, gets no prediction here. inline_global_calls covers those
+// at run time: once a function is hot, the VM passes the functions its
+// globals have held steadily, and the same guarded copies are made of
+// the calls through them (see VM::speculate_calls). The guard is what
+// makes that safe to get wrong. It runs before any of the body does, so
+// a rebound global only sends later calls down the slow path, where the
+// Call makes an ordinary frame; no inlined body is ever left running on
+// an assumption that no longer holds.
+
+#include "bytecode/instructions.hpp"
+#include "bytecode/types.hpp"
+#include "vm/regalloc.hpp"
+#include "vm/superinstructions.hpp"
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace vm {
+
+namespace detail {
+
+// Callee instructions, End excluded.
+constexpr size_t kMaxInlineSize = 48;
+// Callers stop growing once their code reaches this size.
+constexpr size_t kMaxInlinedCallerSize = 4096;
+
+// A function's register code as it was before inlining.
+struct InlineSource {
+  std::vector<bytecode::RegisterInstruction> code;
+  std::vector<char> is_target;
+  uint16_t register_count = 0;
+  size_t field_caches = 0;
+};
+
+// The register `in` writes, -1 for none, -2 if not known.
+inline int32_t written_register(const bytecode::RegisterInstruction &in) {
+  using bytecode::Operation;
+  if (writes_only_dst(in.op) || in.op == Operation::StoreLocal)
+    return in.dst;
+  if (in.op == Operation::IncJumpLt || in.op == Operation::AddJumpLt)
+    return in.dst;
+  bytecode::RegisterInstruction copy = in;
+  return for_each_reg_operand(copy, [](uint16_t &) {}) ? -1 : -2;
+}
+
+// Index of the instruction before code[i], on the straight-line path into
+// it, that last wrote r; -1 if there is none.
+inline int64_t def_before(const InlineSource &src, size_t i, uint16_t r) {
+  using bytecode::Operation;
+  for (size_t j = i; j-- > 0;) {
+    if (src.is_target[j + 1])
+      return -1;
+    const bytecode::RegisterInstruction &in = src.code[j];
+    if (is_reg_branch(in.op) || in.op == Operation::Return ||
+        in.op == Operation::End)
+      return -1;
+    int32_t w = written_register(in);
+    if (w == -2)
+      return -1;
+    if (w == r)
+      return static_cast<int64_t>(j);
+  }
+  return -1;
+}
+
+// The function code[i] makes a closure (or function value) of, if any.
+inline bytecode::Function *closure_function(const bytecode::Function &func,
+                                            const InlineSource &src, size_t i) {
+  using bytecode::Operation;
+  const bytecode::RegisterInstruction &in = src.code[i];
+  int32_t index = -1;
+  if (in.op == Operation::LoadFunc) {
+    index = in.imm;
+  } else if (in.op == Operation::AllocClosure) {
+    int64_t j = def_before(src, i, in.src2);
+    if (j >= 0 && src.code[j].op == Operation::LoadFunc)
+      index = src.code[j].imm;
+  }
+  if (index < 0 || static_cast<size_t>(index) >= func.functions_.size())
+    return nullptr;
+  return func.functions_[index];
+}
+
+inline bool is_move(bytecode::Operation op) {
+  using bytecode::Operation;
+  return op == Operation::LoadLocal || op == Operation::StoreLocal ||
+         op == Operation::Dup;
+}
+
+// The function whose closure register r holds before code[i], as far as
+// the straight-line code leading there shows.
+inline bytecode::Function *value_function(const bytecode::Function &func,
+                                          const InlineSource &src, size_t i,
+                                          uint16_t r) {
+  using bytecode::Operation;
+  for (int depth = 0; depth < 8; ++depth) {
+    int64_t j = def_before(src, i, r);
+    if (j < 0)
+      return nullptr;
+    const bytecode::RegisterInstruction &in = src.code[j];
+    if (in.op == Operation::LoadFunc || in.op == Operation::AllocClosure)
+      return closure_function(func, src, static_cast<size_t>(j));
+    if (!is_move(in.op))
+      return nullptr;
+    i = static_cast<size_t>(j);
+    r = in.src1;
+  }
+  return nullptr;
+}
+
+// The one function every store seen into a variable makes a closure of.
+struct Prediction {
+  bytecode::Function *target = nullptr;
+  bool conflict = false;
+
+  void add(bytecode::Function *f) {
+    if (!f || (target && target != f))
+      conflict = true;
+    else
+      target = f;
+  }
+  bytecode::Function *get() const { return conflict ? nullptr : target; }
+};
+
+inline bool contains_function(const bytecode::Function *tree,
+                              const bytecode::Function *f) {
+  if (tree == f)
+    return true;
+  for (const bytecode::Function *child : tree->functions_)
+    if (contains_function(child, f))
+      return true;
+  return false;
+}
+
+// Indices at which a callee's tables start in the caller's.
+struct LinkedCallee {
+  uint16_t guard_index;
+  int32_t constants;
+  int32_t names;
+  int32_t functions;
+  uint16_t field_caches;
+};
+
+class Inliner {
+public:
+  template <typename IsNative>
+  Inliner(bytecode::Function *main, IsNative &&is_native) {
+    collect(main);
+    for (bytecode::Function *f : functions_)
+      add_source(f, is_native);
+    predict_globals();
+  }
+
+  // An inliner for the calls in `caller` alone, predicting each global in
+  // `globals` (slot, function) to hold that function.
+  template <typename IsNative>
+  Inliner(bytecode::Function *caller,
+          const std::vector<std::pair<int32_t, bytecode::Function *>> &globals,
+          IsNative &&is_native) {
+    functions_.push_back(caller);
+    add_source(caller, is_native);
+    for (const auto &[slot, f] : globals) {
+      globals_[slot].add(f);
+      if (!sources_.count(f))
+        add_source(f, is_native);
+    }
+  }
+
+  // Inlines the predicted calls of every function; returns the functions
+  // whose code changed.
+  std::vector<bytecode::Function *> run() {
+    std::vector<bytecode::Function *> changed;
+    for (bytecode::Function *f : functions_)
+      if (inline_into(f))
+        changed.push_back(f);
+    return changed;
+  }
+
+  // For a function run changed, the index in the new code of each old
+  // instruction, and of the old end.
+  const std::vector<size_t> &pc_map(bytecode::Function *f) const {
+    return pc_maps_.at(f);
+  }
+
+private:
+  void collect(bytecode::Function *f) {
+    if (!f || sources_.count(f))
+      return;
+    sources_[f];
+    functions_.push_back(f);
+    for (bytecode::Function *child : f->functions_)
+      collect(child);
+  }
+
+  template <typename IsNative>
+  void add_source(bytecode::Function *f, IsNative &&is_native) {
+    InlineSource &src = sources_[f];
+    src.code = f->reg_instructions;
+    src.is_target.assign(src.code.size() + 1, 0);
+    for (size_t i = 0; i < src.code.size(); ++i)
+      if (is_reg_branch(src.code[i].op)) {
+        int64_t t = static_cast<int64_t>(i) + src.code[i].imm;
+        if (t >= 0 && t <= static_cast<int64_t>(src.code.size()))
+          src.is_target[t] = 1;
+      }
+    src.register_count = f->register_count;
+    src.field_caches = f->field_caches.size();
+    if (is_native(f))
+      natives_.push_back(f);
+  }
+
+  void predict_globals() {
+    using bytecode::Operation;
+    for (bytecode::Function *f : functions_) {
+      const InlineSource &src = sources_.at(f);
+      for (size_t i = 0; i < src.code.size(); ++i)
+        if (src.code[i].op == Operation::StoreGlobal)
+          globals_[src.code[i].imm].add(value_function(*f, src, i, src.code[i].src1));
+    }
+  }
+
+  std::vector<Prediction> predict_locals(const bytecode::Function &f,
+                                         const InlineSource &src) const {
+    using bytecode::Operation;
+    const size_t nlocals = f.local_vars_.size();
+    std::vector<Prediction> locals(nlocals);
+    for (size_t l = 0; l < f.parameter_count_ && l < nlocals; ++l)
+      locals[l].conflict = true;
+    for (size_t i = 0; i < src.code.size(); ++i) {
+      const bytecode::RegisterInstruction &in = src.code[i];
+      int32_t w = written_register(in);
+      if (w == -2) {
+        for (Prediction &p : locals) p.conflict = true;
+        break;
+      }
+      if (w < 0 || static_cast<size_t>(w) >= nlocals)
+        continue;
+      bytecode::Function *target = nullptr;
+      if (in.op == Operation::LoadFunc || in.op == Operation::AllocClosure)
+        target = closure_function(f, src, i);
+      else if (is_move(in.op))
+        target = value_function(f, src, i, in.src1);
+      locals[w].add(target);
+    }
+    return locals;
+  }
+
+  // The function the Call at code[i] is predicted to enter.
+  bytecode::Function *predict_call(const bytecode::Function &f,
+                                   const InlineSource &src, size_t i,
+                                   const std::vector<Prediction> &locals) const {
+    using bytecode::Operation;
+    uint16_t r = src.code[i].src1;
+    for (int depth = 0; depth < 8; ++depth) {
+      int64_t j = def_before(src, i, r);
+      if (j < 0)
+        return r < locals.size() ? locals[r].get() : nullptr;
+      const bytecode::RegisterInstruction &in = src.code[j];
+      if (in.op == Operation::LoadGlobal) {
+        auto it = globals_.find(in.imm);
+        return it == globals_.end() ? nullptr : it->second.get();
+      }
+      if (in.op == Operation::LoadFunc || in.op == Operation::AllocClosure)
+        return closure_function(f, src, static_cast<size_t>(j));
+      if (!is_move(in.op))
+        return nullptr;
+      i = static_cast<size_t>(j);
+      r = in.src1;
+    }
+    return nullptr;
+  }
+
+  bool can_inline(bytecode::Function *caller, bytecode::Function *callee,
+                  int32_t arg_count) const {
+    using bytecode::Operation;
+    if (!callee || callee == caller || arg_count < 0 ||
+        static_cast<size_t>(arg_count) != callee->parameter_count_)
+      return false;
+    for (bytecode::Function *native : natives_)
+      if (native == callee)
+        return false;
+    // The callee's nested functions are appended to the caller's, which
+    // must not make the function tree cyclic.
+    if (contains_function(callee, caller))
+      return false;
+    auto it = sources_.find(callee);
+    if (it == sources_.end())
+      return false;
+    const InlineSource &src = it->second;
+    const size_t n = src.code.size();
+    // Falling off the end of a function is an error the body would lose.
+    if (n < 2 || n - 1 > kMaxInlineSize || src.code[n - 1].op != Operation::End ||
+        src.is_target[n - 1] ||
+        (src.code[n - 2].op != Operation::Return && src.code[n - 2].op != Operation::Goto))
+      return false;
+    // A body inlined into the callee at run time has guards that index
+    // the callee's inline targets, not the caller's.
+    for (const bytecode::RegisterInstruction &in : src.code)
+      if ((in.op != Operation::End && written_register(in) == -2) ||
+          in.op == Operation::CallGuard)
+        return false;
+    for (int32_t reg : callee->ref_registers)
+      if (reg < 0)
+        return false;
+    return true;
+  }
+
+  uint16_t none_constant(bytecode::Function *f) {
+    for (size_t k = 0; k < f->constants_.size(); ++k)
+      if (dynamic_cast<bytecode::Constant::None *>(f->constants_[k]))
+        return static_cast<uint16_t>(k);
+    f->constants_.push_back(new bytecode::Constant::None());
+    return static_cast<uint16_t>(f->constants_.size() - 1);
+  }
+
+  bool inline_into(bytecode::Function *f) {
+    using bytecode::Operation;
+    using bytecode::RegisterInstruction;
+    const InlineSource &src = sources_.at(f);
+    const std::vector<RegisterInstruction> &code = src.code;
+    const size_t n = code.size();
+    const std::vector<Prediction> locals = predict_locals(*f, src);
+    const uint16_t window = src.register_count;
+
+    std::unordered_map<bytecode::Function *, LinkedCallee> linked;
+    std::vector<RegisterInstruction> out;
+    std::vector<size_t> new_index(n + 1, 0);
+    struct Fixup {
+      size_t at;
+      size_t target;
+    };
+    std::vector<Fixup> fixups;
+    size_t window_size = 0;
+    int32_t none_index = -1;
+
+    for (size_t i = 0; i < n; ++i) {
+      new_index[i] = out.size();
+      const RegisterInstruction &in = code[i];
+      bytecode::Function *callee = nullptr;
+      if (in.op == Operation::Call && out.size() < kMaxInlinedCallerSize)
+        callee = predict_call(*f, src, i, locals);
+      if (callee && can_inline(f, callee, in.imm)) {
+        const InlineSource &body = sources_.at(callee);
+        const size_t needed = body.register_count + (callee->free_vars_.empty() ? 0 : 1);
+        if (window + needed <= UINT16_MAX &&
+            f->inline_targets.size() < UINT16_MAX &&
+            f->field_caches.size() + body.field_caches <= UINT16_MAX + size_t{1}) {
+          auto it = linked.find(callee);
+          if (it == linked.end())
+            it = linked.emplace(callee, link(f, callee, body)).first;
+          if (none_index < 0)
+            none_index = none_constant(f);
+          emit_inlined(in, *callee, body, it->second, window,
+                       static_cast<uint16_t>(none_index), out);
+          window_size = std::max(window_size, needed);
+          continue;
+        }
+      }
+      if (is_reg_branch(in.op))
+        fixups.push_back({out.size(), static_cast<size_t>(static_cast<int64_t>(i) + in.imm)});
+      out.push_back(in);
+    }
+    if (linked.empty())
+      return false;
+    new_index[n] = out.size();
+    for (const Fixup &fx : fixups)
+      out[fx.at].imm = static_cast<int32_t>(new_index[fx.target]) -
+                       static_cast<int32_t>(fx.at);
+
+    f->reg_instructions = std::move(out);
+    f->register_count = static_cast<uint16_t>(window + window_size);
+    pc_maps_[f] = std::move(new_index);
+    return true;
+  }
+
+  // Appends the callee's tables to the caller's.
+  LinkedCallee link(bytecode::Function *f, bytecode::Function *callee,
+                    const InlineSource &body) {
+    LinkedCallee l;
+    l.guard_index = static_cast<uint16_t>(f->inline_targets.size());
+    f->inline_targets.push_back(callee);
+    l.constants = static_cast<int32_t>(f->constants_.size());
+    f->constants_.insert(f->constants_.end(), callee->constants_.begin(),
+                         callee->constants_.end());
+    l.names = static_cast<int32_t>(f->names_.size());
+    f->names_.insert(f->names_.end(), callee->names_.begin(), callee->names_.end());
+    l.functions = static_cast<int32_t>(f->functions_.size());
+    f->functions_.insert(f->functions_.end(), callee->functions_.begin(),
+                         callee->functions_.end());
+    l.field_caches = static_cast<uint16_t>(f->field_caches.size());
+    f->field_caches.resize(f->field_caches.size() + body.field_caches);
+    return l;
+  }
+
+  // Appends the guarded copy of `callee` that replaces `call` to `out`.
+  static void emit_inlined(const bytecode::RegisterInstruction &call,
+                           const bytecode::Function &callee,
+                           const InlineSource &body, const LinkedCallee &l,
+                           uint16_t window, uint16_t none_index,
+                           std::vector<bytecode::RegisterInstruction> &out) {
+    using bytecode::Operation;
+    using bytecode::RegisterInstruction;
+    const size_t base = out.size();
+    const uint16_t nlocals = static_cast<uint16_t>(callee.local_vars_.size());
+    const uint16_t ref_base = static_cast<uint16_t>(window + nlocals);
+    const int32_t nrefs = static_cast<int32_t>(callee.local_reference_vars_.size());
+    const uint16_t closure = static_cast<uint16_t>(window + body.register_count);
+    auto rel = [&](size_t from, size_t to) {
+      return static_cast<int32_t>(to) - static_cast<int32_t>(from);
+    };
+
+    // Entry: what push_reg_frame does for the callee's window.
+    out.push_back({Operation::CallGuard, l.guard_index, call.src1, 0, 0});
+    if (!callee.free_vars_.empty())
+      out.push_back({Operation::LoadLocal, closure, call.src1, 0, 0});
+    for (int32_t p = 0; p < call.imm; ++p)
+      out.push_back({Operation::LoadLocal, static_cast<uint16_t>(window + p),
+                     static_cast<uint16_t>(call.src2 + p), 0, 0});
+    for (uint16_t v = static_cast<uint16_t>(call.imm); v < nlocals; ++v)
+      out.push_back({Operation::LoadConst, static_cast<uint16_t>(window + v), 0, 0, none_index});
+    for (int32_t k = 0; k < nrefs; ++k)
+      out.push_back({Operation::NewReference, static_cast<uint16_t>(ref_base + k),
+                     static_cast<uint16_t>(window + callee.ref_registers[k]), 0, 0});
+
+    const size_t n = body.code.size();
+    std::vector<size_t> body_at(n, 0);
+    std::vector<std::pair<size_t, size_t>> branches; // (at, callee target)
+    std::vector<size_t> to_done;
+    for (size_t k = 0; k + 1 < n; ++k) {
+      body_at[k] = out.size();
+      RegisterInstruction in = body.code[k];
+      const int32_t imm = in.imm;
+      for_each_reg_operand(in, [&](uint16_t &r) { r = static_cast<uint16_t>(r + window); });
+      switch (in.op) {
+      case Operation::LoadConst:
+        in.imm += l.constants;
+        break;
+      case Operation::LoadFunc:
+        in.imm += l.functions;
+        break;
+      case Operation::FieldLoad:
+        in.src2 = static_cast<uint16_t>(in.src2 + l.field_caches);
+        in.imm += l.names;
+        break;
+      case Operation::FieldStore:
+        in.dst = static_cast<uint16_t>(in.dst + l.field_caches);
+        in.imm += l.names;
+        break;
+      case Operation::FieldLoadSlot:
+      case Operation::FieldStoreSlot:
+        in.imm += l.names;
+        break;
+      case Operation::PushReference:
+        if (imm < nrefs)
+          in = {Operation::LoadLocal, in.dst, static_cast<uint16_t>(ref_base + imm), 0, 0};
+        else
+          in = {Operation::LoadFreeRef, in.dst, closure, 0, imm - nrefs};
+        break;
+      case Operation::StoreLocal:
+        if (imm > 0) {
+          out.push_back({Operation::StoreReference, 0, in.src1,
+                         static_cast<uint16_t>(ref_base + imm - 1), 0});
+          in.imm = 0;
+        }
+        break;
+      case Operation::Return:
+        out.push_back({Operation::LoadLocal, call.dst, in.src1, 0, 0});
+        to_done.push_back(out.size());
+        out.push_back({Operation::Goto, 0, 0, 0, 0});
+        continue;
+      default:
+        break;
+      }
+      if (is_reg_branch(in.op))
+        branches.push_back({out.size(), static_cast<size_t>(static_cast<int64_t>(k) + imm)});
+      out.push_back(in);
+    }
+    body_at[n - 1] = out.size();
+    to_done.push_back(out.size());
+    out.push_back({Operation::Goto, 0, 0, 0, 0});
+
+    const size_t slow = out.size();
+    out.push_back(call);
+    const size_t done = out.size();
+
+    out[base].imm = rel(base, slow);
+    for (const auto &[at, target] : branches)
+      out[at].imm = rel(at, body_at[target]);
+    for (size_t at : to_done)
+      out[at].imm = rel(at, done);
+  }
+
+  std::vector<bytecode::Function *> functions_;
+  std::unordered_map<bytecode::Function *, InlineSource> sources_;
+  std::vector<bytecode::Function *> natives_;
+  std::unordered_map<int32_t, Prediction> globals_;
+  std::unordered_map<bytecode::Function *, std::vector<size_t>> pc_maps_;
+};
+
+} // namespace detail
+
+// Inlines predicted calls throughout the program rooted at `main`; calls
+// of functions for which is_native returns true are left alone. Returns
+// the functions whose code changed; their constant pools, call liveness
+// and verification are the caller's to redo.
+template <typename IsNative>
+inline std::vector<bytecode::Function *> inline_calls(bytecode::Function *main,
+                                                      IsNative &&is_native) {
+  return detail::Inliner(main, is_native).run();
+}
+
+// Inlines the calls in `caller` through the globals in `globals`, each
+// given as (slot, the function it is expected to hold). Returns whether
+// the caller's code changed, and if so sets pc_map[pc] to where each
+// instruction (or the inlined copy replacing a call) now starts; as for
+// inline_calls, the rest is the caller's to redo.
+template <typename IsNative>
+inline bool inline_global_calls(
+    bytecode::Function *caller,
+    const std::vector<std::pair<int32_t, bytecode::Function *>> &globals,
+    std::vector<size_t> &pc_map, IsNative &&is_native) {
+  detail::Inliner inliner(caller, globals, is_native);
+  if (inliner.run().empty())
+    return false;
+  pc_map = inliner.pc_map(caller);
+  return true;
+}
+
+} // namespace vm
@@ -0,0 +1,90 @@
+#pragma once
+
+// Buffered source for the program's standard input. input() used to call
+// std::getline on std::cin once per line; the VM instead reads stdin in
+// large blocks and hands out lines straight from the buffer. Another
+// descriptor can stand in for stdin (see VM::set_stdio); without POSIX
+// read(2) only std::cin is supported.
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#if defined(__unix__)
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+namespace vm {
+
+class InputBuffer {
+public:
+  static constexpr size_t kChunk = 1 << 16;
+
+  InputBuffer() = default;
+  InputBuffer(const InputBuffer &) = delete;
+  InputBuffer &operator=(const InputBuffer &) = delete;
+
+  // Reads from `fd` from now on, dropping anything buffered.
+  void set_fd(int fd) {
+    fd_ = fd;
+    buf_.clear();
+    pos_ = 0;
+    eof_ = false;
+  }
+
+  // The next line without its '\n', like std::getline: at the end of the
+  // input it is whatever is left, possibly empty. The view is valid until
+  // the next call.
+  std::string_view read_line() {
+    size_t from = pos_;
+    for (;;) {
+      size_t nl = buf_.find('\n', from);
+      if (nl != std::string::npos) {
+        std::string_view line(buf_.data() + pos_, nl - pos_);
+        pos_ = nl + 1;
+        return line;
+      }
+      if (eof_) {
+        std::string_view line(buf_.data() + pos_, buf_.size() - pos_);
+        pos_ = buf_.size();
+        return line;
+      }
+      // Drop the lines already handed out, then read more.
+      buf_.erase(0, pos_);
+      pos_ = 0;
+      from = buf_.size();
+      fill();
+    }
+  }
+
+private:
+  void fill() {
+    size_t old_size = buf_.size();
+    buf_.resize(old_size + kChunk);
+#if defined(__unix__)
+    ssize_t n;
+    do {
+      n = ::read(fd_, buf_.data() + old_size, kChunk);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+      n = 0;
+      eof_ = true;
+    }
+#else
+    std::cin.read(buf_.data() + old_size, kChunk);
+    std::streamsize n = std::cin.gcount();
+    if (n <= 0)
+      eof_ = true;
+#endif
+    buf_.resize(old_size + static_cast<size_t>(n));
+  }
+
+  int fd_ = 0; // stdin
+  std::string buf_;
+  size_t pos_ = 0;
+  bool eof_ = false;
+};
+
+} // namespace vm
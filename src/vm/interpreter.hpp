@@ -3,15 +3,42 @@
 #include "bytecode/instructions.hpp"
 #include "bytecode/types.hpp"
 #include "gc/gc.hpp"
+#include "vm/heap_profiler.hpp"
+#include "vm/inliner.hpp"
+#include "vm/input.hpp"
+#include "vm/jit.hpp"
+#include "vm/liveness.hpp"
+#include "vm/output.hpp"
+#include "vm/profiler.hpp"
+#include "vm/regalloc.hpp"
+#include "vm/shape.hpp"
+#include "vm/superinstructions.hpp"
+#include "vm/verifier.hpp"
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
 #include <exception>
+#include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <optional>
 #include <set>
+#include <span>
 #include <string>
+#include <string_view>
+#include <functional>
+#include <utility>
 #include <vector>
 #include <unordered_map>
 #include <cstdint>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 //
 namespace vm {
@@ -23,40 +50,115 @@ class Reference;
 class Closure;
 
 // Lightweight tagged value used for VM stack/locals to avoid heap boxing.
+//
+// Values are packed into 64 bits. Heap pointers are stored as-is (Values are
+// allocated with at least 8-byte alignment, so their low three bits are
+// zero); every other kind keeps a nonzero tag in the low 32 bits and its
+// payload in the high 32 bits, so int32s are immediates and None, true and
+// false are fixed bit patterns.
+//
+// Strings of up to kSmallMax bytes are immediates too: the low byte holds
+// the tag and the length, the other seven the text, zero-padded. Strings
+// that short are always made this way (VM::make_string), so two of them
+// are equal exactly when their bits are.
 struct TaggedValue {
-  enum class Kind : uint8_t { None, Boolean, Integer, HeapPtr };
-  Kind kind;
-  union {
-    int32_t i;
-    bool b;
-    Value *ptr;
+  enum class Kind : uint8_t {
+    HeapPtr = 0,
+    Integer = 1,
+    Boolean = 2,
+    None = 3,
+    SmallString = 4
   };
+  static constexpr uint64_t kTagMask = 0x7;
+  static constexpr uint64_t kNoneBits = static_cast<uint64_t>(Kind::None);
+  static constexpr uint64_t kFalseBits = static_cast<uint64_t>(Kind::Boolean);
+  static constexpr uint64_t kTrueBits = kFalseBits | (uint64_t{1} << 32);
+  static constexpr size_t kSmallMax = 7;
+  // An element slot of a record that holds nothing (see Record). Its tag is
+  // no Kind's, so it is never a value; loads turn it into None.
+  static constexpr uint64_t kHoleBits = 5;
+
+  uint64_t bits;
+
+  constexpr TaggedValue() : bits(kNoneBits) {}
+
+  Kind kind() const { return static_cast<Kind>(bits & kTagMask); }
+  int32_t as_int() const { return static_cast<int32_t>(bits >> 32); }
+  bool as_bool() const { return bits == kTrueBits; }
+  Value *as_ptr() const { return reinterpret_cast<Value *>(bits); }
+  // The text of a SmallString; it points into this value.
+  std::string_view small_text() const {
+    return {reinterpret_cast<const char *>(&bits) + 1,
+            static_cast<size_t>((bits >> 3) & 0x7)};
+  }
 
-  static TaggedValue none() {
-    TaggedValue tv;
-    tv.kind = Kind::None;
-    tv.i = 0;
-    return tv;
+  bool is_hole() const { return bits == kHoleBits; }
+
+  static constexpr TaggedValue none() { return from_bits(kNoneBits); }
+  static constexpr TaggedValue hole() { return from_bits(kHoleBits); }
+  static constexpr TaggedValue from_int(int32_t v) {
+    return from_bits((static_cast<uint64_t>(static_cast<uint32_t>(v)) << 32) |
+                     static_cast<uint64_t>(Kind::Integer));
   }
-  static TaggedValue from_int(int32_t v) {
-    TaggedValue tv;
-    tv.kind = Kind::Integer;
-    tv.i = v;
-    return tv;
+  static constexpr TaggedValue from_bool(bool v) {
+    return from_bits(v ? kTrueBits : kFalseBits);
   }
-  static TaggedValue from_bool(bool v) {
-    TaggedValue tv;
-    tv.kind = Kind::Boolean;
-    tv.b = v;
+  static TaggedValue from_heap(Value *p) {
+    return from_bits(reinterpret_cast<uintptr_t>(p));
+  }
+  // `text` must be at most kSmallMax bytes.
+  static TaggedValue from_small(std::string_view text) {
+    TaggedValue tv =
+        from_bits(static_cast<uint64_t>(Kind::SmallString) | (text.size() << 3));
+    std::memcpy(reinterpret_cast<char *>(&tv.bits) + 1, text.data(), text.size());
     return tv;
   }
-  static TaggedValue from_heap(Value *p) {
+
+private:
+  static constexpr TaggedValue from_bits(uint64_t bits) {
     TaggedValue tv;
-    tv.kind = Kind::HeapPtr;
-    tv.ptr = p;
+    tv.bits = bits;
     return tv;
   }
 };
+static_assert(sizeof(TaggedValue) == 8, "TaggedValue must stay one word");
+static_assert(std::endian::native == std::endian::little,
+              "SmallString text is stored in memory order after the tag byte");
+
+// Calls f(ptr) for each non-null heap pointer in values[0, n). Arrays are
+// mostly immediates, so with SSE2 the tags of four values are tested at
+// once and a group without pointers costs a few instructions.
+template <typename F>
+inline void for_each_heap_ptr(const TaggedValue *values, size_t n, F &&f) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i tags = _mm_set1_epi64x(TaggedValue::kTagMask);
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 4 <= n; i += 4) {
+    __m128i a =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+    __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i + 2));
+    // Bytes 0 and 8 of the mask are the low dwords of the two lanes,
+    // which compare equal to zero exactly when the tag is HeapPtr.
+    int heap = (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(a, tags),
+                                                  zero)) |
+                _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(b, tags),
+                                                  zero))) &
+               0x0101;
+    if (!heap)
+      continue;
+    for (size_t k = i; k < i + 4; ++k) {
+      if (values[k].kind() == TaggedValue::Kind::HeapPtr && values[k].as_ptr())
+        f(values[k].as_ptr());
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    if (values[i].kind() == TaggedValue::Kind::HeapPtr && values[i].as_ptr())
+      f(values[i].as_ptr());
+  }
+}
 
 // Exceptions
 class UninitializedVariableException : public std::exception {
@@ -104,6 +206,29 @@ public:
   const char *what() const noexcept override { return msg.c_str(); }
 };
 
+// A snapshot given to VM::run that does not belong to the program. It is
+// thrown before the program starts, so the caller can run it afresh.
+class SnapshotError : public std::exception {
+  std::string msg;
+
+public:
+  explicit SnapshotError(const std::string &message)
+      : msg("SnapshotError: " + message) {}
+  const char *what() const noexcept override { return msg.c_str(); }
+};
+
+// Guards for invariants the load-time verifier (vm/verifier.hpp) has
+// already established. Debug builds keep them as a cross-check.
+#ifdef NDEBUG
+#define VM_CHECK_VERIFIED(cond, msg) ((void)0)
+#else
+#define VM_CHECK_VERIFIED(cond, msg)                                         \
+  do {                                                                       \
+    if (!(cond))                                                             \
+      throw RuntimeException(msg);                                           \
+  } while (0)
+#endif
+
 // Runtime value types that inherit from Collectable
 class Value : public Collectable {
 public:
@@ -124,6 +249,9 @@ public:
 
   Type type() const { return tag; }
   virtual std::string toString() const = 0;
+  // Appends the printed form to `out`; print() streams through this so
+  // nested records are not built up as intermediate strings.
+  virtual void write_to(std::string &out) const { out += toString(); }
   virtual ~Value() = default;
 
   // Helper methods for type checking
@@ -137,6 +265,35 @@ public:
   bool isReference() const { return tag == Type::Reference; }
 };
 
+inline void write_int(std::string &out, int32_t v) {
+  char buf[16];
+  auto res = std::to_chars(buf, buf + sizeof(buf), v);
+  out.append(buf, res.ptr);
+}
+
+inline void write_tagged(std::string &out, const TaggedValue &tv) {
+  switch (tv.kind()) {
+  case TaggedValue::Kind::None:
+    out += "None";
+    return;
+  case TaggedValue::Kind::Boolean:
+    out += tv.as_bool() ? "true" : "false";
+    return;
+  case TaggedValue::Kind::Integer:
+    write_int(out, tv.as_int());
+    return;
+  case TaggedValue::Kind::SmallString:
+    out += tv.small_text();
+    return;
+  case TaggedValue::Kind::HeapPtr:
+    if (tv.as_ptr())
+      tv.as_ptr()->write_to(out);
+    else
+      out += "None";
+    return;
+  }
+}
+
 class None : public Value {
 public:
   None() : Value(Type::None) {}
@@ -165,6 +322,7 @@ public:
   int32_t value; // Changed to int32_t per spec
   Integer(int32_t v) : Value(Type::Integer), value(v) {}
   std::string toString() const override { return std::to_string(value); }
+  void write_to(std::string &out) const override { write_int(out, value); }
 
 protected:
   void follow(CollectedHeap &) override {
@@ -172,87 +330,519 @@ protected:
   }
 };
 
+// A String is either flat or a rope node standing for left + right. Ropes
+// are flattened the first time their text is needed (str()), which also
+// drops the children so they can be collected. Interned strings are
+// canonical: two distinct interned Strings never have equal text. Long
+// text lives in the large-object space.
 class String : public Value {
 public:
-  std::string value;
-  String(const std::string &v) : Value(Type::String), value(v) {}
-  std::string toString() const override { return value; }
+  String(std::string_view v)
+      : Value(Type::String), value_(v.data(), v.size()), length_(v.size()) {}
+  String(String *left, String *right)
+      : Value(Type::String), left_(left), right_(right),
+        length_(left->length_ + right->length_),
+        depth_(std::max(left->depth_, right->depth_) + 1) {}
+
+  bool interned = false;
+
+  std::string_view str() const {
+    if (left_)
+      flatten();
+    return value_;
+  }
+  size_t size() const { return length_; }
+  uint32_t depth() const { return depth_; }
+
+  // Hash of the text, computed on first use.
+  uint32_t hash() const {
+    if (!hashed_) {
+      hash_ = hash_text(str());
+      hashed_ = true;
+    }
+    return hash_;
+  }
+
+  static uint32_t hash_text(std::string_view text) {
+    uint64_t h = std::hash<std::string_view>{}(text);
+    return static_cast<uint32_t>(h ^ (h >> 32));
+  }
+
+  std::string toString() const override { return std::string(str()); }
+  void write_to(std::string &out) const override { out += str(); }
+
+  // Text past the small-string buffer lives on the malloc heap.
+  size_t payload_bytes() const override {
+    return value_.capacity() > kInlineChars ? value_.capacity() + 1 : 0;
+  }
 
 protected:
-  void follow(CollectedHeap &) override {
-    // String has no references
+  void follow(CollectedHeap &heap) override {
+    heap.markSuccessors(left_);
+    heap.markSuccessors(right_);
+  }
+
+private:
+  using Text =
+      std::basic_string<char, std::char_traits<char>, LargeObjectAllocator<char>>;
+  static constexpr size_t kInlineChars = Text().capacity();
+
+  mutable Text value_;
+  mutable String *left_ = nullptr;
+  mutable String *right_ = nullptr;
+  size_t length_;
+  mutable uint32_t depth_ = 0;
+  mutable uint32_t hash_ = 0;
+  mutable bool hashed_ = false;
+
+  void flatten() const {
+    Text out;
+    out.reserve(length_);
+    std::vector<const String *> todo{this};
+    while (!todo.empty()) {
+      const String *s = todo.back();
+      todo.pop_back();
+      if (s->left_) {
+        todo.push_back(s->right_);
+        todo.push_back(s->left_);
+      } else {
+        out += s->value_;
+      }
+    }
+    value_ = std::move(out);
+    left_ = right_ = nullptr;
+    depth_ = 0;
   }
 };
 
-class Record : public Value {
+// Storage for a record's dictionary-mode keys: an open-addressing index
+// over a flat, insertion-ordered entry array. MITScript treats an integer
+// and the string spelling it as the same key, so keys are normalized
+// (see key_for_text) to an Integer immediate or a SmallString immediate,
+// both hashed and compared by bits, or a longer String, hashed by its
+// cached text hash and compared by pointer before text. Records never
+// delete keys, so entries are only appended.
+class RecordMap {
 public:
-  std::unordered_map<std::string, Value *> fields;
-  bool dense_mode = true;            // start as dense integer array
-  std::vector<TaggedValue> dense;    // fast path storage for int keys
-  // std::map<int64_t, Value *> indices;
-  // size_t next_index = 0;
+  struct Entry {
+    TaggedValue key;
+    TaggedValue value;
+  };
+
+  // Whether `text` is what std::to_string prints for some int32.
+  static bool canonical_int(std::string_view text, int32_t &out) {
+    if (text.empty() || text.size() > 11)
+      return false;
+    size_t i = text[0] == '-' ? 1 : 0;
+    if (i == text.size() || (text[i] == '0' && text.size() > i + 1) ||
+        (i == 1 && text[1] == '0'))
+      return false;
+    int64_t v = 0;
+    for (size_t k = i; k < text.size(); ++k) {
+      if (text[k] < '0' || text[k] > '9')
+        return false;
+      v = v * 10 + (text[k] - '0');
+    }
+    if (i == 1)
+      v = -v;
+    if (v < INT32_MIN || v > INT32_MAX)
+      return false;
+    out = static_cast<int32_t>(v);
+    return true;
+  }
+
+  // The key a String index stands for.
+  static TaggedValue key_for_string(String *s) {
+    if (std::optional<TaggedValue> key = key_for_text(s->str()))
+      return *key;
+    return TaggedValue::from_heap(s);
+  }
+
+  // The immediate key `text` stands for: the int32 it spells, or a
+  // SmallString when it is short enough. nullopt means a String key.
+  static std::optional<TaggedValue> key_for_text(std::string_view text) {
+    int32_t k;
+    if (canonical_int(text, k))
+      return TaggedValue::from_int(k);
+    if (text.size() <= TaggedValue::kSmallMax)
+      return TaggedValue::from_small(text);
+    return std::nullopt;
+  }
 
-  Record() : Value(Type::Record) {}
+  size_t size() const { return entries_.size(); }
+  const std::vector<Entry> &entries() const { return entries_; }
 
-  std::string toString() const override {
-    auto tagged_to_string_local = [](const TaggedValue &tv) -> std::string {
-      switch (tv.kind) {
-      case TaggedValue::Kind::None:
-        return "None";
-      case TaggedValue::Kind::Boolean:
-        return tv.b ? "true" : "false";
-      case TaggedValue::Kind::Integer:
-        return std::to_string(tv.i);
-      case TaggedValue::Kind::HeapPtr:
-        return tv.ptr ? tv.ptr->toString() : "None";
+  // Storage owned by the map, for heap accounting.
+  size_t heap_bytes() const {
+    return entries_.capacity() * sizeof(Entry) +
+           slots_.capacity() * sizeof(Slot);
+  }
+
+  // `key` must be normalized.
+  const TaggedValue *find(const TaggedValue &key) const {
+    if (key.kind() != TaggedValue::Kind::HeapPtr)
+      return find_immediate(key);
+    const String *s = static_cast<const String *>(key.as_ptr());
+    return find_string(s->str(), s->hash(), s);
+  }
+
+  // Looks a key up by its text, which need not be normalized.
+  const TaggedValue *find_text(std::string_view text) const {
+    if (std::optional<TaggedValue> key = key_for_text(text))
+      return find_immediate(*key);
+    return find_string(text, String::hash_text(text), nullptr);
+  }
+  TaggedValue *find_text(std::string_view text) {
+    return const_cast<TaggedValue *>(std::as_const(*this).find_text(text));
+  }
+
+  // Returns the value stored under the normalized `key`, adding a None
+  // entry if the key is new.
+  TaggedValue &insert(const TaggedValue &key) {
+    if ((entries_.size() + 1) * 4 > slots_.size() * 3)
+      grow();
+    uint32_t h = hash_of(key);
+    int64_t at;
+    if (key.kind() != TaggedValue::Kind::HeapPtr) {
+      at = probe(h, [&](const Entry &e) { return e.key.bits == key.bits; });
+    } else {
+      const String *s = static_cast<const String *>(key.as_ptr());
+      at = probe(h, StringKeyMatch{s->str(), s});
+    }
+    Slot &slot = slots_[at];
+    if (slot.entry == kEmpty) {
+      slot.entry = static_cast<uint32_t>(entries_.size());
+      slot.hash = h;
+      entries_.push_back({key, TaggedValue::none()});
+    }
+    return entries_[slot.entry].value;
+  }
+
+  template <typename F> void for_each_heap_ref(F &&f) const {
+    for (const Entry &e : entries_) {
+      if (e.key.kind() == TaggedValue::Kind::HeapPtr)
+        f(e.key.as_ptr());
+      if (e.value.kind() == TaggedValue::Kind::HeapPtr && e.value.as_ptr())
+        f(e.value.as_ptr());
+    }
+  }
+
+private:
+  static constexpr uint32_t kEmpty = UINT32_MAX;
+  struct Slot {
+    uint32_t entry = kEmpty;
+    uint32_t hash = 0;
+  };
+
+  std::vector<Entry> entries_;
+  std::vector<Slot> slots_; // power-of-two sized, at most 3/4 full
+
+  static uint32_t hash_bits(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ull;
+    bits ^= bits >> 33;
+    return static_cast<uint32_t>(bits);
+  }
+
+  static uint32_t hash_of(const TaggedValue &key) {
+    return key.kind() != TaggedValue::Kind::HeapPtr
+               ? hash_bits(key.bits)
+               : static_cast<const String *>(key.as_ptr())->hash();
+  }
+
+  const TaggedValue *find_immediate(const TaggedValue &key) const {
+    int64_t at = probe(hash_bits(key.bits),
+                       [&](const Entry &e) { return e.key.bits == key.bits; });
+    return at >= 0 && slots_[at].entry != kEmpty ? &entries_[slots_[at].entry].value
+                                                 : nullptr;
+  }
+
+  struct StringKeyMatch {
+    std::string_view text;
+    const String *s;
+    bool operator()(const Entry &e) const {
+      if (e.key.kind() != TaggedValue::Kind::HeapPtr)
+        return false;
+      const String *other = static_cast<const String *>(e.key.as_ptr());
+      return other == s || other->str() == text;
+    }
+  };
+
+  const TaggedValue *find_string(std::string_view text, uint32_t h,
+                                 const String *s) const {
+    int64_t at = probe(h, StringKeyMatch{text, s});
+    return at >= 0 && slots_[at].entry != kEmpty ? &entries_[slots_[at].entry].value
+                                                 : nullptr;
+  }
+
+  // Index of the slot holding a matching entry, or of the empty slot where
+  // it would go; -1 if the table has no slots yet.
+  template <typename Match>
+  int64_t probe(uint32_t h, Match &&match) const {
+    if (slots_.empty())
+      return -1;
+    size_t mask = slots_.size() - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+      const Slot &slot = slots_[i];
+      if (slot.entry == kEmpty ||
+          (slot.hash == h && match(entries_[slot.entry])))
+        return static_cast<int64_t>(i);
+    }
+  }
+
+  void grow() {
+    size_t cap = slots_.empty() ? 8 : slots_.size() * 2;
+    slots_.assign(cap, Slot{});
+    size_t mask = cap - 1;
+    for (uint32_t idx = 0; idx < entries_.size(); ++idx) {
+      uint32_t h = hash_of(entries_[idx].key);
+      size_t i = h & mask;
+      while (slots_[i].entry != kEmpty)
+        i = (i + 1) & mask;
+      slots_[i] = {idx, h};
+    }
+  }
+};
+
+// The integer-keyed elements of a record that lie outside its dense
+// prefix (see Record): negative indices, and indices too far past the
+// prefix's end to extend it. Elements are grouped in chunks of kChunkSize
+// consecutive indices, found through a linear-probing table on the chunk
+// number, so storage grows with the chunks in use rather than with the
+// largest index. Slots of a chunk that hold no element are holes, as in
+// the dense prefix, so a stored None is still an element.
+class SparseElements {
+public:
+  static constexpr int32_t kChunkBits = 5;
+  static constexpr int32_t kChunkSize = 1 << kChunkBits;
+
+  struct Chunk {
+    int32_t number; // holds indices [number * kChunkSize, +kChunkSize)
+    std::array<TaggedValue, kChunkSize> values;
+  };
+
+  static int32_t chunk_of(int32_t k) { return k >> kChunkBits; }
+
+  bool empty() const { return chunks_.empty(); }
+  const std::vector<Chunk> &chunks() const { return chunks_; }
+
+  size_t heap_bytes() const {
+    return chunks_.capacity() * sizeof(Chunk) +
+           slots_.capacity() * sizeof(uint32_t);
+  }
+
+  const TaggedValue *find(int32_t k) const {
+    const Chunk *c = find_chunk(chunk_of(k));
+    if (!c || c->values[k & (kChunkSize - 1)].is_hole())
+      return nullptr;
+    return &c->values[k & (kChunkSize - 1)];
+  }
+
+  // The element at `k`, adding its chunk if it has none.
+  TaggedValue &insert(int32_t k) {
+    int32_t number = chunk_of(k);
+    int64_t at = probe(number);
+    if (at < 0 || slots_[at] == kEmpty) {
+      if ((chunks_.size() + 1) * 4 > slots_.size() * 3) {
+        grow();
+        at = probe(number);
       }
-      return "None";
-    };
+      slots_[at] = static_cast<uint32_t>(chunks_.size());
+      chunks_.push_back({number, {}});
+      chunks_.back().values.fill(TaggedValue::hole());
+    }
+    return chunks_[slots_[at]].values[k & (kChunkSize - 1)];
+  }
+
+  const Chunk *find_chunk(int32_t number) const {
+    int64_t at = probe(number);
+    return at >= 0 && slots_[at] != kEmpty ? &chunks_[slots_[at]] : nullptr;
+  }
+
+  // Removes the chunk `number`, which must be present.
+  void erase_chunk(int32_t number) {
+    size_t mask = slots_.size() - 1;
+    size_t hole = static_cast<size_t>(probe(number));
+    uint32_t index = slots_[hole];
+    // Close the gap so that every later chunk in the run stays reachable
+    // from its home slot.
+    for (size_t i = (hole + 1) & mask; slots_[i] != kEmpty; i = (i + 1) & mask) {
+      size_t home = hash(chunks_[slots_[i]].number) & mask;
+      if (((i - home) & mask) >= ((i - hole) & mask)) {
+        slots_[hole] = slots_[i];
+        hole = i;
+      }
+    }
+    slots_[hole] = kEmpty;
+    // Move the last chunk into the freed place.
+    uint32_t last = static_cast<uint32_t>(chunks_.size() - 1);
+    if (index != last) {
+      slots_[probe(chunks_[last].number)] = index;
+      chunks_[index] = chunks_[last];
+    }
+    chunks_.pop_back();
+  }
+
+  template <typename F> void for_each_heap_ref(F &&f) const {
+    for (const Chunk &c : chunks_)
+      for (const TaggedValue &v : c.values)
+        if (v.kind() == TaggedValue::Kind::HeapPtr && v.as_ptr())
+          f(v.as_ptr());
+  }
+
+private:
+  static constexpr uint32_t kEmpty = UINT32_MAX;
+
+  std::vector<Chunk> chunks_;
+  std::vector<uint32_t> slots_; // power-of-two sized, at most 3/4 full
+
+  static uint32_t hash(int32_t number) {
+    return static_cast<uint32_t>(number) * 0x9E3779B1u;
+  }
+
+  // Slot holding chunk `number`, or the empty slot where it would go; -1
+  // if the table has no slots yet.
+  int64_t probe(int32_t number) const {
+    if (slots_.empty())
+      return -1;
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash(number) & mask;; i = (i + 1) & mask) {
+      if (slots_[i] == kEmpty || chunks_[slots_[i]].number == number)
+        return static_cast<int64_t>(i);
+    }
+  }
+
+  void grow() {
+    size_t cap = slots_.empty() ? 8 : slots_.size() * 2;
+    slots_.assign(cap, kEmpty);
+    size_t mask = cap - 1;
+    for (uint32_t idx = 0; idx < chunks_.size(); ++idx) {
+      size_t i = hash(chunks_[idx].number) & mask;
+      while (slots_[i] != kEmpty)
+        i = (i + 1) & mask;
+      slots_[i] = idx;
+    }
+  }
+};
+
+class Record : public Value {
+public:
+  // Integer keys (including strings spelling an int32) are elements: index
+  // i lives in `dense` when i < dense.size() and in `sparse` otherwise (see
+  // VM::record_try_element_store for how the prefix grows). Indices with no
+  // element hold TaggedValue::hole(), which element() reads as None. Every other key
+  // is a named field. Named fields live in `slots`, laid out by `shape`; a
+  // null shape means the record is in dictionary mode and they live in
+  // `fields`. The two halves never affect each other, so an array with a
+  // few named fields stays an array. Values are stored unboxed; a long
+  // dense prefix lives in the large-object space.
+  Shape *shape;
+  std::vector<TaggedValue> slots;
+  RecordMap fields;
+  std::vector<TaggedValue, LargeObjectAllocator<TaggedValue>> dense;
+  SparseElements sparse;
+
+  explicit Record(Shape *s) : Value(Type::Record), shape(s) {}
+
+  static TaggedValue element(const TaggedValue &slot) {
+    return slot.is_hole() ? TaggedValue::none() : slot;
+  }
+
+  // Returns the value stored under a string key, or nullptr if absent.
+  const TaggedValue *find_named(std::string_view key) const {
+    if (shape) {
+      int slot = shape->slot_index(key);
+      if (slot >= 0)
+        return &slots[slot];
+    }
+    return fields.find_text(key);
+  }
 
-    std::string result = "{";
+  std::string toString() const override {
+    std::string result;
+    write_to(result);
+    return result;
+  }
 
-    std::vector<std::pair<std::string, std::string>> entries;
+  void write_to(std::string &out) const override {
+    std::vector<std::pair<std::string, const TaggedValue *>> entries;
 
-    if (dense_mode) {
-      for (size_t i = 0; i < dense.size(); ++i) {
-        const TaggedValue &tv = dense[i];
-        if (tv.kind == TaggedValue::Kind::None)
+    for (size_t i = 0; i < dense.size(); ++i) {
+      const TaggedValue &tv = dense[i];
+      if (tv.is_hole())
+        continue;
+      entries.emplace_back(std::to_string(i), &tv);
+    }
+    for (const SparseElements::Chunk &c : sparse.chunks()) {
+      for (int32_t k = 0; k < SparseElements::kChunkSize; ++k) {
+        if (c.values[k].is_hole())
           continue;
-        entries.emplace_back(std::to_string(i), tagged_to_string_local(tv));
+        entries.emplace_back(
+            std::to_string(c.number * SparseElements::kChunkSize + k),
+            &c.values[k]);
+      }
+    }
+
+    if (shape) {
+      for (size_t i = 0; i < slots.size(); ++i) {
+        entries.emplace_back(shape->fields[i], &slots[i]);
       }
     }
 
-    for (const auto &pair : fields) {
-      entries.emplace_back(pair.first, pair.second->toString());
+    for (const auto &entry : fields.entries()) {
+      if (entry.key.kind() == TaggedValue::Kind::Integer)
+        entries.emplace_back(std::to_string(entry.key.as_int()), &entry.value);
+      else if (entry.key.kind() == TaggedValue::Kind::SmallString)
+        entries.emplace_back(entry.key.small_text(), &entry.value);
+      else
+        entries.emplace_back(static_cast<String *>(entry.key.as_ptr())->str(),
+                             &entry.value);
     }
 
     std::sort(entries.begin(), entries.end(),
               [](const auto &a, const auto &b) { return a.first < b.first; });
 
+    out += '{';
     for (const auto &entry : entries) {
-      result += entry.first + ":" + entry.second + " ";
+      out += entry.first;
+      out += ':';
+      write_tagged(out, *entry.second);
+      out += ' ';
     }
-    result += "}";
-    return result;
+    out += '}';
+  }
+
+  size_t payload_bytes() const override {
+    return (slots.capacity() + dense.capacity()) * sizeof(TaggedValue) +
+           fields.heap_bytes() + sparse.heap_bytes();
   }
 
 protected:
   void follow(CollectedHeap &heap) override {
-    // Mark dense storage
-    if (dense_mode) {
-      for (const auto &tv : dense) {
-        if (tv.kind == TaggedValue::Kind::HeapPtr && tv.ptr) {
-          heap.markSuccessors(tv.ptr);
-        }
-      }
-    }
+    // Immediates hold no references; only heap pointers are traced. All
+    // but the last chunk of a long dense prefix is left to the heap to
+    // trace through follow_slots.
+    auto mark = [&heap](Value *v) { heap.markSuccessors(v); };
+    size_t from = 0;
+    if (dense.size() > CollectedHeap::kScanChunk &&
+        heap.defer_slots(this, 0, dense.size() - CollectedHeap::kScanChunk))
+      from = dense.size() - CollectedHeap::kScanChunk;
+    for_each_heap_ptr(dense.data() + from, dense.size() - from, mark);
+    for_each_heap_ptr(slots.data(), slots.size(), mark);
+    fields.for_each_heap_ref([&heap](Value *v) { heap.markSuccessors(v); });
+    sparse.for_each_heap_ref([&heap](Value *v) { heap.markSuccessors(v); });
+  }
 
-    for (auto &[name, val] : fields) {
-      heap.markSuccessors(val);
-    }
-    // for (auto &[idx, val] : indices) {
-    //   heap.markSuccessors(val);
-    // }
+  // Slots are dense indices; stores carded by slot go through
+  // VM::record_try_element_store. Every other store remembers the record
+  // whole.
+  void follow_slots(CollectedHeap &heap, size_t begin, size_t end) override {
+    end = std::min(end, dense.size());
+    if (begin < end)
+      for_each_heap_ptr(dense.data() + begin, end - begin,
+                        [&heap](Value *v) { heap.markSuccessors(v); });
   }
 };
 
@@ -270,73 +860,218 @@ protected:
 
 class Reference : public Value {
 public:
-  Value *cell; // Points to the heap-allocated cell containing the actual value
-  Reference(Value *c) : Value(Type::Reference), cell(c) {}
+  // The captured variable's value, unboxed like a register, so storing an
+  // integer through the reference allocates nothing.
+  TaggedValue value;
+  explicit Reference(TaggedValue v) : Value(Type::Reference), value(v) {}
   std::string toString() const override {
     throw RuntimeException("Cannot toString a Reference");
   }
 
 protected:
-  void follow(CollectedHeap &heap) override { heap.markSuccessors(cell); }
+  void follow(CollectedHeap &heap) override {
+    if (value.kind() == TaggedValue::Kind::HeapPtr && value.as_ptr())
+      heap.markSuccessors(value.as_ptr());
+  }
 };
 
+// The References a closure captured, in free_vars_ order.
+using FreeRefs = std::span<Value *const>;
+
 class Closure : public Value {
 public:
   bytecode::Function *function;
-  std::vector<Value *> free_var_refs;
-
-  Closure(bytecode::Function *func, std::vector<Value *> refs)
-      : Value(Type::Closure), function(func), free_var_refs(std::move(refs)) {}
+  const uint32_t free_count;
+
+  // The free_count Reference pointers are stored inline after the object,
+  // in the same cell, so a closure must be allocated with
+  // VM::allocate_sized(Closure::size_for(free_count), ...). They start out
+  // null for the caller to fill in.
+  Closure(bytecode::Function *func, uint32_t count)
+      : Value(Type::Closure), function(func), free_count(count) {
+    std::fill_n(free_var_slots(), count, nullptr);
+  }
   std::string toString() const override { return "FUNCTION"; }
 
+  static size_t size_for(size_t count) {
+    return sizeof(Closure) + count * sizeof(Value *);
+  }
+  Value **free_var_slots() { return reinterpret_cast<Value **>(this + 1); }
+  FreeRefs free_var_refs() const {
+    return {reinterpret_cast<Value *const *>(this + 1), free_count};
+  }
+
 protected:
   void follow(CollectedHeap &heap) override {
-    for (Value *ref : free_var_refs) {
+    for (Value *ref : free_var_refs()) {
       heap.markSuccessors(ref);
     }
   }
 };
-
-// Stack frame
+static_assert(sizeof(Closure) % alignof(Value *) == 0,
+              "Closure's inline free variables would be misaligned");
+
+// Stack frame. A frame's locals are a window [base, base + size) of the
+// VM's shared register file. The Reference objects for the function's
+// local_reference_vars_ sit directly after its named locals, starting at
+// ref_base, so that they lie below any argument registers a callee's
+// window can overlap; temporaries follow them.
 struct Frame {
-  std::vector<TaggedValue> locals;
-  std::set<size_t> ref_locals; // Indices that are reference variables
-  std::unordered_map<std::string, Value *>
-      local_refs; // Map from var name to Reference object
-  std::vector<TaggedValue> stack;
+  size_t base = 0;
+  size_t size = 0;
+  size_t ref_base = 0;
+  size_t saved_top = 0; // register_top to restore when the frame is popped
+  std::vector<TaggedValue> stack; // operand stack (stack interpreter only)
   size_t sp = 0; // stack pointer
   size_t pc;
 
   // Pointer to the current function and its free refs
   bytecode::Function *func;
-  const std::vector<Value *> *free_refs;
-
-  Frame(size_t local_count,
-        bytecode::Function *f,
-        const std::vector<Value *> *fr)
-    : locals(local_count, TaggedValue::none()),
-      pc(0),
-      func(f),
-      free_refs(fr) {
-        stack.reserve(256);
-      }
+  FreeRefs free_refs;
+  // The function's materialized constant pool (register interpreter only)
+  const TaggedValue *constants = nullptr;
+  // Callee value that owns free_refs, kept alive because a tail call can
+  // overwrite the register it was loaded from.
+  Value *callee = nullptr;
+  // Set while the frame runs compiled code; pc is then the Call it is
+  // suspended at.
+  bool jit = false;
+
+  Frame(bytecode::Function *f, FreeRefs fr)
+    : pc(0), func(f), free_refs(fr) {}
 };
 
 // Virtual Machine
 class VM {
 private:
   CollectedHeap heap;
-  std::unordered_map<std::string, TaggedValue> globals;
+  ShapeTable shapes;
+  // Globals are resolved to dense slots when functions are translated.
+  // Slots that have never been stored to hold the undefined_global()
+  // sentinel.
+  std::vector<TaggedValue> globals;
+  std::vector<std::string> global_names;
+  std::unordered_map<std::string, uint32_t> global_slots;
   size_t max_heap_bytes;
   std::unordered_map<bytecode::Function *, int>
       native_functions; // Map function to native ID
   std::unordered_map<bytecode::Constant *, Value *> constant_cache;
+  // String constants are interned so equal literals share one String.
+  std::unordered_map<std::string, String *> interned_strings;
+  OutputBuffer output;
+  InputBuffer input;
+  // Per-function constant pools built at translation time, indexed by
+  // Function::constant_pool, and every heap value they (or the constant
+  // cache) can reference. The collector scans constant_roots directly
+  // instead of walking the hash maps.
+  std::vector<std::vector<TaggedValue>> constant_pools;
+  std::vector<Value *> constant_roots;
 
   // For GC - track current execution state
   std::vector<Frame *> call_stack;
 
-  // Allocation tracking for GC trigger
+  // Register-code frames are kept here rather than on the native stack so
+  // that MITScript calls do not recurse in C++ (see execute_function_reg).
+  // Frame objects are reused; reg_depth counts the ones in use.
+  std::vector<std::unique_ptr<Frame>> reg_frames;
+  size_t reg_depth = 0;
+
+  // Register file shared by every active frame. Slots at or above
+  // register_top are dead and are not scanned by the collector.
+  std::vector<TaggedValue> registers;
+  size_t register_top = 0;
+
+  // Baseline JIT state (see jit_compile). Compiled code reports exceptions
+  // raised by its helpers through jit_error instead of unwinding through
+  // native frames, and hands its return value back through jit_ret.
+  bool jit_enabled = false;
+  // Inline predicted calls once the program is translated (see inliner.hpp).
+  bool inlining_enabled = false;
+  // Inline hot calls through globals as the program runs (see
+  // speculate_calls); on with inlining unless profiling.
+  bool speculating = false;
+  static constexpr uint32_t kSpeculateCallThreshold = 16;
+  static constexpr uint32_t kSpeculateBackEdgeThreshold = 256;
+  // Whether run_reg counts calls and backward branches, for the JIT or
+  // for speculate_calls.
+  bool tiering = false;
+  // What speculate_calls saw each function's globals hold halfway there.
+  std::unordered_map<const bytecode::Function *,
+                     std::vector<std::pair<int32_t, bytecode::Function *>>>
+      global_samples;
+  static constexpr uint32_t kJitCallThreshold = 64;
+  // Taken backward branches before a function's loops are compiled, so
+  // that a hot loop in code that is called rarely (main, say) is tiered
+  // up too; see the back_edge label in run_reg.
+  static constexpr uint32_t kJitBackEdgeThreshold = 1024;
+  jit::CodeCache jit_code_cache;
+  std::exception_ptr jit_error;
+  TaggedValue jit_ret = TaggedValue::none();
+
+  // Allocation tracking for GC trigger: a collection (or, while an
+  // incremental mark is running, a mark step) happens once curr_heap_bytes
+  // reaches gc_check_bytes.
   size_t curr_heap_bytes = 0;
+  size_t gc_check_bytes;
+  // Set while a function is being translated; the check waits until the
+  // next allocation after it.
+  bool gc_deferred = false;
+
+  // Incremental marking (--gc-pause-us). With a zero budget full
+  // collections stop the world; otherwise each mark step runs for about
+  // gc_pause, one step per kGcStepBytes allocated. A cycle that has seen
+  // a quarter of the heap budget allocated is finished in one go, so the
+  // heap cannot outgrow the limit while the marker falls behind.
+  static constexpr size_t kGcStepBytes = 256 * 1024;
+  std::chrono::microseconds gc_pause{0};
+  size_t gc_cycle_bytes = 0;
+
+  // Heap sizing. --mem bounds the whole process, so the accounted heap
+  // (cells plus container payloads, see Collectable::payload_bytes) is kept
+  // under heap_budget, the share of the limit left after the interpreter
+  // itself, allocator slack and GC metadata. After each collection the next
+  // one is due once gc_growth times the surviving heap has been allocated:
+  // at least an eighth of the budget and at most what the budget has left,
+  // so collection work stays proportional to allocation. gc_growth follows
+  // the survival rate. When most of what a cycle allocated survives, the
+  // program is building long-lived data and collecting sooner would only
+  // retrace it; when little survives, the default is plenty.
+  static constexpr size_t kHeapBudgetPercent = 60;
+  static constexpr size_t kMinGcInterval = 64 * 1024;
+  static constexpr double kMaxGcGrowth = 4.0;
+  size_t heap_budget;
+  double gc_growth = 1.0;
+  size_t live_after_gc = 0;
+
+  // --gc-stats: where to dump the collector telemetry at exit ("-" for
+  // stderr); empty when off.
+  std::string gc_stats_path;
+  GcStats gc_stats;
+
+  // --perf-counters: the phase counters, owned by the driver; null when
+  // off.
+  PerfCounters *perf_counters = nullptr;
+
+  // --heap-profile: where to write the allocation profile at exit; null
+  // when off. See note_alloc_site for how allocations find their pc.
+  std::unique_ptr<HeapProfiler> heap_profile;
+  std::string heap_profile_path;
+
+  // -O profile / --profile: where to write the execution profile at exit
+  // ("-" for stderr); null when off.
+  std::unique_ptr<Profiler> profiler;
+  std::string profile_path;
+
+  // --snapshot (see vm/snapshot.cpp). snapshot_hook runs at the program's
+  // first input() call, with snapshot_output holding what it printed
+  // before. A resumed run copies resume_registers into main's frame as it
+  // enters it and continues at the Call at resume_pc.
+  bytecode::Function *main_function = nullptr;
+  std::function<void(VM &)> snapshot_hook;
+  std::string snapshot_output;
+  bool resuming = false;
+  size_t resume_pc = 0;
+  std::vector<TaggedValue> resume_registers;
 
   // Singletons for commonly-used immutable values
   Value *none_singleton = nullptr;
@@ -345,12 +1080,211 @@ private:
 
   // Wrapper for heap allocation that triggers GC periodically
   template <typename T, typename... Args> T *allocate(Args &&...args) {
-    curr_heap_bytes += sizeof(T);
-    if (curr_heap_bytes >= max_heap_bytes) {
+    return allocate_sized<T>(sizeof(T), std::forward<Args>(args)...);
+  }
+
+  // As allocate, for a T that keeps `size` - sizeof(T) bytes of trailing
+  // storage in its cell (see Closure).
+  template <typename T, typename... Args>
+  T *allocate_sized(size_t size, Args &&...args) {
+    reserve_heap_bytes(size);
+    T *obj = heap.allocate_sized<T>(size, std::forward<Args>(args)...);
+    note_heap_growth(obj->T::payload_bytes());
+    if (heap_profile)
+      profile_allocation(obj, size);
+    return obj;
+  }
+
+  // Offers an allocation of a `cell_bytes` object to the heap profiler,
+  // which records the interpreter stack if it samples it.
+  void profile_allocation(Value *obj, size_t cell_bytes) {
+    if (!heap_profile->sample(cell_bytes + obj->payload_bytes()))
+      return;
+    std::vector<HeapProfiler::StackFrame> stack;
+    stack.reserve(call_stack.size());
+    for (const Frame *frame : call_stack)
+      stack.push_back({frame->func, frame->pc});
+    heap_profile->record(obj, cell_bytes, value_type_name(obj->type()), stack);
+  }
+
+  // Frame::pc is only kept up to date at Calls. Handlers that allocate
+  // store it first while the heap profiler is on, so samples name the
+  // instruction that allocated.
+  void note_alloc_site(Frame &frame, const bytecode::RegisterInstruction *ip) {
+    if (heap_profile)
+      frame.pc = static_cast<size_t>(ip - frame.func->reg_instructions.data());
+  }
+
+  static const char *value_type_name(Value::Type type) {
+    switch (type) {
+    case Value::Type::None: return "None";
+    case Value::Type::Boolean: return "Boolean";
+    case Value::Type::Integer: return "Integer";
+    case Value::Type::String: return "String";
+    case Value::Type::Record: return "Record";
+    case Value::Type::Function: return "Function";
+    case Value::Type::Closure: return "Closure";
+    case Value::Type::Reference: return "Reference";
+    }
+    return "?";
+  }
+
+  static void forget_freed(void *ctx, Collectable *obj) {
+    static_cast<HeapProfiler *>(ctx)->forget(obj);
+  }
+
+  // Storage a container gained counts towards the next collection like an
+  // allocation, but never collects: callers may still hold values that no
+  // root reaches.
+  void note_heap_growth(size_t bytes) { curr_heap_bytes += bytes; }
+
+  // Counts whatever storage `rec` gains during the scope's lifetime.
+  class RecordGrowthScope {
+  public:
+    RecordGrowthScope(VM &vm, const Record *rec)
+        : vm_(vm), rec_(rec), before_(rec->payload_bytes()) {}
+    ~RecordGrowthScope() {
+      size_t now = rec_->payload_bytes();
+      if (now > before_)
+        vm_.note_heap_growth(now - before_);
+    }
+
+  private:
+    VM &vm_;
+    const Record *rec_;
+    size_t before_;
+  };
+
+  // Counts `bytes` towards the next collection, collecting first if the
+  // budget is exhausted. Callers that then use heap.allocate directly know
+  // no collection happens until their next reservation.
+  void reserve_heap_bytes(size_t bytes) {
+    curr_heap_bytes += bytes;
+    if (curr_heap_bytes >= gc_check_bytes && !gc_deferred) {
       maybe_gc();
       curr_heap_bytes = 0;
     }
-    return heap.allocate<T>(std::forward<Args>(args)...);
+  }
+
+  static TaggedValue undefined_global() {
+    return TaggedValue::from_heap(nullptr);
+  }
+
+  static bool is_undefined_global(const TaggedValue &tv) {
+    return tv.kind() == TaggedValue::Kind::HeapPtr && tv.as_ptr() == nullptr;
+  }
+
+  uint32_t intern_global(const std::string &name) {
+    auto it = global_slots.find(name);
+    if (it != global_slots.end())
+      return it->second;
+    uint32_t slot = static_cast<uint32_t>(globals.size());
+    globals.push_back(undefined_global());
+    global_names.push_back(name);
+    global_slots.emplace(name, slot);
+    return slot;
+  }
+
+  void reserve_registers(size_t need) {
+    if (need > registers.size()) {
+      registers.resize(std::max(need, registers.size() * 2),
+                       TaggedValue::none());
+    }
+  }
+
+  // Claims the `size`-slot window starting at `base` and makes `frame` the
+  // innermost frame. The first `arg_count` slots already hold the arguments
+  // (a register call passes the caller's argument registers as the callee's
+  // parameters); the rest of the window is cleared. The register file may be
+  // reallocated, so callers must re-derive any pointer into it afterwards.
+  void push_frame(Frame &frame, size_t base, size_t arg_count, size_t size) {
+    frame.base = base;
+    frame.ref_base = frame.func->local_vars_.size();
+    frame.size = size;
+    frame.saved_top = register_top;
+    size_t need = base + frame.size;
+    reserve_registers(need);
+    std::fill(registers.begin() + base + arg_count, registers.begin() + need,
+              TaggedValue::none());
+    // A callee window can end below the caller's; keep scanning the caller's
+    // registers so nothing it still holds is collected.
+    register_top = std::max(register_top, need);
+    call_stack.push_back(&frame);
+  }
+
+  void pop_frame(Frame &frame) {
+    register_top = frame.saved_top;
+    call_stack.pop_back();
+  }
+
+  // Makes a frame for register function `func`, whose arguments are already
+  // in [args_base, args_base + arg_count), the innermost frame.
+  Frame &push_reg_frame(bytecode::Function *func, size_t args_base,
+                        size_t arg_count, FreeRefs free_refs, Value *callee) {
+    if (arg_count != func->parameter_count_) {
+      throw RuntimeException("Argument count mismatch");
+    }
+    if (free_refs.size() < func->free_vars_.size()) {
+      throw RuntimeException("PushReference: free variable index out of range");
+    }
+    if (reg_depth == reg_frames.size()) {
+      reg_frames.push_back(std::make_unique<Frame>(func, free_refs));
+    }
+    Frame &frame = *reg_frames[reg_depth++];
+    frame.func = func;
+    frame.free_refs = free_refs;
+    frame.pc = 0;
+    frame.callee = callee;
+    frame.jit = false;
+    frame.constants = constant_pools[func->constant_pool].data();
+    push_frame(frame, args_base, arg_count, func->register_count);
+    // References for local_reference_vars: assume register index matches local_vars_ order
+    init_local_refs(frame);
+    return frame;
+  }
+
+  void pop_reg_frame(Frame &frame) {
+    pop_frame(frame);
+    --reg_depth;
+  }
+
+  // Whether calls to `func` run as a frame of the register interpreter
+  // loop, as opposed to natives. Such a function must be translated with
+  // ensure_translated before its frame is pushed.
+  bool runs_in_reg_loop(bytecode::Function *func) const {
+    return native_functions.find(func) == native_functions.end();
+  }
+
+  TaggedValue &local_at(const Frame &frame, size_t idx) {
+    return registers[frame.base + idx];
+  }
+
+  // Maps each local reference variable to the register holding its value;
+  // computed once per function at translation time.
+  static void compute_ref_registers(bytecode::Function *func) {
+    func->ref_registers.assign(func->local_reference_vars_.size(), -1);
+    for (size_t i = 0; i < func->local_reference_vars_.size(); ++i) {
+      auto it_ref = std::find(func->local_vars_.begin(), func->local_vars_.end(),
+                              func->local_reference_vars_[i]);
+      if (it_ref != func->local_vars_.end()) {
+        func->ref_registers[i] =
+            static_cast<int32_t>(std::distance(func->local_vars_.begin(), it_ref));
+      }
+    }
+  }
+
+  // Allocates the Reference cells for the frame's local reference variables,
+  // seeding each from the current value of its local slot.
+  void init_local_refs(Frame &frame) {
+    const std::vector<int32_t> &ref_registers = frame.func->ref_registers;
+    for (size_t i = 0; i < ref_registers.size(); ++i) {
+      if (ref_registers[i] < 0)
+        continue;
+      size_t var_idx = static_cast<size_t>(ref_registers[i]);
+      auto ref = allocate<Reference>(local_at(frame, var_idx));
+      write_barrier_tagged(ref, ref->value);
+      local_at(frame, frame.ref_base + i) = TaggedValue::from_heap(ref);
+    }
   }
 
   TaggedValue pop(Frame &frame) {
@@ -377,11 +1311,11 @@ private:
   }
 
   int32_t get_int(const TaggedValue &tv) {
-    switch (tv.kind) {
+    switch (tv.kind()) {
     case TaggedValue::Kind::Integer:
-      return tv.i;
+      return tv.as_int();
     case TaggedValue::Kind::HeapPtr:
-      return get_int(tv.ptr);
+      return get_int(tv.as_ptr());
     default:
       throw IllegalCastException("Expected integer");
     }
@@ -394,11 +1328,11 @@ private:
   }
 
   bool get_bool(const TaggedValue &tv) {
-    switch (tv.kind) {
+    switch (tv.kind()) {
     case TaggedValue::Kind::Boolean:
-      return tv.b;
+      return tv.as_bool();
     case TaggedValue::Kind::HeapPtr:
-      return get_bool(tv.ptr);
+      return get_bool(tv.as_ptr());
     default:
       throw IllegalCastException("Expected boolean");
     }
@@ -406,20 +1340,22 @@ private:
 
   std::string get_string(Value *v) {
     if (v->tag == Value::Type::String)
-      return static_cast<String *>(v)->value;
+      return std::string(static_cast<String *>(v)->str());
     throw IllegalCastException("Expected string");
   }
 
   std::string tagged_to_string(const TaggedValue &tv) {
-    switch (tv.kind) {
+    switch (tv.kind()) {
     case TaggedValue::Kind::None:
       return "None";
     case TaggedValue::Kind::Boolean:
-      return tv.b ? "true" : "false";
+      return tv.as_bool() ? "true" : "false";
     case TaggedValue::Kind::Integer:
-      return std::to_string(tv.i);
+      return std::to_string(tv.as_int());
+    case TaggedValue::Kind::SmallString:
+      return std::string(tv.small_text());
     case TaggedValue::Kind::HeapPtr:
-      return tv.ptr->toString();
+      return tv.as_ptr()->toString();
     }
     return "None";
   }
@@ -444,154 +1380,307 @@ private:
     return TaggedValue::none();
   }
 
-  Value *box_tagged(const TaggedValue &tv) {
-    switch (tv.kind) {
-    case TaggedValue::Kind::None:
-      return none_singleton;
-    case TaggedValue::Kind::Boolean:
-      return tv.b ? bool_true_singleton : bool_false_singleton;
-    case TaggedValue::Kind::Integer:
-      return allocate<Integer>(tv.i);
-    case TaggedValue::Kind::HeapPtr:
-      return tv.ptr;
-    }
-    return none_singleton;
+  // Records `owner` -> `tv` for the generational write barrier when `tv` is
+  // a heap pointer; immediates need no barrier.
+  void write_barrier_tagged(Value *owner, const TaggedValue &tv) {
+    if (tv.kind() == TaggedValue::Kind::HeapPtr && tv.as_ptr())
+      heap.write_barrier(owner, tv.as_ptr());
   }
 
-  bool tagged_to_int(const TaggedValue &tv, int32_t &out) const {
-    switch (tv.kind) {
+  // The element index an index value stands for: an Integer immediate or
+  // object, or a String spelling an int32 (the same key; see RecordMap).
+  bool element_index(const TaggedValue &tv, int32_t &out) const {
+    switch (tv.kind()) {
     case TaggedValue::Kind::Integer:
-      out = tv.i;
+      out = tv.as_int();
       return true;
     case TaggedValue::Kind::HeapPtr:
-      if (tv.ptr && tv.ptr->tag == Value::Type::Integer) {
-        out = static_cast<Integer *>(tv.ptr)->value;
+      if (tv.as_ptr() && tv.as_ptr()->tag == Value::Type::Integer) {
+        out = static_cast<Integer *>(tv.as_ptr())->value;
         return true;
       }
+      if (tv.as_ptr() && tv.as_ptr()->tag == Value::Type::String)
+        return RecordMap::canonical_int(static_cast<String *>(tv.as_ptr())->str(), out);
       return false;
+    case TaggedValue::Kind::SmallString:
+      return RecordMap::canonical_int(tv.small_text(), out);
     default:
       return false;
     }
   }
 
-  void degrade_record_to_map(Record *rec) {
-    if (!rec || !rec->dense_mode)
+  void record_to_dictionary(Record *rec) {
+    if (!rec->shape)
       return;
-    for (size_t i = 0; i < rec->dense.size(); ++i) {
-      const TaggedValue &tv = rec->dense[i];
-      if (tv.kind == TaggedValue::Kind::None)
-        continue;
-      Value *boxed = box_tagged(tv);
-      std::string key = std::to_string(i);
-      rec->fields[key] = boxed;
-      heap.write_barrier(rec, boxed);
+    for (size_t i = 0; i < rec->slots.size(); ++i) {
+      TaggedValue key = name_key(rec->shape->fields[i]);
+      write_barrier_tagged(rec, key);
+      rec->fields.insert(key) = rec->slots[i];
     }
-    rec->dense.clear();
-    rec->dense_mode = false;
+    rec->slots.clear();
+    rec->shape = nullptr;
   }
 
-  bool record_try_dense_store(Record *rec,
-                              const TaggedValue &idx_tv,
-                              const TaggedValue &val_tv) {
-    if (!rec || !rec->dense_mode)
-      return false;
-    int32_t idx = -1;
-    if (!tagged_to_int(idx_tv, idx) || idx < 0) {
-      // Non-integer key degrades to generic map mode.
-      if (!(idx_tv.kind == TaggedValue::Kind::Integer ||
-            (idx_tv.kind == TaggedValue::Kind::HeapPtr &&
-             idx_tv.ptr && idx_tv.ptr->tag == Value::Type::Integer))) {
-        degrade_record_to_map(rec);
-      }
-      return false;
-    }
-
-    size_t uidx = static_cast<size_t>(idx);
-    if (uidx >= rec->dense.size()) {
-      rec->dense.resize(uidx + 1, TaggedValue::none());
-    }
-    rec->dense[uidx] = val_tv;
-    if (val_tv.kind == TaggedValue::Kind::HeapPtr && val_tv.ptr) {
-      heap.write_barrier(rec, val_tv.ptr);
-    }
-    return true;
+  // The dictionary key for a field name. Names spelling an integer are the
+  // same key as that integer and short names are SmallStrings; longer names
+  // are keyed on their interned String. Field names from the bytecode are
+  // interned at translation, so this allocates only for names first seen
+  // at runtime.
+  TaggedValue name_key(const std::string &name) {
+    if (std::optional<TaggedValue> key = RecordMap::key_for_text(name))
+      return *key;
+    return TaggedValue::from_heap(intern_string(name));
   }
 
-  bool record_try_dense_load(Record *rec,
-                             const TaggedValue &idx_tv,
-                             TaggedValue &out) {
-    if (!rec || !rec->dense_mode)
-      return false;
-    int32_t idx = -1;
-    if (!tagged_to_int(idx_tv, idx) || idx < 0) {
-      // Only degrade on non-integer keys.
-      if (!(idx_tv.kind == TaggedValue::Kind::Integer ||
-            (idx_tv.kind == TaggedValue::Kind::HeapPtr &&
-             idx_tv.ptr && idx_tv.ptr->tag == Value::Type::Integer))) {
-        degrade_record_to_map(rec);
+  // Stores a string-keyed entry, extending the record's shape when the key
+  // is new. Falls back to dictionary mode once the shape gets too wide.
+  void record_store_named(Record *rec, const std::string &key,
+                          const TaggedValue &val) {
+    RecordGrowthScope growth(*this, rec);
+    write_barrier_tagged(rec, val);
+    if (rec->shape) {
+      int slot = rec->shape->slot_index(key);
+      if (slot >= 0) {
+        rec->slots[slot] = val;
+        return;
+      }
+      if (!rec->fields.find_text(key)) {
+        if (Shape *next = shapes.transition(rec->shape, key)) {
+          rec->shape = next;
+          rec->slots.push_back(val);
+          return;
+        }
+        record_to_dictionary(rec);
       }
-      return false;
     }
-    size_t uidx = static_cast<size_t>(idx);
-    if (uidx < rec->dense.size()) {
-      out = rec->dense[uidx];
-    } else {
-      out = TaggedValue::none();
+    if (TaggedValue *slot = rec->fields.find_text(key)) {
+      *slot = val;
+      return;
     }
-    return true;
+    TaggedValue k = name_key(key);
+    write_barrier_tagged(rec, k);
+    rec->fields.insert(k) = val;
   }
 
-  TaggedValue record_map_load(Record *rec, const TaggedValue &idx_tv) {
-    if (!rec)
-      throw IllegalCastException("Expected record");
-    std::string key;
-    if (idx_tv.kind == TaggedValue::Kind::Integer) {
-      key = std::to_string(idx_tv.i);
-    } else if (idx_tv.kind == TaggedValue::Kind::HeapPtr &&
-               idx_tv.ptr &&
-               idx_tv.ptr->tag == Value::Type::Integer) {
-      key = std::to_string(static_cast<Integer *>(idx_tv.ptr)->value);
-    } else if (idx_tv.kind == TaggedValue::Kind::HeapPtr &&
-               idx_tv.ptr &&
-               idx_tv.ptr->tag == Value::Type::String) {
-      key = static_cast<String *>(idx_tv.ptr)->value;
-    } else {
-      throw IllegalCastException("Invalid index type");
+  static int field_cache_lookup(const bytecode::FieldCache &cache,
+                                uint32_t shape_id) {
+    for (uint8_t i = 0; i < cache.size; ++i) {
+      if (cache.entries[i].shape_id == shape_id)
+        return i;
     }
+    return -1;
+  }
 
-    auto it = rec->fields.find(key);
-    if (it != rec->fields.end())
-      return tagged_from_value(it->second);
-    return TaggedValue::none();
+  static void field_cache_insert(bytecode::FieldCache &cache,
+                                 uint32_t shape_id,
+                                 uint32_t slot,
+                                 uint32_t next_shape_id) {
+    // Once a site has seen kMaxEntries shapes it is megamorphic and stays on
+    // the slow path.
+    if (cache.size >= bytecode::FieldCache::kMaxEntries)
+      return;
+    cache.entries[cache.size++] = {shape_id, slot, next_shape_id};
   }
 
-  void record_map_store(Record *rec,
-                        const TaggedValue &idx_tv,
-                        const TaggedValue &val_tv) {
-    if (!rec)
-      throw IllegalCastException("Expected record");
-    std::string key;
-    if (idx_tv.kind == TaggedValue::Kind::Integer) {
-      key = std::to_string(idx_tv.i);
-    } else if (idx_tv.kind == TaggedValue::Kind::HeapPtr &&
-               idx_tv.ptr &&
-               idx_tv.ptr->tag == Value::Type::Integer) {
-      key = std::to_string(static_cast<Integer *>(idx_tv.ptr)->value);
-    } else if (idx_tv.kind == TaggedValue::Kind::HeapPtr &&
-               idx_tv.ptr &&
-               idx_tv.ptr->tag == Value::Type::String) {
-      key = static_cast<String *>(idx_tv.ptr)->value;
-    } else {
-      throw IllegalCastException("Invalid index type");
+  // FieldLoad slow path: resolves the field by name and caches the slot.
+  TaggedValue record_load_field_miss(Record *rec,
+                                     const std::string &field,
+                                     bytecode::FieldCache &cache) {
+    if (rec->shape) {
+      int slot = rec->shape->slot_index(field);
+      if (slot >= 0) {
+        field_cache_insert(cache, rec->shape->id, slot, rec->shape->id);
+        return rec->slots[slot];
+      }
     }
+    const TaggedValue *v = rec->find_named(field);
+    return v ? *v : TaggedValue::none();
+  }
 
-    Value *boxed = box_tagged(val_tv);
-    rec->fields[key] = boxed;
-    heap.write_barrier(rec, boxed);
+  // FieldStore slow path: stores by name and caches the resulting slot along
+  // with the shape transition (if any) the store caused.
+  void record_store_field_miss(Record *rec,
+                               const std::string &field,
+                               const TaggedValue &val,
+                               bytecode::FieldCache &cache) {
+    Shape *from = rec->shape;
+    record_store_named(rec, field, val);
+    if (from && rec->shape) {
+      int slot = rec->shape->slot_index(field);
+      if (slot >= 0)
+        field_cache_insert(cache, from->id, slot, rec->shape->id);
+    }
+  }
+
+  // Stores an element if `idx_tv` is an element index (see Record);
+  // returns false for a named key.
+  bool record_try_element_store(Record *rec,
+                                const TaggedValue &idx_tv,
+                                const TaggedValue &val_tv) {
+    int32_t idx;
+    if (!element_index(idx_tv, idx))
+      return false;
+    if (idx < 0 || static_cast<size_t>(idx) >= rec->dense.size()) {
+      record_store_outside_dense(rec, idx, val_tv);
+      return true;
+    }
+    rec->dense[idx] = val_tv;
+    dense_write_barrier(rec, static_cast<size_t>(idx), val_tv);
+    return true;
+  }
+
+  void dense_write_barrier(Record *rec, size_t idx, const TaggedValue &val_tv) {
+    if (val_tv.kind() == TaggedValue::Kind::HeapPtr && val_tv.as_ptr()) {
+      // Large arrays are carded by index, so a minor GC rescans only the
+      // ranges written since the last one.
+      if (rec->dense.size() > CollectedHeap::kCardSlots)
+        heap.write_barrier(rec, val_tv.as_ptr(), idx);
+      else
+        heap.write_barrier(rec, val_tv.as_ptr());
+    }
+  }
+
+  // An element store past the dense prefix. An index less than kChunkSize
+  // beyond its end extends the prefix, which takes over any sparse chunks
+  // it then reaches; any other index goes to a sparse chunk. Either way a
+  // record keeps at most about kChunkSize slots per element, so a[1000000]
+  // costs one chunk rather than a million slots.
+  void record_store_outside_dense(Record *rec, int32_t idx,
+                                  const TaggedValue &val_tv) {
+    size_t size = rec->dense.size();
+    if (idx < 0 || static_cast<size_t>(idx) >= size + SparseElements::kChunkSize) {
+      RecordGrowthScope growth(*this, rec);
+      write_barrier_tagged(rec, val_tv);
+      rec->sparse.insert(idx) = val_tv;
+      return;
+    }
+    size_t before = rec->dense.capacity();
+    rec->dense.resize(static_cast<size_t>(idx) + 1, TaggedValue::hole());
+    note_heap_growth((rec->dense.capacity() - before) * sizeof(TaggedValue));
+    if (!rec->sparse.empty())
+      absorb_sparse_elements(rec, size);
+    rec->dense[idx] = val_tv;
+    dense_write_barrier(rec, static_cast<size_t>(idx), val_tv);
+  }
+
+  // The dense prefix has grown from `from` elements: moves the sparse
+  // chunks it now overlaps, or ends next to, into it, extending it over
+  // each one.
+  void absorb_sparse_elements(Record *rec, size_t from) {
+    RecordGrowthScope growth(*this, rec);
+    constexpr int32_t kChunk = SparseElements::kChunkSize;
+    for (size_t n = from / kChunk;
+         n <= rec->dense.size() / kChunk && !rec->sparse.empty(); ++n) {
+      int32_t number = static_cast<int32_t>(n);
+      const SparseElements::Chunk *chunk = rec->sparse.find_chunk(number);
+      if (!chunk)
+        continue;
+      size_t first = n * kChunk;
+      if (rec->dense.size() < first + kChunk)
+        rec->dense.resize(first + kChunk, TaggedValue::hole());
+      for (int32_t k = 0; k < kChunk; ++k) {
+        const TaggedValue &tv = chunk->values[k];
+        if (tv.is_hole())
+          continue;
+        rec->dense[first + k] = tv;
+        dense_write_barrier(rec, first + k, tv);
+      }
+      rec->sparse.erase_chunk(number);
+    }
+  }
+
+  // Loads an element if `idx_tv` is an element index; returns false for a
+  // named key.
+  bool record_try_element_load(Record *rec,
+                               const TaggedValue &idx_tv,
+                               TaggedValue &out) {
+    int32_t idx;
+    if (!element_index(idx_tv, idx))
+      return false;
+    if (idx >= 0 && static_cast<size_t>(idx) < rec->dense.size()) {
+      out = Record::element(rec->dense[idx]);
+    } else {
+      const TaggedValue *v = rec->sparse.find(idx);
+      out = v ? *v : TaggedValue::none();
+    }
+    return true;
+  }
+
+  // The dictionary key for an index value: a string's own text, or an
+  // integer formatted into `scratch`.
+  std::string_view record_key(const TaggedValue &idx_tv, std::string &scratch) {
+    if (idx_tv.kind() == TaggedValue::Kind::Integer) {
+      scratch = std::to_string(idx_tv.as_int());
+      return scratch;
+    }
+    if (idx_tv.kind() == TaggedValue::Kind::SmallString)
+      return idx_tv.small_text();
+    if (idx_tv.kind() == TaggedValue::Kind::HeapPtr && idx_tv.as_ptr()) {
+      if (idx_tv.as_ptr()->tag == Value::Type::Integer) {
+        scratch = std::to_string(static_cast<Integer *>(idx_tv.as_ptr())->value);
+        return scratch;
+      }
+      if (idx_tv.as_ptr()->tag == Value::Type::String)
+        return static_cast<String *>(idx_tv.as_ptr())->str();
+    }
+    throw IllegalCastException("Invalid index type");
+  }
+
+  // The normalized dictionary key (see RecordMap) for an index value.
+  TaggedValue record_map_key(const TaggedValue &idx_tv) {
+    if (idx_tv.kind() == TaggedValue::Kind::Integer)
+      return idx_tv;
+    if (idx_tv.kind() == TaggedValue::Kind::SmallString)
+      return *RecordMap::key_for_text(idx_tv.small_text());
+    if (idx_tv.kind() == TaggedValue::Kind::HeapPtr && idx_tv.as_ptr()) {
+      if (idx_tv.as_ptr()->tag == Value::Type::Integer)
+        return TaggedValue::from_int(static_cast<Integer *>(idx_tv.as_ptr())->value);
+      if (idx_tv.as_ptr()->tag == Value::Type::String)
+        return RecordMap::key_for_string(static_cast<String *>(idx_tv.as_ptr()));
+    }
+    throw IllegalCastException("Invalid index type");
+  }
+
+  // Records that still have shaped fields are looked up by text, which
+  // also covers their slots; dictionary records hash the key directly.
+  TaggedValue record_map_load(Record *rec, const TaggedValue &idx_tv) {
+    if (!rec)
+      throw IllegalCastException("Expected record");
+    if (rec->shape && !rec->shape->fields.empty()) {
+      std::string scratch;
+      const TaggedValue *v = rec->find_named(record_key(idx_tv, scratch));
+      return v ? *v : TaggedValue::none();
+    }
+    const TaggedValue *v = rec->fields.find(record_map_key(idx_tv));
+    return v ? *v : TaggedValue::none();
+  }
+
+  void record_map_store(Record *rec,
+                        const TaggedValue &idx_tv,
+                        const TaggedValue &val_tv) {
+    if (!rec)
+      throw IllegalCastException("Expected record");
+    // A record indexed with arbitrary keys is being used as a map; stop
+    // growing its shape and keep every named key in the dictionary.
+    TaggedValue key = record_map_key(idx_tv);
+    RecordGrowthScope growth(*this, rec);
+    record_to_dictionary(rec);
+    write_barrier_tagged(rec, key);
+    write_barrier_tagged(rec, val_tv);
+    rec->fields.insert(key) = val_tv;
+  }
+
+  // Interns a field name ahead of time so that keying a dictionary record
+  // on it (name_key) never allocates. Bad indices are left to the verifier.
+  void intern_field_name(bytecode::Function *func, int32_t idx) {
+    if (idx >= 0 && static_cast<size_t>(idx) < func->names_.size() &&
+        !RecordMap::key_for_text(func->names_[idx]))
+      intern_string(func->names_[idx]);
   }
 
   void translate_stack_to_reg(bytecode::Function *func) {
     using bytecode::Operation;
+    PerfCounters::Scope phase(perf_counters, PerfCounters::Phase::Translate);
     struct RegAlloc {
       uint16_t next;
       uint16_t max_used;
@@ -602,7 +1691,11 @@ private:
       }
     };
 
-    uint16_t initial = static_cast<uint16_t>(func->local_vars_.size());
+    // Registers: named locals, then one Reference slot per local reference
+    // variable (see Frame), then temporaries. Every temporary is fresh here;
+    // reuse_temporaries packs them once the code is final.
+    uint16_t initial = static_cast<uint16_t>(func->local_vars_.size() +
+                                             func->local_reference_vars_.size());
     RegAlloc alloc{initial, static_cast<uint16_t>(initial ? initial - 1 : 0)};
     std::vector<uint16_t> vstack;
     std::vector<size_t> pc_to_out(func->instructions.size() + 1, 0);
@@ -612,6 +1705,22 @@ private:
     };
     std::vector<Fixup> fixups;
     std::vector<bytecode::RegisterInstruction> out;
+    size_t field_sites = 0;
+    auto next_field_site = [&]() -> uint16_t {
+      if (field_sites > UINT16_MAX) {
+        throw RuntimeException("Translate: too many field access sites");
+      }
+      return static_cast<uint16_t>(field_sites++);
+    };
+
+    // StoreLocal into a local reference variable also updates its Reference
+    // cell; the instruction's immediate carries the ref slot + 1 (0 = none).
+    compute_ref_registers(func);
+    std::vector<int32_t> ref_slot_of_local(func->local_vars_.size(), -1);
+    for (size_t i = 0; i < func->ref_registers.size(); ++i) {
+      if (func->ref_registers[i] >= 0)
+        ref_slot_of_local[func->ref_registers[i]] = static_cast<int32_t>(i);
+    }
 
     auto ensure_reg_count = [&](uint16_t idx) {
       if (idx > alloc.max_used) alloc.max_used = idx;
@@ -621,13 +1730,17 @@ private:
         throw RuntimeException("Translate: stack underflow");
       }
     };
-    ensure_reg_count(static_cast<uint16_t>(func->local_vars_.size() ? func->local_vars_.size() - 1 : 0));
+    ensure_reg_count(static_cast<uint16_t>(initial ? initial - 1 : 0));
 
     for (size_t pc = 0; pc < func->instructions.size(); ++pc) {
       pc_to_out[pc] = out.size();
       const auto &in = func->instructions[pc];
       switch (in.operation) {
       case Operation::LoadConst: {
+        int32_t cidx = in.operand0.value();
+        if (cidx < 0 || static_cast<size_t>(cidx) >= func->constants_.size()) {
+          throw RuntimeException("LoadConst: constant index out of range");
+        }
         uint16_t dst = alloc.fresh();
         out.push_back({Operation::LoadConst, dst, 0, 0, in.operand0.value()});
         vstack.push_back(dst);
@@ -656,7 +1769,8 @@ private:
           throw RuntimeException("Translate: local variable index out of range");
         }
         ensure_reg_count(dst);
-        out.push_back({Operation::StoreLocal, dst, val, 0, 0});
+        out.push_back({Operation::StoreLocal, dst, val, 0,
+                       ref_slot_of_local[dst] + 1});
         break;
       }
       case Operation::Add:
@@ -667,7 +1781,13 @@ private:
       case Operation::Geq:
       case Operation::Eq:
       case Operation::And:
-      case Operation::Or: {
+      case Operation::Or:
+      case Operation::AddI:
+      case Operation::SubI:
+      case Operation::MulI:
+      case Operation::GtI:
+      case Operation::GeqI:
+      case Operation::EqI: {
         require_stack(2);
         uint16_t right = vstack.back(); vstack.pop_back();
         uint16_t left = vstack.back(); vstack.pop_back();
@@ -696,6 +1816,7 @@ private:
         break;
       }
       case Operation::If: {
+        require_stack(1);
         uint16_t cond = vstack.back(); vstack.pop_back();
         int64_t target_pc = static_cast<int64_t>(pc) + in.operand0.value();
         if (target_pc < 0 ||
@@ -743,6 +1864,8 @@ private:
         // ensure contiguous
         if (arg_count > 0) {
           ensure_reg_count(static_cast<uint16_t>(arg_start + arg_count - 1));
+          // Keep the range to itself; see reuse_temporaries.
+          alloc.next = static_cast<uint16_t>(arg_start + arg_count);
           for (int i = 0; i < arg_count; ++i) {
             out.push_back({Operation::StoreLocal,
                            static_cast<uint16_t>(arg_start + i),
@@ -763,15 +1886,25 @@ private:
         break;
       }
       case Operation::LoadGlobal: {
+        size_t name_idx = static_cast<size_t>(in.operand0.value());
+        if (name_idx >= func->names_.size()) {
+          throw RuntimeException("LoadGlobal: name index out of range");
+        }
+        int32_t slot = static_cast<int32_t>(intern_global(func->names_[name_idx]));
         uint16_t dst = alloc.fresh();
-        out.push_back({Operation::LoadGlobal, dst, 0, 0, in.operand0.value()});
+        out.push_back({Operation::LoadGlobal, dst, 0, 0, slot});
         vstack.push_back(dst);
         break;
       }
       case Operation::StoreGlobal: {
         require_stack(1);
+        size_t name_idx = static_cast<size_t>(in.operand0.value());
+        if (name_idx >= func->names_.size()) {
+          throw RuntimeException("StoreGlobal: name index out of range");
+        }
+        int32_t slot = static_cast<int32_t>(intern_global(func->names_[name_idx]));
         uint16_t val = vstack.back(); vstack.pop_back();
-        out.push_back({Operation::StoreGlobal, 0, val, 0, in.operand0.value()});
+        out.push_back({Operation::StoreGlobal, 0, val, 0, slot});
         break;
       }
       case Operation::PushReference: {
@@ -797,23 +1930,52 @@ private:
       }
       case Operation::AllocRecord: {
         uint16_t dst = alloc.fresh();
-        out.push_back({Operation::AllocRecord, dst, 0, 0, 0});
+        out.push_back({Operation::AllocRecord, dst, 0, 0, in.operand0.value_or(0)});
         vstack.push_back(dst);
         break;
       }
       case Operation::FieldLoad: {
         require_stack(1);
+        intern_field_name(func, in.operand0.value());
         uint16_t rec = vstack.back(); vstack.pop_back();
         uint16_t dst = alloc.fresh();
-        out.push_back({Operation::FieldLoad, dst, rec, 0, in.operand0.value()});
+        out.push_back({Operation::FieldLoad, dst, rec, next_field_site(),
+                       in.operand0.value()});
         vstack.push_back(dst);
         break;
       }
       case Operation::FieldStore: {
         require_stack(2);
+        intern_field_name(func, in.operand0.value());
         uint16_t val = vstack.back(); vstack.pop_back();
         uint16_t rec = vstack.back(); vstack.pop_back();
-        out.push_back({Operation::FieldStore, 0, val, rec, in.operand0.value()});
+        out.push_back({Operation::FieldStore, next_field_site(), val, rec,
+                       in.operand0.value()});
+        break;
+      }
+      case Operation::FieldLoadSlot:
+      case Operation::FieldStoreSlot: {
+        bool load = in.operation == Operation::FieldLoadSlot;
+        require_stack(load ? 1 : 2);
+        intern_field_name(func, in.operand0.value());
+        int32_t slot = in.operand1.value_or(-1);
+        if (slot < 0 || slot > UINT16_MAX)
+          throw RuntimeException("Translate: field slot out of range");
+        uint16_t val = 0;
+        if (!load) {
+          val = vstack.back();
+          vstack.pop_back();
+        }
+        uint16_t rec = vstack.back(); vstack.pop_back();
+        if (load) {
+          uint16_t dst = alloc.fresh();
+          out.push_back({Operation::FieldLoadSlot, dst, rec,
+                         static_cast<uint16_t>(slot), in.operand0.value()});
+          vstack.push_back(dst);
+        } else {
+          out.push_back({Operation::FieldStoreSlot, static_cast<uint16_t>(slot),
+                         val, rec, in.operand0.value()});
+        }
         break;
       }
       case Operation::IndexLoad: {
@@ -850,6 +2012,7 @@ private:
         uint16_t base = alloc.fresh();
         if (free_count > 0) {
           ensure_reg_count(static_cast<uint16_t>(base + free_count - 1));
+          alloc.next = static_cast<uint16_t>(base + free_count);
           for (int i = 0; i < free_count; ++i) {
             out.push_back({Operation::StoreLocal,
                            static_cast<uint16_t>(base + i),
@@ -877,653 +2040,2125 @@ private:
       int32_t rel = static_cast<int32_t>(pc_to_out[fx.target_pc] - fx.out_idx);
       out[fx.out_idx].imm = rel;
     }
+    fuse_superinstructions(out, func->constants_, initial);
+    out.push_back({Operation::End, 0, 0, 0, 0});
+    uint16_t register_count = static_cast<uint16_t>(alloc.max_used + 1);
+    reuse_temporaries(out, initial, register_count);
+
+    std::vector<TaggedValue> pool;
+    pool.reserve(func->constants_.size());
+    for (auto *c : func->constants_) {
+      pool.push_back(constant_to_tagged(c));
+    }
+    func->constant_pool = static_cast<int32_t>(constant_pools.size());
+    constant_pools.push_back(std::move(pool));
 
-    func->register_count = alloc.max_used + 1;
+    func->register_count = register_count;
     func->reg_instructions = std::move(out);
+    func->field_caches.assign(field_sites, bytecode::FieldCache{});
   }
 
-  void translate_function_tree(bytecode::Function *func) {
-    if (!func) return;
-    if (func->reg_instructions.empty()) {
+  // Translates `func` to verified register code the first time it is
+  // called, so functions a program never calls are never translated.
+  // Translation interns the function's constant strings, which are rooted
+  // as they are made, but a caller may be holding the call's arguments
+  // where the collector does not look, so collection waits until after.
+  void ensure_translated(bytecode::Function *func) {
+    if (func->constant_pool >= 0) return;
+    const bool was_deferred = gc_deferred;
+    gc_deferred = true;
+    try {
       translate_stack_to_reg(func);
+    } catch (...) {
+      gc_deferred = was_deferred;
+      throw;
+    }
+    gc_deferred = was_deferred;
+    if (const char *error = verify_reg_code(*func, globals.size())) {
+      throw RuntimeException(error);
     }
+    compute_call_liveness(*func);
+    thread_code(func);
+  }
+
+  // Translates every function up front, for the inliner, which needs the
+  // code of its callees.
+  void translate_function_tree(bytecode::Function *func) {
+    if (!func) return;
+    ensure_translated(func);
     for (auto *child : func->functions_) {
       translate_function_tree(child);
     }
   }
 
-  TaggedValue execute_function_reg(bytecode::Function *func,
-                                   const std::vector<TaggedValue> &args,
-                                   const std::vector<Value *> &free_refs) {
-    auto it = native_functions.find(func);
-    if (it != native_functions.end()) {
-      return tagged_from_value(call_native(it->second, args));
-    }
+  // Runs the inliner over the translated program, then brings each
+  // function it changed back to what translation leaves.
+  void inline_function_tree(bytecode::Function *main_func) {
+    auto changed = inline_calls(main_func, [&](bytecode::Function *f) {
+      return native_functions.count(f) != 0;
+    });
+    for (bytecode::Function *func : changed)
+      finish_inlining(func);
+  }
 
-    if (args.size() != func->parameter_count_) {
-      throw RuntimeException("Argument count mismatch");
+  // Gives a function the inliner changed a constant pool covering its
+  // constants, interned field names, verified code and call liveness.
+  void finish_inlining(bytecode::Function *func) {
+    auto &pool = constant_pools[func->constant_pool];
+    for (size_t k = pool.size(); k < func->constants_.size(); ++k)
+      pool.push_back(constant_to_tagged(func->constants_[k]));
+    for (size_t k = 0; k < func->names_.size(); ++k)
+      intern_field_name(func, static_cast<int32_t>(k));
+    if (const char *error = verify_reg_code(*func, globals.size())) {
+      throw RuntimeException(error);
     }
+    compute_call_liveness(*func);
+    thread_code(func);
+  }
 
-    Frame frame(func->register_count, func, &free_refs);
-    call_stack.push_back(&frame);
-
-    for (size_t i = 0; i < args.size(); ++i) {
-      frame.locals[i] = args[i];
-    }
+#ifdef MITSCRIPT_THREADED_DISPATCH
+  // Offsets of run_reg<false>'s handlers from its first one, by operation;
+  // run_reg fills them in when the VM is made.
+  static inline int32_t reg_handler_offsets[static_cast<size_t>(
+                                                bytecode::Operation::End) +
+                                            1];
+
+  // Stores each instruction's handler in it, so the loop dispatches with
+  // one load and an indirect jump. Code is threaded whenever translation,
+  // inlining or unquickening rewrites it; quicken updates one instruction.
+  static void thread_code(bytecode::Function *func) {
+    for (bytecode::RegisterInstruction &in : func->reg_instructions)
+      in.handler = reg_handler_offsets[static_cast<size_t>(in.op)];
+  }
+#else
+  static void thread_code(bytecode::Function *) {}
+#endif
+
+  // The function a global holds, if it holds one the register loop runs.
+  bytecode::Function *global_function(int32_t slot) const {
+    const TaggedValue &g = globals[static_cast<size_t>(slot)];
+    if (g.kind() != TaggedValue::Kind::HeapPtr || is_undefined_global(g))
+      return nullptr;
+    bytecode::Function *f = nullptr;
+    if (g.as_ptr()->tag == Value::Type::Closure)
+      f = static_cast<Closure *>(g.as_ptr())->function;
+    else if (g.as_ptr()->tag == Value::Type::Function)
+      f = static_cast<Function *>(g.as_ptr())->func;
+    return f && runs_in_reg_loop(f) ? f : nullptr;
+  }
 
-    // References for local_reference_vars: assume register index matches local_vars_ order
-    for (const auto &var_name : func->local_reference_vars_) {
-      auto it_ref =
-          std::find(func->local_vars_.begin(), func->local_vars_.end(), var_name);
-      if (it_ref != func->local_vars_.end()) {
-        size_t var_idx = std::distance(func->local_vars_.begin(), it_ref);
-        TaggedValue initial_val = frame.locals[var_idx];
-        Value *boxed_initial = box_tagged(initial_val);
-        auto ref = allocate<Reference>(boxed_initial);
-        frame.local_refs[var_name] = ref;
-        frame.ref_locals.insert(var_idx);
-        frame.locals[var_idx] = TaggedValue::from_heap(ref->cell);
-      }
+  // Speculative inlining of calls through globals, which the inliner run
+  // before the program starts cannot predict when a global is stored
+  // different functions or closures it cannot trace. run_reg calls this
+  // for the innermost frame, at pc, twice as its function gets hot: on
+  // the function's kSpeculateCallThreshold / 2'th call or the
+  // kSpeculateBackEdgeThreshold / 2'th backward branch in it (`sample`)
+  // to note the function each global it loads holds, and again at the
+  // full threshold to inline the calls through the globals that still
+  // hold the same one (see inline_global_calls). Returns the pc at which
+  // the frame carries on in the function's code, which may have changed.
+  //
+  // The function is left alone if it has been compiled or has other
+  // frames, which hold pcs into its code; its one frame is at its entry
+  // or a loop header, where no call is in progress.
+  size_t speculate_calls(Frame &frame, size_t pc, bool sample) {
+    bytecode::Function *func = frame.func;
+    std::vector<std::pair<int32_t, bytecode::Function *>> held;
+    for (const bytecode::RegisterInstruction &in : func->reg_instructions)
+      if (in.op == bytecode::Operation::LoadGlobal)
+        if (bytecode::Function *f = global_function(in.imm))
+          if (std::find(held.begin(), held.end(), std::pair(in.imm, f)) ==
+              held.end())
+            held.push_back({in.imm, f});
+    if (sample) {
+      if (!held.empty())
+        global_samples[func] = std::move(held);
+      return pc;
     }
-
-    const auto &instructions = func->reg_instructions;
-    if (instructions.empty()) {
-      call_stack.pop_back();
-      bool is_main = call_stack.empty();
-      if (!is_main && !func->instructions.empty()) {
-        throw RuntimeException("Function must end with a return statement");
+    auto seen = global_samples.find(func);
+    if (seen == global_samples.end())
+      return pc;
+    std::vector<std::pair<int32_t, bytecode::Function *>> stable;
+    for (const auto &entry : held)
+      if (std::find(seen->second.begin(), seen->second.end(), entry) !=
+          seen->second.end())
+        stable.push_back(entry);
+    global_samples.erase(seen);
+    if (stable.empty() || func->jit_code)
+      return pc;
+    for (size_t d = 0; d + 1 < reg_depth; ++d)
+      if (reg_frames[d]->func == func)
+        return pc;
+
+    // The passes know only the operations translation makes; quickening
+    // will redo its part.
+    unquicken_code(func);
+    for (const auto &entry : stable)
+      unquicken_code(entry.second);
+
+    // The constants the bodies bring are rooted as they are made;
+    // collection waits until the code and its call liveness agree again.
+    std::vector<size_t> pc_map;
+    const bool was_deferred = gc_deferred;
+    gc_deferred = true;
+    try {
+      if (!inline_global_calls(func, stable, pc_map,
+                               [&](bytecode::Function *f) {
+                                 return native_functions.count(f) != 0;
+                               })) {
+        gc_deferred = was_deferred;
+        return pc;
       }
-      return TaggedValue::none();
+      finish_inlining(func);
+    } catch (...) {
+      gc_deferred = was_deferred;
+      throw;
     }
+    gc_deferred = was_deferred;
+    // Give the frame the code's new constants and the registers the
+    // inlined bodies use.
+    frame.constants = constant_pools[func->constant_pool].data();
+    const size_t need = frame.base + func->register_count;
+    reserve_registers(need);
+    std::fill(registers.begin() + frame.base + frame.size,
+              registers.begin() + need, TaggedValue::none());
+    frame.size = func->register_count;
+    register_top = std::max(register_top, need);
+    return pc_map[pc];
+  }
 
-    const bytecode::RegisterInstruction *ip = instructions.data();
-    const bytecode::RegisterInstruction *end = ip + instructions.size();
-    std::vector<TaggedValue> temp_args_local;
-    std::vector<Value *> temp_refs_local;
-
-    static void *dispatch_table[] = {
-        &&op_LoadConstR,    // LoadConst
-        &&op_LoadFuncR,     // LoadFunc
-        &&op_LoadLocalR,    // LoadLocal (used as move)
-        &&op_StoreLocalR,   // StoreLocal (used as move)
-        &&op_LoadGlobalR,   // LoadGlobal
-        &&op_StoreGlobalR,  // StoreGlobal
-        &&op_PushReferenceR,// PushReference
-        &&op_LoadReferenceR,// LoadReference
-        &&op_StoreReferenceR,// StoreReference
-        &&op_AllocRecordR,  // AllocRecord
-        &&op_FieldLoadR,    // FieldLoad
-        &&op_FieldStoreR,   // FieldStore
-        &&op_IndexLoadR,    // IndexLoad
-        &&op_IndexStoreR,   // IndexStore
-        &&op_AllocClosureR, // AllocClosure
-        &&op_CallR,         // Call
-        &&op_ReturnR,       // Return
-        &&op_AddR,          // Add
-        &&op_SubR,          // Sub
-        &&op_MulR,          // Mul
-        &&op_DivR,          // Div
-        &&op_NegR,          // Neg
-        &&op_GtR,           // Gt
-        &&op_GeqR,          // Geq
-        &&op_EqR,           // Eq
-        &&op_AndR,          // And
-        &&op_OrR,           // Or
-        &&op_NotR,          // Not
-        &&op_GotoR,         // Goto
-        &&op_IfR,           // If
-        &&op_DupR,          // Dup (unused)
-        &&op_SwapR,         // Swap (unused)
-        &&op_PopR           // Pop (unused)
-    };
+  // Register-form instruction semantics, shared by the interpreter loop in
+  // execute_function_reg and by JIT-compiled code. None of these touch
+  // control flow; exec_call may grow the register file, so callers must
+  // re-derive `regs` afterwards.
+  void exec_load_const(Frame &frame, TaggedValue *regs,
+                       const bytecode::RegisterInstruction *ip) {
+    // The index was range-checked when the function was translated.
+    regs[ip->dst] = frame.constants[ip->imm];
+  }
 
-#define DISPATCH_REG() goto *dispatch_table[static_cast<int>(ip->op)]
+  void exec_load_func(Frame &frame, TaggedValue *regs,
+                      const bytecode::RegisterInstruction *ip) {
+    uint16_t dst = ip->dst;
+    int32_t findex = ip->imm;
+    VM_CHECK_VERIFIED(findex >= 0 && static_cast<size_t>(findex) <
+                                         frame.func->functions_.size(),
+                      "LoadFunc: function index out of range");
+    auto f = frame.func->functions_[findex];
+    note_alloc_site(frame, ip);
+    regs[dst] = TaggedValue::from_heap(allocate<Function>(f));
+  }
 
-    TaggedValue ret_val = TaggedValue::none();
-    bool returned = false;
-    DISPATCH_REG();
+  void exec_move([[maybe_unused]] Frame &frame, TaggedValue *regs,
+                 const bytecode::RegisterInstruction *ip) {
+    VM_CHECK_VERIFIED(ip->src1 < frame.size,
+                      "LoadLocal: local variable index out of range");
+    TaggedValue v = regs[ip->src1];
+    regs[ip->dst] = v;
+  }
 
-  op_LoadConstR: {
+  void exec_store_local(Frame &frame, TaggedValue *regs,
+                        const bytecode::RegisterInstruction *ip) {
+    VM_CHECK_VERIFIED(ip->src1 < frame.size,
+                      "StoreLocal: local variable index out of range");
+    TaggedValue val = regs[ip->src1];
     uint16_t dst = ip->dst;
-    int32_t cidx = ip->imm;
-    if (cidx < 0 || static_cast<size_t>(cidx) >= func->constants_.size()) {
-      throw RuntimeException("LoadConst: constant index out of range");
+    if (ip->imm) {
+      note_alloc_site(frame, ip);
+      auto ref = static_cast<Reference *>(regs[frame.ref_base + ip->imm - 1].as_ptr());
+      ref->value = val;
+      write_barrier_tagged(ref, val);
     }
-    frame.locals[dst] = constant_to_tagged(func->constants_[cidx]);
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
-    DISPATCH_REG();
+    regs[dst] = val;
   }
 
-  op_LoadFuncR: {
-    uint16_t dst = ip->dst;
-    int32_t findex = ip->imm;
-    if (findex < 0 || static_cast<size_t>(findex) >= func->functions_.size()) {
-      throw RuntimeException("LoadFunc: function index out of range");
+  void exec_load_global(Frame &, TaggedValue *regs,
+                        const bytecode::RegisterInstruction *ip) {
+    const TaggedValue &g = globals[static_cast<size_t>(ip->imm)];
+    if (is_undefined_global(g)) {
+      throw UninitializedVariableException("Undefined global: " +
+                                           global_names[ip->imm]);
     }
-    auto f = func->functions_[findex];
-    frame.locals[dst] = TaggedValue::from_heap(allocate<Function>(f));
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
-    DISPATCH_REG();
+    regs[ip->dst] = g;
   }
 
-  op_LoadLocalR: {
-    if (ip->src1 >= frame.locals.size()) {
-      throw RuntimeException("LoadLocal: local variable index out of range");
+  void exec_store_global(Frame &, TaggedValue *regs,
+                         const bytecode::RegisterInstruction *ip) {
+    globals[static_cast<size_t>(ip->imm)] = regs[ip->src1];
+  }
+
+  void exec_push_reference(Frame &frame, TaggedValue *regs,
+                           const bytecode::RegisterInstruction *ip) {
+    int32_t idx = ip->imm;
+    Value *ref = nullptr;
+    if (idx < static_cast<int32_t>(frame.func->local_reference_vars_.size())) {
+      ref = regs[frame.ref_base + idx].as_ptr();
+    } else {
+      // In range of free_vars_, which push_reg_frame checked the frame's
+      // free_refs covers.
+      size_t free_idx = idx - frame.func->local_reference_vars_.size();
+      VM_CHECK_VERIFIED(free_idx < frame.free_refs.size(),
+                        "PushReference: free variable index out of range");
+      ref = frame.free_refs[free_idx];
     }
-    TaggedValue v = frame.locals[ip->src1];
-    frame.locals[ip->dst] = v;
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
-    DISPATCH_REG();
+    regs[ip->dst] = TaggedValue::from_heap(ref);
   }
 
-  op_StoreLocalR: {
-    if (ip->src1 >= frame.locals.size()) {
-      throw RuntimeException("StoreLocal: local variable index out of range");
+  void exec_load_reference(Frame &, TaggedValue *regs,
+                           const bytecode::RegisterInstruction *ip) {
+    TaggedValue ref_tv = regs[ip->src1];
+    if (ref_tv.kind() != TaggedValue::Kind::HeapPtr ||
+        ref_tv.as_ptr()->tag != Value::Type::Reference)
+      throw IllegalCastException("Expected reference");
+    auto ref = static_cast<Reference *>(ref_tv.as_ptr());
+    regs[ip->dst] = ref->value;
+  }
+
+  void exec_store_reference(Frame &frame, TaggedValue *regs,
+                            const bytecode::RegisterInstruction *ip) {
+    note_alloc_site(frame, ip);
+    TaggedValue val_tv = regs[ip->src1];
+    TaggedValue ref_tv = regs[ip->src2];
+    if (ref_tv.kind() != TaggedValue::Kind::HeapPtr ||
+        ref_tv.as_ptr()->tag != Value::Type::Reference)
+      throw IllegalCastException("Expected reference");
+    auto ref = static_cast<Reference *>(ref_tv.as_ptr());
+    ref->value = val_tv;
+    write_barrier_tagged(ref, val_tv);
+  }
+
+  // Whether a CallGuard lets its inlined body run: the callee is what a
+  // Call would enter as inline_targets[dst], with every free variable
+  // reference the body will load.
+  static bool call_guard_passes(const Frame &frame, const TaggedValue *regs,
+                                const bytecode::RegisterInstruction *ip) {
+    TaggedValue callee_tv = regs[ip->src1];
+    if (callee_tv.kind() != TaggedValue::Kind::HeapPtr)
+      return false;
+    const bytecode::Function *target = frame.func->inline_targets[ip->dst];
+    Value *callee = callee_tv.as_ptr();
+    if (callee->tag == Value::Type::Closure) {
+      auto closure = static_cast<Closure *>(callee);
+      return closure->function == target &&
+             closure->free_count >= target->free_vars_.size();
     }
-    TaggedValue val = frame.locals[ip->src1];
-    uint16_t dst = ip->dst;
-    if (frame.ref_locals.find(dst) != frame.ref_locals.end()) {
-      if (dst >= func->local_vars_.size()) {
-        throw RuntimeException("StoreLocal: local variable name index out of range");
-      }
-      const std::string &var_name = func->local_vars_[dst];
-      auto ref_it = frame.local_refs.find(var_name);
-      if (ref_it != frame.local_refs.end()) {
-        auto ref = static_cast<Reference *>(ref_it->second);
-        ref->cell = box_tagged(val);
-        heap.write_barrier(ref, ref->cell);
+    return callee->tag == Value::Type::Function &&
+           static_cast<Function *>(callee)->func == target &&
+           target->free_vars_.empty();
+  }
+
+  void exec_load_free_ref(Frame &, TaggedValue *regs,
+                          const bytecode::RegisterInstruction *ip) {
+    // The CallGuard in front of the inlined body checked the closure.
+    TaggedValue closure_tv = regs[ip->src1];
+    VM_CHECK_VERIFIED(closure_tv.kind() == TaggedValue::Kind::HeapPtr &&
+                          closure_tv.as_ptr()->tag == Value::Type::Closure,
+                      "LoadFreeRef: expected closure");
+    auto closure = static_cast<Closure *>(closure_tv.as_ptr());
+    VM_CHECK_VERIFIED(static_cast<uint32_t>(ip->imm) < closure->free_count,
+                      "PushReference: free variable index out of range");
+    regs[ip->dst] = TaggedValue::from_heap(closure->free_var_slots()[ip->imm]);
+  }
+
+  // As init_local_refs does for one slot of a frame, except that the local
+  // keeps its unboxed value.
+  void exec_new_reference(Frame &frame, TaggedValue *regs,
+                          const bytecode::RegisterInstruction *ip) {
+    note_alloc_site(frame, ip);
+    auto ref = allocate<Reference>(regs[ip->src1]);
+    write_barrier_tagged(ref, ref->value);
+    regs[ip->dst] = TaggedValue::from_heap(ref);
+  }
+
+  void exec_alloc_record(Frame &frame, TaggedValue *regs,
+                         const bytecode::RegisterInstruction *ip) {
+    note_alloc_site(frame, ip);
+    Record *rec = allocate<Record>(shapes.root());
+    if (ip->imm > 0)
+      reserve_slots(rec, static_cast<size_t>(ip->imm));
+    regs[ip->dst] = TaggedValue::from_heap(rec);
+  }
+
+  // Makes room for the named fields a record literal is about to store.
+  void reserve_slots(Record *rec, size_t count) {
+    RecordGrowthScope growth(*this, rec);
+    rec->slots.reserve(std::min(count, ShapeTable::kMaxShapeFields));
+  }
+
+  // FieldLoad is the most frequent record operation, so the cache hit is
+  // kept apart from everything else, which keeps it small enough to be
+  // inlined into the interpreter loop.
+  void exec_field_load(Frame &frame, TaggedValue *regs,
+                       const bytecode::RegisterInstruction *ip) {
+    TaggedValue rec_tv = regs[ip->src1];
+    if (rec_tv.kind() == TaggedValue::Kind::HeapPtr &&
+        rec_tv.as_ptr()->tag == Value::Type::Record) {
+      auto rec = static_cast<Record *>(rec_tv.as_ptr());
+      bytecode::FieldCache &cache = frame.func->field_caches[ip->src2];
+      int hit = rec->shape ? field_cache_lookup(cache, rec->shape->id) : -1;
+      if (hit >= 0) {
+        regs[ip->dst] = rec->slots[cache.entries[hit].slot];
+        return;
       }
     }
-    frame.locals[dst] = val;
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
-    DISPATCH_REG();
+    field_load_slow(frame, regs, ip);
   }
 
-  op_LoadGlobalR: {
+  void field_load_slow(Frame &frame, TaggedValue *regs,
+                       const bytecode::RegisterInstruction *ip) {
+    TaggedValue rec_tv = regs[ip->src1];
+    if (rec_tv.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_tv.as_ptr()->tag != Value::Type::Record)
+      throw IllegalCastException("Expected record");
+    auto rec = static_cast<Record *>(rec_tv.as_ptr());
     size_t idx = static_cast<size_t>(ip->imm);
-    if (idx >= func->names_.size()) {
-      throw RuntimeException("LoadGlobal: name index out of range");
+    VM_CHECK_VERIFIED(idx < frame.func->names_.size(),
+                      "FieldLoad: name index out of range");
+    regs[ip->dst] = record_load_field_miss(rec, frame.func->names_[idx],
+                                           frame.func->field_caches[ip->src2]);
+  }
+
+  void exec_field_store(Frame &frame, TaggedValue *regs,
+                        const bytecode::RegisterInstruction *ip) {
+    TaggedValue val_tv = regs[ip->src1];
+    TaggedValue rec_tv = regs[ip->src2];
+    if (rec_tv.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_tv.as_ptr()->tag != Value::Type::Record)
+      throw IllegalCastException("Expected record");
+    auto rec = static_cast<Record *>(rec_tv.as_ptr());
+    bytecode::FieldCache &cache = frame.func->field_caches[ip->dst];
+    int hit = rec->shape ? field_cache_lookup(cache, rec->shape->id) : -1;
+    if (hit >= 0) {
+      const auto &entry = cache.entries[hit];
+      if (entry.next_shape_id == entry.shape_id) {
+        rec->slots[entry.slot] = val_tv;
+      } else {
+        rec->shape = shapes.by_id(entry.next_shape_id);
+        size_t before = rec->slots.capacity();
+        rec->slots.push_back(val_tv);
+        note_heap_growth((rec->slots.capacity() - before) * sizeof(TaggedValue));
+      }
+      write_barrier_tagged(rec, val_tv);
+    } else {
+      size_t idx = static_cast<size_t>(ip->imm);
+      VM_CHECK_VERIFIED(idx < frame.func->names_.size(),
+                        "FieldStore: name index out of range");
+      record_store_field_miss(rec, frame.func->names_[idx], val_tv, cache);
     }
-    const std::string &name = func->names_[idx];
-    auto it_g = globals.find(name);
-    if (it_g == globals.end()) {
-      throw UninitializedVariableException("Undefined global: " + name);
+  }
+
+  // A record the compiler proved to come from a record literal keeps the
+  // literal's fields in their slots until it turns into a dictionary.
+  void exec_field_load_slot(Frame &frame, TaggedValue *regs,
+                            const bytecode::RegisterInstruction *ip) {
+    TaggedValue rec_tv = regs[ip->src1];
+    if (rec_tv.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_tv.as_ptr()->tag != Value::Type::Record)
+      throw IllegalCastException("Expected record");
+    auto rec = static_cast<Record *>(rec_tv.as_ptr());
+    if (rec->shape && ip->src2 < rec->slots.size()) {
+      regs[ip->dst] = rec->slots[ip->src2];
+    } else {
+      size_t idx = static_cast<size_t>(ip->imm);
+      VM_CHECK_VERIFIED(idx < frame.func->names_.size(),
+                        "FieldLoad: name index out of range");
+      const TaggedValue *v = rec->find_named(frame.func->names_[idx]);
+      regs[ip->dst] = v ? *v : TaggedValue::none();
     }
-    frame.locals[ip->dst] = it_g->second;
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
-    DISPATCH_REG();
   }
 
-  op_StoreGlobalR: {
-    size_t idx = static_cast<size_t>(ip->imm);
-    if (idx >= func->names_.size()) {
-      throw RuntimeException("StoreGlobal: name index out of range");
+  void exec_field_store_slot(Frame &frame, TaggedValue *regs,
+                             const bytecode::RegisterInstruction *ip) {
+    TaggedValue val_tv = regs[ip->src1];
+    TaggedValue rec_tv = regs[ip->src2];
+    if (rec_tv.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_tv.as_ptr()->tag != Value::Type::Record)
+      throw IllegalCastException("Expected record");
+    auto rec = static_cast<Record *>(rec_tv.as_ptr());
+    if (rec->shape && ip->dst < rec->slots.size()) {
+      rec->slots[ip->dst] = val_tv;
+      write_barrier_tagged(rec, val_tv);
+    } else {
+      size_t idx = static_cast<size_t>(ip->imm);
+      VM_CHECK_VERIFIED(idx < frame.func->names_.size(),
+                        "FieldStore: name index out of range");
+      record_store_named(rec, frame.func->names_[idx], val_tv);
     }
-    const std::string &name = func->names_[idx];
-    globals[name] = frame.locals[ip->src1];
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
-    DISPATCH_REG();
   }
 
-  op_PushReferenceR: {
-    int32_t idx = ip->imm;
-    Value *ref = nullptr;
-    if (idx < static_cast<int32_t>(func->local_reference_vars_.size())) {
-      const std::string &var_name = func->local_reference_vars_[idx];
-      ref = frame.local_refs[var_name];
+  void exec_index_load(Frame &, TaggedValue *regs,
+                       const bytecode::RegisterInstruction *ip) {
+    TaggedValue rec_tv = regs[ip->src1];
+    TaggedValue idx_tv = regs[ip->src2];
+    if (rec_tv.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_tv.as_ptr()->tag != Value::Type::Record)
+      throw IllegalCastException("Expected record");
+    auto rec = static_cast<Record *>(rec_tv.as_ptr());
+    TaggedValue result = TaggedValue::none();
+    if (!record_try_element_load(rec, idx_tv, result)) {
+      result = record_map_load(rec, idx_tv);
+    }
+    regs[ip->dst] = result;
+  }
+
+  void exec_index_store(Frame &, TaggedValue *regs,
+                        const bytecode::RegisterInstruction *ip) {
+    TaggedValue val_tv = regs[ip->src1];
+    TaggedValue idx_tv = regs[ip->src2];
+    TaggedValue rec_tv = regs[ip->dst];
+    if (rec_tv.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_tv.as_ptr()->tag != Value::Type::Record)
+      throw IllegalCastException("Expected record");
+    auto rec = static_cast<Record *>(rec_tv.as_ptr());
+    if (!record_try_element_store(rec, idx_tv, val_tv)) {
+      record_map_store(rec, idx_tv, val_tv);
+    }
+  }
+
+  void exec_alloc_closure(Frame &frame, TaggedValue *regs,
+                          const bytecode::RegisterInstruction *ip) {
+    note_alloc_site(frame, ip);
+    uint32_t free_count = static_cast<uint32_t>(ip->imm);
+    for (uint32_t i = 0; i < free_count; ++i) {
+      TaggedValue tv = regs[ip->src1 + i];
+      if (tv.kind() != TaggedValue::Kind::HeapPtr ||
+          tv.as_ptr()->tag != Value::Type::Reference)
+        throw IllegalCastException("Expected reference");
+    }
+    TaggedValue func_tv = regs[ip->src2];
+    if (func_tv.kind() != TaggedValue::Kind::HeapPtr ||
+        func_tv.as_ptr()->tag != Value::Type::Function)
+      throw IllegalCastException("Expected function");
+    auto f = static_cast<Function *>(func_tv.as_ptr());
+    // The references stay rooted in their registers across the allocation.
+    Closure *closure = allocate_sized<Closure>(Closure::size_for(free_count),
+                                               f->func, free_count);
+    Value **refs = closure->free_var_slots();
+    for (uint32_t i = 0; i < free_count; ++i) {
+      refs[i] = regs[ip->src1 + i].as_ptr();
+      heap.write_barrier(closure, refs[i]);
+    }
+    regs[ip->dst] = TaggedValue::from_heap(closure);
+  }
+
+  void exec_add(Frame &frame, TaggedValue *regs,
+                const bytecode::RegisterInstruction *ip) {
+    note_alloc_site(frame, ip);
+    regs[ip->dst] = add_values(regs[ip->src1], regs[ip->src2]);
+  }
+
+  void exec_add_imm(Frame &frame, TaggedValue *regs,
+                    const bytecode::RegisterInstruction *ip) {
+    TaggedValue left = regs[ip->src1];
+    if (left.kind() == TaggedValue::Kind::Integer) {
+      regs[ip->dst] = TaggedValue::from_int(left.as_int() + ip->imm);
     } else {
-      int32_t free_idx = idx - func->local_reference_vars_.size();
-      if (free_idx < 0 ||
-          free_idx >= static_cast<int32_t>(free_refs.size())) {
-        throw RuntimeException("PushReference: free variable index out of range");
-      }
-      ref = free_refs[free_idx];
+      note_alloc_site(frame, ip);
+      regs[ip->dst] = add_values(left, TaggedValue::from_int(ip->imm));
     }
-    frame.locals[ip->dst] = TaggedValue::from_heap(ref);
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
-    DISPATCH_REG();
   }
 
-  op_LoadReferenceR: {
-    TaggedValue ref_tv = frame.locals[ip->src1];
-    if (ref_tv.kind != TaggedValue::Kind::HeapPtr ||
-        ref_tv.ptr->tag != Value::Type::Reference)
-      throw IllegalCastException("Expected reference");
-    auto ref = static_cast<Reference *>(ref_tv.ptr);
-    frame.locals[ip->dst] = tagged_from_value(ref->cell);
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
-    DISPATCH_REG();
+  // AddI/SubI/MulI/GtI/GeqI/EqI: the compiler proved both operands to be
+  // integers, so their payloads are used without looking at the kinds.
+  void exec_typed_int(Frame &, TaggedValue *regs,
+                      const bytecode::RegisterInstruction *ip) {
+    using bytecode::Operation;
+    int32_t a = regs[ip->src1].as_int();
+    int32_t b = regs[ip->src2].as_int();
+    switch (ip->op) {
+    case Operation::AddI: regs[ip->dst] = TaggedValue::from_int(a + b); break;
+    case Operation::SubI: regs[ip->dst] = TaggedValue::from_int(a - b); break;
+    case Operation::MulI: regs[ip->dst] = TaggedValue::from_int(a * b); break;
+    case Operation::GtI: regs[ip->dst] = TaggedValue::from_bool(a > b); break;
+    case Operation::GeqI: regs[ip->dst] = TaggedValue::from_bool(a >= b); break;
+    default: regs[ip->dst] = TaggedValue::from_bool(a == b); break;
+    }
   }
 
-  op_StoreReferenceR: {
-    TaggedValue val_tv = frame.locals[ip->src1];
-    TaggedValue ref_tv = frame.locals[ip->src2];
-    if (ref_tv.kind != TaggedValue::Kind::HeapPtr ||
-        ref_tv.ptr->tag != Value::Type::Reference)
-      throw IllegalCastException("Expected reference");
-    auto ref = static_cast<Reference *>(ref_tv.ptr);
-    ref->cell = box_tagged(val_tv);
-    heap.write_barrier(ref, ref->cell);
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
-    DISPATCH_REG();
+  // String concatenation for Add. Results of up to TaggedValue::kSmallMax
+  // bytes are SmallStrings, built without allocating, and other short
+  // results are built flat; longer ones become rope nodes over the operands
+  // so that repeated appends stay linear. Ropes deeper than kMaxRopeDepth
+  // are flattened right away, which bounds how many nodes an append loop
+  // keeps alive.
+  static constexpr size_t kRopeMinLength = 64;
+  static constexpr uint32_t kMaxRopeDepth = 512;
+
+  TaggedValue concat_values(const TaggedValue &left, const TaggedValue &right) {
+    auto as_string = [](const TaggedValue &tv) -> String * {
+      return tv.kind() == TaggedValue::Kind::HeapPtr &&
+                     tv.as_ptr()->tag == Value::Type::String
+                 ? static_cast<String *>(tv.as_ptr())
+                 : nullptr;
+    };
+    if (left.kind() == TaggedValue::Kind::SmallString &&
+        right.kind() == TaggedValue::Kind::SmallString) {
+      std::string_view l = left.small_text(), r = right.small_text();
+      if (l.size() + r.size() <= TaggedValue::kSmallMax) {
+        char text[TaggedValue::kSmallMax];
+        std::copy(l.begin(), l.end(), text);
+        std::copy(r.begin(), r.end(), text + l.size());
+        return TaggedValue::from_small({text, l.size() + r.size()});
+      }
+    }
+    String *ls = as_string(left);
+    String *rs = as_string(right);
+    std::string ltext = ls ? std::string() : tagged_to_string(left);
+    std::string rtext = rs ? std::string() : tagged_to_string(right);
+    size_t total = (ls ? ls->size() : ltext.size()) +
+                   (rs ? rs->size() : rtext.size());
+    if (total < kRopeMinLength) {
+      std::string text(ls ? ls->str() : ltext);
+      text += rs ? rs->str() : rtext;
+      return make_string(text);
+    }
+    // Account for every allocation up front so no collection can run while
+    // a fresh operand leaf is not yet reachable from the rope.
+    reserve_heap_bytes(3 * sizeof(String));
+    if (!ls) {
+      ls = heap.allocate<String>(ltext);
+      note_heap_growth(ls->payload_bytes());
+      if (heap_profile)
+        profile_allocation(ls, sizeof(String));
+    }
+    if (!rs) {
+      rs = heap.allocate<String>(rtext);
+      note_heap_growth(rs->payload_bytes());
+      if (heap_profile)
+        profile_allocation(rs, sizeof(String));
+    }
+    String *rope = heap.allocate<String>(ls, rs);
+    if (heap_profile)
+      profile_allocation(rope, sizeof(String));
+    if (rope->depth() > kMaxRopeDepth) {
+      rope->str();
+      note_heap_growth(rope->payload_bytes());
+    }
+    return TaggedValue::from_heap(rope);
   }
 
-  op_AllocRecordR: {
-    frame.locals[ip->dst] = TaggedValue::from_heap(allocate<Record>());
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
-    DISPATCH_REG();
+  static bool is_string(const TaggedValue &tv) {
+    return tv.kind() == TaggedValue::Kind::SmallString ||
+           (tv.kind() == TaggedValue::Kind::HeapPtr &&
+            tv.as_ptr()->tag == Value::Type::String);
   }
 
-  op_FieldLoadR: {
-    TaggedValue rec_tv = frame.locals[ip->src1];
-    if (rec_tv.kind != TaggedValue::Kind::HeapPtr ||
-        rec_tv.ptr->tag != Value::Type::Record)
-      throw IllegalCastException("Expected record");
-    auto rec = static_cast<Record *>(rec_tv.ptr);
-    size_t idx = static_cast<size_t>(ip->imm);
-    if (idx >= func->names_.size()) {
-      throw RuntimeException("FieldLoad: name index out of range");
+  TaggedValue add_values(const TaggedValue &left, const TaggedValue &right) {
+    if ((left.kind() == TaggedValue::Kind::Integer ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Integer)) &&
+        (right.kind() == TaggedValue::Kind::Integer ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Integer))) {
+      auto li = get_int(left);
+      auto ri = get_int(right);
+      return TaggedValue::from_int(li + ri);
+    } else if (is_string(left) || is_string(right)) {
+      return concat_values(left, right);
+    } else {
+      throw IllegalCastException("Invalid operand types for add");
+    }
+  }
+
+  void exec_sub(Frame &, TaggedValue *regs,
+                const bytecode::RegisterInstruction *ip) {
+    TaggedValue left = regs[ip->src1];
+    TaggedValue right = regs[ip->src2];
+    if ((left.kind() == TaggedValue::Kind::Integer ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Integer)) &&
+        (right.kind() == TaggedValue::Kind::Integer ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Integer))) {
+      auto li = get_int(left);
+      auto ri = get_int(right);
+      regs[ip->dst] = TaggedValue::from_int(li - ri);
+    } else {
+      throw IllegalCastException("Invalid operand types for subtract");
     }
-    const std::string &field = func->names_[idx];
-    auto it = rec->fields.find(field);
-    if (it == rec->fields.end()) {
-      frame.locals[ip->dst] = TaggedValue::none();
+  }
+
+  void exec_sub_imm(Frame &, TaggedValue *regs,
+                    const bytecode::RegisterInstruction *ip) {
+    TaggedValue left = regs[ip->src1];
+    if (left.kind() == TaggedValue::Kind::Integer ||
+        (left.kind() == TaggedValue::Kind::HeapPtr &&
+         left.as_ptr()->tag == Value::Type::Integer)) {
+      regs[ip->dst] = TaggedValue::from_int(get_int(left) - ip->imm);
     } else {
-      frame.locals[ip->dst] = tagged_from_value(it->second);
+      throw IllegalCastException("Invalid operand types for subtract");
     }
+  }
+
+  // Slow path of IncJumpLt/AddJumpLt: the counter update, with Add's
+  // semantics, then the loop test. Returns whether the branch is taken.
+  bool exec_counted_loop(Frame &frame, TaggedValue *regs,
+                         const bytecode::RegisterInstruction *ip) {
+    TaggedValue step = ip->op == bytecode::Operation::IncJumpLt
+                           ? TaggedValue::from_int(static_cast<int16_t>(ip->src2))
+                           : regs[ip->src2];
+    note_alloc_site(frame, ip);
+    regs[ip->dst] = add_values(regs[ip->dst], step);
+    return compare_gt(regs[ip->src1], regs[ip->dst]);
+  }
+
+  void exec_mul(Frame &, TaggedValue *regs,
+                const bytecode::RegisterInstruction *ip) {
+    TaggedValue left = regs[ip->src1];
+    TaggedValue right = regs[ip->src2];
+    if ((left.kind() == TaggedValue::Kind::Integer ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Integer)) &&
+        (right.kind() == TaggedValue::Kind::Integer ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Integer))) {
+      auto li = get_int(left);
+      auto ri = get_int(right);
+      regs[ip->dst] = TaggedValue::from_int(li * ri);
+    } else {
+      throw IllegalCastException("Invalid operand types for multiply");
+    }
+  }
+
+  void exec_div(Frame &, TaggedValue *regs,
+                const bytecode::RegisterInstruction *ip) {
+    TaggedValue left = regs[ip->src1];
+    TaggedValue right = regs[ip->src2];
+    if ((left.kind() == TaggedValue::Kind::Integer ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Integer)) &&
+        (right.kind() == TaggedValue::Kind::Integer ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Integer))) {
+      auto li = get_int(left);
+      auto ri = get_int(right);
+      if (ri == 0) throw IllegalArithmeticException("Division by zero");
+      regs[ip->dst] = TaggedValue::from_int(li / ri);
+    } else {
+      throw IllegalCastException("Invalid operand types for divide");
+    }
+  }
+
+  void exec_neg(Frame &, TaggedValue *regs,
+                const bytecode::RegisterInstruction *ip) {
+    TaggedValue left = regs[ip->src1];
+    if (left.kind() == TaggedValue::Kind::Integer ||
+        (left.kind() == TaggedValue::Kind::HeapPtr &&
+         left.as_ptr()->tag == Value::Type::Integer)) {
+      auto li = get_int(left);
+      regs[ip->dst] = TaggedValue::from_int(-li);
+    } else {
+      throw IllegalCastException("Invalid operand types for negate");
+    }
+  }
+
+  void exec_gt(Frame &, TaggedValue *regs,
+               const bytecode::RegisterInstruction *ip) {
+    regs[ip->dst] = TaggedValue::from_bool(compare_gt(regs[ip->src1], regs[ip->src2]));
+  }
+
+  bool compare_gt(const TaggedValue &left, const TaggedValue &right) {
+    if ((left.kind() == TaggedValue::Kind::Integer ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Integer)) &&
+        (right.kind() == TaggedValue::Kind::Integer ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Integer))) {
+      return get_int(left) > get_int(right);
+    } else {
+      throw IllegalCastException("Invalid operand types for greater than");
+    }
+  }
+
+  void exec_geq(Frame &, TaggedValue *regs,
+                const bytecode::RegisterInstruction *ip) {
+    regs[ip->dst] = TaggedValue::from_bool(compare_geq(regs[ip->src1], regs[ip->src2]));
+  }
+
+  bool compare_geq(const TaggedValue &left, const TaggedValue &right) {
+    if ((left.kind() == TaggedValue::Kind::Integer ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Integer)) &&
+        (right.kind() == TaggedValue::Kind::Integer ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Integer))) {
+      return get_int(left) >= get_int(right);
+    } else {
+      throw IllegalCastException("Invalid operand types for greater or equal");
+    }
+  }
+
+  void exec_eq(Frame &, TaggedValue *regs,
+               const bytecode::RegisterInstruction *ip) {
+    TaggedValue left = regs[ip->src1];
+    TaggedValue right = regs[ip->src2];
+    regs[ip->dst] = TaggedValue::from_bool(values_equal(left, right));
+  }
+
+  void exec_and(Frame &, TaggedValue *regs,
+                const bytecode::RegisterInstruction *ip) {
+    TaggedValue left = regs[ip->src1];
+    TaggedValue right = regs[ip->src2];
+    if ((left.kind() == TaggedValue::Kind::Boolean ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Boolean)) &&
+        (right.kind() == TaggedValue::Kind::Boolean ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Boolean))) {
+      regs[ip->dst] = TaggedValue::from_bool(get_bool(left) && get_bool(right));
+    } else {
+      throw IllegalCastException("Invalid operand types for and");
+    }
+  }
+
+  void exec_or(Frame &, TaggedValue *regs,
+               const bytecode::RegisterInstruction *ip) {
+    TaggedValue left = regs[ip->src1];
+    TaggedValue right = regs[ip->src2];
+    if ((left.kind() == TaggedValue::Kind::Boolean ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Boolean)) &&
+        (right.kind() == TaggedValue::Kind::Boolean ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Boolean))) {
+      regs[ip->dst] = TaggedValue::from_bool(get_bool(left) || get_bool(right));
+    } else {
+      throw IllegalCastException("Invalid operand types for or");
+    }
+  }
+
+  void exec_not(Frame &, TaggedValue *regs,
+                const bytecode::RegisterInstruction *ip) {
+    TaggedValue val = regs[ip->src1];
+    if (val.kind() == TaggedValue::Kind::Boolean ||
+        (val.kind() == TaggedValue::Kind::HeapPtr &&
+         val.as_ptr()->tag == Value::Type::Boolean)) {
+      regs[ip->dst] = TaggedValue::from_bool(!get_bool(val));
+    } else {
+      throw IllegalCastException("Invalid operand types for not");
+    }
+  }
+
+  void exec_call(Frame &frame, TaggedValue *regs,
+                 const bytecode::RegisterInstruction *ip) {
+    uint16_t dst = ip->dst;
+    uint16_t callee_reg = ip->src1;
+    uint16_t arg_start = ip->src2;
+    int32_t arg_count = ip->imm;
+
+    TaggedValue callee_tv = regs[callee_reg];
+    if (callee_tv.kind() != TaggedValue::Kind::HeapPtr)
+      throw IllegalCastException("Expected callable");
+
+    Value *callee = callee_tv.as_ptr();
+    TaggedValue result;
+    if (callee->tag == Value::Type::Closure) {
+      auto closure = static_cast<Closure *>(callee);
+      result = execute_function_reg(closure->function, frame.base + arg_start,
+                                    arg_count, closure->free_var_refs());
+    } else if (callee->tag == Value::Type::Function) {
+      auto func_ptr_local = static_cast<Function *>(callee);
+      result = execute_function_reg(func_ptr_local->func, frame.base + arg_start,
+                                    arg_count, FreeRefs{});
+    } else {
+      throw IllegalCastException("Expected closure or function");
+    }
+    regs = registers.data() + frame.base;
+    regs[dst] = result;
+  }
+
+  void exec_dup(Frame &, TaggedValue *regs,
+                const bytecode::RegisterInstruction *ip) {
+    regs[ip->dst] = regs[ip->src1];
+  }
+
+  void exec_swap(Frame &, TaggedValue *regs,
+                 const bytecode::RegisterInstruction *ip) {
+    std::swap(regs[ip->dst], regs[ip->src1]);
+  }
+
+  void exec_pop(Frame &, TaggedValue *regs,
+                const bytecode::RegisterInstruction *ip) {
+    regs[ip->dst] = TaggedValue::none();
+  }
+
+  // ---- Quickening ---------------------------------------------------------
+  //
+  // Generic arithmetic and comparison handlers rewrite their instruction in
+  // place to an *Int variant when both operands arrive as tagged integers.
+  // The variant runs a single kind check per operand and, if that fails,
+  // rewrites the instruction back to the generic op and re-executes it.
+
+  static bytecode::Operation unquickened(bytecode::Operation op) {
+    using bytecode::Operation;
+    switch (op) {
+    case Operation::AddInt: return Operation::Add;
+    case Operation::SubInt: return Operation::Sub;
+    case Operation::MulInt: return Operation::Mul;
+    case Operation::GtInt: return Operation::Gt;
+    case Operation::GeqInt: return Operation::Geq;
+    case Operation::EqInt: return Operation::Eq;
+    case Operation::GtJumpInt: return Operation::GtJump;
+    case Operation::GeqJumpInt: return Operation::GeqJump;
+    case Operation::EqJumpInt: return Operation::EqJump;
+    default: return op;
+    }
+  }
+
+  // The generic operation a compiler-typed one (AddI etc.) stands for.
+  static bytecode::Operation untyped(bytecode::Operation op) {
+    using bytecode::Operation;
+    switch (op) {
+    case Operation::AddI: return Operation::Add;
+    case Operation::SubI: return Operation::Sub;
+    case Operation::MulI: return Operation::Mul;
+    case Operation::GtI: return Operation::Gt;
+    case Operation::GeqI: return Operation::Geq;
+    case Operation::EqI: return Operation::Eq;
+    default: return op;
+    }
+  }
+
+  static void unquicken_code(bytecode::Function *func) {
+    for (bytecode::RegisterInstruction &in : func->reg_instructions)
+      in.op = unquickened(in.op);
+    thread_code(func);
+  }
+
+  static void quicken(const bytecode::RegisterInstruction *ip,
+                      bytecode::Operation op) {
+    auto *in = const_cast<bytecode::RegisterInstruction *>(ip);
+    in->op = op;
+#ifdef MITSCRIPT_THREADED_DISPATCH
+    in->handler = reg_handler_offsets[static_cast<size_t>(op)];
+#endif
+  }
+
+  static bool int_operands(const TaggedValue *regs,
+                           const bytecode::RegisterInstruction *ip) {
+    return regs[ip->src1].kind() == TaggedValue::Kind::Integer &&
+           regs[ip->src2].kind() == TaggedValue::Kind::Integer;
+  }
+
+  bool branch_condition(const TaggedValue &cond) {
+    if (cond.kind() != TaggedValue::Kind::Boolean &&
+        !(cond.kind() == TaggedValue::Kind::HeapPtr &&
+          cond.as_ptr()->tag == Value::Type::Boolean))
+      throw IllegalCastException("Invalid operand types for if");
+    return get_bool(cond);
+  }
+
+  // Whether a conditional branch (If or a compare-and-jump) is taken.
+  bool branch_taken(const TaggedValue *regs, const bytecode::RegisterInstruction *ip) {
+    using bytecode::Operation;
+    bool taken;
+    switch (unquickened(ip->op)) {
+    case Operation::If: return branch_condition(regs[ip->src1]);
+    case Operation::GtJump: taken = compare_gt(regs[ip->src1], regs[ip->src2]); break;
+    case Operation::GeqJump: taken = compare_geq(regs[ip->src1], regs[ip->src2]); break;
+    case Operation::EqJump: taken = values_equal(regs[ip->src1], regs[ip->src2]); break;
+    default: throw RuntimeException("branch_taken: not a conditional branch");
+    }
+    return taken != (ip->dst != 0);
+  }
+
+  // ---- Baseline JIT -------------------------------------------------------
+  //
+  // Once a function has been called kJitCallThreshold times, jit_compile
+  // turns its reg_instructions into straight-line x86-64 with one template
+  // per instruction. Integer arithmetic, comparisons, compare-and-jumps,
+  // counted-loop latches, boolean If and register moves run inline;
+  // everything else (and every slow path) calls a jit_step instantiation,
+  // which runs the interpreter's exec_* handler for that one instruction
+  // and returns the (possibly moved) register window.
+  //
+  // Compiled code receives (VM*, Frame*, TaggedValue* regs, resume) and
+  // keeps the first three in r12, r13 and rbx. It returns a JitStatus. A
+  // Call is not made from compiled code: it records its index in frame->pc
+  // and returns JitCall, and once the interpreter loop has run the callee
+  // it re-enters the code with resume set to the index after the Call.
+  //
+  // Loop headers (targets of backward branches) are entry points too: an
+  // interpreted frame that keeps taking a back edge is moved into compiled
+  // code mid-loop (on-stack replacement). Both tiers keep every value in
+  // the register file, so the transfer is only a jump to the header's code.
+
+  enum JitStatus : int { JitReturned = 0, JitError = 1, JitFellOff = 2, JitCall = 3 };
+  using JitEntry = int (*)(VM *, Frame *, TaggedValue *, uint32_t);
+
+  using ExecFn = void (VM::*)(Frame &, TaggedValue *,
+                              const bytecode::RegisterInstruction *);
+
+  template <ExecFn Exec>
+  static TaggedValue *jit_step(VM *vm, Frame *frame,
+                               const bytecode::RegisterInstruction *ip) noexcept {
+    try {
+      (vm->*Exec)(*frame, vm->registers.data() + frame->base, ip);
+      return vm->registers.data() + frame->base;
+    } catch (...) {
+      vm->jit_error = std::current_exception();
+      return nullptr;
+    }
+  }
+
+  // Fast paths of IndexLoad and IndexStore for an integer index within a
+  // record's dense prefix (and, for a store, an unboxed value, which needs
+  // no barrier). They return false, having done nothing, otherwise. Being
+  // leaves they need no stack frame; in sieve-style loops, whose stores
+  // miss the cache, going through jit_step instead runs at half the speed.
+  static bool jit_index_load(VM *vm, Frame *frame,
+                             const bytecode::RegisterInstruction *ip) noexcept {
+    TaggedValue *regs = vm->registers.data() + frame->base;
+    TaggedValue rec_tv = regs[ip->src1];
+    TaggedValue idx_tv = regs[ip->src2];
+    if (rec_tv.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_tv.as_ptr()->tag != Value::Type::Record ||
+        idx_tv.kind() != TaggedValue::Kind::Integer)
+      return false;
+    auto rec = static_cast<Record *>(rec_tv.as_ptr());
+    auto idx = static_cast<uint32_t>(idx_tv.as_int());
+    if (idx >= rec->dense.size())
+      return false;
+    regs[ip->dst] = Record::element(rec->dense[idx]);
+    return true;
+  }
+
+  static bool jit_index_store(VM *vm, Frame *frame,
+                              const bytecode::RegisterInstruction *ip) noexcept {
+    TaggedValue *regs = vm->registers.data() + frame->base;
+    TaggedValue val_tv = regs[ip->src1];
+    TaggedValue idx_tv = regs[ip->src2];
+    TaggedValue rec_tv = regs[ip->dst];
+    if (rec_tv.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_tv.as_ptr()->tag != Value::Type::Record ||
+        idx_tv.kind() != TaggedValue::Kind::Integer ||
+        val_tv.kind() == TaggedValue::Kind::HeapPtr)
+      return false;
+    auto rec = static_cast<Record *>(rec_tv.as_ptr());
+    auto idx = static_cast<uint32_t>(idx_tv.as_int());
+    if (idx >= rec->dense.size())
+      return false;
+    rec->dense[idx] = val_tv;
+    return true;
+  }
+
+  // Out-of-line handler for a non-branching op, or nullptr if the JIT does
+  // not know the op.
+  static void *jit_step_for(bytecode::Operation op) {
+    using bytecode::Operation;
+    switch (op) {
+    case Operation::LoadConst: return reinterpret_cast<void *>(&jit_step<&VM::exec_load_const>);
+    case Operation::LoadFunc: return reinterpret_cast<void *>(&jit_step<&VM::exec_load_func>);
+    case Operation::LoadLocal: return reinterpret_cast<void *>(&jit_step<&VM::exec_move>);
+    case Operation::StoreLocal: return reinterpret_cast<void *>(&jit_step<&VM::exec_store_local>);
+    case Operation::LoadGlobal: return reinterpret_cast<void *>(&jit_step<&VM::exec_load_global>);
+    case Operation::StoreGlobal: return reinterpret_cast<void *>(&jit_step<&VM::exec_store_global>);
+    case Operation::PushReference: return reinterpret_cast<void *>(&jit_step<&VM::exec_push_reference>);
+    case Operation::LoadReference: return reinterpret_cast<void *>(&jit_step<&VM::exec_load_reference>);
+    case Operation::StoreReference: return reinterpret_cast<void *>(&jit_step<&VM::exec_store_reference>);
+    case Operation::AllocRecord: return reinterpret_cast<void *>(&jit_step<&VM::exec_alloc_record>);
+    case Operation::FieldLoad: return reinterpret_cast<void *>(&jit_step<&VM::exec_field_load>);
+    case Operation::FieldStore: return reinterpret_cast<void *>(&jit_step<&VM::exec_field_store>);
+    case Operation::FieldLoadSlot: return reinterpret_cast<void *>(&jit_step<&VM::exec_field_load_slot>);
+    case Operation::FieldStoreSlot: return reinterpret_cast<void *>(&jit_step<&VM::exec_field_store_slot>);
+    case Operation::AddI:
+    case Operation::SubI:
+    case Operation::MulI:
+    case Operation::GtI:
+    case Operation::GeqI:
+    case Operation::EqI: return reinterpret_cast<void *>(&jit_step<&VM::exec_typed_int>);
+    case Operation::IndexLoad: return reinterpret_cast<void *>(&jit_step<&VM::exec_index_load>);
+    case Operation::IndexStore: return reinterpret_cast<void *>(&jit_step<&VM::exec_index_store>);
+    case Operation::AllocClosure: return reinterpret_cast<void *>(&jit_step<&VM::exec_alloc_closure>);
+    case Operation::Add: return reinterpret_cast<void *>(&jit_step<&VM::exec_add>);
+    case Operation::Sub: return reinterpret_cast<void *>(&jit_step<&VM::exec_sub>);
+    case Operation::Mul: return reinterpret_cast<void *>(&jit_step<&VM::exec_mul>);
+    case Operation::Div: return reinterpret_cast<void *>(&jit_step<&VM::exec_div>);
+    case Operation::Neg: return reinterpret_cast<void *>(&jit_step<&VM::exec_neg>);
+    case Operation::Gt: return reinterpret_cast<void *>(&jit_step<&VM::exec_gt>);
+    case Operation::Geq: return reinterpret_cast<void *>(&jit_step<&VM::exec_geq>);
+    case Operation::Eq: return reinterpret_cast<void *>(&jit_step<&VM::exec_eq>);
+    case Operation::And: return reinterpret_cast<void *>(&jit_step<&VM::exec_and>);
+    case Operation::Or: return reinterpret_cast<void *>(&jit_step<&VM::exec_or>);
+    case Operation::Not: return reinterpret_cast<void *>(&jit_step<&VM::exec_not>);
+    case Operation::Dup: return reinterpret_cast<void *>(&jit_step<&VM::exec_dup>);
+    case Operation::Swap: return reinterpret_cast<void *>(&jit_step<&VM::exec_swap>);
+    case Operation::Pop: return reinterpret_cast<void *>(&jit_step<&VM::exec_pop>);
+    case Operation::AddImm: return reinterpret_cast<void *>(&jit_step<&VM::exec_add_imm>);
+    case Operation::SubImm: return reinterpret_cast<void *>(&jit_step<&VM::exec_sub_imm>);
+    case Operation::LoadFreeRef: return reinterpret_cast<void *>(&jit_step<&VM::exec_load_free_ref>);
+    case Operation::NewReference: return reinterpret_cast<void *>(&jit_step<&VM::exec_new_reference>);
+    default: return nullptr;
+    }
+  }
+
+  // Slow path of a conditional branch: 1 if taken, 0 if not, -1 on error.
+  static int jit_condition(VM *vm, Frame *frame,
+                           const bytecode::RegisterInstruction *ip) noexcept {
+    try {
+      return vm->branch_taken(vm->registers.data() + frame->base, ip) ? 1 : 0;
+    } catch (...) {
+      vm->jit_error = std::current_exception();
+      return -1;
+    }
+  }
+
+  // Slow path of IncJumpLt/AddJumpLt, as for jit_condition.
+  static int jit_counted_loop(VM *vm, Frame *frame,
+                              const bytecode::RegisterInstruction *ip) noexcept {
+    try {
+      return vm->exec_counted_loop(*frame, vm->registers.data() + frame->base, ip) ? 1 : 0;
+    } catch (...) {
+      vm->jit_error = std::current_exception();
+      return -1;
+    }
+  }
+
+  // Whether a CallGuard jumps to its call: 1 if so, 0 if not.
+  static int jit_call_guard(VM *vm, Frame *frame,
+                            const bytecode::RegisterInstruction *ip) noexcept {
+    return call_guard_passes(*frame, vm->registers.data() + frame->base, ip) ? 0 : 1;
+  }
+
+  static void jit_return(VM *vm, Frame *frame,
+                         const bytecode::RegisterInstruction *ip) noexcept {
+    vm->jit_ret = vm->registers[frame->base + ip->src1];
+  }
+
+  static void jit_suspend(VM *, Frame *frame,
+                          const bytecode::RegisterInstruction *ip) noexcept {
+    frame->pc = static_cast<size_t>(ip - frame->func->reg_instructions.data());
+  }
+
+  void jit_compile(bytecode::Function *func) {
+#if MITSCRIPT_JIT_SUPPORTED
+    using bytecode::Operation;
+    using jit::Cond;
+    using jit::Reg;
+    // Templates address register r's tag word at r*8 and its int/bool
+    // payload at r*8+4.
+    static_assert(sizeof(TaggedValue) == 8, "JIT assumes 8-byte TaggedValue");
+    static_assert(TaggedValue::from_int(-2).bits == 0xFFFFFFFE00000001ull,
+                  "JIT assumes int payload in the high word");
+    static_assert(TaggedValue::from_bool(true).bits == 0x0000000100000002ull,
+                  "JIT assumes bool payload in the high word");
+    constexpr uint8_t kBool = static_cast<uint8_t>(TaggedValue::Kind::Boolean);
+    constexpr uint8_t kInt = static_cast<uint8_t>(TaggedValue::Kind::Integer);
+
+    const auto &code = func->reg_instructions;
+    const size_t n = code.size();
+    // Branch targets and register operands were checked by the verifier.
+    for (size_t i = 0; i < n; ++i) {
+      Operation op = unquickened(code[i].op);
+      if (!detail::is_reg_branch(op) && op != Operation::Return &&
+          op != Operation::Call && op != Operation::End && !jit_step_for(op))
+        return;
+    }
+
+    jit::X64Emitter e;
+    auto kind_at = [](uint16_t r) { return static_cast<int32_t>(r) * 8; };
+    auto payload_at = [](uint16_t r) { return static_cast<int32_t>(r) * 8 + 4; };
+
+    std::vector<size_t> labels(n, 0);
+    struct Fixup {
+      size_t at;
+      size_t target;
+    };
+    std::vector<Fixup> branch_fixups;
+    std::vector<size_t> error_fixups;
+    std::vector<size_t> exit_fixups;
+
+    auto emit_helper_call = [&](void *helper, const bytecode::RegisterInstruction *ip) {
+      e.mov(Reg::RDI, Reg::R12);
+      e.mov(Reg::RSI, Reg::R13);
+      e.mov_imm64(Reg::RDX, reinterpret_cast<uint64_t>(ip));
+      e.mov_imm64(Reg::RAX, reinterpret_cast<uint64_t>(helper));
+      e.call(Reg::RAX);
+    };
+    auto emit_step = [&](const bytecode::RegisterInstruction *ip) {
+      emit_helper_call(jit_step_for(unquickened(ip->op)), ip);
+      e.test(Reg::RAX, Reg::RAX);
+      error_fixups.push_back(e.jcc(Cond::E));
+      e.mov(Reg::RBX, Reg::RAX);
+    };
+    // Stores EAX as the payload of a `kind` value in register r. The value
+    // is written whole: a tag and a payload written separately would make
+    // the helpers' 8-byte loads of it wait for both stores to reach the
+    // cache, rather than forwarding them, which behind a store that missed
+    // the cache costs the loop its overlap. EAX is left as it was.
+    auto emit_store_eax = [&](uint16_t r, uint8_t kind) {
+      e.mov(Reg::RDX, Reg::RAX);
+      e.shl_imm(Reg::RDX, 32);
+      e.or_imm(Reg::RDX, kind);
+      e.store64(Reg::RBX, kind_at(r), Reg::RDX);
+    };
+    // Jumps to `slow` unless both source registers hold tagged integers.
+    auto emit_int_guard = [&](const bytecode::RegisterInstruction &in,
+                              std::vector<size_t> &slow) {
+      e.cmp_byte(Reg::RBX, kind_at(in.src1), kInt);
+      slow.push_back(e.jcc(Cond::NE));
+      e.cmp_byte(Reg::RBX, kind_at(in.src2), kInt);
+      slow.push_back(e.jcc(Cond::NE));
+    };
+
+    // Prologue: five pushes keep the stack 16-byte aligned for helper calls.
+    e.push(Reg::RBP);
+    e.push(Reg::RBX);
+    e.push(Reg::R12);
+    e.push(Reg::R13);
+    e.push(Reg::R14);
+    e.mov(Reg::R12, Reg::RDI);
+    e.mov(Reg::R13, Reg::RSI);
+    e.mov(Reg::RBX, Reg::RDX);
+    // Resuming after a call: jump to the instruction following it.
+    std::vector<uint8_t> is_entry(n + 1, 0);
+    for (size_t i = 0; i < n; ++i) {
+      if (unquickened(code[i].op) != Operation::Call) continue;
+      is_entry[i + 1] = 1;
+      e.cmp32_imm(Reg::RCX, static_cast<int32_t>(i + 1));
+      branch_fixups.push_back({e.jcc(Cond::E), i + 1});
+    }
+    // Entering from the interpreter at a loop header.
+    for (size_t i = 0; i < n; ++i) {
+      if (!detail::is_reg_branch(unquickened(code[i].op)) || code[i].imm > 0)
+        continue;
+      size_t header = static_cast<size_t>(static_cast<int64_t>(i) + code[i].imm);
+      if (header == 0 || is_entry[header]) continue;
+      is_entry[header] = 1;
+      e.cmp32_imm(Reg::RCX, static_cast<int32_t>(header));
+      branch_fixups.push_back({e.jcc(Cond::E), header});
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      labels[i] = e.size();
+      const auto &in = code[i];
+      // Typed operations take the integer fast path with no guard.
+      const bool typed = untyped(in.op) != in.op;
+      const Operation op = untyped(unquickened(in.op));
+      switch (op) {
+      case Operation::Add:
+      case Operation::Sub:
+      case Operation::Mul: {
+        std::vector<size_t> slow;
+        if (!typed) emit_int_guard(in, slow);
+        e.load32(Reg::RAX, Reg::RBX, payload_at(in.src1));
+        if (op == Operation::Add)
+          e.add32(Reg::RAX, Reg::RBX, payload_at(in.src2));
+        else if (op == Operation::Sub)
+          e.sub32(Reg::RAX, Reg::RBX, payload_at(in.src2));
+        else
+          e.imul32(Reg::RAX, Reg::RBX, payload_at(in.src2));
+        emit_store_eax(in.dst, kInt);
+        if (typed) break;
+        size_t done = e.jmp();
+        for (size_t at : slow) e.bind(at, e.size());
+        emit_step(&in);
+        e.bind(done, e.size());
+        break;
+      }
+      case Operation::Gt:
+      case Operation::Geq:
+      case Operation::Eq: {
+        std::vector<size_t> slow;
+        if (!typed) emit_int_guard(in, slow);
+        e.load32(Reg::RAX, Reg::RBX, payload_at(in.src1));
+        e.cmp32(Reg::RAX, Reg::RBX, payload_at(in.src2));
+        Cond c = op == Operation::Gt    ? Cond::G
+                 : op == Operation::Geq ? Cond::GE
+                                           : Cond::E;
+        e.setcc(c, Reg::RAX);
+        e.movzx8(Reg::RAX, Reg::RAX);
+        emit_store_eax(in.dst, kBool);
+        if (typed) break;
+        size_t done = e.jmp();
+        for (size_t at : slow) e.bind(at, e.size());
+        emit_step(&in);
+        e.bind(done, e.size());
+        break;
+      }
+      case Operation::AddImm:
+      case Operation::SubImm: {
+        e.cmp_byte(Reg::RBX, kind_at(in.src1), kInt);
+        size_t slow = e.jcc(Cond::NE);
+        e.load32(Reg::RAX, Reg::RBX, payload_at(in.src1));
+        if (op == Operation::AddImm)
+          e.add32_imm(Reg::RAX, in.imm);
+        else
+          e.sub32_imm(Reg::RAX, in.imm);
+        emit_store_eax(in.dst, kInt);
+        size_t done = e.jmp();
+        e.bind(slow, e.size());
+        emit_step(&in);
+        e.bind(done, e.size());
+        break;
+      }
+      case Operation::GtJump:
+      case Operation::GeqJump:
+      case Operation::EqJump: {
+        std::vector<size_t> slow;
+        emit_int_guard(in, slow);
+        e.load32(Reg::RAX, Reg::RBX, payload_at(in.src1));
+        e.cmp32(Reg::RAX, Reg::RBX, payload_at(in.src2));
+        Cond c;
+        if (op == Operation::GtJump)
+          c = in.dst ? Cond::LE : Cond::G;
+        else if (op == Operation::GeqJump)
+          c = in.dst ? Cond::L : Cond::GE;
+        else
+          c = in.dst ? Cond::NE : Cond::E;
+        branch_fixups.push_back({e.jcc(c), i + in.imm});
+        size_t done = e.jmp();
+        for (size_t at : slow) e.bind(at, e.size());
+        emit_helper_call(reinterpret_cast<void *>(&VM::jit_condition), &in);
+        e.test32(Reg::RAX, Reg::RAX);
+        error_fixups.push_back(e.jcc(Cond::S));
+        branch_fixups.push_back({e.jcc(Cond::NE), i + in.imm});
+        e.bind(done, e.size());
+        break;
+      }
+      case Operation::IncJumpLt:
+      case Operation::AddJumpLt: {
+        std::vector<size_t> slow;
+        e.cmp_byte(Reg::RBX, kind_at(in.dst), kInt);
+        slow.push_back(e.jcc(Cond::NE));
+        e.cmp_byte(Reg::RBX, kind_at(in.src1), kInt);
+        slow.push_back(e.jcc(Cond::NE));
+        e.load32(Reg::RAX, Reg::RBX, payload_at(in.dst));
+        if (op == Operation::IncJumpLt) {
+          e.add32_imm(Reg::RAX, static_cast<int16_t>(in.src2));
+        } else {
+          e.cmp_byte(Reg::RBX, kind_at(in.src2), kInt);
+          slow.push_back(e.jcc(Cond::NE));
+          e.add32(Reg::RAX, Reg::RBX, payload_at(in.src2));
+        }
+        emit_store_eax(in.dst, kInt);
+        e.cmp32(Reg::RAX, Reg::RBX, payload_at(in.src1));
+        branch_fixups.push_back({e.jcc(Cond::L), i + in.imm});
+        size_t done = e.jmp();
+        for (size_t at : slow) e.bind(at, e.size());
+        emit_helper_call(reinterpret_cast<void *>(&VM::jit_counted_loop), &in);
+        e.test32(Reg::RAX, Reg::RAX);
+        error_fixups.push_back(e.jcc(Cond::S));
+        branch_fixups.push_back({e.jcc(Cond::NE), i + in.imm});
+        e.bind(done, e.size());
+        break;
+      }
+      case Operation::IndexLoad:
+      case Operation::IndexStore: {
+        emit_helper_call(op == Operation::IndexLoad
+                             ? reinterpret_cast<void *>(&VM::jit_index_load)
+                             : reinterpret_cast<void *>(&VM::jit_index_store),
+                         &in);
+        e.test32(Reg::RAX, Reg::RAX);
+        size_t done = e.jcc(Cond::NE);
+        emit_step(&in);
+        e.bind(done, e.size());
+        break;
+      }
+      case Operation::LoadConst:
+        // Pools are fixed once translated and objects never move, so the
+        // constant is an immediate.
+        e.mov_imm64(Reg::RAX, constant_pools[func->constant_pool][in.imm].bits);
+        e.store64(Reg::RBX, kind_at(in.dst), Reg::RAX);
+        break;
+      case Operation::LoadLocal:
+      case Operation::Dup:
+        e.load64(Reg::RAX, Reg::RBX, kind_at(in.src1));
+        e.store64(Reg::RBX, kind_at(in.dst), Reg::RAX);
+        break;
+      case Operation::Goto:
+        branch_fixups.push_back({e.jmp(), i + in.imm});
+        break;
+      case Operation::If: {
+        e.cmp_byte(Reg::RBX, kind_at(in.src1), kBool);
+        size_t slow = e.jcc(Cond::NE);
+        e.cmp_byte(Reg::RBX, payload_at(in.src1), 0);
+        branch_fixups.push_back({e.jcc(Cond::NE), i + in.imm});
+        size_t done = e.jmp();
+        e.bind(slow, e.size());
+        emit_helper_call(reinterpret_cast<void *>(&VM::jit_condition), &in);
+        e.test32(Reg::RAX, Reg::RAX);
+        error_fixups.push_back(e.jcc(Cond::S));
+        branch_fixups.push_back({e.jcc(Cond::NE), i + in.imm});
+        e.bind(done, e.size());
+        break;
+      }
+      case Operation::CallGuard:
+        emit_helper_call(reinterpret_cast<void *>(&VM::jit_call_guard), &in);
+        e.test32(Reg::RAX, Reg::RAX);
+        branch_fixups.push_back({e.jcc(Cond::NE), i + in.imm});
+        break;
+      case Operation::Return:
+        emit_helper_call(reinterpret_cast<void *>(&VM::jit_return), &in);
+        e.mov_imm32(Reg::RAX, JitReturned);
+        exit_fixups.push_back(e.jmp());
+        break;
+      case Operation::Call:
+        emit_helper_call(reinterpret_cast<void *>(&VM::jit_suspend), &in);
+        e.mov_imm32(Reg::RAX, JitCall);
+        exit_fixups.push_back(e.jmp());
+        break;
+      case Operation::End:
+        e.mov_imm32(Reg::RAX, JitFellOff);
+        exit_fixups.push_back(e.jmp());
+        break;
+      default:
+        emit_step(&in);
+        break;
+      }
+    }
+
+    size_t error_label = e.size();
+    e.mov_imm32(Reg::RAX, JitError);
+
+    size_t exit_label = e.size();
+    e.pop(Reg::R14);
+    e.pop(Reg::R13);
+    e.pop(Reg::R12);
+    e.pop(Reg::RBX);
+    e.pop(Reg::RBP);
+    e.ret();
+
+    for (const auto &fx : branch_fixups) e.bind(fx.at, labels[fx.target]);
+    for (size_t at : error_fixups) e.bind(at, error_label);
+    for (size_t at : exit_fixups) e.bind(at, exit_label);
+
+    func->jit_code = jit_code_cache.install(e.code());
+#else
+    (void)func;
+#endif
+  }
+
+  // Runs `func` with its arguments already in registers
+  // [args_base, args_base + arg_count); they become the callee's parameter
+  // registers without being copied.
+  //
+  // MITScript calls made from register code do not recurse: the loop below
+  // pushes the callee's frame, switches to its code and picks the caller up
+  // again when it returns. A call whose result is returned straight away
+  // replaces the caller's frame instead. Only natives are run through
+  // exec_call. Compiled code suspends at each call so it can use the same
+  // frame stack.
+  TaggedValue execute_function_reg(bytecode::Function *func,
+                                   size_t args_base,
+                                   size_t arg_count,
+                                   FreeRefs free_refs) {
+    if (profiler)
+      return run_reg<true>(func, args_base, arg_count, free_refs);
+    return run_reg<false>(func, args_base, arg_count, free_refs);
+  }
+
+  // The loop of execute_function_reg, with the profiler's counting compiled
+  // in or out. The profiling copy is instantiated in vm/profiler.cpp: built
+  // alongside the other one it took enough of GCC's inlining budget to slow
+  // the normal loop down.
+  template <bool kProfiling>
+  TaggedValue run_reg(bytecode::Function *func, size_t args_base,
+                      size_t arg_count, FreeRefs free_refs) {
+    using bytecode::Operation;
+    static void *dispatch_table[] = {
+        &&op_LoadConstR,    // LoadConst
+        &&op_LoadFuncR,     // LoadFunc
+        &&op_LoadLocalR,    // LoadLocal (used as move)
+        &&op_StoreLocalR,   // StoreLocal (used as move)
+        &&op_LoadGlobalR,   // LoadGlobal
+        &&op_StoreGlobalR,  // StoreGlobal
+        &&op_PushReferenceR,// PushReference
+        &&op_LoadReferenceR,// LoadReference
+        &&op_StoreReferenceR,// StoreReference
+        &&op_AllocRecordR,  // AllocRecord
+        &&op_FieldLoadR,    // FieldLoad
+        &&op_FieldStoreR,   // FieldStore
+        &&op_IndexLoadR,    // IndexLoad
+        &&op_IndexStoreR,   // IndexStore
+        &&op_AllocClosureR, // AllocClosure
+        &&op_CallR,         // Call
+        &&op_ReturnR,       // Return
+        &&op_AddR,          // Add
+        &&op_SubR,          // Sub
+        &&op_MulR,          // Mul
+        &&op_DivR,          // Div
+        &&op_NegR,          // Neg
+        &&op_GtR,           // Gt
+        &&op_GeqR,          // Geq
+        &&op_EqR,           // Eq
+        &&op_AndR,          // And
+        &&op_OrR,           // Or
+        &&op_NotR,          // Not
+        &&op_GotoR,         // Goto
+        &&op_IfR,           // If
+        &&op_DupR,          // Dup (unused)
+        &&op_SwapR,         // Swap (unused)
+        &&op_PopR,          // Pop (unused)
+        &&op_FieldLoadSlotR,// FieldLoadSlot
+        &&op_FieldStoreSlotR,// FieldStoreSlot
+        &&op_AddIR,         // AddI
+        &&op_SubIR,         // SubI
+        &&op_MulIR,         // MulI
+        &&op_GtIR,          // GtI
+        &&op_GeqIR,         // GeqI
+        &&op_EqIR,          // EqI
+        &&op_GtJumpR,       // GtJump
+        &&op_GeqJumpR,      // GeqJump
+        &&op_EqJumpR,       // EqJump
+        &&op_AddImmR,       // AddImm
+        &&op_SubImmR,       // SubImm
+        &&op_IncJumpLtR,    // IncJumpLt
+        &&op_AddJumpLtR,    // AddJumpLt
+        &&op_CallGuardR,    // CallGuard
+        &&op_LoadFreeRefR,  // LoadFreeRef
+        &&op_NewReferenceR, // NewReference
+        &&op_AddIntR,       // AddInt
+        &&op_SubIntR,       // SubInt
+        &&op_MulIntR,       // MulInt
+        &&op_GtIntR,        // GtInt
+        &&op_GeqIntR,       // GeqInt
+        &&op_EqIntR,        // EqInt
+        &&op_GtJumpIntR,    // GtJumpInt
+        &&op_GeqJumpIntR,   // GeqJumpInt
+        &&op_EqJumpIntR,    // EqJumpInt
+        &&op_EndR           // End
+    };
+
+#ifdef MITSCRIPT_THREADED_DISPATCH
+    // Called with no function when the VM is made: records where each
+    // handler sits for thread_code. The profiling copy keeps dispatching
+    // through the table.
+    if constexpr (!kProfiling) {
+      if (!func) {
+        for (size_t i = 0; i < std::size(dispatch_table); ++i)
+          reg_handler_offsets[i] = static_cast<int32_t>(
+              static_cast<char *>(dispatch_table[i]) -
+              static_cast<char *>(&&op_LoadConstR));
+        return TaggedValue::none();
+      }
+    }
+#endif
+
+    auto it = native_functions.find(func);
+    if (it != native_functions.end()) {
+      return call_native(it->second, registers.data() + args_base, arg_count);
+    }
+
+    ensure_translated(func);
+
+    // Frames at or below this depth belong to our callers.
+    const size_t entry_depth = reg_depth;
+    Frame *frame = &push_reg_frame(func, args_base, arg_count, free_refs, nullptr);
+
+    // Describe the innermost frame; re-derived whenever it changes. regs is
+    // also re-derived after every call, which may grow the register file.
+    const bytecode::RegisterInstruction *code = nullptr;
+    const bytecode::RegisterInstruction *ip = nullptr;
+    TaggedValue *regs = nullptr;
+    uint32_t jit_resume = 0;
+    TaggedValue ret_val = TaggedValue::none();
+
+
+    // The profiling copy counts each instruction before running it.
+#ifdef MITSCRIPT_THREADED_DISPATCH
+#define DISPATCH_REG()                                                         \
+  do {                                                                         \
+    if constexpr (kProfiling) {                                                \
+      profiler->count(frame, frame->func, code, ip);                           \
+      goto *dispatch_table[static_cast<int>(ip->op)];                          \
+    }                                                                          \
+    goto *(static_cast<char *>(&&op_LoadConstR) + ip->handler);                \
+  } while (0)
+#else
+#define DISPATCH_REG()                                                         \
+  do {                                                                         \
+    if constexpr (kProfiling)                                                  \
+      profiler->count(frame, frame->func, code, ip);                           \
+    goto *dispatch_table[static_cast<int>(ip->op)];                            \
+  } while (0)
+#endif
+
+    if (resuming) [[unlikely]] {
+      // Continuing from a snapshot: main's frame gets back the registers it
+      // had at the input() call, which runs again. The restored objects
+      // were only reachable from resume_registers until now.
+      resuming = false;
+      std::copy(resume_registers.begin(), resume_registers.end(),
+                registers.begin() + frame->base);
+      std::vector<TaggedValue>().swap(resume_registers);
+      gc_deferred = false;
+      code = func->reg_instructions.data();
+      regs = registers.data() + frame->base;
+      ip = code + resume_pc;
+      DISPATCH_REG();
+    }
+
+  enter_frame:
+    func = frame->func;
+    if (tiering && !func->jit_code) {
+      uint32_t calls = ++func->call_count;
+      if (speculating && (calls == kSpeculateCallThreshold / 2 ||
+                          calls == kSpeculateCallThreshold))
+        speculate_calls(*frame, 0, calls < kSpeculateCallThreshold);
+    }
+    code = func->reg_instructions.data();
+    regs = registers.data() + frame->base;
+    ip = code;
+    if (jit_enabled) {
+      if (!func->jit_code && func->call_count == kJitCallThreshold)
+        goto compile;
+      if (func->jit_code) goto enter_jit;
+    }
+    DISPATCH_REG();
+
+  // A backward branch was taken with tiering on, and ip is its loop header.
+  // A hot loop moves the frame into compiled code there (see jit_compile),
+  // after speculate_calls has had its turn.
+  back_edge:
+    if (!func->jit_code) {
+      uint32_t edges = ++func->back_edge_count;
+      if (speculating && (edges == kSpeculateBackEdgeThreshold / 2 ||
+                          edges == kSpeculateBackEdgeThreshold)) {
+        size_t pc = speculate_calls(*frame, static_cast<size_t>(ip - code),
+                                    edges < kSpeculateBackEdgeThreshold);
+        code = func->reg_instructions.data();
+        regs = registers.data() + frame->base;
+        ip = code + pc;
+      }
+      if (jit_enabled && edges == kJitBackEdgeThreshold)
+        goto compile;
+    }
+    if (func->jit_code) goto enter_jit;
+    DISPATCH_REG();
+
+  // The one call site of jit_compile, which is too big to inline twice.
+  compile:
+    jit_compile(func);
+    if (!func->jit_code) DISPATCH_REG();
+  // Continues the frame in compiled code from ip, the function's entry or a
+  // loop header.
+  enter_jit:
+    frame->jit = true;
+    jit_resume = static_cast<uint32_t>(ip - code);
+
+  run_jit: {
+    auto entry = reinterpret_cast<JitEntry>(func->jit_code);
+    int status = entry(this, frame, regs, jit_resume);
+    if (status == JitError) {
+      std::exception_ptr error = std::move(jit_error);
+      jit_error = nullptr;
+      std::rethrow_exception(error);
+    }
+    if (status == JitReturned) {
+      ret_val = jit_ret;
+      goto function_return;
+    }
+    if (status == JitFellOff) goto function_fell_off;
+    // JitCall: perform the call the compiled code stopped at.
+    ip = code + frame->pc;
+    regs = registers.data() + frame->base;
+    goto op_CallR;
+  }
+
+  // The Call at ip has stored its result.
+  call_done:
+    ++ip;
+    if (frame->jit) {
+      jit_resume = static_cast<uint32_t>(ip - code);
+      goto run_jit;
+    }
+    DISPATCH_REG();
+
+  op_LoadConstR:
+    exec_load_const(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_LoadFuncR:
+    exec_load_func(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_LoadLocalR:
+    exec_move(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_StoreLocalR:
+    exec_store_local(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_LoadGlobalR:
+    exec_load_global(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_StoreGlobalR:
+    exec_store_global(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_PushReferenceR:
+    exec_push_reference(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_LoadReferenceR:
+    exec_load_reference(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_StoreReferenceR:
+    exec_store_reference(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_AllocRecordR:
+    exec_alloc_record(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_FieldLoadR:
+    exec_field_load(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_FieldStoreR:
+    exec_field_store(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_IndexLoadR:
+    exec_index_load(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_IndexStoreR:
+    exec_index_store(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_AllocClosureR:
+    exec_alloc_closure(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_AddR:
+    if (int_operands(regs, ip)) quicken(ip, Operation::AddInt);
+    exec_add(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_SubR:
+    if (int_operands(regs, ip)) quicken(ip, Operation::SubInt);
+    exec_sub(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_MulR:
+    if (int_operands(regs, ip)) quicken(ip, Operation::MulInt);
+    exec_mul(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_DivR:
+    exec_div(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_NegR:
+    exec_neg(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_GtR:
+    if (int_operands(regs, ip)) quicken(ip, Operation::GtInt);
+    exec_gt(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_GeqR:
+    if (int_operands(regs, ip)) quicken(ip, Operation::GeqInt);
+    exec_geq(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_EqR:
+    if (int_operands(regs, ip)) quicken(ip, Operation::EqInt);
+    exec_eq(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_AndR:
+    exec_and(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_OrR:
+    exec_or(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_NotR:
+    exec_not(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_GotoR: {
+    const int32_t offset = ip->imm;
+    ip += offset;
+    VM_CHECK_VERIFIED(ip >= code && ip < code + func->reg_instructions.size(),
+                      "Goto: target out of range");
+    if (offset <= 0 && tiering) goto back_edge;
+    DISPATCH_REG();
+  }
+
+  op_IfR: {
+    if (branch_condition(regs[ip->src1])) {
+      const int32_t offset = ip->imm;
+      ip += offset;
+      if (offset <= 0 && tiering) goto back_edge;
+    } else {
+      ++ip;
+    }
+    DISPATCH_REG();
+  }
+
+  op_CallR: {
+    TaggedValue callee_tv = regs[ip->src1];
+    if (callee_tv.kind() != TaggedValue::Kind::HeapPtr)
+      throw IllegalCastException("Expected callable");
+    Value *callee = callee_tv.as_ptr();
+    bytecode::Function *target;
+    FreeRefs target_refs;
+    if (callee->tag == Value::Type::Closure) {
+      target = static_cast<Closure *>(callee)->function;
+      target_refs = static_cast<Closure *>(callee)->free_var_refs();
+    } else if (callee->tag == Value::Type::Function) {
+      target = static_cast<Function *>(callee)->func;
+    } else {
+      throw IllegalCastException("Expected closure or function");
+    }
+
+    if (!runs_in_reg_loop(target)) {
+      frame->pc = static_cast<size_t>(ip - code);
+      exec_call(*frame, regs, ip);
+      regs = registers.data() + frame->base;
+      goto call_done;
+    }
+    ensure_translated(target);
+
+    size_t args_base = frame->base + ip->src2;
+    size_t arg_count = static_cast<size_t>(ip->imm);
+    const bytecode::RegisterInstruction *next = ip + 1;
+    if (next->op == Operation::Return && next->src1 == ip->dst) {
+      // Tail call: the callee takes over this frame's register window.
+      size_t base = frame->base;
+      std::copy(registers.begin() + args_base,
+                registers.begin() + args_base + arg_count,
+                registers.begin() + base);
+      pop_reg_frame(*frame);
+      frame = &push_reg_frame(target, base, arg_count, target_refs, callee);
+    } else {
+      frame->pc = static_cast<size_t>(ip - code);
+      frame = &push_reg_frame(target, args_base, arg_count, target_refs, callee);
+    }
+    goto enter_frame;
+  }
+
+  op_DupR:
+    exec_dup(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_SwapR:
+    exec_swap(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_PopR:
+    exec_pop(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_FieldLoadSlotR:
+    exec_field_load_slot(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_FieldStoreSlotR:
+    exec_field_store_slot(*frame, regs, ip);
+    ++ip;
+    DISPATCH_REG();
+
+  op_AddIR:
+    regs[ip->dst] = TaggedValue::from_int(regs[ip->src1].as_int() + regs[ip->src2].as_int());
+    ++ip;
+    DISPATCH_REG();
+
+  op_SubIR:
+    regs[ip->dst] = TaggedValue::from_int(regs[ip->src1].as_int() - regs[ip->src2].as_int());
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_FieldStoreR: {
-    TaggedValue val_tv = frame.locals[ip->src1];
-    TaggedValue rec_tv = frame.locals[ip->src2];
-    if (rec_tv.kind != TaggedValue::Kind::HeapPtr ||
-        rec_tv.ptr->tag != Value::Type::Record)
-      throw IllegalCastException("Expected record");
-    auto rec = static_cast<Record *>(rec_tv.ptr);
-    size_t idx = static_cast<size_t>(ip->imm);
-    if (idx >= func->names_.size()) {
-      throw RuntimeException("FieldStore: name index out of range");
-    }
-    const std::string &field = func->names_[idx];
-    Value *boxed = box_tagged(val_tv);
-    rec->fields[field] = boxed;
-    heap.write_barrier(rec, boxed);
+  op_MulIR:
+    regs[ip->dst] = TaggedValue::from_int(regs[ip->src1].as_int() * regs[ip->src2].as_int());
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_IndexLoadR: {
-    TaggedValue rec_tv = frame.locals[ip->src1];
-    TaggedValue idx_tv = frame.locals[ip->src2];
-    if (rec_tv.kind != TaggedValue::Kind::HeapPtr ||
-        rec_tv.ptr->tag != Value::Type::Record)
-      throw IllegalCastException("Expected record");
-    auto rec = static_cast<Record *>(rec_tv.ptr);
-    TaggedValue result = TaggedValue::none();
-    if (!record_try_dense_load(rec, idx_tv, result)) {
-      result = record_map_load(rec, idx_tv);
-    }
-    frame.locals[ip->dst] = result;
+  op_GtIR:
+    regs[ip->dst] = TaggedValue::from_bool(regs[ip->src1].as_int() > regs[ip->src2].as_int());
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_IndexStoreR: {
-    TaggedValue val_tv = frame.locals[ip->src1];
-    TaggedValue idx_tv = frame.locals[ip->src2];
-    TaggedValue rec_tv = frame.locals[ip->dst];
-    if (rec_tv.kind != TaggedValue::Kind::HeapPtr ||
-        rec_tv.ptr->tag != Value::Type::Record)
-      throw IllegalCastException("Expected record");
-    auto rec = static_cast<Record *>(rec_tv.ptr);
-    if (!record_try_dense_store(rec, idx_tv, val_tv)) {
-      record_map_store(rec, idx_tv, val_tv);
-    }
+  op_GeqIR:
+    regs[ip->dst] = TaggedValue::from_bool(regs[ip->src1].as_int() >= regs[ip->src2].as_int());
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_AllocClosureR: {
-    int32_t free_count = ip->imm;
-    temp_refs_local.clear();
-    temp_refs_local.reserve(free_count);
-    for (int i = 0; i < free_count; ++i) {
-      TaggedValue tv = frame.locals[ip->src1 + i];
-      if (tv.kind != TaggedValue::Kind::HeapPtr ||
-          tv.ptr->tag != Value::Type::Reference)
-        throw IllegalCastException("Expected reference");
-      temp_refs_local.push_back(tv.ptr);
-    }
-    TaggedValue func_tv = frame.locals[ip->src2];
-    if (func_tv.kind != TaggedValue::Kind::HeapPtr ||
-        func_tv.ptr->tag != Value::Type::Function)
-      throw IllegalCastException("Expected function");
-    auto f = static_cast<Function *>(func_tv.ptr);
-    Value *closure_val = allocate<Closure>(f->func, temp_refs_local);
-    for (Value *ref : temp_refs_local) {
-      heap.write_barrier(closure_val, ref);
-    }
-    frame.locals[ip->dst] = TaggedValue::from_heap(closure_val);
+  op_EqIR:
+    regs[ip->dst] = TaggedValue::from_bool(regs[ip->src1].as_int() == regs[ip->src2].as_int());
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_AddR: {
-    TaggedValue left = frame.locals[ip->src1];
-    TaggedValue right = frame.locals[ip->src2];
+  op_GtJumpR:
+    if (int_operands(regs, ip)) quicken(ip, Operation::GtJumpInt);
+    if (compare_gt(regs[ip->src1], regs[ip->src2]) != (ip->dst != 0)) {
+      const int32_t offset = ip->imm;
+      ip += offset;
+      if (offset <= 0 && tiering) goto back_edge;
+    } else {
+      ++ip;
+    }
+    DISPATCH_REG();
 
-    auto is_string = [](const TaggedValue &tv) {
-      return tv.kind == TaggedValue::Kind::HeapPtr &&
-             tv.ptr->tag == Value::Type::String;
-    };
+  op_GeqJumpR:
+    if (int_operands(regs, ip)) quicken(ip, Operation::GeqJumpInt);
+    if (compare_geq(regs[ip->src1], regs[ip->src2]) != (ip->dst != 0)) {
+      const int32_t offset = ip->imm;
+      ip += offset;
+      if (offset <= 0 && tiering) goto back_edge;
+    } else {
+      ++ip;
+    }
+    DISPATCH_REG();
 
-    if ((left.kind == TaggedValue::Kind::Integer ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Integer)) &&
-        (right.kind == TaggedValue::Kind::Integer ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Integer))) {
-      auto li = get_int(left);
-      auto ri = get_int(right);
-      frame.locals[ip->dst] = TaggedValue::from_int(li + ri);
-    } else if (is_string(left) || is_string(right)) {
-      frame.locals[ip->dst] = TaggedValue::from_heap(
-          allocate<String>(tagged_to_string(left) + tagged_to_string(right)));
+  op_EqJumpR:
+    if (int_operands(regs, ip)) quicken(ip, Operation::EqJumpInt);
+    if (values_equal(regs[ip->src1], regs[ip->src2]) != (ip->dst != 0)) {
+      const int32_t offset = ip->imm;
+      ip += offset;
+      if (offset <= 0 && tiering) goto back_edge;
     } else {
-      throw IllegalCastException("Invalid operand types for add");
+      ++ip;
     }
+    DISPATCH_REG();
 
+  op_AddImmR:
+    exec_add_imm(*frame, regs, ip);
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_SubR: {
-    TaggedValue left = frame.locals[ip->src1];
-    TaggedValue right = frame.locals[ip->src2];
-    if ((left.kind == TaggedValue::Kind::Integer ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Integer)) &&
-        (right.kind == TaggedValue::Kind::Integer ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Integer))) {
-      auto li = get_int(left);
-      auto ri = get_int(right);
-      frame.locals[ip->dst] = TaggedValue::from_int(li - ri);
-    } else {
-      throw IllegalCastException("Invalid operand types for subtract");
-    }
+  op_SubImmR:
+    exec_sub_imm(*frame, regs, ip);
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_MulR: {
-    TaggedValue left = frame.locals[ip->src1];
-    TaggedValue right = frame.locals[ip->src2];
-    if ((left.kind == TaggedValue::Kind::Integer ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Integer)) &&
-        (right.kind == TaggedValue::Kind::Integer ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Integer))) {
-      auto li = get_int(left);
-      auto ri = get_int(right);
-      frame.locals[ip->dst] = TaggedValue::from_int(li * ri);
+  op_IncJumpLtR: {
+    TaggedValue &counter = regs[ip->dst];
+    bool taken;
+    if (counter.kind() == TaggedValue::Kind::Integer &&
+        regs[ip->src1].kind() == TaggedValue::Kind::Integer) {
+      counter = TaggedValue::from_int(counter.as_int() + static_cast<int16_t>(ip->src2));
+      taken = counter.as_int() < regs[ip->src1].as_int();
     } else {
-      throw IllegalCastException("Invalid operand types for multiply");
+      taken = exec_counted_loop(*frame, regs, ip);
+    }
+    if (taken) {
+      const int32_t offset = ip->imm;
+      ip += offset;
+      if (offset <= 0 && tiering) goto back_edge;
+      DISPATCH_REG();
     }
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
   }
 
-  op_DivR: {
-    TaggedValue left = frame.locals[ip->src1];
-    TaggedValue right = frame.locals[ip->src2];
-    if ((left.kind == TaggedValue::Kind::Integer ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Integer)) &&
-        (right.kind == TaggedValue::Kind::Integer ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Integer))) {
-      auto li = get_int(left);
-      auto ri = get_int(right);
-      if (ri == 0) throw IllegalArithmeticException("Division by zero");
-      frame.locals[ip->dst] = TaggedValue::from_int(li / ri);
+  op_AddJumpLtR: {
+    TaggedValue &counter = regs[ip->dst];
+    bool taken;
+    if (counter.kind() == TaggedValue::Kind::Integer &&
+        regs[ip->src1].kind() == TaggedValue::Kind::Integer &&
+        regs[ip->src2].kind() == TaggedValue::Kind::Integer) {
+      counter = TaggedValue::from_int(counter.as_int() + regs[ip->src2].as_int());
+      taken = counter.as_int() < regs[ip->src1].as_int();
     } else {
-      throw IllegalCastException("Invalid operand types for divide");
+      taken = exec_counted_loop(*frame, regs, ip);
+    }
+    if (taken) {
+      const int32_t offset = ip->imm;
+      ip += offset;
+      if (offset <= 0 && tiering) goto back_edge;
+      DISPATCH_REG();
     }
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
   }
 
-  op_NegR: {
-    TaggedValue left = frame.locals[ip->src1];
-    if (left.kind == TaggedValue::Kind::Integer ||
-        (left.kind == TaggedValue::Kind::HeapPtr &&
-         left.ptr->tag == Value::Type::Integer)) {
-      auto li = get_int(left);
-      frame.locals[ip->dst] = TaggedValue::from_int(-li);
-    } else {
-      throw IllegalCastException("Invalid operand types for negate");
-    }
+  op_CallGuardR:
+    ip += call_guard_passes(*frame, regs, ip) ? 1 : ip->imm;
+    DISPATCH_REG();
+
+  op_LoadFreeRefR:
+    exec_load_free_ref(*frame, regs, ip);
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_GtR: {
-    TaggedValue left = frame.locals[ip->src1];
-    TaggedValue right = frame.locals[ip->src2];
-    if ((left.kind == TaggedValue::Kind::Integer ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Integer)) &&
-        (right.kind == TaggedValue::Kind::Integer ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Integer))) {
-      frame.locals[ip->dst] = TaggedValue::from_bool(get_int(left) > get_int(right));
-    } else {
-      throw IllegalCastException("Invalid operand types for greater than");
-    }
+  op_NewReferenceR:
+    exec_new_reference(*frame, regs, ip);
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_GeqR: {
-    TaggedValue left = frame.locals[ip->src1];
-    TaggedValue right = frame.locals[ip->src2];
-    if ((left.kind == TaggedValue::Kind::Integer ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Integer)) &&
-        (right.kind == TaggedValue::Kind::Integer ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Integer))) {
-      frame.locals[ip->dst] = TaggedValue::from_bool(get_int(left) >= get_int(right));
-    } else {
-      throw IllegalCastException("Invalid operand types for greater or equal");
+  op_AddIntR:
+    if (!int_operands(regs, ip)) {
+      quicken(ip, Operation::Add);
+      goto op_AddR;
     }
+    regs[ip->dst] = TaggedValue::from_int(regs[ip->src1].as_int() + regs[ip->src2].as_int());
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_EqR: {
-    TaggedValue left = frame.locals[ip->src1];
-    TaggedValue right = frame.locals[ip->src2];
-    frame.locals[ip->dst] = TaggedValue::from_bool(values_equal(left, right));
+  op_SubIntR:
+    if (!int_operands(regs, ip)) {
+      quicken(ip, Operation::Sub);
+      goto op_SubR;
+    }
+    regs[ip->dst] = TaggedValue::from_int(regs[ip->src1].as_int() - regs[ip->src2].as_int());
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_AndR: {
-    TaggedValue left = frame.locals[ip->src1];
-    TaggedValue right = frame.locals[ip->src2];
-    if ((left.kind == TaggedValue::Kind::Boolean ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Boolean)) &&
-        (right.kind == TaggedValue::Kind::Boolean ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Boolean))) {
-      frame.locals[ip->dst] = TaggedValue::from_bool(get_bool(left) && get_bool(right));
-    } else {
-      throw IllegalCastException("Invalid operand types for and");
+  op_MulIntR:
+    if (!int_operands(regs, ip)) {
+      quicken(ip, Operation::Mul);
+      goto op_MulR;
     }
+    regs[ip->dst] = TaggedValue::from_int(regs[ip->src1].as_int() * regs[ip->src2].as_int());
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_OrR: {
-    TaggedValue left = frame.locals[ip->src1];
-    TaggedValue right = frame.locals[ip->src2];
-    if ((left.kind == TaggedValue::Kind::Boolean ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Boolean)) &&
-        (right.kind == TaggedValue::Kind::Boolean ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Boolean))) {
-      frame.locals[ip->dst] = TaggedValue::from_bool(get_bool(left) || get_bool(right));
-    } else {
-      throw IllegalCastException("Invalid operand types for or");
+  op_GtIntR:
+    if (!int_operands(regs, ip)) {
+      quicken(ip, Operation::Gt);
+      goto op_GtR;
     }
+    regs[ip->dst] = TaggedValue::from_bool(regs[ip->src1].as_int() > regs[ip->src2].as_int());
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_NotR: {
-    TaggedValue val = frame.locals[ip->src1];
-    if (val.kind == TaggedValue::Kind::Boolean ||
-        (val.kind == TaggedValue::Kind::HeapPtr &&
-         val.ptr->tag == Value::Type::Boolean)) {
-      frame.locals[ip->dst] = TaggedValue::from_bool(!get_bool(val));
-    } else {
-      throw IllegalCastException("Invalid operand types for not");
+  op_GeqIntR:
+    if (!int_operands(regs, ip)) {
+      quicken(ip, Operation::Geq);
+      goto op_GeqR;
     }
+    regs[ip->dst] = TaggedValue::from_bool(regs[ip->src1].as_int() >= regs[ip->src2].as_int());
     ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_GotoR: {
-    ip += ip->imm;
-    if (ip < instructions.data() || ip >= end) {
-      throw RuntimeException("Goto: target out of range");
+  op_EqIntR:
+    if (!int_operands(regs, ip)) {
+      quicken(ip, Operation::Eq);
+      goto op_EqR;
     }
+    regs[ip->dst] = TaggedValue::from_bool(regs[ip->src1].as_int() == regs[ip->src2].as_int());
+    ++ip;
     DISPATCH_REG();
-  }
 
-  op_IfR: {
-    TaggedValue cond = frame.locals[ip->src1];
-    if (cond.kind != TaggedValue::Kind::Boolean &&
-        !(cond.kind == TaggedValue::Kind::HeapPtr &&
-          cond.ptr->tag == Value::Type::Boolean))
-      throw IllegalCastException("Invalid operand types for if");
-    if (get_bool(cond)) {
-      ip += ip->imm;
+  op_GtJumpIntR:
+    if (!int_operands(regs, ip)) {
+      quicken(ip, Operation::GtJump);
+      goto op_GtJumpR;
+    }
+    if ((regs[ip->src1].as_int() > regs[ip->src2].as_int()) != (ip->dst != 0)) {
+      const int32_t offset = ip->imm;
+      ip += offset;
+      if (offset <= 0 && tiering) goto back_edge;
     } else {
       ++ip;
     }
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
-
-  op_CallR: {
-    uint16_t dst = ip->dst;
-    uint16_t callee_reg = ip->src1;
-    uint16_t arg_start = ip->src2;
-    int32_t arg_count = ip->imm;
 
-    TaggedValue callee_tv = frame.locals[callee_reg];
-    if (callee_tv.kind != TaggedValue::Kind::HeapPtr)
-      throw IllegalCastException("Expected callable");
-
-    Value *callee = callee_tv.ptr;
-    temp_args_local.clear();
-    temp_args_local.reserve(arg_count);
-    for (int i = 0; i < arg_count; ++i) {
-      temp_args_local.push_back(frame.locals[arg_start + i]);
+  op_GeqJumpIntR:
+    if (!int_operands(regs, ip)) {
+      quicken(ip, Operation::GeqJump);
+      goto op_GeqJumpR;
     }
-
-    TaggedValue result;
-    if (callee->tag == Value::Type::Closure) {
-      auto closure = static_cast<Closure *>(callee);
-      result = execute_function(closure->function, temp_args_local, closure->free_var_refs);
-    } else if (callee->tag == Value::Type::Function) {
-      auto func_ptr_local = static_cast<Function *>(callee);
-      result = execute_function(func_ptr_local->func, temp_args_local, {});
+    if ((regs[ip->src1].as_int() >= regs[ip->src2].as_int()) != (ip->dst != 0)) {
+      const int32_t offset = ip->imm;
+      ip += offset;
+      if (offset <= 0 && tiering) goto back_edge;
     } else {
-      throw IllegalCastException("Expected closure or function");
+      ++ip;
     }
-    frame.locals[dst] = result;
-
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
-    DISPATCH_REG();
-  }
-
-  op_DupR: {
-    frame.locals[ip->dst] = frame.locals[ip->src1];
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
     DISPATCH_REG();
-  }
 
-  op_SwapR: {
-    std::swap(frame.locals[ip->dst], frame.locals[ip->src1]);
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
+  op_EqJumpIntR:
+    if (!int_operands(regs, ip)) {
+      quicken(ip, Operation::EqJump);
+      goto op_EqJumpR;
+    }
+    if ((regs[ip->src1].as_int() == regs[ip->src2].as_int()) != (ip->dst != 0)) {
+      const int32_t offset = ip->imm;
+      ip += offset;
+      if (offset <= 0 && tiering) goto back_edge;
+    } else {
+      ++ip;
+    }
     DISPATCH_REG();
-  }
 
-  op_PopR: {
-    frame.locals[ip->dst] = TaggedValue::none();
-    ++ip;
-    if (ip == end) goto function_epilogue_reg;
-    DISPATCH_REG();
-  }
+  op_ReturnR:
+    ret_val = regs[ip->src1];
+    goto function_return;
 
-  op_ReturnR: {
-    ret_val = frame.locals[ip->src1];
-    returned = true;
-    goto function_epilogue_reg;
-  }
+  op_EndR:
 
-  function_epilogue_reg:
-    call_stack.pop_back();
-    bool is_main = call_stack.empty();
-    if (!returned && !func->instructions.empty()) {
-      if (is_main) {
-        return TaggedValue::none();
-      }
+  function_fell_off:
+    // call_stack still holds this frame, so main is the only frame left.
+    if (!func->instructions.empty() && call_stack.size() != 1) {
       throw RuntimeException("Function must end with a return statement");
     }
-    return ret_val;
+    ret_val = TaggedValue::none();
+
+  function_return:
+    pop_reg_frame(*frame);
+    if (reg_depth == entry_depth) {
+      return ret_val;
+    }
+    frame = reg_frames[reg_depth - 1].get();
+    func = frame->func;
+    code = func->reg_instructions.data();
+    ip = code + frame->pc;
+    regs = registers.data() + frame->base;
+    regs[ip->dst] = ret_val;
+    goto call_done;
 
 #undef DISPATCH_REG
   }
 
+  // A string value: a SmallString when the text fits, else a new String.
+  TaggedValue make_string(std::string_view text) {
+    if (text.size() <= TaggedValue::kSmallMax)
+      return TaggedValue::from_small(text);
+    return TaggedValue::from_heap(allocate<String>(text));
+  }
+
+  String *intern_string(const std::string &text) {
+    auto it = interned_strings.find(text);
+    if (it != interned_strings.end())
+      return it->second;
+    String *s = allocate<String>(text);
+    s->interned = true;
+    interned_strings.emplace(text, s);
+    constant_roots.push_back(s);
+    return s;
+  }
+
   // Convert bytecode constant to runtime value
   TaggedValue constant_to_tagged(bytecode::Constant *c) {
     auto it = constant_cache.find(c);
@@ -1536,7 +4171,9 @@ private:
     } else if (auto ic = dynamic_cast<bytecode::Constant::Integer *>(c)) {
       return TaggedValue::from_int(static_cast<int32_t>(ic->value));
     } else if (auto sc = dynamic_cast<bytecode::Constant::String *>(c)) {
-      Value *v = allocate<String>(sc->value);
+      if (sc->value.size() <= TaggedValue::kSmallMax)
+        return TaggedValue::from_small(sc->value);
+      Value *v = intern_string(sc->value);
       constant_cache[c] = v;
       return TaggedValue::from_heap(v);
     } else if (auto bc = dynamic_cast<bytecode::Constant::Boolean *>(c)) {
@@ -1545,92 +4182,239 @@ private:
     throw IllegalCastException("Unknown constant type");
   }
 
-  Value *call_native(int func_id, const std::vector<TaggedValue> &args) {
+  TaggedValue call_native(int func_id, const std::vector<TaggedValue> &args) {
+    return call_native(func_id, args.data(), args.size());
+  }
+
+  TaggedValue call_native(int func_id, const TaggedValue *args, size_t arg_count) {
     if (func_id == 0) { // print
-      if (args.size() != 1)
+      if (arg_count != 1)
         throw RuntimeException("print expects 1 argument");
       print_value(args[0]);
-      std::cout << std::endl;
-      return none_singleton;
+      output.put('\n');
+      return TaggedValue::none();
     } else if (func_id == 1) { // input
-      std::string line;
-      std::getline(std::cin, line);
-      return allocate<String>(line);
+      output.flush();
+      if (snapshot_hook)
+        take_snapshot();
+      return make_string(input.read_line());
     } else if (func_id == 2) { // intcast
-      if (args.size() != 1)
+      if (arg_count != 1)
         throw RuntimeException("intcast expects 1 argument");
       const TaggedValue &arg = args[0];
-      if (arg.kind == TaggedValue::Kind::HeapPtr &&
-          arg.ptr->tag == Value::Type::String) {
-        auto s = static_cast<String *>(arg.ptr);
-        try {
-          int32_t val = std::atoi(s->value.c_str());
-          return allocate<Integer>(val);
-        } catch (...) {
-          throw IllegalCastException("Cannot cast string to int");
-        }
+      if (arg.kind() == TaggedValue::Kind::SmallString)
+        return TaggedValue::from_int(parse_int(arg.small_text()));
+      if (arg.kind() == TaggedValue::Kind::HeapPtr &&
+          arg.as_ptr()->tag == Value::Type::String) {
+        auto s = static_cast<String *>(arg.as_ptr());
+        return TaggedValue::from_int(parse_int(s->str()));
       }
       throw IllegalCastException("Cannot cast to int");
     }
     throw UninitializedVariableException("Unknown native function");
   }
 
+  // What atoi gives for text: leading whitespace, an optional sign and
+  // the longest run of digits, 0 when there are none. Out-of-range values
+  // saturate to a long and are truncated to 32 bits, as atoi does.
+  static int32_t parse_int(std::string_view text) {
+    size_t i = 0;
+    while (i < text.size() && (text[i] == ' ' || (text[i] >= '\t' && text[i] <= '\r')))
+      ++i;
+    bool negative = false;
+    if (i < text.size() && (text[i] == '+' || text[i] == '-'))
+      negative = text[i++] == '-';
+    const uint64_t limit = negative ? uint64_t{1} << 63 : (uint64_t{1} << 63) - 1;
+    uint64_t magnitude = 0;
+    for (; i < text.size() && text[i] >= '0' && text[i] <= '9'; ++i) {
+      unsigned digit = static_cast<unsigned>(text[i] - '0');
+      magnitude = magnitude > (limit - digit) / 10 ? limit : magnitude * 10 + digit;
+    }
+    uint64_t bits = negative ? uint64_t{0} - magnitude : magnitude;
+    return static_cast<int32_t>(static_cast<uint32_t>(bits));
+  }
+
+  // Hands the VM to snapshot_hook, once. Only top-level code is snapshotted:
+  // its frame is then the only one, which is all save_snapshot can save.
+  // input() called from inside a function leaves the run unsaved.
+  void take_snapshot() {
+    auto hook = std::move(snapshot_hook);
+    snapshot_hook = nullptr;
+    output.record(nullptr);
+    if (reg_depth == 1 && call_stack.size() == 1)
+      hook(*this);
+    snapshot_output.clear();
+  }
+
+  // Rebuilds the heap, globals and main's frame from `state` (defined in
+  // vm/snapshot.cpp). Throws SnapshotError when the state does not fit the
+  // program.
+  void restore_snapshot(std::string_view state);
+
   void print_value(Value *v) {
-    std::cout << v->toString();
+    v->write_to(output.data());
+    output.maybe_flush();
   }
   void print_value(const TaggedValue &tv) {
-    std::cout << tagged_to_string(tv);
+    write_tagged(output.data(), tv);
+    output.maybe_flush();
   }
 
-  void maybe_gc() {
-    // Collect root set: globals + all stack frames' locals + all operand stacks
-    std::vector<Collectable *> roots;
-
-    // Add globals
-    for (auto &[name, val] : globals) {
-      if (val.kind == TaggedValue::Kind::HeapPtr && val.ptr)
-        roots.push_back(val.ptr);
+  // Calls visit(root) for every root, in place: globals, constant pools
+  // and interned strings, the singletons, and each frame's registers,
+  // callee and operand stack.
+  template <typename Visit> void visit_roots(Visit &&visit) {
+    for (const TaggedValue &val : globals) {
+      if (val.kind() == TaggedValue::Kind::HeapPtr)
+        visit(val.as_ptr());
     }
+    for (Value *root : constant_roots) visit(root);
+    visit(none_singleton);
+    visit(bool_true_singleton);
+    visit(bool_false_singleton);
+
+    for (size_t depth = 0; depth < call_stack.size(); ++depth) {
+      Frame *frame = call_stack[depth];
+      Frame *callee = depth + 1 < call_stack.size() ? call_stack[depth + 1]
+                                                    : nullptr;
+      visit(frame->callee);
+      visit_frame_registers(*frame, callee, visit);
+      for (size_t i = 0; i < frame->sp; ++i) {
+        if (frame->stack[i].kind() == TaggedValue::Kind::HeapPtr)
+          visit(frame->stack[i].as_ptr());
+      }
+    }
+  }
 
-    // Cached constants
-    for (auto &[c, val] : constant_cache) {
-      if (val)
-        roots.push_back(val);
+  // A frame below the innermost one is suspended at the Call at its pc, and
+  // only the registers live across that Call (see compute_call_liveness)
+  // are roots. The innermost frame's position is known only to the loop
+  // running it, so all of its registers are scanned.
+  //
+  // A dead register is cleared rather than just skipped: once its frame is
+  // innermost again it is scanned in full, and must not hold a pointer to
+  // an object this collection frees. Windows overlap from the callee's base
+  // up, where a register may be one of the callee's; those are left alone
+  // and always scanned.
+  template <typename Visit>
+  void visit_frame_registers(const Frame &frame, const Frame *callee,
+                             Visit &visit) {
+    TaggedValue *regs = registers.data() + frame.base;
+    const bytecode::Function &func = *frame.func;
+    const uint64_t *live = nullptr;
+    if (callee && frame.pc < func.call_live_map.size() &&
+        func.call_live_map[frame.pc] != bytecode::Function::kNoLiveMap)
+      live = func.call_live_maps.data() + func.call_live_map[frame.pc];
+    size_t owned = live ? std::min(frame.size, callee->base - frame.base) : 0;
+    for (size_t r = 0; r < frame.size; ++r) {
+      if (regs[r].kind() != TaggedValue::Kind::HeapPtr)
+        continue;
+      if (r < owned && !(live[r / 64] >> (r % 64) & 1)) {
+        regs[r] = TaggedValue::none();
+        continue;
+      }
+      visit(regs[r].as_ptr());
     }
+  }
 
-    // Add singletons as roots
-    if (none_singleton) roots.push_back(none_singleton);
-    if (bool_true_singleton) roots.push_back(bool_true_singleton);
-    if (bool_false_singleton) roots.push_back(bool_false_singleton);
+  void maybe_gc() {
+    auto roots = [this](auto &&visit) {
+      visit_roots(visit);
+    };
+    GcStats::Pause pause(gc_stats_path.empty() ? nullptr : &gc_stats);
+    gc_stats.note_heap(heap.live_bytes());
 
-    // Add all locals from all frames in call stack
-    for (Frame *frame : call_stack) {
-      for (const TaggedValue &local : frame->locals) {
-        if (local.kind == TaggedValue::Kind::HeapPtr && local.ptr)
-          roots.push_back(local.ptr);
-      }
+    if (heap.marking()) {
+      gc_cycle_bytes += curr_heap_bytes;
+      if (gc_cycle_bytes >= heap_budget / 4 || heap.mark_for(gc_pause))
+        finish_gc_cycle();
+      return;
+    }
 
-      // Add operand stack contents
-      for (size_t i = 0; i < frame->sp; ++i) {
-        if (frame->stack[i].kind == TaggedValue::Kind::HeapPtr &&
-            frame->stack[i].ptr)
-          roots.push_back(frame->stack[i].ptr);
+    // Run GC: first try minor GC (generational collection)
+    heap.minor_gc(roots);
+
+    // If the old generation leaves too little room, run full GC
+    if (heap.live_bytes() + heap_budget / 8 > heap_budget) {
+      if (gc_pause.count() == 0) {
+        heap.full_gc(roots);
+      } else {
+        heap.start_incremental_mark(roots);
+        gc_cycle_bytes = 0;
+        gc_check_bytes = std::min(kGcStepBytes, heap_budget);
+        if (heap.mark_for(gc_pause))
+          finish_gc_cycle();
+        return;
       }
+    }
+    schedule_next_gc(curr_heap_bytes);
+  }
 
-      // Add reference objects
-      for (auto &[name, ref] : frame->local_refs) {
-        if (ref)
-          roots.push_back(ref);
-      }
+  // Sets how much may be allocated before the next collection, given that
+  // `allocated` bytes were allocated since the previous one.
+  void schedule_next_gc(size_t allocated) {
+    size_t live = heap.live_bytes();
+    size_t survived = live > live_after_gc ? live - live_after_gc : 0;
+    if (allocated > 0) {
+      double rate = static_cast<double>(survived) / allocated;
+      if (rate > 0.5)
+        gc_growth = std::min(gc_growth * 2, kMaxGcGrowth);
+      else if (rate < 0.1)
+        gc_growth = std::max(gc_growth / 2, 1.0);
     }
+    live_after_gc = live;
 
-    // Run GC: first try minor GC (generational collection)
-    heap.minor_gc(roots.begin(), roots.end());
+    size_t room = heap_budget > live ? heap_budget - live : 0;
+    size_t next = static_cast<size_t>(static_cast<double>(live) * gc_growth);
+    next = std::min(std::max(next, heap_budget / 8), room);
+    gc_check_bytes = std::max(next, kMinGcInterval);
+  }
+
+  void finish_gc_cycle() {
+    heap.finish_incremental_mark(
+        [this](auto &&visit) { visit_roots(visit); });
+    schedule_next_gc(gc_cycle_bytes);
+  }
+
+  void write_heap_profile() {
+    if (!heap_profile)
+      return;
+    // Objects the last collection found dead leave the profile first.
+    heap.finish_sweep();
+    std::ofstream out(heap_profile_path);
+    if (!out)
+      std::cerr << "cannot write heap profile to " << heap_profile_path
+                << "\n";
+    else
+      heap_profile->write(out);
+  }
+
+  void write_profile() {
+    if (!profiler)
+      return;
+    if (profile_path == "-") {
+      profiler->write(std::cerr);
+      return;
+    }
+    std::ofstream out(profile_path);
+    if (!out)
+      std::cerr << "cannot write profile to " << profile_path << "\n";
+    else
+      profiler->write(out);
+  }
 
-    // If memory is still above threshold after minor GC, run full GC
-    if (heap.get_allocated_bytes() >= max_heap_bytes) {
-      heap.full_gc(roots.begin(), roots.end());
+  void write_gc_stats() {
+    if (gc_stats_path.empty())
+      return;
+    if (gc_stats_path == "-") {
+      gc_stats.write_json(std::cerr, max_heap_bytes, heap_budget);
+      return;
     }
+    std::ofstream out(gc_stats_path);
+    if (!out)
+      std::cerr << "cannot write GC stats to " << gc_stats_path << "\n";
+    else
+      gc_stats.write_json(out, max_heap_bytes, heap_budget);
   }
 
   // helper function for optimization execute_function
@@ -1650,61 +4434,46 @@ private:
 
   TaggedValue execute_function(bytecode::Function *func,
                           const std::vector<TaggedValue> &args,
-                          const std::vector<Value *> &free_refs) {
+                          FreeRefs free_refs) {
+    if (native_functions.find(func) == native_functions.end())
+      ensure_translated(func);
     if (!func->reg_instructions.empty()) {
-      return execute_function_reg(func, args, free_refs);
+      size_t args_base = register_top;
+      reserve_registers(args_base + args.size());
+      std::copy(args.begin(), args.end(), registers.begin() + args_base);
+      return execute_function_reg(func, args_base, args.size(), free_refs);
     }
     // Handle native functions - if this function is a native function, call it
     auto it = native_functions.find(func);
     if (it != native_functions.end()) {
-      return tagged_from_value(call_native(it->second, args));
+      return call_native(it->second, args);
     }
 
     if (args.size() != func->parameter_count_) {
       throw RuntimeException("Argument count mismatch");
     }
 
-    Frame frame(func->local_vars_.size(), func, &free_refs);
-    call_stack.push_back(&frame);
+    Frame frame(func, free_refs);
+    push_frame(frame, register_top, 0,
+               func->local_vars_.size() + func->local_reference_vars_.size());
+    frame.stack.reserve(256);
 
     // Initialize parameters
     for (size_t i = 0; i < args.size(); ++i) {
-      frame.locals[i] = args[i];
+      local_at(frame, i) = args[i];
     }
 
     // Create references for local_reference_vars
-    for (const auto &var_name : func->local_reference_vars_) {
-      auto it_ref = std::find(func->local_vars_.begin(), func->local_vars_.end(),
-                          var_name);
-      if (it_ref != func->local_vars_.end()) {
-        size_t var_idx = std::distance(func->local_vars_.begin(), it_ref);
-
-        // Get initial value (parameter value, or None if not a parameter)
-        TaggedValue initial_val = frame.locals[var_idx];
-        Value *boxed_initial = box_tagged(initial_val);
-
-        // Create a Reference pointing to this value
-        Value *ref = allocate<Reference>(boxed_initial);
-
-        // Store reference for PushReference
-        frame.local_refs[var_name] = ref;
-
-        // Mark this local as a reference variable
-        frame.ref_locals.insert(var_idx);
-
-        // Store the value in the local slot (same as ref->cell)
-        frame.locals[var_idx] = initial_val;
-      }
-    }
+    init_local_refs(frame);
 
     using bytecode::Operation;
 
     auto *func_ptr = func;
-    const std::vector<Value *> &free_refs_local = free_refs;
+    FreeRefs free_refs_local = free_refs;
     auto &instructions = func_ptr->instructions;
 
     if (instructions.empty()) {
-      call_stack.pop_back();
+      pop_frame(frame);
       bool is_main = call_stack.empty();
       if (!is_main) {
         throw RuntimeException("Function must end with a return statement");
@@ -1754,7 +4523,15 @@ private:
       &&op_If,
       &&op_Dup,
       &&op_Swap,
-      &&op_Pop
+      &&op_Pop,
+      &&op_FieldLoadSlot,
+      &&op_FieldStoreSlot,
+      &&op_Add,           // AddI: the stack interpreter checks anyway
+      &&op_Sub,           // SubI
+      &&op_Mul,           // MulI
+      &&op_Gt,            // GtI
+      &&op_Geq,           // GeqI
+      &&op_Eq             // EqI
     };
 
 #define DISPATCH() goto *dispatch_table[static_cast<int>(ip->operation)]
@@ -1789,10 +4566,10 @@ private:
 
   op_LoadLocal: {
     size_t idx = ip->operand0.value();
-    if (idx >= frame.locals.size()) {
+    if (idx >= frame.ref_base) {
       throw RuntimeException("LoadLocal: local variable index out of range");
     }
-    TaggedValue local = frame.locals[idx];
+    TaggedValue local = local_at(frame, idx);
     push(frame, local);
 
     ++ip;
@@ -1802,26 +4579,20 @@ private:
 
   op_StoreLocal: {
     size_t idx = ip->operand0.value();
-    if (idx >= frame.locals.size()) {
+    if (idx >= frame.ref_base) {
       throw RuntimeException("StoreLocal: local variable index out of range");
     }
     TaggedValue val = pop(frame);
-    if (frame.ref_locals.find(idx) != frame.ref_locals.end()) {
-      if (idx >= func_ptr->local_vars_.size()) {
-        throw RuntimeException(
-            "StoreLocal: local variable name index out of range");
-      }
-      const std::string &var_name = func_ptr->local_vars_[idx];
-      auto ref_it = frame.local_refs.find(var_name);
-      if (ref_it != frame.local_refs.end()) {
-        auto ref = static_cast<Reference *>(ref_it->second);
-        ref->cell = box_tagged(val);
-        heap.write_barrier(ref, ref->cell);
-      }
-      frame.locals[idx] = val;
-    } else {
-      frame.locals[idx] = val;
+    const auto &ref_regs = func_ptr->ref_registers;
+    auto ref_it = std::find(ref_regs.begin(), ref_regs.end(),
+                            static_cast<int32_t>(idx));
+    if (ref_it != ref_regs.end()) {
+      size_t ref_slot = frame.ref_base + std::distance(ref_regs.begin(), ref_it);
+      auto ref = static_cast<Reference *>(local_at(frame, ref_slot).as_ptr());
+      ref->value = val;
+      write_barrier_tagged(ref, val);
     }
+    local_at(frame, idx) = val;
 
     ++ip;
     if (ip == end) goto function_epilogue;
@@ -1834,11 +4605,11 @@ private:
       throw RuntimeException("LoadGlobal: name index out of range");
     }
     const std::string &name = func_ptr->names_[idx];
-    auto global_it = globals.find(name);
-    if (global_it == globals.end()) {
+    const TaggedValue &g = globals[intern_global(name)];
+    if (is_undefined_global(g)) {
       throw UninitializedVariableException("Undefined global: " + name);
     }
-    push(frame, global_it->second);
+    push(frame, g);
 
     ++ip;
     if (ip == end) goto function_epilogue;
@@ -1851,8 +4622,7 @@ private:
       throw RuntimeException("StoreGlobal: name index out of range");
     }
     TaggedValue v = pop(frame);
-    const std::string &name = func_ptr->names_[idx];
-    globals[name] = v;
+    globals[intern_global(func_ptr->names_[idx])] = v;
 
     ++ip;
     if (ip == end) goto function_epilogue;
@@ -1864,8 +4634,7 @@ private:
     Value *ref;
 
     if (idx < static_cast<int32_t>(func_ptr->local_reference_vars_.size())) {
-      const std::string &var_name = func_ptr->local_reference_vars_[idx];
-      ref = frame.local_refs[var_name];
+      ref = local_at(frame, frame.ref_base + idx).as_ptr();
     } else {
       int32_t free_idx = idx - func_ptr->local_reference_vars_.size();
       if (free_idx < 0 ||
@@ -1884,11 +4653,11 @@ private:
 
   op_LoadReference: {
     TaggedValue ref_val = pop(frame);
-    if (ref_val.kind != TaggedValue::Kind::HeapPtr ||
-        ref_val.ptr->tag != Value::Type::Reference)
+    if (ref_val.kind() != TaggedValue::Kind::HeapPtr ||
+        ref_val.as_ptr()->tag != Value::Type::Reference)
       throw IllegalCastException("Expected reference");
-    auto ref = static_cast<Reference *>(ref_val.ptr);
-    push(frame, tagged_from_value(ref->cell));
+    auto ref = static_cast<Reference *>(ref_val.as_ptr());
+    push(frame, ref->value);
 
     ++ip;
     if (ip == end) goto function_epilogue;
@@ -1898,42 +4667,41 @@ private:
   op_StoreReference: {
     TaggedValue val = pop(frame);
     TaggedValue ref_val = pop(frame);
-    if (ref_val.kind != TaggedValue::Kind::HeapPtr ||
-        ref_val.ptr->tag != Value::Type::Reference)
+    if (ref_val.kind() != TaggedValue::Kind::HeapPtr ||
+        ref_val.as_ptr()->tag != Value::Type::Reference)
       throw IllegalCastException("Expected reference");
-    auto ref = static_cast<Reference *>(ref_val.ptr);
-    ref->cell = box_tagged(val);
-    heap.write_barrier(ref, ref->cell);
+    auto ref = static_cast<Reference *>(ref_val.as_ptr());
+    ref->value = val;
+    write_barrier_tagged(ref, val);
 
     ++ip;
     if (ip == end) goto function_epilogue;
     DISPATCH();
   }
 
-  op_AllocRecord:
-    push(frame, TaggedValue::from_heap(allocate<Record>()));
+  op_AllocRecord: {
+    Record *rec = allocate<Record>(shapes.root());
+    if (ip->operand0.value_or(0) > 0)
+      reserve_slots(rec, static_cast<size_t>(ip->operand0.value()));
+    push(frame, TaggedValue::from_heap(rec));
 
     ++ip;
     if (ip == end) goto function_epilogue;
     DISPATCH();
+  }
 
   op_FieldLoad: {
     TaggedValue rec_val = pop(frame);
-    if (rec_val.kind != TaggedValue::Kind::HeapPtr ||
-        rec_val.ptr->tag != Value::Type::Record)
+    if (rec_val.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_val.as_ptr()->tag != Value::Type::Record)
       throw IllegalCastException("Expected record");
-    auto rec = static_cast<Record *>(rec_val.ptr);
+    auto rec = static_cast<Record *>(rec_val.as_ptr());
     size_t idx = ip->operand0.value();
     if (idx >= func_ptr->names_.size()) {
       throw RuntimeException("FieldLoad: name index out of range");
     }
-    const std::string &field = func_ptr->names_[idx];
-    auto field_it = rec->fields.find(field);
-    if (field_it == rec->fields.end()) {
-      push(frame, TaggedValue::none());
-    } else {
-      push(frame, tagged_from_value(field_it->second));
-    }
+    const TaggedValue *field_val = rec->find_named(func_ptr->names_[idx]);
+    push(frame, field_val ? *field_val : TaggedValue::none());
 
     ++ip;
     if (ip == end) goto function_epilogue;
@@ -1943,18 +4711,15 @@ private:
   op_FieldStore: {
     TaggedValue val = pop(frame);
     TaggedValue rec_val = pop(frame);
-    if (rec_val.kind != TaggedValue::Kind::HeapPtr ||
-        rec_val.ptr->tag != Value::Type::Record)
+    if (rec_val.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_val.as_ptr()->tag != Value::Type::Record)
       throw IllegalCastException("Expected record");
-    auto rec = static_cast<Record *>(rec_val.ptr);
+    auto rec = static_cast<Record *>(rec_val.as_ptr());
     size_t idx = ip->operand0.value();
     if (idx >= func_ptr->names_.size()) {
       throw RuntimeException("FieldStore: name index out of range");
     }
-    const std::string &field = func_ptr->names_[idx];
-    Value *boxed = box_tagged(val);
-    rec->fields[field] = boxed;
-    heap.write_barrier(rec, boxed);
+    record_store_named(rec, func_ptr->names_[idx], val);
 
     ++ip;
     if (ip == end) goto function_epilogue;
@@ -1964,13 +4729,13 @@ private:
   op_IndexLoad: {
     TaggedValue idx_val = pop(frame);
     TaggedValue rec_val = pop(frame);
-    if (rec_val.kind != TaggedValue::Kind::HeapPtr ||
-        rec_val.ptr->tag != Value::Type::Record)
+    if (rec_val.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_val.as_ptr()->tag != Value::Type::Record)
       throw IllegalCastException("Expected record");
-    auto rec = static_cast<Record *>(rec_val.ptr);
+    auto rec = static_cast<Record *>(rec_val.as_ptr());
 
     TaggedValue result = TaggedValue::none();
-    if (!record_try_dense_load(rec, idx_val, result)) {
+    if (!record_try_element_load(rec, idx_val, result)) {
       result = record_map_load(rec, idx_val);
     }
     push(frame, result);
@@ -1984,12 +4749,12 @@ private:
     TaggedValue val = pop(frame);
     TaggedValue idx_val = pop(frame);
     TaggedValue rec_val = pop(frame);
-    if (rec_val.kind != TaggedValue::Kind::HeapPtr ||
-        rec_val.ptr->tag != Value::Type::Record)
+    if (rec_val.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_val.as_ptr()->tag != Value::Type::Record)
       throw IllegalCastException("Expected record");
-    auto rec = static_cast<Record *>(rec_val.ptr);
+    auto rec = static_cast<Record *>(rec_val.as_ptr());
 
-    if (!record_try_dense_store(rec, idx_val, val)) {
+    if (!record_try_element_store(rec, idx_val, val)) {
       record_map_store(rec, idx_val, val);
     }
 
@@ -2004,25 +4769,28 @@ private:
     temp_refs.reserve(free_count);
     for (int i = 0; i < free_count; ++i) {
       TaggedValue tv = pop(frame);
-      if (tv.kind != TaggedValue::Kind::HeapPtr ||
-          tv.ptr->tag != Value::Type::Reference)
+      if (tv.kind() != TaggedValue::Kind::HeapPtr ||
+          tv.as_ptr()->tag != Value::Type::Reference)
         throw IllegalCastException("Expected reference");
-      temp_refs.push_back(tv.ptr);
+      temp_refs.push_back(tv.as_ptr());
     }
     std::reverse(temp_refs.begin(), temp_refs.end());
 
     TaggedValue func_val = pop(frame);
-    if (func_val.kind != TaggedValue::Kind::HeapPtr ||
-        func_val.ptr->tag != Value::Type::Function)
+    if (func_val.kind() != TaggedValue::Kind::HeapPtr ||
+        func_val.as_ptr()->tag != Value::Type::Function)
       throw IllegalCastException("Expected function");
-    auto f = static_cast<Function *>(func_val.ptr);
+    auto f = static_cast<Function *>(func_val.as_ptr());
 
     for (Value *ref : temp_refs) {
       push(frame, TaggedValue::from_heap(ref));
     }
     push(frame, func_val);
 
-    Value *closure_val = allocate<Closure>(f->func, temp_refs);
+    Closure *closure_val = allocate_sized<Closure>(
+        Closure::size_for(temp_refs.size()), f->func,
+        static_cast<uint32_t>(temp_refs.size()));
+    std::copy(temp_refs.begin(), temp_refs.end(), closure_val->free_var_slots());
 
     pop(frame); // Remove duplicate func
     for (size_t i = 0; i < temp_refs.size(); ++i) {
@@ -2046,14 +4814,14 @@ private:
 
     TaggedValue closure_val = pop(frame);
 
-    if (closure_val.kind == TaggedValue::Kind::HeapPtr &&
-        closure_val.ptr->tag == Value::Type::Closure) {
-      auto closure = static_cast<Closure *>(closure_val.ptr);
+    if (closure_val.kind() == TaggedValue::Kind::HeapPtr &&
+        closure_val.as_ptr()->tag == Value::Type::Closure) {
+      auto closure = static_cast<Closure *>(closure_val.as_ptr());
       push(frame,
-           execute_function(closure->function, temp_args, closure->free_var_refs));
-    } else if (closure_val.kind == TaggedValue::Kind::HeapPtr &&
-               closure_val.ptr->tag == Value::Type::Function) {
-      auto func_ptr_local = static_cast<Function *>(closure_val.ptr);
+           execute_function(closure->function, temp_args, closure->free_var_refs()));
+    } else if (closure_val.kind() == TaggedValue::Kind::HeapPtr &&
+               closure_val.as_ptr()->tag == Value::Type::Function) {
+      auto func_ptr_local = static_cast<Function *>(closure_val.as_ptr());
       push(frame, execute_function(func_ptr_local->func, temp_args, {}));
     } else {
       throw IllegalCastException("Expected closure or function");
@@ -2078,23 +4846,17 @@ private:
     TaggedValue right = pop(frame);
     TaggedValue left = pop(frame);
 
-    auto is_string = [](const TaggedValue &tv) {
-      return tv.kind == TaggedValue::Kind::HeapPtr &&
-             tv.ptr->tag == Value::Type::String;
-    };
-
-    if ((left.kind == TaggedValue::Kind::Integer ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Integer)) &&
-        (right.kind == TaggedValue::Kind::Integer ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Integer))) {
+    if ((left.kind() == TaggedValue::Kind::Integer ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Integer)) &&
+        (right.kind() == TaggedValue::Kind::Integer ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Integer))) {
       auto li = get_int(left);
       auto ri = get_int(right);
       push(frame, TaggedValue::from_int(li + ri));
     } else if (is_string(left) || is_string(right)) {
-      push(frame, TaggedValue::from_heap(
-                      allocate<String>(tagged_to_string(left) + tagged_to_string(right))));
+      push(frame, make_string(tagged_to_string(left) + tagged_to_string(right)));
     } else {
       throw IllegalCastException("Invalid operand types for add");
     }
@@ -2107,12 +4869,12 @@ private:
   op_Sub: {
     TaggedValue right = pop(frame);
     TaggedValue left = pop(frame);
-    if ((left.kind == TaggedValue::Kind::Integer ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Integer)) &&
-        (right.kind == TaggedValue::Kind::Integer ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Integer))) {
+    if ((left.kind() == TaggedValue::Kind::Integer ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Integer)) &&
+        (right.kind() == TaggedValue::Kind::Integer ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Integer))) {
       auto li = get_int(left);
       auto ri = get_int(right);
       push(frame, TaggedValue::from_int(li - ri));
@@ -2128,12 +4890,12 @@ private:
   op_Mul: {
     TaggedValue right = pop(frame);
     TaggedValue left = pop(frame);
-    if ((left.kind == TaggedValue::Kind::Integer ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Integer)) &&
-        (right.kind == TaggedValue::Kind::Integer ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Integer))) {
+    if ((left.kind() == TaggedValue::Kind::Integer ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Integer)) &&
+        (right.kind() == TaggedValue::Kind::Integer ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Integer))) {
       auto li = get_int(left);
       auto ri = get_int(right);
       push(frame, TaggedValue::from_int(li * ri));
@@ -2149,12 +4911,12 @@ private:
   op_Div: {
     TaggedValue right = pop(frame);
     TaggedValue left = pop(frame);
-    if ((left.kind == TaggedValue::Kind::Integer ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Integer)) &&
-        (right.kind == TaggedValue::Kind::Integer ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Integer))) {
+    if ((left.kind() == TaggedValue::Kind::Integer ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Integer)) &&
+        (right.kind() == TaggedValue::Kind::Integer ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Integer))) {
       auto li = get_int(left);
       auto ri = get_int(right);
       if (ri == 0)
@@ -2171,9 +4933,9 @@ private:
 
   op_Neg: {
     TaggedValue left = pop(frame);
-    if (left.kind == TaggedValue::Kind::Integer ||
-        (left.kind == TaggedValue::Kind::HeapPtr &&
-         left.ptr->tag == Value::Type::Integer)) {
+    if (left.kind() == TaggedValue::Kind::Integer ||
+        (left.kind() == TaggedValue::Kind::HeapPtr &&
+         left.as_ptr()->tag == Value::Type::Integer)) {
       auto li = get_int(left);
       push(frame, TaggedValue::from_int(-li));
     } else {
@@ -2188,12 +4950,12 @@ private:
   op_Gt: {
     TaggedValue right = pop(frame);
     TaggedValue left = pop(frame);
-    if ((left.kind == TaggedValue::Kind::Integer ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Integer)) &&
-        (right.kind == TaggedValue::Kind::Integer ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Integer))) {
+    if ((left.kind() == TaggedValue::Kind::Integer ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Integer)) &&
+        (right.kind() == TaggedValue::Kind::Integer ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Integer))) {
       auto li = get_int(left);
       auto ri = get_int(right);
       push(frame, TaggedValue::from_bool(li > ri));
@@ -2209,12 +4971,12 @@ private:
   op_Geq: {
     TaggedValue right = pop(frame);
     TaggedValue left = pop(frame);
-    if ((left.kind == TaggedValue::Kind::Integer ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Integer)) &&
-        (right.kind == TaggedValue::Kind::Integer ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Integer))) {
+    if ((left.kind() == TaggedValue::Kind::Integer ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Integer)) &&
+        (right.kind() == TaggedValue::Kind::Integer ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Integer))) {
       auto li = get_int(left);
       auto ri = get_int(right);
       push(frame, TaggedValue::from_bool(li >= ri));
@@ -2241,12 +5003,12 @@ private:
   op_And: {
     TaggedValue right = pop(frame);
     TaggedValue left = pop(frame);
-    if ((left.kind == TaggedValue::Kind::Boolean ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Boolean)) &&
-        (right.kind == TaggedValue::Kind::Boolean ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Boolean))) {
+    if ((left.kind() == TaggedValue::Kind::Boolean ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Boolean)) &&
+        (right.kind() == TaggedValue::Kind::Boolean ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Boolean))) {
       auto lb = get_bool(left);
       auto rb = get_bool(right);
       push(frame, TaggedValue::from_bool(lb && rb));
@@ -2262,12 +5024,12 @@ private:
   op_Or: {
     TaggedValue right = pop(frame);
     TaggedValue left = pop(frame);
-    if ((left.kind == TaggedValue::Kind::Boolean ||
-         (left.kind == TaggedValue::Kind::HeapPtr &&
-          left.ptr->tag == Value::Type::Boolean)) &&
-        (right.kind == TaggedValue::Kind::Boolean ||
-         (right.kind == TaggedValue::Kind::HeapPtr &&
-          right.ptr->tag == Value::Type::Boolean))) {
+    if ((left.kind() == TaggedValue::Kind::Boolean ||
+         (left.kind() == TaggedValue::Kind::HeapPtr &&
+          left.as_ptr()->tag == Value::Type::Boolean)) &&
+        (right.kind() == TaggedValue::Kind::Boolean ||
+         (right.kind() == TaggedValue::Kind::HeapPtr &&
+          right.as_ptr()->tag == Value::Type::Boolean))) {
       auto lb = get_bool(left);
       auto rb = get_bool(right);
       push(frame, TaggedValue::from_bool(lb || rb));
@@ -2282,9 +5044,9 @@ private:
 
   op_Not: {
     TaggedValue left = pop(frame);
-    if (left.kind == TaggedValue::Kind::Boolean ||
-        (left.kind == TaggedValue::Kind::HeapPtr &&
-         left.ptr->tag == Value::Type::Boolean)) {
+    if (left.kind() == TaggedValue::Kind::Boolean ||
+        (left.kind() == TaggedValue::Kind::HeapPtr &&
+         left.as_ptr()->tag == Value::Type::Boolean)) {
       auto lb = get_bool(left);
       push(frame, TaggedValue::from_bool(!lb));
     } else {
@@ -2307,9 +5069,9 @@ private:
 
   op_If: {
     TaggedValue cond = pop(frame);
-    if (cond.kind != TaggedValue::Kind::Boolean &&
-        !(cond.kind == TaggedValue::Kind::HeapPtr &&
-          cond.ptr->tag == Value::Type::Boolean))
+    if (cond.kind() != TaggedValue::Kind::Boolean &&
+        !(cond.kind() == TaggedValue::Kind::HeapPtr &&
+          cond.as_ptr()->tag == Value::Type::Boolean))
       throw IllegalCastException("Invalid operand types for if");
 
     if (get_bool(cond)) {
@@ -2350,8 +5112,55 @@ private:
     if (ip == end) goto function_epilogue;
     DISPATCH();
 
+  op_FieldLoadSlot: {
+    TaggedValue rec_val = pop(frame);
+    if (rec_val.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_val.as_ptr()->tag != Value::Type::Record)
+      throw IllegalCastException("Expected record");
+    auto rec = static_cast<Record *>(rec_val.as_ptr());
+    size_t slot = static_cast<size_t>(ip->operand1.value_or(-1));
+    if (rec->shape && slot < rec->slots.size()) {
+      push(frame, rec->slots[slot]);
+    } else {
+      size_t idx = ip->operand0.value();
+      if (idx >= func_ptr->names_.size()) {
+        throw RuntimeException("FieldLoad: name index out of range");
+      }
+      const TaggedValue *field_val = rec->find_named(func_ptr->names_[idx]);
+      push(frame, field_val ? *field_val : TaggedValue::none());
+    }
+
+    ++ip;
+    if (ip == end) goto function_epilogue;
+    DISPATCH();
+  }
+
+  op_FieldStoreSlot: {
+    TaggedValue val = pop(frame);
+    TaggedValue rec_val = pop(frame);
+    if (rec_val.kind() != TaggedValue::Kind::HeapPtr ||
+        rec_val.as_ptr()->tag != Value::Type::Record)
+      throw IllegalCastException("Expected record");
+    auto rec = static_cast<Record *>(rec_val.as_ptr());
+    size_t slot = static_cast<size_t>(ip->operand1.value_or(-1));
+    if (rec->shape && slot < rec->slots.size()) {
+      rec->slots[slot] = val;
+      write_barrier_tagged(rec, val);
+    } else {
+      size_t idx = ip->operand0.value();
+      if (idx >= func_ptr->names_.size()) {
+        throw RuntimeException("FieldStore: name index out of range");
+      }
+      record_store_named(rec, func_ptr->names_[idx], val);
+    }
+
+    ++ip;
+    if (ip == end) goto function_epilogue;
+    DISPATCH();
+  }
+
   function_epilogue:
-    call_stack.pop_back();
+    pop_frame(frame);
 
     bool is_main = call_stack.empty();
     if (!returned_flag) {
@@ -2377,19 +5186,19 @@ private:
 
   bool values_equal(const TaggedValue &left, const TaggedValue &right) {
     auto is_none = [](const TaggedValue &tv) {
-      return tv.kind == TaggedValue::Kind::None ||
-             (tv.kind == TaggedValue::Kind::HeapPtr &&
-              tv.ptr->tag == Value::Type::None);
+      return tv.kind() == TaggedValue::Kind::None ||
+             (tv.kind() == TaggedValue::Kind::HeapPtr &&
+              tv.as_ptr()->tag == Value::Type::None);
     };
     auto is_bool = [](const TaggedValue &tv) {
-      return tv.kind == TaggedValue::Kind::Boolean ||
-             (tv.kind == TaggedValue::Kind::HeapPtr &&
-              tv.ptr->tag == Value::Type::Boolean);
+      return tv.kind() == TaggedValue::Kind::Boolean ||
+             (tv.kind() == TaggedValue::Kind::HeapPtr &&
+              tv.as_ptr()->tag == Value::Type::Boolean);
     };
     auto is_int = [](const TaggedValue &tv) {
-      return tv.kind == TaggedValue::Kind::Integer ||
-             (tv.kind == TaggedValue::Kind::HeapPtr &&
-              tv.ptr->tag == Value::Type::Integer);
+      return tv.kind() == TaggedValue::Kind::Integer ||
+             (tv.kind() == TaggedValue::Kind::HeapPtr &&
+              tv.as_ptr()->tag == Value::Type::Integer);
     };
 
     if (is_none(left) && is_none(right))
@@ -2398,45 +5207,167 @@ private:
       return get_int(left) == get_int(right);
     if (is_bool(left) && is_bool(right))
       return get_bool(left) == get_bool(right);
+    if (left.kind() == TaggedValue::Kind::SmallString ||
+        right.kind() == TaggedValue::Kind::SmallString) {
+      // A String is never as short as a SmallString (make_string).
+      return left.bits == right.bits;
+    }
 
-    if (left.kind == TaggedValue::Kind::HeapPtr &&
-        right.kind == TaggedValue::Kind::HeapPtr) {
-      if (left.ptr->tag != right.ptr->tag)
+    if (left.kind() == TaggedValue::Kind::HeapPtr &&
+        right.kind() == TaggedValue::Kind::HeapPtr) {
+      if (left.as_ptr()->tag != right.as_ptr()->tag)
         return false;
-      switch (left.ptr->tag) {
-      case Value::Type::String:
-        return static_cast<String *>(left.ptr)->value ==
-               static_cast<String *>(right.ptr)->value;
+      switch (left.as_ptr()->tag) {
+      case Value::Type::String: {
+        auto *ls = static_cast<String *>(left.as_ptr());
+        auto *rs = static_cast<String *>(right.as_ptr());
+        if (ls == rs)
+          return true;
+        if (ls->interned && rs->interned)
+          return false;
+        return ls->size() == rs->size() && ls->str() == rs->str();
+      }
       case Value::Type::Record:
       case Value::Type::Function:
       case Value::Type::Closure:
       case Value::Type::Reference:
-        return left.ptr == right.ptr;
+        return left.as_ptr() == right.as_ptr();
       case Value::Type::None:
         return true;
       case Value::Type::Boolean:
       case Value::Type::Integer:
         // Should be covered above, but keep for completeness.
-        return values_equal(tagged_from_value(left.ptr),
-                            tagged_from_value(right.ptr));
+        return values_equal(tagged_from_value(left.as_ptr()),
+                            tagged_from_value(right.as_ptr()));
       }
     }
     return false;
   }
 
 public:
+  // Enables the baseline JIT for hot functions (-O jit).
+  void set_jit_enabled(bool enabled) { jit_enabled = enabled; }
+
+  // Inlines predicted calls in register code (-O inline).
+  void set_inlining(bool enabled) { inlining_enabled = enabled; }
+
+  // Bounds each incremental mark step (--gc-pause-us); 0 disables
+  // incremental marking.
+  void set_gc_pause_us(size_t us) { gc_pause = std::chrono::microseconds(us); }
+
+  // Threads used to trace during full and minor collections (--gc-threads).
+  void set_gc_threads(size_t n) { heap.set_mark_threads(n); }
+
+  // Sweeps dead objects on a background thread (--gc-background-sweep).
+  void set_gc_background_sweep(bool on) { heap.set_background_sweep(on); }
+
+  // Writes a sampled allocation profile to `path` when the program ends
+  // (--heap-profile; see HeapProfiler); an empty path turns it off.
+  void set_heap_profile(const std::string &path) {
+    heap_profile_path = path;
+    if (path.empty()) {
+      heap.set_free_hook(nullptr, nullptr);
+      heap_profile.reset();
+      return;
+    }
+    heap_profile = std::make_unique<HeapProfiler>();
+    heap.set_free_hook(&VM::forget_freed, heap_profile.get());
+  }
+
+  // Runs the program with `input_fd` as its stdin and `output_fd` as its
+  // stdout, or with its output appended to `capture` when that is set.
+  // Batch runs use this to give each VM its own streams.
+  void set_stdio(int input_fd, int output_fd, std::string *capture = nullptr) {
+    input.set_fd(input_fd);
+    if (capture)
+      output.capture(capture);
+    else
+      output.set_fd(output_fd);
+  }
+
+  // Writes an execution profile to `path` ("-" for stderr) when the program
+  // ends (-O profile / --profile; see Profiler); an empty path turns it
+  // off. Compiled code is not counted, so profiling also keeps the JIT off.
+  void set_profile(const std::string &path) {
+    profile_path = path;
+    if (path.empty())
+      profiler.reset();
+    else
+      profiler = std::make_unique<Profiler>();
+  }
+
+  // Dumps collector telemetry as JSON to `path` ("-" for stderr) when the
+  // program ends (--gc-stats); an empty path turns it off.
+  void set_gc_stats(const std::string &path) {
+    gc_stats_path = path;
+    heap.set_stats(path.empty() ? nullptr : &gc_stats);
+  }
+
+  // Charges translation, execution and collection to their phases in
+  // `counters` (--perf-counters; nullptr turns it off). The caller owns
+  // them and writes the report.
+  void set_perf_counters(PerfCounters *counters) {
+    perf_counters = counters;
+    heap.set_perf_counters(counters);
+  }
+
   explicit VM(size_t max_mem_mb = 10000)
-      : max_heap_bytes(max_mem_mb * 1024 * 1024) {
+      : max_heap_bytes(max_mem_mb * 1024 * 1024),
+        heap_budget(max_heap_bytes / 100 * kHeapBudgetPercent) {
+    gc_check_bytes = heap_budget / 8;
+    // Collections only run from maybe_gc, between instructions; leave dead
+    // objects for the allocator to destroy as it reuses their pages.
+    heap.set_lazy_sweep(true);
     // Bypass allocate wrapper to avoid premature GC before roots are known.
     none_singleton = heap.allocate<None>();
     bool_true_singleton = heap.allocate<Boolean>(true);
     bool_false_singleton = heap.allocate<Boolean>(false);
+#ifdef MITSCRIPT_THREADED_DISPATCH
+    run_reg<false>(nullptr, 0, 0, FreeRefs{});
+#endif
+  }
+
+  // heap is destroyed last, but its background sweeper may still report
+  // freed objects to heap_profile; stop it first.
+  ~VM() { heap.set_background_sweep(false); }
+
+  // Destroys every object left in the heap. The destructor skips that, as
+  // a VM normally lasts until the process exits; a process that runs one
+  // VM after another (batch) calls this so each run's heap is not leaked.
+  void release_heap() {
+    heap.set_background_sweep(false);
+    heap.destroy_objects();
+  }
+
+  // Calls `hook` when top-level code first calls input(), to save the run
+  // with save_snapshot; an empty hook turns it off.
+  void set_snapshot_hook(std::function<void(VM &)> hook) {
+    snapshot_hook = std::move(hook);
   }
 
-  void run(bytecode::Function *main_func) {
-    // Eagerly translate the entire function tree to the register-based
-    // instruction set so we always execute the faster interpreter.
-    translate_function_tree(main_func);
+  // The state of a run stopped at its first input() call, for run() to
+  // resume: the live heap, the globals, main's registers and pc and the
+  // output so far (defined in vm/snapshot.cpp).
+  std::string save_snapshot();
+
+  // Runs the program, or with a `snapshot` from save_snapshot resumes it
+  // where that was taken. The snapshot must come from the same program,
+  // with the same inlining setting; otherwise this throws SnapshotError
+  // before the program runs.
+  void run(bytecode::Function *main_func, std::string_view snapshot = {}) {
+    // Functions are translated to register code when first called, except
+    // that the inliner works on the whole translated program.
+    if (inlining_enabled)
+      translate_function_tree(main_func);
+    if (heap_profile)
+      heap_profile->name_functions(main_func);
+    if (profiler) {
+      profiler->name_functions(main_func);
+      jit_enabled = false;
+    }
+    // A snapshot holds a pc in main's code as the inliner left it.
+    speculating = inlining_enabled && !profiler && !snapshot_hook;
+    tiering = jit_enabled || speculating;
 
     // Mark first 3 functions as native with their IDs
     if (main_func->functions_.size() >= 3) {
@@ -2444,9 +5375,32 @@ public:
       native_functions[main_func->functions_[1]] = 1; // input
       native_functions[main_func->functions_[2]] = 2; // intcast
     }
-
-    execute_function(main_func, {}, {});
+    if (inlining_enabled)
+      inline_function_tree(main_func);
+    main_function = main_func;
+    if (!snapshot.empty())
+      restore_snapshot(snapshot);
+    else if (snapshot_hook)
+      output.record(&snapshot_output);
+
+    try {
+      PerfCounters::Scope phase(perf_counters, PerfCounters::Phase::Execute);
+      execute_function(main_func, {}, {});
+    } catch (...) {
+      output.flush();
+      write_gc_stats();
+      write_heap_profile();
+      write_profile();
+      throw;
+    }
+    output.flush();
+    write_gc_stats();
+    write_heap_profile();
+    write_profile();
   }
 };
 
+extern template TaggedValue
+VM::run_reg<true>(bytecode::Function *, size_t, size_t, FreeRefs);
+
 } // namespace vm
@@ -0,0 +1,275 @@
+#pragma once
+
+// Minimal x86-64 machine-code emitter and executable-memory cache used by
+// the VM's baseline JIT (see VM::jit_compile). Only the handful of
+// instruction forms the JIT templates need are provided.
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define MITSCRIPT_JIT_SUPPORTED 1
+#else
+#define MITSCRIPT_JIT_SUPPORTED 0
+#endif
+
+namespace vm::jit {
+
+enum class Reg : uint8_t {
+  RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Condition codes as encoded in Jcc / SETcc.
+enum class Cond : uint8_t {
+  E = 0x4, NE = 0x5, S = 0x8, L = 0xC, GE = 0xD, LE = 0xE, G = 0xF
+};
+
+class X64Emitter {
+public:
+  size_t size() const { return code_.size(); }
+  const std::vector<uint8_t> &code() const { return code_; }
+
+  void push(Reg r) {
+    if (hi(r)) emit(0x41);
+    emit(0x50 + low(r));
+  }
+
+  void pop(Reg r) {
+    if (hi(r)) emit(0x41);
+    emit(0x58 + low(r));
+  }
+
+  void ret() { emit(0xC3); }
+
+  // mov dst, src (64-bit)
+  void mov(Reg dst, Reg src) {
+    rex(true, src, dst);
+    emit(0x89);
+    modrm_reg(src, dst);
+  }
+
+  // mov dst, imm64
+  void mov_imm64(Reg dst, uint64_t imm) {
+    rex(true, Reg::RAX, dst);
+    emit(0xB8 + low(dst));
+    emit_bytes(&imm, 8);
+  }
+
+  // mov dst32, imm32
+  void mov_imm32(Reg dst, int32_t imm) {
+    if (hi(dst)) emit(0x41);
+    emit(0xB8 + low(dst));
+    emit_bytes(&imm, 4);
+  }
+
+  void call(Reg target) {
+    if (hi(target)) emit(0x41);
+    emit(0xFF);
+    modrm_reg(static_cast<Reg>(2), target);
+  }
+
+  // test a, b (64-bit)
+  void test(Reg a, Reg b) {
+    rex(true, b, a);
+    emit(0x85);
+    modrm_reg(b, a);
+  }
+
+  // test a32, b32
+  void test32(Reg a, Reg b) {
+    rex(false, b, a);
+    emit(0x85);
+    modrm_reg(b, a);
+  }
+
+  // cmp byte [base + disp], imm8
+  void cmp_byte(Reg base, int32_t disp, uint8_t imm) {
+    rex(false, Reg::RAX, base);
+    emit(0x80);
+    modrm_mem(static_cast<Reg>(7), base, disp);
+    emit(imm);
+  }
+
+  // movzx dst32, src8 (src must be AL..BL)
+  void movzx8(Reg dst, Reg src) {
+    rex(false, dst, src);
+    emit(0x0F);
+    emit(0xB6);
+    modrm_reg(dst, src);
+  }
+
+  // mov dst, qword [base + disp]
+  void load64(Reg dst, Reg base, int32_t disp) {
+    rex(true, dst, base);
+    emit(0x8B);
+    modrm_mem(dst, base, disp);
+  }
+
+  // mov qword [base + disp], src
+  void store64(Reg base, int32_t disp, Reg src) {
+    rex(true, src, base);
+    emit(0x89);
+    modrm_mem(src, base, disp);
+  }
+
+  // mov dst32, dword [base + disp]
+  void load32(Reg dst, Reg base, int32_t disp) {
+    rex(false, dst, base);
+    emit(0x8B);
+    modrm_mem(dst, base, disp);
+  }
+
+  // add / sub / cmp / imul dst32, dword [base + disp]
+  void add32(Reg dst, Reg base, int32_t disp) { alu_mem(0x03, dst, base, disp); }
+  void sub32(Reg dst, Reg base, int32_t disp) { alu_mem(0x2B, dst, base, disp); }
+  void cmp32(Reg dst, Reg base, int32_t disp) { alu_mem(0x3B, dst, base, disp); }
+  void imul32(Reg dst, Reg base, int32_t disp) {
+    rex(false, dst, base);
+    emit(0x0F);
+    emit(0xAF);
+    modrm_mem(dst, base, disp);
+  }
+
+  // add / sub / cmp dst32, imm32
+  void add32_imm(Reg dst, int32_t imm) { alu_imm(0, dst, imm); }
+  void sub32_imm(Reg dst, int32_t imm) { alu_imm(5, dst, imm); }
+  void cmp32_imm(Reg dst, int32_t imm) { alu_imm(7, dst, imm); }
+
+  // shl dst, imm8 (64-bit)
+  void shl_imm(Reg dst, uint8_t imm) {
+    rex(true, Reg::RAX, dst);
+    emit(0xC1);
+    modrm_reg(static_cast<Reg>(4), dst);
+    emit(imm);
+  }
+
+  // or dst, imm32 (64-bit, sign-extended)
+  void or_imm(Reg dst, int32_t imm) {
+    rex(true, Reg::RAX, dst);
+    emit(0x81);
+    modrm_reg(static_cast<Reg>(1), dst);
+    emit_bytes(&imm, 4);
+  }
+
+  // setcc dst8 (dst must be AL..BL)
+  void setcc(Cond c, Reg dst) {
+    emit(0x0F);
+    emit(0x90 + static_cast<uint8_t>(c));
+    modrm_reg(Reg::RAX, dst);
+  }
+
+  // Jumps with a 32-bit displacement. The returned offset identifies the
+  // displacement field for bind().
+  size_t jmp() {
+    emit(0xE9);
+    return placeholder();
+  }
+
+  size_t jcc(Cond c) {
+    emit(0x0F);
+    emit(0x80 + static_cast<uint8_t>(c));
+    return placeholder();
+  }
+
+  // Points the jump whose displacement lives at `fixup` to `target`.
+  void bind(size_t fixup, size_t target) {
+    int32_t rel = static_cast<int32_t>(target) - static_cast<int32_t>(fixup + 4);
+    std::memcpy(&code_[fixup], &rel, 4);
+  }
+
+private:
+  std::vector<uint8_t> code_;
+
+  static bool hi(Reg r) { return static_cast<uint8_t>(r) >= 8; }
+  static uint8_t low(Reg r) { return static_cast<uint8_t>(r) & 7; }
+
+  void emit(uint8_t b) { code_.push_back(b); }
+  void emit_bytes(const void *p, size_t n) {
+    const auto *b = static_cast<const uint8_t *>(p);
+    code_.insert(code_.end(), b, b + n);
+  }
+
+  size_t placeholder() {
+    size_t at = code_.size();
+    int32_t zero = 0;
+    emit_bytes(&zero, 4);
+    return at;
+  }
+
+  void rex(bool wide, Reg reg, Reg rm) {
+    uint8_t prefix = 0x40 | (wide ? 0x08 : 0) | (hi(reg) ? 0x04 : 0) |
+                     (hi(rm) ? 0x01 : 0);
+    if (prefix != 0x40) emit(prefix);
+  }
+
+  void modrm_reg(Reg reg, Reg rm) {
+    emit(0xC0 | (low(reg) << 3) | low(rm));
+  }
+
+  // [base + disp32]
+  void modrm_mem(Reg reg, Reg base, int32_t disp) {
+    emit(0x80 | (low(reg) << 3) | low(base));
+    if (low(base) == 4) emit(0x24); // SIB for rsp/r12 base
+    emit_bytes(&disp, 4);
+  }
+
+  void alu_imm(uint8_t ext, Reg dst, int32_t imm) {
+    rex(false, Reg::RAX, dst);
+    emit(0x81);
+    modrm_reg(static_cast<Reg>(ext), dst);
+    emit_bytes(&imm, 4);
+  }
+
+  void alu_mem(uint8_t opcode, Reg dst, Reg base, int32_t disp) {
+    rex(false, dst, base);
+    emit(opcode);
+    modrm_mem(dst, base, disp);
+  }
+};
+
+// Owns the executable pages holding compiled functions. Code is written
+// while the mapping is writable and then flipped to read+execute.
+class CodeCache {
+public:
+  CodeCache() = default;
+  CodeCache(const CodeCache &) = delete;
+  CodeCache &operator=(const CodeCache &) = delete;
+
+  ~CodeCache() {
+#if MITSCRIPT_JIT_SUPPORTED
+    for (const auto &block : blocks_) {
+      munmap(block.first, block.second);
+    }
+#endif
+  }
+
+  // Returns nullptr if executable memory is unavailable.
+  void *install(const std::vector<uint8_t> &code) {
+#if MITSCRIPT_JIT_SUPPORTED
+    size_t len = code.size();
+    void *mem = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+      return nullptr;
+    std::memcpy(mem, code.data(), len);
+    if (mprotect(mem, len, PROT_READ | PROT_EXEC) != 0) {
+      munmap(mem, len);
+      return nullptr;
+    }
+    blocks_.emplace_back(mem, len);
+    return mem;
+#else
+    (void)code;
+    return nullptr;
+#endif
+  }
+
+private:
+  std::vector<std::pair<void *, size_t>> blocks_;
+};
+
+} // namespace vm::jit
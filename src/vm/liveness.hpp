@@ -0,0 +1,92 @@
+#pragma once
+
+// Register liveness for the collector, computed once per function after
+// VM::translate_stack_to_reg has verified its register code.
+//
+// A frame that is not the innermost one is suspended at a Call (see
+// Frame::pc), so only the registers live across that Call can still be
+// read when it resumes. Recording them per Call lets the collector skip
+// dead registers, whose stale pointers would otherwise keep garbage alive.
+//
+// This is the usual backward dataflow, run over instructions rather than
+// basic blocks: live_in(i) = reads(i) | (live_out(i) & ~writes(i)), where
+// live_out(i) joins live_in over i's successors. Reference slots are read
+// through Frame::ref_base by PushReference and by StoreLocal into a
+// captured local, not through register operands, so they are always live.
+
+#include "bytecode/instructions.hpp"
+#include "bytecode/types.hpp"
+#include "vm/superinstructions.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace vm {
+
+// live_in of every instruction of `code`, `words` 64-bit words per
+// instruction; registers set in `always` are live everywhere.
+inline std::vector<uint64_t>
+compute_live_in(const std::vector<bytecode::RegisterInstruction> &code,
+                size_t words, const std::vector<uint64_t> &always) {
+  using bytecode::Operation;
+  const size_t n = code.size();
+  std::vector<uint64_t> live_in(n * words, 0);
+  std::vector<uint64_t> live(words);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = n; i-- > 0;) {
+      const bytecode::RegisterInstruction &in = code[i];
+      std::fill(live.begin(), live.end(), 0);
+      auto join = [&](size_t succ) {
+        if (succ >= n) return;
+        for (size_t w = 0; w < words; ++w) live[w] |= live_in[succ * words + w];
+      };
+      if (in.op != Operation::Return && in.op != Operation::End) {
+        if (detail::is_reg_branch(in.op)) join(i + in.imm);
+        if (in.op != Operation::Goto) join(i + 1);
+      }
+      if (detail::writes_only_dst(in.op) || in.op == Operation::StoreLocal)
+        live[in.dst / 64] &= ~(uint64_t{1} << (in.dst % 64));
+      detail::for_each_reg_read(in, [&](uint16_t r) {
+        live[r / 64] |= uint64_t{1} << (r % 64);
+      });
+      for (size_t w = 0; w < words; ++w) live[w] |= always[w];
+
+      uint64_t *slot = live_in.data() + i * words;
+      for (size_t w = 0; w < words; ++w) {
+        if (slot[w] != live[w]) {
+          slot[w] = live[w];
+          changed = true;
+        }
+      }
+    }
+  }
+  return live_in;
+}
+
+inline void compute_call_liveness(bytecode::Function &func) {
+  using bytecode::Operation;
+  const auto &code = func.reg_instructions;
+  const size_t n = code.size();
+  const size_t words = func.live_map_words();
+
+  std::vector<uint64_t> always(words, 0);
+  const size_t ref_base = func.local_vars_.size();
+  for (size_t r = ref_base; r < ref_base + func.local_reference_vars_.size();
+       ++r)
+    always[r / 64] |= uint64_t{1} << (r % 64);
+  std::vector<uint64_t> live_in = compute_live_in(code, words, always);
+
+  func.call_live_map.assign(n, bytecode::Function::kNoLiveMap);
+  func.call_live_maps.clear();
+  for (size_t i = 0; i < n; ++i) {
+    if (code[i].op != Operation::Call) continue;
+    func.call_live_map[i] = static_cast<uint32_t>(func.call_live_maps.size());
+    func.call_live_maps.insert(func.call_live_maps.end(),
+                               live_in.begin() + i * words,
+                               live_in.begin() + (i + 1) * words);
+  }
+}
+
+} // namespace vm
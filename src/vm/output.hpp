@@ -0,0 +1,112 @@
+#pragma once
+
+// Buffered sink for the program's standard output. print() used to flush
+// std::cout on every call; the VM instead appends to one large buffer that
+// is written out only when it fills, before input() reads, when the run
+// ends, and when an error escapes (so output still precedes the message).
+// The output can go to another descriptor or be captured in a string
+// instead (see VM::set_stdio); without POSIX write(2) only std::cout is
+// supported.
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#if defined(__unix__)
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+namespace vm {
+
+class OutputBuffer {
+public:
+  static constexpr size_t kCapacity = 1 << 16;
+
+  OutputBuffer() { buf_.reserve(kCapacity); }
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer &operator=(const OutputBuffer &) = delete;
+  ~OutputBuffer() { flush(); }
+
+  // Writes to `fd` from now on.
+  void set_fd(int fd) {
+    flush();
+    fd_ = fd;
+    capture_ = nullptr;
+  }
+
+  // Appends to `sink` from now on instead of writing anywhere.
+  void capture(std::string *sink) {
+    flush();
+    capture_ = sink;
+  }
+
+  // Also appends everything written out from now on to `log`, or stops
+  // when it is null. A run that may be snapshotted keeps its output this
+  // way so that a resumed run can print it again.
+  void record(std::string *log) {
+    flush();
+    log_ = log;
+  }
+
+  // Values append their printed form here directly (see Value::write_to).
+  std::string &data() { return buf_; }
+
+  void append(std::string_view text) {
+    buf_.append(text.data(), text.size());
+    maybe_flush();
+  }
+
+  void put(char c) {
+    buf_.push_back(c);
+    maybe_flush();
+  }
+
+  // Called after writing through data().
+  void maybe_flush() {
+    if (buf_.size() >= kCapacity)
+      flush();
+  }
+
+  void flush() {
+    if (buf_.empty())
+      return;
+    if (log_)
+      log_->append(buf_);
+    if (capture_) {
+      capture_->append(buf_);
+      buf_.clear();
+      return;
+    }
+#if defined(__unix__)
+    // Anything already queued on std::cout must come out first.
+    if (fd_ == STDOUT_FILENO)
+      std::cout.flush();
+    const char *p = buf_.data();
+    size_t left = buf_.size();
+    while (left > 0) {
+      ssize_t n = ::write(fd_, p, left);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+      p += n;
+      left -= static_cast<size_t>(n);
+    }
+#else
+    std::cout.write(buf_.data(), static_cast<std::streamsize>(buf_.size()));
+    std::cout.flush();
+#endif
+    buf_.clear();
+  }
+
+private:
+  int fd_ = 1; // stdout
+  std::string *capture_ = nullptr;
+  std::string *log_ = nullptr;
+  std::string buf_;
+};
+
+} // namespace vm
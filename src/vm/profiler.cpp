@@ -0,0 +1,8 @@
+#include "vm/interpreter.hpp"
+
+namespace vm {
+
+template TaggedValue VM::run_reg<true>(bytecode::Function *, size_t, size_t,
+                                       FreeRefs);
+
+} // namespace vm
@@ -0,0 +1,250 @@
+#pragma once
+
+// Execution profiler for -O profile / --profile.
+//
+// While it is on, the register interpreter runs a separately compiled copy
+// of its dispatch loop that calls count() before every instruction, so
+// the normal loop pays nothing when it is off. count() keeps an execution
+// counter per Operation and per (function, pc), and notices back edges: an
+// instruction reached from one at the same or a later pc of the same
+// frame, which is a taken backward Goto, If or fused compare-and-jump. The
+// instruction that follows is the header of a loop.
+//
+// Time is sampled rather than measured: every kTimerInterval instructions
+// the clock is read and the time since the last reading is charged to the
+// function running then.
+//
+// Calls are derived at the end: a function's entries are the executions
+// of its first instruction that were not back edges, and a call site's
+// count is the execution count of its Call. write() prints the hottest
+// operations, functions, loops and call sites as text tables.
+
+#include "bytecode/instructions.hpp"
+#include "bytecode/types.hpp"
+#include "vm/heap_profiler.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vm {
+
+inline const char *operation_name(bytecode::Operation op) {
+  static const char *const names[] = {
+      "LoadConst",     "LoadFunc",       "LoadLocal",  "StoreLocal",
+      "LoadGlobal",    "StoreGlobal",    "PushReference", "LoadReference",
+      "StoreReference", "AllocRecord",   "FieldLoad",  "FieldStore",
+      "IndexLoad",     "IndexStore",     "AllocClosure", "Call",
+      "Return",        "Add",            "Sub",        "Mul",
+      "Div",           "Neg",            "Gt",         "Geq",
+      "Eq",            "And",            "Or",         "Not",
+      "Goto",          "If",             "Dup",        "Swap",
+      "Pop",           "FieldLoadSlot",  "FieldStoreSlot", "AddI",
+      "SubI",          "MulI",           "GtI",        "GeqI",
+      "EqI",           "GtJump",         "GeqJump",    "EqJump",
+      "AddImm",        "SubImm",         "IncJumpLt",  "AddJumpLt",
+      "CallGuard",     "LoadFreeRef",    "NewReference", "AddInt",
+      "SubInt",        "MulInt",         "GtInt",      "GeqInt",
+      "EqInt",         "GtJumpInt",      "GeqJumpInt", "EqJumpInt",
+      "End"};
+  static_assert(sizeof(names) / sizeof(names[0]) ==
+                    static_cast<size_t>(bytecode::Operation::End) + 1,
+                "operation_name is out of step with Operation");
+  return names[static_cast<size_t>(op)];
+}
+
+class Profiler {
+public:
+  static constexpr uint32_t kTimerInterval = 1024;
+  // Rows printed per table.
+  static constexpr size_t kReportRows = 15;
+
+  Profiler() : last_sample_(Clock::now()), start_(last_sample_) {}
+
+  // Names every function in the tree under `main`; see label_functions.
+  void name_functions(const bytecode::Function *main) {
+    names_.clear();
+    label_functions(main, "main", names_);
+  }
+
+  // Counts the instruction at `ip` in `code`, the register code of `func`,
+  // about to run in the activation `frame`.
+  void count(const void *frame, const bytecode::Function *func,
+             const bytecode::RegisterInstruction *code,
+             const bytecode::RegisterInstruction *ip) {
+    ++op_counts_[static_cast<size_t>(ip->op)];
+    if (func != cached_func_) {
+      cached_func_ = func;
+      cached_ = &functions_[func];
+    }
+    size_t pc = static_cast<size_t>(ip - code);
+    if (pc >= cached_->pcs.size())
+      cached_->pcs.resize(std::max(pc + 1, func->reg_instructions.size()));
+    PcCounts &counts = cached_->pcs[pc];
+    ++counts.executed;
+    if (frame == last_frame_ && func == last_func_ && pc <= last_pc_)
+      ++counts.back_edges;
+    last_frame_ = frame;
+    last_func_ = func;
+    last_pc_ = pc;
+    if (--timer_countdown_ == 0) {
+      timer_countdown_ = kTimerInterval;
+      auto now = Clock::now();
+      cached_->time += now - last_sample_;
+      last_sample_ = now;
+    }
+  }
+
+  void write(std::ostream &out) const {
+    uint64_t total = 0;
+    for (uint64_t n : op_counts_)
+      total += n;
+    double seconds =
+        std::chrono::duration<double>(Clock::now() - start_).count();
+    Clock::duration sampled{};
+    for (const auto &[func, counts] : functions_)
+      sampled += counts.time;
+
+    out << "profile: " << total << " instructions in "
+        << format("%.3f", seconds) << "s\n";
+
+    out << "\nhottest operations\n"
+        << format("%14s %7s  %s\n", "executed", "share", "operation");
+    std::vector<size_t> ops;
+    for (size_t i = 0; i < op_counts_.size(); ++i)
+      if (op_counts_[i])
+        ops.push_back(i);
+    top(ops, [&](size_t i) { return op_counts_[i]; });
+    for (size_t i : ops)
+      out << format("%14llu %6.2f%%  ", as_ull(op_counts_[i]),
+                    share(op_counts_[i], total))
+          << operation_name(static_cast<bytecode::Operation>(i)) << '\n';
+
+    // Functions, loops and call sites, from the per-pc counts.
+    struct FunctionRow {
+      const bytecode::Function *func;
+      uint64_t executed, calls;
+      Clock::duration time;
+    };
+    struct SiteRow {
+      const bytecode::Function *func;
+      size_t pc;
+      uint64_t count;
+    };
+    std::vector<FunctionRow> function_rows;
+    std::vector<SiteRow> loops, calls;
+    for (const auto &[func, counts] : functions_) {
+      FunctionRow row{func, 0, 0, counts.time};
+      for (size_t pc = 0; pc < counts.pcs.size(); ++pc) {
+        const PcCounts &c = counts.pcs[pc];
+        row.executed += c.executed;
+        if (c.back_edges)
+          loops.push_back({func, pc, c.back_edges});
+        if (c.executed && pc < func->reg_instructions.size()) {
+          auto op = func->reg_instructions[pc].op;
+          if (op == bytecode::Operation::Call ||
+              op == bytecode::Operation::CallGuard)
+            calls.push_back({func, pc, c.executed});
+        }
+      }
+      if (!counts.pcs.empty())
+        row.calls = counts.pcs[0].executed - counts.pcs[0].back_edges;
+      function_rows.push_back(row);
+    }
+
+    out << "\nhottest functions\n"
+        << format("%7s %14s %7s %12s  %s\n", "time", "executed", "share",
+                  "calls", "function");
+    top(function_rows, [&](const FunctionRow &r) {
+      return sampled.count() ? static_cast<uint64_t>(r.time.count())
+                             : r.executed;
+    });
+    for (const FunctionRow &r : function_rows)
+      out << format("%6.2f%% %14llu %6.2f%% %12llu  ",
+                    share(static_cast<uint64_t>(r.time.count()),
+                          static_cast<uint64_t>(sampled.count())),
+                    as_ull(r.executed), share(r.executed, total),
+                    as_ull(r.calls))
+          << name(r.func) << '\n';
+
+    out << "\nhottest loops\n"
+        << format("%14s  %s\n", "back edges", "loop header");
+    top(loops, [](const SiteRow &r) { return r.count; });
+    for (const SiteRow &r : loops)
+      out << format("%14llu  ", as_ull(r.count)) << name(r.func) << '@'
+          << r.pc << '\n';
+
+    out << "\nhottest call sites\n"
+        << format("%14s  %s\n", "calls", "call site");
+    top(calls, [](const SiteRow &r) { return r.count; });
+    for (const SiteRow &r : calls)
+      out << format("%14llu  ", as_ull(r.count)) << name(r.func) << '@'
+          << r.pc << '\n';
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct PcCounts {
+    uint64_t executed = 0;
+    uint64_t back_edges = 0;
+  };
+  struct FunctionCounts {
+    std::vector<PcCounts> pcs;
+    Clock::duration time{};
+  };
+
+  // Sorts `rows` by descending key and keeps the first kReportRows.
+  template <typename T, typename Key>
+  static void top(std::vector<T> &rows, Key key) {
+    std::stable_sort(rows.begin(), rows.end(), [&](const T &a, const T &b) {
+      return key(a) > key(b);
+    });
+    if (rows.size() > kReportRows)
+      rows.resize(kReportRows);
+  }
+
+  template <typename... Args>
+  static std::string format(const char *fmt, Args... args) {
+    char buf[128];
+    std::snprintf(buf, sizeof buf, fmt, args...);
+    return buf;
+  }
+
+  static unsigned long long as_ull(uint64_t n) { return n; }
+
+  static double share(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * static_cast<double>(part) /
+                       static_cast<double>(whole)
+                 : 0.0;
+  }
+
+  std::string name(const bytecode::Function *func) const {
+    auto it = names_.find(func);
+    return it != names_.end() ? it->second : std::string("?");
+  }
+
+  std::array<uint64_t, static_cast<size_t>(bytecode::Operation::End) + 1>
+      op_counts_{};
+  std::unordered_map<const bytecode::Function *, FunctionCounts> functions_;
+  const bytecode::Function *cached_func_ = nullptr;
+  FunctionCounts *cached_ = nullptr;
+
+  // The instruction counted last, for spotting back edges.
+  const void *last_frame_ = nullptr;
+  const bytecode::Function *last_func_ = nullptr;
+  size_t last_pc_ = 0;
+
+  uint32_t timer_countdown_ = kTimerInterval;
+  Clock::time_point last_sample_;
+  Clock::time_point start_;
+  std::unordered_map<const bytecode::Function *, std::string> names_;
+};
+
+} // namespace vm
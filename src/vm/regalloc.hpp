@@ -0,0 +1,270 @@
+#pragma once
+
+// Linear-scan reallocation of temporaries, run at the end of
+// VM::translate_stack_to_reg. Translation hands every stack value a fresh
+// register, so a function needs one register per value it ever computes
+// and its frame grows with the length of its code. This pass gives the
+// temporaries (registers at or above first_temp; locals and reference slots
+// keep their numbers) new numbers so that two of them share a register
+// whenever their live ranges do not overlap.
+//
+// A temporary's live range is the span of instructions from the first to
+// the last one where it is live (see compute_live_in), written or read; a
+// span covers every point where its value matters even around loops, so
+// disjoint spans are safe to share. A Call's argument registers and an
+// AllocClosure's captured references must stay contiguous, so each such
+// range (merged with any range it overlaps) is placed as one unit. Units
+// are assigned in order of their start to the lowest registers that are
+// free by then.
+
+#include "bytecode/instructions.hpp"
+#include "vm/liveness.hpp"
+#include "vm/superinstructions.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace vm {
+
+namespace detail {
+
+// Calls f(field) for every field of `in` that names a register, read or
+// written; false for instructions this pass does not know.
+template <typename F>
+inline bool for_each_reg_operand(bytecode::RegisterInstruction &in, F &&f) {
+  using bytecode::Operation;
+  switch (in.op) {
+  case Operation::Goto:
+  case Operation::End:
+    return true;
+  case Operation::LoadConst:
+  case Operation::LoadFunc:
+  case Operation::LoadGlobal:
+  case Operation::PushReference:
+  case Operation::AllocRecord:
+    f(in.dst);
+    return true;
+  case Operation::StoreGlobal:
+  case Operation::Return:
+  case Operation::If:
+  case Operation::CallGuard: // dst is the inline target
+    f(in.src1);
+    return true;
+  case Operation::StoreLocal:
+  case Operation::LoadLocal:
+  case Operation::Dup:
+  case Operation::LoadFreeRef:
+  case Operation::NewReference:
+  case Operation::LoadReference:
+  case Operation::FieldLoad: // src2 is the field cache
+  case Operation::FieldLoadSlot: // src2 is the slot
+  case Operation::Neg:
+  case Operation::Not:
+  case Operation::AddImm:
+  case Operation::SubImm:
+    f(in.dst);
+    f(in.src1);
+    return true;
+  case Operation::StoreReference:
+  case Operation::FieldStore: // dst is the field cache
+  case Operation::FieldStoreSlot: // dst is the slot
+  case Operation::GtJump:
+  case Operation::GeqJump:
+  case Operation::EqJump: // dst is the negate flag
+    f(in.src1);
+    f(in.src2);
+    return true;
+  case Operation::IncJumpLt: // src2 is the step
+    f(in.dst);
+    f(in.src1);
+    return true;
+  case Operation::AddJumpLt:
+    f(in.dst);
+    f(in.src1);
+    f(in.src2);
+    return true;
+  case Operation::IndexLoad:
+  case Operation::IndexStore:
+  case Operation::Add:
+  case Operation::Sub:
+  case Operation::Mul:
+  case Operation::Div:
+  case Operation::Gt:
+  case Operation::Geq:
+  case Operation::Eq:
+  case Operation::And:
+  case Operation::Or:
+  case Operation::AddI:
+  case Operation::SubI:
+  case Operation::MulI:
+  case Operation::GtI:
+  case Operation::GeqI:
+  case Operation::EqI:
+    f(in.dst);
+    f(in.src1);
+    f(in.src2);
+    return true;
+  case Operation::Call: // src2 starts the arguments
+  case Operation::AllocClosure: // src1 starts the references
+    f(in.dst);
+    f(in.src1);
+    f(in.src2);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Calls f(reg) for every register live across code[i] other than the one
+// it writes.
+template <typename F>
+inline void for_each_live_across(const std::vector<uint64_t> &live_in,
+                                 size_t words, size_t i, size_t n,
+                                 uint16_t written, F &&f) {
+  if (i + 1 >= n)
+    return;
+  const uint64_t *live = live_in.data() + (i + 1) * words;
+  for (size_t w = 0; w < words; ++w) {
+    for (uint64_t bits = live[w]; bits; bits &= bits - 1) {
+      size_t r = w * 64 + static_cast<size_t>(__builtin_ctzll(bits));
+      if (r != written)
+        f(r);
+    }
+  }
+}
+
+} // namespace detail
+
+inline void reuse_temporaries(std::vector<bytecode::RegisterInstruction> &code,
+                              uint16_t first_temp, uint16_t &register_count) {
+  using bytecode::Operation;
+  const size_t nregs = register_count;
+  const size_t n = code.size();
+  if (nregs <= first_temp)
+    return;
+  for (auto &in : code) {
+    bool in_range = true;
+    bool known = detail::for_each_reg_operand(in, [&](uint16_t &r) {
+      if (r >= nregs) in_range = false;
+    });
+    if (!known || !in_range)
+      return; // left for the verifier to reject
+  }
+
+  const size_t words = (nregs + 63) / 64;
+  std::vector<uint64_t> live_in =
+      compute_live_in(code, words, std::vector<uint64_t>(words, 0));
+
+  std::vector<int32_t> start(nregs, INT32_MAX), end(nregs, -1);
+  auto touch = [&](size_t r, int32_t i) {
+    if (r < first_temp) return;
+    start[r] = std::min(start[r], i);
+    end[r] = std::max(end[r], i);
+  };
+  // Counted ranges, by first register; translation keeps them disjoint.
+  std::vector<uint16_t> width(nregs, 1);
+  std::vector<char> call_args(nregs, 0);
+  std::vector<char> in_range(nregs, 0);
+  for (size_t i = 0; i < n; ++i) {
+    const uint64_t *live = live_in.data() + i * words;
+    for (size_t w = 0; w < words; ++w) {
+      for (uint64_t bits = live[w]; bits; bits &= bits - 1)
+        touch(w * 64 + static_cast<size_t>(__builtin_ctzll(bits)),
+              static_cast<int32_t>(i));
+    }
+    const auto &in = code[i];
+    if (detail::writes_only_dst(in.op) || in.op == Operation::StoreLocal)
+      touch(in.dst, static_cast<int32_t>(i));
+    if ((in.op == Operation::Call || in.op == Operation::AllocClosure) &&
+        in.imm > 0) {
+      uint16_t first = in.op == Operation::Call ? in.src2 : in.src1;
+      if (first < first_temp || first + static_cast<size_t>(in.imm) > nregs)
+        return;
+      for (size_t k = first; k < first + static_cast<size_t>(in.imm); ++k) {
+        if (in_range[k])
+          return;
+        in_range[k] = 1;
+      }
+      width[first] = static_cast<uint16_t>(in.imm);
+      call_args[first] = in.op == Operation::Call;
+    }
+  }
+
+  struct Unit {
+    uint16_t first;
+    uint16_t width;
+    bool call_args;
+    int32_t start;
+    int32_t end;
+  };
+  std::vector<Unit> units;
+  for (size_t r = first_temp; r < nregs; r += width[r]) {
+    Unit u{static_cast<uint16_t>(r), width[r], call_args[r] != 0, INT32_MAX, -1};
+    for (size_t k = r; k < r + u.width; ++k) {
+      u.start = std::min(u.start, start[k]);
+      u.end = std::max(u.end, end[k]);
+    }
+    if (u.end >= 0)
+      units.push_back(u);
+  }
+  std::stable_sort(units.begin(), units.end(),
+                   [](const Unit &a, const Unit &b) { return a.start < b.start; });
+
+  // busy_until[r]: last instruction of the unit now holding register r.
+  std::vector<int32_t> busy_until;
+  std::vector<uint16_t> new_reg(nregs, 0);
+  for (size_t r = 0; r < first_temp; ++r)
+    new_reg[r] = static_cast<uint16_t>(r);
+  for (const Unit &u : units) {
+    size_t base = 0;
+    if (u.call_args) {
+      // The callee's frame starts at its first argument, so everything
+      // the caller still holds must sit below it.
+      for (size_t k = busy_until.size(); k-- > 0;) {
+        if (busy_until[k] >= u.start) {
+          base = k + 1;
+          break;
+        }
+      }
+    } else {
+      while (true) {
+        size_t k = 0;
+        while (k < u.width && base + k < busy_until.size() &&
+               busy_until[base + k] < u.start)
+          ++k;
+        if (k == u.width || base + k >= busy_until.size())
+          break;
+        base += k + 1;
+      }
+    }
+    if (base + u.width > busy_until.size())
+      busy_until.resize(base + u.width, -1);
+    for (size_t k = 0; k < u.width; ++k) {
+      busy_until[base + k] = u.end;
+      new_reg[u.first + k] = static_cast<uint16_t>(first_temp + base + k);
+    }
+  }
+  uint16_t new_count = static_cast<uint16_t>(first_temp + busy_until.size());
+
+  std::vector<bytecode::RegisterInstruction> renamed = code;
+  for (size_t i = 0; i < n; ++i) {
+    auto &in = renamed[i];
+    detail::for_each_reg_operand(in, [&](uint16_t &r) { r = new_reg[r]; });
+    if (in.op != Operation::Call)
+      continue;
+    // Check the callee window; a call without arguments gets the lowest
+    // base above everything live across it.
+    size_t above = first_temp;
+    detail::for_each_live_across(live_in, words, i, n, code[i].dst, [&](size_t r) {
+      above = std::max(above, static_cast<size_t>(new_reg[r]) + 1);
+    });
+    if (in.imm == 0)
+      in.src2 = static_cast<uint16_t>(above);
+    else if (in.src2 < above)
+      return; // keep the translation as it is
+  }
+  code = std::move(renamed);
+  register_count = new_count;
+}
+
+} // namespace vm
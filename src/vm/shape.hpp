@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace vm {
+
+// Hidden class for a Record's named fields. Records that add the same field
+// names in the same order share a Shape, so a field name resolves to the same
+// slot index for all of them. Shapes form a transition tree rooted at the
+// empty shape; they are owned by the ShapeTable and never collected.
+struct Shape {
+  uint32_t id;
+  Shape *parent;
+  std::vector<std::string> fields; // field name for each slot, in slot order
+  std::unordered_map<std::string, Shape *> transitions;
+
+  Shape(uint32_t id, Shape *parent) : id(id), parent(parent) {}
+
+  // Returns -1 if the field is not part of this shape.
+  int slot_index(std::string_view field) const {
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (fields[i] == field)
+        return static_cast<int>(i);
+    }
+    return -1;
+  }
+};
+
+class ShapeTable {
+public:
+  // Records whose shape would grow past this many fields switch to
+  // dictionary mode instead of extending the transition tree.
+  static constexpr size_t kMaxShapeFields = 32;
+
+  ShapeTable() { shapes_.push_back(std::make_unique<Shape>(0, nullptr)); }
+
+  Shape *root() const { return shapes_[0].get(); }
+
+  Shape *by_id(uint32_t id) const { return shapes_[id].get(); }
+
+  // Returns the shape reached from `from` by appending `field`, or nullptr if
+  // that shape would exceed kMaxShapeFields.
+  Shape *transition(Shape *from, const std::string &field) {
+    auto it = from->transitions.find(field);
+    if (it != from->transitions.end())
+      return it->second;
+    if (from->fields.size() >= kMaxShapeFields)
+      return nullptr;
+    auto next = std::make_unique<Shape>(static_cast<uint32_t>(shapes_.size()),
+                                        from);
+    next->fields = from->fields;
+    next->fields.push_back(field);
+    Shape *raw = next.get();
+    shapes_.push_back(std::move(next));
+    from->transitions.emplace(field, raw);
+    return raw;
+  }
+
+private:
+  std::vector<std::unique_ptr<Shape>> shapes_;
+};
+
+} // namespace vm
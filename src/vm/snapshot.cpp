@@ -0,0 +1,477 @@
+// Heap snapshots for --snapshot: VM::save_snapshot and VM::restore_snapshot.
+//
+// A snapshot is taken when top-level code first calls input(), so it holds
+// everything the program built before reading any input. At that point
+// main's frame is the only frame, and the Call to input() at frame->pc has
+// not run yet. The snapshot saves main's registers and that pc, the
+// defined globals by name, every heap object reachable from either, and
+// the output printed so far. A resumed run prints that output again,
+// rebuilds the objects and re-enters main at the Call, so input() reads
+// the new run's input.
+//
+// Functions are saved as their index in a preorder walk of the program
+// tree. Global slots and constant pools belong to a VM and are rebuilt by
+// translation. Register pcs depend only on the program and the inlining
+// setting; the snapshot's cache key covers both.
+//
+// Layout, with 32-bit little-endian words:
+//   header    magic "\x7fMITSNP\x03", function count, main's register
+//             count, main's pc, object count
+//   objects   one record per object, in id order: a type byte, then
+//               Integer    the value
+//               Boolean    0 or 1
+//               String     interned flag byte, length, bytes
+//               Function   function index
+//               Closure    function index, free variable count, their ids
+//               Reference  value
+//               Record     shape field count (0xffffffff in dictionary
+//                            mode) and names, slot values, dense values,
+//                            sparse elements as index and value pairs,
+//                            map entries as key and value pairs
+//   globals   count, then name and value per global
+//   frame     main's register values
+//   output    length, bytes
+// A value is a kind byte (none, false, true, integer, object, null, short
+// string, or hole for a dense element that holds nothing) and a word: the
+// integer, the object id or the short string's length, which is followed
+// by its bytes.
+
+#include "vm/interpreter.hpp"
+#include <cstring>
+
+namespace vm {
+
+namespace {
+
+constexpr char kMagic[8] = {'\x7f', 'M', 'I', 'T', 'S', 'N', 'P', '\x04'};
+constexpr uint32_t kDictionaryMode = 0xffffffffu;
+
+enum class ValueKind : uint8_t {
+  None,
+  False,
+  True,
+  Integer,
+  Object,
+  Null,
+  SmallString,
+  Hole
+};
+
+class Writer {
+public:
+  explicit Writer(std::string &out) : out_(out) {}
+
+  void byte(uint8_t b) { out_.push_back(static_cast<char>(b)); }
+  void word(uint32_t w) {
+    for (int i = 0; i < 4; ++i)
+      out_.push_back(static_cast<char>(w >> (8 * i)));
+  }
+  void text(std::string_view s) {
+    word(static_cast<uint32_t>(s.size()));
+    out_.append(s.data(), s.size());
+  }
+
+private:
+  std::string &out_;
+};
+
+class Reader {
+public:
+  explicit Reader(std::string_view in) : in_(in) {}
+
+  size_t position() const { return pos_; }
+  void seek(size_t pos) { pos_ = pos; }
+  bool at_end() const { return pos_ == in_.size(); }
+
+  uint8_t byte() {
+    need(1);
+    return static_cast<uint8_t>(in_[pos_++]);
+  }
+  uint32_t word() {
+    need(4);
+    uint32_t w = 0;
+    for (int i = 0; i < 4; ++i)
+      w |= uint32_t{static_cast<unsigned char>(in_[pos_++])} << (8 * i);
+    return w;
+  }
+  std::string_view text() { return bytes(word()); }
+  std::string_view bytes(size_t n) {
+    need(n);
+    std::string_view s = in_.substr(pos_, n);
+    pos_ += n;
+    return s;
+  }
+
+private:
+  void need(size_t n) const {
+    if (in_.size() - pos_ < n)
+      throw SnapshotError("truncated");
+  }
+
+  std::string_view in_;
+  size_t pos_ = 0;
+};
+
+[[noreturn]] void corrupt(const char *what) {
+  throw SnapshotError(what);
+}
+
+// The program's functions in preorder. The VM's inliner can share a
+// callee's children with its callers, so each function is listed once.
+void number_functions(bytecode::Function *func,
+                      std::vector<bytecode::Function *> &order,
+                      std::unordered_map<const bytecode::Function *, uint32_t> &index) {
+  if (!index.emplace(func, static_cast<uint32_t>(order.size())).second)
+    return;
+  order.push_back(func);
+  for (bytecode::Function *child : func->functions_)
+    number_functions(child, order, index);
+}
+
+} // namespace
+
+std::string VM::save_snapshot() {
+  std::vector<bytecode::Function *> functions;
+  std::unordered_map<const bytecode::Function *, uint32_t> function_index;
+  number_functions(main_function, functions, function_index);
+  const Frame &frame = *call_stack.front();
+
+  // Objects get ids in the order they are first reached; the records are
+  // written after the roots, which is when the count is known.
+  std::vector<Value *> objects;
+  std::unordered_map<const Value *, uint32_t> ids;
+  std::string roots;
+  std::string records;
+
+  auto value = [&](Writer &w, const TaggedValue &tv) {
+    if (tv.is_hole()) {
+      w.byte(static_cast<uint8_t>(ValueKind::Hole));
+      w.word(0);
+      return;
+    }
+    switch (tv.kind()) {
+    case TaggedValue::Kind::None:
+      w.byte(static_cast<uint8_t>(ValueKind::None));
+      w.word(0);
+      return;
+    case TaggedValue::Kind::Boolean:
+      w.byte(static_cast<uint8_t>(tv.as_bool() ? ValueKind::True
+                                               : ValueKind::False));
+      w.word(0);
+      return;
+    case TaggedValue::Kind::Integer:
+      w.byte(static_cast<uint8_t>(ValueKind::Integer));
+      w.word(static_cast<uint32_t>(tv.as_int()));
+      return;
+    case TaggedValue::Kind::SmallString:
+      w.byte(static_cast<uint8_t>(ValueKind::SmallString));
+      w.text(tv.small_text());
+      return;
+    case TaggedValue::Kind::HeapPtr:
+      break;
+    }
+    if (!tv.as_ptr()) {
+      w.byte(static_cast<uint8_t>(ValueKind::Null));
+      w.word(0);
+      return;
+    }
+    auto [it, added] =
+        ids.emplace(tv.as_ptr(), static_cast<uint32_t>(objects.size()));
+    if (added)
+      objects.push_back(tv.as_ptr());
+    w.byte(static_cast<uint8_t>(ValueKind::Object));
+    w.word(it->second);
+  };
+
+  Writer r(roots);
+  uint32_t defined = 0;
+  for (const TaggedValue &g : globals)
+    defined += !is_undefined_global(g);
+  r.word(defined);
+  for (size_t i = 0; i < globals.size(); ++i) {
+    if (is_undefined_global(globals[i]))
+      continue;
+    r.text(global_names[i]);
+    value(r, globals[i]);
+  }
+  for (size_t i = 0; i < frame.size; ++i)
+    value(r, registers[frame.base + i]);
+  r.text(snapshot_output);
+
+  Writer o(records);
+  for (size_t i = 0; i < objects.size(); ++i) {
+    Value *v = objects[i];
+    o.byte(static_cast<uint8_t>(v->tag));
+    switch (v->tag) {
+    case Value::Type::None:
+      break;
+    case Value::Type::Boolean:
+      o.byte(static_cast<Boolean *>(v)->value);
+      break;
+    case Value::Type::Integer:
+      o.word(static_cast<uint32_t>(static_cast<Integer *>(v)->value));
+      break;
+    case Value::Type::String: {
+      auto s = static_cast<String *>(v);
+      o.byte(s->interned);
+      o.text(s->str());
+      break;
+    }
+    case Value::Type::Function:
+      o.word(function_index.at(static_cast<Function *>(v)->func));
+      break;
+    case Value::Type::Closure: {
+      auto c = static_cast<Closure *>(v);
+      o.word(function_index.at(c->function));
+      o.word(c->free_count);
+      for (Value *ref : c->free_var_refs())
+        value(o, TaggedValue::from_heap(ref));
+      break;
+    }
+    case Value::Type::Reference:
+      value(o, static_cast<Reference *>(v)->value);
+      break;
+    case Value::Type::Record: {
+      auto rec = static_cast<Record *>(v);
+      if (rec->shape) {
+        o.word(static_cast<uint32_t>(rec->shape->fields.size()));
+        for (const std::string &field : rec->shape->fields)
+          o.text(field);
+      } else {
+        o.word(kDictionaryMode);
+      }
+      o.word(static_cast<uint32_t>(rec->slots.size()));
+      for (const TaggedValue &tv : rec->slots)
+        value(o, tv);
+      o.word(static_cast<uint32_t>(rec->dense.size()));
+      for (const TaggedValue &tv : rec->dense)
+        value(o, tv);
+      uint32_t sparse_count = 0;
+      for (const SparseElements::Chunk &c : rec->sparse.chunks())
+        for (const TaggedValue &tv : c.values)
+          sparse_count += !tv.is_hole();
+      o.word(sparse_count);
+      for (const SparseElements::Chunk &c : rec->sparse.chunks()) {
+        for (int32_t k = 0; k < SparseElements::kChunkSize; ++k) {
+          if (c.values[k].is_hole())
+            continue;
+          o.word(static_cast<uint32_t>(c.number * SparseElements::kChunkSize + k));
+          value(o, c.values[k]);
+        }
+      }
+      o.word(static_cast<uint32_t>(rec->fields.size()));
+      for (const RecordMap::Entry &e : rec->fields.entries()) {
+        value(o, e.key);
+        value(o, e.value);
+      }
+      break;
+    }
+    }
+  }
+
+  std::string out(kMagic, sizeof kMagic);
+  Writer h(out);
+  h.word(static_cast<uint32_t>(functions.size()));
+  h.word(static_cast<uint32_t>(frame.size));
+  h.word(static_cast<uint32_t>(frame.pc));
+  h.word(static_cast<uint32_t>(objects.size()));
+  out += records;
+  out += roots;
+  return out;
+}
+
+void VM::restore_snapshot(std::string_view state) {
+  if (state.size() < sizeof kMagic ||
+      std::memcmp(state.data(), kMagic, sizeof kMagic) != 0)
+    corrupt("not a snapshot");
+  Reader in(state.substr(sizeof kMagic));
+
+  std::vector<bytecode::Function *> functions;
+  std::unordered_map<const bytecode::Function *, uint32_t> function_index;
+  number_functions(main_function, functions, function_index);
+  if (in.word() != functions.size())
+    corrupt("taken of another program");
+  ensure_translated(main_function);
+  uint32_t register_count = in.word();
+  uint32_t pc = in.word();
+  if (register_count != main_function->register_count ||
+      pc >= main_function->reg_instructions.size() ||
+      main_function->reg_instructions[pc].op != bytecode::Operation::Call)
+    corrupt("taken of another program");
+  uint32_t object_count = in.word();
+
+  auto function_at = [&](uint32_t i) {
+    if (i >= functions.size())
+      corrupt("function out of range");
+    return functions[i];
+  };
+
+  // The objects are made in one pass over their records and filled in by a
+  // second, as they can refer to each other in any order. Nothing is
+  // collected until main's registers hold the roots again (see run_reg).
+  gc_deferred = true;
+  std::vector<Value *> objects(object_count, nullptr);
+  bool filling = false;
+  // Only a dense element may be a hole.
+  auto value = [&](Reader &r, bool element = false) {
+    auto kind = static_cast<ValueKind>(r.byte());
+    uint32_t w = r.word();
+    switch (kind) {
+    case ValueKind::None:
+      return TaggedValue::none();
+    case ValueKind::False:
+      return TaggedValue::from_bool(false);
+    case ValueKind::True:
+      return TaggedValue::from_bool(true);
+    case ValueKind::Integer:
+      return TaggedValue::from_int(static_cast<int32_t>(w));
+    case ValueKind::Null:
+      return TaggedValue::from_heap(nullptr);
+    case ValueKind::SmallString:
+      if (w > TaggedValue::kSmallMax)
+        corrupt("short string too long");
+      return TaggedValue::from_small(r.bytes(w));
+    case ValueKind::Object:
+      if (w >= object_count)
+        corrupt("object out of range");
+      return TaggedValue::from_heap(filling ? objects[w] : nullptr);
+    case ValueKind::Hole:
+      if (!element)
+        corrupt("hole outside the dense elements");
+      return TaggedValue::hole();
+    }
+    corrupt("bad value");
+  };
+
+  const size_t records_at = in.position();
+  for (int pass = 0; pass < 2; ++pass) {
+    filling = pass == 1;
+    in.seek(records_at);
+    for (uint32_t i = 0; i < object_count; ++i) {
+      auto tag = static_cast<Value::Type>(in.byte());
+      switch (tag) {
+      case Value::Type::None:
+        objects[i] = none_singleton;
+        break;
+      case Value::Type::Boolean:
+        objects[i] = in.byte() ? bool_true_singleton : bool_false_singleton;
+        break;
+      case Value::Type::Integer: {
+        int32_t n = static_cast<int32_t>(in.word());
+        if (!filling)
+          objects[i] = allocate<Integer>(n);
+        break;
+      }
+      case Value::Type::String: {
+        bool interned = in.byte();
+        std::string_view text = in.text();
+        if (!filling)
+          objects[i] = interned ? intern_string(std::string(text))
+                                : allocate<String>(std::string(text));
+        break;
+      }
+      case Value::Type::Function: {
+        bytecode::Function *f = function_at(in.word());
+        if (!filling)
+          objects[i] = allocate<Function>(f);
+        break;
+      }
+      case Value::Type::Closure: {
+        bytecode::Function *f = function_at(in.word());
+        uint32_t count = in.word();
+        if (!filling)
+          objects[i] = allocate_sized<Closure>(Closure::size_for(count), f,
+                                               count);
+        Value **refs = static_cast<Closure *>(objects[i])->free_var_slots();
+        for (uint32_t k = 0; k < count; ++k) {
+          TaggedValue ref = value(in);
+          if (!filling)
+            continue;
+          if (ref.kind() != TaggedValue::Kind::HeapPtr ||
+              ref.as_ptr()->tag != Value::Type::Reference)
+            corrupt("closure captures a non-reference");
+          refs[k] = ref.as_ptr();
+        }
+        break;
+      }
+      case Value::Type::Reference: {
+        TaggedValue v = value(in);
+        if (!filling)
+          objects[i] = allocate<Reference>(TaggedValue::none());
+        else
+          static_cast<Reference *>(objects[i])->value = v;
+        break;
+      }
+      case Value::Type::Record: {
+        Shape *shape = nullptr;
+        uint32_t field_count = in.word();
+        if (field_count != kDictionaryMode) {
+          shape = shapes.root();
+          for (uint32_t k = 0; k < field_count && shape; ++k)
+            shape = shapes.transition(shape, std::string(in.text()));
+          if (!shape)
+            corrupt("record shape too large");
+        }
+        if (!filling)
+          objects[i] = allocate<Record>(shape);
+        auto rec = static_cast<Record *>(objects[i]);
+        uint32_t slot_count = in.word();
+        if (filling)
+          rec->slots.resize(slot_count);
+        for (uint32_t k = 0; k < slot_count; ++k) {
+          TaggedValue v = value(in);
+          if (filling)
+            rec->slots[k] = v;
+        }
+        uint32_t dense_count = in.word();
+        if (filling)
+          rec->dense.resize(dense_count);
+        for (uint32_t k = 0; k < dense_count; ++k) {
+          TaggedValue v = value(in, true);
+          if (filling)
+            rec->dense[k] = v;
+        }
+        uint32_t sparse_count = in.word();
+        for (uint32_t k = 0; k < sparse_count; ++k) {
+          auto index = static_cast<int32_t>(in.word());
+          TaggedValue v = value(in);
+          if (filling) {
+            if (index >= 0 && static_cast<uint32_t>(index) < dense_count)
+              corrupt("sparse element inside the dense prefix");
+            rec->sparse.insert(index) = v;
+          }
+        }
+        uint32_t entry_count = in.word();
+        for (uint32_t k = 0; k < entry_count; ++k) {
+          TaggedValue key = value(in);
+          TaggedValue v = value(in);
+          if (filling)
+            rec->fields.insert(key) = v;
+        }
+        break;
+      }
+      default:
+        corrupt("bad object type");
+      }
+    }
+  }
+
+  uint32_t global_count = in.word();
+  for (uint32_t i = 0; i < global_count; ++i) {
+    std::string name(in.text());
+    TaggedValue v = value(in);
+    globals[intern_global(name)] = v;
+  }
+  resume_registers.resize(register_count);
+  for (TaggedValue &reg : resume_registers)
+    reg = value(in);
+  std::string_view printed = in.text();
+  if (!in.at_end())
+    corrupt("trailing data");
+
+  resume_pc = pc;
+  resuming = true;
+  output.append(printed);
+}
+
+} // namespace vm
@@ -0,0 +1,311 @@
+#pragma once
+
+// Peephole pass over register code, run at the end of
+// VM::translate_stack_to_reg. Translation maps each stack instruction to one
+// register instruction, so common idioms cost several dispatches and pass
+// intermediate values through temporaries. This pass folds adjacent pairs
+// into superinstructions:
+//
+//   LoadConst t, <int k>; Add d, a, t       =>  AddImm d, a, k   (also Sub)
+//   Gt t, a, b; [Not u, t;] If t|u, off     =>  GtJump a, b, off (also Geq, Eq)
+//   <op> t, ...; StoreLocal l, t            =>  <op> l, ...
+//   Goto +1                                 =>  (removed)
+//   AddImm c, c, k; GtJump b, c, off        =>  IncJumpLt c, b, k, off
+//   Add c, c, s; GtJump b, c, off           =>  AddJumpLt c, b, s, off
+//
+// The typed forms (AddI, GtI, ...) fold the same way into the checked
+// AddImm and compare-jumps, which the interpreter quickens and the JIT
+// inlines; one kind check there is cheaper than a separate dispatch.
+//
+// The last two are the latch of a counted loop once the compiler has
+// rotated it (see induction.hpp): the counter's update and the loop test
+// then take one dispatch per iteration.
+//
+// Only temporaries (registers at or above first_temp) that are read exactly
+// once are folded away, and an instruction is never merged into its
+// predecessor when a branch lands on it.
+
+#include "bytecode/instructions.hpp"
+#include "bytecode/types.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace vm {
+
+namespace detail {
+
+// Calls f(reg) for every register `in` reads.
+template <typename F>
+inline void for_each_reg_read(const bytecode::RegisterInstruction &in, F &&f) {
+  using bytecode::Operation;
+  switch (in.op) {
+  case Operation::LoadConst:
+  case Operation::LoadFunc:
+  case Operation::LoadGlobal:
+  case Operation::PushReference:
+  case Operation::AllocRecord:
+  case Operation::Goto:
+  case Operation::Pop:
+  case Operation::End:
+    break;
+  case Operation::LoadLocal:
+  case Operation::StoreLocal:
+  case Operation::StoreGlobal:
+  case Operation::LoadReference:
+  case Operation::FieldLoad:
+  case Operation::FieldLoadSlot:
+  case Operation::Return:
+  case Operation::Neg:
+  case Operation::Not:
+  case Operation::If:
+  case Operation::Dup:
+  case Operation::AddImm:
+  case Operation::SubImm:
+  case Operation::CallGuard:
+  case Operation::LoadFreeRef:
+  case Operation::NewReference:
+    f(in.src1);
+    break;
+  case Operation::IncJumpLt:
+    f(in.dst);
+    f(in.src1);
+    break;
+  case Operation::AddJumpLt:
+    f(in.dst);
+    f(in.src1);
+    f(in.src2);
+    break;
+  case Operation::Swap:
+    f(in.dst);
+    f(in.src1);
+    break;
+  case Operation::IndexStore:
+    f(in.dst);
+    f(in.src1);
+    f(in.src2);
+    break;
+  case Operation::AllocClosure:
+    for (int32_t k = 0; k < in.imm; ++k) f(static_cast<uint16_t>(in.src1 + k));
+    f(in.src2);
+    break;
+  case Operation::Call:
+    f(in.src1);
+    for (int32_t k = 0; k < in.imm; ++k) f(static_cast<uint16_t>(in.src2 + k));
+    break;
+  default: // two-operand forms
+    f(in.src1);
+    f(in.src2);
+    break;
+  }
+}
+
+inline bool is_reg_branch(bytecode::Operation op) {
+  using bytecode::Operation;
+  return op == Operation::Goto || op == Operation::If ||
+         op == Operation::GtJump || op == Operation::GeqJump ||
+         op == Operation::EqJump || op == Operation::IncJumpLt ||
+         op == Operation::AddJumpLt || op == Operation::CallGuard;
+}
+
+// Ops whose only effect on registers is writing dst, after all their inputs
+// have been read, so the result can be written to its final home directly.
+inline bool writes_only_dst(bytecode::Operation op) {
+  using bytecode::Operation;
+  switch (op) {
+  case Operation::LoadConst:
+  case Operation::LoadFunc:
+  case Operation::LoadLocal:
+  case Operation::Dup:
+  case Operation::LoadGlobal:
+  case Operation::PushReference:
+  case Operation::LoadFreeRef:
+  case Operation::NewReference:
+  case Operation::LoadReference:
+  case Operation::AllocRecord:
+  case Operation::FieldLoad:
+  case Operation::FieldLoadSlot:
+  case Operation::IndexLoad:
+  case Operation::AllocClosure:
+  case Operation::Call:
+  case Operation::Add:
+  case Operation::Sub:
+  case Operation::Mul:
+  case Operation::Div:
+  case Operation::Neg:
+  case Operation::Gt:
+  case Operation::Geq:
+  case Operation::Eq:
+  case Operation::And:
+  case Operation::Or:
+  case Operation::Not:
+  case Operation::AddImm:
+  case Operation::SubImm:
+  case Operation::AddI:
+  case Operation::SubI:
+  case Operation::MulI:
+  case Operation::GtI:
+  case Operation::GeqI:
+  case Operation::EqI:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Shared driver for one rewriting sweep. `fuse(i, out)` either appends one
+// instruction standing for code[i..i+k) to `out` and returns k, or returns 0
+// to keep code[i] unchanged. A fused branch takes its target from the last
+// instruction it replaces.
+template <typename Fuse>
+inline void rewrite_reg_code(std::vector<bytecode::RegisterInstruction> &code,
+                             Fuse &&fuse) {
+  using bytecode::RegisterInstruction;
+  const size_t n = code.size();
+  std::vector<RegisterInstruction> out;
+  std::vector<size_t> origin; // old branch instruction behind each output
+  std::vector<size_t> new_index(n + 1, 0);
+  out.reserve(n);
+  origin.reserve(n);
+
+  for (size_t i = 0; i < n;) {
+    size_t consumed = fuse(i, out);
+    if (consumed == 0) {
+      out.push_back(code[i]);
+      consumed = 1;
+    }
+    if (out.size() > origin.size()) {
+      new_index[i] = out.size() - 1;
+      for (size_t k = 1; k < consumed; ++k) new_index[i + k] = out.size() - 1;
+      origin.push_back(i + consumed - 1);
+    } else {
+      // Dropped outright; anything jumping here lands on the next output.
+      for (size_t k = 0; k < consumed; ++k) new_index[i + k] = out.size();
+    }
+    i += consumed;
+  }
+  new_index[n] = out.size();
+
+  for (size_t k = 0; k < out.size(); ++k) {
+    if (!is_reg_branch(out[k].op)) continue;
+    size_t old_target = origin[k] + code[origin[k]].imm;
+    out[k].imm = static_cast<int32_t>(new_index[old_target]) -
+                 static_cast<int32_t>(k);
+  }
+  code = std::move(out);
+}
+
+} // namespace detail
+
+inline void fuse_superinstructions(
+    std::vector<bytecode::RegisterInstruction> &code,
+    const std::vector<bytecode::Constant *> &constants, uint16_t first_temp) {
+  using bytecode::Operation;
+  using bytecode::RegisterInstruction;
+
+  std::vector<uint32_t> reads;
+  std::vector<bool> is_target;
+  auto analyze = [&]() {
+    reads.assign(UINT16_MAX + 1, 0);
+    is_target.assign(code.size() + 1, false);
+    for (size_t i = 0; i < code.size(); ++i) {
+      detail::for_each_reg_read(code[i], [&](uint16_t r) { ++reads[r]; });
+      if (detail::is_reg_branch(code[i].op))
+        is_target[i + code[i].imm] = true;
+    }
+  };
+  // code[j] may be merged into its predecessor, eliminating temporary `reg`.
+  auto foldable = [&](size_t j, uint16_t reg) {
+    return j < code.size() && !is_target[j] && reg >= first_temp &&
+           reads[reg] == 1;
+  };
+
+  // Pass 1: immediate arithmetic, compare-and-branch, empty gotos.
+  analyze();
+  detail::rewrite_reg_code(code, [&](size_t i, std::vector<RegisterInstruction> &out) -> size_t {
+    const RegisterInstruction &in = code[i];
+    if (in.op == Operation::Goto && in.imm == 1)
+      return 1;
+
+    if (in.op == Operation::LoadConst && i + 1 < code.size()) {
+      const RegisterInstruction &next = code[i + 1];
+      auto *k = in.imm >= 0 && static_cast<size_t>(in.imm) < constants.size()
+                    ? dynamic_cast<bytecode::Constant::Integer *>(constants[in.imm])
+                    : nullptr;
+      bool add = next.op == Operation::Add || next.op == Operation::AddI;
+      bool sub = next.op == Operation::Sub || next.op == Operation::SubI;
+      if (k && (add || sub) &&
+          next.src2 == in.dst && next.src1 != in.dst && foldable(i + 1, in.dst)) {
+        Operation op = add ? Operation::AddImm : Operation::SubImm;
+        out.push_back({op, next.dst, next.src1, 0, k->value});
+        return 2;
+      }
+    }
+
+    Operation cmp = in.op == Operation::GtI    ? Operation::Gt
+                    : in.op == Operation::GeqI ? Operation::Geq
+                    : in.op == Operation::EqI  ? Operation::Eq
+                                               : in.op;
+    if (cmp == Operation::Gt || cmp == Operation::Geq || cmp == Operation::Eq) {
+      size_t j = i + 1;
+      uint16_t cond = in.dst;
+      uint16_t negate = 0;
+      if (j < code.size() && code[j].op == Operation::Not &&
+          code[j].src1 == cond && foldable(j, cond)) {
+        cond = code[j].dst;
+        negate = 1;
+        ++j;
+      }
+      if (j < code.size() && code[j].op == Operation::If &&
+          code[j].src1 == cond && foldable(j, cond)) {
+        Operation op = cmp == Operation::Gt    ? Operation::GtJump
+                       : cmp == Operation::Geq ? Operation::GeqJump
+                                               : Operation::EqJump;
+        out.push_back({op, negate, in.src1, in.src2, 0});
+        return j - i + 1;
+      }
+    }
+    return 0;
+  });
+
+  // Pass 2: write results straight into the local that stores them.
+  analyze();
+  detail::rewrite_reg_code(code, [&](size_t i, std::vector<RegisterInstruction> &out) -> size_t {
+    const RegisterInstruction &in = code[i];
+    if (!detail::writes_only_dst(in.op) || i + 1 >= code.size())
+      return 0;
+    const RegisterInstruction &next = code[i + 1];
+    if (next.op != Operation::StoreLocal || next.imm != 0 ||
+        next.src1 != in.dst || !foldable(i + 1, in.dst))
+      return 0;
+    RegisterInstruction merged = in;
+    merged.dst = next.dst;
+    out.push_back(merged);
+    return 2;
+  });
+
+  // Pass 3: counted-loop latches, now that the updates write their locals.
+  analyze();
+  detail::rewrite_reg_code(code, [&](size_t i, std::vector<RegisterInstruction> &out) -> size_t {
+    const RegisterInstruction &in = code[i];
+    if (i + 1 >= code.size() || is_target[i + 1])
+      return 0;
+    const RegisterInstruction &test = code[i + 1];
+    if (test.op != Operation::GtJump || test.dst != 0 || test.src2 != in.dst ||
+        test.src1 == in.dst)
+      return 0;
+    if (in.op == Operation::AddImm && in.src1 == in.dst &&
+        in.imm >= INT16_MIN && in.imm <= INT16_MAX) {
+      out.push_back({Operation::IncJumpLt, in.dst, test.src1,
+                     static_cast<uint16_t>(static_cast<int16_t>(in.imm)), 0});
+      return 2;
+    }
+    if ((in.op == Operation::Add || in.op == Operation::AddI) &&
+        in.src1 == in.dst) {
+      out.push_back({Operation::AddJumpLt, in.dst, test.src1, in.src2, 0});
+      return 2;
+    }
+    return 0;
+  });
+}
+
+} // namespace vm
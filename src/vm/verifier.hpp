@@ -0,0 +1,120 @@
+#pragma once
+
+// Load-time verification of register code, run once per function at the
+// end of VM::translate_stack_to_reg. It establishes the invariants that do
+// not depend on runtime values:
+//
+//   - every register an instruction reads or writes (including Call
+//     argument and AllocClosure capture ranges) is below register_count;
+//   - constant, function, global, name, field-cache, reference and inline
+//     target indices are in range for the function;
+//   - every branch lands inside the code, and the code ends with the End
+//     sentinel, so straight-line dispatch never runs off the end.
+//
+// Handlers in the interpreter loop and the JIT rely on these and only
+// re-check them in debug builds (see VM_CHECK_VERIFIED).
+
+#include "bytecode/instructions.hpp"
+#include "bytecode/types.hpp"
+#include "vm/superinstructions.hpp"
+#include <cstdint>
+
+namespace vm {
+
+// Returns nullptr if `func`'s register code is well formed, otherwise a
+// description of the first problem found.
+inline const char *verify_reg_code(const bytecode::Function &func,
+                                   size_t global_count) {
+  using bytecode::Operation;
+  const auto &code = func.reg_instructions;
+  const size_t n = code.size();
+  const size_t nregs = func.register_count;
+  const size_t nrefs = func.local_reference_vars_.size();
+
+  if (n == 0 || code[n - 1].op != Operation::End)
+    return "Verify: register code must end with End";
+  if (nregs < func.local_vars_.size() + nrefs)
+    return "Verify: register file smaller than the frame layout";
+
+  for (size_t i = 0; i < n; ++i) {
+    const bytecode::RegisterInstruction &in = code[i];
+
+    // Counted register ranges
+    if (in.op == Operation::Call || in.op == Operation::AllocClosure) {
+      uint16_t first = in.op == Operation::Call ? in.src2 : in.src1;
+      if (in.imm < 0 || first + static_cast<size_t>(in.imm) > nregs)
+        return "Verify: register range out of bounds";
+    }
+    bool regs_ok = true;
+    detail::for_each_reg_read(in, [&](uint16_t r) {
+      if (r >= nregs) regs_ok = false;
+    });
+    if (!regs_ok)
+      return "Verify: register index out of range";
+    if ((detail::writes_only_dst(in.op) || in.op == Operation::StoreLocal) &&
+        in.dst >= nregs)
+      return "Verify: register index out of range";
+
+    switch (in.op) {
+    case Operation::LoadConst:
+      if (in.imm < 0 || static_cast<size_t>(in.imm) >= func.constants_.size())
+        return "LoadConst: constant index out of range";
+      break;
+    case Operation::LoadFunc:
+      if (in.imm < 0 || static_cast<size_t>(in.imm) >= func.functions_.size())
+        return "LoadFunc: function index out of range";
+      break;
+    case Operation::LoadGlobal:
+    case Operation::StoreGlobal:
+      if (in.imm < 0 || static_cast<size_t>(in.imm) >= global_count)
+        return "Verify: global slot out of range";
+      break;
+    case Operation::StoreLocal:
+      // imm is the local's Reference slot + 1, or 0.
+      if (in.imm < 0 || static_cast<size_t>(in.imm) > nrefs ||
+          (in.imm > 0 && func.ref_registers[in.imm - 1] < 0))
+        return "StoreLocal: reference slot out of range";
+      break;
+    case Operation::PushReference:
+      if (in.imm < 0 ||
+          static_cast<size_t>(in.imm) >= nrefs + func.free_vars_.size())
+        return "PushReference: free variable index out of range";
+      break;
+    case Operation::CallGuard:
+      if (in.dst >= func.inline_targets.size())
+        return "CallGuard: inline target out of range";
+      break;
+    case Operation::FieldLoad:
+    case Operation::FieldStore: {
+      uint16_t site = in.op == Operation::FieldLoad ? in.src2 : in.dst;
+      if (site >= func.field_caches.size())
+        return "Verify: field cache index out of range";
+      if (in.imm < 0 || static_cast<size_t>(in.imm) >= func.names_.size())
+        return in.op == Operation::FieldLoad
+                   ? "FieldLoad: name index out of range"
+                   : "FieldStore: name index out of range";
+      break;
+    }
+    case Operation::FieldLoadSlot:
+    case Operation::FieldStoreSlot:
+      // The slot needs no check: the handlers fall back to the name when
+      // the record has no such slot.
+      if (in.imm < 0 || static_cast<size_t>(in.imm) >= func.names_.size())
+        return in.op == Operation::FieldLoadSlot
+                   ? "FieldLoad: name index out of range"
+                   : "FieldStore: name index out of range";
+      break;
+    default:
+      break;
+    }
+
+    if (detail::is_reg_branch(in.op)) {
+      int64_t target = static_cast<int64_t>(i) + in.imm;
+      if (target < 0 || target >= static_cast<int64_t>(n))
+        return "Verify: branch target out of range";
+    }
+  }
+  return nullptr;
+}
+
+} // namespace vm